@@ -4,6 +4,14 @@
  * This file is the main application file that initializes and starts the various
  * modules and then runs the super loop.
  *
+ * The init and start phase of each module is timed with the cycle counter, and
+ * a summary is printed at the end of boot (see "main boot" for details). In
+ * fast-start mode (CONFIG_MAIN_FAST_START), the start of modules flagged with
+ * defer_start, which bring up slow external hardware, is instead done from the
+ * super loop, one module per pass, so the console, watchdog, and motion
+ * control are live sooner after reset. A deferred module's run function is not
+ * called until it has been started.
+ *
  * MIT License
  * 
  * Copyright (c) 2021 Eugene R Schroeder
@@ -34,7 +42,9 @@
 #include "config.h"
 #include CONFIG_STM32_LL_RCC_HDR // Needed for IDE bug (see below).
 
+#include "bench.h"
 #include "blinky.h"
+#include "can.h"
 #include "cmd.h"
 #include "console.h"
 #include "dio.h"
@@ -44,13 +54,16 @@
 #include "float.h"
 #include "gps_gtu7.h"
 #include "i2c.h"
+#include "istat.h"
 #include "log.h"
 #include "lwl.h"
 #include "mem.h"
 #include "module.h"
 #include "os.h"
+#include "sched.h"
 #include "stat.h"
 #include "step.h"
+#include "telem.h"
 #include "tmphm.h"
 #include "ttys.h"
 #include "tmr.h"
@@ -94,6 +107,22 @@ struct mod_info {
         } multi_instance;
     } ops;
     void* cfg_obj;
+    uint8_t sched_prio;  // Priority of run function, higher runs first.
+    bool defer_start;    // Start from the super loop in fast-start mode.
+};
+
+// Boot time profile of a module.
+struct mod_boot_prof {
+    uint32_t init_cyc;   // Get default config and init.
+    uint32_t start_cyc;
+    bool start_pending;  // Start deferred, and not yet done.
+};
+
+// Run time profile of a module, measured around each call of its run function.
+struct mod_run_prof {
+    uint64_t total_cyc;
+    uint32_t max_cyc;
+    uint32_t calls;
 };
 
 enum main_u16_pms {
@@ -108,7 +137,14 @@ enum main_u16_pms {
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
+static void mod_start_call(int32_t mod_idx);
+static int32_t mod_task(int32_t mod_idx);
+static int32_t start_task(int32_t arg);
+static void sched_setup(void);
+static void boot_report(uint32_t boot_cyc);
 static int32_t cmd_main_status();
+static int32_t cmd_main_prof(int32_t argc, const char** argv);
+static int32_t cmd_main_boot(int32_t argc, const char** argv);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -122,6 +158,16 @@ static struct cmd_cmd_info cmds[] = {
         .func = cmd_main_status,
         .help = "Get main status, usage: main status [clear]",
     },
+    {
+        .name = "prof",
+        .func = cmd_main_prof,
+        .help = "Get module run time profile, usage: main prof [clear]",
+    },
+    {
+        .name = "boot",
+        .func = cmd_main_boot,
+        .help = "Get module boot time profile, usage: main boot",
+    },
 };
 
 static uint16_t cnts_u16[NUM_U16_PMS];
@@ -233,6 +279,7 @@ static struct dio_in_info d_inputs[DIN_NUM] = {
         .port = DIO_PORT_B,
         .pin = DIO_PIN_3,
         .pull = DIO_PULL_NO,
+        .edge = DIO_EDGE_RISING,
     }
 };
 
@@ -267,7 +314,7 @@ static struct dio_cfg dio_cfg = {
     .outputs = d_outputs,
 };
 
-static struct stat_dur stat_loop_dur;
+static struct stat_cyc_dur stat_loop_dur;
 
     struct console_cfg console_cfg;
 
@@ -303,6 +350,10 @@ static struct stat_dur stat_loop_dur;
     static struct tmphm_cfg tmphm_cfg;
 #endif
 
+#if CONFIG_TMPHM_2_PRESENT
+    static struct tmphm_cfg tmphm_cfg_2;
+#endif
+
 #if CONFIG_STEP_1_PRESENT
     static struct step_cfg step_cfg_1;
 #endif
@@ -315,6 +366,10 @@ static struct stat_dur stat_loop_dur;
     static struct draw_cfg draw_cfg;
 #endif
 
+#if CONFIG_CAN_1_PRESENT
+    static struct can_cfg can_cfg_1;
+#endif
+
 static struct mod_info mods[] = {
 
 #if CONFIG_TTYS_1_PRESENT
@@ -367,6 +422,7 @@ static struct mod_info mods[] = {
         .name = "flash",
         .instance = MOD_NO_INSTANCE,
         .ops.singleton.mod_start = (mod_start)flash_start,
+        .ops.singleton.mod_run = (mod_run)flash_run,
     },
 #endif
 
@@ -375,6 +431,7 @@ static struct mod_info mods[] = {
         .name = "lwl",
         .instance = MOD_NO_INSTANCE,
         .ops.singleton.mod_start = (mod_start)lwl_start,
+        .ops.singleton.mod_run = (mod_run)lwl_run,
     },
 #endif
 
@@ -397,8 +454,16 @@ static struct mod_info mods[] = {
         .instance = MOD_NO_INSTANCE,
         .ops.singleton.mod_get_def_cfg = (mod_get_def_cfg)console_get_def_cfg,
         .ops.singleton.mod_init = (mod_init)console_init,
+        .ops.singleton.mod_start = (mod_start)console_start,
         .ops.singleton.mod_run = (mod_run)console_run,
         .cfg_obj = &console_cfg,
+        .sched_prio = 1,
+    },
+    {
+        .name = "log",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)log_start,
+        .ops.singleton.mod_run = (mod_run)log_run,
     },
     {
         .name = "tmr",
@@ -406,7 +471,41 @@ static struct mod_info mods[] = {
         .ops.singleton.mod_init = (mod_init)tmr_init,
         .ops.singleton.mod_start = (mod_start)tmr_start,
         .ops.singleton.mod_run = (mod_run)tmr_run,
+        .sched_prio = 3,
+    },
+    {
+        .name = "sched",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)sched_start,
     },
+
+#if CONFIG_BENCH_PRESENT
+    {
+        .name = "bench",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)bench_start,
+    },
+#endif
+
+#if CONFIG_TELEM_PRESENT
+    {
+        .name = "telem",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_init = (mod_init)telem_init,
+        .ops.singleton.mod_start = (mod_start)telem_start,
+        .ops.singleton.mod_run = (mod_run)telem_run,
+    },
+#endif
+
+#if CONFIG_ISTAT_PRESENT
+    {
+        .name = "istat",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_init = (mod_init)istat_init,
+        .ops.singleton.mod_start = (mod_start)istat_start,
+    },
+#endif
+
     {
         .name = "blinky",
         .instance = MOD_NO_INSTANCE,
@@ -431,6 +530,8 @@ static struct mod_info mods[] = {
         .ops.singleton.mod_start = (mod_start)gps_start,
         .ops.singleton.mod_run = (mod_run)gps_run,
         .cfg_obj = &gps_cfg,
+        .sched_prio = 2,
+        .defer_start = true,
     },
 #endif
 
@@ -442,6 +543,7 @@ static struct mod_info mods[] = {
         .ops.singleton.mod_init = (mod_init)i2c_init,
         .ops.singleton.mod_start = (mod_start)i2c_start,
         .cfg_obj = &i2c_cfg,
+        .defer_start = true,
     },
 #endif
 
@@ -454,6 +556,20 @@ static struct mod_info mods[] = {
         .ops.singleton.mod_start = (mod_start)tmphm_start,
         .ops.singleton.mod_run = (mod_run)tmphm_run,
         .cfg_obj = &tmphm_cfg,
+        .defer_start = true,
+    },
+#endif
+
+#if CONFIG_TMPHM_2_PRESENT
+    {
+        .name = "tmphm",
+        .instance = TMPHM_INSTANCE_2,
+        .ops.singleton.mod_get_def_cfg = (mod_get_def_cfg)tmphm_get_def_cfg,
+        .ops.singleton.mod_init = (mod_init)tmphm_init,
+        .ops.singleton.mod_start = (mod_start)tmphm_start,
+        .ops.singleton.mod_run = (mod_run)tmphm_run,
+        .cfg_obj = &tmphm_cfg_2,
+        .defer_start = true,
     },
 #endif
 
@@ -494,6 +610,20 @@ static struct mod_info mods[] = {
     },
 #endif
 
+#if CONFIG_CAN_1_PRESENT
+    {
+        .name = "can",
+        .instance = CAN_INSTANCE_1,
+        .ops.multi_instance.mod_get_def_cfg =
+            (mod_instance_get_def_cfg)can_get_def_cfg,
+        .ops.multi_instance.mod_init = (mod_instance_init)can_init,
+        .ops.multi_instance.mod_start = (mod_instance_start)can_start,
+        .ops.multi_instance.mod_run = (mod_instance_run)can_run,
+        .cfg_obj = &can_cfg_1,
+        .defer_start = true,
+    },
+#endif
+
 #if CONFIG_FLOAT_PRESENT
     {
         .name = "float",
@@ -520,6 +650,17 @@ static struct mod_info mods[] = {
 
 };
 
+static struct mod_run_prof mod_run_profs[ARRAY_SIZE(mods)];
+
+static struct mod_boot_prof mod_boot_profs[ARRAY_SIZE(mods)];
+
+// Sched task for deferred module starts, and the next module to check.
+static int32_t start_task_id = SCHED_NO_TASK;
+static int32_t start_next_idx;
+
+// Sched task ID for each module's run function (or SCHED_NO_TASK).
+static int32_t mod_task_ids[ARRAY_SIZE(mods)];
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -534,12 +675,18 @@ void app_main(void)
     int32_t rc;
     int32_t idx;
     struct mod_info* mod;
+    uint32_t boot_start_cyc;
+    uint32_t start_cyc;
 
 #if defined STM32L452xx
     // Fix for bug in IDE generated code.
     LL_RCC_HSI_SetCalibTrimming(64);
 #endif
 
+    // This also enables the cycle counter, used for the boot time profile.
+    stat_cyc_dur_init(&stat_loop_dur);
+    boot_start_cyc = stat_cyc_get();
+
 #if CONFIG_FAULT_PRESENT
     wdg_start_init_hdw_wdg();
 #endif
@@ -560,12 +707,14 @@ void app_main(void)
          idx++, mod++) {
         if (mod->ops.singleton.mod_get_def_cfg != NULL &&
             mod->cfg_obj != NULL) {
+            start_cyc = stat_cyc_get();
             if (mod->instance == MOD_NO_INSTANCE) {
                 rc = mod->ops.singleton.mod_get_def_cfg(mod->cfg_obj);
             } else {
                 rc = mod->ops.multi_instance.mod_get_def_cfg(mod->instance,
                                                              mod->cfg_obj);
             }
+            mod_boot_profs[idx].init_cyc += stat_cyc_get() - start_cyc;
             if (rc < 0) {
                 log_error("Default cfg error for %s[%d]: %d\n", mod->name,
                           mod->instance, rc);
@@ -582,12 +731,14 @@ void app_main(void)
          idx < ARRAY_SIZE(mods);
          idx++, mod++) {
         if (mod->ops.singleton.mod_init != NULL) {
+            start_cyc = stat_cyc_get();
             if (mod->instance == MOD_NO_INSTANCE) {
                 rc = mod->ops.singleton.mod_init(mod->cfg_obj);
             } else {
                 rc = mod->ops.multi_instance.mod_init(mod->instance,
                                                       mod->cfg_obj);
             }
+            mod_boot_profs[idx].init_cyc += stat_cyc_get() - start_cyc;
             if (rc < 0) {
                 log_error("Init error for %s[%d]: %d\n", mod->name,
                           mod->instance, rc);
@@ -605,18 +756,12 @@ void app_main(void)
     for (idx = 0, mod = mods;
          idx < ARRAY_SIZE(mods);
          idx++, mod++) {
-        if (mod->ops.singleton.mod_start != NULL) {
-            if (mod->instance == MOD_NO_INSTANCE) {
-                rc = mod->ops.singleton.mod_start();
-            } else {
-                rc = mod->ops.multi_instance.mod_start(mod->instance);
-            }
-            if (rc < 0) {
-                log_error("Start error for %s: %d\n", mods->name, rc);
-                INC_SAT_U16(cnts_u16[CNT_START_ERR]);
-            }
-        }
-                
+        if (mod->ops.singleton.mod_start == NULL)
+            continue;
+        if (CONFIG_MAIN_FAST_START && mod->defer_start)
+            mod_boot_profs[idx].start_pending = true;
+        else
+            mod_start_call(idx);
     }
 
     rc = cmd_register(&cmd_info);
@@ -625,10 +770,19 @@ void app_main(void)
         INC_SAT_U16(cnts_u16[CNT_START_ERR]);
     }
 
-    stat_dur_init(&stat_loop_dur);
+#if CONFIG_TELEM_PRESENT
+    rc = telem_register_cyc_dur("loop", &stat_loop_dur);
+    if (rc < 0) {
+        log_error("main: telem_register_cyc_dur error %d\n", rc);
+        INC_SAT_U16(cnts_u16[CNT_START_ERR]);
+    }
+#endif
+
+    sched_setup();
 
     //
-    // In the super loop invoke the run API on modules the use it.
+    // In the super loop run the ready module tasks, then sleep until there is
+    // more to do.
     //
 
 #if CONFIG_FAULT_PRESENT
@@ -640,26 +794,24 @@ void app_main(void)
     }
 #endif
 
+#if CONFIG_OS_FREERTOS
+    printc("Init: Start kernel\n");
+    rc = os_sched_start();
+    log_error("main: os_sched_start error %d\n", rc);
+#endif
+
+    boot_report(stat_cyc_get() - boot_start_cyc);
     printc("Init: Enter super loop\n");
     while (1)
     {
-        stat_dur_restart(&stat_loop_dur);
-
-        for (idx = 0, mod = mods;
-             idx < ARRAY_SIZE(mods);
-             idx++, mod++) {
-            if (mod->ops.singleton.mod_run != NULL) {
-                if (mod->instance == MOD_NO_INSTANCE) {
-                    rc = mod->ops.singleton.mod_run();
-                } else {
-                    rc = mod->ops.multi_instance.mod_run(mod->instance);
-                }
-                if (rc < 0) {
-                    log_error("Run error for %s: %d\n", mods->name, rc);
-                    INC_SAT_U16(cnts_u16[CNT_RUN_ERR]);
-                }
-            }
-        }
+        // Only the work in a pass is timed, not the idle sleep.
+        stat_cyc_dur_start(&stat_loop_dur);
+        sched_run();
+        stat_cyc_dur_end(&stat_loop_dur);
+
+        // Sleep until a task is posted, the next timer deadline, or other
+        // interrupt.
+        sched_idle();
     }
 }
 
@@ -667,6 +819,183 @@ void app_main(void)
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
 
+/*
+ * @brief Call a module's start function.
+ *
+ * @param[in] mod_idx Index of the module in mods[].
+ *
+ * The start function call is profiled (see "main boot").
+ */
+static void mod_start_call(int32_t mod_idx)
+{
+    struct mod_info* mod = &mods[mod_idx];
+    uint32_t start_cyc = stat_cyc_get();
+    int32_t rc;
+
+    if (mod->instance == MOD_NO_INSTANCE) {
+        rc = mod->ops.singleton.mod_start();
+    } else {
+        rc = mod->ops.multi_instance.mod_start(mod->instance);
+    }
+    mod_boot_profs[mod_idx].start_cyc = stat_cyc_get() - start_cyc;
+    mod_boot_profs[mod_idx].start_pending = false;
+
+    if (rc < 0) {
+        log_error("Start error for %s[%d]: %d\n", mod->name, mod->instance,
+                  rc);
+        INC_SAT_U16(cnts_u16[CNT_START_ERR]);
+    }
+}
+
+/*
+ * @brief Sched task function that runs a module's run function.
+ *
+ * @param[in] mod_idx Index of the module in mods[].
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The run function call is profiled (see "main prof").
+ */
+static int32_t mod_task(int32_t mod_idx)
+{
+    struct mod_info* mod = &mods[mod_idx];
+    struct mod_run_prof* prof = &mod_run_profs[mod_idx];
+    uint32_t start_cyc;
+    uint32_t dur_cyc;
+    int32_t rc;
+
+    // A module with a deferred start doesn't run until it is started.
+    if (mod_boot_profs[mod_idx].start_pending)
+        return 0;
+
+    start_cyc = stat_cyc_get();
+    if (mod->instance == MOD_NO_INSTANCE) {
+        rc = mod->ops.singleton.mod_run();
+    } else {
+        rc = mod->ops.multi_instance.mod_run(mod->instance);
+    }
+
+    dur_cyc = stat_cyc_get() - start_cyc;
+    prof->total_cyc += dur_cyc;
+    prof->calls++;
+    if (dur_cyc > prof->max_cyc)
+        prof->max_cyc = dur_cyc;
+
+    if (rc < 0) {
+        log_error("Run error for %s: %d\n", mod->name, rc);
+        INC_SAT_U16(cnts_u16[CNT_RUN_ERR]);
+    }
+    return rc;
+}
+
+/*
+ * @brief Sched task function that does deferred module starts.
+ *
+ * @param[in] arg Not used.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * One module is started per call, in mods[] order, so dependencies between
+ * modules (e.g. tmphm on i2c) are handled as for a normal boot. When all are
+ * started, the task stops polling, and so never runs again.
+ */
+static int32_t start_task(int32_t arg)
+{
+    while (start_next_idx < ARRAY_SIZE(mods)) {
+        if (mod_boot_profs[start_next_idx].start_pending) {
+            mod_start_call(start_next_idx++);
+            return 0;
+        }
+        start_next_idx++;
+    }
+    printc("Init: Deferred starts done\n");
+    sched_task_set_poll(start_task_id, false);
+    return 0;
+}
+
+/*
+ * @brief Add sched tasks for the module run functions.
+ *
+ * All tasks start out polled (run on every super loop pass). Then tasks whose
+ * work is signalled by an interrupt are switched to event driven, once the
+ * event source is hooked up.
+ */
+static void sched_setup(void)
+{
+    int32_t idx;
+    struct mod_info* mod;
+    bool start_pending = false;
+
+    for (idx = 0, mod = mods;
+         idx < ARRAY_SIZE(mods);
+         idx++, mod++) {
+        if (mod_boot_profs[idx].start_pending)
+            start_pending = true;
+        mod_task_ids[idx] = SCHED_NO_TASK;
+        if (mod->ops.singleton.mod_run != NULL) {
+            mod_task_ids[idx] = sched_task_add(mod->name, mod_task, idx,
+                                               mod->sched_prio, true);
+            if (mod_task_ids[idx] < 0) {
+                log_error("main: sched_task_add error %d for %s\n",
+                          mod_task_ids[idx], mod->name);
+                INC_SAT_U16(cnts_u16[CNT_START_ERR]);
+            }
+        }
+
+#if CONFIG_GPS_PRESENT
+        // The GPS module only has work to do when characters are received.
+        if (mod->cfg_obj == &gps_cfg && mod_task_ids[idx] >= 0 &&
+            ttys_set_rx_task(gps_cfg.ttys_instance_id, mod_task_ids[idx]) == 0)
+            sched_task_set_poll(mod_task_ids[idx], false);
+#endif
+    }
+
+    if (start_pending) {
+        start_task_id = sched_task_add("start", start_task, 0, 0, true);
+        if (start_task_id < 0) {
+            log_error("main: sched_task_add error %d for start\n",
+                      start_task_id);
+            INC_SAT_U16(cnts_u16[CNT_START_ERR]);
+        }
+    }
+}
+
+/*
+ * @brief Print a summary of the boot time profile.
+ *
+ * @param[in] boot_cyc Cycles from the start of app_main() to the super loop.
+ */
+static void boot_report(uint32_t boot_cyc)
+{
+    uint32_t init_cyc = 0;
+    uint32_t start_cyc = 0;
+    uint32_t num_deferred = 0;
+    int32_t slow_idx = -1;
+    uint32_t idx;
+
+    for (idx = 0; idx < ARRAY_SIZE(mods); idx++) {
+        struct mod_boot_prof* prof = &mod_boot_profs[idx];
+
+        init_cyc += prof->init_cyc;
+        start_cyc += prof->start_cyc;
+        if (prof->start_pending)
+            num_deferred++;
+        if (slow_idx < 0 ||
+            prof->init_cyc + prof->start_cyc >
+            mod_boot_profs[slow_idx].init_cyc +
+            mod_boot_profs[slow_idx].start_cyc)
+            slow_idx = idx;
+    }
+    printc("Init: Boot took %lu us (init %lu us, start %lu us), %lu deferred\n",
+           stat_cyc_to_us64(boot_cyc), stat_cyc_to_us64(init_cyc),
+           stat_cyc_to_us64(start_cyc), num_deferred);
+    if (slow_idx >= 0)
+        printc("Init: Slowest module %s[%d] %lu us (see \"main boot\")\n",
+               mods[slow_idx].name, mods[slow_idx].instance,
+               stat_cyc_to_us64(mod_boot_profs[slow_idx].init_cyc +
+                                mod_boot_profs[slow_idx].start_cyc));
+}
+
 /*
  * @brief Console command function for "main status".
  *
@@ -696,13 +1025,117 @@ static int32_t cmd_main_status(int32_t argc, const char** argv)
         return MOD_ERR_ARG;
     }
 
-    printc("Super loop samples=%lu min=%lu ms, max=%lu ms, avg=%lu us\n",
-           stat_loop_dur.samples, stat_loop_dur.min, stat_loop_dur.max,
-           stat_dur_avg_us(&stat_loop_dur));
+    printc("Super loop samples=%lu min=%lu ns, max=%lu ns, avg=%lu ns\n",
+           stat_loop_dur.samples, stat_cyc_to_ns(stat_loop_dur.min),
+           stat_cyc_to_ns(stat_loop_dur.max),
+           stat_cyc_dur_avg_ns(&stat_loop_dur));
+    printc("Super loop p50=%lu ns, p99=%lu ns, p999=%lu ns\n",
+           stat_cyc_dur_pctl_ns(&stat_loop_dur, 5000),
+           stat_cyc_dur_pctl_ns(&stat_loop_dur, 9900),
+           stat_cyc_dur_pctl_ns(&stat_loop_dur, 9990));
 
     if (clear) {
         printc("Clearing loop stat\n");
-        stat_dur_init(&stat_loop_dur);
+        stat_cyc_dur_init(&stat_loop_dur);
+    }
+    return 0;
+}
+
+/*
+ * @brief Console command function for "main prof".
+ *
+ * @param[in] argc Number of arguments, including "main"
+ * @param[in] argv Argument values, including "main"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: main prof [clear]
+ *
+ * Modules are listed in order of total run time consumed.
+ */
+static int32_t cmd_main_prof(int32_t argc, const char** argv)
+{
+    uint8_t order[ARRAY_SIZE(mods)];
+    uint64_t all_cyc = 0;
+    uint32_t idx;
+    uint32_t idx2;
+
+    if (argc > 3 || (argc == 3 && strcasecmp(argv[2], "clear") != 0)) {
+        printc("Invalid arguments\n");
+        return MOD_ERR_ARG;
+    }
+
+    // Insertion sort of module indices, by decreasing total time.
+    for (idx = 0; idx < ARRAY_SIZE(mods); idx++) {
+        uint64_t total_cyc = mod_run_profs[idx].total_cyc;
+        all_cyc += total_cyc;
+        for (idx2 = idx;
+             idx2 > 0 && mod_run_profs[order[idx2 - 1]].total_cyc < total_cyc;
+             idx2--)
+            order[idx2] = order[idx2 - 1];
+        order[idx2] = idx;
+    }
+
+    printc("Module   Inst    Calls     Total us   Pct   Avg ns     Max ns\n"
+           "-------- ---- ---------- ---------- ----- ---------- ----------\n");
+    for (idx = 0; idx < ARRAY_SIZE(mods); idx++) {
+        struct mod_info* mod = &mods[order[idx]];
+        struct mod_run_prof* prof = &mod_run_profs[order[idx]];
+
+        if (mod->ops.singleton.mod_run == NULL)
+            continue;
+        printc("%-8s %4d %10lu %10lu %3lu.%lu %10lu %10lu\n",
+               mod->name, mod->instance == MOD_NO_INSTANCE ? 0 : mod->instance,
+               prof->calls, stat_cyc_to_us64(prof->total_cyc),
+               all_cyc == 0 ? 0 : (uint32_t)(prof->total_cyc * 100 / all_cyc),
+               all_cyc == 0 ? 0 :
+               (uint32_t)((prof->total_cyc * 1000 / all_cyc) % 10),
+               prof->calls == 0 ? 0 :
+               stat_cyc_to_ns(prof->total_cyc / prof->calls),
+               stat_cyc_to_ns(prof->max_cyc));
+    }
+
+    if (argc == 3) {
+        printc("Clearing profile\n");
+        memset(mod_run_profs, 0, sizeof(mod_run_profs));
+    }
+    return 0;
+}
+
+/*
+ * @brief Console command function for "main boot".
+ *
+ * @param[in] argc Number of arguments, including "main"
+ * @param[in] argv Argument values, including "main"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: main boot
+ *
+ * Deferred starts are shown with a "D" (or "P" if still pending).
+ */
+static int32_t cmd_main_boot(int32_t argc, const char** argv)
+{
+    uint32_t idx;
+
+    if (argc != 2) {
+        printc("Invalid arguments\n");
+        return MOD_ERR_ARG;
+    }
+
+    printc("Module   Inst  Init us   Start us  Def\n"
+           "-------- ---- ---------- ---------- ---\n");
+    for (idx = 0; idx < ARRAY_SIZE(mods); idx++) {
+        struct mod_info* mod = &mods[idx];
+        struct mod_boot_prof* prof = &mod_boot_profs[idx];
+        bool deferred = CONFIG_MAIN_FAST_START && mod->defer_start &&
+            mod->ops.singleton.mod_start != NULL;
+
+        printc("%-8s %4d %10lu %10lu  %c\n",
+               mod->name, mod->instance == MOD_NO_INSTANCE ? 0 : mod->instance,
+               stat_cyc_to_us64(prof->init_cyc),
+               stat_cyc_to_us64(prof->start_cyc),
+               prof->start_pending ? 'P' : deferred ? 'D' : ' ');
     }
     return 0;
 }
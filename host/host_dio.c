@@ -0,0 +1,716 @@
+/*
+ * @brief Host (x86/Linux) implementation of the dio module API.
+ *
+ * This file replaces modules/dio/dio.c in the host build (see host_main.c).
+ * The GPIO ports are simulated by plain variables (see host_hal.h), with one
+ * input data register (IDR) and one output data register (ODR) per port.
+ *
+ * Inputs are driven from the console with "dio sim", which also captures an
+ * edge if the input is configured for edge capture, as the EXTI interrupt
+ * handler would.
+ *
+ * The following console commands are provided:
+ * > dio status
+ * > dio get
+ * > dio set
+ * > dio edge
+ * > dio sim
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_GPIO_HDR
+
+#include "cmd.h"
+#include "console.h"
+#include "dio.h"
+#include "log.h"
+#include "module.h"
+#include "tmr.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define EDGE_RING_MASK (CONFIG_DIO_EDGE_RING_SIZE - 1)
+
+#if (CONFIG_DIO_EDGE_RING_SIZE & EDGE_RING_MASK) != 0
+    #error CONFIG_DIO_EDGE_RING_SIZE must be a power of 2
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+enum dio_u16_pms {
+    CNT_EDGE,
+    CNT_EDGE_OVERRUN,
+
+    NUM_U16_PMS
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t find_input(const char* name);
+static int32_t find_output(const char* name);
+static void edge_capture(uint32_t din_idx);
+
+static int32_t cmd_dio_status(int32_t argc, const char** argv);
+static int32_t cmd_dio_get(int32_t argc, const char** argv);
+static int32_t cmd_dio_set(int32_t argc, const char** argv);
+static int32_t cmd_dio_edge(int32_t argc, const char** argv);
+static int32_t cmd_dio_sim(int32_t argc, const char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static struct dio_cfg* cfg;
+
+static struct dio_edge_event edge_ring[CONFIG_DIO_EDGE_RING_SIZE];
+static volatile uint32_t edge_put_ctr;
+static volatile uint32_t edge_get_ctr;
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "edge",
+    "edge overrun",
+};
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "status",
+        .func = cmd_dio_status,
+        .help = "Get module status, usage: dio status",
+    },
+    {
+        .name = "get",
+        .func = cmd_dio_get,
+        .help = "Get input value, usage: dio get <input-name>",
+    },
+    {
+        .name = "set",
+        .func = cmd_dio_set,
+        .help = "Set output value, usage: dio set <output-name> {0|1}",
+    },
+    {
+        .name = "edge",
+        .func = cmd_dio_edge,
+        .help = "Read (and remove) captured edges, usage: dio edge",
+    },
+    {
+        .name = "sim",
+        .func = cmd_dio_sim,
+        .help = "Drive simulated input, usage: dio sim <input-name> {0|1}",
+    },
+};
+
+static int32_t log_level = LOG_DEFAULT;
+
+static struct cmd_client_info cmd_info = {
+    .name = "dio",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Initialize dio module instance.
+ *
+ * @param[in] cfg The dio configuration.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Inputs start out inactive (i.e. at the inverted level if inverted), and
+ * outputs at their initial value.
+ */
+int32_t dio_init(struct dio_cfg* _cfg)
+{
+    uint32_t idx;
+    const struct dio_in_info* dii;
+    const struct dio_out_info* doi;
+
+    cfg = _cfg;
+
+    for (idx = 0; idx < cfg->num_inputs; idx++) {
+        dii = &cfg->inputs[idx];
+        if (dii->invert)
+            dii->port->IDR |= dii->pin;
+        else
+            dii->port->IDR &= ~dii->pin;
+    }
+    for (idx = 0; idx < cfg->num_outputs; idx++) {
+        doi = &cfg->outputs[idx];
+        dio_set(idx, doi->init_value > 0 ? 1 : 0);
+    }
+    return 0;
+}
+
+/*
+ * @brief Start dio module instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_start(void)
+{
+    int32_t result;
+
+    result = cmd_register(&cmd_info);
+    if (result < 0) {
+        log_error("dio_start: cmd error %d\n", result);
+        return result;
+    }
+    return 0;
+}
+
+/*
+ * @brief Get value of discrete input.
+ *
+ * @param[in] din_idx Discrete input index per module configuration.
+ *
+ * @return Input state (0/1), else a "MOD_ERR" value (< 0). See code for
+ *         details.
+ */
+int32_t dio_get(uint32_t din_idx)
+{
+    if (din_idx >= cfg->num_inputs)
+        return MOD_ERR_ARG;
+    return ((cfg->inputs[din_idx].port->IDR & cfg->inputs[din_idx].pin) != 0) ^
+        cfg->inputs[din_idx].invert;
+}
+
+/*
+ * @brief Get value of discrete output.
+ *
+ * @param[in] dout_idx Discrete output index per module configuration.
+ *
+ * @return Output state (0/1), else a "MOD_ERR" value (< 0). See code for
+ *         details.
+ */
+int32_t dio_get_out(uint32_t dout_idx)
+{
+    if (dout_idx >= cfg->num_outputs)
+        return MOD_ERR_ARG;
+    return ((cfg->outputs[dout_idx].port->ODR &
+             cfg->outputs[dout_idx].pin) != 0) ^
+        cfg->outputs[dout_idx].invert;
+}
+
+/*
+ * @brief Set value of discrete output.
+ *
+ * @param[in] dout_idx Discrete output index per module configuration.
+ * @param[in] value Output value 0/1.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_set(uint32_t dout_idx, uint32_t value)
+{
+    if (dout_idx >= cfg->num_outputs)
+        return MOD_ERR_ARG;
+    if (value ^ cfg->outputs[dout_idx].invert)
+        return dio_set_outputs(cfg->outputs[dout_idx].port,
+                               cfg->outputs[dout_idx].pin);
+    return dio_reset_outputs(cfg->outputs[dout_idx].port,
+                             cfg->outputs[dout_idx].pin);
+}
+
+/*
+ * @brief Get number of discrete inputs.
+ *
+ * @return Return number of inputs (non-negative) for success, else a "MOD_ERR"
+ *         value. See code for details.
+ */
+int32_t dio_get_num_in(void)
+{
+    return cfg == NULL ? MOD_ERR_RESOURCE : cfg->num_inputs;
+}
+
+/*
+ * @brief Get number of discrete output.
+ *
+ * @return Return number of outputs (non-negative) for success, else a "MOD_ERR"
+ *         value. See code for details.
+ */
+int32_t dio_get_num_out(void)
+{
+    return cfg == NULL ? MOD_ERR_RESOURCE : cfg->num_outputs;
+}
+
+/*
+ * @brief Set up a group of inputs or outputs.
+ *
+ * @param[out] grp The group.
+ * @param[in] outputs True for a group of outputs, false for inputs.
+ * @param[in] idxs Input/output indexes per module configuration.
+ * @param[in] num_pins Number of entries in idxs (max DIO_GROUP_MAX_PINS).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_group_init(struct dio_group* grp, bool outputs,
+                       const uint32_t* idxs, uint32_t num_pins)
+{
+    uint32_t idx;
+    uint32_t port_idx;
+    dio_port* port;
+    uint32_t pin;
+    uint8_t invert;
+
+    if (grp == NULL || idxs == NULL || cfg == NULL ||
+        num_pins > DIO_GROUP_MAX_PINS)
+        return MOD_ERR_ARG;
+
+    memset(grp, 0, sizeof(*grp));
+    grp->outputs = outputs;
+    for (idx = 0; idx < num_pins; idx++) {
+        if (outputs) {
+            if (idxs[idx] >= cfg->num_outputs)
+                return MOD_ERR_ARG;
+            port = cfg->outputs[idxs[idx]].port;
+            pin = cfg->outputs[idxs[idx]].pin;
+            invert = cfg->outputs[idxs[idx]].invert;
+        } else {
+            if (idxs[idx] >= cfg->num_inputs)
+                return MOD_ERR_ARG;
+            port = cfg->inputs[idxs[idx]].port;
+            pin = cfg->inputs[idxs[idx]].pin;
+            invert = cfg->inputs[idxs[idx]].invert;
+        }
+        for (port_idx = 0; port_idx < grp->num_ports; port_idx++) {
+            if (grp->ports[port_idx] == port)
+                break;
+        }
+        if (port_idx == grp->num_ports) {
+            if (grp->num_ports >= DIO_GROUP_MAX_PORTS)
+                return MOD_ERR_RESOURCE;
+            grp->ports[grp->num_ports++] = port;
+        }
+        grp->pin_port_idx[idx] = port_idx;
+        grp->pin_num[idx] = __builtin_ctz(pin);
+        if (invert)
+            grp->invert_masks[port_idx] |= 1 << grp->pin_num[idx];
+    }
+    grp->num_pins = num_pins;
+    return 0;
+}
+
+/*
+ * @brief Get the values of a group of inputs or outputs.
+ *
+ * @param[in] grp The group.
+ * @param[out] values The values, bit N for the pin at index N of the group.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_group_get(const struct dio_group* grp, uint32_t* values)
+{
+    uint32_t port_vals[DIO_GROUP_MAX_PORTS];
+    uint32_t idx;
+    uint32_t val = 0;
+
+    if (grp == NULL || values == NULL)
+        return MOD_ERR_ARG;
+
+    for (idx = 0; idx < grp->num_ports; idx++) {
+        port_vals[idx] = (grp->outputs ? grp->ports[idx]->ODR :
+                          grp->ports[idx]->IDR) ^ grp->invert_masks[idx];
+    }
+    for (idx = 0; idx < grp->num_pins; idx++)
+        val |= ((port_vals[grp->pin_port_idx[idx]] >> grp->pin_num[idx]) & 1) <<
+            idx;
+    *values = val;
+    return 0;
+}
+
+/*
+ * @brief Set the values of a group of outputs.
+ *
+ * @param[in] grp The group (of outputs).
+ * @param[in] values The values, bit N for the pin at index N of the group.
+ * @param[in] mask Which pins to write, bit N for the pin at index N.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_group_set(const struct dio_group* grp, uint32_t values,
+                      uint32_t mask)
+{
+    uint32_t set_masks[DIO_GROUP_MAX_PORTS] = { 0 };
+    uint32_t reset_masks[DIO_GROUP_MAX_PORTS] = { 0 };
+    uint32_t idx;
+    uint32_t port_idx;
+    uint32_t pin_bit;
+
+    if (grp == NULL || !grp->outputs)
+        return MOD_ERR_ARG;
+
+    for (idx = 0; idx < grp->num_pins; idx++) {
+        if ((mask & (1UL << idx)) == 0)
+            continue;
+        port_idx = grp->pin_port_idx[idx];
+        pin_bit = 1 << grp->pin_num[idx];
+        if (((values >> idx) & 1) ^ ((grp->invert_masks[port_idx] & pin_bit) != 0))
+            set_masks[port_idx] |= pin_bit;
+        else
+            reset_masks[port_idx] |= pin_bit;
+    }
+    for (port_idx = 0; port_idx < grp->num_ports; port_idx++)
+        dio_set_reset_outputs(grp->ports[port_idx], set_masks[port_idx],
+                              reset_masks[port_idx]);
+    return 0;
+}
+
+/*
+ * @brief Get the oldest captured input edge.
+ *
+ * @param[out] event The edge.
+ *
+ * @return 1 if an edge was returned, 0 if there are none, else a "MOD_ERR"
+ *         value (< 0). See code for details.
+ */
+int32_t dio_edge_get(struct dio_edge_event* event)
+{
+    if (event == NULL)
+        return MOD_ERR_ARG;
+    if (edge_get_ctr == edge_put_ctr)
+        return 0;
+    *event = edge_ring[edge_get_ctr & EDGE_RING_MASK];
+    edge_get_ctr++;
+    return 1;
+}
+
+/*
+ * @brief Direct run-time configuration of GPIO.
+ *
+ * @param[in] cfg Configuration for one more more pins.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Only the initial value of output pins is simulated.
+ */
+int32_t dio_direct_cfg(struct dio_direct_cfg* cfg)
+{
+    if (cfg == NULL || cfg->port == NULL)
+        return MOD_ERR_ARG;
+
+    if (cfg->mode == DIO_MODE_OUTPUT) {
+        if (cfg->init_value)
+            dio_set_outputs(cfg->port, cfg->pin_mask);
+        else
+            dio_reset_outputs(cfg->port, cfg->pin_mask);
+    }
+    return 0;
+}
+
+/*
+ * @brief Set one or more output bits on a port.
+ *
+ * @param[in] port The GPIO port.
+ * @param[in] pin_mask The pin bit mask.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_set_outputs(dio_port* const port, uint32_t pin_mask)
+{
+    return dio_set_reset_outputs(port, pin_mask, 0);
+}
+
+/*
+ * @brief Reset (clear) one or more output bits on a port.
+ *
+ * @param[in] port The GPIO port.
+ * @param[in] pin_mask The pin bit mask.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_reset_outputs(dio_port* const port, uint32_t pin_mask)
+{
+    return dio_set_reset_outputs(port, 0, pin_mask);
+}
+
+/*
+ * @brief Set and reset (clear) one or more output bits on a port.
+ *
+ * @param[in] port The GPIO port.
+ * @param[in] set_mask The pin bit set mask.
+ * @param[in] reset_mask The pin bit reset mask.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_set_reset_outputs(dio_port* const port, uint32_t set_mask,
+                              uint32_t reset_mask)
+{
+    CRIT_STATE_VAR;
+
+    if (port == NULL)
+        return MOD_ERR_ARG;
+
+    CRIT_BEGIN_NEST();
+    port->ODR = (port->ODR & ~reset_mask) | set_mask;
+    CRIT_END_NEST();
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Find an input by name.
+ *
+ * @param[in] name Input name (case insensitive).
+ *
+ * @return Input index (>= 0), else a "MOD_ERR" value (< 0).
+ */
+static int32_t find_input(const char* name)
+{
+    uint32_t idx;
+
+    for (idx = 0; idx < cfg->num_inputs; idx++)
+        if (strcasecmp(name, cfg->inputs[idx].name) == 0)
+            return idx;
+    return MOD_ERR_ARG;
+}
+
+/*
+ * @brief Find an output by name.
+ *
+ * @param[in] name Output name (case insensitive).
+ *
+ * @return Output index (>= 0), else a "MOD_ERR" value (< 0).
+ */
+static int32_t find_output(const char* name)
+{
+    uint32_t idx;
+
+    for (idx = 0; idx < cfg->num_outputs; idx++)
+        if (strcasecmp(name, cfg->outputs[idx].name) == 0)
+            return idx;
+    return MOD_ERR_ARG;
+}
+
+/*
+ * @brief Capture an edge on an input, as the EXTI interrupt handler would.
+ *
+ * @param[in] din_idx Discrete input index, after its value has changed.
+ */
+static void edge_capture(uint32_t din_idx)
+{
+    struct dio_edge_event* event;
+    int32_t value = dio_get(din_idx);
+    uint8_t edge = cfg->inputs[din_idx].edge;
+    CRIT_STATE_VAR;
+
+    // The edge is on the pin, before inversion.
+    if ((value ^ cfg->inputs[din_idx].invert) ?
+        (edge & DIO_EDGE_RISING) == 0 : (edge & DIO_EDGE_FALLING) == 0)
+        return;
+
+    CRIT_BEGIN_NEST();
+    if (edge_put_ctr - edge_get_ctr >= CONFIG_DIO_EDGE_RING_SIZE) {
+        INC_SAT_U16(cnts_u16[CNT_EDGE_OVERRUN]);
+    } else {
+        event = &edge_ring[edge_put_ctr & EDGE_RING_MASK];
+        event->ms = tmr_get_ms();
+        event->systick_ctr = tmr_get_systick_ctr();
+        event->din_idx = din_idx;
+        event->value = value;
+        edge_put_ctr++;
+        INC_SAT_U16(cnts_u16[CNT_EDGE]);
+    }
+    CRIT_END_NEST();
+}
+
+/*
+ * @brief Console command function for "dio status".
+ *
+ * @param[in] argc Number of arguments, including "dio".
+ * @param[in] argv Argument values, including "dio".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: dio status
+ */
+static int32_t cmd_dio_status(int32_t argc, const char** argv)
+{
+    int32_t idx;
+
+    if (argc != 2) {
+        printc("Invalid arguments\n");
+        return MOD_ERR_ARG;
+    }
+    printc("Inputs:\n");
+    for (idx = 0; idx < cfg->num_inputs; idx++)
+        printc("  %2lu: %s = %ld\n", idx, cfg->inputs[idx].name, dio_get(idx));
+
+    printc("Outputs:\n");
+    for (idx = 0; idx < cfg->num_outputs; idx++)
+        printc("  %2lu: %s = %ld\n", idx, cfg->outputs[idx].name,
+               dio_get_out(idx));
+    return 0;
+}
+
+/*
+ * @brief Console command function for "dio get".
+ *
+ * @param[in] argc Number of arguments, including "dio".
+ * @param[in] argv Argument values, including "dio".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: dio get <input-name>
+ */
+static int32_t cmd_dio_get(int32_t argc, const char** argv)
+{
+    int32_t idx;
+    struct cmd_arg_val arg_vals[1];
+
+    if (cmd_parse_args(argc-2, argv+2, "s", arg_vals) != 1)
+        return MOD_ERR_BAD_CMD;
+
+    idx = find_input(arg_vals[0].val.s);
+    if (idx >= 0) {
+        printc("%s = %ld\n", cfg->inputs[idx].name, dio_get(idx));
+        return 0;
+    }
+    idx = find_output(arg_vals[0].val.s);
+    if (idx >= 0) {
+        printc("%s %ld\n", cfg->outputs[idx].name, dio_get_out(idx));
+        return 0;
+    }
+    printc("Invalid dio input/output name '%s'\n", arg_vals[0].val.s);
+    return MOD_ERR_ARG;
+}
+
+/*
+ * @brief Console command function for "dio set".
+ *
+ * @param[in] argc Number of arguments, including "dio".
+ * @param[in] argv Argument values, including "dio".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: dio set <output-name> {0|1}
+ */
+static int32_t cmd_dio_set(int32_t argc, const char** argv)
+{
+    int32_t idx;
+    struct cmd_arg_val arg_vals[2];
+
+    if (cmd_parse_args(argc-2, argv+2, "su", arg_vals) != 2)
+        return MOD_ERR_BAD_CMD;
+
+    idx = find_output(arg_vals[0].val.s);
+    if (idx < 0) {
+        printc("Invalid dio name '%s'\n", arg_vals[0].val.s);
+        return MOD_ERR_ARG;
+    }
+    if (arg_vals[1].val.u > 1) {
+        printc("Invalid value\n");
+        return MOD_ERR_ARG;
+    }
+    return dio_set(idx, arg_vals[1].val.u);
+}
+
+/*
+ * @brief Console command function for "dio edge".
+ *
+ * @param[in] argc Number of arguments, including "dio".
+ * @param[in] argv Argument values, including "dio".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: dio edge
+ */
+static int32_t cmd_dio_edge(int32_t argc, const char** argv)
+{
+    struct dio_edge_event event;
+
+    printc("Input        ms       Systick Value\n"
+           "------------ -------- ------- -----\n");
+    while (dio_edge_get(&event) == 1) {
+        printc("%-12s %8lu %7lu %u\n", cfg->inputs[event.din_idx].name,
+               event.ms, event.systick_ctr, event.value);
+    }
+    return 0;
+}
+
+/*
+ * @brief Console command function for "dio sim".
+ *
+ * @param[in] argc Number of arguments, including "dio".
+ * @param[in] argv Argument values, including "dio".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: dio sim <input-name> {0|1}
+ *
+ * The value is the logical value, i.e. as returned by dio_get().
+ */
+static int32_t cmd_dio_sim(int32_t argc, const char** argv)
+{
+    int32_t idx;
+    struct cmd_arg_val arg_vals[2];
+    const struct dio_in_info* dii;
+    CRIT_STATE_VAR;
+
+    if (cmd_parse_args(argc-2, argv+2, "su", arg_vals) != 2)
+        return MOD_ERR_BAD_CMD;
+
+    idx = find_input(arg_vals[0].val.s);
+    if (idx < 0) {
+        printc("Invalid dio input name '%s'\n", arg_vals[0].val.s);
+        return MOD_ERR_ARG;
+    }
+    if (arg_vals[1].val.u > 1) {
+        printc("Invalid value\n");
+        return MOD_ERR_ARG;
+    }
+    if (dio_get(idx) == (int32_t)arg_vals[1].val.u)
+        return 0;
+
+    dii = &cfg->inputs[idx];
+    CRIT_BEGIN_NEST();
+    dii->port->IDR ^= dii->pin;
+    CRIT_END_NEST();
+    edge_capture(idx);
+    return 0;
+}
@@ -0,0 +1,829 @@
+/*
+ * @brief Host (x86/Linux) implementation of the flash module API.
+ *
+ * This file replaces modules/flash/flash.c in the host build (see
+ * host_main.c). The flash memory (CONFIG_FLASH_SIZE bytes at
+ * CONFIG_FLASH_BASE_ADDR) is a RAM image, and addresses passed to the API are
+ * target addresses into it. If the HOST_FLASH environment variable names a
+ * file, the image is mapped from that file, so it persists across runs (a new
+ * or short file is extended, erased). Otherwise it starts erased every run.
+ *
+ * The image behaves like flash where it matters to clients:
+ * - An erase sets a page to 0xff.
+ * - A write unit (CONFIG_FLASH_WRITE_BYTES) can only be written while erased;
+ *   otherwise the write fails with MOD_ERR_PERIPH, like a programming error.
+ * - Asynchronous operations complete in order, one per flash_run() call,
+ *   which then calls the completion callback. Panic operations complete
+ *   immediately; as nothing is ever in progress, none is aborted.
+ *
+ * The key/value store keeps the target API, but not the target's log
+ * structured layout: each key has a fixed slot in the key/value pages
+ * (CONFIG_FLASH_KV_BASE_ADDR), updated in place.
+ *
+ * The following console commands are provided:
+ * > flash e (to erase)
+ * > flash w (to write)
+ * > flash ea (to erase, asynchronously)
+ * > flash wa (to write, asynchronously)
+ * > flash r (to read, as the image is not in the address space)
+ * > flash kv (key/value store operations)
+ * > flash pm
+ *
+ * See code for details.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+#include "cmd.h"
+#include "console.h"
+#include "flash.h"
+#include "log.h"
+#include "module.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define FLASH_WRITE_BYTES_MASK (CONFIG_FLASH_WRITE_BYTES - 1)
+
+#define KV_AREA_SIZE (CONFIG_FLASH_KV_PAGE_SIZE * CONFIG_FLASH_KV_NUM_PAGES)
+#define KV_SLOT_USED 0x5a
+
+#if CONFIG_FLASH_KV_MAX_VALUE_LEN > 255
+    #error CONFIG_FLASH_KV_MAX_VALUE_LEN must fit in a uint8_t
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+struct async_op {
+    uint32_t* addr;
+    const uint8_t* data; // NULL for an erase.
+    uint32_t len;
+    flash_done_cb cb;
+    void* user_data;
+};
+
+// A key/value slot in the image. A slot is free if erased.
+struct kv_slot {
+    uint16_t key;
+    uint8_t flags;
+    uint8_t len;
+    uint8_t value[CONFIG_FLASH_KV_MAX_VALUE_LEN];
+};
+
+enum flash_u16_pms {
+    CNT_KV_WRITE,
+    CNT_ASYNC_OP,
+    CNT_ASYNC_ERR,
+    CNT_ASYNC_QUEUE_FULL,
+
+    NUM_U16_PMS
+};
+
+_Static_assert(sizeof(struct kv_slot) * CONFIG_FLASH_KV_MAX_KEYS <=
+               KV_AREA_SIZE, "Key/value slots do not fit the pages");
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t image_open(void);
+static uint8_t* image_ptr(const uint32_t* addr, uint32_t len);
+static int32_t erase_page(uint32_t* start_addr);
+static int32_t write_data(uint32_t* flash_addr, const uint8_t* data,
+                          uint32_t data_len);
+static struct kv_slot* kv_find(uint16_t key);
+
+static int32_t cmd_flash_erase(int32_t argc, const char** argv);
+static int32_t cmd_flash_write(int32_t argc, const char** argv);
+static int32_t cmd_flash_erase_async(int32_t argc, const char** argv);
+static int32_t cmd_flash_write_async(int32_t argc, const char** argv);
+static int32_t cmd_flash_read(int32_t argc, const char** argv);
+static void cmd_async_done(int32_t rc, void* user_data);
+static int32_t cmd_flash_kv(int32_t argc, const char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t* image;
+
+static struct async_op async_ops[CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+static uint32_t async_put_ctr;
+static uint32_t async_get_ctr;
+
+static struct kv_slot* kv_slots;
+
+static int32_t log_level = LOG_DEFAULT;
+
+// Data for the "flash wa" command, which must stay valid until completion.
+static uint32_t cmd_async_data[7];
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "kv write",
+    "async op",
+    "async err",
+    "async queue full",
+};
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "e",
+        .func = cmd_flash_erase,
+        .help = "Erase flash: usage: flash e addr",
+    },
+    {
+        .name = "w",
+        .func = cmd_flash_write,
+        .help = "Write flash: usage: flash w addr value(32) ...",
+    },
+    {
+        .name = "ea",
+        .func = cmd_flash_erase_async,
+        .help = "Erase flash asynchronously: usage: flash ea addr",
+    },
+    {
+        .name = "wa",
+        .func = cmd_flash_write_async,
+        .help = "Write flash asynchronously: usage: flash wa addr value(32) ...",
+    },
+    {
+        .name = "r",
+        .func = cmd_flash_read,
+        .help = "Read flash: usage: flash r addr [num-words]",
+    },
+    {
+        .name = "kv",
+        .func = cmd_flash_kv,
+        .help = "Key/value store, usage: flash kv [<op> [<arg>]] (enter no op for help)",
+    },
+};
+
+static struct cmd_client_info cmd_info = {
+    .name = "flash",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Start flash instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function starts the flash singleton module, to enter normal operation.
+ * This includes setting up the flash image.
+ */
+int32_t flash_start(void)
+{
+    int32_t rc;
+
+    rc = cmd_register(&cmd_info);
+    if (rc < 0) {
+        log_error("flash_start: cmd error %d\n", rc);
+        return rc;
+    }
+
+    rc = image_open();
+    if (rc != 0) {
+        log_error("flash_start: image_open error %ld\n", rc);
+        return rc;
+    }
+    kv_slots = (struct kv_slot*)image_ptr(
+        (uint32_t*)CONFIG_FLASH_KV_BASE_ADDR, KV_AREA_SIZE);
+    return 0;
+}
+
+/*
+ * @brief Run flash instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function runs the flash singleton module, during normal operation. It
+ * completes the oldest asynchronous operation, if any, and calls its callback.
+ */
+int32_t flash_run(void)
+{
+    struct async_op op;
+    int32_t rc;
+
+    if (async_get_ctr == async_put_ctr)
+        return 0;
+
+    // Copy the op, so the slot can be reused by the callback.
+    op = async_ops[async_get_ctr % CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+    async_get_ctr++;
+    if (op.data == NULL)
+        rc = erase_page(op.addr);
+    else
+        rc = write_data(op.addr, op.data, op.len);
+    INC_SAT_U16(cnts_u16[CNT_ASYNC_OP]);
+    if (rc != 0)
+        INC_SAT_U16(cnts_u16[CNT_ASYNC_ERR]);
+    if (op.cb != NULL)
+        op.cb(rc, op.user_data);
+    return 0;
+}
+
+/*
+ * @brief Panic erase of a single page of memory.
+ *
+ * @param[in] start_addr Starting address in flash (must be on page boundary).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t flash_panic_erase_page(uint32_t* start_addr)
+{
+    return erase_page(start_addr);
+}
+
+/*
+ * @brief Panic data write.
+ *
+ * @param[in] flash_addr Starting address in flash (must be on N-byte boundary).
+ * @param[in] data Pointer to data to write (must be on 4-byte boundary).
+ * @param[in] data_len Number of bytes of data (must be multiple of N).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t flash_panic_write(uint32_t* flash_addr, uint32_t* data,
+                          uint32_t data_len)
+{
+    if (((uintptr_t)data & 0x3) || (data_len & FLASH_WRITE_BYTES_MASK))
+        return MOD_ERR_ARG;
+    return write_data(flash_addr, (const uint8_t*)data, data_len);
+}
+
+/*
+ * @brief Queue an asynchronous erase of a single page of memory.
+ *
+ * @param[in] start_addr Starting address in flash (must be on page boundary).
+ * @param[in] cb Function called from flash_run() on completion (can be NULL).
+ * @param[in] user_data Passed to cb.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t flash_erase_async(uint32_t* start_addr, flash_done_cb cb,
+                          void* user_data)
+{
+    return flash_write_async(start_addr, NULL, 0, cb, user_data);
+}
+
+/*
+ * @brief Queue an asynchronous data write.
+ *
+ * @param[in] flash_addr Starting address in flash (must be on N-byte boundary).
+ * @param[in] data Pointer to data to write (any alignment), or NULL to erase
+ *                 (internal use, see flash_erase_async()).
+ * @param[in] data_len Number of bytes of data (> 0). If not a multiple of N,
+ *                     the last unit is padded with 0xff.
+ * @param[in] cb Function called from flash_run() on completion (can be NULL).
+ * @param[in] user_data Passed to cb.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note The data is not copied, so it must stay valid until completion.
+ */
+int32_t flash_write_async(uint32_t* flash_addr, const void* data,
+                          uint32_t data_len, flash_done_cb cb, void* user_data)
+{
+    struct async_op* op;
+
+    if (data != NULL) {
+        if (data_len == 0 || image_ptr(flash_addr, data_len) == NULL)
+            return MOD_ERR_ARG;
+    } else if (image_ptr(flash_addr, CONFIG_FLASH_PAGE_SIZE) == NULL) {
+        return MOD_ERR_ARG;
+    }
+    if (async_put_ctr - async_get_ctr >= CONFIG_FLASH_ASYNC_QUEUE_SIZE) {
+        INC_SAT_U16(cnts_u16[CNT_ASYNC_QUEUE_FULL]);
+        return MOD_ERR_RESOURCE;
+    }
+    op = &async_ops[async_put_ctr % CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+    op->addr = flash_addr;
+    op->data = data;
+    op->len = data_len;
+    op->cb = cb;
+    op->user_data = user_data;
+    async_put_ctr++;
+    return 0;
+}
+
+/*
+ * @brief Check if there are no asynchronous operations pending.
+ *
+ * @return true if all asynchronous operations are complete, and their
+ *         callbacks have been called.
+ */
+bool flash_async_idle(void)
+{
+    return async_get_ctr == async_put_ctr;
+}
+
+/*
+ * @brief Get the value of a key from the key/value store.
+ *
+ * @param[in] key The key (0 to FLASH_KV_KEY_MAX).
+ * @param[out] buf Buffer for the value.
+ * @param[in] buf_len Size of buf. If the value is longer, it is truncated.
+ *
+ * @return Length of the value (>= 0) for success, else a "MOD_ERR" value. See
+ *         code for details. MOD_ERR_UNAVAIL means the key is not present.
+ */
+int32_t flash_kv_get(uint16_t key, void* buf, uint32_t buf_len)
+{
+    struct kv_slot* slot;
+
+    if (kv_slots == NULL)
+        return MOD_ERR_STATE;
+    if (buf == NULL && buf_len > 0)
+        return MOD_ERR_ARG;
+
+    slot = kv_find(key);
+    if (slot == NULL)
+        return MOD_ERR_UNAVAIL;
+    memcpy(buf, slot->value, slot->len < buf_len ? slot->len : buf_len);
+    return slot->len;
+}
+
+/*
+ * @brief Set the value of a key in the key/value store.
+ *
+ * @param[in] key The key (0 to FLASH_KV_KEY_MAX).
+ * @param[in] data The value.
+ * @param[in] len Length of the value (up to CONFIG_FLASH_KV_MAX_VALUE_LEN).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t flash_kv_set(uint16_t key, const void* data, uint32_t len)
+{
+    struct kv_slot* slot;
+    uint32_t idx;
+
+    if (kv_slots == NULL)
+        return MOD_ERR_STATE;
+    if (key > FLASH_KV_KEY_MAX || len > CONFIG_FLASH_KV_MAX_VALUE_LEN ||
+        (data == NULL && len > 0))
+        return MOD_ERR_ARG;
+
+    slot = kv_find(key);
+    if (slot == NULL) {
+        for (idx = 0; idx < CONFIG_FLASH_KV_MAX_KEYS; idx++) {
+            if (kv_slots[idx].flags != KV_SLOT_USED) {
+                slot = &kv_slots[idx];
+                break;
+            }
+        }
+        if (slot == NULL)
+            return MOD_ERR_RESOURCE;
+    } else if (slot->len == len && memcmp(slot->value, data, len) == 0) {
+        return 0;
+    }
+    slot->key = key;
+    slot->len = len;
+    memcpy(slot->value, data, len);
+    slot->flags = KV_SLOT_USED;
+    INC_SAT_U16(cnts_u16[CNT_KV_WRITE]);
+    return 0;
+}
+
+/*
+ * @brief Delete a key from the key/value store.
+ *
+ * @param[in] key The key.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t flash_kv_delete(uint16_t key)
+{
+    struct kv_slot* slot;
+
+    if (kv_slots == NULL)
+        return MOD_ERR_STATE;
+
+    slot = kv_find(key);
+    if (slot != NULL)
+        memset(slot, 0xff, sizeof(*slot));
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Set up the flash image, from the HOST_FLASH file if set.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t image_open(void)
+{
+    const char* path;
+    struct stat sb;
+    off_t old_size = 0;
+    int fd;
+
+    path = getenv("HOST_FLASH");
+    if (path == NULL) {
+        image = mmap(NULL, CONFIG_FLASH_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (image == MAP_FAILED) {
+            image = NULL;
+            return MOD_ERR_RESOURCE;
+        }
+        memset(image, 0xff, CONFIG_FLASH_SIZE);
+        return 0;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return MOD_ERR_RESOURCE;
+    if (fstat(fd, &sb) == 0)
+        old_size = sb.st_size;
+    if (old_size < CONFIG_FLASH_SIZE &&
+        ftruncate(fd, CONFIG_FLASH_SIZE) != 0) {
+        close(fd);
+        return MOD_ERR_RESOURCE;
+    }
+    image = mmap(NULL, CONFIG_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        image = NULL;
+        return MOD_ERR_RESOURCE;
+    }
+    if (old_size < CONFIG_FLASH_SIZE)
+        memset(image + old_size, 0xff, CONFIG_FLASH_SIZE - old_size);
+    log_info("Flash image %s\n", path);
+    return 0;
+}
+
+/*
+ * @brief Get the image location of a flash address range.
+ *
+ * @param[in] addr Flash (target) address.
+ * @param[in] len Length of the range.
+ *
+ * @return Pointer into the image, or NULL if the range is not in flash.
+ */
+static uint8_t* image_ptr(const uint32_t* addr, uint32_t len)
+{
+    uintptr_t offset = (uintptr_t)addr - CONFIG_FLASH_BASE_ADDR;
+
+    if (image == NULL || (uintptr_t)addr < CONFIG_FLASH_BASE_ADDR ||
+        offset > CONFIG_FLASH_SIZE || len > CONFIG_FLASH_SIZE - offset)
+        return NULL;
+    return image + offset;
+}
+
+/*
+ * @brief Erase a page.
+ *
+ * @param[in] start_addr Starting address in flash (must be on page boundary).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t erase_page(uint32_t* start_addr)
+{
+    uint8_t* p = image_ptr(start_addr, CONFIG_FLASH_PAGE_SIZE);
+
+    if (p == NULL ||
+        (((uintptr_t)start_addr - CONFIG_FLASH_BASE_ADDR) %
+         CONFIG_FLASH_PAGE_SIZE) != 0)
+        return MOD_ERR_ARG;
+    memset(p, 0xff, CONFIG_FLASH_PAGE_SIZE);
+    return 0;
+}
+
+/*
+ * @brief Write data, a unit at a time.
+ *
+ * @param[in] flash_addr Starting address in flash (must be on N-byte boundary).
+ * @param[in] data Data to write (any alignment).
+ * @param[in] data_len Number of bytes of data. If not a multiple of N, the last
+ *                     unit is padded with 0xff.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Units written before an error stay written, as on the target.
+ */
+static int32_t write_data(uint32_t* flash_addr, const uint8_t* data,
+                          uint32_t data_len)
+{
+    uint32_t num_units = (data_len + FLASH_WRITE_BYTES_MASK) /
+        CONFIG_FLASH_WRITE_BYTES;
+    uint8_t* p = image_ptr(flash_addr, num_units * CONFIG_FLASH_WRITE_BYTES);
+    uint32_t len;
+    uint32_t idx;
+
+    if (p == NULL || ((uintptr_t)flash_addr & FLASH_WRITE_BYTES_MASK))
+        return MOD_ERR_ARG;
+
+    for (; data_len > 0; data_len -= len, data += len,
+             p += CONFIG_FLASH_WRITE_BYTES) {
+        for (idx = 0; idx < CONFIG_FLASH_WRITE_BYTES; idx++) {
+            if (p[idx] != 0xff)
+                return MOD_ERR_PERIPH;
+        }
+        len = data_len < CONFIG_FLASH_WRITE_BYTES ? data_len :
+            CONFIG_FLASH_WRITE_BYTES;
+        memcpy(p, data, len);
+    }
+    return 0;
+}
+
+/*
+ * @brief Find the slot of a key.
+ *
+ * @param[in] key The key.
+ *
+ * @return The slot, or NULL if the key is not present.
+ */
+static struct kv_slot* kv_find(uint16_t key)
+{
+    uint32_t idx;
+
+    for (idx = 0; idx < CONFIG_FLASH_KV_MAX_KEYS; idx++) {
+        if (kv_slots[idx].flags == KV_SLOT_USED && kv_slots[idx].key == key)
+            return &kv_slots[idx];
+    }
+    return NULL;
+}
+
+/*
+ * @brief Console command function for "flash e".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash e addr
+ */
+static int32_t cmd_flash_erase(int32_t argc, const char** argv)
+{
+    int32_t rc;
+    struct cmd_arg_val arg_vals[1];
+
+    rc = cmd_parse_args(argc-2, argv+2, "p", arg_vals);
+    if (rc != 1)
+        return rc;
+
+    rc = flash_panic_erase_page(arg_vals[0].val.p);
+    printc("rc=%ld\n", rc);
+    return rc;
+}
+
+/*
+ * @brief Console command function for "flash w".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash w addr value(32) ...
+ */
+static int32_t cmd_flash_write(int32_t argc, const char** argv)
+{
+    const int NUM_WORDS = CONFIG_FLASH_WRITE_BYTES / 4;
+    int32_t num_args;
+    struct cmd_arg_val arg_vals[NUM_WORDS + 1];
+    uint32_t data[NUM_WORDS];
+    int idx;
+    int32_t rc;
+
+    num_args = cmd_parse_args(argc-2, argv+2, "puu[uu]", arg_vals);
+    if (num_args != (NUM_WORDS + 1)) {
+        printc("Must specify %d data words\n", NUM_WORDS);
+        return num_args;
+    }
+    num_args--;
+    for (idx = 0; idx < num_args; idx++)
+        data[idx] = arg_vals[idx+1].val.u;
+    rc = flash_panic_write(arg_vals[0].val.p, data,
+                           num_args * sizeof(uint32_t));
+    printc("rc=%ld\n", rc);
+    return rc;
+}
+
+/*
+ * @brief Console command function for "flash ea".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash ea addr
+ */
+static int32_t cmd_flash_erase_async(int32_t argc, const char** argv)
+{
+    int32_t rc;
+    struct cmd_arg_val arg_vals[1];
+
+    rc = cmd_parse_args(argc-2, argv+2, "p", arg_vals);
+    if (rc != 1)
+        return rc;
+
+    rc = flash_erase_async(arg_vals[0].val.p, cmd_async_done, "erase");
+    printc("rc=%ld\n", rc);
+    return rc;
+}
+
+/*
+ * @brief Console command function for "flash wa".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash wa addr value(32) ...
+ *
+ * From 1 to 7 words can be written (the last unit is padded).
+ */
+static int32_t cmd_flash_write_async(int32_t argc, const char** argv)
+{
+    int32_t num_args;
+    struct cmd_arg_val arg_vals[ARRAY_SIZE(cmd_async_data) + 1];
+    int idx;
+    int32_t rc;
+
+    // The data buffer is shared, so only one write at a time.
+    if (!flash_async_idle()) {
+        printc("Asynchronous operation in progress\n");
+        return MOD_ERR_BUSY;
+    }
+    num_args = cmd_parse_args(argc-2, argv+2, "pu[u[u[u[u[u[u]]]]]]",
+                              arg_vals);
+    if (num_args < 2)
+        return num_args;
+    num_args--;
+    for (idx = 0; idx < num_args; idx++)
+        cmd_async_data[idx] = arg_vals[idx+1].val.u;
+    rc = flash_write_async(arg_vals[0].val.p, cmd_async_data,
+                           num_args * sizeof(uint32_t), cmd_async_done,
+                           "write");
+    printc("rc=%ld\n", rc);
+    return rc;
+}
+
+/*
+ * @brief Console command function for "flash r".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash r addr [num-words]
+ */
+static int32_t cmd_flash_read(int32_t argc, const char** argv)
+{
+    struct cmd_arg_val arg_vals[2];
+    uint32_t num_words = 1;
+    uint32_t idx;
+    uint32_t addr;
+    const uint32_t* p;
+    int32_t num_args;
+
+    num_args = cmd_parse_args(argc-2, argv+2, "p[u]", arg_vals);
+    if (num_args < 1)
+        return num_args;
+    if (num_args > 1)
+        num_words = arg_vals[1].val.u;
+    addr = (uint32_t)(uintptr_t)arg_vals[0].val.p;
+    p = (const uint32_t*)image_ptr(arg_vals[0].val.p, num_words * 4);
+    if (p == NULL || (addr & 0x3)) {
+        printc("Invalid address range\n");
+        return MOD_ERR_ARG;
+    }
+    for (idx = 0; idx < num_words; idx++) {
+        if (idx % 4 == 0)
+            printc("%s%08lx:", idx == 0 ? "" : "\n", addr + idx * 4);
+        printc(" %08lx", p[idx]);
+    }
+    printc("\n");
+    return 0;
+}
+
+/*
+ * @brief Completion callback for the "flash ea" and "flash wa" commands.
+ *
+ * @param[in] rc The operation result.
+ * @param[in] user_data The operation name.
+ */
+static void cmd_async_done(int32_t rc, void* user_data)
+{
+    printc("flash async %s done rc=%ld\n", (const char*)user_data, rc);
+}
+
+/*
+ * @brief Console command function for "flash kv".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash kv [<op> [<arg>]]
+ */
+static int32_t cmd_flash_kv(int32_t argc, const char** argv)
+{
+    struct cmd_arg_val arg_vals[2];
+    uint8_t value[CONFIG_FLASH_KV_MAX_VALUE_LEN];
+    int32_t rc;
+    uint32_t idx;
+
+    if (argc < 3) {
+        printc("Operations and param(s) are as follows:\n"
+               "  List keys, usage: flash kv list\n"
+               "  Get value, usage: flash kv get <key>\n"
+               "  Set value (string), usage: flash kv set <key> <value>\n"
+               "  Delete key, usage: flash kv del <key>\n");
+        return 0;
+    }
+
+    if (strcasecmp(argv[2], "list") == 0) {
+        if (kv_slots == NULL)
+            return MOD_ERR_STATE;
+        printc(" Key Len Slot\n"
+               "---- --- ----\n");
+        for (idx = 0; idx < CONFIG_FLASH_KV_MAX_KEYS; idx++) {
+            if (kv_slots[idx].flags == KV_SLOT_USED)
+                printc("%4u %3u %4lu\n", kv_slots[idx].key, kv_slots[idx].len,
+                       idx);
+        }
+        return 0;
+    } else if (strcasecmp(argv[2], "get") == 0) {
+        if (cmd_parse_args(argc-3, argv+3, "u", arg_vals) != 1)
+            return MOD_ERR_BAD_CMD;
+        rc = flash_kv_get(arg_vals[0].val.u, value, sizeof(value));
+        for (idx = 0; rc > 0 && idx < (uint32_t)rc; idx++)
+            printc("%02x ", value[idx]);
+        if (rc > 0)
+            printc("\n");
+    } else if (strcasecmp(argv[2], "set") == 0) {
+        if (cmd_parse_args(argc-3, argv+3, "us", arg_vals) != 2)
+            return MOD_ERR_BAD_CMD;
+        rc = flash_kv_set(arg_vals[0].val.u, arg_vals[1].val.s,
+                          strlen(arg_vals[1].val.s));
+    } else if (strcasecmp(argv[2], "del") == 0) {
+        if (cmd_parse_args(argc-3, argv+3, "u", arg_vals) != 1)
+            return MOD_ERR_BAD_CMD;
+        rc = flash_kv_delete(arg_vals[0].val.u);
+    } else {
+        printc("Invalid operation '%s'\n", argv[2]);
+        return MOD_ERR_BAD_CMD;
+    }
+    printc("rc=%ld\n", rc);
+    return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * @brief Implementation of the host (x86/Linux) core peripheral simulation.
+ *
+ * This file simulates the Cortex-M core peripherals used by the hardware
+ * independent modules (see host_hal.h), using the Linux monotonic clock:
+ * - The DWT cycle counter runs at SystemCoreClock (1 GHz), so it counts ns.
+ * - The SysTick "interrupts" once per ms. The counter value is derived from
+ *   the time until the next tick, so it counts down as on the MCU.
+ *
+ * The simulated interrupts are delivered by host_poll(), which the super loop
+ * calls on every pass. It also polls the other shims (ttys input, i2c
+ * transfers), which in turn call the module "interrupt" handling. When the
+ * sched module has nothing to do it calls __WFI(), which maps to host_wait().
+ * That sleeps until the next tick is due, or until there is ttys input.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE // For ppoll().
+
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define HOST_CORE_CLOCK_HZ 1000000000UL
+#define NS_PER_MS 1000000ULL
+
+// If base level code blocks for longer than this (e.g. the process stopped in
+// a debugger), skip the missed ticks rather than trying to catch up.
+#define MAX_TICK_CATCH_UP_MS 1000
+
+#define MAX_POLL_FDS 8
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t get_mono_ns(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static SysTick_Type systick = {
+    .CTRL = SysTick_CTRL_ENABLE_Msk | SysTick_CTRL_CLKSOURCE_Msk,
+    .LOAD = HOST_CORE_CLOCK_HZ / 1000 - 1,
+};
+
+static DWT_Type dwt;
+
+static uint64_t start_ns;
+static uint64_t next_tick_ns;
+static uint32_t cyccnt_base;
+static uint32_t last_cyccnt;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t SystemCoreClock = HOST_CORE_CLOCK_HZ;
+SCB_Type host_scb;
+CoreDebug_Type host_core_debug;
+GPIO_TypeDef host_gpio[HOST_NUM_GPIO_PORTS];
+uint32_t host_primask;
+uint32_t host_ipsr;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Initialize the host simulation.
+ *
+ * This must be called before any module is initialized, as it plays the part
+ * of the MCU startup code and IDE generated initialization.
+ */
+void host_init(void)
+{
+    start_ns = get_mono_ns();
+    next_tick_ns = start_ns + NS_PER_MS;
+}
+
+/*
+ * @brief Get the time since host_init() in ns.
+ *
+ * @return Time in ns.
+ */
+uint64_t host_get_ns(void)
+{
+    return get_mono_ns() - start_ns;
+}
+
+/*
+ * @brief Access the simulated SysTick.
+ *
+ * @return Pointer to the SysTick registers, with VAL updated.
+ *
+ * Writes to VAL have no effect, as the counter is derived from the time until
+ * the next tick.
+ */
+SysTick_Type* host_systick(void)
+{
+    uint64_t now_ns = get_mono_ns();
+    uint64_t to_go = next_tick_ns > now_ns ? next_tick_ns - now_ns : 0;
+    uint32_t load = systick.LOAD & SysTick_LOAD_RELOAD_Msk;
+
+    to_go = to_go * (load + 1) / NS_PER_MS;
+    systick.VAL = to_go > load ? load : (uint32_t)to_go;
+    return &systick;
+}
+
+/*
+ * @brief Access the simulated DWT.
+ *
+ * @return Pointer to the DWT registers, with CYCCNT updated.
+ *
+ * A write to CYCCNT (e.g. to zero it when enabling it) is honoured by
+ * rebasing the counter on the next access.
+ */
+DWT_Type* host_dwt(void)
+{
+    uint32_t now_cyc = (uint32_t)(get_mono_ns() - start_ns);
+
+    if ((dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0) {
+        cyccnt_base = now_cyc - dwt.CYCCNT;
+    } else if (dwt.CYCCNT != last_cyccnt) {
+        // Written since the last access.
+        cyccnt_base = now_cyc - dwt.CYCCNT;
+    }
+    if (dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk)
+        dwt.CYCCNT = now_cyc - cyccnt_base;
+    last_cyccnt = dwt.CYCCNT;
+    return &dwt;
+}
+
+/*
+ * @brief Deliver simulated interrupts.
+ *
+ * This is called from the super loop, at base level with "interrupts"
+ * enabled. It runs the SysTick handler once for each ms that has elapsed, then
+ * polls the other shims.
+ */
+void host_poll(void)
+{
+    uint64_t now_ns = get_mono_ns();
+
+    if (now_ns >= next_tick_ns + MAX_TICK_CATCH_UP_MS * NS_PER_MS)
+        next_tick_ns = now_ns;
+
+    host_ipsr = 16 + SysTick_IRQn; // Exception number, as in the IPSR.
+    while (now_ns >= next_tick_ns) {
+        next_tick_ns += NS_PER_MS;
+        if ((systick.CTRL & (SysTick_CTRL_ENABLE_Msk |
+                             SysTick_CTRL_TICKINT_Msk)) ==
+            (SysTick_CTRL_ENABLE_Msk | SysTick_CTRL_TICKINT_Msk))
+            SysTick_Handler();
+    }
+
+    host_ipsr = 16 + USART2_IRQn;
+    host_ttys_poll();
+    host_ipsr = 16 + I2C3_EV_IRQn;
+    host_i2c_poll();
+    host_ipsr = 0;
+}
+
+/*
+ * @brief Wait for an interrupt.
+ *
+ * This is the host version of the WFI instruction. It sleeps until the next
+ * SysTick is due, or there is ttys input. The interrupts themselves are
+ * delivered by the next call to host_poll().
+ */
+void host_wait(void)
+{
+    struct pollfd pfds[MAX_POLL_FDS];
+    int fds[MAX_POLL_FDS];
+    struct timespec tmo;
+    uint64_t now_ns = get_mono_ns();
+    uint64_t to_go = next_tick_ns > now_ns ? next_tick_ns - now_ns : 0;
+    int num_fds;
+    int idx;
+
+    num_fds = host_ttys_get_poll_fds(fds, MAX_POLL_FDS);
+    for (idx = 0; idx < num_fds; idx++) {
+        pfds[idx].fd = fds[idx];
+        pfds[idx].events = POLLIN;
+        pfds[idx].revents = 0;
+    }
+    tmo.tv_sec = to_go / 1000000000ULL;
+    tmo.tv_nsec = to_go % 1000000000ULL;
+    (void)ppoll(pfds, num_fds, &tmo, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Read the Linux monotonic clock.
+ *
+ * @return Clock value in ns.
+ */
+static uint64_t get_mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
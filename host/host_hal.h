@@ -0,0 +1,282 @@
+#ifndef _HOST_HAL_H_
+#define _HOST_HAL_H_
+
+/*
+ * @brief Host (x86/Linux) replacement for the STM32 LL and CMSIS headers.
+ *
+ * In the host build (see host_main.c), config.h points all of the
+ * CONFIG_STM32_LL_*_HDR includes at this file. It provides just enough of the
+ * CMSIS core API (SysTick, DWT, PRIMASK, NVIC etc.) and the LL GPIO
+ * definitions for the hardware independent modules to compile and run
+ * unchanged. The "peripherals" are simulated in host_hal.c and the other host
+ * shim files.
+ *
+ * Notes:
+ * - SystemCoreClock is 1 GHz, so DWT cycle counts are in ns.
+ * - Interrupts are simulated. Handlers are run from host_poll(), which is
+ *   called from the super loop, so they never preempt base level code. Thus
+ *   PRIMASK only needs to be tracked, not enforced.
+ * - Hardware exclusive access (__LDREXW/__STREXW) always succeeds, for the
+ *   same reason.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define __IO volatile
+#define __I volatile const
+#define __ASM __asm__
+#define __NVIC_PRIO_BITS 4
+
+#define SysTick_CTRL_ENABLE_Msk (1UL << 0)
+#define SysTick_CTRL_TICKINT_Msk (1UL << 1)
+#define SysTick_CTRL_CLKSOURCE_Msk (1UL << 2)
+#define SysTick_CTRL_COUNTFLAG_Msk (1UL << 16)
+#define SysTick_LOAD_RELOAD_Msk 0xffffffUL
+
+#define SCB_ICSR_PENDSTSET_Msk (1UL << 26)
+#define SCB_ICSR_VECTACTIVE_Msk 0x1ffUL
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+#define SysTick (host_systick())
+#define DWT (host_dwt())
+#define SCB (&host_scb)
+#define CoreDebug (&host_core_debug)
+
+// GPIO ports. Only the registers used by the host dio shim are simulated.
+#define GPIOA (&host_gpio[0])
+#define GPIOB (&host_gpio[1])
+#define GPIOC (&host_gpio[2])
+#define GPIOD (&host_gpio[3])
+#define GPIOE (&host_gpio[4])
+#define GPIOF (&host_gpio[5])
+#define GPIOG (&host_gpio[6])
+#define GPIOH (&host_gpio[7])
+#define HOST_NUM_GPIO_PORTS 8
+
+#define LL_GPIO_PIN_0 (1UL << 0)
+#define LL_GPIO_PIN_1 (1UL << 1)
+#define LL_GPIO_PIN_2 (1UL << 2)
+#define LL_GPIO_PIN_3 (1UL << 3)
+#define LL_GPIO_PIN_4 (1UL << 4)
+#define LL_GPIO_PIN_5 (1UL << 5)
+#define LL_GPIO_PIN_6 (1UL << 6)
+#define LL_GPIO_PIN_7 (1UL << 7)
+#define LL_GPIO_PIN_8 (1UL << 8)
+#define LL_GPIO_PIN_9 (1UL << 9)
+#define LL_GPIO_PIN_10 (1UL << 10)
+#define LL_GPIO_PIN_11 (1UL << 11)
+#define LL_GPIO_PIN_12 (1UL << 12)
+#define LL_GPIO_PIN_13 (1UL << 13)
+#define LL_GPIO_PIN_14 (1UL << 14)
+#define LL_GPIO_PIN_15 (1UL << 15)
+
+#define LL_GPIO_MODE_INPUT 0
+#define LL_GPIO_MODE_OUTPUT 1
+#define LL_GPIO_MODE_ALTERNATE 2
+#define LL_GPIO_MODE_ANALOG 3
+
+#define LL_GPIO_PULL_NO 0
+#define LL_GPIO_PULL_UP 1
+#define LL_GPIO_PULL_DOWN 2
+
+#define LL_GPIO_SPEED_FREQ_LOW 0
+#define LL_GPIO_SPEED_FREQ_MEDIUM 1
+#define LL_GPIO_SPEED_FREQ_HIGH 2
+#define LL_GPIO_SPEED_FREQ_VERY_HIGH 3
+
+#define LL_GPIO_OUTPUT_PUSHPULL 0
+#define LL_GPIO_OUTPUT_OPENDRAIN 1
+
+#define LL_GPIO_AF_0 0
+#define LL_GPIO_AF_1 1
+#define LL_GPIO_AF_2 2
+#define LL_GPIO_AF_3 3
+#define LL_GPIO_AF_4 4
+#define LL_GPIO_AF_5 5
+#define LL_GPIO_AF_6 6
+#define LL_GPIO_AF_7 7
+#define LL_GPIO_AF_8 8
+#define LL_GPIO_AF_9 9
+#define LL_GPIO_AF_10 10
+#define LL_GPIO_AF_11 11
+#define LL_GPIO_AF_12 12
+#define LL_GPIO_AF_13 13
+#define LL_GPIO_AF_14 14
+#define LL_GPIO_AF_15 15
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    NonMaskableInt_IRQn = -14,
+    HardFault_IRQn = -13,
+    MemoryManagement_IRQn = -12,
+    BusFault_IRQn = -11,
+    UsageFault_IRQn = -10,
+    SVCall_IRQn = -5,
+    DebugMonitor_IRQn = -4,
+    PendSV_IRQn = -2,
+    SysTick_IRQn = -1,
+    I2C1_EV_IRQn = 31,
+    I2C2_EV_IRQn = 33,
+    USART1_IRQn = 37,
+    USART2_IRQn = 38,
+    I2C3_EV_IRQn = 72,
+    USART6_IRQn = 71,
+} IRQn_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t LOAD;
+    __IO uint32_t VAL;
+    __I uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t ICSR;
+    __IO uint32_t VTOR;
+    __IO uint32_t AIRCR;
+    __IO uint32_t SCR;
+    __IO uint32_t CCR;
+    __IO uint32_t SHCSR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+    __IO uint32_t MODER;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+} GPIO_TypeDef;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) externs
+////////////////////////////////////////////////////////////////////////////////
+
+extern uint32_t SystemCoreClock;
+extern SCB_Type host_scb;
+extern CoreDebug_Type host_core_debug;
+extern GPIO_TypeDef host_gpio[HOST_NUM_GPIO_PORTS];
+extern uint32_t host_primask;
+extern uint32_t host_ipsr;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+// Simulated core peripherals.
+SysTick_Type* host_systick(void);
+DWT_Type* host_dwt(void);
+
+// Host shim framework, see host_hal.c.
+void host_init(void);
+void host_poll(void);
+void host_wait(void);
+uint64_t host_get_ns(void);
+
+// Shim hooks called by host_poll() and host_wait(), see the other host files.
+void host_ttys_poll(void);
+int host_ttys_get_poll_fds(int* fds, int max_fds);
+void host_i2c_poll(void);
+
+// Handlers for the simulated interrupts.
+void SysTick_Handler(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// CMSIS core functions
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t __get_PRIMASK(void) { return host_primask; }
+static inline void __set_PRIMASK(uint32_t primask) { host_primask = primask; }
+static inline void __disable_irq(void) { host_primask = 1; }
+static inline void __enable_irq(void) { host_primask = 0; }
+static inline uint32_t __get_IPSR(void) { return host_ipsr; }
+static inline uint32_t __get_CONTROL(void) { return 0; }
+static inline void __DSB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void __DMB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void __ISB(void) { }
+static inline void __NOP(void) { }
+static inline void __WFI(void) { host_wait(); }
+
+static inline uint32_t __LDREXW(volatile uint32_t* addr) { return *addr; }
+
+static inline uint32_t __STREXW(uint32_t value, volatile uint32_t* addr)
+{
+    *addr = value;
+    return 0;
+}
+
+static inline uint32_t NVIC_GetPriorityGrouping(void) { return 0; }
+
+static inline uint32_t NVIC_EncodePriority(uint32_t grouping, uint32_t preempt,
+                                           uint32_t sub)
+{
+    (void)grouping;
+    (void)sub;
+    return preempt;
+}
+
+static inline void NVIC_SetPriority(IRQn_Type irqn, uint32_t prio)
+{
+    (void)irqn;
+    (void)prio;
+}
+
+static inline uint32_t NVIC_GetPriority(IRQn_Type irqn)
+{
+    (void)irqn;
+    return 0;
+}
+
+static inline void NVIC_EnableIRQ(IRQn_Type irqn) { (void)irqn; }
+static inline void NVIC_DisableIRQ(IRQn_Type irqn) { (void)irqn; }
+static inline void NVIC_ClearPendingIRQ(IRQn_Type irqn) { (void)irqn; }
+
+static inline void LL_SYSTICK_EnableIT(void)
+{
+    host_systick()->CTRL |= SysTick_CTRL_TICKINT_Msk;
+}
+
+static inline void LL_SYSTICK_DisableIT(void)
+{
+    host_systick()->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
+}
+
+#endif // _HOST_HAL_H_
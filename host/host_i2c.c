@@ -0,0 +1,535 @@
+/*
+ * @brief Host (x86/Linux) implementation of the i2c module API.
+ *
+ * This file replaces modules/i2c/i2c.c in the host build (see host_main.c).
+ * Rather than a bus, each i2c instance has a set of simulated devices. An
+ * operation started with i2c_write()/i2c_read()/i2c_submit() completes in the
+ * next host_i2c_poll(), which plays the part of the I2C interrupt handler.
+ * An operation to an address without a device fails with I2C_ERR_ACK_FAIL,
+ * as it would on a real bus.
+ *
+ * Currently the only device type is the Sensirion SHT3x temperature/humidity
+ * sensor used by the tmphm module, at addresses 0x44 and 0x45. Any write is
+ * accepted as a command, and any read returns the current measurement. The
+ * simulated temperature cycles slowly around 22 degC, to give the tmphm
+ * statistics something to work on.
+ *
+ * The following console commands are provided:
+ * > i2c status
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_I2C_HDR
+
+#include "cmd.h"
+#include "console.h"
+#include "i2c.h"
+#include "log.h"
+#include "module.h"
+#include "tmr.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define SHT3X_ADDR_A 0x44
+#define SHT3X_ADDR_B 0x45
+#define SHT3X_MEAS_LEN 6
+
+// Simulated temperature cycle.
+#define SIM_TEMP_DEG_C 22.0f
+#define SIM_TEMP_SWING_DEG_C 3.0f
+#define SIM_TEMP_PERIOD_MS 600000
+#define SIM_RH_PERCENT 45.0f
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Per-instance i2c state information.
+struct i2c_state {
+    bool started;
+    bool reserved;
+    bool op_active;
+    bool op_read;
+    uint16_t op_addr;
+    uint8_t* op_bfr;
+    uint32_t op_len;
+    enum i2c_errors last_op_error;
+    struct i2c_xact* xact_head;
+    struct i2c_xact* xact_tail;
+};
+
+enum i2c_u16_pms {
+    CNT_RESERVE_FAIL,
+    CNT_ACK_FAIL,
+    CNT_XACT,
+
+    NUM_U16_PMS
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t start_op(enum i2c_instance_id instance_id, uint32_t dest_addr,
+                        uint8_t* msg_bfr, uint32_t msg_len, bool read);
+static enum i2c_errors dev_access(uint16_t addr, bool read, uint8_t* bfr,
+                                  uint32_t len);
+static uint8_t sht3x_crc8(const uint8_t* data, uint32_t len);
+static int32_t cmd_i2c_status(int32_t argc, const char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static struct i2c_state i2c_states[I2C_NUM_INSTANCES];
+
+static int32_t log_level = LOG_DEFAULT;
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "i2c reserve fail",
+    "i2c ack fail",
+    "i2c xact",
+};
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "status",
+        .func = cmd_i2c_status,
+        .help = "Get module status, usage: i2c status",
+    },
+};
+
+static struct cmd_client_info cmd_info = {
+    .name = "i2c",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Get default i2c configuration.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ * @param[out] cfg The i2c configuration with defaults filled in.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t i2c_get_def_cfg(enum i2c_instance_id instance_id, struct i2c_cfg* cfg)
+{
+    cfg->transaction_guard_time_ms = CONFIG_I2C_DFLT_TRANS_GUARD_TIME_MS;
+    cfg->use_dma = false;
+    return 0;
+}
+
+/*
+ * @brief Initialize i2c instance.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ * @param[in] cfg The i2c configuration.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t i2c_init(enum i2c_instance_id instance_id, struct i2c_cfg* cfg)
+{
+    if (instance_id >= I2C_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (cfg == NULL)
+        return MOD_ERR_ARG;
+
+    memset(&i2c_states[instance_id], 0, sizeof(i2c_states[instance_id]));
+    return 0;
+}
+
+/*
+ * @brief Start i2c instance.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t i2c_start(enum i2c_instance_id instance_id)
+{
+    int32_t result;
+
+    if (instance_id >= I2C_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+
+    result = cmd_register(&cmd_info);
+    if (result < 0) {
+        log_error("i2c_start: cmd_register error %d\n", result);
+        return result;
+    }
+    i2c_states[instance_id].started = true;
+    return 0;
+}
+
+/*
+ * @brief Reserve I2C bus.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t i2c_reserve(enum i2c_instance_id instance_id)
+{
+    struct i2c_state* st;
+    int32_t rc = 0;
+    CRIT_STATE_VAR;
+
+    if (instance_id >= I2C_NUM_INSTANCES || !i2c_states[instance_id].started)
+        return MOD_ERR_BAD_INSTANCE;
+    st = &i2c_states[instance_id];
+
+    CRIT_BEGIN_NEST();
+    if (st->reserved || st->xact_head != NULL) {
+        INC_SAT_U16(cnts_u16[CNT_RESERVE_FAIL]);
+        rc = MOD_ERR_RESOURCE;
+    } else {
+        st->reserved = true;
+    }
+    CRIT_END_NEST();
+    return rc;
+}
+
+/*
+ * @brief Release I2C bus.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t i2c_release(enum i2c_instance_id instance_id)
+{
+    if (instance_id >= I2C_NUM_INSTANCES || !i2c_states[instance_id].started)
+        return MOD_ERR_BAD_INSTANCE;
+    i2c_states[instance_id].reserved = false;
+    return 0;
+}
+
+/*
+ * @brief Queue an I2C transaction.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ * @param[in] xact The transaction descriptor. See struct i2c_xact.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t i2c_submit(enum i2c_instance_id instance_id, struct i2c_xact* xact)
+{
+    struct i2c_state* st;
+    CRIT_STATE_VAR;
+
+    if (instance_id >= I2C_NUM_INSTANCES || !i2c_states[instance_id].started)
+        return MOD_ERR_BAD_INSTANCE;
+    if (xact == NULL || xact->op > I2C_XACT_WRITE_READ ||
+        (xact->op != I2C_XACT_READ && xact->wr_len > 0 &&
+         xact->wr_bfr == NULL) ||
+        (xact->op != I2C_XACT_WRITE && xact->rd_len > 0 &&
+         xact->rd_bfr == NULL))
+        return MOD_ERR_ARG;
+    st = &i2c_states[instance_id];
+
+    xact->rc = MOD_ERR_OP_IN_PROG;
+    xact->error = I2C_ERR_NONE;
+    xact->next = NULL;
+
+    CRIT_BEGIN_NEST();
+    if (st->xact_head == NULL)
+        st->xact_head = xact;
+    else
+        st->xact_tail->next = xact;
+    st->xact_tail = xact;
+    CRIT_END_NEST();
+    return 0;
+}
+
+/*
+ * @brief Initiate I2C write.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ * @param[in] dest_Addr I2C destination address (not shifted).
+ * @param[in] msg_bfr Buffer containing data bytes to send.
+ * @param[in] msg_len Number of bytes in messages.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t i2c_write(enum i2c_instance_id instance_id, uint32_t dest_addr,
+                  uint8_t* msg_bfr, uint32_t msg_len)
+{
+    return start_op(instance_id, dest_addr, msg_bfr, msg_len, false);
+}
+
+/*
+ * @brief Initiate I2C read.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ * @param[in] dest_Addr I2C destination address (not shifted).
+ * @param[in] msg_bfr Buffer to contain received data bytes.
+ * @param[in] msg_len Number of bytes to receive.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t i2c_read(enum i2c_instance_id instance_id, uint32_t dest_addr,
+                 uint8_t* msg_bfr, uint32_t msg_len)
+{
+    return start_op(instance_id, dest_addr, msg_bfr, msg_len, true);
+}
+
+/*
+ * @brief Get detailed error information.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ *
+ * @return I2C error code (enum i2c_errors).
+ */
+enum i2c_errors i2c_get_error(enum i2c_instance_id instance_id)
+{
+    if (instance_id >= I2C_NUM_INSTANCES || !i2c_states[instance_id].started)
+        return I2C_ERR_INVALID_INSTANCE;
+    return i2c_states[instance_id].last_op_error;
+}
+
+/*
+ * @brief Get status of operation.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ *
+ * @return 0 if operation was successful, else a "MOD_ERR" value. See code for
+ *         details.
+ */
+int32_t i2c_get_op_status(enum i2c_instance_id instance_id)
+{
+    struct i2c_state* st;
+
+    if (instance_id >= I2C_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+
+    st = &i2c_states[instance_id];
+    if (!st->reserved)
+        return MOD_ERR_NOT_RESERVED;
+    if (st->op_active)
+        return MOD_ERR_OP_IN_PROG;
+    return st->last_op_error == I2C_ERR_NONE ? 0 : MOD_ERR_PERIPH;
+}
+
+/*
+ * @brief Check if the bus is busy.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ *
+ * @return 0 if not busy, 1 if busy, else a "MOD_ERR" value (< 0).
+ */
+int32_t i2c_bus_busy(enum i2c_instance_id instance_id)
+{
+    if (instance_id >= I2C_NUM_INSTANCES || !i2c_states[instance_id].started)
+        return MOD_ERR_BAD_INSTANCE;
+    return i2c_states[instance_id].op_active ? 1 : 0;
+}
+
+/*
+ * @brief Complete the active operations, as the interrupt handler would.
+ *
+ * This is called by host_poll(). Each instance completes at most one
+ * operation or transaction per call, so the completion is never in the same
+ * super loop pass as the start.
+ */
+void host_i2c_poll(void)
+{
+    struct i2c_state* st;
+    struct i2c_xact* xact;
+    int32_t instance_id;
+
+    for (instance_id = 0; instance_id < I2C_NUM_INSTANCES; instance_id++) {
+        st = &i2c_states[instance_id];
+        if (st->op_active) {
+            st->last_op_error = dev_access(st->op_addr, st->op_read, st->op_bfr,
+                                           st->op_len);
+            st->op_active = false;
+        } else if (st->xact_head != NULL && !st->reserved) {
+            xact = st->xact_head;
+            st->xact_head = xact->next;
+            if (st->xact_head == NULL)
+                st->xact_tail = NULL;
+            xact->error = I2C_ERR_NONE;
+            if (xact->op != I2C_XACT_READ)
+                xact->error = dev_access(xact->dest_addr, false, xact->wr_bfr,
+                                         xact->wr_len);
+            if (xact->op != I2C_XACT_WRITE && xact->error == I2C_ERR_NONE)
+                xact->error = dev_access(xact->dest_addr, true, xact->rd_bfr,
+                                         xact->rd_len);
+            xact->rc = xact->error == I2C_ERR_NONE ? 0 : MOD_ERR_PERIPH;
+            INC_SAT_U16(cnts_u16[CNT_XACT]);
+            if (xact->cb != NULL)
+                xact->cb(xact);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Start a write or read operation.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ * @param[in] dest_Addr I2C destination address (not shifted).
+ * @param[in] msg_bfr Message buffer.
+ * @param[in] msg_len Number of bytes to write or read.
+ * @param[in] read True for a read, else a write.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t start_op(enum i2c_instance_id instance_id, uint32_t dest_addr,
+                        uint8_t* msg_bfr, uint32_t msg_len, bool read)
+{
+    struct i2c_state* st;
+
+    if (instance_id >= I2C_NUM_INSTANCES || !i2c_states[instance_id].started)
+        return MOD_ERR_BAD_INSTANCE;
+
+    st = &i2c_states[instance_id];
+    if (!st->reserved)
+        return MOD_ERR_NOT_RESERVED;
+    if (st->op_active)
+        return MOD_ERR_STATE;
+
+    st->op_addr = dest_addr;
+    st->op_bfr = msg_bfr;
+    st->op_len = msg_len;
+    st->op_read = read;
+    st->op_active = true;
+    return 0;
+}
+
+/*
+ * @brief Access a simulated device.
+ *
+ * @param[in] addr I2C address (not shifted).
+ * @param[in] read True for a read, else a write.
+ * @param[in,out] bfr Data written, or buffer for data read.
+ * @param[in] len Number of bytes.
+ *
+ * @return I2C_ERR_NONE for success, else an I2C error.
+ */
+static enum i2c_errors dev_access(uint16_t addr, bool read, uint8_t* bfr,
+                                  uint32_t len)
+{
+    uint8_t meas[SHT3X_MEAS_LEN];
+    float phase;
+    uint32_t raw;
+
+    if (addr != SHT3X_ADDR_A && addr != SHT3X_ADDR_B) {
+        INC_SAT_U16(cnts_u16[CNT_ACK_FAIL]);
+        return I2C_ERR_ACK_FAIL;
+    }
+    if (!read)
+        return I2C_ERR_NONE;
+
+    // Conversions per the SHT3x datasheet, section 4.13.
+    phase = (float)(tmr_get_ms() % SIM_TEMP_PERIOD_MS) / SIM_TEMP_PERIOD_MS;
+    raw = (uint32_t)((SIM_TEMP_DEG_C +
+                      SIM_TEMP_SWING_DEG_C * sinf(2 * (float)M_PI * phase) +
+                      45.0f) * 65535.0f / 175.0f);
+    meas[0] = raw >> 8;
+    meas[1] = raw & 0xff;
+    meas[2] = sht3x_crc8(&meas[0], 2);
+    raw = (uint32_t)(SIM_RH_PERCENT * 65535.0f / 100.0f);
+    meas[3] = raw >> 8;
+    meas[4] = raw & 0xff;
+    meas[5] = sht3x_crc8(&meas[3], 2);
+    memcpy(bfr, meas, len < SHT3X_MEAS_LEN ? len : SHT3X_MEAS_LEN);
+    if (len > SHT3X_MEAS_LEN)
+        memset(bfr + SHT3X_MEAS_LEN, 0xff, len - SHT3X_MEAS_LEN);
+    return I2C_ERR_NONE;
+}
+
+/*
+ * @brief Compute the SHT3x CRC-8 (polynomial 0x31, initial value 0xff).
+ *
+ * @param[in] data Data bytes.
+ * @param[in] len Number of bytes.
+ *
+ * @return CRC value.
+ */
+static uint8_t sht3x_crc8(const uint8_t* data, uint32_t len)
+{
+    uint8_t crc = 0xff;
+    uint32_t bit;
+
+    while (len-- > 0) {
+        crc ^= *data++;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+    return crc;
+}
+
+/*
+ * @brief Console command function for "i2c status".
+ *
+ * @param[in] argc Number of arguments, including "i2c"
+ * @param[in] argv Argument values, including "i2c"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: i2c status
+ */
+static int32_t cmd_i2c_status(int32_t argc, const char** argv)
+{
+    struct i2c_state* st;
+    int32_t instance_id;
+
+    for (instance_id = 0; instance_id < I2C_NUM_INSTANCES; instance_id++) {
+        st = &i2c_states[instance_id];
+        printc("Instance %ld: started=%d reserved=%d op_active=%d "
+               "last_op_error=%d xact_queued=%d\n", instance_id, st->started,
+               st->reserved, st->op_active, st->last_op_error,
+               st->xact_head != NULL);
+    }
+    printc("Simulated devices: SHT3x at 0x%02x, 0x%02x\n", SHT3X_ADDR_A,
+           SHT3X_ADDR_B);
+    return 0;
+}
@@ -0,0 +1,791 @@
+/*
+ * @brief Main file for the host (x86/Linux) simulation build.
+ *
+ * This file plays the part of app1/app_main.c for the host build. It
+ * initializes and starts the modules that can run on the host, and then runs
+ * the super loop. The hardware is simulated by the other files in this
+ * directory:
+ * - host_hal.c: The core peripherals (SysTick, DWT cycle counter, PRIMASK).
+ * - host_ttys.c: The ttys API over stdin/stdout, ptys and files.
+ * - host_dio.c: The dio API, with inputs driven by "dio sim".
+ * - host_i2c.c: The i2c API, with simulated SHT3x sensors for tmphm.
+ * - host_flash.c: The flash API over a RAM image, optionally mapped from the
+ *   file named by HOST_FLASH.
+ *
+ * With CONFIG_FEAT_DRAW, the draw kinematics and the step sequencing run
+ * unchanged, with the motor outputs going to the simulated dio.
+ *
+ * Modules that program peripheral registers directly (fault, wdg, can, mem,
+ * os) are not part of the host build.
+ *
+ * The pure logic modules run unchanged, so they can be exercised under perf,
+ * valgrind, gdb, sanitizers etc., and benchmarked (see the bench module) at
+ * host speed. Build from the top directory, for example:
+ *
+ *   gcc -std=gnu11 -O2 -g -DHOST_LINUX -DCONFIG_FEAT_BENCH \
+ *       -DCONFIG_FEAT_FLOAT -DCONFIG_FEAT_GPS -DCONFIG_GPS_PRESENT=1 \
+ *       -DCONFIG_TTYS_6_PRESENT=1 -DCONFIG_FEAT_TMPHM -DCONFIG_FEAT_TELEM \
+ *       -DCONFIG_FEAT_DRAW -Ihost -Imodules/include -o host_app \
+ *       host/host_*.c modules/bench/bench.c modules/blinky/blinky.c \
+ *       modules/cmd/cmd.c modules/console/console.c modules/crc/crc.c \
+ *       modules/draw/draw.c modules/float/float.c modules/float/whetstone.c \
+ *       modules/fmt/fmt.c modules/gps_gtu7/gps_gtu7.c modules/log/log.c \
+ *       modules/lwl/lwl.c modules/sched/sched.c modules/stat/stat.c \
+ *       modules/step/step.c modules/telem/telem.c modules/tmphm/tmphm.c \
+ *       modules/tmr/tmr.c -lm
+ *
+ * and run as, for example:
+ *
+ *   HOST_TTYS_6=nmea.txt HOST_FLASH=flash.img ./host_app
+ *
+ * The console is on stdin/stdout, so commands can also be piped in, e.g.
+ * "echo 'bench run csv' | ./host_app". The program runs until killed.
+ *
+ * The modules print 32-bit values with "%lu" and "%ld", as long is 32 bits on
+ * the target. On the host, fmt reads "l" arguments as 32 bits (so negative
+ * values print correctly), and printc() is not format checked.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+#include "bench.h"
+#include "blinky.h"
+#include "cmd.h"
+#include "console.h"
+#include "dio.h"
+#include "draw.h"
+#include "flash.h"
+#include "float.h"
+#include "gps_gtu7.h"
+#include "i2c.h"
+#include "log.h"
+#include "lwl.h"
+#include "module.h"
+#include "sched.h"
+#include "stat.h"
+#include "step.h"
+#include "telem.h"
+#include "tmphm.h"
+#include "ttys.h"
+#include "tmr.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+#define MOD_NO_INSTANCE -1
+
+typedef int32_t (*mod_get_def_cfg)(void* cfg);
+typedef int32_t (*mod_init)(void* cfg);
+typedef int32_t (*mod_start)(void);
+typedef int32_t (*mod_run)(void);
+
+typedef int32_t (*mod_instance_get_def_cfg)(int instanced, void* cfg);
+typedef int32_t (*mod_instance_init)(int instance, void* cfg);
+typedef int32_t (*mod_instance_start)(int instance);
+typedef int32_t (*mod_instance_run)(int instance);
+
+struct mod_info {
+    const char* name;
+    int instance;
+    union {
+        struct {
+            mod_get_def_cfg mod_get_def_cfg;
+            mod_init mod_init;
+            mod_start mod_start;
+            mod_run mod_run;
+        } singleton;
+        struct {
+            mod_instance_get_def_cfg mod_get_def_cfg;
+            mod_instance_init mod_init;
+            mod_instance_start mod_start;
+            mod_instance_run mod_run;
+        } multi_instance;
+    } ops;
+    void* cfg_obj;
+    uint8_t sched_prio;  // Priority of run function, higher runs first.
+};
+
+// Run time profile of a module, measured around each call of its run function.
+struct mod_run_prof {
+    uint64_t total_cyc;
+    uint32_t max_cyc;
+    uint32_t calls;
+};
+
+enum main_u16_pms {
+    CNT_INIT_ERR,
+    CNT_START_ERR,
+    CNT_RUN_ERR,
+
+    NUM_U16_PMS
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t mod_task(int32_t mod_idx);
+static void sched_setup(void);
+static int32_t cmd_main_status(int32_t argc, const char** argv);
+static int32_t cmd_main_prof(int32_t argc, const char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t log_level = LOG_DEFAULT;
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "status",
+        .func = cmd_main_status,
+        .help = "Get main status, usage: main status [clear]",
+    },
+    {
+        .name = "prof",
+        .func = cmd_main_prof,
+        .help = "Get module run time profile, usage: main prof [clear]",
+    },
+};
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "init err",
+    "start err",
+    "run err",
+};
+
+static struct cmd_client_info cmd_info = {
+    .name = "main",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
+// Simulated DIO, with the same names as the F401 (Nucleo) board in app1.
+//
+// These variables must be static because the dio module, during initialization,
+// keeps pointers to them, and continues to accesses them after initialization.
+
+enum din_index {
+    DIN_BUTTON_1,
+    DIN_GPS_PPS,
+
+    DIN_NUM,
+};
+
+static struct dio_in_info d_inputs[DIN_NUM] = {
+    {
+        .name = "Button_1",
+        .port = DIO_PORT_C,
+        .pin = DIO_PIN_13,
+        .pull = DIO_PULL_NO,
+        .invert = 1,
+    },
+    {
+        .name = "PPS",
+        .port = DIO_PORT_B,
+        .pin = DIO_PIN_3,
+        .pull = DIO_PULL_NO,
+        .edge = DIO_EDGE_RISING,
+    }
+};
+
+enum dout_index {
+    DOUT_LED_2,
+
+    DOUT_NUM,
+
+    DOUT_LED_BLINKY = DOUT_LED_2,
+};
+
+static struct dio_out_info d_outputs[DOUT_NUM] = {
+    {
+        .name = "LED_2",
+        .port = DIO_PORT_A,
+        .pin = DIO_PIN_5,
+        .pull = DIO_PULL_NO,
+        .init_value = 0,
+        .speed = DIO_SPEED_FREQ_LOW,
+        .output_type = DIO_OUTPUT_PUSHPULL,
+    }
+};
+
+static struct dio_cfg dio_cfg = {
+    .num_inputs = ARRAY_SIZE(d_inputs),
+    .inputs = d_inputs,
+    .num_outputs = ARRAY_SIZE(d_outputs),
+    .outputs = d_outputs,
+};
+
+static struct stat_cyc_dur stat_loop_dur;
+
+static struct console_cfg console_cfg;
+
+#if CONFIG_GPS_PRESENT
+    static struct gps_cfg gps_cfg;
+#endif
+
+#if CONFIG_I2C_3_PRESENT
+    static struct i2c_cfg i2c_cfg;
+#endif
+
+#if CONFIG_TTYS_2_PRESENT
+    static struct ttys_cfg ttys_cfg_2;
+#endif
+
+#if CONFIG_TTYS_6_PRESENT
+    static struct ttys_cfg ttys_cfg_6;
+#endif
+
+static struct blinky_cfg blinky_cfg = {
+    .dout_idx = DOUT_LED_BLINKY,
+    .code_num_blinks = 5,
+    .code_period_ms = 1000,
+    .sep_num_blinks = 5,
+    .sep_period_ms = 200,
+};
+
+#if CONFIG_TMPHM_1_PRESENT
+    static struct tmphm_cfg tmphm_cfg;
+#endif
+
+#if CONFIG_STEP_1_PRESENT
+    static struct step_cfg step_cfg_1;
+#endif
+
+#if CONFIG_STEP_2_PRESENT
+    static struct step_cfg step_cfg_2;
+#endif
+
+#if CONFIG_DRAW_PRESENT
+    static struct draw_cfg draw_cfg;
+#endif
+
+static struct mod_info mods[] = {
+
+#if CONFIG_TTYS_2_PRESENT
+    {
+        .name = "ttys",
+        .instance = TTYS_INSTANCE_2,
+        .ops.multi_instance.mod_get_def_cfg =
+            (mod_instance_get_def_cfg)ttys_get_def_cfg,
+        .ops.multi_instance.mod_init = (mod_instance_init)ttys_init,
+        .ops.multi_instance.mod_start = (mod_instance_start)ttys_start,
+        .cfg_obj = &ttys_cfg_2,
+    },
+#endif
+
+#if CONFIG_TTYS_6_PRESENT
+    {
+        .name = "ttys",
+        .instance = TTYS_INSTANCE_6,
+        .ops.multi_instance.mod_get_def_cfg =
+            (mod_instance_get_def_cfg)ttys_get_def_cfg,
+        .ops.multi_instance.mod_init = (mod_instance_init)ttys_init,
+        .ops.multi_instance.mod_start = (mod_instance_start)ttys_start,
+        .cfg_obj = &ttys_cfg_6,
+    },
+#endif
+
+    {
+        .name = "cmd",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_init = (mod_init)cmd_init,
+    },
+    {
+        .name = "console",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_get_def_cfg = (mod_get_def_cfg)console_get_def_cfg,
+        .ops.singleton.mod_init = (mod_init)console_init,
+        .ops.singleton.mod_start = (mod_start)console_start,
+        .ops.singleton.mod_run = (mod_run)console_run,
+        .cfg_obj = &console_cfg,
+        .sched_prio = 1,
+    },
+    {
+        .name = "log",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)log_start,
+        .ops.singleton.mod_run = (mod_run)log_run,
+    },
+
+    // Other modules log to lwl unconditionally, so it is always linked in.
+    {
+        .name = "lwl",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)lwl_start,
+        .ops.singleton.mod_run = (mod_run)lwl_run,
+    },
+    {
+        .name = "tmr",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_init = (mod_init)tmr_init,
+        .ops.singleton.mod_start = (mod_start)tmr_start,
+        .ops.singleton.mod_run = (mod_run)tmr_run,
+        .sched_prio = 3,
+    },
+    {
+        .name = "sched",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)sched_start,
+    },
+
+#if CONFIG_BENCH_PRESENT
+    {
+        .name = "bench",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)bench_start,
+    },
+#endif
+
+#if CONFIG_TELEM_PRESENT
+    {
+        .name = "telem",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_init = (mod_init)telem_init,
+        .ops.singleton.mod_start = (mod_start)telem_start,
+        .ops.singleton.mod_run = (mod_run)telem_run,
+    },
+#endif
+
+    {
+        .name = "blinky",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_init = (mod_init)blinky_init,
+        .ops.singleton.mod_start = (mod_start)blinky_start,
+        .cfg_obj = &blinky_cfg,
+    },
+    {
+        .name = "dio",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_init = (mod_init)dio_init,
+        .ops.singleton.mod_start = (mod_start)dio_start,
+        .cfg_obj = &dio_cfg,
+    },
+
+#if CONFIG_GPS_PRESENT
+    {
+        .name = "gps",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_get_def_cfg = (mod_get_def_cfg)gps_get_def_cfg,
+        .ops.singleton.mod_init = (mod_init)gps_init,
+        .ops.singleton.mod_start = (mod_start)gps_start,
+        .ops.singleton.mod_run = (mod_run)gps_run,
+        .cfg_obj = &gps_cfg,
+        .sched_prio = 2,
+    },
+#endif
+
+#if CONFIG_I2C_3_PRESENT
+    {
+        .name = "i2c",
+        .instance = I2C_INSTANCE_3,
+        .ops.multi_instance.mod_get_def_cfg =
+            (mod_instance_get_def_cfg)i2c_get_def_cfg,
+        .ops.multi_instance.mod_init = (mod_instance_init)i2c_init,
+        .ops.multi_instance.mod_start = (mod_instance_start)i2c_start,
+        .cfg_obj = &i2c_cfg,
+    },
+#endif
+
+#if CONFIG_TMPHM_1_PRESENT
+    {
+        .name = "tmphm",
+        .instance = TMPHM_INSTANCE_1,
+        .ops.multi_instance.mod_get_def_cfg =
+            (mod_instance_get_def_cfg)tmphm_get_def_cfg,
+        .ops.multi_instance.mod_init = (mod_instance_init)tmphm_init,
+        .ops.multi_instance.mod_start = (mod_instance_start)tmphm_start,
+        .ops.multi_instance.mod_run = (mod_instance_run)tmphm_run,
+        .cfg_obj = &tmphm_cfg,
+    },
+#endif
+
+#if CONFIG_FLOAT_PRESENT
+    {
+        .name = "float",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)float_start,
+    },
+#endif
+
+#if CONFIG_FLASH_PRESENT
+    {
+        .name = "flash",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_start = (mod_start)flash_start,
+        .ops.singleton.mod_run = (mod_run)flash_run,
+    },
+#endif
+
+#if CONFIG_STEP_1_PRESENT
+    {
+        .name = "step",
+        .instance = STEP_INSTANCE_1,
+        .ops.multi_instance.mod_get_def_cfg =
+            (mod_instance_get_def_cfg)step_get_def_cfg,
+        .ops.multi_instance.mod_init = (mod_instance_init)step_init,
+        .ops.multi_instance.mod_start = (mod_instance_start)step_start,
+        .cfg_obj = &step_cfg_1,
+    },
+#endif
+
+#if CONFIG_STEP_2_PRESENT
+    {
+        .name = "step",
+        .instance = STEP_INSTANCE_2,
+        .ops.multi_instance.mod_get_def_cfg =
+            (mod_instance_get_def_cfg)step_get_def_cfg,
+        .ops.multi_instance.mod_init = (mod_instance_init)step_init,
+        .ops.multi_instance.mod_start = (mod_instance_start)step_start,
+        .cfg_obj = &step_cfg_2,
+    },
+#endif
+
+#if CONFIG_DRAW_PRESENT
+    {
+        .name = "draw",
+        .instance = MOD_NO_INSTANCE,
+        .ops.singleton.mod_get_def_cfg = (mod_get_def_cfg)draw_get_def_cfg,
+        .ops.singleton.mod_init = (mod_init)draw_init,
+        .ops.singleton.mod_start = (mod_start)draw_start,
+        .ops.singleton.mod_run = (mod_run)draw_run,
+        .cfg_obj = &draw_cfg,
+    },
+#endif
+
+};
+
+static struct mod_run_prof mod_run_profs[ARRAY_SIZE(mods)];
+
+// Sched task ID for each module's run function (or SCHED_NO_TASK).
+static int32_t mod_task_ids[ARRAY_SIZE(mods)];
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+int main(void)
+{
+    int32_t rc;
+    int32_t idx;
+    struct mod_info* mod;
+
+    host_init();
+
+    // As on the target, so the lwl benchmark and lwl records work.
+    lwl_enable(true);
+
+    //
+    // Invoke the init API on modules the use it.
+    //
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+    printc("\nInit: Init modules\n");
+
+    for (idx = 0, mod = mods;
+         idx < ARRAY_SIZE(mods);
+         idx++, mod++) {
+        if (mod->ops.singleton.mod_get_def_cfg != NULL &&
+            mod->cfg_obj != NULL) {
+            if (mod->instance == MOD_NO_INSTANCE) {
+                rc = mod->ops.singleton.mod_get_def_cfg(mod->cfg_obj);
+            } else {
+                rc = mod->ops.multi_instance.mod_get_def_cfg(mod->instance,
+                                                             mod->cfg_obj);
+            }
+            if (rc < 0) {
+                log_error("Default cfg error for %s[%d]: %d\n", mod->name,
+                          mod->instance, rc);
+                INC_SAT_U16(cnts_u16[CNT_INIT_ERR]);
+            }
+        }
+    }
+
+    for (idx = 0, mod = mods;
+         idx < ARRAY_SIZE(mods);
+         idx++, mod++) {
+        if (mod->ops.singleton.mod_init != NULL) {
+            if (mod->instance == MOD_NO_INSTANCE) {
+                rc = mod->ops.singleton.mod_init(mod->cfg_obj);
+            } else {
+                rc = mod->ops.multi_instance.mod_init(mod->instance,
+                                                      mod->cfg_obj);
+            }
+            if (rc < 0) {
+                log_error("Init error for %s[%d]: %d\n", mod->name,
+                          mod->instance, rc);
+                INC_SAT_U16(cnts_u16[CNT_INIT_ERR]);
+            }
+        }
+    }
+
+    //
+    // Invoke the start API on modules the use it.
+    //
+
+    printc("Init: Start modules\n");
+
+    for (idx = 0, mod = mods;
+         idx < ARRAY_SIZE(mods);
+         idx++, mod++) {
+        if (mod->ops.singleton.mod_start != NULL) {
+            if (mod->instance == MOD_NO_INSTANCE) {
+                rc = mod->ops.singleton.mod_start();
+            } else {
+                rc = mod->ops.multi_instance.mod_start(mod->instance);
+            }
+            if (rc < 0) {
+                log_error("Start error for %s: %d\n", mod->name, rc);
+                INC_SAT_U16(cnts_u16[CNT_START_ERR]);
+            }
+        }
+    }
+
+    rc = cmd_register(&cmd_info);
+    if (rc < 0) {
+        log_error("main: cmd_register error %d\n", rc);
+        INC_SAT_U16(cnts_u16[CNT_START_ERR]);
+    }
+
+#if CONFIG_TELEM_PRESENT
+    rc = telem_register_cyc_dur("loop", &stat_loop_dur);
+    if (rc < 0) {
+        log_error("main: telem_register_cyc_dur error %d\n", rc);
+        INC_SAT_U16(cnts_u16[CNT_START_ERR]);
+    }
+#endif
+
+    sched_setup();
+
+    stat_cyc_dur_init(&stat_loop_dur);
+
+    //
+    // In the super loop deliver the simulated interrupts, run the ready module
+    // tasks, then sleep until there is more to do.
+    //
+
+    printc("Init: Enter super loop\n");
+    while (1)
+    {
+        // Only the work in a pass is timed, not the idle sleep.
+        stat_cyc_dur_start(&stat_loop_dur);
+        host_poll();
+        sched_run();
+        stat_cyc_dur_end(&stat_loop_dur);
+
+        // Sleep until a task is posted, the next tick, or ttys input.
+        sched_idle();
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Sched task function that runs a module's run function.
+ *
+ * @param[in] mod_idx Index of the module in mods[].
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The run function call is profiled (see "main prof").
+ */
+static int32_t mod_task(int32_t mod_idx)
+{
+    struct mod_info* mod = &mods[mod_idx];
+    struct mod_run_prof* prof = &mod_run_profs[mod_idx];
+    uint32_t start_cyc = stat_cyc_get();
+    uint32_t dur_cyc;
+    int32_t rc;
+
+    if (mod->instance == MOD_NO_INSTANCE) {
+        rc = mod->ops.singleton.mod_run();
+    } else {
+        rc = mod->ops.multi_instance.mod_run(mod->instance);
+    }
+
+    dur_cyc = stat_cyc_get() - start_cyc;
+    prof->total_cyc += dur_cyc;
+    prof->calls++;
+    if (dur_cyc > prof->max_cyc)
+        prof->max_cyc = dur_cyc;
+
+    if (rc < 0) {
+        log_error("Run error for %s: %d\n", mod->name, rc);
+        INC_SAT_U16(cnts_u16[CNT_RUN_ERR]);
+    }
+    return rc;
+}
+
+/*
+ * @brief Add sched tasks for the module run functions.
+ *
+ * As in app1, all tasks start out polled, and the GPS task is switched to
+ * event driven once it is hooked up to its ttys instance.
+ */
+static void sched_setup(void)
+{
+    int32_t idx;
+    struct mod_info* mod;
+
+    for (idx = 0, mod = mods;
+         idx < ARRAY_SIZE(mods);
+         idx++, mod++) {
+        mod_task_ids[idx] = SCHED_NO_TASK;
+        if (mod->ops.singleton.mod_run != NULL) {
+            mod_task_ids[idx] = sched_task_add(mod->name, mod_task, idx,
+                                               mod->sched_prio, true);
+            if (mod_task_ids[idx] < 0) {
+                log_error("main: sched_task_add error %d for %s\n",
+                          mod_task_ids[idx], mod->name);
+                INC_SAT_U16(cnts_u16[CNT_START_ERR]);
+            }
+        }
+
+#if CONFIG_GPS_PRESENT
+        if (mod->cfg_obj == &gps_cfg && mod_task_ids[idx] >= 0 &&
+            ttys_set_rx_task(gps_cfg.ttys_instance_id, mod_task_ids[idx]) == 0)
+            sched_task_set_poll(mod_task_ids[idx], false);
+#endif
+    }
+}
+
+/*
+ * @brief Console command function for "main status".
+ *
+ * @param[in] argc Number of arguments, including "main"
+ * @param[in] argv Argument values, including "main"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: main status [clear]
+ */
+static int32_t cmd_main_status(int32_t argc, const char** argv)
+{
+    if (argc > 3 || (argc == 3 && strcasecmp(argv[2], "clear") != 0)) {
+        printc("Invalid arguments\n");
+        return MOD_ERR_ARG;
+    }
+
+    printc("Host uptime %llu ms\n",
+           (unsigned long long)(host_get_ns() / 1000000));
+    printc("Super loop samples=%lu min=%lu ns, max=%lu ns, avg=%lu ns\n",
+           stat_loop_dur.samples, stat_cyc_to_ns(stat_loop_dur.min),
+           stat_cyc_to_ns(stat_loop_dur.max),
+           stat_cyc_dur_avg_ns(&stat_loop_dur));
+    printc("Super loop p50=%lu ns, p99=%lu ns, p999=%lu ns\n",
+           stat_cyc_dur_pctl_ns(&stat_loop_dur, 5000),
+           stat_cyc_dur_pctl_ns(&stat_loop_dur, 9900),
+           stat_cyc_dur_pctl_ns(&stat_loop_dur, 9990));
+
+    if (argc == 3) {
+        printc("Clearing loop stat\n");
+        stat_cyc_dur_init(&stat_loop_dur);
+    }
+    return 0;
+}
+
+/*
+ * @brief Console command function for "main prof".
+ *
+ * @param[in] argc Number of arguments, including "main"
+ * @param[in] argv Argument values, including "main"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: main prof [clear]
+ *
+ * Modules are listed in order of total run time consumed.
+ */
+static int32_t cmd_main_prof(int32_t argc, const char** argv)
+{
+    uint8_t order[ARRAY_SIZE(mods)];
+    uint64_t all_cyc = 0;
+    uint32_t idx;
+    uint32_t idx2;
+
+    if (argc > 3 || (argc == 3 && strcasecmp(argv[2], "clear") != 0)) {
+        printc("Invalid arguments\n");
+        return MOD_ERR_ARG;
+    }
+
+    // Insertion sort of module indices, by decreasing total time.
+    for (idx = 0; idx < ARRAY_SIZE(mods); idx++) {
+        uint64_t total_cyc = mod_run_profs[idx].total_cyc;
+        all_cyc += total_cyc;
+        for (idx2 = idx;
+             idx2 > 0 && mod_run_profs[order[idx2 - 1]].total_cyc < total_cyc;
+             idx2--)
+            order[idx2] = order[idx2 - 1];
+        order[idx2] = idx;
+    }
+
+    printc("Module   Inst    Calls     Total us   Pct   Avg ns     Max ns\n"
+           "-------- ---- ---------- ---------- ----- ---------- ----------\n");
+    for (idx = 0; idx < ARRAY_SIZE(mods); idx++) {
+        struct mod_info* mod = &mods[order[idx]];
+        struct mod_run_prof* prof = &mod_run_profs[order[idx]];
+
+        if (mod->ops.singleton.mod_run == NULL)
+            continue;
+        printc("%-8s %4d %10lu %10lu %3lu.%lu %10lu %10lu\n",
+               mod->name, mod->instance == MOD_NO_INSTANCE ? 0 : mod->instance,
+               prof->calls, stat_cyc_to_us64(prof->total_cyc),
+               all_cyc == 0 ? 0 : (uint32_t)(prof->total_cyc * 100 / all_cyc),
+               all_cyc == 0 ? 0 :
+               (uint32_t)((prof->total_cyc * 1000 / all_cyc) % 10),
+               prof->calls == 0 ? 0 :
+               stat_cyc_to_ns(prof->total_cyc / prof->calls),
+               stat_cyc_to_ns(prof->max_cyc));
+    }
+
+    if (argc == 3) {
+        printc("Clearing profile\n");
+        memset(mod_run_profs, 0, sizeof(mod_run_profs));
+    }
+    return 0;
+}
@@ -0,0 +1,637 @@
+/*
+ * @brief Host (x86/Linux) implementation of the ttys module API.
+ *
+ * This file replaces modules/ttys/ttys.c in the host build (see host_main.c).
+ * Each ttys instance maps to Linux file descriptors rather than a UART:
+ * - The console instance (CONFIG_CONSOLE_DFLT_TTYS_INSTANCE) uses stdin and
+ *   stdout. If stdin is a terminal it is put in non-canonical mode without
+ *   echo, as the console module does its own line editing.
+ * - Other instances use the file named by environment variable
+ *   HOST_TTYS_<uart-num>, e.g. HOST_TTYS_6=/dev/pts/3 for a pty, or a file of
+ *   recorded NMEA sentences for the GPS module. If the variable is not set,
+ *   the instance has no device; output is discarded and there is no input.
+ *
+ * Output is written directly to the file descriptor, so the TX buffer is
+ * always empty and no TX storage is used. Input is read in host_ttys_poll(),
+ * which plays the part of the RX interrupt handler: it fills the RX buffer and
+ * posts the RX task (see ttys_set_rx_task()). With rx_wake_on_idle, the task is
+ * posted once for the characters read in each poll, the host equivalent of a
+ * burst ending in an idle line.
+ *
+ * The following console commands are provided:
+ * > ttys pm
+ * > ttys log
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_USART_HDR
+
+#include "cmd.h"
+#include "console.h"
+#include "log.h"
+#include "module.h"
+#include "ring.h"
+#include "sched.h"
+#include "ttys.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define NO_FD -1
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Per-instance ttys state information.
+struct ttys_state {
+    struct ttys_cfg cfg;
+    FILE* stream;
+    int in_fd;
+    int out_fd;
+    uint8_t uart_num;
+    bool initialized;
+    struct ring rx_ring;
+    int32_t rx_task_id;
+    char* rx_buf;
+};
+
+// Performance measurements for ttys. Currently these are common to all
+// instances.  A future enhancement would be to make them per-instance.
+
+enum ttys_u16_pms {
+    CNT_TX_WRITE_ERR,
+    CNT_RX_READ_ERR,
+    CNT_RX_BUF_OVERRUN,
+
+    NUM_U16_PMS
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t get_uart_num(enum ttys_instance_id instance_id);
+static int32_t open_fds(struct ttys_state* st, bool is_console);
+static void term_restore(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static struct ttys_state ttys_states[TTYS_NUM_INSTANCES];
+
+// Default RX buffer storage for each instance.
+
+#if CONFIG_TTYS_1_PRESENT
+static char rx_buf_1[CONFIG_TTYS_1_RX_BUF_SIZE];
+#endif
+
+#if CONFIG_TTYS_2_PRESENT
+static char rx_buf_2[CONFIG_TTYS_2_RX_BUF_SIZE];
+#endif
+
+#if CONFIG_TTYS_3_PRESENT
+static char rx_buf_3[CONFIG_TTYS_3_RX_BUF_SIZE];
+#endif
+
+#if CONFIG_TTYS_6_PRESENT
+static char rx_buf_6[CONFIG_TTYS_6_RX_BUF_SIZE];
+#endif
+
+static int32_t log_level = LOG_DEFAULT;
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "tx write err",
+    "rx read err",
+    "rx buf overrun",
+};
+
+static struct cmd_client_info cmd_info = {
+    .name = "ttys",
+    .num_cmds = 0,
+    .cmds = NULL,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
+static bool term_saved;
+static struct termios term_save;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Get default ttys configuration.
+ *
+ * @param[out] cfg The ttys configuration with defaults filled in.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t ttys_get_def_cfg(enum ttys_instance_id instance_id, struct ttys_cfg* cfg)
+{
+    if (cfg == NULL)
+        return MOD_ERR_ARG;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->create_stream = true;
+    cfg->send_cr_after_nl = true;
+    cfg->use_dma = false;
+    cfg->rx_wake_on_idle = true;
+
+    switch (instance_id) {
+#if CONFIG_TTYS_1_PRESENT
+        case TTYS_INSTANCE_1:
+            cfg->rx_buf = rx_buf_1;
+            cfg->rx_buf_size = sizeof(rx_buf_1);
+            cfg->tx_buf_size = CONFIG_TTYS_1_TX_BUF_SIZE;
+            break;
+#endif
+#if CONFIG_TTYS_2_PRESENT
+        case TTYS_INSTANCE_2:
+            cfg->rx_buf = rx_buf_2;
+            cfg->rx_buf_size = sizeof(rx_buf_2);
+            cfg->tx_buf_size = CONFIG_TTYS_2_TX_BUF_SIZE;
+            break;
+#endif
+#if CONFIG_TTYS_3_PRESENT
+        case TTYS_INSTANCE_3:
+            cfg->rx_buf = rx_buf_3;
+            cfg->rx_buf_size = sizeof(rx_buf_3);
+            cfg->tx_buf_size = CONFIG_TTYS_3_TX_BUF_SIZE;
+            break;
+#endif
+#if CONFIG_TTYS_6_PRESENT
+        case TTYS_INSTANCE_6:
+            cfg->rx_buf = rx_buf_6;
+            cfg->rx_buf_size = sizeof(rx_buf_6);
+            cfg->tx_buf_size = CONFIG_TTYS_6_TX_BUF_SIZE;
+            break;
+#endif
+        default:
+            return MOD_ERR_BAD_INSTANCE;
+    }
+    return 0;
+}
+
+/*
+ * @brief Initialize ttys module instance.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[in] cfg The ttys module configuration.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The device is opened here, rather than in ttys_start(), so that output
+ * written before the module is started is not lost.
+ */
+int32_t ttys_init(enum ttys_instance_id instance_id, struct ttys_cfg* cfg)
+{
+    int32_t rc;
+    struct ttys_state* st;
+
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+
+    if (cfg == NULL)
+        return MOD_ERR_ARG;
+
+    if (cfg->use_dma)
+        return MOD_ERR_IMPL;
+
+    // The TX buffer is not used, but its size is reported by ttys_tx_space().
+    if (cfg->rx_buf == NULL || !RING_SIZE_OK(cfg->rx_buf_size) ||
+        cfg->tx_buf_size < 2)
+        return MOD_ERR_ARG;
+
+    rc = get_uart_num(instance_id);
+    if (rc < 0)
+        return rc;
+
+    st = &ttys_states[instance_id];
+    memset(st, 0, sizeof(*st));
+    st->cfg = *cfg;
+    st->uart_num = rc;
+    st->rx_buf = cfg->rx_buf;
+    ring_init(&st->rx_ring, cfg->rx_buf_size);
+    st->rx_task_id = SCHED_NO_TASK;
+    rc = open_fds(st, instance_id == CONFIG_CONSOLE_DFLT_TTYS_INSTANCE);
+    if (rc != 0)
+        return rc;
+
+    if (st->cfg.create_stream && st->out_fd != NO_FD) {
+        if (st->out_fd == STDOUT_FILENO)
+            st->stream = stdout;
+        else
+            st->stream = fdopen(dup(st->out_fd), "r+");
+        if (st->stream != NULL)
+            setvbuf(st->stream, NULL, _IONBF, 0);
+    }
+    st->initialized = true;
+    return 0;
+}
+
+/*
+ * @brief Start ttys module instance.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t ttys_start(enum ttys_instance_id instance_id)
+{
+    int32_t rc;
+
+    if (instance_id >= TTYS_NUM_INSTANCES ||
+        !ttys_states[instance_id].initialized)
+        return MOD_ERR_BAD_INSTANCE;
+
+    rc = cmd_register(&cmd_info);
+    if (rc < 0) {
+        log_error("ttys_start: cmd error %d\n", rc);
+        return rc;
+    }
+    return 0;
+}
+
+/*
+ * @brief Put a character for transmission.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[in] c Character to transmit.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t ttys_putc(enum ttys_instance_id instance_id, char c)
+{
+    int32_t rc = ttys_write(instance_id, &c, 1);
+
+    return rc < 0 ? rc : 0;
+}
+
+/*
+ * @brief Write characters for transmission.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[in] buf Characters to transmit.
+ * @param[in] len Number of characters.
+ *
+ * @return Number of characters written (>= 0), else a "MOD_ERR" value (< 0).
+ *
+ * @note Output for an instance without a device is discarded, but counted as
+ *       written, as a UART with nothing connected would be.
+ */
+int32_t ttys_write(enum ttys_instance_id instance_id, const char* buf,
+                   uint32_t len)
+{
+    struct ttys_state* st;
+    uint32_t num_written = 0;
+    ssize_t n;
+
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (buf == NULL)
+        return MOD_ERR_ARG;
+    st = &ttys_states[instance_id];
+    if (st->out_fd == NO_FD)
+        return st->initialized ? (int32_t)len : 0;
+
+    while (num_written < len) {
+        n = write(st->out_fd, buf + num_written, len - num_written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            INC_SAT_U16(cnts_u16[CNT_TX_WRITE_ERR]);
+            break;
+        }
+        num_written += n;
+    }
+    return num_written;
+}
+
+/*
+ * @brief Get a received character.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[out] c Received character.
+ *
+ * @return Number of characters returned (0 or 1)
+ */
+int32_t ttys_getc(enum ttys_instance_id instance_id, char* c)
+{
+    struct ttys_state* st;
+    uint32_t get_idx;
+
+    if (instance_id >= TTYS_NUM_INSTANCES ||
+        !ttys_states[instance_id].initialized)
+        return MOD_ERR_BAD_INSTANCE;
+
+    st = &ttys_states[instance_id];
+
+    if (ring_get_peek(&st->rx_ring, &get_idx) == 0)
+        return 0;
+    *c = st->rx_buf[get_idx];
+    ring_get_commit(&st->rx_ring, 1);
+    return 1;
+}
+
+/*
+ * @brief Get file descriptor for a ttys instance.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ *
+ * @return File descriptor (>= 0) for success, else a "MOD_ERR" value (<0). See
+ *          code for details.
+ */
+int ttys_get_fd(enum ttys_instance_id instance_id)
+{
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_ARG;
+    if (ttys_states[instance_id].out_fd >= 0)
+        return ttys_states[instance_id].out_fd;
+    return MOD_ERR_RESOURCE;
+}
+
+/*
+ * @brief Get FILE stream for a ttys instance.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ *
+ * @return FILE stream pointer, or NULL if error.
+ */
+FILE* ttys_get_stream(enum ttys_instance_id instance_id)
+{
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return NULL;
+
+    return ttys_states[instance_id].stream;
+}
+
+/*
+ * @brief Check if xmit is idle (buffer empty).
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ *
+ * @return 1 if tx is idle, 0 if not idle, else aa "MOD_ERR" value (<0).
+ *
+ * Output is written synchronously, so xmit is always idle.
+ */
+int32_t ttys_tx_idle(enum ttys_instance_id instance_id)
+{
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_ARG;
+    return 1;
+}
+
+/*
+ * @brief Get the free space in the xmit buffer.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ *
+ * @return Number of chars that can be written without overrun, else a
+ *         "MOD_ERR" value (<0).
+ */
+int32_t ttys_tx_space(enum ttys_instance_id instance_id)
+{
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_ARG;
+    return ttys_states[instance_id].cfg.tx_buf_size - 1;
+}
+
+/*
+ * @brief Set a task to be posted when characters are received.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[in] task_id The sched task ID (or SCHED_NO_TASK for none).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t ttys_set_rx_task(enum ttys_instance_id instance_id, int32_t task_id)
+{
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    ttys_states[instance_id].rx_task_id = task_id;
+    return 0;
+}
+
+/*
+ * @brief Read available input, as the RX interrupt handler would.
+ *
+ * This is called by host_poll(). Input is only read while there is room in
+ * the RX buffer, so (unlike a UART) nothing is lost if the client is slow.
+ * Thus the RX buffer overrun count only reflects reads that had to be cut
+ * short.
+ */
+void host_ttys_poll(void)
+{
+    struct ttys_state* st;
+    uint32_t put_idx;
+    int32_t instance_id;
+    bool got_input;
+    char c;
+    ssize_t n;
+
+    for (instance_id = 0; instance_id < TTYS_NUM_INSTANCES; instance_id++) {
+        st = &ttys_states[instance_id];
+        if (!st->initialized || st->in_fd == NO_FD)
+            continue;
+        got_input = false;
+        while (1) {
+            if (ring_put_peek(&st->rx_ring, &put_idx) == 0) {
+                INC_SAT_U16(cnts_u16[CNT_RX_BUF_OVERRUN]);
+                break;
+            }
+            n = read(st->in_fd, &c, 1);
+            if (n == 0) {
+                // End of file (e.g. a recording, or piped stdin). Stop
+                // reading, else host_wait() would never sleep.
+                st->in_fd = NO_FD;
+                break;
+            }
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR)
+                    INC_SAT_U16(cnts_u16[CNT_RX_READ_ERR]);
+                break;
+            }
+            st->rx_buf[put_idx] = c;
+            ring_put_commit(&st->rx_ring, 1);
+            got_input = true;
+            if (!st->cfg.rx_wake_on_idle)
+                sched_post(st->rx_task_id);
+        }
+        if (got_input && st->cfg.rx_wake_on_idle)
+            sched_post(st->rx_task_id);
+    }
+}
+
+/*
+ * @brief Get the input file descriptors, for host_wait().
+ *
+ * @param[out] fds File descriptors.
+ * @param[in] max_fds Size of fds.
+ *
+ * @return Number of file descriptors returned.
+ *
+ * Instances with a full RX buffer are left out, so that host_wait() does not
+ * return immediately for input that cannot be read yet.
+ */
+int host_ttys_get_poll_fds(int* fds, int max_fds)
+{
+    struct ttys_state* st;
+    int32_t instance_id;
+    int num_fds = 0;
+
+    for (instance_id = 0; instance_id < TTYS_NUM_INSTANCES; instance_id++) {
+        st = &ttys_states[instance_id];
+        if (!st->initialized || st->in_fd == NO_FD || num_fds >= max_fds)
+            continue;
+        if (ring_space(&st->rx_ring) == 0)
+            continue;
+        fds[num_fds++] = st->in_fd;
+    }
+    return num_fds;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Get the UART number for a ttys instance.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ *
+ * @return UART number (> 0), else a "MOD_ERR" value (< 0).
+ */
+static int32_t get_uart_num(enum ttys_instance_id instance_id)
+{
+    switch (instance_id) {
+
+#if CONFIG_TTYS_1_PRESENT
+        case TTYS_INSTANCE_1:
+            return 1;
+#endif
+
+#if CONFIG_TTYS_2_PRESENT
+        case TTYS_INSTANCE_2:
+            return 2;
+#endif
+
+#if CONFIG_TTYS_3_PRESENT
+        case TTYS_INSTANCE_3:
+            return 3;
+#endif
+
+#if CONFIG_TTYS_6_PRESENT
+        case TTYS_INSTANCE_6:
+            return 6;
+#endif
+
+        default:
+            return MOD_ERR_BAD_INSTANCE;
+    }
+}
+
+/*
+ * @brief Open the file descriptors for an instance.
+ *
+ * @param[in] st Instance state, with uart_num set.
+ * @param[in] is_console True for the console instance (stdin/stdout).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t open_fds(struct ttys_state* st, bool is_console)
+{
+    char env_name[16];
+    const char* path;
+    struct termios term;
+    int fd;
+
+    st->in_fd = NO_FD;
+    st->out_fd = NO_FD;
+
+    if (is_console) {
+        if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &term_save) == 0) {
+            term = term_save;
+            term.c_lflag &= ~(ICANON | ECHO);
+            term.c_cc[VMIN] = 1;
+            term.c_cc[VTIME] = 0;
+            if (tcsetattr(STDIN_FILENO, TCSANOW, &term) == 0 && !term_saved) {
+                term_saved = true;
+                atexit(term_restore);
+            }
+        }
+        fcntl(STDIN_FILENO, F_SETFL,
+              fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+        st->in_fd = STDIN_FILENO;
+        st->out_fd = STDOUT_FILENO;
+        return 0;
+    }
+
+    snprintf(env_name, sizeof(env_name), "HOST_TTYS_%u", st->uart_num);
+    path = getenv(env_name);
+    if (path == NULL)
+        return 0;
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        // Might be a read-only recording.
+        fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (fd < 0)
+            return MOD_ERR_RESOURCE;
+    } else {
+        st->out_fd = fd;
+    }
+    st->in_fd = fd;
+    return 0;
+}
+
+/*
+ * @brief Restore the terminal settings on exit.
+ */
+static void term_restore(void)
+{
+    if (term_saved)
+        tcsetattr(STDIN_FILENO, TCSANOW, &term_save);
+}
@@ -0,0 +1,411 @@
+/*
+ * @brief Implementation of bench module.
+ *
+ * This module is a harness for on-target micro-benchmarks. Modules register
+ * benchmarks (in the same way they register console commands with the cmd
+ * module), typically in their start function, and the harness runs them on
+ * request and reports the cost per operation, measured with the DWT cycle
+ * counter.
+ *
+ * Each benchmark is run CONFIG_BENCH_REPEATS times with the same number of
+ * operations, and the minimum and average cycles per operation are reported.
+ * Interrupts are not disabled, so the minimum is usually the most repeatable
+ * value. The "bench nop" benchmark measures the harness overhead (i.e. an
+ * empty loop), and CSV output (with the core clock frequency) is available for
+ * tracking results across firmware releases.
+ *
+ * The following console commands are provided:
+ * > bench list
+ * > bench run [csv] [<client> [<bench> [<num-ops>]]]
+ * > bench nop
+ * See code for details.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+#include "cmd.h"
+#include "console.h"
+#include "log.h"
+#include "module.h"
+#include "stat.h"
+
+#include "bench.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_CLIENTS CONFIG_BENCH_MAX_CLIENTS
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t run_bench(const struct bench_client_info* ci,
+                         const struct bench_info* bi, uint32_t num_ops,
+                         bool csv);
+static int32_t bench_nop(uint32_t num_ops);
+static int32_t bench_cmd_execute(uint32_t num_ops);
+static int32_t cmd_bench_list(int32_t argc, const char** argv);
+static int32_t cmd_bench_run(int32_t argc, const char** argv);
+static int32_t cmd_bench_nop(int32_t argc, const char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static const struct bench_client_info* client_info[MAX_CLIENTS];
+
+static int32_t log_level = LOG_DEFAULT;
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "list",
+        .func = cmd_bench_list,
+        .help = "List benchmarks, usage: bench list",
+    },
+    {
+        .name = "run",
+        .func = cmd_bench_run,
+        .help = "Run benchmarks, usage: bench run [csv] [<client> [<bench> "
+                "[<num-ops>]]]",
+    },
+    {
+        .name = "nop",
+        .func = cmd_bench_nop,
+        .help = "Do nothing (for cmd_execute benchmark), usage: bench nop",
+    },
+};
+
+static struct cmd_client_info cmd_info = {
+    .name = "bench",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+};
+
+// The harness's own benchmarks.
+static const struct bench_info benches[] = {
+    {
+        .name = "nop",
+        .func = bench_nop,
+        .dflt_num_ops = 100000,
+    },
+    {
+        .name = "cmd_execute",
+        .func = bench_cmd_execute,
+        .dflt_num_ops = 10000,
+    },
+};
+
+static const struct bench_client_info bench_client_info = {
+    .name = "bench",
+    .num_benches = ARRAY_SIZE(benches),
+    .benches = benches,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Start bench module instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function starts the bench singleton module, to enter normal operation.
+ */
+int32_t bench_start(void)
+{
+    int32_t rc;
+
+    rc = cmd_register(&cmd_info);
+    if (rc < 0) {
+        log_error("bench_start: cmd error %d\n", rc);
+        return rc;
+    }
+    return bench_register(&bench_client_info);
+}
+
+/*
+ * @brief Register a benchmark client.
+ *
+ * @param[in] _client_info The client's benchmark information.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note This function keeps a copy of the _client_info pointer. Registering a
+ *       client with the same name as an existing one replaces it, so it is
+ *       safe to call this from each instance of a multi-instance module.
+ */
+int32_t bench_register(const struct bench_client_info* _client_info)
+{
+    int32_t idx;
+
+    if (_client_info->num_benches < 0)
+        return MOD_ERR_ARG;
+
+    for (idx = 0; idx < MAX_CLIENTS; idx++) {
+        if (client_info[idx] == NULL ||
+            strcasecmp(client_info[idx]->name, _client_info->name) == 0) {
+            client_info[idx] = _client_info;
+            return 0;
+        }
+    }
+    return MOD_ERR_RESOURCE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Run one benchmark and print the result.
+ *
+ * @param[in] ci The benchmark client.
+ * @param[in] bi The benchmark.
+ * @param[in] num_ops Number of operations, or 0 for the default.
+ * @param[in] csv True for CSV output.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t run_bench(const struct bench_client_info* ci,
+                         const struct bench_info* bi, uint32_t num_ops,
+                         bool csv)
+{
+    struct stat_cyc_dur stat;
+    uint32_t min_x100;
+    uint32_t avg_x100;
+    uint32_t rep;
+    int32_t rc;
+
+    if (num_ops == 0)
+        num_ops = bi->dflt_num_ops;
+    if (num_ops == 0)
+        num_ops = 1;
+
+    stat_cyc_dur_init(&stat);
+    for (rep = 0; rep < CONFIG_BENCH_REPEATS; rep++) {
+        stat_cyc_dur_start(&stat);
+        rc = bi->func(num_ops);
+        stat_cyc_dur_end(&stat);
+        if (rc < 0) {
+            if (csv)
+                printc("%s,%s,error %ld\n", ci->name, bi->name, rc);
+            else
+                printc("%-8s %-16s error %ld\n", ci->name, bi->name, rc);
+            return rc;
+        }
+    }
+
+    // Cycles per operation, in hundredths.
+    min_x100 = ((uint64_t)stat.min * 100) / num_ops;
+    avg_x100 = (stat.accum_cyc * 100) / ((uint64_t)stat.samples * num_ops);
+
+    if (csv)
+        printc("%s,%s,%lu,%lu.%02lu,%lu.%02lu,%lu\n", ci->name, bi->name,
+               num_ops, min_x100 / 100, min_x100 % 100, avg_x100 / 100,
+               avg_x100 % 100, SystemCoreClock);
+    else
+        printc("%-8s %-16s %8lu %9lu.%02lu %9lu.%02lu %9lu\n", ci->name,
+               bi->name, num_ops, min_x100 / 100, min_x100 % 100,
+               avg_x100 / 100, avg_x100 % 100,
+               (uint32_t)(((uint64_t)min_x100 * 10000000) / SystemCoreClock));
+    return 0;
+}
+
+/*
+ * @brief Benchmark for harness overhead (empty loop).
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 (always).
+ */
+static int32_t bench_nop(uint32_t num_ops)
+{
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++)
+        __ASM volatile("" : : : "memory");
+    return 0;
+}
+
+/*
+ * @brief Benchmark for cmd_execute() tokenizing and dispatch.
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The command executed is "bench nop", which does nothing. Since
+ * cmd_execute() tokenizes the line in place, it is copied for each operation.
+ */
+static int32_t bench_cmd_execute(uint32_t num_ops)
+{
+    static const char line[] = "bench nop";
+    char bfr[sizeof(line)];
+    uint32_t idx;
+    int32_t rc;
+
+    for (idx = 0; idx < num_ops; idx++) {
+        memcpy(bfr, line, sizeof(line));
+        rc = cmd_execute(bfr);
+        if (rc < 0)
+            return rc;
+    }
+    return 0;
+}
+
+/*
+ * @brief Console command function for "bench list".
+ *
+ * @param[in] argc Number of arguments, including "bench"
+ * @param[in] argv Argument values, including "bench"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: bench list
+ */
+static int32_t cmd_bench_list(int32_t argc, const char** argv)
+{
+    int32_t idx;
+    int32_t bench_idx;
+    const struct bench_client_info* ci;
+
+    printc("Client   Bench            Dflt ops\n"
+           "-------- ---------------- --------\n");
+    for (idx = 0; idx < MAX_CLIENTS && client_info[idx] != NULL; idx++) {
+        ci = client_info[idx];
+        for (bench_idx = 0; bench_idx < ci->num_benches; bench_idx++)
+            printc("%-8s %-16s %8lu\n", ci->name, ci->benches[bench_idx].name,
+                   ci->benches[bench_idx].dflt_num_ops);
+    }
+    return 0;
+}
+
+/*
+ * @brief Console command function for "bench run".
+ *
+ * @param[in] argc Number of arguments, including "bench"
+ * @param[in] argv Argument values, including "bench"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: bench run [csv] [<client> [<bench> [<num-ops>]]]
+ *
+ * With no client, all benchmarks are run. With no bench, all of the client's
+ * benchmarks are run. A failing benchmark does not stop the others, and the
+ * first error is returned.
+ */
+static int32_t cmd_bench_run(int32_t argc, const char** argv)
+{
+    bool csv = false;
+    const char* client_name = NULL;
+    const char* bench_name = NULL;
+    uint32_t num_ops = 0;
+    int32_t num_args;
+    struct cmd_arg_val arg_vals[3];
+    int32_t idx;
+    int32_t bench_idx;
+    int32_t num_run = 0;
+    int32_t rc;
+    int32_t first_rc = 0;
+    const struct bench_client_info* ci;
+
+    argc -= 2;
+    argv += 2;
+    if (argc > 0 && strcasecmp(argv[0], "csv") == 0) {
+        csv = true;
+        argc--;
+        argv++;
+    }
+    num_args = cmd_parse_args(argc, argv, "[s[s[u]]]", arg_vals);
+    if (num_args < 0)
+        return num_args;
+    if (num_args > 0)
+        client_name = arg_vals[0].val.s;
+    if (num_args > 1)
+        bench_name = arg_vals[1].val.s;
+    if (num_args > 2)
+        num_ops = arg_vals[2].val.u;
+
+    if (csv)
+        printc("client,bench,ops,min_cyc_per_op,avg_cyc_per_op,core_hz\n");
+    else
+        printc("Client   Bench                 Ops Min cyc/op   Avg cyc/op  "
+               "Min ns/op\n"
+               "-------- ---------------- -------- ------------ ------------ "
+               "---------\n");
+
+    for (idx = 0; idx < MAX_CLIENTS && client_info[idx] != NULL; idx++) {
+        ci = client_info[idx];
+        if (client_name != NULL && strcasecmp(client_name, ci->name) != 0)
+            continue;
+        for (bench_idx = 0; bench_idx < ci->num_benches; bench_idx++) {
+            if (bench_name != NULL &&
+                strcasecmp(bench_name, ci->benches[bench_idx].name) != 0)
+                continue;
+            // A failed benchmark is reported, and the rest still run.
+            rc = run_bench(ci, &ci->benches[bench_idx], num_ops, csv);
+            if (rc < 0 && first_rc == 0)
+                first_rc = rc;
+            num_run++;
+        }
+    }
+
+    if (num_run == 0) {
+        printc("No matching benchmark\n");
+        return MOD_ERR_ARG;
+    }
+    return first_rc;
+}
+
+/*
+ * @brief Console command function for "bench nop".
+ *
+ * @param[in] argc Number of arguments, including "bench"
+ * @param[in] argv Argument values, including "bench"
+ *
+ * @return 0 (always).
+ *
+ * Command usage: bench nop
+ */
+static int32_t cmd_bench_nop(int32_t argc, const char** argv)
+{
+    return 0;
+}
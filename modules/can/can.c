@@ -1,10 +1,43 @@
 /*
  * @brief Implementation of CAN module.
  *
- * This module ...
+ * This module provides a driver for the bxCAN controller (CONFIG_CAN_TYPE 1).
+ * Main features:
+ * - Hardware acceptance filters, so unwanted frames never reach software.
+ * - Interrupt-driven RX from FIFO 0 into a lock-free ring (see ring.h), with
+ *   the ISR as the producer and can_rx() or can_run() as the consumer.
+ * - A TX queue feeding all three hardware mailboxes. Transmit FIFO priority
+ *   (MCR TXFP) is used so frames go out in the order they were queued.
+ * - Dispatch of received frames to subscribers (see can_subscribe()).
+ * - Per-instance throughput and error counters (see "can pm").
+ *
+ * Subscribers register a callback for an ID/mask, which is installed as a
+ * hardware filter. The filter match index reported by the hardware for each
+ * received frame is then used as a direct index into the subscriber table, so
+ * dispatch needs no search. Dispatch is done by can_run(), which passes each
+ * subscriber a pointer into the RX ring (no copy), and handles a bounded number
+ * of frames per call so a busy bus cannot starve the super loop. While there
+ * are subscribers, frames not claimed by one are dropped (and counted), and
+ * can_rx() cannot be used.
+ *
+ * The bit timing is computed from the APB1 clock and the configured bit rate,
+ * with a sample point of 87.5%.
+ *
+ * Bus-off recovery is automatic (MCR ABOM). As the error warning, error
+ * passive, and bus-off conditions can persist, their interrupts are disabled
+ * when they occur, and re-enabled by can_run() when the condition clears.
+ * Likewise the last error code interrupt is disabled after each protocol error,
+ * and re-enabled by the next can_run(), so a node alone on the bus (an ACK
+ * error on every retransmission) can't flood the CPU with interrupts. The
+ * protocol error counters are thus sampled, at most one per can_run() call.
+ *
+ * This module overrides the (weak) CAN interrupt handler functions, so they
+ * should not be chosen in the IDE device configuration tool.
  *
  * The following console commands are provided:
  * > can status
+ * > can test
+ * > can pm
  * See code for details.
  *
  * MIT License
@@ -30,44 +63,170 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "config.h"
-#include CONFIG_STM32_LL_CORTEX_HDR // Used to get CAN stuff.
+#include CONFIG_STM32_LL_BUS_HDR
+#include CONFIG_STM32_LL_CORTEX_HDR
+#include CONFIG_STM32_LL_RCC_HDR
 
 #include "can.h"
+#include "cmd.h"
+#include "console.h"
+#include "dio.h"
 #include "log.h"
 #include "module.h"
+#include "ring.h"
+#include "tmr.h"
+
+#if CONFIG_CAN_TYPE == 1
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
-// Much of the CAN configuration is hardcoded. This is expressed in the #defines
-// below. These are generally register fields.
+// Bit timing. The number of time quanta per bit is chosen from this range,
+// largest first, so that the prescaler divides the clock exactly.
+#define BIT_TQ_MAX 16
+#define BIT_TQ_MIN 8
+#define BRP_MAX 1024
+
+// Sample point, in eighths of a bit.
+#define SAMPLE_POINT_8THS 7
+
+// Time limit for the controller to enter/leave initialization mode. Leaving
+// requires seeing 11 recessive bits on the bus.
+#define INIT_MODE_TMO_MS 10
+
+// Number of filter banks on the controller.
+#define NUM_FILTER_BANKS 14
+
+// Number of TX mailboxes.
+#define NUM_TX_MAILBOXES 3
+
+// Shifts of the ID fields in the mailbox and filter "identifier" registers.
+#define STD_ID_SHIFT 21
+#define EXT_ID_SHIFT 3
+
+#define TSR_TME_ALL (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)
 
-// Register BTR parameters related to bus speed of 125000. The values for
-// presale, time seg 1, and time seg 1 were gotten from this website:
-//   http://www.bittiming.can-wiki.info/
-// Note we subtract off 1 due to how the values are coded in the register.
+// Last error codes (ESR LEC).
+#define LEC_NONE 0
+#define LEC_STUFF 1
+#define LEC_FORM 2
+#define LEC_ACK 3
+#define LEC_BIT_RECESSIVE 4
+#define LEC_BIT_DOMINANT 5
+#define LEC_CRC 6
+#define LEC_SW_SET 7
 
-#define BTR_BRP_40_SHIFTED_VAL ((40-1) << 0)
-#define BTR_BRP_SHIFTED_VAL BTR_BRP_40_SHIFTED_VAL
+// Maximum frames dispatched to subscribers per can_run() call.
+#define MAX_DISPATCH_PER_RUN 8
+
+// Interrupts for error conditions that can persist.
+#define IER_ERR_STATE_IE (CAN_IER_BOFIE | CAN_IER_EPVIE | CAN_IER_EWGIE)
+
+#if !RING_SIZE_OK(CONFIG_CAN_RX_RING_SIZE)
+    #error CONFIG_CAN_RX_RING_SIZE must be a power of 2 (max 0x8000)
+#endif
+#if !RING_SIZE_OK(CONFIG_CAN_TX_QUEUE_SIZE)
+    #error CONFIG_CAN_TX_QUEUE_SIZE must be a power of 2 (max 0x8000)
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+// A subscriber, installed as the filter at the same index.
+struct can_sub {
+    struct can_filter filter;
+    can_rx_cb cb;
+    void* user_data;
+};
+
+// Per-instance can state information.
 struct can_state {
     struct can_cfg cfg;
-    I2C_TypeDef* can_reg_base;
+    CAN_TypeDef* can_reg_base;
+    bool started;
+    struct ring rx_ring;
+    struct ring tx_ring;
+    uint32_t bit_rate; // Actual bit rate.
+    uint32_t num_subs;
+    struct can_sub subs[CONFIG_CAN_MAX_FILTERS];
+    struct can_msg rx_msgs[CONFIG_CAN_RX_RING_SIZE];
+    struct can_msg tx_msgs[CONFIG_CAN_TX_QUEUE_SIZE];
+};
+
+// Performance measurements for can. These are per-instance.
+
+enum can_u16_pms {
+    CNT_RX_FRAMES,
+    CNT_TX_FRAMES,
+    CNT_RX_RING_OVERRUN,
+    CNT_RX_FIFO_OVERRUN,
+    CNT_TX_QUEUE_FULL,
+    CNT_TX_ERR,
+    CNT_TX_ARB_LOST,
+    CNT_BUS_OFF,
+    CNT_ERR_PASSIVE,
+    CNT_ERR_WARNING,
+    CNT_STUFF_ERR,
+    CNT_FORM_ERR,
+    CNT_ACK_ERR,
+    CNT_BIT_ERR,
+    CNT_CRC_ERR,
+    CNT_RX_UNCLAIMED,
+
+    NUM_U16_PMS
 };
 
+#define PM_NAMES(prefix)                        \
+    prefix " rx frames",                        \
+    prefix " tx frames",                        \
+    prefix " rx ring overrun",                  \
+    prefix " rx fifo overrun",                  \
+    prefix " tx queue full",                    \
+    prefix " tx err",                           \
+    prefix " tx arb lost",                      \
+    prefix " bus off",                          \
+    prefix " err passive",                      \
+    prefix " err warning",                      \
+    prefix " stuff err",                        \
+    prefix " form err",                         \
+    prefix " ack err",                          \
+    prefix " bit err",                          \
+    prefix " crc err",                          \
+    prefix " rx unclaimed"
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
+static int32_t get_instance_info(enum can_instance_id instance_id,
+                                 CAN_TypeDef** p_can_reg_base,
+                                 IRQn_Type* p_tx_irq_type,
+                                 IRQn_Type* p_rx_irq_type,
+                                 IRQn_Type* p_sce_irq_type);
+static int32_t hdw_init(enum can_instance_id instance_id);
+static int32_t set_init_mode(CAN_TypeDef* can_reg_base, bool enter);
+static int32_t calc_btr(uint32_t bit_rate, uint32_t* btr,
+                        uint32_t* actual_bit_rate);
+static void program_filters(struct can_state* st);
+static void dispatch(enum can_instance_id instance_id);
+static void cmd_sub_cb(enum can_instance_id instance_id,
+                       const struct can_msg* msg, void* user_data);
+static void mailbox_write(CAN_TypeDef* can_reg_base, uint32_t mailbox,
+                          const struct can_msg* msg);
+static void tx_fill(struct can_state* st);
+static void tx_interrupt(enum can_instance_id instance_id);
+static void rx_interrupt(enum can_instance_id instance_id);
+static void sce_interrupt(enum can_instance_id instance_id);
+static int32_t cmd_can_status(int32_t argc, const char** argv);
+static int32_t cmd_can_test(int32_t argc, const char** argv);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
@@ -76,6 +235,44 @@ static struct can_state can_states[CAN_NUM_INSTANCES];
 
 static int32_t log_level = LOG_DEFAULT;
 
+// Storage for performance measurements.
+static uint16_t cnts_u16[CAN_NUM_INSTANCES][NUM_U16_PMS];
+
+// Names of performance measurements.
+static const char* cnts_u16_names[CAN_NUM_INSTANCES * NUM_U16_PMS] = {
+#if CONFIG_CAN_1_PRESENT
+    PM_NAMES("can1"),
+#endif
+#if CONFIG_CAN_2_PRESENT
+    PM_NAMES("can2"),
+#endif
+};
+
+// Data structure with console command info.
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "status",
+        .func = cmd_can_status,
+        .help = "Get module status, usage: can status",
+    },
+    {
+        .name = "test",
+        .func = cmd_can_test,
+        .help = "Run test, usage: can test [<op> [<arg>]] (enter no op for help)",
+    }
+};
+
+// Data structure passed to cmd module for console interaction.
+static struct cmd_client_info cmd_info = {
+    .name = "can",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = CAN_NUM_INSTANCES * NUM_U16_PMS,
+    .u16_pms = &cnts_u16[0][0],
+    .u16_pm_names = cnts_u16_names,
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -89,10 +286,31 @@ static int32_t log_level = LOG_DEFAULT;
  *
  * @param[in] instance_id Identifies the can instance.
  * @param[out] cfg The can configuration with defaults filled in.
+ *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * By default there are no filters, which means all frames are accepted.
  */
 int32_t can_get_def_cfg(enum can_instance_id instance_id, struct can_cfg* cfg)
 {
+    if (instance_id >= CAN_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (cfg == NULL)
+        return MOD_ERR_ARG;
+
+    memset(cfg, 0, sizeof(*cfg));
+#if CONFIG_CAN_1_PRESENT
+    if (instance_id == CAN_INSTANCE_1) {
+        cfg->can_tx_pin_port = CONFIG_CAN_1_DFLT_TX_PORT;
+        cfg->can_tx_pin = CONFIG_CAN_1_DFLT_TX_PIN;
+        cfg->can_rx_pin_port = CONFIG_CAN_1_DFLT_RX_PORT;
+        cfg->can_rx_pin = CONFIG_CAN_1_DFLT_RX_PIN;
+        cfg->pin_function = CONFIG_CAN_1_DFLT_PIN_FUNCTION;
+    }
+#endif
+    cfg->bit_rate = CONFIG_CAN_DFLT_BIT_RATE;
+    cfg->loopback = false;
+    cfg->num_filters = 0;
     return 0;
 }
 
@@ -100,7 +318,7 @@ int32_t can_get_def_cfg(enum can_instance_id instance_id, struct can_cfg* cfg)
  * @brief Initialize can instance.
  *
  * @param[in] instance_id Identifies the can instance.
- * @param[in] cfg The can configuration. (FUTURE)
+ * @param[in] cfg The can configuration.
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
  *
@@ -110,10 +328,19 @@ int32_t can_get_def_cfg(enum can_instance_id instance_id, struct can_cfg* cfg)
  */
 int32_t can_init(enum can_instance_id instance_id, struct can_cfg* cfg)
 {
+    struct can_state* st;
+
     if (instance_id >= CAN_NUM_INSTANCES)
         return MOD_ERR_BAD_INSTANCE;
-    memset(&can_states[instance_id], 0, sizeof(can_states[instance_id]));
-    return 0;
+    if (cfg == NULL || cfg->num_filters > CONFIG_CAN_MAX_FILTERS)
+        return MOD_ERR_ARG;
+
+    st = &can_states[instance_id];
+    memset(st, 0, sizeof(*st));
+    ring_init(&st->rx_ring, CONFIG_CAN_RX_RING_SIZE);
+    ring_init(&st->tx_ring, CONFIG_CAN_TX_QUEUE_SIZE);
+    st->cfg = *cfg;
+    return get_instance_info(instance_id, &st->can_reg_base, NULL, NULL, NULL);
 }
 
 /*
@@ -123,10 +350,44 @@ int32_t can_init(enum can_instance_id instance_id, struct can_cfg* cfg)
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
  *
- * This function starts a can module instance, to enter normal operation.
+ * This function starts a can module instance, to enter normal operation. This
+ * includes initializing the hardware and enabling interrupts.
  */
 int32_t can_start(enum can_instance_id instance_id)
 {
+    struct can_state* st;
+    IRQn_Type irq_types[3];
+    uint32_t idx;
+    int32_t rc;
+
+    if (instance_id >= CAN_NUM_INSTANCES ||
+        can_states[instance_id].can_reg_base == NULL)
+        return MOD_ERR_BAD_INSTANCE;
+
+    rc = cmd_register(&cmd_info);
+    if (rc < 0) {
+        log_error("can_start: cmd error %d\n", rc);
+        return rc;
+    }
+
+    rc = hdw_init(instance_id);
+    if (rc != 0)
+        return rc;
+
+    st = &can_states[instance_id];
+    st->can_reg_base->IER = (CAN_IER_FMPIE0 | CAN_IER_FOVIE0 | CAN_IER_TMEIE |
+                             CAN_IER_ERRIE | CAN_IER_LECIE | IER_ERR_STATE_IE);
+
+    rc = get_instance_info(instance_id, NULL, &irq_types[0], &irq_types[1],
+                           &irq_types[2]);
+    if (rc != 0)
+        return rc;
+    for (idx = 0; idx < ARRAY_SIZE(irq_types); idx++) {
+        NVIC_SetPriority(irq_types[idx],
+                         NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+        NVIC_EnableIRQ(irq_types[idx]);
+    }
+    st->started = true;
     return 0;
 }
 
@@ -139,48 +400,337 @@ int32_t can_start(enum can_instance_id instance_id)
  *
  * @note This function should not block.
  *
- * This function runs a can module instance, during normal operation.
+ * This function runs a can module instance, during normal operation. It
+ * dispatches received frames to subscribers, and re-enables the error state
+ * interrupts once the error state clears.
  */
 int32_t can_run(enum can_instance_id instance_id)
 {
+    struct can_state* st;
+    uint32_t esr;
+    uint32_t ie_mask = 0;
+    CRIT_STATE_VAR;
+
+    if (instance_id >= CAN_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+
+    st = &can_states[instance_id];
+    if (!st->started)
+        return 0;
+
+    if (st->num_subs > 0)
+        dispatch(instance_id);
+
+    if (!(st->can_reg_base->IER & CAN_IER_LECIE)) {
+        CRIT_BEGIN_NEST();
+        st->can_reg_base->IER |= CAN_IER_LECIE;
+        CRIT_END_NEST();
+    }
+
+    esr = st->can_reg_base->ESR;
+    if (!(esr & CAN_ESR_BOFF))
+        ie_mask |= CAN_IER_BOFIE;
+    if (!(esr & CAN_ESR_EPVF))
+        ie_mask |= CAN_IER_EPVIE;
+    if (!(esr & CAN_ESR_EWGF))
+        ie_mask |= CAN_IER_EWGIE;
+    ie_mask &= ~st->can_reg_base->IER;
+    if (ie_mask != 0) {
+        log_info("can_run: instance %d err state clear 0x%lx\n", instance_id,
+                 ie_mask);
+        CRIT_BEGIN_NEST();
+        st->can_reg_base->IER |= ie_mask;
+        CRIT_END_NEST();
+    }
     return 0;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Private (static) functions
-////////////////////////////////////////////////////////////////////////////////
+/*
+ * @brief Queue a frame for transmission.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ * @param[in] msg The frame. It is copied.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * If the TX queue is empty and a mailbox is free, the frame goes straight to
+ * the mailbox. Otherwise it is queued, and the TX interrupt moves it to a
+ * mailbox once one frees up.
+ */
+int32_t can_tx(enum can_instance_id instance_id, const struct can_msg* msg)
+{
+    struct can_state* st;
+    int32_t rc = 0;
+    CRIT_STATE_VAR;
+
+    if (instance_id >= CAN_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (msg == NULL || msg->len > CAN_MAX_DATA_LEN ||
+        msg->id > (msg->ext ? CAN_EXT_ID_MAX : CAN_STD_ID_MAX))
+        return MOD_ERR_ARG;
+
+    st = &can_states[instance_id];
+    if (!st->started)
+        return MOD_ERR_STATE;
+
+    CRIT_BEGIN_NEST();
+    if (ring_empty(&st->tx_ring) && (st->can_reg_base->TSR & TSR_TME_ALL)) {
+        mailbox_write(st->can_reg_base,
+                      (st->can_reg_base->TSR & CAN_TSR_CODE) >> CAN_TSR_CODE_Pos,
+                      msg);
+    } else if (ring_put(&st->tx_ring, st->tx_msgs, sizeof(*msg), msg, 1) == 0) {
+        INC_SAT_U16(cnts_u16[instance_id][CNT_TX_QUEUE_FULL]);
+        rc = MOD_ERR_BUF_OVERRUN;
+    }
+    CRIT_END_NEST();
+    return rc;
+}
+
+/*
+ * @brief Get a received frame.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ * @param[out] msg The frame.
+ *
+ * @return 1 if a frame was returned, 0 if none is available, else a "MOD_ERR"
+ *         value. See code for details.
+ *
+ * @note This can't be used while there are subscribers.
+ */
+int32_t can_rx(enum can_instance_id instance_id, struct can_msg* msg)
+{
+    struct can_state* st;
 
-int32_t can_hdw_init(enum can_instance_id instance_id)
+    if (instance_id >= CAN_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (msg == NULL)
+        return MOD_ERR_ARG;
+
+    st = &can_states[instance_id];
+    if (st->num_subs > 0)
+        return MOD_ERR_STATE;
+    return ring_get(&st->rx_ring, st->rx_msgs, sizeof(*msg), msg, 1);
+}
+
+/*
+ * @brief Set the acceptance filters.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ * @param[in] num_filters Number of filters (0 to accept all frames).
+ * @param[in] filters The filters. They are copied.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * On reception, struct can_msg filter_idx gives the index of the filter that
+ * matched. The filters can't be changed while there are subscribers, as
+ * subscriptions use the filter indexes after the configured filters.
+ */
+int32_t can_set_filters(enum can_instance_id instance_id, uint32_t num_filters,
+                        const struct can_filter* filters)
 {
-    log_verbose("can_hdw_init\n"); // TODO REMOVE
+    struct can_state* st;
+
+    if (instance_id >= CAN_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (num_filters > CONFIG_CAN_MAX_FILTERS ||
+        (num_filters > 0 && filters == NULL))
+        return MOD_ERR_ARG;
+
+    st = &can_states[instance_id];
+    if (st->num_subs > 0)
+        return MOD_ERR_STATE;
+    memcpy(st->cfg.filters, filters, num_filters * sizeof(*filters));
+    st->cfg.num_filters = num_filters;
+    if (st->started)
+        program_filters(st);
     return 0;
-#if 0
+}
+
+/*
+ * @brief Subscribe to received frames.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ * @param[in] filter The IDs to subscribe to (see struct can_filter). A
+ *                   range of IDs is given as an aligned block, using the mask.
+ * @param[in] cb Callback, called from can_run() for each matching frame.
+ * @param[in] user_data Passed to the callback.
+ *
+ * @return Subscription handle (>= 0) for success, else a "MOD_ERR" value. See
+ *         code for details.
+ *
+ * The callback gets a pointer to the frame in the RX ring, which is valid only
+ * until the callback returns. If a frame matches more than one subscription,
+ * the one with the lowest handle gets it.
+ */
+int32_t can_subscribe(enum can_instance_id instance_id,
+                      const struct can_filter* filter, can_rx_cb cb,
+                      void* user_data)
+{
     struct can_state* st;
-    struct dio_direct_cfg dio_cfg;
-    uint32_t rc;
+    uint32_t idx;
+    CRIT_STATE_VAR;
+
+    if (instance_id >= CAN_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (filter == NULL || cb == NULL)
+        return MOD_ERR_ARG;
+
+    st = &can_states[instance_id];
+    for (idx = st->cfg.num_filters; idx < CONFIG_CAN_MAX_FILTERS; idx++) {
+        if (st->subs[idx].cb == NULL)
+            break;
+    }
+    if (idx >= CONFIG_CAN_MAX_FILTERS)
+        return MOD_ERR_RESOURCE;
+
+    st->subs[idx].filter = *filter;
+    st->subs[idx].user_data = user_data;
+    CRIT_BEGIN_NEST();
+    st->subs[idx].cb = cb;
+    st->num_subs++;
+    CRIT_END_NEST();
+    if (st->started)
+        program_filters(st);
+    return idx;
+}
+
+/*
+ * @brief Remove a subscription.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ * @param[in] handle The handle returned by can_subscribe().
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t can_unsubscribe(enum can_instance_id instance_id, int32_t handle)
+{
+    struct can_state* st;
+    CRIT_STATE_VAR;
 
     if (instance_id >= CAN_NUM_INSTANCES)
         return MOD_ERR_BAD_INSTANCE;
-        
     st = &can_states[instance_id];
+    if (handle < 0 || handle >= CONFIG_CAN_MAX_FILTERS ||
+        st->subs[handle].cb == NULL)
+        return MOD_ERR_ARG;
+
+    CRIT_BEGIN_NEST();
+    st->subs[handle].cb = NULL;
+    st->num_subs--;
+    CRIT_END_NEST();
+    if (st->started)
+        program_filters(st);
+    return 0;
+}
+
+// The following interrupt handler functions override the default handlers,
+// which are "weak" symobols.
 
 #if CONFIG_CAN_1_PRESENT
-    if (instance_id == CAN_INSTANCE_1) {
-        SET_BIT(RCC->APB1ENR1, RCC_APB1ENR1_CAN1EN);
-    }
+#if defined STM32F103xB
+void USB_HP_CAN1_TX_IRQHandler(void)
+{
+    tx_interrupt(CAN_INSTANCE_1);
+}
+
+void USB_LP_CAN1_RX0_IRQHandler(void)
+{
+    rx_interrupt(CAN_INSTANCE_1);
+}
+#else
+void CAN1_TX_IRQHandler(void)
+{
+    tx_interrupt(CAN_INSTANCE_1);
+}
+
+void CAN1_RX0_IRQHandler(void)
+{
+    rx_interrupt(CAN_INSTANCE_1);
+}
 #endif
 
-#if CONFIG_CAN_2_PRESENT
-    else if (instance_id == CAN_INSTANCE_2) {
-        SET_BIT(RCC->APB1ENR1, RCC_APB1ENR1_CAN2EN);
-    }
+void CAN1_SCE_IRQHandler(void)
+{
+    sce_interrupt(CAN_INSTANCE_1);
+}
 #endif
 
-    else {
-        return MOD_ERR_BAD_INSTANCE;
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Get hardware information for a can instance.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ * @param[out] p_can_reg_base Register base (or NULL).
+ * @param[out] p_tx_irq_type TX interrupt type (or NULL).
+ * @param[out] p_rx_irq_type RX FIFO 0 interrupt type (or NULL).
+ * @param[out] p_sce_irq_type Status change/error interrupt type (or NULL).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t get_instance_info(enum can_instance_id instance_id,
+                                 CAN_TypeDef** p_can_reg_base,
+                                 IRQn_Type* p_tx_irq_type,
+                                 IRQn_Type* p_rx_irq_type,
+                                 IRQn_Type* p_sce_irq_type)
+{
+    CAN_TypeDef* can_reg_base;
+    IRQn_Type tx_irq_type;
+    IRQn_Type rx_irq_type;
+    IRQn_Type sce_irq_type;
+
+    switch (instance_id) {
+#if CONFIG_CAN_1_PRESENT
+        case CAN_INSTANCE_1:
+            can_reg_base = CAN1;
+#if defined STM32F103xB
+            tx_irq_type = USB_HP_CAN1_TX_IRQn;
+            rx_irq_type = USB_LP_CAN1_RX0_IRQn;
+#else
+            tx_irq_type = CAN1_TX_IRQn;
+            rx_irq_type = CAN1_RX0_IRQn;
+#endif
+            sce_irq_type = CAN1_SCE_IRQn;
+            break;
+#endif
+        default:
+            return MOD_ERR_BAD_INSTANCE;
+    }
+    if (p_can_reg_base != NULL)
+        *p_can_reg_base = can_reg_base;
+    if (p_tx_irq_type != NULL)
+        *p_tx_irq_type = tx_irq_type;
+    if (p_rx_irq_type != NULL)
+        *p_rx_irq_type = rx_irq_type;
+    if (p_sce_irq_type != NULL)
+        *p_sce_irq_type = sce_irq_type;
+    return 0;
+}
+
+/*
+ * @brief Initialize the can hardware.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t hdw_init(enum can_instance_id instance_id)
+{
+    struct can_state* st = &can_states[instance_id];
+    CAN_TypeDef* can = st->can_reg_base;
+    struct dio_direct_cfg dio_cfg;
+    uint32_t btr;
+    int32_t rc;
+
+    rc = calc_btr(st->cfg.bit_rate, &btr, &st->bit_rate);
+    if (rc != 0) {
+        log_error("can_hdw_init: no bit timing for %lu\n", st->cfg.bit_rate);
+        return rc;
     }
 
-    // TODO Need delay here?
+    LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_CAN1);
 
     dio_cfg.port = st->cfg.can_tx_pin_port;
     dio_cfg.pin_mask = st->cfg.can_tx_pin;
@@ -189,7 +739,7 @@ int32_t can_hdw_init(enum can_instance_id instance_id)
     dio_cfg.init_value = -1;
     dio_cfg.speed = DIO_SPEED_FREQ_VERY_HIGH;
     dio_cfg.output_type = DIO_OUTPUT_PUSHPULL;
-    dio_cfg.function = DIO_GPIO_FUNC_4;
+    dio_cfg.function = st->cfg.pin_function;
     rc = dio_direct_cfg(&dio_cfg);
     if (rc != 0) {
         log_error("can_hdw_init: dio_direct_cfg error tx %d\n", rc);
@@ -197,414 +747,563 @@ int32_t can_hdw_init(enum can_instance_id instance_id)
     }
     dio_cfg.port = st->cfg.can_rx_pin_port;
     dio_cfg.pin_mask = st->cfg.can_rx_pin;
+#if CONFIG_DIO_TYPE == 3
+    // Alternate function inputs are plain inputs on this GPIO type.
+    dio_cfg.mode = DIO_MODE_INPUT;
+    dio_cfg.pull = DIO_PULL_UP;
+#endif
     rc = dio_direct_cfg(&dio_cfg);
     if (rc != 0) {
         log_error("can_hdw_init: dio_direct_cfg error rx %d\n", rc);
         return rc;
     }
-    return 0;
-#endif
-}
-
-
-#if 0
-    __HAL_RCC_GPIOB_CLK_ENABLE();
-    /**CAN1 GPIO Configuration
-    PB12     ------> CAN1_RX
-    PB13     ------> CAN1_TX
-    */
-    GPIO_InitStruct.Pin = GPIO_PIN_12|GPIO_PIN_13;
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Pull = GPIO_NOPULL;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
-    GPIO_InitStruct.Alternate = GPIO_AF10_CAN1;
-    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
-  /* USER CODE BEGIN CAN1_MspInit 1 */
-
-  /* USER CODE END CAN1_MspInit 1 */
-  }
+    CLEAR_BIT(can->MCR, CAN_MCR_SLEEP);
+    rc = set_init_mode(can, true);
+    if (rc != 0) {
+        log_error("can_hdw_init: enter init mode timeout\n");
+        return rc;
+    }
 
+    // Automatic bus-off recovery, automatic retransmission, and chronological
+    // transmit order.
+    MODIFY_REG(can->MCR, CAN_MCR_TTCM | CAN_MCR_AWUM | CAN_MCR_NART |
+               CAN_MCR_RFLM, CAN_MCR_ABOM | CAN_MCR_TXFP);
+    can->BTR = btr | (st->cfg.loopback ? CAN_BTR_LBKM : 0);
+    program_filters(st);
 
-    {
-      hcan->MspInitCallback = HAL_CAN_MspInit; /* Legacy weak MspInit */
+    rc = set_init_mode(can, false);
+    if (rc != 0) {
+        log_error("can_hdw_init: leave init mode timeout (bus idle?)\n");
+        return rc;
     }
+    return 0;
+}
 
-    /* Init the low level hardware: CLOCK, NVIC */
-    hcan->MspInitCallback(hcan);
-  }
-
-#if 0
-#else
-  if (hcan->State == HAL_CAN_STATE_RESET)
-  {
-    /* Init the low level hardware: CLOCK, NVIC */
-    HAL_CAN_MspInit(hcan);
-  }
-#endif /* (USE_HAL_CAN_REGISTER_CALLBACKS) */
-
-  /* Exit from sleep mode */
-  CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_SLEEP);
-
-  /* Get tick */
-  tickstart = HAL_GetTick();
-
-  /* Check Sleep mode leave acknowledge */
-  while ((hcan->Instance->MSR & CAN_MSR_SLAK) != 0U)
-  {
-    if ((HAL_GetTick() - tickstart) > CAN_TIMEOUT_VALUE)
-    {
-      /* Update error code */
-      hcan->ErrorCode |= HAL_CAN_ERROR_TIMEOUT;
+/*
+ * @brief Enter or leave initialization mode.
+ *
+ * @param[in] can_reg_base Register base.
+ * @param[in] enter True to enter initialization mode, false to leave it.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t set_init_mode(CAN_TypeDef* can_reg_base, bool enter)
+{
+    uint32_t start_ms;
 
-      /* Change CAN state */
-      hcan->State = HAL_CAN_STATE_ERROR;
+    if (enter)
+        SET_BIT(can_reg_base->MCR, CAN_MCR_INRQ);
+    else
+        CLEAR_BIT(can_reg_base->MCR, CAN_MCR_INRQ);
 
-      return HAL_ERROR;
+    start_ms = tmr_get_ms();
+    while (((can_reg_base->MSR & CAN_MSR_INAK) != 0) != enter) {
+        if (tmr_get_ms() - start_ms > INIT_MODE_TMO_MS)
+            return MOD_ERR_PERIPH;
     }
-  }
+    return 0;
+}
 
-  /* Request initialisation */
-  SET_BIT(hcan->Instance->MCR, CAN_MCR_INRQ);
+/*
+ * @brief Calculate the bit timing register value.
+ *
+ * @param[in] bit_rate The desired bit rate.
+ * @param[out] btr The BTR value (timing fields only).
+ * @param[out] actual_bit_rate The resulting bit rate.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * An exact bit rate is required, which the usual bus speeds allow with the
+ * usual APB1 clocks.
+ */
+static int32_t calc_btr(uint32_t bit_rate, uint32_t* btr,
+                        uint32_t* actual_bit_rate)
+{
+    LL_RCC_ClocksTypeDef clocks;
+    uint32_t num_tq;
+    uint32_t brp;
+    uint32_t ts1;
+    uint32_t ts2;
+
+    if (bit_rate == 0)
+        return MOD_ERR_ARG;
+
+    LL_RCC_GetSystemClocksFreq(&clocks);
+    for (num_tq = BIT_TQ_MAX; num_tq >= BIT_TQ_MIN; num_tq--) {
+        if (clocks.PCLK1_Frequency % (bit_rate * num_tq) != 0)
+            continue;
+        brp = clocks.PCLK1_Frequency / (bit_rate * num_tq);
+        if (brp < 1 || brp > BRP_MAX)
+            continue;
+
+        // One quantum is always the sync segment.
+        ts1 = (num_tq * SAMPLE_POINT_8THS + 4) / 8 - 1;
+        ts2 = num_tq - 1 - ts1;
+        *btr = (((brp - 1) << CAN_BTR_BRP_Pos) |
+                ((ts1 - 1) << CAN_BTR_TS1_Pos) |
+                ((ts2 - 1) << CAN_BTR_TS2_Pos));
+        *actual_bit_rate = clocks.PCLK1_Frequency / (brp * num_tq);
+        return 0;
+    }
+    return MOD_ERR_ARG;
+}
 
-  /* Get tick */
-  tickstart = HAL_GetTick();
+/*
+ * @brief Program the acceptance filters into the hardware.
+ *
+ * @param[in] st The instance state.
+ *
+ * Each filter, configured or from a subscription, uses the filter bank with
+ * its index, in 32-bit mask mode and assigned to FIFO 0. The hardware numbers
+ * filters regardless of whether their banks are active, so the filter match
+ * index equals the bank number. With no filters at all, bank 0 is set up to
+ * accept everything.
+ */
+static void program_filters(struct can_state* st)
+{
+    CAN_TypeDef* can = st->can_reg_base;
+    uint32_t all_mask = (1 << CONFIG_CAN_MAX_FILTERS) - 1;
+    uint32_t active_mask = 0;
+    uint32_t idx;
+    CRIT_STATE_VAR;
+
+    CRIT_BEGIN_NEST();
+    SET_BIT(can->FMR, CAN_FMR_FINIT);
+    CLEAR_BIT(can->FA1R, (1 << NUM_FILTER_BANKS) - 1);
+    CLEAR_BIT(can->FM1R, all_mask);
+    SET_BIT(can->FS1R, all_mask);
+    CLEAR_BIT(can->FFA1R, all_mask);
+    for (idx = 0; idx < CONFIG_CAN_MAX_FILTERS; idx++) {
+        struct can_filter* f;
+
+        if (idx < st->cfg.num_filters)
+            f = &st->cfg.filters[idx];
+        else if (st->subs[idx].cb != NULL)
+            f = &st->subs[idx].filter;
+        else
+            continue;
+        if (f->ext) {
+            can->sFilterRegister[idx].FR1 = ((f->id << EXT_ID_SHIFT) |
+                                             CAN_RI0R_IDE);
+            can->sFilterRegister[idx].FR2 = ((f->mask << EXT_ID_SHIFT) |
+                                             CAN_RI0R_IDE);
+        } else {
+            can->sFilterRegister[idx].FR1 = f->id << STD_ID_SHIFT;
+            can->sFilterRegister[idx].FR2 = ((f->mask << STD_ID_SHIFT) |
+                                             CAN_RI0R_IDE);
+        }
+        active_mask |= 1 << idx;
+    }
+    if (active_mask == 0) {
+        can->sFilterRegister[0].FR1 = 0;
+        can->sFilterRegister[0].FR2 = 0;
+        active_mask = 1;
+    }
+    SET_BIT(can->FA1R, active_mask);
+    CLEAR_BIT(can->FMR, CAN_FMR_FINIT);
+    CRIT_END_NEST();
+}
 
-  /* Wait initialisation acknowledge */
-  while ((hcan->Instance->MSR & CAN_MSR_INAK) == 0U)
-  {
-    if ((HAL_GetTick() - tickstart) > CAN_TIMEOUT_VALUE)
-    {
-      /* Update error code */
-      hcan->ErrorCode |= HAL_CAN_ERROR_TIMEOUT;
-
-      /* Change CAN state */
-      hcan->State = HAL_CAN_STATE_ERROR;
-
-      return HAL_ERROR;
-    }
-  }
-
-  /* Set the time triggered communication mode */
-  if (hcan->Init.TimeTriggeredMode == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_TTCM);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_TTCM);
-  }
-
-  /* Set the automatic bus-off management */
-  if (hcan->Init.AutoBusOff == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_ABOM);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_ABOM);
-  }
-
-  /* Set the automatic wake-up mode */
-  if (hcan->Init.AutoWakeUp == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_AWUM);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_AWUM);
-  }
-
-  /* Set the automatic retransmission */
-  if (hcan->Init.AutoRetransmission == ENABLE)
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_NART);
-  }
-  else
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_NART);
-  }
-
-  /* Set the receive FIFO locked mode */
-  if (hcan->Init.ReceiveFifoLocked == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_RFLM);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_RFLM);
-  }
-
-  /* Set the transmit FIFO priority */
-  if (hcan->Init.TransmitFifoPriority == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_TXFP);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_TXFP);
-  }
-
-  /* Set the bit timing register */
-  WRITE_REG(hcan->Instance->BTR, (uint32_t)(hcan->Init.Mode           |
-                                            hcan->Init.SyncJumpWidth  |
-                                            hcan->Init.TimeSeg1       |
-                                            hcan->Init.TimeSeg2       |
-                                            (hcan->Init.Prescaler - 1U)));
-
-  /* Initialize the error code */
-  hcan->ErrorCode = HAL_CAN_ERROR_NONE;
-
-  /* Initialize the CAN state */
-  hcan->State = HAL_CAN_STATE_READY;
-
-  /* Return function status */
-  return HAL_OK;
+/*
+ * @brief Dispatch received frames to subscribers.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ *
+ * Each frame is passed in place in the RX ring, and its slot is released
+ * after the callback returns.
+ */
+static void dispatch(enum can_instance_id instance_id)
+{
+    struct can_state* st = &can_states[instance_id];
+    uint32_t num_frames;
+    uint32_t get_idx;
+
+    for (num_frames = 0;
+         num_frames < MAX_DISPATCH_PER_RUN &&
+             ring_get_peek(&st->rx_ring, &get_idx) > 0;
+         num_frames++) {
+        struct can_msg* msg = &st->rx_msgs[get_idx];
+        struct can_sub* sub = NULL;
+
+        if (msg->filter_idx < CONFIG_CAN_MAX_FILTERS)
+            sub = &st->subs[msg->filter_idx];
+        if (sub != NULL && sub->cb != NULL)
+            sub->cb(instance_id, msg, sub->user_data);
+        else
+            INC_SAT_U16(cnts_u16[instance_id][CNT_RX_UNCLAIMED]);
+        ring_get_commit(&st->rx_ring, 1);
+    }
 }
-#endif
 
-#if 0
-void HAL_CAN_MspInit(CAN_HandleTypeDef* hcan)
+/*
+ * @brief Write a frame to a TX mailbox and request transmission.
+ *
+ * @param[in] can_reg_base Register base.
+ * @param[in] mailbox The mailbox number, which must be free.
+ * @param[in] msg The frame.
+ */
+static void mailbox_write(CAN_TypeDef* can_reg_base, uint32_t mailbox,
+                          const struct can_msg* msg)
 {
-  GPIO_InitTypeDef GPIO_InitStruct = {0};
-  if(hcan->Instance==CAN1)
-  {
-  /* USER CODE BEGIN CAN1_MspInit 0 */
-
-  /* USER CODE END CAN1_MspInit 0 */
-    /* Peripheral clock enable */
-    __HAL_RCC_CAN1_CLK_ENABLE();
-
-    __HAL_RCC_GPIOB_CLK_ENABLE();
-    /**CAN1 GPIO Configuration
-    PB12     ------> CAN1_RX
-    PB13     ------> CAN1_TX
-    */
-    GPIO_InitStruct.Pin = GPIO_PIN_12|GPIO_PIN_13;
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Pull = GPIO_NOPULL;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
-    GPIO_InitStruct.Alternate = GPIO_AF10_CAN1;
-    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
-
-  /* USER CODE BEGIN CAN1_MspInit 1 */
-
-  /* USER CODE END CAN1_MspInit 1 */
-  }
+    CAN_TxMailBox_TypeDef* mb = &can_reg_base->sTxMailBox[mailbox];
+    uint32_t tir;
+
+    if (msg->ext)
+        tir = (msg->id << EXT_ID_SHIFT) | CAN_TI0R_IDE;
+    else
+        tir = msg->id << STD_ID_SHIFT;
+    if (msg->rtr)
+        tir |= CAN_TI0R_RTR;
+
+    mb->TDTR = msg->len;
+    mb->TDLR = (msg->data[0] | (msg->data[1] << 8) |
+                (msg->data[2] << 16) | ((uint32_t)msg->data[3] << 24));
+    mb->TDHR = (msg->data[4] | (msg->data[5] << 8) |
+                (msg->data[6] << 16) | ((uint32_t)msg->data[7] << 24));
+    mb->TIR = tir | CAN_TI0R_TXRQ;
+}
 
+/*
+ * @brief Move frames from the TX queue to free mailboxes.
+ *
+ * @param[in] st The instance state.
+ *
+ * @note Must be called with interrupts disabled, or from the TX interrupt.
+ */
+static void tx_fill(struct can_state* st)
+{
+    uint32_t tsr;
+    uint32_t get_idx;
+
+    while (ring_get_peek(&st->tx_ring, &get_idx) > 0) {
+        tsr = st->can_reg_base->TSR;
+        if (!(tsr & TSR_TME_ALL))
+            break;
+        mailbox_write(st->can_reg_base,
+                      (tsr & CAN_TSR_CODE) >> CAN_TSR_CODE_Pos,
+                      &st->tx_msgs[get_idx]);
+        ring_get_commit(&st->tx_ring, 1);
+    }
 }
-#endif
 
-#if 0
-HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef *hcan)
+/*
+ * @brief TX interrupt handler.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ *
+ * Counts completed requests, and refills free mailboxes.
+ */
+static void tx_interrupt(enum can_instance_id instance_id)
 {
-  uint32_t tickstart;
-
-  /* Check CAN handle */
-  if (hcan == NULL)
-  {
-    return HAL_ERROR;
-  }
-
-  /* Check the parameters */
-  assert_param(IS_CAN_ALL_INSTANCE(hcan->Instance));
-  assert_param(IS_FUNCTIONAL_STATE(hcan->Init.TimeTriggeredMode));
-  assert_param(IS_FUNCTIONAL_STATE(hcan->Init.AutoBusOff));
-  assert_param(IS_FUNCTIONAL_STATE(hcan->Init.AutoWakeUp));
-  assert_param(IS_FUNCTIONAL_STATE(hcan->Init.AutoRetransmission));
-  assert_param(IS_FUNCTIONAL_STATE(hcan->Init.ReceiveFifoLocked));
-  assert_param(IS_FUNCTIONAL_STATE(hcan->Init.TransmitFifoPriority));
-  assert_param(IS_CAN_MODE(hcan->Init.Mode));
-  assert_param(IS_CAN_SJW(hcan->Init.SyncJumpWidth));
-  assert_param(IS_CAN_BS1(hcan->Init.TimeSeg1));
-  assert_param(IS_CAN_BS2(hcan->Init.TimeSeg2));
-  assert_param(IS_CAN_PRESCALER(hcan->Init.Prescaler));
-
-#if USE_HAL_CAN_REGISTER_CALLBACKS == 1
-  if (hcan->State == HAL_CAN_STATE_RESET)
-  {
-    /* Reset callbacks to legacy functions */
-    hcan->RxFifo0MsgPendingCallback  =  HAL_CAN_RxFifo0MsgPendingCallback;  /* Legacy weak RxFifo0MsgPendingCallback  */
-    hcan->RxFifo0FullCallback        =  HAL_CAN_RxFifo0FullCallback;        /* Legacy weak RxFifo0FullCallback        */
-    hcan->RxFifo1MsgPendingCallback  =  HAL_CAN_RxFifo1MsgPendingCallback;  /* Legacy weak RxFifo1MsgPendingCallback  */
-    hcan->RxFifo1FullCallback        =  HAL_CAN_RxFifo1FullCallback;        /* Legacy weak RxFifo1FullCallback        */
-    hcan->TxMailbox0CompleteCallback =  HAL_CAN_TxMailbox0CompleteCallback; /* Legacy weak TxMailbox0CompleteCallback */
-    hcan->TxMailbox1CompleteCallback =  HAL_CAN_TxMailbox1CompleteCallback; /* Legacy weak TxMailbox1CompleteCallback */
-    hcan->TxMailbox2CompleteCallback =  HAL_CAN_TxMailbox2CompleteCallback; /* Legacy weak TxMailbox2CompleteCallback */
-    hcan->TxMailbox0AbortCallback    =  HAL_CAN_TxMailbox0AbortCallback;    /* Legacy weak TxMailbox0AbortCallback    */
-    hcan->TxMailbox1AbortCallback    =  HAL_CAN_TxMailbox1AbortCallback;    /* Legacy weak TxMailbox1AbortCallback    */
-    hcan->TxMailbox2AbortCallback    =  HAL_CAN_TxMailbox2AbortCallback;    /* Legacy weak TxMailbox2AbortCallback    */
-    hcan->SleepCallback              =  HAL_CAN_SleepCallback;              /* Legacy weak SleepCallback              */
-    hcan->WakeUpFromRxMsgCallback    =  HAL_CAN_WakeUpFromRxMsgCallback;    /* Legacy weak WakeUpFromRxMsgCallback    */
-    hcan->ErrorCallback              =  HAL_CAN_ErrorCallback;              /* Legacy weak ErrorCallback              */
-
-    if (hcan->MspInitCallback == NULL)
-    {
-      hcan->MspInitCallback = HAL_CAN_MspInit; /* Legacy weak MspInit */
+    static const uint32_t rqcp[NUM_TX_MAILBOXES] = {
+        CAN_TSR_RQCP0, CAN_TSR_RQCP1, CAN_TSR_RQCP2
+    };
+    static const uint32_t txok[NUM_TX_MAILBOXES] = {
+        CAN_TSR_TXOK0, CAN_TSR_TXOK1, CAN_TSR_TXOK2
+    };
+    static const uint32_t alst[NUM_TX_MAILBOXES] = {
+        CAN_TSR_ALST0, CAN_TSR_ALST1, CAN_TSR_ALST2
+    };
+    struct can_state* st = &can_states[instance_id];
+    uint16_t* cnts = cnts_u16[instance_id];
+    uint32_t tsr;
+    uint32_t clr = 0;
+    uint32_t idx;
+    CRIT_STATE_VAR;
+
+    tsr = st->can_reg_base->TSR;
+    for (idx = 0; idx < NUM_TX_MAILBOXES; idx++) {
+        if (!(tsr & rqcp[idx]))
+            continue;
+        clr |= rqcp[idx];
+        if (tsr & txok[idx]) {
+            INC_SAT_U16(cnts[CNT_TX_FRAMES]);
+        } else {
+            INC_SAT_U16(cnts[CNT_TX_ERR]);
+            if (tsr & alst[idx])
+                INC_SAT_U16(cnts[CNT_TX_ARB_LOST]);
+        }
     }
+    // Writing RQCPx also clears TXOKx, ALSTx, and TERRx.
+    st->can_reg_base->TSR = clr;
 
-    /* Init the low level hardware: CLOCK, NVIC */
-    hcan->MspInitCallback(hcan);
-  }
+    CRIT_BEGIN_NEST();
+    tx_fill(st);
+    CRIT_END_NEST();
+}
 
-#else
-  if (hcan->State == HAL_CAN_STATE_RESET)
-  {
-    /* Init the low level hardware: CLOCK, NVIC */
-    HAL_CAN_MspInit(hcan);
-  }
-#endif /* (USE_HAL_CAN_REGISTER_CALLBACKS) */
-
-  /* Exit from sleep mode */
-  CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_SLEEP);
-
-  /* Get tick */
-  tickstart = HAL_GetTick();
-
-  /* Check Sleep mode leave acknowledge */
-  while ((hcan->Instance->MSR & CAN_MSR_SLAK) != 0U)
-  {
-    if ((HAL_GetTick() - tickstart) > CAN_TIMEOUT_VALUE)
-    {
-      /* Update error code */
-      hcan->ErrorCode |= HAL_CAN_ERROR_TIMEOUT;
+/*
+ * @brief RX FIFO 0 interrupt handler.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ *
+ * Moves all pending frames from the FIFO to the RX ring.
+ */
+static void rx_interrupt(enum can_instance_id instance_id)
+{
+    struct can_state* st = &can_states[instance_id];
+    CAN_TypeDef* can = st->can_reg_base;
+    uint16_t* cnts = cnts_u16[instance_id];
+    uint32_t num_pending;
+    uint32_t rir;
+    uint32_t rdtr;
+    uint32_t rdlr;
+    uint32_t rdhr;
+    uint32_t put_idx;
+
+    if (can->RF0R & CAN_RF0R_FOVR0) {
+        INC_SAT_U16(cnts[CNT_RX_FIFO_OVERRUN]);
+        can->RF0R = CAN_RF0R_FOVR0;
+    }
 
-      /* Change CAN state */
-      hcan->State = HAL_CAN_STATE_ERROR;
+    num_pending = (can->RF0R & CAN_RF0R_FMP0) >> CAN_RF0R_FMP0_Pos;
+    while (num_pending-- > 0) {
+        rir = can->sFIFOMailBox[0].RIR;
+        rdtr = can->sFIFOMailBox[0].RDTR;
+        rdlr = can->sFIFOMailBox[0].RDLR;
+        rdhr = can->sFIFOMailBox[0].RDHR;
+        can->RF0R = CAN_RF0R_RFOM0;
+
+        if (ring_put_peek(&st->rx_ring, &put_idx) == 0) {
+            INC_SAT_U16(cnts[CNT_RX_RING_OVERRUN]);
+        } else {
+            struct can_msg* msg = &st->rx_msgs[put_idx];
+            msg->ext = (rir & CAN_RI0R_IDE) != 0;
+            msg->rtr = (rir & CAN_RI0R_RTR) != 0;
+            msg->id = rir >> (msg->ext ? EXT_ID_SHIFT : STD_ID_SHIFT);
+            msg->len = rdtr & CAN_RDT0R_DLC;
+            if (msg->len > CAN_MAX_DATA_LEN)
+                msg->len = CAN_MAX_DATA_LEN;
+            msg->filter_idx = (rdtr & CAN_RDT0R_FMI) >> CAN_RDT0R_FMI_Pos;
+            msg->data[0] = rdlr;
+            msg->data[1] = rdlr >> 8;
+            msg->data[2] = rdlr >> 16;
+            msg->data[3] = rdlr >> 24;
+            msg->data[4] = rdhr;
+            msg->data[5] = rdhr >> 8;
+            msg->data[6] = rdhr >> 16;
+            msg->data[7] = rdhr >> 24;
+            ring_put_commit(&st->rx_ring, 1);
+            INC_SAT_U16(cnts[CNT_RX_FRAMES]);
+        }
+
+        // Wait for the hardware to release the output mailbox.
+        while (can->RF0R & CAN_RF0R_RFOM0)
+            ;
+    }
+}
 
-      return HAL_ERROR;
+/*
+ * @brief Status change/error interrupt handler.
+ *
+ * @param[in] instance_id Identifies the can instance.
+ */
+static void sce_interrupt(enum can_instance_id instance_id)
+{
+    struct can_state* st = &can_states[instance_id];
+    CAN_TypeDef* can = st->can_reg_base;
+    uint16_t* cnts = cnts_u16[instance_id];
+    uint32_t esr = can->ESR;
+    uint32_t ier = can->IER;
+    uint32_t lec = (esr & CAN_ESR_LEC) >> CAN_ESR_LEC_Pos;
+
+    switch (lec) {
+        case LEC_STUFF:
+            INC_SAT_U16(cnts[CNT_STUFF_ERR]);
+            break;
+        case LEC_FORM:
+            INC_SAT_U16(cnts[CNT_FORM_ERR]);
+            break;
+        case LEC_ACK:
+            INC_SAT_U16(cnts[CNT_ACK_ERR]);
+            break;
+        case LEC_BIT_RECESSIVE:
+        case LEC_BIT_DOMINANT:
+            INC_SAT_U16(cnts[CNT_BIT_ERR]);
+            break;
+        case LEC_CRC:
+            INC_SAT_U16(cnts[CNT_CRC_ERR]);
+            break;
+        default:
+            break;
     }
-  }
 
-  /* Request initialisation */
-  SET_BIT(hcan->Instance->MCR, CAN_MCR_INRQ);
+    // Setting LEC to the software value lets us see the next update. The last
+    // error code interrupt is disabled until the next can_run(), and the
+    // error state interrupts while the state persists (see can_run()).
+    can->ESR = LEC_SW_SET << CAN_ESR_LEC_Pos;
+    if (lec != LEC_NONE && lec != LEC_SW_SET)
+        ier &= ~CAN_IER_LECIE;
+    if ((esr & CAN_ESR_BOFF) && (ier & CAN_IER_BOFIE)) {
+        INC_SAT_U16(cnts[CNT_BUS_OFF]);
+        ier &= ~CAN_IER_BOFIE;
+    }
+    if ((esr & CAN_ESR_EPVF) && (ier & CAN_IER_EPVIE)) {
+        INC_SAT_U16(cnts[CNT_ERR_PASSIVE]);
+        ier &= ~CAN_IER_EPVIE;
+    }
+    if ((esr & CAN_ESR_EWGF) && (ier & CAN_IER_EWGIE)) {
+        INC_SAT_U16(cnts[CNT_ERR_WARNING]);
+        ier &= ~CAN_IER_EWGIE;
+    }
+    can->IER = ier;
+    can->MSR = CAN_MSR_ERRI;
+}
 
-  /* Get tick */
-  tickstart = HAL_GetTick();
+/*
+ * @brief Console command function for "can status".
+ *
+ * @param[in] argc Number of arguments, including "can"
+ * @param[in] argv Argument values, including "can"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: can status
+ */
+static int32_t cmd_can_status(int32_t argc, const char** argv)
+{
+    uint32_t idx;
+    struct can_state* st;
 
-  /* Wait initialisation acknowledge */
-  while ((hcan->Instance->MSR & CAN_MSR_INAK) == 0U)
-  {
-    if ((HAL_GetTick() - tickstart) > CAN_TIMEOUT_VALUE)
-    {
-      /* Update error code */
-      hcan->ErrorCode |= HAL_CAN_ERROR_TIMEOUT;
-
-      /* Change CAN state */
-      hcan->State = HAL_CAN_STATE_ERROR;
-
-      return HAL_ERROR;
-    }
-  }
-
-  /* Set the time triggered communication mode */
-  if (hcan->Init.TimeTriggeredMode == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_TTCM);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_TTCM);
-  }
-
-  /* Set the automatic bus-off management */
-  if (hcan->Init.AutoBusOff == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_ABOM);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_ABOM);
-  }
-
-  /* Set the automatic wake-up mode */
-  if (hcan->Init.AutoWakeUp == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_AWUM);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_AWUM);
-  }
-
-  /* Set the automatic retransmission */
-  if (hcan->Init.AutoRetransmission == ENABLE)
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_NART);
-  }
-  else
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_NART);
-  }
-
-  /* Set the receive FIFO locked mode */
-  if (hcan->Init.ReceiveFifoLocked == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_RFLM);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_RFLM);
-  }
-
-  /* Set the transmit FIFO priority */
-  if (hcan->Init.TransmitFifoPriority == ENABLE)
-  {
-    SET_BIT(hcan->Instance->MCR, CAN_MCR_TXFP);
-  }
-  else
-  {
-    CLEAR_BIT(hcan->Instance->MCR, CAN_MCR_TXFP);
-  }
-
-  /* Set the bit timing register */
-  WRITE_REG(hcan->Instance->BTR, (uint32_t)(hcan->Init.Mode           |
-                                            hcan->Init.SyncJumpWidth  |
-                                            hcan->Init.TimeSeg1       |
-                                            hcan->Init.TimeSeg2       |
-                                            (hcan->Init.Prescaler - 1U)));
-
-  /* Initialize the error code */
-  hcan->ErrorCode = HAL_CAN_ERROR_NONE;
-
-  /* Initialize the CAN state */
-  hcan->State = HAL_CAN_STATE_READY;
-
-  /* Return function status */
-  return HAL_OK;
+    printc("            RX  TX          Err ESR\n"
+           "ID Bit rate Rng Que Flt TEC REC BOF EPV EWG\n"
+           "-- -------- --- --- --- --- --- --- --- ---\n");
+    for (idx = 0, st = can_states; idx < CAN_NUM_INSTANCES; idx++, st++) {
+        uint32_t esr = st->started ? st->can_reg_base->ESR : 0;
+        printc("%2lu %8lu %3lu %3lu %3lu %3lu %3lu %3d %3d %3d\n",
+               idx, st->bit_rate,
+               ring_count(&st->rx_ring), ring_count(&st->tx_ring),
+               st->cfg.num_filters,
+               (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos,
+               (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos,
+               (esr & CAN_ESR_BOFF) != 0, (esr & CAN_ESR_EPVF) != 0,
+               (esr & CAN_ESR_EWGF) != 0);
+    }
+    return 0;
 }
-#endif
 
-#if 0
-static void MX_CAN1_Init(void)
+/*
+ * @brief Console command function for "can test".
+ *
+ * @param[in] argc Number of arguments, including "can"
+ * @param[in] argv Argument values, including "can"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: can test [<op> [<arg>]]
+ */
+static int32_t cmd_can_test(int32_t argc, const char** argv)
 {
+    struct cmd_arg_val arg_vals[5];
+    enum can_instance_id instance_id;
+    struct can_msg msg;
+    struct can_filter filter;
+    int32_t num_args;
+    int32_t rc = 0;
+    uint32_t idx;
+
+    // Handle help case.
+    if (argc == 2) {
+        printc("Test operations and param(s) are as follows:\n"
+               "  Send frame, usage: can test send <instance-id> <can-id> "
+               "[<len> [<data-0-3> [<data-4-7>]]]\n"
+               "  Send ext frame, usage: can test sendx <instance-id> <can-id> "
+               "[<len> [<data-0-3> [<data-4-7>]]]\n");
+        printc("  Get received frames, usage: can test recv <instance-id>\n"
+               "  Set one filter, usage: can test filter <instance-id> "
+               "[<can-id> <mask> [<ext>]]\n"
+               "  Subscribe (print frames), usage: can test sub <instance-id> "
+               "<can-id> <mask> [<ext>]\n"
+               "  Unsubscribe, usage: can test unsub <instance-id> <handle>\n"
+               "Data words are sent least significant byte first.\n");
+        return 0;
+    }
+
+    if (cmd_parse_args(argc-3, argv+3, "u+", arg_vals) != 1) {
+        printc("Can't get instance ID\n");
+        return MOD_ERR_BAD_CMD;
+    }
+    instance_id = (enum can_instance_id)arg_vals[0].val.u;
+    if (instance_id >= CAN_NUM_INSTANCES ||
+        !can_states[instance_id].started) {
+        printc("Bad instance\n");
+        return MOD_ERR_BAD_INSTANCE;
+    }
 
-  /* USER CODE BEGIN CAN1_Init 0 */
-
-  /* USER CODE END CAN1_Init 0 */
-
-  /* USER CODE BEGIN CAN1_Init 1 */
-
-  /* USER CODE END CAN1_Init 1 */
-  hcan1.Instance = CAN1;
-  hcan1.Init.Prescaler = 40;
-  hcan1.Init.Mode = CAN_MODE_NORMAL;
-  hcan1.Init.SyncJumpWidth = CAN_SJW_1TQ;
-  hcan1.Init.TimeSeg1 = CAN_BS1_13TQ;
-  hcan1.Init.TimeSeg2 = CAN_BS2_2TQ;
-  hcan1.Init.TimeTriggeredMode = DISABLE;
-  hcan1.Init.AutoBusOff = DISABLE;
-  hcan1.Init.AutoWakeUp = DISABLE;
-  hcan1.Init.AutoRetransmission = DISABLE;
-  hcan1.Init.ReceiveFifoLocked = DISABLE;
-  hcan1.Init.TransmitFifoPriority = DISABLE;
-  if (HAL_CAN_Init(&hcan1) != HAL_OK)
-  {
-    Error_Handler();
-  }
-  /* USER CODE BEGIN CAN1_Init 2 */
-
-  /* USER CODE END CAN1_Init 2 */
+    if (strcasecmp(argv[2], "send") == 0 || strcasecmp(argv[2], "sendx") == 0) {
+        num_args = cmd_parse_args(argc-4, argv+4, "u[u[u[u]]]", arg_vals);
+        if (num_args < 1)
+            return MOD_ERR_BAD_CMD;
+        memset(&msg, 0, sizeof(msg));
+        msg.id = arg_vals[0].val.u;
+        msg.ext = strcasecmp(argv[2], "sendx") == 0;
+        msg.len = num_args > 1 ? arg_vals[1].val.u : 0;
+        for (idx = 0; idx < CAN_MAX_DATA_LEN; idx++) {
+            if (num_args > 2 + idx / 4)
+                msg.data[idx] = arg_vals[2 + idx / 4].val.u >> (8 * (idx % 4));
+        }
+        rc = can_tx(instance_id, &msg);
+    } else if (strcasecmp(argv[2], "recv") == 0) {
+        while (can_rx(instance_id, &msg) == 1) {
+            printc("id=0x%08lx%s%s flt=%u len=%u:", msg.id,
+                   msg.ext ? " ext" : "", msg.rtr ? " rtr" : "",
+                   msg.filter_idx, msg.len);
+            for (idx = 0; idx < msg.len; idx++)
+                printc(" %02x", msg.data[idx]);
+            printc("\n");
+        }
+    } else if (strcasecmp(argv[2], "filter") == 0) {
+        num_args = cmd_parse_args(argc-4, argv+4, "[uu[u]]", arg_vals);
+        if (num_args < 0)
+            return MOD_ERR_BAD_CMD;
+        if (num_args == 0) {
+            rc = can_set_filters(instance_id, 0, NULL);
+        } else {
+            filter.id = arg_vals[0].val.u;
+            filter.mask = arg_vals[1].val.u;
+            filter.ext = num_args > 2 && arg_vals[2].val.u != 0;
+            rc = can_set_filters(instance_id, 1, &filter);
+        }
+    } else if (strcasecmp(argv[2], "sub") == 0) {
+        num_args = cmd_parse_args(argc-4, argv+4, "uu[u]", arg_vals);
+        if (num_args < 0)
+            return MOD_ERR_BAD_CMD;
+        filter.id = arg_vals[0].val.u;
+        filter.mask = arg_vals[1].val.u;
+        filter.ext = num_args > 2 && arg_vals[2].val.u != 0;
+        rc = can_subscribe(instance_id, &filter, cmd_sub_cb, NULL);
+    } else if (strcasecmp(argv[2], "unsub") == 0) {
+        num_args = cmd_parse_args(argc-4, argv+4, "u", arg_vals);
+        if (num_args < 0)
+            return MOD_ERR_BAD_CMD;
+        rc = can_unsubscribe(instance_id, arg_vals[0].val.u);
+    } else {
+        printc("Invalid operation '%s'\n", argv[2]);
+        return MOD_ERR_BAD_CMD;
+    }
+    printc("Return code %ld\n", rc);
+    return 0;
+}
 
+/*
+ * @brief Subscriber callback for "can test sub".
+ *
+ * @param[in] instance_id Identifies the can instance.
+ * @param[in] msg The received frame.
+ * @param[in] user_data Not used.
+ */
+static void cmd_sub_cb(enum can_instance_id instance_id,
+                       const struct can_msg* msg, void* user_data)
+{
+    uint32_t idx;
+
+    printc("can%d id=0x%08lx%s%s flt=%u len=%u:", instance_id + 1, msg->id,
+           msg->ext ? " ext" : "", msg->rtr ? " rtr" : "", msg->filter_idx,
+           msg->len);
+    for (idx = 0; idx < msg->len; idx++)
+        printc(" %02x", msg->data[idx]);
+    printc("\n");
 }
-#endif
+
+#endif // CONFIG_CAN_TYPE == 1
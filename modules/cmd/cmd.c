@@ -54,6 +54,11 @@
  * > * log
  * > * log <new-level>
  *
+ * Client names and command names are looked up using a hash table built at
+ * registration time (open addressing, case-insensitive FNV-1a hash of the
+ * client name, or of the client and command names). Thus the cost of
+ * dispatching a command does not depend on the number of clients or commands.
+ *
  * MIT License
  * 
  * Copyright (c) 2021 Eugene R Schroeder
@@ -96,6 +101,24 @@
 #define MAX_TOKENS CONFIG_CMD_MAX_TOKENS
 #define MAX_CLIENTS CONFIG_CMD_MAX_CLIENTS
 
+#define HASH_SIZE CONFIG_CMD_HASH_SIZE
+#define HASH_MASK (HASH_SIZE - 1)
+
+_Static_assert((HASH_SIZE & HASH_MASK) == 0,
+               "CONFIG_CMD_HASH_SIZE not a power of 2");
+_Static_assert(MAX_CLIENTS < 255, "CONFIG_CMD_MAX_CLIENTS too large");
+
+#define FNV_OFFSET_BASIS 2166136261UL
+#define FNV_PRIME 16777619UL
+
+// A hash table entry has the client index + 1 in the low byte and the command
+// index + 1 in the high byte (0 for an entry for the client itself). An empty
+// entry is 0.
+#define HASH_ENTRY(client_idx, cmd_idx) \
+    ((uint16_t)(((client_idx) + 1) | (((cmd_idx) + 1) << 8)))
+#define HASH_ENTRY_CLIENT_IDX(entry) (((entry) & 0xff) - 1)
+#define HASH_ENTRY_CMD_IDX(entry) (((entry) >> 8) - 1)
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -106,6 +129,15 @@
 
 static const char* log_level_str(int32_t level);
 static int32_t log_level_int(const char* level_name);
+static uint32_t hash_str(uint32_t hash, const char* str);
+static uint32_t hash_cmd(const char* client_name, const char* cmd_name);
+static int32_t hash_insert(uint32_t hash, uint16_t entry);
+static int32_t hash_add_client(int32_t client_idx);
+static int32_t hash_rebuild(void);
+static int32_t find_client(const char* name);
+static int32_t parse_bin_arg(const char* arg, char fmt,
+                             struct cmd_arg_val* arg_val);
+static int32_t find_cmd(int32_t client_idx, const char* cmd_name);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -114,6 +146,9 @@ static int32_t log_level_int(const char* level_name);
 // Client info.
 static const struct cmd_client_info* client_info[MAX_CLIENTS];
 
+// Hash table for client and command lookup.
+static uint16_t hash_tbl[HASH_SIZE];
+
 static int32_t log_level = LOG_DEFAULT; 
 
 static const char* log_level_names[] = {
@@ -142,6 +177,7 @@ static const char* log_level_names[] = {
 int32_t cmd_init(struct cmd_cfg* cfg)
 {
     memset(client_info, 0, sizeof(client_info));
+    memset(hash_tbl, 0, sizeof(hash_tbl));
     return 0;
 }
 
@@ -157,15 +193,47 @@ int32_t cmd_init(struct cmd_cfg* cfg)
 int32_t cmd_register(const struct cmd_client_info* _client_info)
 {
     int32_t idx;
+    int32_t rc = 0;
+
+    if (_client_info->num_cmds < 0 || _client_info->num_cmds >= 255)
+        return MOD_ERR_ARG;
 
     for (idx = 0; idx < MAX_CLIENTS; idx++) {
-        if (client_info[idx] == NULL ||
-            strcasecmp(client_info[idx]->name, _client_info->name) == 0) {
+        if (client_info[idx] == NULL) {
             client_info[idx] = _client_info;
-            return 0;
+            rc = hash_add_client(idx);
+            break;
+        }
+        if (strcasecmp(client_info[idx]->name, _client_info->name) == 0) {
+            // Replacing a client, so its old commands must be removed.
+            client_info[idx] = _client_info;
+            rc = hash_rebuild();
+            break;
         }
     }
-    return MOD_ERR_RESOURCE;
+    if (idx >= MAX_CLIENTS)
+        return MOD_ERR_RESOURCE;
+    if (rc < 0)
+        log_error("cmd_register: hash table full for %s\n",
+                  _client_info->name);
+    return rc;
+}
+
+/*
+ * @brief Get a registered client.
+ *
+ * @param[in] idx Client index, in order of registration (0-based).
+ *
+ * @return The client information, or NULL if there is no such client.
+ *
+ * This lets other modules (e.g. telem) walk the clients, for example to
+ * collect their performance measurements.
+ */
+const struct cmd_client_info* cmd_get_client(uint32_t idx)
+{
+    if (idx >= MAX_CLIENTS)
+        return NULL;
+    return client_info[idx];
 }
 
 /*
@@ -183,10 +251,6 @@ int32_t cmd_execute(char* bfr)
     int32_t num_tokens = 0;
     const char* tokens[MAX_TOKENS];
     char* p = bfr;
-    int32_t idx;
-    int32_t idx2;
-    const struct cmd_client_info* ci;
-    const struct cmd_cmd_info* cci;
 
     // Tokenize the command line in-place.
     while (1) {
@@ -215,6 +279,29 @@ int32_t cmd_execute(char* bfr)
         }
     }
 
+    return cmd_execute_argv(num_tokens, tokens);
+}
+
+/*
+ * @brief Execute a command given as tokens.
+ *
+ * @param[in] num_tokens Number of tokens.
+ * @param[in] tokens The tokens, starting with the client name. Note that
+ *                   tokens[1] can be modified.
+ *
+ * @return 0 or the value returned by the command function for success, else a
+ *         "MOD_ERR" value. See code for details.
+ *
+ * This is the second part of cmd_execute(), used directly by the console
+ * binary command mode, where the tokens do not come from a command line.
+ */
+int32_t cmd_execute_argv(int32_t num_tokens, const char** tokens)
+{
+    int32_t idx;
+    int32_t idx2;
+    const struct cmd_client_info* ci;
+    const struct cmd_cmd_info* cci;
+
     // If there are no tokens, nothing to do.
     if (num_tokens == 0)
         return 0;
@@ -283,12 +370,9 @@ int32_t cmd_execute(char* bfr)
     }
 
     // Find and execute the command.
-    for (idx = 0;
-         idx < MAX_CLIENTS && client_info[idx] != NULL;
-         idx++) {
+    idx = find_client(tokens[0]);
+    if (idx >= 0) {
         ci = client_info[idx];
-        if (strcasecmp(tokens[0], ci->name) != 0)
-            continue;
 
         // If there is no command, treat it as help.
         if (num_tokens == 1)
@@ -361,12 +445,10 @@ int32_t cmd_execute(char* bfr)
         }
 
         // Find the command
-        for (idx2 = 0; idx2 < ci->num_cmds; idx2++) {
-            if (strcasecmp(tokens[1], ci->cmds[idx2].name) == 0) {
-                log_debug("Handle command\n");
-                ci->cmds[idx2].func(num_tokens, tokens);
-                return 0;
-            }
+        idx2 = find_cmd(idx, tokens[1]);
+        if (idx2 >= 0) {
+            log_debug("Handle command\n");
+            return ci->cmds[idx2].func(num_tokens, tokens);
         }
         printc("No such command (%s %s)\n", tokens[0], tokens[1]);
         return MOD_ERR_BAD_CMD;
@@ -421,6 +503,12 @@ int32_t cmd_execute(char* bfr)
  *   "i[ii" - Requires either one or three integer arguments.
  *   "i[ii]" - Same as above (matched brackets).
  *
+ * Arguments of a console binary frame (see console_bin_active()) can also be
+ * binary (see CMD_BIN_ARG_MARK), in which case the value is used without
+ * parsing. A binary 'i', 'u', or 'p' argument is accepted for any of these
+ * formats, and also for 'f' (converted). A binary 'f' argument is only
+ * accepted for 'f'.
+ *
  * @return On success, the number of arguments present (>=0), a "MOD_ERR" value
  *         (<0). See code for details.
  */
@@ -462,6 +550,20 @@ int32_t cmd_parse_args(int32_t argc, const char** argv, const char* fmt,
             return MOD_ERR_BAD_CMD;
         }
 
+        // Binary arguments need no parsing. They only come from a console
+        // binary frame, so in text mode the mark is just a character.
+        if (**argv == CMD_BIN_ARG_MARK && console_bin_active()) {
+            if (parse_bin_arg(*argv, *fmt, arg_vals) != 0)
+                return MOD_ERR_ARG;
+            arg_vals->type = *fmt;
+            arg_vals++;
+            arg_cnt++;
+            argv++;
+            fmt++;
+            opt_args = false;
+            continue;
+        }
+
         switch (*fmt) {
             case 'i':
                 arg_vals->val.i = strtol(*argv, &endptr, 0);
@@ -570,3 +672,204 @@ static int32_t log_level_int(const char* level_name)
     }
     return rc;
 }
+
+/*
+ * @brief Continue a case-insensitive FNV-1a hash over a string.
+ *
+ * @param[in] hash Hash value so far (FNV_OFFSET_BASIS to start).
+ * @param[in] str String to hash.
+ *
+ * @return Hash value.
+ */
+static uint32_t hash_str(uint32_t hash, const char* str)
+{
+    while (*str) {
+        hash ^= (uint8_t)tolower((unsigned char)*str++);
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * @brief Get the hash of a client name and command name.
+ *
+ * @param[in] client_name Client name.
+ * @param[in] cmd_name Command name.
+ *
+ * @return Hash value.
+ */
+static uint32_t hash_cmd(const char* client_name, const char* cmd_name)
+{
+    uint32_t hash = hash_str(FNV_OFFSET_BASIS, client_name);
+
+    // Separator, so that e.g. "ab c" and "a bc" differ.
+    hash ^= ' ';
+    hash *= FNV_PRIME;
+    return hash_str(hash, cmd_name);
+}
+
+/*
+ * @brief Insert an entry into the hash table.
+ *
+ * @param[in] hash Hash value of the entry key.
+ * @param[in] entry Entry value (see HASH_ENTRY).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Linear probing is used. Since entries are only added (except for a rebuild),
+ * an entry for a duplicate name is found after the first one, which matches
+ * the behavior of a linear search.
+ */
+static int32_t hash_insert(uint32_t hash, uint16_t entry)
+{
+    uint32_t probe;
+
+    for (probe = 0; probe < HASH_SIZE; probe++) {
+        uint16_t* slot = &hash_tbl[(hash + probe) & HASH_MASK];
+        if (*slot == 0) {
+            *slot = entry;
+            return 0;
+        }
+    }
+    return MOD_ERR_RESOURCE;
+}
+
+/*
+ * @brief Add a client and its commands to the hash table.
+ *
+ * @param[in] client_idx Index of client in client_info.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t hash_add_client(int32_t client_idx)
+{
+    const struct cmd_client_info* ci = client_info[client_idx];
+    int32_t cmd_idx;
+    int32_t rc;
+
+    rc = hash_insert(hash_str(FNV_OFFSET_BASIS, ci->name),
+                     HASH_ENTRY(client_idx, -1));
+    for (cmd_idx = 0; rc == 0 && cmd_idx < ci->num_cmds; cmd_idx++)
+        rc = hash_insert(hash_cmd(ci->name, ci->cmds[cmd_idx].name),
+                         HASH_ENTRY(client_idx, cmd_idx));
+    return rc;
+}
+
+/*
+ * @brief Rebuild the hash table from the registered clients.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t hash_rebuild(void)
+{
+    int32_t idx;
+    int32_t rc = 0;
+
+    memset(hash_tbl, 0, sizeof(hash_tbl));
+    for (idx = 0; rc == 0 && idx < MAX_CLIENTS && client_info[idx] != NULL;
+         idx++)
+        rc = hash_add_client(idx);
+    return rc;
+}
+
+/*
+ * @brief Find a client by name.
+ *
+ * @param[in] name Client name (case-insensitive).
+ *
+ * @return Index of client in client_info, or -1 if not found.
+ */
+static int32_t find_client(const char* name)
+{
+    uint32_t hash = hash_str(FNV_OFFSET_BASIS, name);
+    uint32_t probe;
+
+    for (probe = 0; probe < HASH_SIZE; probe++) {
+        uint16_t entry = hash_tbl[(hash + probe) & HASH_MASK];
+        if (entry == 0)
+            break;
+        if (HASH_ENTRY_CMD_IDX(entry) < 0 &&
+            strcasecmp(name, client_info[HASH_ENTRY_CLIENT_IDX(entry)]->name)
+            == 0)
+            return HASH_ENTRY_CLIENT_IDX(entry);
+    }
+    return -1;
+}
+
+/*
+ * @brief Find a client's command by name.
+ *
+ * @param[in] client_idx Index of client in client_info.
+ * @param[in] cmd_name Command name (case-insensitive).
+ *
+ * @return Index of command in the client's cmds, or -1 if not found.
+ */
+static int32_t find_cmd(int32_t client_idx, const char* cmd_name)
+{
+    const struct cmd_client_info* ci = client_info[client_idx];
+    uint32_t hash = hash_cmd(ci->name, cmd_name);
+    uint32_t probe;
+
+    for (probe = 0; probe < HASH_SIZE; probe++) {
+        uint16_t entry = hash_tbl[(hash + probe) & HASH_MASK];
+        if (entry == 0)
+            break;
+        if (HASH_ENTRY_CLIENT_IDX(entry) == client_idx &&
+            HASH_ENTRY_CMD_IDX(entry) >= 0 &&
+            strcasecmp(cmd_name, ci->cmds[HASH_ENTRY_CMD_IDX(entry)].name) == 0)
+            return HASH_ENTRY_CMD_IDX(entry);
+    }
+    return -1;
+}
+
+/*
+ * @brief Get the value of a binary argument.
+ *
+ * @param[in] arg The argument, starting with CMD_BIN_ARG_MARK.
+ * @param[in] fmt The format character the argument must match.
+ * @param[out] arg_val The argument value.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t parse_bin_arg(const char* arg, char fmt,
+                             struct cmd_arg_val* arg_val)
+{
+    char type = arg[1];
+    const uint8_t* p = (const uint8_t*)&arg[2];
+    uint32_t u = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    bool is_int = (type == 'i' || type == 'u' || type == 'p');
+
+    switch (fmt) {
+        case 'i':
+        case 'u':
+            if (is_int) {
+                arg_val->val.u = u;
+                return 0;
+            }
+            break;
+        case 'p':
+            if (is_int) {
+                arg_val->val.p = (void*)(uintptr_t)u;
+                return 0;
+            }
+            break;
+        case 'f':
+            if (type == 'f') {
+                memcpy(&arg_val->val.f, &u, sizeof(arg_val->val.f));
+                return 0;
+            }
+            if (type == 'i') {
+                arg_val->val.f = (float)(int32_t)u;
+                return 0;
+            }
+            if (is_int) {
+                arg_val->val.f = (float)u;
+                return 0;
+            }
+            break;
+        default:
+            break;
+    }
+    printc("Binary argument type '%c' does not match '%c'\n", type, fmt);
+    return MOD_ERR_ARG;
+}
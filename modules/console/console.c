@@ -12,6 +12,56 @@
  * (i.e. toggle). This is handy to temporarily stop logging output when running
  * commands.
  *
+ * Binary command mode
+ * -------------------
+ *
+ * For host automation, commands can also be sent as binary frames, which are
+ * dispatched to the same command tables as text commands (see cmd module),
+ * without the overhead of formatting and parsing numbers as text. A binary
+ * frame is recognized when the CONSOLE_BIN_SOF character is received at the
+ * start of a line. Frames have this format:
+ *
+ *   SOF | len | seq | payload (len bytes) | crc16 (LSB first)
+ *
+ * The CRC is CRC-16/CCITT-FALSE over len, seq, and the payload. A request
+ * payload is a sequence of typed arguments, starting with the client and
+ * command names:
+ *
+ *   's' <n> <n chars>     String.
+ *   'i' <4 bytes>         Signed integer (little endian).
+ *   'u' <4 bytes>         Unsigned integer (little endian).
+ *   'p' <4 bytes>         Pointer / address (little endian).
+ *   'f' <4 bytes>         IEEE float (little endian).
+ *
+ * The type codes are those used by cmd_parse_args(), which accepts the binary
+ * arguments directly. Frames with a bad CRC, or not completed within
+ * CONFIG_CONSOLE_BIN_TMO_MS, are dropped (and counted).
+ *
+ * Reply frames use the same framing and echo the request seq value. The first
+ * payload byte gives the reply type:
+ *
+ *   'O' <text>                Command output (printc), as many frames as
+ *                             needed.
+ *   'R' <rc:4> <data_len:4>   Command completed with return code rc. If
+ *                             data_len is not 0, 'D' frames follow.
+ *   'D' <offset:4> <data>     Raw data from console_data_print(), sent
+ *                             instead of a hex dump.
+ *
+ * No echo or prompt is produced for binary commands.
+ *
+ * Formatted output
+ * ----------------
+ *
+ * printc() and friends use the fmt utility rather than vsnprintf(). The
+ * output is passed to ttys in chunks as it is formatted, so there is no
+ * print buffer on the stack and no limit on output length. The fmt
+ * utility supports fixed-point float conversions (e.g. "%.3f").
+ *
+ * If CONFIG_CONSOLE_FMT_BENCH is set, the following console command is
+ * provided, to compare fmt with vsnprintf():
+ * > console fmt-bench
+ * See code for details.
+ *
  * MIT License
  * 
  * Copyright (c) 2021 Eugene R Schroeder
@@ -43,11 +93,16 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "bench.h"
 #include "cmd.h"
 #include "config.h"
 #include "console.h"
+#include "crc.h"
+#include "fmt.h"
 #include "log.h"
 #include "module.h"
+#include "stat.h"
+#include "tmr.h"
 #include "ttys.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -58,12 +113,40 @@
 
 #define DATA_PRINT_BYTES_PER_LINE 32
 
+// Data print line: "oooooooo: " + 2 hex chars per byte + "\n"
+#define DATA_PRINT_LINE_SIZE (8 + 2 + 2 * DATA_PRINT_BYTES_PER_LINE + 1)
+
+#define BIN_MAX_PAYLOAD CONFIG_CONSOLE_BIN_MAX_PAYLOAD
+#define BIN_MAX_ARGS CONFIG_CMD_MAX_TOKENS
+
+// Frame overhead: SOF, len, seq, crc16
+#define BIN_FRAME_OVERHEAD 5
+
+// Space for the frame header in front of an 'O' or 'D' payload.
+#define BIN_OUT_HDR_SIZE 3
+
+#define BIN_DATA_HDR_SIZE 5
+
+#if BIN_MAX_PAYLOAD > 255
+    #error CONFIG_CONSOLE_BIN_MAX_PAYLOAD too large
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
 #define CONSOLE_CMD_BFR_SIZE 80
 
+// Binary frame receive state, i.e. what the next byte is.
+enum bin_rx_state {
+    BIN_RX_IDLE,
+    BIN_RX_LEN,
+    BIN_RX_SEQ,
+    BIN_RX_PAYLOAD,
+    BIN_RX_CRC_LSB,
+    BIN_RX_CRC_MSB,
+};
+
 struct console_state {
     struct console_cfg cfg;
     char cmd_bfr[CONSOLE_CMD_BFR_SIZE];
@@ -72,11 +155,59 @@ struct console_state {
     uint8_t* data_print_ptr;
     uint16_t num_cmd_bfr_chars;
     bool first_run_done;
+    bool data_print_bin;
+
+    // Binary command mode.
+    enum bin_rx_state bin_rx_state;
+    uint8_t bin_rx_len;
+    uint8_t bin_rx_cnt;
+    uint8_t bin_seq;
+    uint16_t bin_rx_crc;
+    uint32_t bin_rx_start_ms;
+    uint8_t bin_rx_buf[BIN_MAX_PAYLOAD];
+    bool bin_exec;
+    uint16_t bin_out_len;
+    uint8_t bin_out_buf[BIN_OUT_HDR_SIZE + BIN_MAX_PAYLOAD + 2];
+};
+
+// Performance measurements for console.
+
+enum console_u16_pms {
+    CNT_BIN_RX_FRAME,
+    CNT_BIN_RX_CRC_ERR,
+    CNT_BIN_RX_TMO,
+    CNT_BIN_RX_BAD_ARGS,
+
+    NUM_U16_PMS
 };
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
+static void console_write(const char* buf, int len);
+static void console_out(void* out_arg, const char* s, uint32_t len);
+static uint32_t data_line_format(char* line, uint32_t offset,
+                                 const uint8_t* data, uint32_t num_bytes);
+static void bin_rx(uint8_t c);
+static void bin_execute(void);
+static void bin_out_flush(void);
+static void bin_send(uint8_t* frame, uint32_t payload_len);
+static void put_u32(uint8_t* p, uint32_t val);
+#if CONFIG_FAULT_PRESENT
+static void console_out_panic(void* out_arg, const char* s, uint32_t len);
+#endif
+#if CONFIG_CONSOLE_FMT_BENCH || CONFIG_BENCH_PRESENT
+static int bench_format(bool use_fmt, char* buf, uint32_t size,
+                        uint32_t case_idx);
+#endif
+#if CONFIG_CONSOLE_FMT_BENCH
+static int32_t cmd_console_fmt_bench(int32_t argc, const char** argv);
+#endif
+#if CONFIG_BENCH_PRESENT
+static int32_t bench_fmt(uint32_t num_ops);
+static int32_t bench_snprintf(uint32_t num_ops);
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
@@ -90,6 +221,73 @@ static struct console_state state = {
 
 static int32_t log_level = LOG_DEFAULT;
 
+static const char hex_digits[] = "0123456789abcdef";
+
+// Storage for performance measurements.
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+// Names of performance measurements.
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "bin rx frame",
+    "bin rx crc err",
+    "bin rx timeout",
+    "bin rx bad args",
+};
+
+// Number of benchmark format cases (see bench_format()).
+#define BENCH_NUM_CASES 5
+
+#if CONFIG_CONSOLE_FMT_BENCH
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "fmt-bench",
+        .func = cmd_console_fmt_bench,
+        .help = "Compare fmt with vsnprintf, usage: console fmt-bench "
+                "[iterations]",
+    },
+};
+
+#endif
+
+// Data structure passed to cmd module for console interaction.
+static struct cmd_client_info cmd_info = {
+    .name = "console",
+#if CONFIG_CONSOLE_FMT_BENCH
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+#else
+    .num_cmds = 0,
+    .cmds = NULL,
+#endif
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
+#if CONFIG_BENCH_PRESENT
+// Data structure passed to bench module.
+static const struct bench_info benches[] = {
+    {
+        .name = "fmt",
+        .func = bench_fmt,
+        .dflt_num_ops = 10000,
+    },
+    {
+        .name = "snprintf",
+        .func = bench_snprintf,
+        .dflt_num_ops = 10000,
+    },
+};
+
+static const struct bench_client_info bench_info = {
+    .name = "console",
+    .num_benches = ARRAY_SIZE(benches),
+    .benches = benches,
+};
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -137,6 +335,33 @@ int32_t console_init(struct console_cfg* cfg)
     return 0;
 }
 
+/*
+ * @brief Start console module instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function starts the console singleton module, to enter normal
+ * operation.
+ */
+int32_t console_start(void)
+{
+    int32_t rc;
+
+    rc = cmd_register(&cmd_info);
+    if (rc < 0) {
+        log_error("console_start: cmd error %d\n", rc);
+        return rc;
+    }
+#if CONFIG_BENCH_PRESENT
+    rc = bench_register(&bench_info);
+    if (rc < 0) {
+        log_error("console_start: bench error %d\n", rc);
+        return rc;
+    }
+#endif
+    return 0;
+}
+
 /*
  * @brief Run console instance.
  *
@@ -154,20 +379,54 @@ int32_t console_run(void)
         printc("%s", PROMPT);
     }
 
-    if (state.data_print_bytes_left > 0 && console_tx_idle() == 1) {
-        uint32_t line_byte_ctr = 0;
+    if (state.bin_rx_state != BIN_RX_IDLE &&
+        tmr_get_ms() - state.bin_rx_start_ms > CONFIG_CONSOLE_BIN_TMO_MS) {
+        INC_SAT_U16(cnts_u16[CNT_BIN_RX_TMO]);
+        state.bin_rx_state = BIN_RX_IDLE;
+    }
 
-        // We always print exactly one line.
-        printc("%08lx: ", state.data_print_offset);
+    // Data print output is sent as long as there is space for it in the ttys
+    // buffer, so it keeps up with the line rate without ever blocking.
+    if (state.data_print_bytes_left > 0 && state.data_print_bin) {
+        uint8_t* frame = state.bin_out_buf;
+        uint32_t len;
 
-        while (state.data_print_bytes_left > 0) {
-            printc("%02x", *((uint8_t*)state.data_print_ptr++));
-            state.data_print_bytes_left--;            
-            state.data_print_offset++;
-            if (++line_byte_ctr == DATA_PRINT_BYTES_PER_LINE)
-                break;
+        while (state.data_print_bytes_left > 0 &&
+               console_tx_space() >= BIN_FRAME_OVERHEAD + BIN_MAX_PAYLOAD) {
+            len = state.data_print_bytes_left;
+            if (len > BIN_MAX_PAYLOAD - BIN_DATA_HDR_SIZE)
+                len = BIN_MAX_PAYLOAD - BIN_DATA_HDR_SIZE;
+            frame[BIN_OUT_HDR_SIZE] = 'D';
+            put_u32(&frame[BIN_OUT_HDR_SIZE + 1], state.data_print_offset);
+            memcpy(&frame[BIN_OUT_HDR_SIZE + BIN_DATA_HDR_SIZE],
+                   state.data_print_ptr, len);
+            bin_send(frame, BIN_DATA_HDR_SIZE + len);
+            state.data_print_ptr += len;
+            state.data_print_offset += len;
+            state.data_print_bytes_left -= len;
+        }
+        return 0;
+    }
+
+    if (state.data_print_bytes_left > 0) {
+        char line[DATA_PRINT_LINE_SIZE];
+        uint32_t line_len;
+        uint32_t len;
+
+        // Each line becomes at most DATA_PRINT_LINE_SIZE chars plus a CR.
+        while (state.data_print_bytes_left > 0 &&
+               console_tx_space() >= DATA_PRINT_LINE_SIZE + 1) {
+            len = state.data_print_bytes_left;
+            if (len > DATA_PRINT_BYTES_PER_LINE)
+                len = DATA_PRINT_BYTES_PER_LINE;
+            line_len = data_line_format(line, state.data_print_offset,
+                                        state.data_print_ptr, len);
+            line[line_len++] = '\n';
+            console_write(line, line_len);
+            state.data_print_ptr += len;
+            state.data_print_offset += len;
+            state.data_print_bytes_left -= len;
         }
-        printc("\n");
         if (state.data_print_bytes_left == 0)
             printc("%s", PROMPT);
         return 0;
@@ -175,6 +434,18 @@ int32_t console_run(void)
 
     while (ttys_getc(state.cfg.ttys_instance_id, &c)) {
 
+        // Handle binary frames, which can only start at the beginning of a
+        // line.
+        if (state.bin_rx_state != BIN_RX_IDLE) {
+            bin_rx((uint8_t)c);
+            continue;
+        }
+        if (c == CONSOLE_BIN_SOF && state.num_cmd_bfr_chars == 0) {
+            state.bin_rx_state = BIN_RX_LEN;
+            state.bin_rx_start_ms = tmr_get_ms();
+            continue;
+        }
+
         // Handle processing completed command line.
         if (c == '\n' || c == '\r') {
             state.cmd_bfr[state.num_cmd_bfr_chars] = '\0';
@@ -233,12 +504,26 @@ int32_t console_data_print(uint8_t* data_ptr, uint32_t num_bytes)
     if (state.data_print_bytes_left != 0)
         return MOD_ERR_BUSY;
 
+    state.data_print_bin = state.bin_exec;
     state.data_print_bytes_left = num_bytes;
     state.data_print_offset = 0;
     state.data_print_ptr = data_ptr;
     return 0;
 }
 
+/*
+ * @brief Check if a binary command is being executed.
+ *
+ * @return true if the current command came in a binary frame, else false.
+ *
+ * Command functions with large outputs can use this to choose a raw binary
+ * output (see console_data_print()) over formatted text.
+ */
+bool console_bin_active(void)
+{
+    return state.bin_exec;
+}
+
 /*
  * @brief Emit prompt.
  */
@@ -257,22 +542,11 @@ void console_emit_prompt(void)
 int printc(const char* fmt, ...)
 {
     va_list args;
-    char buf[CONFIG_CONSOLE_PRINT_BUF_SIZE];
     int rc;
-    int idx;
 
     va_start(args, fmt);
-    rc = vsnprintf(buf, CONFIG_CONSOLE_PRINT_BUF_SIZE, fmt, args);
+    rc = fmt_vformat(console_out, NULL, fmt, args);
     va_end(args);
-    for (idx = 0; idx < rc; idx++) {
-        ttys_putc(state.cfg.ttys_instance_id, buf[idx]);
-        if (buf[idx] == '\0')
-            break;
-        if (buf[idx] == '\n') 
-            ttys_putc(state.cfg.ttys_instance_id, '\r');
-    }
-    if (rc >= CONFIG_CONSOLE_PRINT_BUF_SIZE)
-        printc("[!]\n");
     return rc;
 }
 
@@ -286,21 +560,7 @@ int printc(const char* fmt, ...)
  */
 int vprintc(const char* fmt, va_list args)
 {
-    char buf[CONFIG_CONSOLE_PRINT_BUF_SIZE];
-    int rc;
-    int idx;
-
-    rc = vsnprintf(buf, CONFIG_CONSOLE_PRINT_BUF_SIZE, fmt, args);
-    for (idx = 0; idx < rc; idx++) {
-        ttys_putc(state.cfg.ttys_instance_id, buf[idx]);
-        if (buf[idx] == '\0')
-            break;
-        if (buf[idx] == '\n') 
-            ttys_putc(state.cfg.ttys_instance_id, '\r');
-    }
-    if (rc >= CONFIG_CONSOLE_PRINT_BUF_SIZE)
-        printc("[!]\n");
-    return rc;
+    return fmt_vformat(console_out, NULL, fmt, args);
 }
 
 void printc_float(const char* prefix, float f, uint32_t max_frac_width,
@@ -340,6 +600,19 @@ int32_t console_tx_idle(void)
     return ttys_tx_idle(state.cfg.ttys_instance_id);
 }
 
+/*
+ * @brief Get the free space in the transmit buffer.
+ *
+ * @return Number of chars that can be written without overrun, else a
+ *         "MOD_ERR" value (<0).
+ *
+ * Note that each '\n' written with printc() takes two chars (a CR is added).
+ */
+int32_t console_tx_space(void)
+{
+    return ttys_tx_space(state.cfg.ttys_instance_id);
+}
+
 #if CONFIG_FAULT_PRESENT
 
 /*
@@ -355,27 +628,484 @@ int32_t console_tx_idle(void)
 int printc_panic(const char* fmt, ...)
 {
     va_list args;
-    char buf[CONFIG_CONSOLE_PRINT_BUF_SIZE];
     int rc;
-    int idx;
 
     va_start(args, fmt);
-    rc = vsnprintf(buf, CONFIG_CONSOLE_PRINT_BUF_SIZE, fmt, args);
+    rc = fmt_vformat(console_out_panic, NULL, fmt, args);
     va_end(args);
-    for (idx = 0; idx < rc; idx++) {
-        ttys_putc_panic(state.cfg.ttys_instance_id, buf[idx]);
-        if (buf[idx] == '\0')
-            break;
-        if (buf[idx] == '\n') 
-            ttys_putc_panic(state.cfg.ttys_instance_id, '\r');
-    }
-    if (rc >= CONFIG_CONSOLE_PRINT_BUF_SIZE)
-        printc_panic("[!]\n");
     return rc;
 }
 
+/*
+ * @brief Print data in hex, in panic mode.
+ *
+ * @param[in] offset The offset printed for the first byte.
+ * @param[in] data The data.
+ * @param[in] num_bytes Number of data bytes.
+ *
+ * The output has the same format as console_data_print(). Each line is hex
+ * encoded with a lookup table, and written to ttys with one call, avoiding
+ * vsnprintf() and a ttys call per byte.
+ */
+void console_data_print_panic(uint32_t offset, const uint8_t* data,
+                              uint32_t num_bytes)
+{
+    char line[DATA_PRINT_LINE_SIZE + 1];
+    uint32_t line_bytes;
+    uint32_t len;
+
+    while (num_bytes > 0) {
+        line_bytes = num_bytes;
+        if (line_bytes > DATA_PRINT_BYTES_PER_LINE)
+            line_bytes = DATA_PRINT_BYTES_PER_LINE;
+        len = data_line_format(line, offset, data, line_bytes);
+        line[len++] = '\n';
+        line[len++] = '\r';
+        ttys_write_panic(state.cfg.ttys_instance_id, line, len);
+        offset += line_bytes;
+        data += line_bytes;
+        num_bytes -= line_bytes;
+    }
+}
+
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Write formatted output to the console ttys.
+ *
+ * @param[in] buf Formatted output.
+ * @param[in] len Number of characters.
+ *
+ * The output is passed to ttys in blocks, each ending with a newline, and a CR
+ * is added after each newline. Output is stopped at an embedded NUL (e.g. from
+ * "%c").
+ */
+static void console_write(const char* buf, int len)
+{
+    int idx;
+    int seg_start = 0;
+
+    // While executing a binary command, output from the super loop is
+    // collected into 'O' reply frames. Output from interrupt handlers (e.g.
+    // logging) is passed on as text, which the host skips.
+    if (state.bin_exec && __get_IPSR() == 0) {
+        for (idx = 0; idx < len && buf[idx] != '\0'; idx++) {
+            if (state.bin_out_len == 0)
+                state.bin_out_buf[BIN_OUT_HDR_SIZE + state.bin_out_len++] = 'O';
+            state.bin_out_buf[BIN_OUT_HDR_SIZE + state.bin_out_len++] = buf[idx];
+            if (state.bin_out_len == BIN_MAX_PAYLOAD)
+                bin_out_flush();
+        }
+        return;
+    }
+
+    for (idx = 0; idx < len; idx++) {
+        if (buf[idx] == '\0')
+            break;
+        if (buf[idx] == '\n') {
+            ttys_write(state.cfg.ttys_instance_id, &buf[seg_start],
+                       idx + 1 - seg_start);
+            ttys_write(state.cfg.ttys_instance_id, "\r", 1);
+            seg_start = idx + 1;
+        }
+    }
+    if (idx > seg_start)
+        ttys_write(state.cfg.ttys_instance_id, &buf[seg_start],
+                   idx - seg_start);
+}
+
+/*
+ * @brief Output function for fmt, for printc() and vprintc().
+ *
+ * @param[in] out_arg Not used.
+ * @param[in] s The characters.
+ * @param[in] len Number of characters.
+ */
+static void console_out(void* out_arg, const char* s, uint32_t len)
+{
+    console_write(s, len);
+}
+
+#if CONFIG_FAULT_PRESENT
+
+/*
+ * @brief Output function for fmt, for printc_panic().
+ *
+ * @param[in] out_arg Not used.
+ * @param[in] s The characters.
+ * @param[in] len Number of characters.
+ *
+ * As console_write(), but using the "panic" version of ttys_write().
+ */
+static void console_out_panic(void* out_arg, const char* s, uint32_t len)
+{
+    uint32_t idx;
+    uint32_t seg_start = 0;
+
+    for (idx = 0; idx < len && s[idx] != '\0'; idx++) {
+        if (s[idx] == '\n') {
+            ttys_write_panic(state.cfg.ttys_instance_id, &s[seg_start],
+                             idx + 1 - seg_start);
+            ttys_putc_panic(state.cfg.ttys_instance_id, '\r');
+            seg_start = idx + 1;
+        }
+    }
+    if (idx > seg_start)
+        ttys_write_panic(state.cfg.ttys_instance_id, &s[seg_start],
+                         idx - seg_start);
+}
+
+#endif
+
+/*
+ * @brief Format a line of data print output.
+ *
+ * @param[out] line Where to put the line (at least DATA_PRINT_LINE_SIZE).
+ * @param[in] offset The offset printed for the first byte.
+ * @param[in] data The data.
+ * @param[in] num_bytes Number of data bytes (max DATA_PRINT_BYTES_PER_LINE).
+ *
+ * @return Length of the line, which is not terminated.
+ *
+ * The hex is encoded with a lookup table, as vsnprintf() per byte is slow.
+ */
+static uint32_t data_line_format(char* line, uint32_t offset,
+                                 const uint8_t* data, uint32_t num_bytes)
+{
+    uint32_t len = 0;
+    int idx;
+
+    for (idx = 28; idx >= 0; idx -= 4)
+        line[len++] = hex_digits[(offset >> idx) & 0xf];
+    line[len++] = ':';
+    line[len++] = ' ';
+    while (num_bytes-- > 0) {
+        line[len++] = hex_digits[*data >> 4];
+        line[len++] = hex_digits[*data++ & 0xf];
+    }
+    return len;
+}
+
+/*
+ * @brief Process a received binary frame byte.
+ *
+ * @param[in] c The received byte.
+ */
+static void bin_rx(uint8_t c)
+{
+    switch (state.bin_rx_state) {
+        case BIN_RX_LEN:
+            if (c == 0 || c > BIN_MAX_PAYLOAD) {
+                INC_SAT_U16(cnts_u16[CNT_BIN_RX_BAD_ARGS]);
+                state.bin_rx_state = BIN_RX_IDLE;
+                break;
+            }
+            state.bin_rx_len = c;
+            state.bin_rx_cnt = 0;
+            state.bin_rx_crc = crc16_update(CRC16_INIT, &c, 1);
+            state.bin_rx_state = BIN_RX_SEQ;
+            break;
+        case BIN_RX_SEQ:
+            state.bin_seq = c;
+            state.bin_rx_crc = crc16_update(state.bin_rx_crc, &c, 1);
+            state.bin_rx_state = BIN_RX_PAYLOAD;
+            break;
+        case BIN_RX_PAYLOAD:
+            state.bin_rx_buf[state.bin_rx_cnt++] = c;
+            if (state.bin_rx_cnt == state.bin_rx_len) {
+                state.bin_rx_crc = crc16_update(state.bin_rx_crc,
+                                                state.bin_rx_buf,
+                                                state.bin_rx_len);
+                state.bin_rx_state = BIN_RX_CRC_LSB;
+            }
+            break;
+        case BIN_RX_CRC_LSB:
+            if (c != (state.bin_rx_crc & 0xff)) {
+                INC_SAT_U16(cnts_u16[CNT_BIN_RX_CRC_ERR]);
+                state.bin_rx_state = BIN_RX_IDLE;
+                break;
+            }
+            state.bin_rx_state = BIN_RX_CRC_MSB;
+            break;
+        case BIN_RX_CRC_MSB:
+            state.bin_rx_state = BIN_RX_IDLE;
+            if (c != (state.bin_rx_crc >> 8)) {
+                INC_SAT_U16(cnts_u16[CNT_BIN_RX_CRC_ERR]);
+                break;
+            }
+            INC_SAT_U16(cnts_u16[CNT_BIN_RX_FRAME]);
+            bin_execute();
+            break;
+        default:
+            state.bin_rx_state = BIN_RX_IDLE;
+            break;
+    }
+}
+
+/*
+ * @brief Decode the arguments of a binary frame and execute the command.
+ *
+ * String arguments are copied to a NUL terminated string. Numeric arguments
+ * are passed to the command function as a CMD_BIN_ARG_MARK character, the type
+ * code, and the 4 value bytes, which cmd_parse_args() recognizes.
+ */
+static void bin_execute(void)
+{
+    // Each decoded argument is at most one byte longer than when encoded.
+    char args[BIN_MAX_PAYLOAD + BIN_MAX_ARGS];
+    const char* argv[BIN_MAX_ARGS];
+    int32_t argc = 0;
+    uint32_t in_idx = 0;
+    uint32_t out_idx = 0;
+    uint32_t len;
+    uint8_t* frame = state.bin_out_buf;
+    int32_t rc = 0;
+
+    while (in_idx < state.bin_rx_len) {
+        uint8_t type = state.bin_rx_buf[in_idx++];
+
+        if (argc >= BIN_MAX_ARGS) {
+            rc = MOD_ERR_BAD_CMD;
+            break;
+        }
+        argv[argc++] = &args[out_idx];
+        if (type == 's') {
+            if (in_idx >= state.bin_rx_len) {
+                rc = MOD_ERR_BAD_CMD;
+                break;
+            }
+            len = state.bin_rx_buf[in_idx++];
+            // A string starting with the mark would be taken for a binary
+            // numeric argument.
+            if (len > 0 && in_idx < state.bin_rx_len &&
+                state.bin_rx_buf[in_idx] == CMD_BIN_ARG_MARK) {
+                rc = MOD_ERR_BAD_CMD;
+                break;
+            }
+        } else if (type == 'i' || type == 'u' || type == 'p' || type == 'f') {
+            args[out_idx++] = CMD_BIN_ARG_MARK;
+            args[out_idx++] = type;
+            len = 4;
+        } else {
+            rc = MOD_ERR_BAD_CMD;
+            break;
+        }
+        if (len > state.bin_rx_len - in_idx) {
+            rc = MOD_ERR_BAD_CMD;
+            break;
+        }
+        memcpy(&args[out_idx], &state.bin_rx_buf[in_idx], len);
+        in_idx += len;
+        out_idx += len;
+        if (type == 's')
+            args[out_idx++] = '\0';
+    }
+
+    if (rc == 0 && (argc < 1 || *argv[0] == CMD_BIN_ARG_MARK))
+        rc = MOD_ERR_BAD_CMD;
+
+    if (rc == 0) {
+        state.bin_exec = true;
+        state.bin_out_len = 0;
+        rc = cmd_execute_argv(argc, argv);
+        bin_out_flush();
+        state.bin_exec = false;
+    } else {
+        INC_SAT_U16(cnts_u16[CNT_BIN_RX_BAD_ARGS]);
+    }
+
+    frame[BIN_OUT_HDR_SIZE] = 'R';
+    put_u32(&frame[BIN_OUT_HDR_SIZE + 1], (uint32_t)rc);
+    put_u32(&frame[BIN_OUT_HDR_SIZE + 5],
+            state.data_print_bin ? state.data_print_bytes_left : 0);
+    bin_send(frame, 9);
+}
+
+/*
+ * @brief Send any collected binary command output as an 'O' frame.
+ */
+static void bin_out_flush(void)
+{
+    if (state.bin_out_len > 0) {
+        bin_send(state.bin_out_buf, state.bin_out_len);
+        state.bin_out_len = 0;
+    }
+}
+
+/*
+ * @brief Add framing to a reply payload and send it.
+ *
+ * @param[in] frame Frame buffer, with the payload at offset BIN_OUT_HDR_SIZE,
+ *                  and 2 bytes of space after the payload.
+ * @param[in] payload_len Length of the payload.
+ */
+static void bin_send(uint8_t* frame, uint32_t payload_len)
+{
+    uint16_t crc;
+
+    frame[0] = CONSOLE_BIN_SOF;
+    frame[1] = payload_len;
+    frame[2] = state.bin_seq;
+    crc = crc16_update(CRC16_INIT, &frame[1], payload_len + 2);
+    frame[BIN_OUT_HDR_SIZE + payload_len] = crc & 0xff;
+    frame[BIN_OUT_HDR_SIZE + payload_len + 1] = crc >> 8;
+    ttys_write(state.cfg.ttys_instance_id, (const char*)frame,
+               payload_len + BIN_FRAME_OVERHEAD);
+}
+
+/*
+ * @brief Store a 32-bit value little endian.
+ *
+ * @param[out] p Where to store the value.
+ * @param[in] val The value.
+ */
+static void put_u32(uint8_t* p, uint32_t val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+}
+
+#if CONFIG_CONSOLE_FMT_BENCH || CONFIG_BENCH_PRESENT
+
+/*
+ * @brief Format one of the benchmark cases.
+ *
+ * @param[in] use_fmt True to use fmt, false to use snprintf().
+ * @param[out] buf Output buffer.
+ * @param[in] size Size of output buffer.
+ * @param[in] case_idx Which case (< BENCH_NUM_CASES).
+ *
+ * @return Output length as in snprintf().
+ *
+ * The cases are typical of the formats used by the modules.
+ */
+static int bench_format(bool use_fmt, char* buf, uint32_t size,
+                        uint32_t case_idx)
+{
+#define BENCH_PRINT(...) (use_fmt ? fmt_snprintf(buf, size, __VA_ARGS__) : \
+                          snprintf(buf, size, __VA_ARGS__))
+
+    switch (case_idx) {
+        case 0:
+            return BENCH_PRINT("%lu.%03lu INFO %s: %d\n", 123456UL, 789UL,
+                               "tmphm", -42);
+        case 1:
+            return BENCH_PRINT("%08lx: %02x %02x %02x %02x %02x %02x %02x %02x",
+                               0x20001000UL, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc,
+                               0xde, 0xf0);
+        case 2:
+            return BENCH_PRINT("%-12s %10lu %7ld %5u %c", "bench", 4000000000UL,
+                               -123456L, 65535, 'x');
+        case 3:
+            return BENCH_PRINT("%s", "A plain string without conversions.");
+        case 4:
+            return BENCH_PRINT("T=%.2f H=%.1f", 23.456, 45.5);
+        default:
+            return 0;
+    }
+
+#undef BENCH_PRINT
+}
+
+#endif
+
+#if CONFIG_BENCH_PRESENT
+
+/*
+ * @brief Benchmark for fmt formatting (as used by printc()).
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 (always).
+ *
+ * Each operation formats one of the benchmark cases into a buffer, cycling
+ * through the cases.
+ */
+static int32_t bench_fmt(uint32_t num_ops)
+{
+    char bfr[80];
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++)
+        bench_format(true, bfr, sizeof(bfr), idx % BENCH_NUM_CASES);
+    return 0;
+}
+
+/*
+ * @brief Benchmark for snprintf() formatting, for comparison with fmt.
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 (always).
+ */
+static int32_t bench_snprintf(uint32_t num_ops)
+{
+    char bfr[80];
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++)
+        bench_format(false, bfr, sizeof(bfr), idx % BENCH_NUM_CASES);
+    return 0;
+}
+
+#endif
+
+#if CONFIG_CONSOLE_FMT_BENCH
+
+/*
+ * @brief Console command function for "console fmt-bench".
+ *
+ * @param[in] argc Number of arguments, including "console".
+ * @param[in] argv Argument values, including "console".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: console fmt-bench [iterations]
+ *
+ * Each case is formatted into a buffer, with fmt and with snprintf(), and the
+ * average time per call is reported, along with whether the outputs match.
+ */
+static int32_t cmd_console_fmt_bench(int32_t argc, const char** argv)
+{
+    int32_t num_args;
+    struct cmd_arg_val arg_vals[1];
+    uint32_t iterations = 1000;
+    uint32_t case_idx;
+    uint32_t idx;
+    uint32_t start_cyc;
+    uint32_t cyc[2];
+    char bfr[2][80];
+    int side;
+
+    num_args = cmd_parse_args(argc-2, argv+2, "[u", arg_vals);
+    if (num_args < 0)
+        return num_args;
+    if (num_args > 0)
+        iterations = arg_vals[0].val.u;
+    if (iterations == 0)
+        return MOD_ERR_ARG;
+
+    printc("Case fmt ns   snprintf ns Match\n"
+           "---- -------- ----------- -----\n");
+    for (case_idx = 0; case_idx < BENCH_NUM_CASES; case_idx++) {
+        for (side = 0; side < 2; side++) {
+            start_cyc = stat_cyc_get();
+            for (idx = 0; idx < iterations; idx++)
+                bench_format(side == 0, bfr[side], sizeof(bfr[side]),
+                             case_idx);
+            cyc[side] = (stat_cyc_get() - start_cyc) / iterations;
+        }
+        printc("%4lu %8lu %11lu %s\n", case_idx, stat_cyc_to_ns(cyc[0]),
+               stat_cyc_to_ns(cyc[1]),
+               strcmp(bfr[0], bfr[1]) == 0 ? "yes" : "no");
+    }
+    return 0;
+}
+
+#endif
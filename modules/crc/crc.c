@@ -0,0 +1,369 @@
+/*
+ * @brief Implementation of crc utility.
+ *
+ * This utility provides the CRCs used by other modules:
+ * - CRC-8 as used by Sensirion sensors (e.g. SHT3x): polynomial 0x31,
+ *   initial value 0xff, no reflection, no final XOR. Example: 0xbeef => 0x92.
+ * - CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xffff, no
+ *   reflection, no final XOR. Example: "123456789" => 0x29b1.
+ * - CRC-32 as in IEEE 802.3 (zlib, etc): polynomial 0x04c11db7, reflected,
+ *   initial value 0xffffffff, final XOR 0xffffffff. Example: "123456789" =>
+ *   0xcbf43926.
+ *
+ * Each has an *_update() function taking a running CRC value, so streaming
+ * data can be processed as it arrives. For CRC-32 the running value does not
+ * include the final XOR, which the caller applies at the end (crc32() does it
+ * all in one call).
+ *
+ * CRC-8 and CRC-16 use 256-entry tables, one lookup per byte.
+ *
+ * CRC-32 uses the MCU CRC peripheral, if present (see CONFIG_CRC_TYPE), for
+ * the whole 32-bit words of the data, and a 16-entry table (one nibble at a
+ * time) for the remaining bytes, or for all of the data if there is no CRC
+ * peripheral. The peripheral is used in its default configuration,
+ * non-reflected polynomial 0x04c11db7 with 32-bit input, which all the
+ * supported MCUs have. The reflected CRC is obtained by bit reversing the
+ * input words and the result, and the running value is loaded by folding it
+ * into the first word written after a reset. The peripheral is shared, so it
+ * is used with interrupts disabled, in chunks of CRC_HW_CHUNK_WORDS to bound
+ * the interrupt latency.
+ *
+ * There is no state other than the peripheral, and no initialization is
+ * needed, so this utility can be used anywhere, including interrupt handlers
+ * and before modules are initialized.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_BUS_HDR
+
+#include "crc.h"
+#include "module.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+// Below this many bytes, CRC-32 software is cheaper than setting up the
+// peripheral.
+#define CRC_HW_MIN_BYTES 16
+
+// Number of words processed by the peripheral per critical section.
+#define CRC_HW_CHUNK_WORDS 64
+
+#define CRC_HW_RESET_VALUE 0xffffffff
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t crc32_sw(uint32_t crc, const uint8_t* data, uint32_t len);
+#if CONFIG_CRC_TYPE == 1 || CONFIG_CRC_TYPE == 2
+static uint32_t crc32_hw(uint32_t crc, const uint8_t* data,
+                         uint32_t num_words);
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+// Table for crc8_update(), for the polynomial 0x31.
+static const uint8_t crc8_table[256] = {
+    0x00, 0x31, 0x62, 0x53, 0xc4, 0xf5, 0xa6, 0x97,
+    0xb9, 0x88, 0xdb, 0xea, 0x7d, 0x4c, 0x1f, 0x2e,
+    0x43, 0x72, 0x21, 0x10, 0x87, 0xb6, 0xe5, 0xd4,
+    0xfa, 0xcb, 0x98, 0xa9, 0x3e, 0x0f, 0x5c, 0x6d,
+    0x86, 0xb7, 0xe4, 0xd5, 0x42, 0x73, 0x20, 0x11,
+    0x3f, 0x0e, 0x5d, 0x6c, 0xfb, 0xca, 0x99, 0xa8,
+    0xc5, 0xf4, 0xa7, 0x96, 0x01, 0x30, 0x63, 0x52,
+    0x7c, 0x4d, 0x1e, 0x2f, 0xb8, 0x89, 0xda, 0xeb,
+    0x3d, 0x0c, 0x5f, 0x6e, 0xf9, 0xc8, 0x9b, 0xaa,
+    0x84, 0xb5, 0xe6, 0xd7, 0x40, 0x71, 0x22, 0x13,
+    0x7e, 0x4f, 0x1c, 0x2d, 0xba, 0x8b, 0xd8, 0xe9,
+    0xc7, 0xf6, 0xa5, 0x94, 0x03, 0x32, 0x61, 0x50,
+    0xbb, 0x8a, 0xd9, 0xe8, 0x7f, 0x4e, 0x1d, 0x2c,
+    0x02, 0x33, 0x60, 0x51, 0xc6, 0xf7, 0xa4, 0x95,
+    0xf8, 0xc9, 0x9a, 0xab, 0x3c, 0x0d, 0x5e, 0x6f,
+    0x41, 0x70, 0x23, 0x12, 0x85, 0xb4, 0xe7, 0xd6,
+    0x7a, 0x4b, 0x18, 0x29, 0xbe, 0x8f, 0xdc, 0xed,
+    0xc3, 0xf2, 0xa1, 0x90, 0x07, 0x36, 0x65, 0x54,
+    0x39, 0x08, 0x5b, 0x6a, 0xfd, 0xcc, 0x9f, 0xae,
+    0x80, 0xb1, 0xe2, 0xd3, 0x44, 0x75, 0x26, 0x17,
+    0xfc, 0xcd, 0x9e, 0xaf, 0x38, 0x09, 0x5a, 0x6b,
+    0x45, 0x74, 0x27, 0x16, 0x81, 0xb0, 0xe3, 0xd2,
+    0xbf, 0x8e, 0xdd, 0xec, 0x7b, 0x4a, 0x19, 0x28,
+    0x06, 0x37, 0x64, 0x55, 0xc2, 0xf3, 0xa0, 0x91,
+    0x47, 0x76, 0x25, 0x14, 0x83, 0xb2, 0xe1, 0xd0,
+    0xfe, 0xcf, 0x9c, 0xad, 0x3a, 0x0b, 0x58, 0x69,
+    0x04, 0x35, 0x66, 0x57, 0xc0, 0xf1, 0xa2, 0x93,
+    0xbd, 0x8c, 0xdf, 0xee, 0x79, 0x48, 0x1b, 0x2a,
+    0xc1, 0xf0, 0xa3, 0x92, 0x05, 0x34, 0x67, 0x56,
+    0x78, 0x49, 0x1a, 0x2b, 0xbc, 0x8d, 0xde, 0xef,
+    0x82, 0xb3, 0xe0, 0xd1, 0x46, 0x77, 0x24, 0x15,
+    0x3b, 0x0a, 0x59, 0x68, 0xff, 0xce, 0x9d, 0xac,
+};
+
+// Table for crc16_update(), for the polynomial 0x1021.
+static const uint16_t crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+// Table for crc32_sw(), for the reflected polynomial 0xedb88320.
+static const uint32_t crc32_table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+#if CONFIG_CRC_TYPE == 1 || CONFIG_CRC_TYPE == 2
+static bool hw_clock_enabled;
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Update a CRC-8 (Sensirion).
+ *
+ * @param[in] crc The running CRC value (CRC8_INIT to start).
+ * @param[in] data The data.
+ * @param[in] len Length of the data.
+ *
+ * @return The updated CRC value.
+ */
+uint8_t crc8_update(uint8_t crc, const void* data, uint32_t len)
+{
+    const uint8_t* p = data;
+
+    while (len-- > 0)
+        crc = crc8_table[crc ^ *p++];
+    return crc;
+}
+
+/*
+ * @brief Update a CRC-16/CCITT-FALSE.
+ *
+ * @param[in] crc The running CRC value (CRC16_INIT to start).
+ * @param[in] data The data.
+ * @param[in] len Length of the data.
+ *
+ * @return The updated CRC value.
+ */
+uint16_t crc16_update(uint16_t crc, const void* data, uint32_t len)
+{
+    const uint8_t* p = data;
+
+    while (len-- > 0)
+        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *p++];
+    return crc;
+}
+
+/*
+ * @brief Update a CRC-32 (IEEE 802.3, reflected).
+ *
+ * @param[in] crc The running CRC value (CRC32_INIT to start).
+ * @param[in] data The data.
+ * @param[in] len Length of the data.
+ *
+ * @return The updated CRC value, without the final XOR.
+ */
+uint32_t crc32_update(uint32_t crc, const void* data, uint32_t len)
+{
+    const uint8_t* p = data;
+
+#if CONFIG_CRC_TYPE == 1 || CONFIG_CRC_TYPE == 2
+    if (len >= CRC_HW_MIN_BYTES) {
+        uint32_t num_words = len / 4;
+        crc = crc32_hw(crc, p, num_words);
+        p += num_words * 4;
+        len -= num_words * 4;
+    }
+#endif
+    return crc32_sw(crc, p, len);
+}
+
+/*
+ * @brief Calculate a CRC-8 (Sensirion).
+ *
+ * @param[in] data The data.
+ * @param[in] len Length of the data.
+ *
+ * @return The CRC.
+ */
+uint8_t crc8(const void* data, uint32_t len)
+{
+    return crc8_update(CRC8_INIT, data, len);
+}
+
+/*
+ * @brief Calculate a CRC-16/CCITT-FALSE.
+ *
+ * @param[in] data The data.
+ * @param[in] len Length of the data.
+ *
+ * @return The CRC.
+ */
+uint16_t crc16(const void* data, uint32_t len)
+{
+    return crc16_update(CRC16_INIT, data, len);
+}
+
+/*
+ * @brief Calculate a CRC-32 (IEEE 802.3).
+ *
+ * @param[in] data The data.
+ * @param[in] len Length of the data.
+ *
+ * @return The CRC, including the final XOR.
+ */
+uint32_t crc32(const void* data, uint32_t len)
+{
+    return ~crc32_update(CRC32_INIT, data, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Update a CRC-32 in software.
+ *
+ * @param[in] crc The running CRC value.
+ * @param[in] data The data.
+ * @param[in] len Length of the data.
+ *
+ * @return The updated CRC value.
+ */
+static uint32_t crc32_sw(uint32_t crc, const uint8_t* data, uint32_t len)
+{
+    while (len-- > 0) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ crc32_table[crc & 0xf];
+        crc = (crc >> 4) ^ crc32_table[crc & 0xf];
+    }
+    return crc;
+}
+
+#if CONFIG_CRC_TYPE == 1 || CONFIG_CRC_TYPE == 2
+
+/*
+ * @brief Update a CRC-32 using the CRC peripheral.
+ *
+ * @param[in] crc The running CRC value.
+ * @param[in] data The data (any alignment).
+ * @param[in] num_words Number of 32-bit (little endian) words of data.
+ *
+ * @return The updated CRC value.
+ *
+ * The peripheral computes CRC = F(CRC ^ DR) for each word written, MSB first.
+ * The reflected CRC of a little endian word is the same computation on the
+ * bit reversed values. After a reset the peripheral CRC is all ones, so the
+ * running value is loaded by XORing it (and the reset value) into the first
+ * word written.
+ */
+static uint32_t crc32_hw(uint32_t crc, const uint8_t* data,
+                         uint32_t num_words)
+{
+    uint32_t chunk;
+    uint32_t word;
+    CRIT_STATE_VAR;
+
+    while (num_words > 0) {
+        chunk = num_words < CRC_HW_CHUNK_WORDS ? num_words :
+            CRC_HW_CHUNK_WORDS;
+        num_words -= chunk;
+
+        CRIT_BEGIN_NEST();
+        if (!hw_clock_enabled) {
+            LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_CRC);
+            hw_clock_enabled = true;
+        }
+#if CONFIG_CRC_TYPE == 2
+        // Programmable unit, make sure it is in the default configuration.
+        CRC->INIT = CRC_HW_RESET_VALUE;
+        CRC->POL = 0x04c11db7;
+        CRC->CR = CRC_CR_RESET;
+#else
+        CRC->CR = CRC_CR_RESET;
+#endif
+        memcpy(&word, data, sizeof(word));
+        CRC->DR = __RBIT(word) ^ __RBIT(crc) ^ CRC_HW_RESET_VALUE;
+        data += sizeof(word);
+        while (--chunk > 0) {
+            memcpy(&word, data, sizeof(word));
+            CRC->DR = __RBIT(word);
+            data += sizeof(word);
+        }
+        crc = __RBIT(CRC->DR);
+        CRIT_END_NEST();
+    }
+    return crc;
+}
+
+#endif // CONFIG_CRC_TYPE == 1 || CONFIG_CRC_TYPE == 2
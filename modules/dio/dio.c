@@ -21,10 +21,22 @@
  *    GPIOs is retained by this module (in other words, the hardware is
  *    configured and then forgotten). Thus there is no console support.
  *
+ * For the I/O defined at init time:
+ * - Groups of inputs or outputs can be read or written with one call (see
+ *   dio_group_init()). The pins are resolved to per-port masks up front, so
+ *   each port register is accessed once per call, and outputs on a port change
+ *   together with a single BSRR write.
+ * - Inputs can capture edges, using EXTI interrupts (see the "edge" field of
+ *   struct dio_in_info). Each edge is put in a ring with a timestamp, and is
+ *   read later with dio_edge_get(), so clients need not poll inputs. If the
+ *   ring is full, edges are dropped (and counted).
+ *
  * The following console commands are provided:
  * > dio status
  * > dio get
  * > dio set
+ * > dio edge
+ * > dio pm
  * See code for details.
  * 
  * MIT License
@@ -62,8 +74,10 @@
 #include "cmd.h"
 #include "console.h"
 #include "dio.h"
+#include "fault.h"
 #include "log.h"
 #include "module.h"
+#include "tmr.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
@@ -71,19 +85,51 @@
 
 #define MAX_PIN_NUM 15
 
+#define EDGE_RING_MASK (CONFIG_DIO_EDGE_RING_SIZE - 1)
+
+#if (CONFIG_DIO_EDGE_RING_SIZE & EDGE_RING_MASK) != 0
+    #error CONFIG_DIO_EDGE_RING_SIZE must be a power of 2
+#endif
+
+// EXTI registers. The U5 has separate rising/falling pending registers.
+#if CONFIG_DIO_TYPE == 1 || CONFIG_DIO_TYPE == 3
+    #define EXTI_RTSR (EXTI->RTSR)
+    #define EXTI_FTSR (EXTI->FTSR)
+    #define EXTI_IMR (EXTI->IMR)
+#else
+    #define EXTI_RTSR (EXTI->RTSR1)
+    #define EXTI_FTSR (EXTI->FTSR1)
+    #define EXTI_IMR (EXTI->IMR1)
+#endif
+
+// GPIO ports are this far apart in the address map, on all supported MCUs.
+#define GPIO_PORT_SPACING ((uint32_t)GPIOB - (uint32_t)GPIOA)
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+enum dio_u16_pms {
+    CNT_EDGE,
+    CNT_EDGE_OVERRUN,
+
+    NUM_U16_PMS
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
 static int32_t enable_gpio_port(dio_port* port);
+static uint32_t pin_to_mask(uint32_t pin);
+static int32_t edge_setup(void);
+static IRQn_Type exti_irq_type(uint32_t line);
+static void exti_interrupt(void);
 
 static int32_t cmd_dio_status(int32_t argc, const char** argv);
 static int32_t cmd_dio_get(int32_t argc, const char** argv);
 static int32_t cmd_dio_set(int32_t argc, const char** argv);
+static int32_t cmd_dio_edge(int32_t argc, const char** argv);
 
 static const char* gpio_pin_mode_to_str(uint32_t mode);
 static const char* gpio_output_type_to_str(uint32_t mode);
@@ -96,6 +142,24 @@ static const char* gpio_pull_to_str(uint32_t mode);
 
 static struct dio_cfg* cfg;
 
+// Edge capture ring. The EXTI interrupt handlers (all at the same priority)
+// are the only writers of edge_put_ctr, and dio_edge_get() the only writer of
+// edge_get_ctr. The counters are free running.
+static struct dio_edge_event edge_ring[CONFIG_DIO_EDGE_RING_SIZE];
+static volatile uint32_t edge_put_ctr;
+static volatile uint32_t edge_get_ctr;
+
+// Input index for each EXTI line (i.e. pin number), or -1 if not used.
+static int8_t exti_line_din_idx[DIO_NUM_PINS_PER_PORT];
+static uint32_t exti_lines_mask;
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "edge",
+    "edge overrun",
+};
+
 static struct cmd_cmd_info cmds[] = {
     {
         .name = "status",
@@ -113,6 +177,11 @@ static struct cmd_cmd_info cmds[] = {
         .help = "Set output value, usage: dio set <output-name> {0|1}\n"
                 "         or: dio set <port-letter> <pin-number> {0|1}\n",
     },
+    {
+        .name = "edge",
+        .func = cmd_dio_edge,
+        .help = "Read (and remove) captured edges, usage: dio edge",
+    },
 };
 
 static int32_t log_level = LOG_DEFAULT;
@@ -122,6 +191,9 @@ static struct cmd_client_info cmd_info = {
     .num_cmds = ARRAY_SIZE(cmds),
     .cmds = cmds,
     .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
 };
 
 // The follow array contains information about each GPIO port, used primarily to
@@ -346,6 +418,11 @@ int32_t dio_start(void)
         log_error("dio_start: cmd error %d\n", result);
         return result;
     }
+    result = edge_setup();
+    if (result < 0) {
+        log_error("dio_start: edge_setup error %d\n", result);
+        return result;
+    }
     return 0;
 }
 
@@ -428,6 +505,158 @@ int32_t dio_get_num_out(void)
     return cfg == NULL ? MOD_ERR_RESOURCE : cfg->num_outputs;
 }
 
+/*
+ * @brief Set up a group of inputs or outputs.
+ *
+ * @param[out] grp The group.
+ * @param[in] outputs True for a group of outputs, false for inputs.
+ * @param[in] idxs Input/output indexes per module configuration.
+ * @param[in] num_pins Number of entries in idxs (max DIO_GROUP_MAX_PINS).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The pins can be on at most DIO_GROUP_MAX_PORTS ports. This is normally
+ * called once, by a client's init or start function.
+ */
+int32_t dio_group_init(struct dio_group* grp, bool outputs,
+                       const uint32_t* idxs, uint32_t num_pins)
+{
+    uint32_t idx;
+    uint32_t port_idx;
+    dio_port* port;
+    uint32_t pin;
+    uint8_t invert;
+
+    if (grp == NULL || idxs == NULL || cfg == NULL ||
+        num_pins > DIO_GROUP_MAX_PINS)
+        return MOD_ERR_ARG;
+
+    memset(grp, 0, sizeof(*grp));
+    grp->outputs = outputs;
+    for (idx = 0; idx < num_pins; idx++) {
+        if (outputs) {
+            if (idxs[idx] >= cfg->num_outputs)
+                return MOD_ERR_ARG;
+            port = cfg->outputs[idxs[idx]].port;
+            pin = cfg->outputs[idxs[idx]].pin;
+            invert = cfg->outputs[idxs[idx]].invert;
+        } else {
+            if (idxs[idx] >= cfg->num_inputs)
+                return MOD_ERR_ARG;
+            port = cfg->inputs[idxs[idx]].port;
+            pin = cfg->inputs[idxs[idx]].pin;
+            invert = cfg->inputs[idxs[idx]].invert;
+        }
+        for (port_idx = 0; port_idx < grp->num_ports; port_idx++) {
+            if (grp->ports[port_idx] == port)
+                break;
+        }
+        if (port_idx == grp->num_ports) {
+            if (grp->num_ports >= DIO_GROUP_MAX_PORTS)
+                return MOD_ERR_RESOURCE;
+            grp->ports[grp->num_ports++] = port;
+        }
+        grp->pin_port_idx[idx] = port_idx;
+        grp->pin_num[idx] = __builtin_ctz(pin_to_mask(pin));
+        if (invert)
+            grp->invert_masks[port_idx] |= 1 << grp->pin_num[idx];
+    }
+    grp->num_pins = num_pins;
+    return 0;
+}
+
+/*
+ * @brief Get the values of a group of inputs or outputs.
+ *
+ * @param[in] grp The group.
+ * @param[out] values The values, bit N for the pin at index N of the group.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t dio_group_get(const struct dio_group* grp, uint32_t* values)
+{
+    uint32_t port_vals[DIO_GROUP_MAX_PORTS];
+    uint32_t idx;
+    uint32_t val = 0;
+
+    if (grp == NULL || values == NULL)
+        return MOD_ERR_ARG;
+
+    for (idx = 0; idx < grp->num_ports; idx++) {
+        port_vals[idx] = (grp->outputs ?
+                          LL_GPIO_ReadOutputPort(grp->ports[idx]) :
+                          LL_GPIO_ReadInputPort(grp->ports[idx])) ^
+            grp->invert_masks[idx];
+    }
+    for (idx = 0; idx < grp->num_pins; idx++)
+        val |= ((port_vals[grp->pin_port_idx[idx]] >> grp->pin_num[idx]) & 1) <<
+            idx;
+    *values = val;
+    return 0;
+}
+
+/*
+ * @brief Set the values of a group of outputs.
+ *
+ * @param[in] grp The group (of outputs).
+ * @param[in] values The values, bit N for the pin at index N of the group.
+ * @param[in] mask Which pins to write, bit N for the pin at index N.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The pins on each port are changed together, with one BSRR write, so no
+ * critical section is needed.
+ */
+int32_t dio_group_set(const struct dio_group* grp, uint32_t values,
+                      uint32_t mask)
+{
+    uint32_t bsrr[DIO_GROUP_MAX_PORTS] = { 0 };
+    uint32_t idx;
+    uint32_t port_idx;
+    uint32_t pin_bit;
+
+    if (grp == NULL || !grp->outputs)
+        return MOD_ERR_ARG;
+
+    for (idx = 0; idx < grp->num_pins; idx++) {
+        if ((mask & (1UL << idx)) == 0)
+            continue;
+        port_idx = grp->pin_port_idx[idx];
+        pin_bit = 1 << grp->pin_num[idx];
+        if (((values >> idx) & 1) ^ ((grp->invert_masks[port_idx] & pin_bit) != 0))
+            bsrr[port_idx] |= pin_bit;
+        else
+            bsrr[port_idx] |= pin_bit << 16;
+    }
+    for (port_idx = 0; port_idx < grp->num_ports; port_idx++) {
+        if (bsrr[port_idx] != 0)
+            WRITE_REG(grp->ports[port_idx]->BSRR, bsrr[port_idx]);
+    }
+    return 0;
+}
+
+/*
+ * @brief Get the oldest captured input edge.
+ *
+ * @param[out] event The edge.
+ *
+ * @return 1 if an edge was returned, 0 if there are none, else a "MOD_ERR"
+ *         value (< 0). See code for details.
+ *
+ * There is a single ring for all inputs, so there should be a single client
+ * reading it.
+ */
+int32_t dio_edge_get(struct dio_edge_event* event)
+{
+    if (event == NULL)
+        return MOD_ERR_ARG;
+    if (edge_get_ctr == edge_put_ctr)
+        return 0;
+    *event = edge_ring[edge_get_ctr & EDGE_RING_MASK];
+    edge_get_ctr++;
+    return 1;
+}
+
 /*
  * @brief Direct run-time configuration of GPIO.
  *
@@ -545,10 +774,189 @@ int32_t dio_set_reset_outputs(dio_port* const port, uint32_t set_mask,
     return 0;
 }
 
+// The following interrupt handler functions override the default handlers,
+// which are "weak" symobols.
+
+#if CONFIG_DIO_TYPE == 4
+
+void EXTI0_IRQHandler(void) { exti_interrupt(); }
+void EXTI1_IRQHandler(void) { exti_interrupt(); }
+void EXTI2_IRQHandler(void) { exti_interrupt(); }
+void EXTI3_IRQHandler(void) { exti_interrupt(); }
+void EXTI4_IRQHandler(void) { exti_interrupt(); }
+void EXTI5_IRQHandler(void) { exti_interrupt(); }
+void EXTI6_IRQHandler(void) { exti_interrupt(); }
+void EXTI7_IRQHandler(void) { exti_interrupt(); }
+void EXTI8_IRQHandler(void) { exti_interrupt(); }
+void EXTI9_IRQHandler(void) { exti_interrupt(); }
+void EXTI10_IRQHandler(void) { exti_interrupt(); }
+void EXTI11_IRQHandler(void) { exti_interrupt(); }
+void EXTI12_IRQHandler(void) { exti_interrupt(); }
+void EXTI13_IRQHandler(void) { exti_interrupt(); }
+void EXTI14_IRQHandler(void) { exti_interrupt(); }
+void EXTI15_IRQHandler(void) { exti_interrupt(); }
+
+#else
+
+void EXTI0_IRQHandler(void) { exti_interrupt(); }
+void EXTI1_IRQHandler(void) { exti_interrupt(); }
+void EXTI2_IRQHandler(void) { exti_interrupt(); }
+void EXTI3_IRQHandler(void) { exti_interrupt(); }
+void EXTI4_IRQHandler(void) { exti_interrupt(); }
+void EXTI9_5_IRQHandler(void) { exti_interrupt(); }
+void EXTI15_10_IRQHandler(void) { exti_interrupt(); }
+
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
 
+/*
+ * @brief Convert an LL pin value to a pin bit mask.
+ *
+ * @param[in] pin The pin value (e.g. DIO_PIN_3).
+ *
+ * @return The pin bit mask.
+ *
+ * On the F1 the LL pin values also encode the config register position, with
+ * the pin bit mask in the upper bits.
+ */
+static uint32_t pin_to_mask(uint32_t pin)
+{
+#if CONFIG_DIO_TYPE == 3
+    return (pin >> GPIO_PIN_MASK_POS) & 0xffff;
+#else
+    return pin;
+#endif
+}
+
+/*
+ * @brief Set up EXTI edge capture for the configured inputs.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t edge_setup(void)
+{
+    uint32_t idx;
+    uint32_t line;
+    uint32_t port_idx;
+    uint32_t line_mask;
+    const struct dio_in_info* dii;
+    IRQn_Type irq_type;
+
+    memset(exti_line_din_idx, -1, sizeof(exti_line_din_idx));
+    exti_lines_mask = 0;
+    for (idx = 0; idx < cfg->num_inputs; idx++) {
+        dii = &cfg->inputs[idx];
+        if (dii->edge == DIO_EDGE_NONE)
+            continue;
+        line = __builtin_ctz(pin_to_mask(dii->pin));
+        line_mask = 1UL << line;
+        if (exti_lines_mask & line_mask) {
+            log_error("dio: %s shares EXTI line %lu\n", dii->name, line);
+            return MOD_ERR_RESOURCE;
+        }
+        exti_line_din_idx[line] = idx;
+        exti_lines_mask |= line_mask;
+
+        // Route the pin's port to the EXTI line.
+        port_idx = ((uint32_t)dii->port - (uint32_t)GPIOA) / GPIO_PORT_SPACING;
+#if CONFIG_DIO_TYPE == 1 || CONFIG_DIO_TYPE == 2
+        SET_BIT(RCC->APB2ENR, RCC_APB2ENR_SYSCFGEN);
+        MODIFY_REG(SYSCFG->EXTICR[line >> 2], 0xfUL << ((line & 3) * 4),
+                   port_idx << ((line & 3) * 4));
+#elif CONFIG_DIO_TYPE == 3
+        SET_BIT(RCC->APB2ENR, RCC_APB2ENR_AFIOEN);
+        MODIFY_REG(AFIO->EXTICR[line >> 2], 0xfUL << ((line & 3) * 4),
+                   port_idx << ((line & 3) * 4));
+#elif CONFIG_DIO_TYPE == 4
+        MODIFY_REG(EXTI->EXTICR[line >> 2], 0xffUL << ((line & 3) * 8),
+                   port_idx << ((line & 3) * 8));
+#endif
+        if (dii->edge & DIO_EDGE_RISING)
+            SET_BIT(EXTI_RTSR, line_mask);
+        else
+            CLEAR_BIT(EXTI_RTSR, line_mask);
+        if (dii->edge & DIO_EDGE_FALLING)
+            SET_BIT(EXTI_FTSR, line_mask);
+        else
+            CLEAR_BIT(EXTI_FTSR, line_mask);
+        SET_BIT(EXTI_IMR, line_mask);
+
+        irq_type = exti_irq_type(line);
+        NVIC_SetPriority(irq_type,
+                         NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+        NVIC_EnableIRQ(irq_type);
+    }
+    return 0;
+}
+
+/*
+ * @brief Get the interrupt type for an EXTI line.
+ *
+ * @param[in] line The EXTI line (0-15).
+ *
+ * @return The interrupt type.
+ */
+static IRQn_Type exti_irq_type(uint32_t line)
+{
+#if CONFIG_DIO_TYPE == 4
+    return (IRQn_Type)(EXTI0_IRQn + line);
+#else
+    if (line <= 4)
+        return (IRQn_Type)(EXTI0_IRQn + line);
+    return line <= 9 ? EXTI9_5_IRQn : EXTI15_10_IRQn;
+#endif
+}
+
+/*
+ * @brief Common EXTI interrupt handler.
+ *
+ * Each pending line that is used for edge capture is cleared, and an edge is
+ * put in the ring for it. Lines sharing an interrupt are handled together.
+ */
+static void exti_interrupt(void)
+{
+    struct dio_edge_event* event;
+    uint32_t pending;
+    uint32_t line;
+    uint32_t ms = tmr_get_ms();
+    uint32_t systick_ctr = tmr_get_systick_ctr();
+
+#if CONFIG_FAULT_PRESENT
+    fault_stack_sample();
+#endif
+
+#if CONFIG_DIO_TYPE == 4
+    pending = (EXTI->RPR1 | EXTI->FPR1) & exti_lines_mask;
+    WRITE_REG(EXTI->RPR1, pending);
+    WRITE_REG(EXTI->FPR1, pending);
+#elif CONFIG_DIO_TYPE == 2
+    pending = EXTI->PR1 & exti_lines_mask;
+    WRITE_REG(EXTI->PR1, pending);
+#else
+    pending = EXTI->PR & exti_lines_mask;
+    WRITE_REG(EXTI->PR, pending);
+#endif
+
+    while (pending != 0) {
+        line = __builtin_ctz(pending);
+        pending &= pending - 1;
+        if (edge_put_ctr - edge_get_ctr >= CONFIG_DIO_EDGE_RING_SIZE) {
+            INC_SAT_U16(cnts_u16[CNT_EDGE_OVERRUN]);
+            continue;
+        }
+        event = &edge_ring[edge_put_ctr & EDGE_RING_MASK];
+        event->ms = ms;
+        event->systick_ctr = systick_ctr;
+        event->din_idx = exti_line_din_idx[line];
+        event->value = dio_get(event->din_idx);
+        edge_put_ctr++;
+        INC_SAT_U16(cnts_u16[CNT_EDGE]);
+    }
+}
+
 static int32_t enable_gpio_port(dio_port* port)
 {
     int idx;
@@ -564,6 +972,31 @@ static int32_t enable_gpio_port(dio_port* port)
     return MOD_ERR_INTERNAL;
 }
 
+/*
+ * @brief Console command function for "dio edge".
+ *
+ * @param[in] argc Number of arguments, including "dio".
+ * @param[in] argv Argument values, including "dio".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: dio edge
+ *
+ * This is for debugging, as the edges are removed from the ring.
+ */
+static int32_t cmd_dio_edge(int32_t argc, const char** argv)
+{
+    struct dio_edge_event event;
+
+    printc("Input        ms       Systick Value\n"
+           "------------ -------- ------- -----\n");
+    while (dio_edge_get(&event) == 1) {
+        printc("%-12s %8lu %7lu %u\n", cfg->inputs[event.din_idx].name,
+               event.ms, event.systick_ctr, event.value);
+    }
+    return 0;
+}
+
 /*
  * @brief Console command function for "dio status".
  *
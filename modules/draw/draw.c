@@ -4,8 +4,44 @@
  * This module drives a drawing machine based on a 2-joint planer robot. It
  * makes use of the step module for driving the stepper motors.
  *
+ * Moves (to a point, by joint or Cartesian interpolation) are added to a move
+ * queue, so a polyline can be queued as a series of moves. A planner, run from
+ * draw_run(), takes moves from the queue and breaks Cartesian moves into short
+ * segments, solving the inverse kinematics for the end point ("via point") of
+ * each. The via points are kept in a lookahead buffer until they are sent to
+ * the step module.
+ *
+ * The tool point speed is planned over the buffered via points, so that
+ * motion continues smoothly from segment to segment, and from move to move.
+ * The planner limits the speed at each junction between segments based on
+ * the angle between them (the "junction deviation" method), and the speed
+ * change between junctions to the configured acceleration, assuming a stop at
+ * the end of the buffered path. Via points are sent to the step module only
+ * once enough points follow them in the buffer (or the path ends), with each
+ * segment's time set from its planned entry and exit speeds.
+ *
+ * There are two kinematics kernels. One uses the libm trig functions, and the
+ * other (selected with CONFIG_DRAW_FAST_KIN) uses polynomial approximations
+ * with errors far below the motor step resolution. The "draw test kinbench"
+ * command compares their speed and accuracy.
+ *
+ * A job can be streamed to the module on a ttys instance (see
+ * draw_stream_start()). The stream is a subset of G-code, one block per line:
+ * - G0 (joint move) and G1 (Cartesian move), with X/Y end point words. The
+ *   motion mode is modal, so a line with only X/Y words repeats it.
+ * - F (feed rate, mm/min), which applies to following Cartesian moves.
+ * - G90/G91 (absolute/relative coordinates) and G21 (mm, the only units).
+ * - N (line number) and M words are ignored, as are comments (";" to the end
+ *   of the line, and "(...)").
+ * Lines are parsed from draw_run() straight into the move queue. When the
+ * queue is full, a parsed move is held and no more characters are read, so the
+ * ttys RX buffer absorbs the input. XON/XOFF is sent to the sender based on
+ * the free space in the move queue, so the job runs as fast as the mechanics
+ * allow. Bad lines are counted and skipped.
+ *
  * The following console commands are provided:
  * > draw status
+ * > draw stream
  * > draw test
  * See code for details.
  *
@@ -36,10 +72,14 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "bench.h"
 #include "cmd.h"
 #include "console.h"
 #include "log.h"
 #include "module.h"
+#include "ring.h"
+#include "stat.h"
+#include "ttys.h"
 
 #include "draw.h"
 
@@ -52,6 +92,40 @@
 #define NUM_CART_DIM 2
 #define DFLT_MS_PER_STEP 20
 #define DFLT_MM_PER_CART_SEG 2.f
+#define DFLT_FEED_MM_PER_S 20.f
+#define DFLT_ACCEL_MM_PER_S2 100.f
+#define JUNCTION_DEV_MM 0.05f
+
+#define MOVE_QUEUE_SIZE CONFIG_DRAW_MOVE_QUEUE_SIZE
+#define VIA_BUF_SIZE CONFIG_DRAW_VIA_BUF_SIZE
+
+#if !RING_SIZE_OK(MOVE_QUEUE_SIZE)
+    #error CONFIG_DRAW_MOVE_QUEUE_SIZE must be a power of 2 (max 0x8000)
+#endif
+#if !RING_SIZE_OK(VIA_BUF_SIZE)
+    #error CONFIG_DRAW_VIA_BUF_SIZE must be a power of 2 (max 0x8000)
+#endif
+
+// Number of via points that must follow a via point in the buffer before it
+// is sent to the step module, unless the path ends.
+#define LOOKAHEAD_MIN_VIAS 8
+
+// Max number of IK solutions in a call to draw_run.
+#define MAX_VIAS_PER_RUN 4
+
+#define STREAM_LINE_SIZE CONFIG_DRAW_STREAM_LINE_SIZE
+
+// Max number of stream characters read in a call to draw_run.
+#define STREAM_MAX_CHARS_PER_RUN 64
+
+// Flow control thresholds, in free move queue slots. XOFF is sent when the
+// free slots drop to STREAM_XOFF_SLOTS, leaving the ttys RX buffer to absorb
+// characters in flight, and XON when they rise to STREAM_XON_SLOTS.
+#define STREAM_XOFF_SLOTS 2
+#define STREAM_XON_SLOTS (MOVE_QUEUE_SIZE / 2)
+
+#define STREAM_XON 0x11
+#define STREAM_XOFF 0x13
 
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
@@ -63,46 +137,154 @@ enum move_state {
     MOVE_STATE_ACTIVE,
 };
 
+struct move
+{
+    float mm[NUM_CART_DIM];
+    enum draw_move_type move_type;
+    float feed_mm_per_s;
+};
+
+// A via point is the end of a segment of the planned path.
+struct via_point
+{
+    int32_t steps[NUM_MOTORS];
+    float len_mm;           // Cartesian segment length, 0 for joint moves.
+    float entry_speed;      // Planned speed at start of segment (mm/s).
+    float max_entry_speed;  // Junction speed limit.
+    uint32_t joint_ms;      // Fixed time for joint moves, 0 otherwise.
+    float feed_mm_per_s;    // Speed limit in the segment.
+};
+
+// State of a job streamed on a ttys instance.
+struct stream_state
+{
+    bool active;
+    enum ttys_instance_id ttys_instance_id;
+    bool xoff_sent;
+
+    // Line being received.
+    char line[STREAM_LINE_SIZE];
+    uint16_t line_len;
+    bool line_overflow;
+
+    // Modal state of the G-code parser.
+    enum draw_move_type move_type;
+    bool relative;
+    float feed_mm_per_s;
+    float pos_mm[NUM_CART_DIM];
+
+    // A parsed move waiting for move queue space.
+    bool move_pending;
+    float pending_mm[NUM_CART_DIM];
+    enum draw_move_type pending_move_type;
+
+    // Counters.
+    uint32_t num_lines;
+    uint32_t num_moves;
+    uint32_t num_bad_lines;
+    uint32_t num_move_errs;
+    uint32_t num_xoffs;
+};
+
 struct state
 {
     struct draw_cfg cfg;
     uint32_t ms_per_step;
+    uint32_t min_ms_per_step;
     float mm_per_cart_seg;
+    float feed_mm_per_s;
+    float accel_mm_per_s2;
 
-    // Following are used for all move types.
     enum move_state move_state;
+
+    struct stream_state stream;
+
+    // Queue of moves not yet started by the planner.
+    struct move moves[MOVE_QUEUE_SIZE];
+    struct ring move_ring;
+
+    // Lookahead buffer of via points not yet sent to the step module.
+    struct via_point vias[VIA_BUF_SIZE];
+    struct ring via_ring;
+    float sent_exit_speed;
+    int32_t sent_steps[NUM_MOTORS];
+
+    // Following are for the move being planned.
+    bool move_active;
     enum draw_move_type move_type;
+    float move_feed_mm_per_s;
     int32_t move_final_steps[NUM_MOTORS];
     float move_final_mm[NUM_CART_DIM];
 
     // Following are used for Cartesian moves only.
-    float move_distance_mm[NUM_CART_DIM];
-    int32_t last_via_point_steps[NUM_MOTORS];
     float seg_distance_mm[NUM_CART_DIM];
     uint32_t num_segments;
     uint32_t crnt_seg_num;
 
+    // Following are the end of the planned path.
+    int32_t last_via_point_steps[NUM_MOTORS];
+    float last_via_point_mm[NUM_CART_DIM];
+    float last_dir[NUM_CART_DIM];
+    float last_feed_mm_per_s;
+    bool last_via_cart;
+
     // This is the tool point position. It is updated when a move completes
-    // from the viewpoint of this module; the actual physical move might not be
-    // complete.
+    // from the viewpoint of this module (i.e. it has been planned); the actual
+    // physical move might not be complete.
     int32_t initial_steps[NUM_MOTORS];
     float initial_mm[NUM_CART_DIM];
 
     float steps_per_radian[NUM_MOTORS];
+
+    // True if the motors are coordinated step instances (see step module).
+    bool coord;
 };
     
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
-static int32_t traj_plan_start(void);
-static int32_t traj_plan_continue(void);
+static int32_t queue_move_feed(float x_mm, float y_mm,
+                               enum draw_move_type move_type,
+                               float feed_mm_per_s);
+static void stream_run(void);
+static int32_t stream_parse_line(void);
+static const char* stream_parse_num(const char* p, float* val);
+static void stream_flow_control(void);
+static int32_t plan_fill(void);
+static int32_t plan_move_start(void);
+static int32_t plan_move_continue(void);
+static void plan_add_via(const int32_t* steps, const float* mm,
+                         uint32_t joint_ms);
+static void plan_recalc(void);
+static int32_t plan_feed(void);
+static void plan_reset(void);
+static void plan_set_position(void);
+static int32_t queue_move(const int32_t* steps, uint32_t ms);
 static int32_t solve_fk(float theta_1_rad, float theta_2_rad,
                         float* x_mm, float* y_mm);
 static int32_t solve_ik(float x_mm, float y_mm,
                         float* theta_1_rad, float* theta_2_rad);
+static int32_t solve_fk_libm(float theta_1_rad, float theta_2_rad,
+                             float* x_mm, float* y_mm);
+static int32_t solve_ik_libm(float x_mm, float y_mm,
+                             float* theta_1_rad, float* theta_2_rad);
+static int32_t solve_fk_fast(float theta_1_rad, float theta_2_rad,
+                             float* x_mm, float* y_mm);
+static int32_t solve_ik_fast(float x_mm, float y_mm,
+                             float* theta_1_rad, float* theta_2_rad);
+static float fast_atan2(float y, float x);
+static void fast_sincos(float angle_rad, float* sin_val, float* cos_val);
+static int32_t kin_bench(uint32_t num_points);
+#if CONFIG_BENCH_PRESENT
+static const float* bench_points(void);
+static int32_t bench_solve_ik(uint32_t num_ops);
+static int32_t bench_ik_libm(uint32_t num_ops);
+static int32_t bench_ik_fast(uint32_t num_ops);
+#endif
 
 static int32_t cmd_draw_status(int32_t argc, const char** argv);
+static int32_t cmd_draw_stream(int32_t argc, const char** argv);
 static int32_t cmd_draw_test(int32_t argc, const char** argv);
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -120,6 +302,11 @@ static struct cmd_cmd_info cmds[] = {
         .func = cmd_draw_status,
         .help = "Get module status, usage: draw status",
     },
+    {
+        .name = "stream",
+        .func = cmd_draw_stream,
+        .help = "Stream job, usage: draw stream {start <ttys-instance>|stop|status}",
+    },
     {
         .name = "test",
         .func = cmd_draw_test,
@@ -135,6 +322,39 @@ static struct cmd_client_info cmd_info = {
     .log_level_ptr = &log_level,
 };
 
+#if CONFIG_BENCH_PRESENT
+// Data structure passed to bench module.
+static const struct bench_info benches[] = {
+    {
+        .name = "solve_ik",
+        .func = bench_solve_ik,
+        .dflt_num_ops = 10000,
+    },
+    {
+        .name = "ik_libm",
+        .func = bench_ik_libm,
+        .dflt_num_ops = 10000,
+    },
+    {
+        .name = "ik_fast",
+        .func = bench_ik_fast,
+        .dflt_num_ops = 10000,
+    },
+};
+
+static const struct bench_client_info bench_info = {
+    .name = "draw",
+    .num_benches = ARRAY_SIZE(benches),
+    .benches = benches,
+};
+
+// Number of workspace points used by the benchmarks (a power of 2).
+#define BENCH_NUM_POINTS 16
+
+// Benchmark results are stored here so they aren't optimized away.
+static volatile float bench_sink;
+#endif
+
 static const float rad_to_deg_factor = 180.0F / PI_F;
 static const float deg_to_rad_factor = PI_F / 180.0F;
 
@@ -180,11 +400,15 @@ int32_t draw_get_def_cfg(struct draw_cfg* cfg)
 int32_t draw_init(struct draw_cfg* cfg)
 {  
     memset(&state, 0, sizeof(state));
+    ring_init(&state.move_ring, MOVE_QUEUE_SIZE);
+    ring_init(&state.via_ring, VIA_BUF_SIZE);
 
     state.cfg = *cfg;
     state.move_state = MOVE_STATE_NOT_CALIB;
     state.ms_per_step = DFLT_MS_PER_STEP;
     state.mm_per_cart_seg = DFLT_MM_PER_CART_SEG;
+    state.feed_mm_per_s = DFLT_FEED_MM_PER_S;
+    state.accel_mm_per_s2 = DFLT_ACCEL_MM_PER_S2;
     return 0;
 }
 
@@ -207,12 +431,25 @@ int32_t draw_start(void)
         return rc;
     }
 
+#if CONFIG_BENCH_PRESENT
+    rc = bench_register(&bench_info);
+    if (rc < 0) {
+        log_error("draw_start: bench error %d\n", rc);
+        return rc;
+    }
+#endif
+
+    state.coord = true;
     for (idx = 0; idx < NUM_MOTORS; idx++)
     {
         rc = step_get_info(state.cfg.step_motor_instance[idx], &smi);
         if (rc != 0)
             return rc;
         state.steps_per_radian[idx] = (float)smi.steps_per_rev/(PI_F * 2.0f);
+        if (smi.min_ms_per_step > state.min_ms_per_step)
+            state.min_ms_per_step = smi.min_ms_per_step;
+        if (!smi.coord)
+            state.coord = false;
     }
     return 0;
 }
@@ -225,61 +462,167 @@ int32_t draw_start(void)
  * @note This function should not block.
  *
  * This function runs the draw singleton module, during normal operation.
+ * It extends the planned path from the move queue, and sends planned via
+ * points to the step module.
  */
 int32_t draw_run(void)
 {
+    int32_t rc;
+
+    if (state.stream.active)
+        stream_run();
+
     if (state.move_state != MOVE_STATE_ACTIVE)
         return 0;
 
-    // If we don't have free command slots for both motors, nothing we can do.
-    if (step_get_free_queue_slots(state.cfg.step_motor_instance[0]) <= 0 ||
-        step_get_free_queue_slots(state.cfg.step_motor_instance[1]) <= 0)
-    {
-        return 0;
+    rc = plan_fill();
+    if (rc == 0)
+        rc = plan_feed();
+    if (rc != 0) {
+        state.move_state = MOVE_STATE_NOT_CALIB;
+        plan_reset();
+        if (state.stream.active) {
+            log_error("draw_run: stream stopped rc=%ld\n", rc);
+            draw_stream_stop();
+        }
+        return rc;
     }
 
-    return traj_plan_continue();
+    if (!state.move_active && ring_empty(&state.move_ring) &&
+        ring_empty(&state.via_ring))
+        state.move_state = MOVE_STATE_IDLE;
+    return 0;
 }
 
 /*
- * @brief Move to a position.
+ * @brief Queue a move to a position.
  *
  * @param[in] x_mm Location on x axis in mm.
  * @param[in] y_mm Location on y axis in mm.
  * @param[in] move_type Move type (joint or Cartesian).
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The move starts from the end point of the previously queued move (or the
+ * current position if there is none). Feasibility (i.e. the IK solution) is
+ * checked for the end point here, and for points along a Cartesian move when
+ * it is planned.
  */
-int32_t draw_move_to(float x_mm, float y_mm, enum draw_move_type move_type)
+int32_t draw_queue_move(float x_mm, float y_mm, enum draw_move_type move_type)
 {
-    float move_final_radians[NUM_MOTORS];
+    return queue_move_feed(x_mm, y_mm, move_type, state.feed_mm_per_s);
+}
+
+/*
+ * @brief Queue a polyline of Cartesian moves.
+ *
+ * @param[in] xy_mm Points, as x/y pairs in mm.
+ * @param[in] num_points Number of points.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Either all points are queued, or none are.
+ */
+int32_t draw_queue_polyline(const float* xy_mm, uint32_t num_points)
+{
+    uint16_t save_put_idx = state.move_ring.put_idx;
+    enum move_state save_move_state = state.move_state;
+    uint32_t idx;
     int32_t rc;
+
+    if (xy_mm == NULL)
+        return MOD_ERR_ARG;
+    if (draw_get_free_move_slots() < (int32_t)num_points)
+        return MOD_ERR_RESOURCE;
+
+    for (idx = 0; idx < num_points; idx++) {
+        rc = draw_queue_move(xy_mm[idx * 2], xy_mm[idx * 2 + 1],
+                             DRAW_MOVE_TYPE_CART);
+        if (rc != 0) {
+            state.move_ring.put_idx = save_put_idx;
+            state.move_state = save_move_state;
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/*
+ * @brief Get number of free move queue slots.
+ *
+ * @return Number of free slots (non-negative).
+ */
+int32_t draw_get_free_move_slots(void)
+{
+    return ring_space(&state.move_ring);
+}
+
+/*
+ * @brief Start streaming a job on a ttys instance.
+ *
+ * @param[in] instance_id The ttys instance the job is received on.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The module must be idle, and the ttys instance must not be used by another
+ * module (e.g. console). Streamed positions start from the current position,
+ * and the feed rate from the current setting.
+ */
+int32_t draw_stream_start(enum ttys_instance_id instance_id)
+{
+    struct stream_state* st = &state.stream;
     uint32_t idx;
 
-    if (state.move_state != MOVE_STATE_IDLE)
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (st->active || state.move_state != MOVE_STATE_IDLE)
         return MOD_ERR_STATE;
 
-    // If we don't have free command slots for both motors, nothing we can do.
-    if (step_get_free_queue_slots(state.cfg.step_motor_instance[0]) <= 0 ||
-        step_get_free_queue_slots(state.cfg.step_motor_instance[1]) <= 0)
-    {
-        return MOD_ERR_STATE;
-    }
+    memset(st, 0, sizeof(*st));
+    st->ttys_instance_id = instance_id;
+    st->move_type = DRAW_MOVE_TYPE_JOINT;
+    st->feed_mm_per_s = state.feed_mm_per_s;
+    for (idx = 0; idx < NUM_CART_DIM; idx++)
+        st->pos_mm[idx] = state.initial_mm[idx];
+    st->active = true;
 
-    rc = solve_ik(x_mm, y_mm, &move_final_radians[0], &move_final_radians[1]);
-    if (rc != 0) {
-        return rc;
-    }
+    // The sender might have been left stopped.
+    return ttys_putc(instance_id, STREAM_XON);
+}
 
-    state.move_final_mm[0] = x_mm;
-    state.move_final_mm[1] = y_mm;
+/*
+ * @brief Stop streaming a job.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Moves already queued are completed. A partial line, or a move waiting for
+ * queue space, is dropped.
+ */
+int32_t draw_stream_stop(void)
+{
+    if (!state.stream.active)
+        return 0;
+    state.stream.active = false;
+    state.stream.move_pending = false;
+    return 0;
+}
 
-    for (idx = 0; idx < NUM_MOTORS; idx++) {
-        state.move_final_steps[idx] = roundf(move_final_radians[idx] *
-                                             state.steps_per_radian[idx]);
-    }
-    state.move_type = move_type;
-    return traj_plan_start();
+/*
+ * @brief Move to a position.
+ *
+ * @param[in] x_mm Location on x axis in mm.
+ * @param[in] y_mm Location on y axis in mm.
+ * @param[in] move_type Move type (joint or Cartesian).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This is the same as draw_queue_move(), except the module must be idle.
+ */
+int32_t draw_move_to(float x_mm, float y_mm, enum draw_move_type move_type)
+{
+    if (state.move_state != MOVE_STATE_IDLE)
+        return MOD_ERR_STATE;
+    return draw_queue_move(x_mm, y_mm, move_type);
 }
 
 /*
@@ -327,6 +670,7 @@ int32_t draw_jog_joint(uint32_t joint_idx, float jog_degrees)
             log_error("draw_jog_jount: solve_fk fails rc=%ld\n", rc);
             state.move_state = MOVE_STATE_NOT_CALIB;
         }
+        plan_set_position();
     }
     return rc;
 }
@@ -379,6 +723,8 @@ int32_t draw_joint_calib(float theta_1_deg, float theta_2_deg)
     for (idx = 0; idx < NUM_CART_DIM; idx++) {
         state.initial_mm[idx] = pos_mm[idx];
     }
+    plan_reset();
+    plan_set_position();
     state.move_state = MOVE_STATE_IDLE;
     return rc;
 }    
@@ -388,199 +734,744 @@ int32_t draw_joint_calib(float theta_1_deg, float theta_2_deg)
 ////////////////////////////////////////////////////////////////////////////////
 
 /*
- * @brief Start the trajectory planning for a move that has been queued.
+ * @brief Queue a move to a position, with a feed rate.
+ *
+ * @param[in] x_mm Location on x axis in mm.
+ * @param[in] y_mm Location on y axis in mm.
+ * @param[in] move_type Move type (joint or Cartesian).
+ * @param[in] feed_mm_per_s Feed rate for a Cartesian move.
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * See draw_queue_move().
  */
-static int32_t traj_plan_start(void)
+static int32_t queue_move_feed(float x_mm, float y_mm,
+                               enum draw_move_type move_type,
+                               float feed_mm_per_s)
 {
+    struct move* move;
+    float radians[NUM_MOTORS];
+    uint32_t put_idx;
     int32_t rc;
-    uint32_t max_steps = 0;
-    uint32_t idx;
-    CRIT_STATE_VAR;
-    float move_abs_distance_mm;
 
-    if (state.move_type == DRAW_MOVE_TYPE_JOINT) {
-        int32_t abs_steps;
-        for (idx = 0; idx < NUM_MOTORS; idx++) {
-            abs_steps = (state.move_final_steps[idx] -
-                         state.initial_steps[idx]);
-            if (abs_steps < 0)
-                abs_steps = -abs_steps;
-            if (abs_steps > max_steps)
-                max_steps = abs_steps;
-        }
+    if (state.move_state == MOVE_STATE_NOT_CALIB)
+        return MOD_ERR_STATE;
 
-        CRIT_BEGIN_NEST();
-        for (idx = 0; idx < NUM_MOTORS; idx++) {
-            rc = step_queue_cmd(state.cfg.step_motor_instance[idx],
-                                STEP_CMD_TO_P_IN_M,
-                                state.move_final_steps[idx],
-                                max_steps * state.ms_per_step);
-            if (rc < 0)
-                break;
-        }
-        CRIT_END_NEST();
+    if (ring_put_peek(&state.move_ring, &put_idx) == 0)
+        return MOD_ERR_RESOURCE;
 
-        if (rc < 0) {
-            log_error("traj_plan_start: step_queue_cmd fails rc=%ld\n", rc);
-            state.move_state = MOVE_STATE_NOT_CALIB;
-            return rc;
-        }
-        
-        // Move is done from this module's viewpoint.
-        for (idx = 0; idx < NUM_MOTORS; idx++)
-            state.initial_steps[idx] = state.move_final_steps[idx];
-        for (idx = 0; idx < NUM_CART_DIM; idx++)
-            state.initial_mm[idx] = state.move_final_mm[idx];
-        state.move_state = MOVE_STATE_IDLE;
+    rc = solve_ik(x_mm, y_mm, &radians[0], &radians[1]);
+    if (rc != 0)
+        return rc;
 
-    } else if (state.move_type == DRAW_MOVE_TYPE_CART) {
-        state.crnt_seg_num = 0;
-        for (idx = 0; idx < NUM_CART_DIM; idx++) {
-            state.move_distance_mm[idx] =
-                (state.move_final_mm[idx] - state.initial_mm[idx]);
-            state.last_via_point_steps[idx] = state.initial_steps[idx];
-        }
-        move_abs_distance_mm = sqrtf((state.move_distance_mm[0] *
-                                      state.move_distance_mm[0]) +
-                                     (state.move_distance_mm[1] *
-                                      state.move_distance_mm[1]));
-
-        state.num_segments = ceilf(move_abs_distance_mm /
-                                   state.mm_per_cart_seg);
-        log_debug("traj_plan_start num_segments=%lu\n", state.num_segments);
-        for (idx = 0; idx < NUM_CART_DIM; idx++) {
-            state.seg_distance_mm[idx] =
-                state.move_distance_mm[idx] / (float)state.num_segments;
-        }
-        state.move_state = MOVE_STATE_ACTIVE;
-    } else {
-        rc = MOD_ERR_INTERNAL;
-        state.move_state = MOVE_STATE_NOT_CALIB;
-    }
-    return rc;
+    move = &state.moves[put_idx];
+    move->mm[0] = x_mm;
+    move->mm[1] = y_mm;
+    move->move_type = move_type;
+    move->feed_mm_per_s = feed_mm_per_s;
+    ring_put_commit(&state.move_ring, 1);
+    state.move_state = MOVE_STATE_ACTIVE;
+    return 0;
 }
 
 /*
- * @brief  Continue trajector planning.
+ * @brief Read and parse the streamed job.
  *
- * @return 0 for success, else a "MOD_ERR" value. See code for details.
- *
- * This is only used for Cartesian moves. It computes the next via point and
- * queues the move to that point to the motors.
+ * Characters are read until the move queue fills, the ttys RX buffer empties,
+ * or the per-run limit is reached.
  */
-static int32_t traj_plan_continue(void)
+static void stream_run(void)
 {
+    struct stream_state* st = &state.stream;
+    uint32_t num_chars;
     int32_t rc;
-    uint32_t idx;
-    float via_point_mm[NUM_CART_DIM];
-    float via_point_radians[NUM_MOTORS];
-    int32_t via_point_steps[NUM_MOTORS];
-    int32_t num_steps;
-    uint32_t max_steps = 0;
-    CRIT_STATE_VAR;
-
-    log_debug("traj_plan_continue crnt_seg_num=%lu\n", state.crnt_seg_num);
-
-    if (state.move_type != DRAW_MOVE_TYPE_CART ||
-        state.crnt_seg_num >= state.num_segments)
-        return MOD_ERR_INTERNAL;
-
-    state.crnt_seg_num++;
-
-    if (state.crnt_seg_num >= state.num_segments) {
-
-        // For the last segment, use the move final destination rather than
-        // calculate a via point.
-
-        for (idx = 0; idx < NUM_CART_DIM; idx++) {
-            via_point_mm[idx] = state.move_final_mm[idx];
-        }
-    } else {
-        // Calculate the next via point.
-        for (idx = 0; idx < NUM_CART_DIM; idx++) {
-            via_point_mm[idx] = state.initial_mm[idx] +
-                state.seg_distance_mm[idx] * (float)state.crnt_seg_num;
-        }
-    }
-
-    rc = solve_ik(via_point_mm[0], via_point_mm[1],
-                  &via_point_radians[0], &via_point_radians[1]);
-
-    if (rc != 0) {
-        // Presumably we encountered a point outside the workspace.
-        log_error("traj_plan_continue: solve_ik fails rc=%ld\n", rc);
-        state.move_state = MOVE_STATE_NOT_CALIB;
-        return rc;
-    }
+    char c;
 
-    for (idx = 0; idx < NUM_MOTORS; idx++) {
-        via_point_steps[idx] = (int32_t)(via_point_radians[idx] *
-                                         state.steps_per_radian[idx]);
-        num_steps = via_point_steps[idx] - state.last_via_point_steps[idx];
-        if (num_steps < 0)
-            num_steps = -num_steps;
-        if  (num_steps > max_steps)
-            max_steps = num_steps;
+    if (state.move_state == MOVE_STATE_NOT_CALIB) {
+        log_error("stream_run: not calibrated, stream stopped\n");
+        draw_stream_stop();
+        return;
     }
 
-    if (max_steps > 0) {
-        CRIT_BEGIN_NEST();
-        for (idx = 0; idx < NUM_MOTORS; idx++) {
-            rc = step_queue_cmd(state.cfg.step_motor_instance[idx],
-                                STEP_CMD_TO_P_IN_M,
-                                via_point_steps[idx],
-                                max_steps * state.ms_per_step);
-            if (rc < 0)
+    for (num_chars = 0; num_chars < STREAM_MAX_CHARS_PER_RUN; num_chars++) {
+        if (st->move_pending) {
+            rc = queue_move_feed(st->pending_mm[0], st->pending_mm[1],
+                                 st->pending_move_type, st->feed_mm_per_s);
+            if (rc == MOD_ERR_RESOURCE)
                 break;
+            st->move_pending = false;
+            if (rc == 0) {
+                st->num_moves++;
+            } else {
+                st->num_move_errs++;
+                log_debug("stream_run: line %lu move fails rc=%ld\n",
+                          st->num_lines, rc);
+            }
         }
-        CRIT_END_NEST();
 
-        if (rc < 0) {
-            log_error("traj_plan_continue: step_queue_cmd fails rc=%ld\n", rc);
-            state.move_state = MOVE_STATE_NOT_CALIB;
-            return rc;
+        if (ttys_getc(st->ttys_instance_id, &c) != 1)
+            break;
+
+        if (c == '\n' || c == '\r') {
+            if (st->line_len == 0 && !st->line_overflow)
+                continue;
+            st->num_lines++;
+            if (st->line_overflow) {
+                st->num_bad_lines++;
+            } else {
+                st->line[st->line_len] = '\0';
+                if (stream_parse_line() != 0) {
+                    st->num_bad_lines++;
+                    log_debug("stream_run: line %lu bad '%s'\n",
+                              st->num_lines, st->line);
+                }
+            }
+            st->line_len = 0;
+            st->line_overflow = false;
+        } else if (st->line_len < STREAM_LINE_SIZE - 1) {
+            st->line[st->line_len++] = c;
+        } else {
+            st->line_overflow = true;
         }
-
-        for (idx = 0; idx < NUM_MOTORS; idx++)
-            state.last_via_point_steps[idx] = via_point_steps[idx];
-    }
-
-    // If this was the last segment we are done, so the final position will be
-    // the initial position for the next move.
-
-    if (state.crnt_seg_num >= state.num_segments) {
-        for (idx = 0; idx < NUM_MOTORS; idx++)
-            state.initial_steps[idx] = state.move_final_steps[idx];
-        for (idx = 0; idx < NUM_CART_DIM; idx++)
-            state.initial_mm[idx] = state.move_final_mm[idx];
-        state.move_state = MOVE_STATE_IDLE;
     }
-    return rc;
+    stream_flow_control();
 }
 
 /*
- * @brief  Perform forward kinematics.
+ * @brief Parse a line of the streamed job.
  *
- * @param [in] theta_1_rad Joint 1 angle in radians.
- * @param [in] theta_2_rad Joint 2 angle in radians.
- * @param [out] x_mm Tool point x coordinate in mm.
- * @param [out] y_mm Tool point y coordinate in mm.
-
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The line is in st->line. A move is not queued here; it is left pending for
+ * stream_run(). A bad line has no effect on the parser state.
  */
-static int32_t solve_fk(float theta_1_rad, float theta_2_rad,
-                        float* x_mm, float* y_mm)
+static int32_t stream_parse_line(void)
 {
-    float theta_sum_rad = theta_1_rad + theta_2_rad;
+    struct stream_state* st = &state.stream;
+    const char* p = st->line;
+    enum draw_move_type move_type = st->move_type;
+    bool relative = st->relative;
+    float feed_mm_per_s = st->feed_mm_per_s;
+    float xy[NUM_CART_DIM];
+    bool xy_seen[NUM_CART_DIM] = {false, false};
+    uint32_t idx;
+    float val;
+    char letter;
+
+    while (*p != '\0') {
+        letter = *p++;
+        if (letter == ' ' || letter == '\t')
+            continue;
+        if (letter == ';' || letter == '%')
+            break;
+        if (letter == '(') {
+            while (*p != '\0' && *p != ')')
+                p++;
+            if (*p == '\0')
+                return MOD_ERR_ARG;
+            p++;
+            continue;
+        }
+        if (letter >= 'a' && letter <= 'z')
+            letter -= 'a' - 'A';
 
-    *x_mm = (state.cfg.link_len_mm[0] * cosf(theta_1_rad) +
-          state.cfg.link_len_mm[1] * cosf(theta_sum_rad));
-    *y_mm = (state.cfg.link_len_mm[0] * sinf(theta_1_rad) +
-             state.cfg.link_len_mm[1] * sinf(theta_sum_rad));
+        p = stream_parse_num(p, &val);
+        if (p == NULL)
+            return MOD_ERR_ARG;
 
-    return 0;
+        switch (letter) {
+            case 'G':
+                if (val == 0.0f) {
+                    move_type = DRAW_MOVE_TYPE_JOINT;
+                } else if (val == 1.0f) {
+                    move_type = DRAW_MOVE_TYPE_CART;
+                } else if (val == 90.0f) {
+                    relative = false;
+                } else if (val == 91.0f) {
+                    relative = true;
+                } else if (val != 21.0f) {
+                    return MOD_ERR_ARG;
+                }
+                break;
+            case 'X':
+            case 'Y':
+                idx = letter - 'X';
+                xy[idx] = val;
+                xy_seen[idx] = true;
+                break;
+            case 'F':
+                if (val <= 0.0f)
+                    return MOD_ERR_ARG;
+                feed_mm_per_s = val / 60.0f;
+                break;
+            case 'N':
+            case 'M':
+                break;
+            default:
+                return MOD_ERR_ARG;
+        }
+    }
+
+    st->move_type = move_type;
+    st->relative = relative;
+    st->feed_mm_per_s = feed_mm_per_s;
+    if (!xy_seen[0] && !xy_seen[1])
+        return 0;
+    for (idx = 0; idx < NUM_CART_DIM; idx++) {
+        if (xy_seen[idx])
+            st->pos_mm[idx] = relative ? st->pos_mm[idx] + xy[idx] : xy[idx];
+        st->pending_mm[idx] = st->pos_mm[idx];
+    }
+    st->pending_move_type = move_type;
+    st->move_pending = true;
+    return 0;
+}
+
+/*
+ * @brief Parse a number in the streamed job.
+ *
+ * @param[in] p The number string.
+ * @param[out] val The number.
+ *
+ * @return Pointer to the character after the number, or NULL if there is no
+ *         valid number.
+ *
+ * Only an optional sign, digits, and a decimal point are accepted, which is
+ * all G-code needs, and avoids pulling in strtof().
+ */
+static const char* stream_parse_num(const char* p, float* val)
+{
+    float f = 0.0f;
+    float factor = 1.0f;
+    bool point_seen = false;
+    bool digit_seen = false;
+
+    while (*p == ' ')
+        p++;
+    if (*p == '-') {
+        factor = -1.0f;
+        p++;
+    } else if (*p == '+') {
+        p++;
+    }
+    for (; *p != '\0'; p++) {
+        if (*p == '.' && !point_seen) {
+            point_seen = true;
+        } else if (*p >= '0' && *p <= '9') {
+            digit_seen = true;
+            if (point_seen)
+                factor /= 10.0f;
+            f = f * 10.0f + (float)(*p - '0');
+        } else {
+            break;
+        }
+    }
+    if (!digit_seen)
+        return NULL;
+    *val = f * factor;
+    return p;
+}
+
+/*
+ * @brief Send XON/XOFF to the job sender, based on move queue space.
+ */
+static void stream_flow_control(void)
+{
+    struct stream_state* st = &state.stream;
+    int32_t free_slots = draw_get_free_move_slots();
+
+    if (!st->xoff_sent && (free_slots <= STREAM_XOFF_SLOTS ||
+                           st->move_pending)) {
+        if (ttys_putc(st->ttys_instance_id, STREAM_XOFF) == 0) {
+            st->xoff_sent = true;
+            st->num_xoffs++;
+        }
+    } else if (st->xoff_sent && free_slots >= STREAM_XON_SLOTS &&
+               !st->move_pending) {
+        if (ttys_putc(st->ttys_instance_id, STREAM_XON) == 0)
+            st->xoff_sent = false;
+    }
+}
+/*
+ * @brief Extend the planned path.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Via points are added to the lookahead buffer from the move being planned
+ * and the move queue, up to MAX_VIAS_PER_RUN at a time.
+ */
+static int32_t plan_fill(void)
+{
+    uint32_t num_vias = 0;
+    int32_t rc;
+
+    while (num_vias < MAX_VIAS_PER_RUN) {
+        if (ring_space(&state.via_ring) == 0)
+            break;
+
+        if (!state.move_active) {
+            if (ring_empty(&state.move_ring))
+                break;
+            rc = plan_move_start();
+        } else {
+            rc = plan_move_continue();
+        }
+        if (rc != 0)
+            return rc;
+        num_vias++;
+    }
+    return 0;
+}
+
+/*
+ * @brief Start planning the next move in the move queue.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Joint moves are planned as a single via point. For Cartesian moves, the
+ * number of segments is computed, and the first via point is added.
+ */
+static int32_t plan_move_start(void)
+{
+    struct move move;
+    float move_final_radians[NUM_MOTORS];
+    float move_distance_mm[NUM_CART_DIM];
+    float move_abs_distance_mm;
+    uint32_t max_steps = 0;
+    int32_t abs_steps;
+    uint32_t idx;
+    int32_t rc;
+
+    // The caller has checked that the move queue isn't empty.
+    ring_get(&state.move_ring, state.moves, sizeof(move), &move, 1);
+
+    rc = solve_ik(move.mm[0], move.mm[1],
+                  &move_final_radians[0], &move_final_radians[1]);
+    if (rc != 0) {
+        log_error("plan_move_start: solve_ik fails rc=%ld\n", rc);
+        return rc;
+    }
+    for (idx = 0; idx < NUM_MOTORS; idx++) {
+        state.move_final_steps[idx] = roundf(move_final_radians[idx] *
+                                             state.steps_per_radian[idx]);
+    }
+    for (idx = 0; idx < NUM_CART_DIM; idx++)
+        state.move_final_mm[idx] = move.mm[idx];
+    state.move_type = move.move_type;
+    state.move_feed_mm_per_s = move.feed_mm_per_s;
+
+    if (state.move_type == DRAW_MOVE_TYPE_JOINT) {
+        for (idx = 0; idx < NUM_MOTORS; idx++) {
+            abs_steps = (state.move_final_steps[idx] -
+                         state.initial_steps[idx]);
+            if (abs_steps < 0)
+                abs_steps = -abs_steps;
+            if (abs_steps > max_steps)
+                max_steps = abs_steps;
+        }
+        plan_add_via(state.move_final_steps, state.move_final_mm,
+                     max_steps > 0 ? max_steps * state.ms_per_step : 1);
+
+        // Move is done from this module's viewpoint.
+        for (idx = 0; idx < NUM_MOTORS; idx++)
+            state.initial_steps[idx] = state.move_final_steps[idx];
+        for (idx = 0; idx < NUM_CART_DIM; idx++)
+            state.initial_mm[idx] = state.move_final_mm[idx];
+        return 0;
+    } else if (state.move_type != DRAW_MOVE_TYPE_CART) {
+        return MOD_ERR_INTERNAL;
+    }
+
+    state.crnt_seg_num = 0;
+    for (idx = 0; idx < NUM_CART_DIM; idx++) {
+        move_distance_mm[idx] = (state.move_final_mm[idx] -
+                                 state.initial_mm[idx]);
+    }
+    move_abs_distance_mm = sqrtf((move_distance_mm[0] * move_distance_mm[0]) +
+                                 (move_distance_mm[1] * move_distance_mm[1]));
+
+    state.num_segments = ceilf(move_abs_distance_mm / state.mm_per_cart_seg);
+    if (state.num_segments == 0)
+        state.num_segments = 1;
+    log_debug("plan_move_start num_segments=%lu\n", state.num_segments);
+    for (idx = 0; idx < NUM_CART_DIM; idx++) {
+        state.seg_distance_mm[idx] =
+            move_distance_mm[idx] / (float)state.num_segments;
+    }
+    state.move_active = true;
+    return plan_move_continue();
+}
+
+/*
+ * @brief Continue planning a Cartesian move.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * It computes the next via point and adds it to the lookahead buffer.
+ */
+static int32_t plan_move_continue(void)
+{
+    int32_t rc;
+    uint32_t idx;
+    float via_point_mm[NUM_CART_DIM];
+    float via_point_radians[NUM_MOTORS];
+    int32_t via_point_steps[NUM_MOTORS];
+
+    log_debug("plan_move_continue crnt_seg_num=%lu\n", state.crnt_seg_num);
+
+    if (state.move_type != DRAW_MOVE_TYPE_CART ||
+        state.crnt_seg_num >= state.num_segments)
+        return MOD_ERR_INTERNAL;
+
+    state.crnt_seg_num++;
+
+    if (state.crnt_seg_num >= state.num_segments) {
+
+        // For the last segment, use the move final destination rather than
+        // calculate a via point.
+
+        for (idx = 0; idx < NUM_CART_DIM; idx++) {
+            via_point_mm[idx] = state.move_final_mm[idx];
+        }
+        for (idx = 0; idx < NUM_MOTORS; idx++)
+            via_point_steps[idx] = state.move_final_steps[idx];
+    } else {
+        // Calculate the next via point.
+        for (idx = 0; idx < NUM_CART_DIM; idx++) {
+            via_point_mm[idx] = state.initial_mm[idx] +
+                state.seg_distance_mm[idx] * (float)state.crnt_seg_num;
+        }
+
+        rc = solve_ik(via_point_mm[0], via_point_mm[1],
+                      &via_point_radians[0], &via_point_radians[1]);
+        if (rc != 0) {
+            // Presumably we encountered a point outside the workspace.
+            log_error("plan_move_continue: solve_ik fails rc=%ld\n", rc);
+            return rc;
+        }
+        for (idx = 0; idx < NUM_MOTORS; idx++) {
+            via_point_steps[idx] = roundf(via_point_radians[idx] *
+                                          state.steps_per_radian[idx]);
+        }
+    }
+
+    plan_add_via(via_point_steps, via_point_mm, 0);
+
+    // If this was the last segment we are done, so the final position will be
+    // the initial position for the next move.
+
+    if (state.crnt_seg_num >= state.num_segments) {
+        for (idx = 0; idx < NUM_MOTORS; idx++)
+            state.initial_steps[idx] = state.move_final_steps[idx];
+        for (idx = 0; idx < NUM_CART_DIM; idx++)
+            state.initial_mm[idx] = state.move_final_mm[idx];
+        state.move_active = false;
+    }
+    return 0;
+}
+
+/*
+ * @brief Add a via point to the lookahead buffer.
+ *
+ * @param[in] steps Motor step positions of the via point.
+ * @param[in] mm Tool point position of the via point.
+ * @param[in] joint_ms For a joint move, the move time, else 0.
+ *
+ * The caller must ensure there is room in the buffer. After adding the via
+ * point, the speeds of the buffered path are re-planned.
+ */
+static void plan_add_via(const int32_t* steps, const float* mm,
+                         uint32_t joint_ms)
+{
+    struct via_point* via = &state.vias[state.via_ring.put_idx];
+    float delta_mm[NUM_CART_DIM];
+    float dir[NUM_CART_DIM];
+    float cos_theta;
+    float sin_theta_d2;
+    float max_entry_sqr;
+    float feed_mm_per_s;
+    uint32_t idx;
+
+    for (idx = 0; idx < NUM_MOTORS; idx++) {
+        via->steps[idx] = steps[idx];
+        state.last_via_point_steps[idx] = steps[idx];
+    }
+    for (idx = 0; idx < NUM_CART_DIM; idx++)
+        delta_mm[idx] = mm[idx] - state.last_via_point_mm[idx];
+    via->len_mm = sqrtf(delta_mm[0] * delta_mm[0] + delta_mm[1] * delta_mm[1]);
+    via->joint_ms = joint_ms;
+    via->entry_speed = 0.0f;
+    via->max_entry_speed = 0.0f;
+    via->feed_mm_per_s = state.move_feed_mm_per_s;
+
+    if (joint_ms == 0 && via->len_mm > 0.0f) {
+        // The junction speed can't exceed the feed rate of either segment.
+        feed_mm_per_s = state.move_feed_mm_per_s;
+        if (state.last_via_cart && state.last_feed_mm_per_s < feed_mm_per_s)
+            feed_mm_per_s = state.last_feed_mm_per_s;
+
+        for (idx = 0; idx < NUM_CART_DIM; idx++)
+            dir[idx] = delta_mm[idx] / via->len_mm;
+
+        // The junction speed is limited based on the angle between the
+        // previous and this segment. With theta the angle between the reversed
+        // previous direction and this direction, a straight line gives
+        // theta=180 degrees (no limit) and a reversal gives theta=0 (stop).
+        if (state.last_via_cart) {
+            cos_theta = -(state.last_dir[0] * dir[0] +
+                          state.last_dir[1] * dir[1]);
+            if (cos_theta <= -0.999f) {
+                via->max_entry_speed = feed_mm_per_s;
+            } else if (cos_theta < 0.999f) {
+                sin_theta_d2 = sqrtf(0.5f * (1.0f - cos_theta));
+                max_entry_sqr = (state.accel_mm_per_s2 * JUNCTION_DEV_MM *
+                                 sin_theta_d2 / (1.0f - sin_theta_d2));
+                via->max_entry_speed = sqrtf(max_entry_sqr);
+                if (via->max_entry_speed > feed_mm_per_s)
+                    via->max_entry_speed = feed_mm_per_s;
+            }
+        }
+        for (idx = 0; idx < NUM_CART_DIM; idx++)
+            state.last_dir[idx] = dir[idx];
+        state.last_feed_mm_per_s = state.move_feed_mm_per_s;
+        state.last_via_cart = true;
+    } else {
+        state.last_via_cart = false;
+    }
+    for (idx = 0; idx < NUM_CART_DIM; idx++)
+        state.last_via_point_mm[idx] = mm[idx];
+
+    ring_put_commit(&state.via_ring, 1);
+    plan_recalc();
+}
+
+/*
+ * @brief Plan the speeds of the buffered path.
+ *
+ * A backward pass limits each entry speed so that the tool can decelerate to
+ * a stop at the end of the buffered path, and a forward pass limits each entry
+ * speed to what can be reached by accelerating from the previous one. The
+ * entry speed of the first buffered via point is fixed, as it is the exit
+ * speed of the last segment sent to the step module.
+ */
+static void plan_recalc(void)
+{
+    struct via_point* via;
+    float next_entry_speed = 0.0f;
+    float limit;
+    uint32_t idx;
+
+    if (ring_empty(&state.via_ring))
+        return;
+
+    // Backward pass (not including the first via point).
+    idx = state.via_ring.put_idx;
+    while (1) {
+        idx = (idx - 1) & state.via_ring.mask;
+        if (idx == state.via_ring.get_idx)
+            break;
+        via = &state.vias[idx];
+        limit = sqrtf(next_entry_speed * next_entry_speed +
+                      2.0f * state.accel_mm_per_s2 * via->len_mm);
+        via->entry_speed = (via->max_entry_speed < limit ?
+                            via->max_entry_speed : limit);
+        next_entry_speed = via->entry_speed;
+    }
+
+    // Forward pass.
+    idx = state.via_ring.get_idx;
+    via = &state.vias[idx];
+    via->entry_speed = state.sent_exit_speed;
+    while (1) {
+        float entry_speed = state.vias[idx].entry_speed;
+        float len_mm = state.vias[idx].len_mm;
+
+        idx = (idx + 1) & state.via_ring.mask;
+        if (idx == state.via_ring.put_idx)
+            break;
+        via = &state.vias[idx];
+        limit = sqrtf(entry_speed * entry_speed +
+                      2.0f * state.accel_mm_per_s2 * len_mm);
+        if (via->entry_speed > limit)
+            via->entry_speed = limit;
+    }
+}
+
+/*
+ * @brief Send planned via points to the step module.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The time for a Cartesian segment is computed from its entry speed, its exit
+ * speed (the entry speed of the next via point), and the highest speed that
+ * can be reached in between, approximating the speed profile in the segment
+ * as piecewise linear. It is also limited by the maximum motor step rate.
+ */
+static int32_t plan_feed(void)
+{
+    struct via_point* via;
+    uint32_t via_idx;
+    uint32_t next_idx;
+    uint32_t num_following;
+    uint32_t max_steps;
+    int32_t num_steps;
+    uint32_t ms;
+    uint32_t idx;
+    float exit_speed;
+    float mid_speed;
+    bool path_end;
+    int32_t rc;
+
+    path_end = !state.move_active && ring_empty(&state.move_ring);
+
+    while (ring_get_peek(&state.via_ring, &via_idx) > 0) {
+        num_following = ring_count(&state.via_ring) - 1;
+        if (num_following < LOOKAHEAD_MIN_VIAS && !path_end)
+            break;
+
+        // If we don't have free command slots for both motors, nothing we can
+        // do.
+        if (step_get_free_queue_slots(state.cfg.step_motor_instance[0]) <= 0 ||
+            step_get_free_queue_slots(state.cfg.step_motor_instance[1]) <= 0)
+            break;
+
+        via = &state.vias[via_idx];
+        next_idx = (via_idx + 1) & state.via_ring.mask;
+        exit_speed = (next_idx == state.via_ring.put_idx ?
+                      0.0f : state.vias[next_idx].entry_speed);
+
+        max_steps = 0;
+        for (idx = 0; idx < NUM_MOTORS; idx++) {
+            num_steps = via->steps[idx] - state.sent_steps[idx];
+            if (num_steps < 0)
+                num_steps = -num_steps;
+            if (num_steps > max_steps)
+                max_steps = num_steps;
+        }
+
+        if (via->joint_ms > 0) {
+            ms = via->joint_ms;
+            exit_speed = 0.0f;
+        } else {
+            mid_speed = sqrtf(0.5f * (via->entry_speed * via->entry_speed +
+                                      exit_speed * exit_speed) +
+                              state.accel_mm_per_s2 * via->len_mm);
+            if (mid_speed > via->feed_mm_per_s)
+                mid_speed = via->feed_mm_per_s;
+            ms = roundf(4000.0f * via->len_mm /
+                        (via->entry_speed + 2.0f * mid_speed + exit_speed));
+            if (ms < max_steps * state.min_ms_per_step)
+                ms = max_steps * state.min_ms_per_step;
+            if (ms == 0)
+                ms = 1;
+        }
+
+        if (max_steps > 0) {
+            rc = queue_move(via->steps, ms);
+            if (rc < 0) {
+                log_error("plan_feed: queue_move fails rc=%ld\n", rc);
+                return rc;
+            }
+            for (idx = 0; idx < NUM_MOTORS; idx++)
+                state.sent_steps[idx] = via->steps[idx];
+        }
+        state.sent_exit_speed = exit_speed;
+        ring_get_commit(&state.via_ring, 1);
+    }
+    return 0;
+}
+
+/*
+ * @brief Discard all planned and queued moves.
+ */
+static void plan_reset(void)
+{
+    state.move_active = false;
+    state.move_ring.get_idx = state.move_ring.put_idx;
+    state.via_ring.get_idx = state.via_ring.put_idx;
+    state.sent_exit_speed = 0.0f;
+    state.last_via_cart = false;
+}
+
+/*
+ * @brief Set the end of the planned path to the current position.
+ *
+ * This is used when the motors are moved (or calibrated) outside of the
+ * planner.
+ */
+static void plan_set_position(void)
+{
+    uint32_t idx;
+
+    for (idx = 0; idx < NUM_MOTORS; idx++) {
+        state.last_via_point_steps[idx] = state.initial_steps[idx];
+        state.sent_steps[idx] = state.initial_steps[idx];
+    }
+    for (idx = 0; idx < NUM_CART_DIM; idx++)
+        state.last_via_point_mm[idx] = state.initial_mm[idx];
+    state.last_via_cart = false;
+}
+
+/*
+ * @brief Queue a move of both motors to step positions.
+ *
+ * @param[in] steps Step destinations, indexed by motor.
+ * @param[in] ms Time for the move.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * If the motors are coordinated step instances, a single coordinated command
+ * is queued. Otherwise, a command is queued for each motor, with interrupts
+ * disabled so that both commands start at the same time.
+ */
+static int32_t queue_move(const int32_t* steps, uint32_t ms)
+{
+    int32_t rc = 0;
+    uint32_t idx;
+    CRIT_STATE_VAR;
+
+    if (state.coord) {
+        int32_t positions[STEP_NUM_INSTANCES];
+        uint32_t instance_mask = 0;
+
+        for (idx = 0; idx < NUM_MOTORS; idx++) {
+            positions[state.cfg.step_motor_instance[idx]] = steps[idx];
+            instance_mask |= 1UL << state.cfg.step_motor_instance[idx];
+        }
+        return step_queue_coord_cmd(instance_mask, positions, ms);
+    }
+
+    CRIT_BEGIN_NEST();
+    for (idx = 0; idx < NUM_MOTORS; idx++) {
+        rc = step_queue_cmd(state.cfg.step_motor_instance[idx],
+                            STEP_CMD_TO_P_IN_M, steps[idx], ms);
+        if (rc < 0)
+            break;
+    }
+    CRIT_END_NEST();
+    return rc;
+}
+
+/*
+ * @brief  Perform forward kinematics.
+ *
+ * @param [in] theta_1_rad Joint 1 angle in radians.
+ * @param [in] theta_2_rad Joint 2 angle in radians.
+ * @param [out] x_mm Tool point x coordinate in mm.
+ * @param [out] y_mm Tool point y coordinate in mm.
+
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The kernel used is selected with CONFIG_DRAW_FAST_KIN.
+ */
+static int32_t solve_fk(float theta_1_rad, float theta_2_rad,
+                        float* x_mm, float* y_mm)
+{
+#if CONFIG_DRAW_FAST_KIN
+    return solve_fk_fast(theta_1_rad, theta_2_rad, x_mm, y_mm);
+#else
+    return solve_fk_libm(theta_1_rad, theta_2_rad, x_mm, y_mm);
+#endif
 }
 
 /*
@@ -592,9 +1483,54 @@ static int32_t solve_fk(float theta_1_rad, float theta_2_rad,
  * @param [out] theta_2_rad Joint 2 angle in radians.
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The kernel used is selected with CONFIG_DRAW_FAST_KIN.
  */
 static int32_t solve_ik(float x_mm, float y_mm,
                         float* theta_1_rad, float* theta_2_rad)
+{
+#if CONFIG_DRAW_FAST_KIN
+    return solve_ik_fast(x_mm, y_mm, theta_1_rad, theta_2_rad);
+#else
+    return solve_ik_libm(x_mm, y_mm, theta_1_rad, theta_2_rad);
+#endif
+}
+
+/*
+ * @brief  Perform forward kinematics, using libm.
+ *
+ * @param [in] theta_1_rad Joint 1 angle in radians.
+ * @param [in] theta_2_rad Joint 2 angle in radians.
+ * @param [out] x_mm Tool point x coordinate in mm.
+ * @param [out] y_mm Tool point y coordinate in mm.
+
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t solve_fk_libm(float theta_1_rad, float theta_2_rad,
+                             float* x_mm, float* y_mm)
+{
+    float theta_sum_rad = theta_1_rad + theta_2_rad;
+
+    *x_mm = (state.cfg.link_len_mm[0] * cosf(theta_1_rad) +
+          state.cfg.link_len_mm[1] * cosf(theta_sum_rad));
+    *y_mm = (state.cfg.link_len_mm[0] * sinf(theta_1_rad) +
+             state.cfg.link_len_mm[1] * sinf(theta_sum_rad));
+
+    return 0;
+}
+
+/*
+ * @brief  Perform inverse kinematics, using libm.
+ *
+ * @param [in] x_mm Tool point x coordinate in mm.
+ * @param [in] y_mm Tool point y coordinate in mm.
+ * @param [out] theta_1_rad Joint 1 angle in radians.
+ * @param [out] theta_2_rad Joint 2 angle in radians.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t solve_ik_libm(float x_mm, float y_mm,
+                             float* theta_1_rad, float* theta_2_rad)
 {
     const float len_1_mm = state.cfg.link_len_mm[0];
     const float len_2_mm = state.cfg.link_len_mm[1];
@@ -635,6 +1571,362 @@ static int32_t solve_ik(float x_mm, float y_mm,
     return 0;
 }
 
+/*
+ * @brief  Perform forward kinematics, using polynomial approximations.
+ *
+ * @param [in] theta_1_rad Joint 1 angle in radians.
+ * @param [in] theta_2_rad Joint 2 angle in radians.
+ * @param [out] x_mm Tool point x coordinate in mm.
+ * @param [out] y_mm Tool point y coordinate in mm.
+
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t solve_fk_fast(float theta_1_rad, float theta_2_rad,
+                             float* x_mm, float* y_mm)
+{
+    float sin_1, cos_1;
+    float sin_12, cos_12;
+
+    fast_sincos(theta_1_rad, &sin_1, &cos_1);
+    fast_sincos(theta_1_rad + theta_2_rad, &sin_12, &cos_12);
+
+    *x_mm = (state.cfg.link_len_mm[0] * cos_1 +
+             state.cfg.link_len_mm[1] * cos_12);
+    *y_mm = (state.cfg.link_len_mm[0] * sin_1 +
+             state.cfg.link_len_mm[1] * sin_12);
+    return 0;
+}
+
+/*
+ * @brief  Perform inverse kinematics, using polynomial approximations.
+ *
+ * @param [in] x_mm Tool point x coordinate in mm.
+ * @param [in] y_mm Tool point y coordinate in mm.
+ * @param [out] theta_1_rad Joint 1 angle in radians.
+ * @param [out] theta_2_rad Joint 2 angle in radians.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This uses the same solution as solve_ik_libm(), but the arc cosines are
+ * computed as acos(c) = atan2(sqrt(1 - c^2), c), with the fast atan2. The
+ * feasibility check is done on the cosine values rather than by checking for
+ * a NaN result.
+ */
+static int32_t solve_ik_fast(float x_mm, float y_mm,
+                             float* theta_1_rad, float* theta_2_rad)
+{
+    const float len_1_mm = state.cfg.link_len_mm[0];
+    const float len_2_mm = state.cfg.link_len_mm[1];
+    float x_sqr_p_y_sqr = x_mm * x_mm + y_mm * y_mm;
+    float dist_mm = sqrtf(x_sqr_p_y_sqr);
+    float cos_alpha;
+    float cos_beta;
+
+    if (dist_mm <= 0.0f)
+        return MOD_ERR_INFEASIBLE;
+
+    cos_alpha = ((x_sqr_p_y_sqr + len_1_mm * len_1_mm - len_2_mm * len_2_mm) /
+                 (2.0f * len_1_mm * dist_mm));
+    cos_beta = ((len_1_mm * len_1_mm + len_2_mm * len_2_mm - x_sqr_p_y_sqr) /
+                (2.0f * len_1_mm * len_2_mm));
+    if (!(cos_alpha >= -1.0f && cos_alpha <= 1.0f &&
+          cos_beta >= -1.0f && cos_beta <= 1.0f))
+        return MOD_ERR_INFEASIBLE;
+
+    *theta_1_rad = (fast_atan2(y_mm, x_mm) -
+                    fast_atan2(sqrtf(1.0f - cos_alpha * cos_alpha), cos_alpha));
+    *theta_2_rad = (PI_F -
+                    fast_atan2(sqrtf(1.0f - cos_beta * cos_beta), cos_beta));
+    return 0;
+}
+
+/*
+ * @brief Fast atan2.
+ *
+ * @param [in] y Y value.
+ * @param [in] x X value.
+ *
+ * @return atan2(y, x), in the range [-pi, pi].
+ *
+ * The argument is reduced to [0, 1] using octant symmetries, and then the
+ * polynomial of Abramowitz & Stegun 4.4.49 is used (error at most 2e-8 rad
+ * before float rounding).
+ */
+static float fast_atan2(float y, float x)
+{
+    float abs_x = x < 0.0f ? -x : x;
+    float abs_y = y < 0.0f ? -y : y;
+    float t;
+    float t_sqr;
+    float res;
+
+    if (abs_x == 0.0f && abs_y == 0.0f)
+        return 0.0f;
+
+    t = abs_y <= abs_x ? abs_y / abs_x : abs_x / abs_y;
+    t_sqr = t * t;
+    res = t * (1.0f + t_sqr * (-0.3333314528f + t_sqr * (0.1999355085f +
+          t_sqr * (-0.1420889944f + t_sqr * (0.1065626393f +
+          t_sqr * (-0.0752896400f + t_sqr * (0.0429096138f +
+          t_sqr * (-0.0161657367f + t_sqr * 0.0028662257f))))))));
+    if (abs_y > abs_x)
+        res = PI_F / 2.0f - res;
+    if (x < 0.0f)
+        res = PI_F - res;
+    return y < 0.0f ? -res : res;
+}
+
+/*
+ * @brief Fast sine and cosine.
+ *
+ * @param [in] angle_rad Angle in radians.
+ * @param [out] sin_val Sine of angle.
+ * @param [out] cos_val Cosine of angle.
+ *
+ * The angle is reduced to [-pi/2, pi/2], and then the polynomials of
+ * Abramowitz & Stegun 4.3.97 and 4.3.99 are used (error at most 2e-9 before
+ * float rounding). The range reduction is done in float, so it adds error for
+ * large angles; joint angles are within a few revolutions of zero.
+ */
+static void fast_sincos(float angle_rad, float* sin_val, float* cos_val)
+{
+    float x;
+    float x_sqr;
+    float cos_sign = 1.0f;
+
+    // Reduce to [-pi, pi], then to [-pi/2, pi/2].
+    x = angle_rad - (2.0f * PI_F) * roundf(angle_rad * (0.5f / PI_F));
+    if (x > PI_F / 2.0f) {
+        x = PI_F - x;
+        cos_sign = -1.0f;
+    } else if (x < -PI_F / 2.0f) {
+        x = -PI_F - x;
+        cos_sign = -1.0f;
+    }
+    x_sqr = x * x;
+    *sin_val = x * (1.0f + x_sqr * (-0.1666666664f + x_sqr * (0.0083333315f +
+               x_sqr * (-0.0001984090f + x_sqr * (0.0000027526f +
+               x_sqr * -0.0000000239f)))));
+    *cos_val = cos_sign * (1.0f + x_sqr * (-0.4999999963f +
+               x_sqr * (0.0416666418f + x_sqr * (-0.0013888397f +
+               x_sqr * (0.0000247609f + x_sqr * -0.0000002605f)))));
+}
+
+/*
+ * @brief Benchmark the kinematics kernels.
+ *
+ * @param [in] num_points Number of test points.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Test points are spread pseudo-randomly over the workspace. For each, the IK
+ * is solved with both kernels, and the positional error of the fast solution
+ * is found by solving the libm FK of its joint angles. The fast FK is
+ * compared against the libm FK for the same joint angles.
+ */
+static int32_t kin_bench(uint32_t num_points)
+{
+    struct stat_cyc_dur stats[4];
+    const float len_1_mm = state.cfg.link_len_mm[0];
+    const float len_2_mm = state.cfg.link_len_mm[1];
+    float min_dist_mm = fabsf(len_1_mm - len_2_mm) + 1.0f;
+    float max_dist_mm = len_1_mm + len_2_mm - 1.0f;
+    float max_ik_err_mm = 0.0f;
+    float max_fk_err_mm = 0.0f;
+    float max_angle_err_rad = 0.0f;
+    uint32_t rand_val = 12345;
+    uint32_t num_infeasible = 0;
+    uint32_t idx;
+    uint32_t stat_idx;
+    static const char* names[] = {
+        "ik libm", "ik fast", "fk libm", "fk fast"
+    };
+
+    for (stat_idx = 0; stat_idx < ARRAY_SIZE(stats); stat_idx++)
+        stat_cyc_dur_init(&stats[stat_idx]);
+
+    for (idx = 0; idx < num_points; idx++) {
+        float theta_libm[NUM_MOTORS];
+        float theta_fast[NUM_MOTORS];
+        float dist_mm;
+        float angle_rad;
+        float x_mm, y_mm;
+        float x2_mm, y2_mm;
+        float err;
+        int32_t rc_libm;
+        int32_t rc_fast;
+
+        // Linear congruential generator, for repeatable points.
+        rand_val = rand_val * 1103515245 + 12345;
+        dist_mm = min_dist_mm + (max_dist_mm - min_dist_mm) *
+            (float)(rand_val >> 16) / 65536.0f;
+        rand_val = rand_val * 1103515245 + 12345;
+        angle_rad = PI_F * ((float)(rand_val >> 16) / 32768.0f - 1.0f);
+        x_mm = dist_mm * cosf(angle_rad);
+        y_mm = dist_mm * sinf(angle_rad);
+
+        stat_cyc_dur_start(&stats[0]);
+        rc_libm = solve_ik_libm(x_mm, y_mm, &theta_libm[0], &theta_libm[1]);
+        stat_cyc_dur_end(&stats[0]);
+        stat_cyc_dur_start(&stats[1]);
+        rc_fast = solve_ik_fast(x_mm, y_mm, &theta_fast[0], &theta_fast[1]);
+        stat_cyc_dur_end(&stats[1]);
+        if (rc_libm != 0 || rc_fast != 0) {
+            num_infeasible++;
+            continue;
+        }
+
+        err = fabsf(theta_fast[0] - theta_libm[0]);
+        if (err > max_angle_err_rad)
+            max_angle_err_rad = err;
+        err = fabsf(theta_fast[1] - theta_libm[1]);
+        if (err > max_angle_err_rad)
+            max_angle_err_rad = err;
+
+        solve_fk_libm(theta_fast[0], theta_fast[1], &x2_mm, &y2_mm);
+        err = sqrtf((x2_mm - x_mm) * (x2_mm - x_mm) +
+                    (y2_mm - y_mm) * (y2_mm - y_mm));
+        if (err > max_ik_err_mm)
+            max_ik_err_mm = err;
+
+        stat_cyc_dur_start(&stats[2]);
+        solve_fk_libm(theta_libm[0], theta_libm[1], &x_mm, &y_mm);
+        stat_cyc_dur_end(&stats[2]);
+        stat_cyc_dur_start(&stats[3]);
+        solve_fk_fast(theta_libm[0], theta_libm[1], &x2_mm, &y2_mm);
+        stat_cyc_dur_end(&stats[3]);
+        err = sqrtf((x2_mm - x_mm) * (x2_mm - x_mm) +
+                    (y2_mm - y_mm) * (y2_mm - y_mm));
+        if (err > max_fk_err_mm)
+            max_fk_err_mm = err;
+    }
+
+    printc("Kernel   Avg cyc  Min cyc  Max cyc\n"
+           "------- -------- -------- --------\n");
+    for (stat_idx = 0; stat_idx < ARRAY_SIZE(stats); stat_idx++) {
+        struct stat_cyc_dur* stat = &stats[stat_idx];
+        printc("%-7s %8lu %8lu %8lu\n", names[stat_idx],
+               stat->samples > 0 ? (uint32_t)(stat->accum_cyc / stat->samples) : 0,
+               stat->min, stat->max);
+    }
+    printc("Points=%lu infeasible=%lu\n", num_points, num_infeasible);
+    printc_float("Max fast IK angle err (mrad)=", max_angle_err_rad * 1000.0f,
+                 4, NULL);
+    printc_float(" IK pos err (mm)=", max_ik_err_mm, 4, NULL);
+    printc_float(" FK pos err (mm)=", max_fk_err_mm, 4, "\n");
+    return 0;
+}
+
+#if CONFIG_BENCH_PRESENT
+
+/*
+ * @brief Get the workspace points for the benchmarks.
+ *
+ * @return BENCH_NUM_POINTS x/y pairs (mm).
+ *
+ * The points are spread over the workspace as in kin_bench(), and are
+ * generated on the first call.
+ */
+static const float* bench_points(void)
+{
+    static float points[BENCH_NUM_POINTS * 2];
+    static bool generated;
+    const float len_1_mm = state.cfg.link_len_mm[0];
+    const float len_2_mm = state.cfg.link_len_mm[1];
+    float min_dist_mm = fabsf(len_1_mm - len_2_mm) + 1.0f;
+    float max_dist_mm = len_1_mm + len_2_mm - 1.0f;
+    uint32_t rand_val = 12345;
+    float dist_mm;
+    float angle_rad;
+    uint32_t idx;
+
+    if (!generated) {
+        for (idx = 0; idx < BENCH_NUM_POINTS; idx++) {
+            rand_val = rand_val * 1103515245 + 12345;
+            dist_mm = min_dist_mm + (max_dist_mm - min_dist_mm) *
+                (float)(rand_val >> 16) / 65536.0f;
+            rand_val = rand_val * 1103515245 + 12345;
+            angle_rad = PI_F * ((float)(rand_val >> 16) / 32768.0f - 1.0f);
+            points[idx * 2] = dist_mm * cosf(angle_rad);
+            points[idx * 2 + 1] = dist_mm * sinf(angle_rad);
+        }
+        generated = true;
+    }
+    return points;
+}
+
+/*
+ * @brief Benchmark for solve_ik() (the kernel selected by
+ *        CONFIG_DRAW_FAST_KIN).
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 (always).
+ */
+static int32_t bench_solve_ik(uint32_t num_ops)
+{
+    const float* points = bench_points();
+    float theta_rad[NUM_MOTORS];
+    float sum = 0.0f;
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++) {
+        const float* pt = &points[(idx % BENCH_NUM_POINTS) * 2];
+        solve_ik(pt[0], pt[1], &theta_rad[0], &theta_rad[1]);
+        sum += theta_rad[0] + theta_rad[1];
+    }
+    bench_sink = sum;
+    return 0;
+}
+
+/*
+ * @brief Benchmark for solve_ik_libm().
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 (always).
+ */
+static int32_t bench_ik_libm(uint32_t num_ops)
+{
+    const float* points = bench_points();
+    float theta_rad[NUM_MOTORS];
+    float sum = 0.0f;
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++) {
+        const float* pt = &points[(idx % BENCH_NUM_POINTS) * 2];
+        solve_ik_libm(pt[0], pt[1], &theta_rad[0], &theta_rad[1]);
+        sum += theta_rad[0] + theta_rad[1];
+    }
+    bench_sink = sum;
+    return 0;
+}
+
+/*
+ * @brief Benchmark for solve_ik_fast().
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 (always).
+ */
+static int32_t bench_ik_fast(uint32_t num_ops)
+{
+    const float* points = bench_points();
+    float theta_rad[NUM_MOTORS];
+    float sum = 0.0f;
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++) {
+        const float* pt = &points[(idx % BENCH_NUM_POINTS) * 2];
+        solve_ik_fast(pt[0], pt[1], &theta_rad[0], &theta_rad[1]);
+        sum += theta_rad[0] + theta_rad[1];
+    }
+    bench_sink = sum;
+    return 0;
+}
+
+#endif
+
 /*
  * @brief Console command function for "draw status".
  *
@@ -647,9 +1939,9 @@ static int32_t solve_ik(float x_mm, float y_mm,
  */
 static int32_t cmd_draw_status(int32_t argc, const char** argv)
 {
-    printc("Move: state=%d type=%d move_step_steps=[%ld, %ld]\n",
-           state.move_state, state.move_type, state.move_final_steps[0],
-           state.move_final_steps[1]);
+    printc("Move: state=%d active=%d type=%d move_final_steps=[%ld, %ld]\n",
+           state.move_state, state.move_active, state.move_type,
+           state.move_final_steps[0], state.move_final_steps[1]);
     printc("      last_via_point_steps=[%ld, %ld] initial_steps=[%ld, %ld]\n",
            state.last_via_point_steps[0], state.last_via_point_steps[1], 
            state.initial_steps[0], state.initial_steps[1]);
@@ -658,8 +1950,57 @@ static int32_t cmd_draw_status(int32_t argc, const char** argv)
 
     printc("      num_segments=%lu crnt_seg_num=%lu\n", state.num_segments,
            state.crnt_seg_num);
+    printc("Queued moves=%lu buffered vias=%lu", ring_count(&state.move_ring),
+           ring_count(&state.via_ring));
+    printc_float(" sent_exit_speed=", state.sent_exit_speed, 2, "\n");
     printc("ms_per_step=%lu mm_per_cart_seg=", state.ms_per_step);
-    printc_float(NULL, state.mm_per_cart_seg, 1, "\n");
+    printc_float(NULL, state.mm_per_cart_seg, 1, NULL);
+    printc_float(" feed=", state.feed_mm_per_s, 1, NULL);
+    printc_float(" accel=", state.accel_mm_per_s2, 1, "\n");
+    return 0;
+}
+
+/*
+ * @brief Console command function for "draw stream".
+ *
+ * @param[in] argc Number of arguments, including "draw"
+ * @param[in] argv Argument values, including "draw"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: draw stream {start <ttys-instance>|stop|status}
+ */
+static int32_t cmd_draw_stream(int32_t argc, const char** argv)
+{
+    struct stream_state* st = &state.stream;
+    struct cmd_arg_val arg_vals[1];
+    int32_t rc = 0;
+
+    if (argc < 3)
+        return MOD_ERR_BAD_CMD;
+
+    if (strcasecmp(argv[2], "start") == 0) {
+        if (cmd_parse_args(argc-3, argv+3, "u", arg_vals) != 1)
+            return MOD_ERR_BAD_CMD;
+        rc = draw_stream_start((enum ttys_instance_id)arg_vals[0].val.u);
+    } else if (strcasecmp(argv[2], "stop") == 0) {
+        rc = draw_stream_stop();
+    } else if (strcasecmp(argv[2], "status") == 0) {
+        printc("Stream: active=%d ttys=%d xoff=%d pending=%d relative=%d "
+               "type=%d\n", st->active, st->ttys_instance_id, st->xoff_sent,
+               st->move_pending, st->relative, st->move_type);
+        printc_float("        pos_mm=[", st->pos_mm[0], 3, ", ");
+        printc_float(NULL, st->pos_mm[1], 3, "]");
+        printc_float(" feed=", st->feed_mm_per_s, 1, "\n");
+        printc("        lines=%lu moves=%lu bad_lines=%lu move_errs=%lu "
+               "xoffs=%lu\n", st->num_lines, st->num_moves, st->num_bad_lines,
+               st->num_move_errs, st->num_xoffs);
+        return 0;
+    } else {
+        printc("Invalid stream operation '%s'\n", argv[2]);
+        return MOD_ERR_BAD_CMD;
+    }
+    printc("Return code %ld\n", rc);
     return 0;
 }
 
@@ -677,7 +2018,7 @@ static int32_t cmd_draw_test(int32_t argc, const char** argv)
 {
     int32_t rc = 0;
     int32_t num_args;
-    struct cmd_arg_val arg_vals[3];
+    struct cmd_arg_val arg_vals[6];
     float theta_1;
     float theta_2;
     float x;
@@ -690,9 +2031,13 @@ static int32_t cmd_draw_test(int32_t argc, const char** argv)
                "  Compute FK, usage: draw test fk <t1> <t2>\n");
         printc("  Calibrate for zero joint angles, usage: draw test calib\n"
                "  Jog joint, usage: draw test jog {0|1} <deg>\n"
-               "  Move, usage: draw test move x y {j|c}\n");
+               "  Move, usage: draw test move x y {j|c}\n"
+               "  Polyline, usage: draw test poly x1 y1 [x2 y2 [x3 y3]]\n");
         printc("  Set speed, usage: draw test speed <ms-per-step>\n"
-               "  Set mm per seg, usage: draw test mm <mm-per-seg>\n");
+               "  Set mm per seg, usage: draw test mm <mm-per-seg>\n"
+               "  Set feed, usage: draw test feed <mm-per-sec>\n"
+               "  Set accel, usage: draw test accel <mm-per-sec^2>\n"
+               "  Kinematics benchmark, usage: draw test kinbench [<num-points>]\n");
 
         return 0;
     }
@@ -745,7 +2090,17 @@ static int32_t cmd_draw_test(int32_t argc, const char** argv)
             printc("Invalid move type '%s'\n", arg_vals[2].val.s);
             return MOD_ERR_BAD_CMD;
         }
-        rc = draw_move_to(arg_vals[0].val.f, arg_vals[1].val.f, move_type);
+        rc = draw_queue_move(arg_vals[0].val.f, arg_vals[1].val.f, move_type);
+    } else if (strcasecmp(argv[2], "poly") == 0) {
+        float xy_mm[6];
+        uint32_t idx;
+
+        num_args = cmd_parse_args(argc-3, argv+3, "ff[ff[ff]]", arg_vals);
+        if (num_args < 2 || (num_args & 1) != 0)
+            return MOD_ERR_BAD_CMD;
+        for (idx = 0; idx < num_args; idx++)
+            xy_mm[idx] = arg_vals[idx].val.f;
+        rc = draw_queue_polyline(xy_mm, num_args / 2);
     } else if (strcasecmp(argv[2], "speed") == 0) {
         num_args = cmd_parse_args(argc-3, argv+3, "u", arg_vals);
         if (num_args != 1)
@@ -756,6 +2111,21 @@ static int32_t cmd_draw_test(int32_t argc, const char** argv)
         if (num_args != 1)
             return MOD_ERR_BAD_CMD;
         state.mm_per_cart_seg = arg_vals[0].val.f;
+    } else if (strcasecmp(argv[2], "kinbench") == 0) {
+        num_args = cmd_parse_args(argc-3, argv+3, "[u]", arg_vals);
+        if (num_args < 0)
+            return MOD_ERR_BAD_CMD;
+        rc = kin_bench(num_args == 1 ? arg_vals[0].val.u : 1000);
+    } else if (strcasecmp(argv[2], "feed") == 0) {
+        num_args = cmd_parse_args(argc-3, argv+3, "f", arg_vals);
+        if (num_args != 1 || arg_vals[0].val.f <= 0.0f)
+            return MOD_ERR_BAD_CMD;
+        state.feed_mm_per_s = arg_vals[0].val.f;
+    } else if (strcasecmp(argv[2], "accel") == 0) {
+        num_args = cmd_parse_args(argc-3, argv+3, "f", arg_vals);
+        if (num_args != 1 || arg_vals[0].val.f <= 0.0f)
+            return MOD_ERR_BAD_CMD;
+        state.accel_mm_per_s2 = arg_vals[0].val.f;
     } else {
         printc("Invalid test '%s'\n", argv[2]);
         return MOD_ERR_BAD_CMD;
@@ -9,10 +9,17 @@
  * - It handles watchdog module timeout notifications.
  * - On a fault (panic), it writes diagnositc data to the console and to flash
  *   (depending on configuration). This includes the light weight log (lwl)
- *   buffer.
+ *   buffer and the top of the stack.
+ *
+ * Flash holds a history of fault records, appended one after the other to a
+ * ring of pages (CONFIG_FAULT_FLASH_NUM_PAGES). Each record has a sequence
+ * number, and a record never spans pages. When the newest record's page is
+ * full, the next page (with the oldest records) is erased. The lwl and stack
+ * sections are compressed in flash with a simple LZ scheme (see
+ * lz_compress()), and written uncompressed to the console.
  *
  * The following console commands are provided:
- * > fault data [erase]
+ * > fault data [erase|<seq>]
  * > fault status
  * > fault test
  * See code for details.
@@ -64,29 +71,33 @@
 #define STACK_INIT_PATTERN 0xcafebadd
 #define STACK_GUARD_BLOCK_SIZE 32
 
-// Address of last page of flash.
-#if CONFIG_FLASH_TYPE == 1
-
-#define FLASH_PANIC_DATA_ADDR ((uint8_t*)(CONFIG_FLASH_BASE_ADDR +  \
-                                          CONFIG_FLASH_SIZE -       \
-                                          CONFIG_FLASH_PAGE_SIZE))
-
-#elif CONFIG_FLASH_TYPE == 2
+// Stack peak usage is tracked per exception priority level, plus one extra
+// bucket for thread mode.
+#define STACK_NUM_PRIOS (1 << __NVIC_PRIO_BITS)
+#define STACK_PRIO_THREAD STACK_NUM_PRIOS
 
+// Flash pages for the fault records.
 #define FLASH_PANIC_DATA_ADDR ((uint8_t*)CONFIG_FAULT_FLASH_PANIC_ADDR)
-
-#elif CONFIG_FLASH_TYPE == 3
-
-#define FLASH_PANIC_DATA_ADDR ((uint8_t*)(CONFIG_FLASH_BASE_ADDR +  \
-                                          CONFIG_FLASH_PAGE_SIZE))
-
-#elif CONFIG_FLASH_TYPE == 4
-
-#define FLASH_PANIC_DATA_ADDR ((uint8_t*)(CONFIG_FLASH_BASE_ADDR +  \
-                                          CONFIG_FLASH_SIZE -       \
-                                          CONFIG_FLASH_PAGE_SIZE))
-
-#endif
+#define FLASH_PANIC_DATA_END (FLASH_PANIC_DATA_ADDR +               \
+                              CONFIG_FAULT_FLASH_NUM_PAGES *        \
+                              CONFIG_FAULT_FLASH_PAGE_SIZE)
+
+#define FLASH_WRITE_BYTES_MASK (CONFIG_FLASH_WRITE_BYTES - 1)
+#define ROUND_UP_FLASH_WRITE(n) \
+    (((n) + FLASH_WRITE_BYTES_MASK) & ~FLASH_WRITE_BYTES_MASK)
+
+#define FLASH_ERASED_32 0xffffffff
+
+// LZ compression tokens. A byte less than LZ_MATCH is followed by that many
+// plus one literal bytes. Otherwise, the low 7 bits plus LZ_MIN_MATCH are the
+// length of a copy of earlier output, whose distance back (1 to 65535) follows
+// in 2 bytes, little endian.
+#define LZ_MATCH 0x80
+#define LZ_MAX_LITERALS 0x80
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_HASH_SIZE 256
+#define LZ_NO_POS 0xffff
 
 #if CONFIG_MPU_TYPE == -1
     #define _s_stack_guard _sstack
@@ -135,9 +146,8 @@ struct fault_data
     uint32_t bfar;                   //@fault_data,bfar,4
     uint32_t tick_ms;                //@fault_data,tick_ms,4
 
-    #if CONFIG_FLASH_WRITE_BYTES == 16
-    uint32_t pad1[2];                //@fault_data,pad1,8
-    #endif
+    uint32_t seq;                    //@fault_data,seq,4
+    uint32_t rcc_csr;                //@fault_data,rcc_csr,4
 };
 
 #define EXCPT_STK_BYTES (8*4)
@@ -158,6 +168,35 @@ struct end_marker {
 _Static_assert((sizeof(struct end_marker) % CONFIG_FLASH_WRITE_BYTES) == 0,
                "Invalid struct end_marker");
 
+// Stack section header. The stack data, starting at addr, follows.
+struct stack_hdr {
+    uint32_t magic;
+    uint32_t num_section_bytes;
+    uint32_t addr;
+};
+
+// Compressed section header. The compressed data follows (padded to the flash
+// write size), and expands to num_raw_bytes of one or more sections.
+struct lz_hdr {
+    uint32_t magic;
+    uint32_t num_section_bytes;
+    uint32_t num_raw_bytes;
+};
+
+// For writing a fault record to flash. If dry_run is true, nothing is written,
+// which is used to get the record size.
+struct rec_writer {
+    uint8_t* addr;
+    uint32_t num_bytes;
+    bool dry_run;
+    uint32_t unit_len;
+    uint32_t unit[CONFIG_FLASH_WRITE_BYTES / 4];
+};
+
+_Static_assert(sizeof(struct lwl_data) < LZ_NO_POS &&
+               CONFIG_FAULT_STACK_DUMP_BYTES < LZ_NO_POS,
+               "Section too large for LZ compression");
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
@@ -165,7 +204,28 @@ _Static_assert((sizeof(struct end_marker) % CONFIG_FLASH_WRITE_BYTES) == 0,
 static void fault_common_handler(void);
 static void record_fault_data(uint32_t data_offset, uint8_t* addr,
                               uint32_t num_bytes);
+static void write_fault_record(uint8_t* lwl_data, uint32_t lwl_num_bytes,
+                               struct stack_hdr* stack, uint8_t* stack_data,
+                               struct end_marker* end);
+static void put_record(struct rec_writer* w, uint8_t* lwl_data,
+                       uint32_t lwl_num_bytes, struct stack_hdr* stack,
+                       uint8_t* stack_data, struct end_marker* end);
+static void put_lz_section(struct rec_writer* w, uint8_t* data1,
+                           uint32_t num_bytes1, uint8_t* data2,
+                           uint32_t num_bytes2);
+static void lz_compress(struct rec_writer* w, const uint8_t* data,
+                        uint32_t num_bytes);
+static void wr_put(struct rec_writer* w, const void* data, uint32_t num_bytes);
+static void wr_pad(struct rec_writer* w);
+static struct fault_data* next_record(uint8_t** pos, uint8_t** rec_end);
+static struct fault_data* find_newest_record(uint8_t** rec_end);
+static uint8_t* page_end(uint8_t* addr);
+static bool is_erased(uint8_t* addr, uint32_t num_bytes);
 static void wdg_triggered_handler(uint32_t wdg_client_id);
+static enum tmr_cb_action stack_scan_tmr_cb(int32_t tmr_id,
+                                            uint32_t user_data);
+static enum tmr_cb_action stack_sample_tmr_cb(int32_t tmr_id,
+                                              uint32_t user_data);
 static int32_t cmd_fault_data(int32_t argc, const char** argv);
 static int32_t cmd_fault_status(int32_t argc, const char** argv);
 static int32_t cmd_fault_test(int32_t argc, const char** argv);
@@ -177,6 +237,11 @@ static void test_overflow_stack(void);
 
 static struct fault_data fault_data_buf;
 
+// Copy of the top of the stack at the time of the fault. The fault handling
+// runs on the same stack, so the live stack changes while the record is
+// written (between the size and write passes, for one).
+static uint8_t stack_data_buf[CONFIG_FAULT_STACK_DUMP_BYTES];
+
 static int32_t log_level = LOG_DEFAULT;  
 
 // Data structure with console command info.
@@ -184,7 +249,7 @@ static struct cmd_cmd_info cmds[] = {
     {
         .name = "data",
         .func = cmd_fault_data,
-        .help = "Print/erase fault data, usage: fault data [erase]",
+        .help = "Print/erase fault data, usage: fault data [erase|<seq>]",
     },
     {
         .name = "status",
@@ -198,17 +263,51 @@ static struct cmd_cmd_info cmds[] = {
     }
 };
 
+// Performance measurements for fault. Note that "stack hwm bytes" is a
+// level rather than a count.
+enum {
+    CNT_STACK_HWM_BYTES,
+    CNT_STACK_HWM_MOVES,
+
+    NUM_U16_PMS
+};
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "stack hwm bytes",
+    "stack hwm moves",
+};
+
 // Data structure passed to cmd module for console interaction.
 static struct cmd_client_info cmd_info = {
     .name = "fault",
     .num_cmds = ARRAY_SIZE(cmds),
     .cmds = cmds,
     .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
 };
 
+// Background stack monitoring. The scanner walks up from the bottom of the
+// stack a few words per timer tick, looking for the lowest word that no
+// longer holds the fill pattern. The peak usage per priority is sampled from
+// the main stack pointer by fault_stack_sample().
+static struct
+{
+    uint32_t* scan_ptr;
+    uint32_t* hwm_ptr;
+    uint32_t num_passes;
+    uint32_t prio_peak[STACK_NUM_PRIOS + 1];
+} stack_mon;
+
 static uint32_t rcc_csr;
 static bool got_rcc_csr = false;
 
+// LZ compression hash table, with the latest position of each 3 byte hash.
+static uint16_t lz_hash[LZ_HASH_SIZE];
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -276,8 +375,23 @@ int32_t fault_start(void)
 
     __ASM volatile("MOV  %0, sp" : "=r" (sp) : : "memory");
     sp--;
+    stack_mon.hwm_ptr = sp + 1;
     while (sp >= &_s_stack_guard)
         *sp-- = STACK_INIT_PATTERN;
+    stack_mon.scan_ptr = &_e_stack_guard;
+
+    rc = tmr_inst_get_cb(CONFIG_FAULT_STACK_SCAN_MS, stack_scan_tmr_cb, 0,
+                         TMR_CNTX_BASE_LEVEL);
+    if (rc < 0) {
+        log_error("fault_start: tmr_inst_get_cb error %d\n", rc);
+        return rc;
+    }
+    rc = tmr_inst_get_cb(CONFIG_FAULT_STACK_SAMPLE_MS, stack_sample_tmr_cb, 0,
+                         TMR_CNTX_INTERRUPT);
+    if (rc < 0) {
+        log_error("fault_start: tmr_inst_get_cb error %d\n", rc);
+        return rc;
+    }
 
 #if CONFIG_MPU_TYPE == 1
 
@@ -370,6 +484,46 @@ int32_t fault_start(void)
     return 0;
 }
 
+/*
+ * @brief Sample main stack usage for the current execution priority.
+ *
+ * Records the peak main stack usage seen at the priority of the code calling
+ * this function. It is cheap enough to be called from interrupt handlers, and
+ * is called by this module from the timer interrupt and from base level.
+ * Calls made from thread mode while running on the process stack (e.g. in an
+ * RTOS task) are ignored.
+ *
+ * Each priority bucket is only updated by code running at that priority,
+ * which can't preempt itself, so no critical section is needed.
+ */
+void fault_stack_sample(void)
+{
+    uint32_t exc_num;
+    uint32_t bucket;
+    uint32_t used;
+
+    if (stack_mon.hwm_ptr == NULL)
+        return;
+
+    exc_num = __get_IPSR();
+    if (exc_num == 0) {
+        if (__get_CONTROL() & CONTROL_SPSEL_Msk)
+            return;
+        bucket = STACK_PRIO_THREAD;
+    } else if (exc_num < 4) {
+        // NMI and hard fault have fixed negative priority.
+        bucket = 0;
+    } else {
+        bucket = NVIC_GetPriority((IRQn_Type)((int32_t)exc_num - 16));
+        if (bucket >= STACK_NUM_PRIOS)
+            bucket = STACK_NUM_PRIOS - 1;
+    }
+
+    used = (uint32_t)&_estack - __get_MSP();
+    if (used > stack_mon.prio_peak[bucket])
+        stack_mon.prio_peak[bucket] = used;
+}
+
 /*
  * @brief Fault detected by software.
  *
@@ -494,8 +648,23 @@ static void fault_common_handler()
 {
     uint8_t* lwl_data;
     uint32_t lwl_num_bytes;
+    struct stack_hdr stack;
+    uint8_t* stack_addr;
+    uint32_t stack_num_bytes = 0;
     struct end_marker end;
 
+    // The top of the stack at the time of the fault, if the sp is valid. The
+    // fault handling has reset the sp, so it is copied before anything else is
+    // called. Even so, the oldest part of the stack (at the highest address)
+    // might already be overwritten.
+    stack_addr = (uint8_t*)(fault_data_buf.sp & ~0x3);
+    if (stack_addr >= (uint8_t*)&_sdata && stack_addr < (uint8_t*)&_estack) {
+        stack_num_bytes = (uint8_t*)&_estack - stack_addr;
+        if (stack_num_bytes > CONFIG_FAULT_STACK_DUMP_BYTES)
+            stack_num_bytes = CONFIG_FAULT_STACK_DUMP_BYTES;
+        memcpy(stack_data_buf, stack_addr, stack_num_bytes);
+    }
+
     lwl_enable(false);
     printc_panic("\nFault type=%lu param=%lu\n", fault_data_buf.fault_type,
                  fault_data_buf.fault_param);
@@ -511,86 +680,392 @@ static void fault_common_handler()
     fault_data_buf.mmfar =  SCB->MMFAR;
     fault_data_buf.bfar =  SCB->BFAR;
     fault_data_buf.tick_ms = tmr_get_ms();
+    fault_data_buf.rcc_csr = fault_get_rcc_csr();
+    fault_data_buf.seq = 0;
 
-    // Record the MCU data.
-    record_fault_data(0, (uint8_t*)&fault_data_buf, sizeof(fault_data_buf));
+#if CONFIG_FAULT_PANIC_TO_FLASH
+    {
+        uint8_t* rec_end;
+        struct fault_data* newest = find_newest_record(&rec_end);
+        fault_data_buf.seq = newest == NULL ? 1 : newest->seq + 1;
+    }
+#endif
 
-    // Record the LWL buffer.
     lwl_data = lwl_get_buffer(&lwl_num_bytes);
-    record_fault_data(sizeof(fault_data_buf), lwl_data, lwl_num_bytes);
 
-    // Record end marker.
+    stack.magic = MOD_MAGIC_STACK;
+    stack.num_section_bytes = sizeof(stack) + stack_num_bytes;
+    stack.addr = (uint32_t)stack_addr;
+
     memset(&end, 0, sizeof(end));
     end.magic = MOD_MAGIC_END;
     end.num_section_bytes = sizeof(end);
 
-    record_fault_data(sizeof(fault_data_buf) + lwl_num_bytes, (uint8_t*)&end,
-                      sizeof(end));
+    // Record the MCU data, LWL buffer, stack, and end marker to the console.
+    record_fault_data(0, (uint8_t*)&fault_data_buf, sizeof(fault_data_buf));
+    record_fault_data(sizeof(fault_data_buf), lwl_data, lwl_num_bytes);
+    record_fault_data(sizeof(fault_data_buf) + lwl_num_bytes,
+                      (uint8_t*)&stack, sizeof(stack));
+    record_fault_data(sizeof(fault_data_buf) + lwl_num_bytes + sizeof(stack),
+                      stack_data_buf, stack_num_bytes);
+    record_fault_data(sizeof(fault_data_buf) + lwl_num_bytes +
+                      stack.num_section_bytes, (uint8_t*)&end, sizeof(end));
+
+#if CONFIG_FAULT_PANIC_TO_FLASH
+    // Record to flash, in compressed form.
+    write_fault_record(lwl_data, lwl_num_bytes, &stack, stack_data_buf, &end);
+#endif
 
     // Reset system - this function will not return.
     NVIC_SystemReset();
 }
 
 /*
- * @brief Record fault data.
+ * @brief Record fault data to the console.
  *
  * @param[in] data_offset The logical offset of this chunk of data.
- * @param[in] data_addr The location of the data. Must be on 8 byte boundary
- *                      if writing to flash.
- * @param[in] num_bytes The number of bytes of data. Must ba multiple of 8
- *                      if writing to flash.
+ * @param[in] data_addr The location of the data.
+ * @param[in] num_bytes The number of bytes of data.
  *
- * @note As we are in a panic, we tend to just ignore return codes and keep
- *       going.
+ * The data is printed a line at a time, feeding the hardware watchdog after
+ * each line, so a slow console can't cause a reset before the flash record is
+ * written.
  */
 static void record_fault_data(uint32_t data_offset, uint8_t* data_addr,
                               uint32_t num_bytes)
 {
-#if CONFIG_FAULT_PANIC_TO_FLASH
+#if CONFIG_FAULT_PANIC_TO_CONSOLE
     {
-        static bool do_flash;
-        int32_t rc;
-        
-        if (data_offset == 0) {
-            do_flash = ((struct fault_data*)FLASH_PANIC_DATA_ADDR)->magic !=
-                MOD_MAGIC_FAULT;
+        const uint32_t bytes_per_line = 32;
+        uint32_t len;
+
+        for (; num_bytes > 0; num_bytes -= len) {
+            len = num_bytes < bytes_per_line ? num_bytes : bytes_per_line;
+            console_data_print_panic(data_offset, data_addr, len);
+            data_offset += len;
+            data_addr += len;
+            wdg_feed_hdw();
         }
-        if (do_flash) {
-            if (data_offset == 0) {
-                rc = flash_panic_erase_page((uint32_t*)FLASH_PANIC_DATA_ADDR);
-                if (rc != 0)
-                    printc_panic("flash_panic_erase_page returns %ld\n", rc);
+    }
+#endif
+
+}
+
+/*
+ * @brief Write a fault record to flash.
+ *
+ * @param[in] lwl_data The LWL buffer.
+ * @param[in] lwl_num_bytes Size of the LWL buffer.
+ * @param[in] stack The stack section header.
+ * @param[in] stack_data The stack data.
+ * @param[in] end The end marker.
+ *
+ * The record is appended after the newest record if there is room in its
+ * page, else the next page is erased. The size of the record is found first,
+ * with a dry run.
+ *
+ * @note As we are in a panic, we tend to just ignore return codes and keep
+ *       going.
+ */
+static void write_fault_record(uint8_t* lwl_data, uint32_t lwl_num_bytes,
+                               struct stack_hdr* stack, uint8_t* stack_data,
+                               struct end_marker* end)
+{
+    struct rec_writer w;
+    struct fault_data* newest;
+    uint8_t* rec_end;
+    uint8_t* addr;
+    uint32_t num_bytes;
+    int32_t rc;
+
+    memset(&w, 0, sizeof(w));
+    w.dry_run = true;
+    put_record(&w, lwl_data, lwl_num_bytes, stack, stack_data, end);
+    num_bytes = w.num_bytes;
+    if (num_bytes > CONFIG_FAULT_FLASH_PAGE_SIZE) {
+        printc_panic("Fault record too large (%lu bytes)\n", num_bytes);
+        return;
+    }
+
+    newest = find_newest_record(&rec_end);
+    if (newest != NULL && rec_end + num_bytes <= page_end((uint8_t*)newest) &&
+        is_erased(rec_end, num_bytes)) {
+        addr = rec_end;
+    } else {
+        addr = newest == NULL ? FLASH_PANIC_DATA_ADDR :
+            page_end((uint8_t*)newest);
+        if (addr >= FLASH_PANIC_DATA_END)
+            addr = FLASH_PANIC_DATA_ADDR;
+        wdg_feed_hdw();
+        rc = flash_panic_erase_page((uint32_t*)addr);
+        if (rc != 0)
+            printc_panic("flash_panic_erase_page returns %ld\n", rc);
+    }
+    wdg_feed_hdw();
+
+    memset(&w, 0, sizeof(w));
+    w.addr = addr;
+    put_record(&w, lwl_data, lwl_num_bytes, stack, stack_data, end);
+}
+
+/*
+ * @brief Put a fault record: the MCU data, the compressed LWL buffer and stack,
+ *        and the end marker.
+ *
+ * @param[in] w The writer.
+ * @param[in] lwl_data The LWL buffer.
+ * @param[in] lwl_num_bytes Size of the LWL buffer.
+ * @param[in] stack The stack section header.
+ * @param[in] stack_data The stack data.
+ * @param[in] end The end marker.
+ */
+static void put_record(struct rec_writer* w, uint8_t* lwl_data,
+                       uint32_t lwl_num_bytes, struct stack_hdr* stack,
+                       uint8_t* stack_data, struct end_marker* end)
+{
+    wr_put(w, &fault_data_buf, sizeof(fault_data_buf));
+    put_lz_section(w, lwl_data, lwl_num_bytes, NULL, 0);
+    wdg_feed_hdw();
+    put_lz_section(w, (uint8_t*)stack, sizeof(*stack), stack_data,
+                   stack->num_section_bytes - sizeof(*stack));
+    wr_put(w, end, sizeof(*end));
+    wdg_feed_hdw();
+}
+
+/*
+ * @brief Put a compressed section.
+ *
+ * @param[in] w The writer.
+ * @param[in] data1 First part of the data to compress.
+ * @param[in] num_bytes1 Size of the first part.
+ * @param[in] data2 Second part of the data to compress.
+ * @param[in] num_bytes2 Size of the second part (can be 0).
+ *
+ * The data is compressed twice, first to get the size for the header.
+ */
+static void put_lz_section(struct rec_writer* w, uint8_t* data1,
+                           uint32_t num_bytes1, uint8_t* data2,
+                           uint32_t num_bytes2)
+{
+    struct rec_writer size_w;
+    struct lz_hdr hdr;
+
+    memset(&size_w, 0, sizeof(size_w));
+    size_w.dry_run = true;
+    lz_compress(&size_w, data1, num_bytes1);
+    lz_compress(&size_w, data2, num_bytes2);
+
+    // Sections start on a flash write boundary, so padding the section pads
+    // the record.
+    hdr.magic = MOD_MAGIC_LZ;
+    hdr.num_section_bytes = ROUND_UP_FLASH_WRITE(sizeof(hdr) +
+                                                 size_w.num_bytes);
+    hdr.num_raw_bytes = num_bytes1 + num_bytes2;
+    wr_put(w, &hdr, sizeof(hdr));
+    lz_compress(w, data1, num_bytes1);
+    lz_compress(w, data2, num_bytes2);
+    wr_pad(w);
+}
+
+/*
+ * @brief Compress data.
+ *
+ * @param[in] w The writer for the compressed data.
+ * @param[in] data The data.
+ * @param[in] num_bytes Size of the data.
+ *
+ * This is a simple and fast LZ77 style compressor (see LZ_MATCH), using a hash
+ * of the next 3 bytes to find the latest earlier match. Matches only refer to
+ * this data, so the output of several calls can be concatenated. In the worst
+ * case, the output is 1/128 larger than the input.
+ */
+static void lz_compress(struct rec_writer* w, const uint8_t* data,
+                        uint32_t num_bytes)
+{
+    uint32_t idx = 0;
+    uint32_t lit_idx = 0;
+    uint8_t token[3];
+
+    memset(lz_hash, 0xff, sizeof(lz_hash));
+    while (idx + LZ_MIN_MATCH <= num_bytes) {
+        uint32_t hash = ((data[idx] << 4) ^ (data[idx + 1] << 2) ^
+                         data[idx + 2]) & (LZ_HASH_SIZE - 1);
+        uint32_t match_idx = lz_hash[hash];
+        uint32_t len = 0;
+
+        lz_hash[hash] = idx;
+        if (match_idx != LZ_NO_POS) {
+            while (len < LZ_MAX_MATCH && idx + len < num_bytes &&
+                   data[match_idx + len] == data[idx + len])
+                len++;
+        }
+        if (len < LZ_MIN_MATCH) {
+            if (++idx - lit_idx == LZ_MAX_LITERALS) {
+                token[0] = LZ_MAX_LITERALS - 1;
+                wr_put(w, token, 1);
+                wr_put(w, &data[lit_idx], LZ_MAX_LITERALS);
+                lit_idx = idx;
             }
-            rc = flash_panic_write((uint32_t*)(FLASH_PANIC_DATA_ADDR +
-                                               data_offset),
-                                   (uint32_t*)data_addr, num_bytes);
+            continue;
+        }
+        if (idx > lit_idx) {
+            token[0] = idx - lit_idx - 1;
+            wr_put(w, token, 1);
+            wr_put(w, &data[lit_idx], idx - lit_idx);
+        }
+        token[0] = LZ_MATCH | (len - LZ_MIN_MATCH);
+        token[1] = (idx - match_idx) & 0xff;
+        token[2] = (idx - match_idx) >> 8;
+        wr_put(w, token, 3);
+        idx += len;
+        lit_idx = idx;
+    }
+
+    while (lit_idx < num_bytes) {
+        uint32_t len = num_bytes - lit_idx;
+        if (len > LZ_MAX_LITERALS)
+            len = LZ_MAX_LITERALS;
+        token[0] = len - 1;
+        wr_put(w, token, 1);
+        wr_put(w, &data[lit_idx], len);
+        lit_idx += len;
+    }
+}
+
+/*
+ * @brief Put data to a fault record.
+ *
+ * @param[in] w The writer.
+ * @param[in] data The data.
+ * @param[in] num_bytes Size of the data.
+ *
+ * The data is buffered, and written to flash a unit at a time.
+ */
+static void wr_put(struct rec_writer* w, const void* data, uint32_t num_bytes)
+{
+    const uint8_t* bytes = data;
+    int32_t rc;
+
+    w->num_bytes += num_bytes;
+    if (w->dry_run)
+        return;
+    while (num_bytes-- > 0) {
+        ((uint8_t*)w->unit)[w->unit_len++] = *bytes++;
+        if (w->unit_len == CONFIG_FLASH_WRITE_BYTES) {
+            rc = flash_panic_write((uint32_t*)w->addr, w->unit,
+                                   CONFIG_FLASH_WRITE_BYTES);
             if (rc != 0)
                 printc_panic("flash_panic_write returns %ld\n", rc);
+            w->addr += CONFIG_FLASH_WRITE_BYTES;
+            w->unit_len = 0;
         }
     }
-#endif
+}
 
-#if CONFIG_FAULT_PANIC_TO_CONSOLE
-    {
-        const int bytes_per_line = 32;
-        uint32_t line_byte_ctr = 0;
-        uint32_t idx;
-
-        for (idx = 0; idx < num_bytes; idx++) {
-            if (line_byte_ctr == 0)
-                printc_panic("%08x: ", (unsigned int)data_offset);
-            printc_panic("%02x", (unsigned)*data_addr++);
-            data_offset++;
-            if (++line_byte_ctr >= bytes_per_line) {
-                printc_panic("\n");
-                line_byte_ctr = 0;
+/*
+ * @brief Pad a fault record (with zeros) to the flash write size.
+ *
+ * @param[in] w The writer.
+ */
+static void wr_pad(struct rec_writer* w)
+{
+    static const uint8_t zeros[CONFIG_FLASH_WRITE_BYTES];
+
+    wr_put(w, zeros, ROUND_UP_FLASH_WRITE(w->num_bytes) - w->num_bytes);
+}
+
+/*
+ * @brief Get the next complete fault record in flash.
+ *
+ * @param[in,out] pos Where to start looking (FLASH_PANIC_DATA_ADDR to start),
+ *                    updated to where to look for the next one.
+ * @param[out] rec_end The end of the record.
+ *
+ * @return The record, or NULL if there are no more.
+ *
+ * Records are found by following the section lengths to the end marker.
+ * After an erased or incomplete record, the rest of the page is skipped.
+ */
+static struct fault_data* next_record(uint8_t** pos, uint8_t** rec_end)
+{
+    while (*pos < FLASH_PANIC_DATA_END) {
+        uint8_t* rec = *pos;
+        uint8_t* end = page_end(rec);
+        uint8_t* addr = rec;
+
+        while (((struct fault_data*)rec)->magic == MOD_MAGIC_FAULT &&
+               addr + sizeof(struct end_marker) <= end) {
+            struct end_marker* section = (struct end_marker*)addr;
+            uint32_t num_bytes = section->num_section_bytes;
+
+            if (num_bytes < sizeof(struct end_marker) || (num_bytes & 0x3) ||
+                num_bytes > end - addr)
+                break;
+            addr += num_bytes;
+            if (section->magic == MOD_MAGIC_END) {
+                *pos = addr;
+                *rec_end = addr;
+                return (struct fault_data*)rec;
             }
         }
-        if (line_byte_ctr != 0)
-            printc_panic("\n");
+        *pos = end;
     }
-#endif
+    return NULL;
+}
+
+/*
+ * @brief Find the fault record with the largest sequence number.
+ *
+ * @param[out] rec_end The end of the record.
+ *
+ * @return The record, or NULL if there are none.
+ */
+static struct fault_data* find_newest_record(uint8_t** rec_end)
+{
+    struct fault_data* newest = NULL;
+    struct fault_data* rec;
+    uint8_t* pos = FLASH_PANIC_DATA_ADDR;
+    uint8_t* end;
+
+    while ((rec = next_record(&pos, &end)) != NULL) {
+        if (newest == NULL || rec->seq > newest->seq) {
+            newest = rec;
+            *rec_end = end;
+        }
+    }
+    return newest;
+}
 
+/*
+ * @brief Get the end of the fault record page containing an address.
+ *
+ * @param[in] addr The address.
+ *
+ * @return The end of the page.
+ */
+static uint8_t* page_end(uint8_t* addr)
+{
+    return FLASH_PANIC_DATA_ADDR +
+        ((addr - FLASH_PANIC_DATA_ADDR) / CONFIG_FAULT_FLASH_PAGE_SIZE + 1) *
+        CONFIG_FAULT_FLASH_PAGE_SIZE;
+}
+
+/*
+ * @brief Check whether flash is erased.
+ *
+ * @param[in] addr The address (word aligned).
+ * @param[in] num_bytes Number of bytes (multiple of 4).
+ *
+ * @return True if all bytes are erased.
+ */
+static bool is_erased(uint8_t* addr, uint32_t num_bytes)
+{
+    uint32_t* word = (uint32_t*)addr;
+
+    for (; num_bytes > 0; num_bytes -= 4)
+        if (*word++ != FLASH_ERASED_32)
+            return false;
+    return true;
 }
 
 /*
@@ -605,6 +1080,63 @@ static void wdg_triggered_handler(uint32_t wdg_client_id)
     fault_detected(FAULT_TYPE_WDG, wdg_client_id);
 }
 
+/*
+ * @brief Timer callback to incrementally scan the stack for its high water
+ *        mark.
+ *
+ * @param[in] tmr_id Timer ID.
+ * @param[in] user_data User callback data (not used).
+ *
+ * @return TMR_CB_RESTART (always).
+ *
+ * Each call checks up to CONFIG_FAULT_STACK_SCAN_WORDS words, working up from
+ * the bottom of the stack towards the current high water mark. If a word has
+ * been overwritten, the high water mark moves down to it and the scan starts
+ * over.
+ */
+static enum tmr_cb_action stack_scan_tmr_cb(int32_t tmr_id,
+                                            uint32_t user_data)
+{
+    uint32_t num_words;
+    uint32_t hwm_bytes;
+
+    for (num_words = 0; num_words < CONFIG_FAULT_STACK_SCAN_WORDS;
+         num_words++) {
+        if (stack_mon.scan_ptr >= stack_mon.hwm_ptr) {
+            stack_mon.scan_ptr = &_e_stack_guard;
+            stack_mon.num_passes++;
+            break;
+        }
+        if (*stack_mon.scan_ptr != STACK_INIT_PATTERN) {
+            stack_mon.hwm_ptr = stack_mon.scan_ptr;
+            stack_mon.scan_ptr = &_e_stack_guard;
+            hwm_bytes = (&_estack - stack_mon.hwm_ptr) * sizeof(uint32_t);
+            cnts_u16[CNT_STACK_HWM_BYTES] =
+                hwm_bytes > UINT16_MAX ? UINT16_MAX : hwm_bytes;
+            INC_SAT_U16(cnts_u16[CNT_STACK_HWM_MOVES]);
+            break;
+        }
+        stack_mon.scan_ptr++;
+    }
+    fault_stack_sample();
+    return TMR_CB_RESTART;
+}
+
+/*
+ * @brief Timer callback to sample stack usage from interrupt context.
+ *
+ * @param[in] tmr_id Timer ID.
+ * @param[in] user_data User callback data (not used).
+ *
+ * @return TMR_CB_RESTART (always).
+ */
+static enum tmr_cb_action stack_sample_tmr_cb(int32_t tmr_id,
+                                              uint32_t user_data)
+{
+    fault_stack_sample();
+    return TMR_CB_RESTART;
+}
+
 /*
  * @brief Console command function for "fault data".
  *
@@ -613,29 +1145,64 @@ static void wdg_triggered_handler(uint32_t wdg_client_id)
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
  *
- * Command usage: fault data [erase]
+ * Command usage: fault data [erase|<seq>]
+ *
+ * With no argument, the fault records are listed, and then the flash is
+ * printed from the start up to the end of the last record. Erased areas
+ * between records are skipped by logfmt.py. With a sequence number, only that
+ * record is printed.
  */
 static int32_t cmd_fault_data(int32_t argc, const char** argv)
 {
+    struct fault_data* rec;
+    struct cmd_arg_val arg_vals[1];
+    uint8_t* pos = FLASH_PANIC_DATA_ADDR;
+    uint8_t* rec_end;
+    uint8_t* last_end = FLASH_PANIC_DATA_ADDR;
     int32_t rc = 0;
 
-    if (argc > 3 || (argc == 3 && strcasecmp(argv[2], "erase") != 0)) {
+    if (argc > 3) {
         printc("Invalid command arguments\n");
         return MOD_ERR_BAD_CMD;
     }
 
+    if (argc == 3 && strcasecmp(argv[2], "erase") == 0) {
+        for (; pos < FLASH_PANIC_DATA_END; pos += CONFIG_FAULT_FLASH_PAGE_SIZE) {
+            rc = flash_panic_erase_page((uint32_t*)pos);
+            if (rc != 0) {
+                printc("Flash erase fails\n");
+                break;
+            }
+        }
+        return rc;
+    }
+
     if (argc == 3) {
-        rc = flash_panic_erase_page((uint32_t*)FLASH_PANIC_DATA_ADDR);
-        if (rc != 0)
-            printc("Flash erase fails\n");
-    } else {
-        uint32_t num_bytes;
-        lwl_get_buffer(&num_bytes);
-        num_bytes += sizeof(fault_data_buf);
-        num_bytes += sizeof(struct end_marker);
-        console_data_print((uint8_t*)FLASH_PANIC_DATA_ADDR, num_bytes);
+        if (cmd_parse_args(argc-2, argv+2, "u", arg_vals) != 1)
+            return MOD_ERR_BAD_CMD;
+        while ((rec = next_record(&pos, &rec_end)) != NULL) {
+            if (rec->seq == arg_vals[0].val.u)
+                return console_data_print((uint8_t*)rec,
+                                          rec_end - (uint8_t*)rec);
+        }
+        printc("No fault record with seq %lu\n", arg_vals[0].val.u);
+        return MOD_ERR_ARG;
     }
-    return rc;
+
+    while ((rec = next_record(&pos, &rec_end)) != NULL) {
+        printc("seq=%lu addr=0x%08lx bytes=%lu type=%lu param=%lu "
+               "tick_ms=%lu\n", rec->seq, (uint32_t)rec,
+               (uint32_t)(rec_end - (uint8_t*)rec), rec->fault_type,
+               rec->fault_param, rec->tick_ms);
+        if (rec_end > last_end)
+            last_end = rec_end;
+    }
+    if (last_end == FLASH_PANIC_DATA_ADDR) {
+        printc("No fault records\n");
+        return 0;
+    }
+    return console_data_print(FLASH_PANIC_DATA_ADDR,
+                              last_end - FLASH_PANIC_DATA_ADDR);
 }
 
 /*
@@ -677,6 +1244,19 @@ static int32_t cmd_fault_status(int32_t argc, const char** argv)
     printc("Stack usage: 0x%08lx -> 0x%08lx (%lu bytes)\n",
            (uint32_t)&_estack, (uint32_t)sp,
            (uint32_t)((&_estack - sp) * sizeof(uint32_t)));
+    if (stack_mon.hwm_ptr != NULL) {
+        printc("Stack scan: high water %lu bytes, %lu passes\n",
+               (uint32_t)((&_estack - stack_mon.hwm_ptr) * sizeof(uint32_t)),
+               stack_mon.num_passes);
+        printc("Stack peak by priority (sampled):\n");
+        for (idx = 0; idx < STACK_NUM_PRIOS; idx++) {
+            if (stack_mon.prio_peak[idx] != 0)
+                printc("  prio %2lu: %lu bytes\n", idx,
+                       stack_mon.prio_peak[idx]);
+        }
+        printc("  thread : %lu bytes\n",
+               stack_mon.prio_peak[STACK_PRIO_THREAD]);
+    }
     printc("CSR: Poweron=0x%08lx Current=0x%08lx\n", rcc_csr,
            RCC->CSR);
     for (idx = 0; idx < ARRAY_SIZE(reset_info); idx++) {
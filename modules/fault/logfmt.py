@@ -11,8 +11,17 @@ the fault data (text) from there. Otherwise, if the fault data was successfully
 written to flash, you can use the "fault data" command to print it out. In
 either case, put the data in a file, and pass it to this program.
 
+Flash holds a history of fault records, and "fault data" prints all of them
+(or "fault data <seq>" prints one). In flash, the LWL and stack sections are
+compressed (MOD_MAGIC_LZ sections), and there can be erased areas between
+records. This program expands the compressed sections and skips the erased
+areas, and then decodes every record.
+
 For the lwl module, this program can interpret and format the output of the "lwl
-dump" command.
+dump" command. It can also decode a live LWL stream (see "lwl stream"), read
+from a serial device (configured beforehand, e.g. with stty) or a capture file,
+with the -s option. In that case it runs until the end of the input, or
+indefinitely for a device.
 
 This program does the following:
 - Searches through your source code to get metadata about the LWL statements
@@ -51,18 +60,34 @@ class Data:
 
     MOD_MAGIC_FAULT = 0xdead0001
     MOD_MAGIC_LWL = 0xf00d0001
+    MOD_MAGIC_LWL_TS = 0xf00d0002
     MOD_MAGIC_TRAILER = 0xc0da0001                  
+    MOD_MAGIC_STACK = 0x57ac0001
+    MOD_MAGIC_LZ = 0x1200c001
 
     SECTION_TYPE_FAULT = 0
     SECTION_TYPE_LWL = 1
     SECTION_TYPE_TRAILER = 2
+    SECTION_TYPE_LWL_TS = 3
+    SECTION_TYPE_STACK = 4
+    SECTION_TYPE_LZ = 5
 
     magic_to_fault_type = {
         MOD_MAGIC_FAULT : SECTION_TYPE_FAULT,
         MOD_MAGIC_LWL : SECTION_TYPE_LWL,
         MOD_MAGIC_TRAILER : SECTION_TYPE_TRAILER,
+        MOD_MAGIC_LWL_TS : SECTION_TYPE_LWL_TS,
+        MOD_MAGIC_STACK : SECTION_TYPE_STACK,
+        MOD_MAGIC_LZ : SECTION_TYPE_LZ,
         }
 
+    # Value of a word of erased flash.
+    FLASH_ERASED = 0xffffffff
+
+    # LZ compression tokens (see lz_compress() in fault.c).
+    LZ_MATCH = 0x80
+    LZ_MIN_MATCH = 3
+
     def __init__(self):
         self.data_array = bytearray()
         self.data_len = 0
@@ -141,6 +166,7 @@ class Data:
         """
 
         _log.debug('process_data()')
+        self.expand_sections()
         idx = 0
         section_type = 0
         section_len = 0
@@ -175,14 +201,117 @@ class Data:
                 g_fault_data.pretty_print(idx, section_len)
             elif section_type == self.SECTION_TYPE_LWL:
                 lwl_printer.pretty_print(idx, section_len)
+            elif section_type == self.SECTION_TYPE_LWL_TS:
+                lwl_printer.pretty_print(idx, section_len, timestamped=True)
+            elif section_type == self.SECTION_TYPE_STACK:
+                self.print_stack(idx, section_len)
             elif section_type == self.SECTION_TYPE_TRAILER:
+                lwl_printer.print_merged()
                 print('=' * 80)
                 print("End of fault data")
                 print('=' * 80)
             idx += section_len
 
+        lwl_printer.print_merged()
         return True
 
+    def expand_sections(self):
+        """
+        Expand compressed sections, and remove erased flash.
+
+        Compressed sections (MOD_MAGIC_LZ) are replaced by the sections they
+        expand to. Erased words between fault records are removed. If unknown
+        data is found, we print a warning and skip to the next fault record.
+        """
+
+        _log.debug('expand_sections()')
+        data = self.data_array
+        out = bytearray()
+        idx = 0
+
+        while idx + 8 <= len(data):
+            magic, section_len = struct.unpack_from('<II', data, idx)
+            if magic == self.FLASH_ERASED:
+                idx += 4
+                continue
+            if (magic not in self.magic_to_fault_type or section_len < 8 or
+                idx + section_len > len(data)):
+                next_idx = data.find(struct.pack('<I', self.MOD_MAGIC_FAULT),
+                                     idx + 4)
+                print('WARNING: Skipping unknown data at idx %d' % idx)
+                if next_idx < 0:
+                    idx = len(data)
+                    break
+                idx = next_idx
+                continue
+            if magic == self.MOD_MAGIC_LZ:
+                raw_len = struct.unpack_from('<I', data, idx + 8)[0]
+                expanded = self.lz_expand(data[idx + 12:idx + section_len],
+                                          raw_len)
+                if expanded is None:
+                    print('WARNING: Bad compressed section at idx %d' % idx)
+                else:
+                    _log.debug('Expanded section at idx %d from %d to %d bytes',
+                               idx, section_len, raw_len)
+                    out.extend(expanded)
+            else:
+                out.extend(data[idx:idx + section_len])
+            idx += section_len
+
+        out.extend(data[idx:])
+        self.data_array = out
+        self.data_len = len(out)
+
+    def lz_expand(self, data, raw_len):
+        """
+        Expand LZ compressed data.
+
+        Parameters:
+            data (bytearray) : The compressed data (can include padding).
+            raw_len (int)    : Number of bytes of expanded data.
+
+        Returns the expanded data, or None if the data is corrupt.
+        """
+
+        out = bytearray()
+        idx = 0
+        try:
+            while len(out) < raw_len:
+                token = data[idx]
+                idx += 1
+                if token < self.LZ_MATCH:
+                    out.extend(data[idx:idx + token + 1])
+                    idx += token + 1
+                else:
+                    length = (token & 0x7f) + self.LZ_MIN_MATCH
+                    dist = data[idx] | (data[idx + 1] << 8)
+                    idx += 2
+                    if dist == 0 or dist > len(out):
+                        return None
+                    # Copy a byte at a time, as the copy can overlap.
+                    for loop_counter in range(length):
+                        out.append(out[-dist])
+        except IndexError:
+            return None
+        return out[:raw_len]
+
+    def print_stack(self, section_offset, section_len):
+        """
+        Print the stack section.
+
+        Parameters:
+            section_offset (int) : Data array index of start of the section.
+            section_len (int)    : Length of segment in bytes.
+        """
+
+        print('=' * 80)
+        print('Stack')
+        print('=' * 80)
+        addr = self.get_data(section_offset + 8, 4)
+        for idx in range(12, section_len - 3, 4):
+            print('0x%08x: 0x%08x' % (addr + idx - 12,
+                                      self.get_data(section_offset + idx, 4)))
+
     def get_data(self, idx, num_bytes):
         """
         Return value from data array as an int.
@@ -449,13 +578,31 @@ g_lwl_msg_set = LwlMsgSet()
 
 class LwlPrinter:
 
-    def pretty_print(self, section_offset, section_len):
+    # Names of the LWL rings, in section order (see lwl.h).
+    ring_names = ['main', 'hi_rate']
+
+    # Time stamp byte value indicating a 2 byte time delta follows.
+    LWL_TS_EXT = 0xff
+
+    def __init__(self):
+        self.num_rings = 0
+        self.merged = []
+        self.ring_last_ms = []
+
+    def pretty_print(self, section_offset, section_len, timestamped=False):
         """
         Pretty print the LWL messages.
 
         Parameters:
             section_offset (int) : Data array index of start of the section.
             section_len (int)    : Length of segment in bytes.
+            timestamped (bool)   : True for a ring section (MOD_MAGIC_LWL_TS),
+                                   where each message ID is followed by a
+                                   time delta, and the put index word holds
+                                   the time of the last message.
+
+        For ring sections, the messages are not printed here, but saved to be
+        merged in time order with the other rings (see print_merged).
 
         Note that the "put index" is (was) the next location to be written, and
         thus is the oldest data in the circular buffer. This is where we
@@ -469,7 +616,14 @@ class LwlPrinter:
 
         # Following the section header (magic and length) 
         print('=' * 80)
-        print('LWL')
+        if timestamped:
+            ring = self.num_rings
+            self.num_rings += 1
+            ring_name = (self.ring_names[ring] if ring < len(self.ring_names)
+                         else str(ring))
+            print('LWL ring %s' % ring_name)
+        else:
+            print('LWL')
         print('=' * 80)
 
         # The section layout is as follows:
@@ -491,6 +645,12 @@ class LwlPrinter:
         buf_len = g_data.get_data(section_offset + 8, 4)
         put_idx = g_data.get_data(section_offset + 12, 4)
         buf_start_idx = section_offset + 16
+        last_ms = 0
+        ring_msgs = []
+        if timestamped:
+            last_ms = put_idx >> 16
+            # The put index is free running modulo 64K.
+            put_idx = put_idx & 0xffff & (buf_len - 1)
 
         _log.debug('pretty_print buf_len=%d put_idx=%d buf_start_idx=%d',
                    buf_len, put_idx, buf_start_idx)
@@ -502,7 +662,8 @@ class LwlPrinter:
             print('ERROR: Invalid lwl put_idx: %d')
             return
 
-        idx =  self.get_optimal_start_idx(buf_start_idx, buf_len, put_idx)
+        idx =  self.get_optimal_start_idx(buf_start_idx, buf_len, put_idx,
+                                          timestamped)
         first_get = True
         skipped_data = []
 
@@ -534,11 +695,20 @@ class LwlPrinter:
                         continue
                     break
 
-                # We have a potential ID, now get the arguments.
+                # We have a potential ID, now get the time delta (if present)
+                # and the arguments.
                 if skipped_data:
                     print('Skipped data (hex): %s' %
                           ' '.join(['%02x' % tmp for tmp in skipped_data]))
 
+                delta_ms = 0
+                if timestamped:
+                    delta_ms, idx = g_data.get_data_circ(
+                        idx, 1, buf_start_idx, buf_len, put_idx, first_get)
+                    if delta_ms == self.LWL_TS_EXT:
+                        delta_ms, idx = g_data.get_data_circ(
+                            idx, 2, buf_start_idx, buf_len, put_idx, first_get)
+
                 arg_values = []
                 for arg_bytes in msg_meta.arg_bytes:
                     arg_bytes = int(arg_bytes)
@@ -547,7 +717,10 @@ class LwlPrinter:
                         put_idx, first_get)
                     arg_values.append(arg_value)
                 _log.debug('id=%d arg_values=%s', id, arg_values)
-                print(msg_meta.fmt % tuple(arg_values))
+                if timestamped:
+                    ring_msgs.append((delta_ms, msg_meta.fmt % tuple(arg_values)))
+                else:
+                    print(msg_meta.fmt % tuple(arg_values))
                 _log.debug('----------------------------------------')
 
         except EOFError:
@@ -568,7 +741,57 @@ class LwlPrinter:
             print('Unused data (hex): %s' %
                   ' '.join(['%02x' % tmp for tmp in unused_data]))
 
-    def get_optimal_start_idx(self, buf_start_idx, buf_len, put_idx):
+        if timestamped:
+            # The time of the last message is known, so work backwards using
+            # the deltas to get the time of each message.
+            msg_ms = last_ms
+            ring_entries = []
+            for delta_ms, text in reversed(ring_msgs):
+                ring_entries.append((msg_ms, ring_name, text))
+                msg_ms -= delta_ms
+            ring_entries.reverse()
+            print('%d messages (merged below)' % len(ring_entries))
+            self.ring_last_ms.append(last_ms)
+            self.merged.append(ring_entries)
+
+    def print_merged(self):
+        """
+        Print the messages of all LWL rings, merged in time order.
+
+        Each ring's times are relative to the 16 bit ms time of its last message.
+        The rings are aligned assuming their last messages are within about 32
+        seconds of each other.
+        """
+
+        if not self.merged:
+            return
+
+        print('=' * 80)
+        print('LWL merged')
+        print('=' * 80)
+
+        ref_ms = max(self.ring_last_ms)
+        all_entries = []
+        for ring_entries, last_ms in zip(self.merged, self.ring_last_ms):
+            # Unwrap the 16 bit time relative to the reference.
+            adj_ms = ((last_ms - ref_ms + 0x8000) & 0xffff) - 0x8000
+            adj_ms = ref_ms + adj_ms - last_ms
+            for seq, (msg_ms, ring_name, text) in enumerate(ring_entries):
+                all_entries.append((msg_ms + adj_ms - ref_ms, seq, ring_name,
+                                    text))
+
+        # Sort by time, keeping the ring order for equal times. Times are
+        # printed relative to the last message.
+        all_entries.sort(key=lambda e: e[0])
+        for msg_ms, seq, ring_name, text in all_entries:
+            print('%8d ms %-8s %s' % (msg_ms, ring_name, text))
+
+        self.merged = []
+        self.ring_last_ms = []
+        self.num_rings = 0
+
+    def get_optimal_start_idx(self, buf_start_idx, buf_len, put_idx,
+                              timestamped=False):
         """
         Find the optimal starting index to decode log buffer.
 
@@ -576,6 +799,7 @@ class LwlPrinter:
             buf_start_idx (int) : Start of LWL buffer in the fault data.
             buf_len (int)       : Length of LWL buffer.
             put_idx (int)       : LWL buffer put_idx.
+            timestamped (bool)  : True if messages have a time delta.
 
         Return:
             The optimal starting index (>= put_idx)
@@ -599,7 +823,10 @@ class LwlPrinter:
         optimal_start_idx = None
         optimal_bytes_remaining = buf_len
 
-        for offset in range(g_lwl_msg_set.max_msg_len + 1):
+        max_msg_len = g_lwl_msg_set.max_msg_len
+        if timestamped:
+            max_msg_len += 3
+        for offset in range(max_msg_len + 1):
             start_idx = put_idx + offset
             if start_idx >= buf_len:
                 start_idx -= buf_len
@@ -627,12 +854,21 @@ class LwlPrinter:
 
                 _log.debug('Valid ID %d at idx %d', id, idx);
 
-                # The ID is valid. Try to get the argument bytes.
+                # The ID is valid. Try to get the time delta and argument
+                # bytes.
                 save_idx = idx
+                num_bytes = msg_meta.num_arg_bytes
+                if timestamped:
+                    try:
+                        ts, ts_idx = g_data.get_data_circ(
+                            idx, 1, buf_start_idx, buf_len, put_idx, first_get)
+                    except EOFError:
+                        break
+                    num_bytes += 3 if ts == self.LWL_TS_EXT else 1
                 bytes_left, idx = g_data.get_bytes_left_circ(
-                    idx, msg_meta.num_arg_bytes, buf_start_idx,
+                    idx, num_bytes, buf_start_idx,
                     buf_len, put_idx, first_get)
-                if bytes_left < msg_meta.num_arg_bytes:
+                if bytes_left < num_bytes:
                     _log.debug('Insufficient data for aguments')
                     # Add byte for ID.
                     bytes_left += 1
@@ -661,6 +897,142 @@ lwl_printer = LwlPrinter()
 
 ################################################################################
 
+class LwlStreamDecoder:
+    """
+    This class decodes a live LWL stream (see "lwl stream" in lwl.c for the
+    frame format).
+
+    Bytes that are not part of a valid frame (e.g. console output on the same
+    UART) are ignored. If a frame is lost (sequence number gap), the partial
+    log data of all rings is discarded, and sync with log boundaries is
+    re-established by skipping invalid IDs. If the target reports that a ring
+    overran the stream (resync frame), the ring's partial data is discarded and
+    its time base is restarted.
+    """
+
+    SYNC_1 = 0xa5
+    SYNC_2 = 0x5a
+    TYPE_TIME = 0x80
+    TYPE_RESYNC = 0x40
+    HDR_BYTES = 5
+
+    def __init__(self):
+        self.rx = bytearray()
+        self.expected_seq = None
+        self.ring_data = {}
+        self.ring_ms = {}
+        self.lost_frames = 0
+
+    def process_bytes(self, data):
+        """
+        Process received stream bytes, printing any complete logs.
+
+        Parameters:
+            data (bytes) : The received bytes.
+        """
+
+        self.rx.extend(data)
+        while True:
+            idx = self.rx.find(bytes([self.SYNC_1, self.SYNC_2]))
+            if idx < 0:
+                # Keep a possible first sync byte.
+                del self.rx[:max(0, len(self.rx) - 1)]
+                return
+            del self.rx[:idx]
+            if len(self.rx) < self.HDR_BYTES:
+                return
+            frame_len = self.HDR_BYTES + self.rx[4] + 1
+            if len(self.rx) < frame_len:
+                return
+            frame = self.rx[:frame_len]
+            if (sum(frame[2:-1]) & 0xff) != frame[-1]:
+                _log.debug('Bad stream frame checksum')
+                del self.rx[:1]
+                continue
+            del self.rx[:frame_len]
+            self.process_frame(frame[2], frame[3], frame[5:-1])
+
+    def process_frame(self, seq, frame_type, payload):
+        if self.expected_seq is not None and seq != self.expected_seq:
+            self.lost_frames += (seq - self.expected_seq) & 0xff
+            print('WARNING: Lost %d stream frame(s)' %
+                  ((seq - self.expected_seq) & 0xff))
+            for ring in self.ring_data:
+                self.ring_data[ring] = bytearray()
+        self.expected_seq = (seq + 1) & 0xff
+
+        if frame_type & (self.TYPE_TIME | self.TYPE_RESYNC):
+            ring = frame_type & ~(self.TYPE_TIME | self.TYPE_RESYNC)
+            if frame_type & self.TYPE_RESYNC:
+                print('WARNING: Ring %d overran the stream, logs lost' % ring)
+            now_ms = int.from_bytes(payload[0:4], 'big')
+            last_ms = int.from_bytes(payload[4:6], 'big')
+            self.ring_ms[ring] = now_ms - ((now_ms - last_ms) & 0xffff)
+            self.ring_data[ring] = bytearray()
+            return
+
+        ring = frame_type
+        data = self.ring_data.setdefault(ring, bytearray())
+        data.extend(payload)
+        self.decode_ring(ring)
+
+    def decode_ring(self, ring):
+        data = self.ring_data[ring]
+        ring_name = (LwlPrinter.ring_names[ring]
+                     if ring < len(LwlPrinter.ring_names) else str(ring))
+        while data:
+            msg_meta = g_lwl_msg_set.get_metadata(data[0])
+            if msg_meta is None:
+                print('Skipped data (hex): %02x' % data[0])
+                del data[:1]
+                continue
+            if len(data) < 2:
+                return
+            if data[1] == LwlPrinter.LWL_TS_EXT:
+                ts_bytes = 3
+                if len(data) < 4:
+                    return
+                delta_ms = (data[2] << 8) + data[3]
+            else:
+                ts_bytes = 1
+                delta_ms = data[1]
+            msg_len = 1 + ts_bytes + msg_meta.num_arg_bytes
+            if len(data) < msg_len:
+                return
+            idx = 1 + ts_bytes
+            arg_values = []
+            for arg_bytes in msg_meta.arg_bytes:
+                arg_bytes = int(arg_bytes)
+                arg_values.append(int.from_bytes(data[idx:idx + arg_bytes],
+                                                 'big'))
+                idx += arg_bytes
+            del data[:msg_len]
+            if ring in self.ring_ms:
+                self.ring_ms[ring] += delta_ms
+                print('%10d ms %-8s %s' % (self.ring_ms[ring], ring_name,
+                                           msg_meta.fmt % tuple(arg_values)))
+            else:
+                print('%10s    %-8s %s' % ('?', ring_name,
+                                           msg_meta.fmt % tuple(arg_values)))
+            sys.stdout.flush()
+
+    def decode_file(self, file_path):
+        """
+        Decode a stream from a file or device, until end of file.
+
+        Parameters:
+            file_path (str) : File or device path.
+        """
+
+        with open(file_path, 'rb', buffering=0) as f:
+            while True:
+                data = f.read(256)
+                if not data:
+                    break
+                self.process_bytes(data)
+
+################################################################################
+
 class SourceParser:
 
     def parse_source_dir(self, dir_path):
@@ -901,6 +1273,9 @@ def main():
                         help='Code directory to search for LWL statements and '
                         'fault metadata -- can specify multipe space-separated '
                         'directories, and can be used multiple times')
+    parser.add_argument('-s',
+                        help='LWL stream file or serial device (default=None)',
+                        default=None)
     parser.add_argument('--log',
                         help='notset|debug|info|warning|error|critical',
                         default='warning')
@@ -938,7 +1313,12 @@ def main():
     if error_count != 0:
         print('WARNING: Errors detected parsing source code')
 
-    if args.f is None:
+    if args.s is not None:
+        try:
+            LwlStreamDecoder().decode_file(args.s)
+        except FileNotFoundError:
+            print('ERROR: Cannot open file: %s' % args.s)
+    elif args.f is None:
         print('WARN: No data file provided.')
     else:
         try:
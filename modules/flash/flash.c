@@ -1,14 +1,45 @@
 /*
  * @brief Implementation of flash module.
  *
- * This module is for writing to flash memory. It only supports "panic" mode
- * operation, where interrupts are not used and blocking is allowed. In fact,
- * there are (unexpected) scenarios where a function could hang, and in this
- * case it is assumed a watchdog timer will force a reset.
+ * This module is for writing to flash memory. It supports two modes of
+ * operation:
+ * - "Panic" mode, where interrupts are not used and blocking is allowed. In
+ *   fact, there are (unexpected) scenarios where a function could hang, and in
+ *   this case it is assumed a watchdog timer will force a reset.
+ * - Asynchronous mode (see flash_erase_async() and flash_write_async()), where
+ *   operations are queued and return immediately. Each operation is started,
+ *   and then advanced one write unit at a time, from the flash interrupt
+ *   (EOP/error) or from polling in flash_run(), whichever sees the operation
+ *   is no longer busy first. The completion callback is called from
+ *   flash_run(). A panic operation aborts an active asynchronous operation.
+ *
+ * On parts with a single flash bank, the CPU still stalls on instruction
+ * fetches from flash while an erase or write unit is in progress, but the
+ * super loop gets control back between write units, and while waiting for the
+ * completion.
+ *
+ * It also provides a key/value store (see flash_kv_get() etc.) for persistent
+ * configuration and counters. This is log-structured over a ring of flash
+ * pages (CONFIG_FLASH_KV_NUM_PAGES, at CONFIG_FLASH_KV_BASE_ADDR, which the
+ * linker script must keep free):
+ * - Only one page, the one with the highest sequence number in its header, is
+ *   active. Updates are appended to it as records (header + value), so there
+ *   is no erase per update.
+ * - An index in RAM, built at startup, maps each key to its latest record, so
+ *   lookups read the value directly.
+ * - When the active page gets 3/4 full, flash_run() compacts it, copying the
+ *   live records to the next page in the ring, which spreads wear over all
+ *   the pages. The new page header is written last, so an interrupted
+ *   compaction leaves the old page active.
+ * - Each record has a CRC, so an interrupted write is detected at startup.
  *
  * The following console commands are provided:
  * > flash e (to erase)
  * > flash w (to write)
+ * > flash ea (to erase, asynchronously)
+ * > flash wa (to write, asynchronously)
+ * > flash kv (key/value store operations)
+ * > flash pm
  *
  * See code for details.
  *
@@ -43,12 +74,14 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "config.h"
 #include CONFIG_STM32_LL_CORTEX_HDR
 
 #include "cmd.h"
 #include "console.h"
+#include "crc.h"
 #include "flash.h"
 #include "log.h"
 #include "module.h"
@@ -108,6 +141,7 @@
 #elif CONFIG_FLASH_TYPE == 4 // Example: STM32U575xx
 
 #define FLASH_SR_BSY_Msk FLASH_NSSR_BSY_Msk
+#define FLASH_SR_EOP_Msk FLASH_NSSR_EOP_Msk
 
 #define FLASH_ERR_MASK (FLASH_NSSR_OPERR_Msk |      \
                         FLASH_NSSR_PROGERR_Msk |    \
@@ -135,6 +169,8 @@
 #define FLASH_CR_BKER_Msk FLASH_NSCR_BKER_Msk
 #define FLASH_CR_BKER_Pos FLASH_NSCR_BKER_Pos
 #define FLASH_CR_PER_Msk FLASH_NSCR_PER_Msk
+#define FLASH_CR_EOPIE_Msk FLASH_NSCR_EOPIE_Msk
+#define FLASH_CR_ERRIE_Msk FLASH_NSCR_ERRIE_Msk
 #define FLASH_SR_WDW_Msk FLASH_NSSR_WDW_Msk
 
 #define FLASH_SR FLASH->NSSR
@@ -161,17 +197,147 @@
     #define FLASH_KEY2 0xCDEF89ABU                   
 #endif
 
+#if CONFIG_FLASH_KV_NUM_PAGES >= 2
+    #define FLASH_KV_PRESENT 1
+#endif
+
+#define FLASH_WRITE_WORDS (CONFIG_FLASH_WRITE_BYTES / 4)
+
+#if FLASH_KV_PRESENT
+
+#if CONFIG_FLASH_KV_MAX_VALUE_LEN > 255
+    #error CONFIG_FLASH_KV_MAX_VALUE_LEN too large
+#endif
+
+// Records (and the page header) take whole flash write units.
+#define KV_UNIT CONFIG_FLASH_WRITE_BYTES
+
+#define KV_PAGE_ADDR(page) \
+    (CONFIG_FLASH_KV_BASE_ADDR + (page) * CONFIG_FLASH_KV_PAGE_SIZE)
+#define KV_END_ADDR KV_PAGE_ADDR(CONFIG_FLASH_KV_NUM_PAGES)
+#define KV_REC_SIZE(len) (KV_UNIT + (((len) + KV_UNIT - 1) & ~(KV_UNIT - 1)))
+
+// The live records are limited to half a page, and compaction starts when the
+// active page is 3/4 full. This leaves room for updates during compaction,
+// and means compaction always frees at least 1/4 of a page.
+#define KV_PAGE_CAPACITY ((CONFIG_FLASH_KV_PAGE_SIZE - KV_UNIT) / 2)
+#define KV_COMPACT_THRESHOLD (CONFIG_FLASH_KV_PAGE_SIZE * 3 / 4)
+
+#define KV_PAGE_MAGIC 0x4b565031
+#define KV_ERASED_32 0xffffffff
+#define KV_ERASED_16 0xffff
+#define KV_FLAGS_VALID 0x5a
+#define KV_FLAGS_DELETED 0xa5
+
+// Check the flash layout in config.h. The firmware image is checked against
+// the store at startup (see kv_init()), as its size is only known at link
+// time.
+_Static_assert(CONFIG_FLASH_KV_BASE_ADDR >= CONFIG_FLASH_BASE_ADDR &&
+               KV_END_ADDR <= CONFIG_FLASH_BASE_ADDR + CONFIG_FLASH_SIZE,
+               "KV store not within flash");
+#ifdef CONFIG_FAULT_FLASH_PANIC_ADDR
+_Static_assert(KV_END_ADDR <= CONFIG_FAULT_FLASH_PANIC_ADDR ||
+               CONFIG_FAULT_FLASH_PANIC_ADDR +
+               CONFIG_FAULT_FLASH_NUM_PAGES * CONFIG_FAULT_FLASH_PAGE_SIZE <=
+               CONFIG_FLASH_KV_BASE_ADDR,
+               "KV store overlaps fault records");
+#endif
+
+#endif // FLASH_KV_PRESENT
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+// Asynchronous operation. If data is NULL, it is an erase.
+struct async_op {
+    uint32_t* addr;
+    const uint8_t* data;
+    uint32_t len;
+    uint32_t offset; // Bytes written so far.
+    flash_done_cb cb;
+    void* user_data;
+    int32_t rc;
+};
+
+// Asynchronous operation queue. The counters are free running, and ops are
+// in order: completed (cb_ctr to active_ctr), active (active_ctr, if active
+// is true), and waiting (to put_ctr).
+struct async_state {
+    struct async_op ops[CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+    uint32_t put_ctr;
+    uint32_t active_ctr;
+    uint32_t cb_ctr;
+    bool active;
+};
+
+#if FLASH_KV_PRESENT
+
+// Key/value store page header, at the start of the page.
+struct kv_page_hdr {
+    uint32_t magic;
+    uint32_t seq;
+};
+
+// Key/value store record header. The value follows in the next write unit.
+struct kv_rec_hdr {
+    uint16_t key;
+    uint8_t len;
+    uint8_t flags;
+    uint32_t crc;
+};
+
+struct kv_index_entry {
+    uint32_t addr; // Record address.
+    uint16_t key;
+    uint8_t len;
+};
+
+struct kv_state {
+    bool ready;
+    bool compact_pending;
+    bool compacting;
+    bool erasing; // Compaction target page erase in progress.
+    uint32_t active_page;
+    uint32_t seq;
+    uint32_t write_addr;
+    uint32_t live_bytes; // Total size of live records.
+    uint32_t target_page;
+    uint32_t target_write_addr;
+    uint32_t num_keys;
+    struct kv_index_entry index[CONFIG_FLASH_KV_MAX_KEYS]; // Sorted by key.
+};
+
+#endif // FLASH_KV_PRESENT
+
+enum flash_u16_pms {
+    CNT_KV_WRITE,
+    CNT_KV_COMPACT,
+    CNT_KV_BAD_REC,
+    CNT_KV_COMPACT_ERR,
+    CNT_ASYNC_OP,
+    CNT_ASYNC_ERR,
+    CNT_ASYNC_ABORT,
+    CNT_ASYNC_QUEUE_FULL,
+
+    NUM_U16_PMS
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
 static void flash_unlock(void);
-static void flash_panic_op_start(void);
-static void flash_panic_op_complete(void);
+static void flash_op_start(void);
+static void flash_op_complete(void);
+static int32_t erase_setup(uint32_t* start_addr);
+static void write_unit(uint32_t* flash_addr, const uint32_t* data);
+static int32_t async_put(uint32_t* addr, const void* data, uint32_t len,
+                         flash_done_cb cb, void* user_data);
+static void async_kick(void);
+static void async_service(void);
+static void async_abort(void);
+static void async_write_next_unit(struct async_op* op);
 static int32_t addr_to_page_num(uint32_t* addr);
 
 #if CONFIG_FLASH_TYPE == 4
@@ -180,6 +346,28 @@ static int32_t addr_to_bank_num(uint32_t* addr);
 
 static int32_t cmd_flash_erase(int32_t argc, const char** argv);
 static int32_t cmd_flash_write(int32_t argc, const char** argv);
+static int32_t cmd_flash_erase_async(int32_t argc, const char** argv);
+static int32_t cmd_flash_write_async(int32_t argc, const char** argv);
+static void cmd_async_done(int32_t rc, void* user_data);
+
+#if FLASH_KV_PRESENT
+static int32_t kv_init(void);
+static int32_t kv_compact_step(void);
+static void kv_compact_abort(void);
+static int32_t kv_format_page(uint32_t page, uint32_t seq);
+static int32_t kv_append(uint16_t key, uint8_t flags, const void* data,
+                         uint32_t len, uint32_t* addr);
+static int32_t kv_write_rec(uint32_t addr, uint16_t key, uint8_t flags,
+                            const void* data, uint32_t len);
+static uint32_t kv_rec_crc(uint16_t key, uint8_t flags, const void* data,
+                           uint32_t len);
+static bool kv_is_erased(uint32_t start_addr, uint32_t end_addr);
+static void kv_erase_done(int32_t rc, void* user_data);
+static int32_t kv_index_find(uint16_t key);
+static void kv_index_insert(uint16_t key, uint32_t addr, uint32_t len);
+static void kv_index_remove(int32_t idx);
+static int32_t cmd_flash_kv(int32_t argc, const char** argv);
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -197,6 +385,35 @@ uint32_t last_op_error_mask = 0;
 
 static int32_t log_level = LOG_DEFAULT;
 
+static struct async_state async;
+
+// Data for the "flash wa" command, which must stay valid until completion.
+static uint32_t cmd_async_data[7];
+
+#if FLASH_KV_PRESENT
+static struct kv_state kv;
+
+// These symbols are defined in the linker script.
+extern uint32_t _sidata;
+extern uint32_t _sdata;
+extern uint32_t _edata;
+#endif
+
+// Storage for performance measurements.
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+// Names of performance measurements.
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "kv write",
+    "kv compact",
+    "kv bad rec",
+    "kv compact err",
+    "async op",
+    "async err",
+    "async abort",
+    "async queue full",
+};
+
 static struct cmd_cmd_info cmds[] = {
     {
         .name = "e",
@@ -208,6 +425,23 @@ static struct cmd_cmd_info cmds[] = {
         .func = cmd_flash_write,
         .help = "Write flash: usage: flash w addr value(32) ...",
     },
+    {
+        .name = "ea",
+        .func = cmd_flash_erase_async,
+        .help = "Erase flash asynchronously: usage: flash ea addr",
+    },
+    {
+        .name = "wa",
+        .func = cmd_flash_write_async,
+        .help = "Write flash asynchronously: usage: flash wa addr value(32) ...",
+    },
+#if FLASH_KV_PRESENT
+    {
+        .name = "kv",
+        .func = cmd_flash_kv,
+        .help = "Key/value store, usage: flash kv [<op> [<arg>]] (enter no op for help)",
+    },
+#endif
 };
 
 static struct cmd_client_info cmd_info = {
@@ -215,6 +449,9 @@ static struct cmd_client_info cmd_info = {
     .num_cmds = ARRAY_SIZE(cmds),
     .cmds = cmds,
     .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -231,6 +468,7 @@ static struct cmd_client_info cmd_info = {
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
  *
  * This function starts the flash singleton module, to enter normal operation.
+ * This includes building the key/value store index.
  */
 int32_t flash_start(void)
 {
@@ -242,6 +480,57 @@ int32_t flash_start(void)
         return rc;
     }
 
+    NVIC_SetPriority(FLASH_IRQn,
+                     NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+    NVIC_EnableIRQ(FLASH_IRQn);
+
+#if FLASH_KV_PRESENT
+    rc = kv_init();
+    if (rc != 0) {
+        log_error("flash_start: kv_init error %ld\n", rc);
+        return rc;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * @brief Run flash instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function runs the flash singleton module, during normal operation. It
+ * polls the active asynchronous operation (in case the interrupt was missed),
+ * calls the callbacks of completed operations, and performs key/value store
+ * compaction, one step per call.
+ */
+int32_t flash_run(void)
+{
+    async_service();
+
+    while (async.cb_ctr != async.active_ctr) {
+        struct async_op* op =
+            &async.ops[async.cb_ctr % CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+        // Copy the op, so the slot can be reused by the callback.
+        struct async_op done = *op;
+
+        async.cb_ctr++;
+        if (done.cb != NULL)
+            done.cb(done.rc, done.user_data);
+    }
+
+#if FLASH_KV_PRESENT
+    int32_t rc;
+
+    if (kv.ready && (kv.compact_pending || kv.compacting)) {
+        rc = kv_compact_step();
+        if (rc != 0) {
+            INC_SAT_U16(cnts_u16[CNT_KV_COMPACT_ERR]);
+            return rc;
+        }
+    }
+#endif
     return 0;
 }
 
@@ -258,6 +547,7 @@ int32_t flash_start(void)
  */
 int32_t flash_panic_erase_page(uint32_t* start_addr)
 {
+    int32_t rc;
     int32_t page_num = addr_to_page_num(start_addr);
     if (page_num < 0)
         return page_num;
@@ -265,48 +555,17 @@ int32_t flash_panic_erase_page(uint32_t* start_addr)
     log_debug("flash panic erase start_addr=0x%08x page_num=%ld\n",
               (unsigned)start_addr, page_num);
 
+    async_abort();
+
     // Check that no flash main memory operation is ongoing.
     if (FLASH_SR & FLASH_SR_BSY_Msk)
         return MOD_ERR_BUSY;
 
-    flash_panic_op_start();
-
-#if CONFIG_FLASH_TYPE == 1 // Example: STM32L452xx 
-
-    // Select the page in FLASH->CR;
-    FLASH_CR = (FLASH_CR & (~FLASH_CR_PNB_Msk)) |
-        (page_num << FLASH_CR_PNB_Pos);
-
-    // Set the PER bit in FLASH->CR.
-    FLASH_CR |= FLASH_CR_PER_Msk;
-
-#elif CONFIG_FLASH_TYPE == 2 // Example: STM32F401xE
-
-    // Select the SER bit and sector in FLASH->CR;
-    FLASH_CR = (FLASH_CR & (~FLASH_CR_SNB_Msk)) |
-        ((page_num << FLASH_CR_SNB_Pos) | FLASH_CR_SER_Msk);
-
-#elif CONFIG_FLASH_TYPE == 3 // Example: STM32F103xB
-
-    #error TODO STM32F103xB
-
-#elif CONFIG_FLASH_TYPE == 4 // Example: STM32U575xx
-
-    {
-        int32_t bank_num = addr_to_bank_num(start_addr);
-        if (bank_num < 0)
-            return bank_num;
-
-        // Select the page and bank in FLASH->CR;
-        FLASH_CR = (FLASH_CR & (~(FLASH_CR_PNB_Msk | FLASH_CR_BKER_Msk))) |
-            (FLASH_CR_PER_Msk |
-             (page_num << FLASH_CR_PNB_Pos) |
-             (bank_num << FLASH_CR_BKER_Pos));
-    }
+    flash_op_start();
 
-#else
-    #error Unknown procesor
-#endif
+    rc = erase_setup(start_addr);
+    if (rc != 0)
+        return rc;
 
     // Start the erase.
     FLASH_CR |= FLASH_CR_STRT_Msk;
@@ -314,7 +573,7 @@ int32_t flash_panic_erase_page(uint32_t* start_addr)
     // Wait for BSY bit to be cleared in FLASH->SR.
     while (FLASH_SR & FLASH_SR_BSY_Msk) {}
 
-    flash_panic_op_complete();
+    flash_op_complete();
 
     if (last_op_error_mask != 0)
         return MOD_ERR_PERIPH;
@@ -343,6 +602,8 @@ int32_t flash_panic_write(uint32_t* flash_addr, uint32_t* data,
         (data_len & FLASH_WRITE_BYTES_MASK))
         return MOD_ERR_ARG;
 
+    async_abort();
+
     // Check that no flash main memory operation is ongoing.
     if (FLASH_SR & FLASH_SR_BSY_Msk)
         return MOD_ERR_BUSY;
@@ -353,20 +614,15 @@ int32_t flash_panic_write(uint32_t* flash_addr, uint32_t* data,
             return MOD_ERR_PERIPH;
     #endif
 
-    flash_panic_op_start();
+    flash_op_start();
 
     // Set the program bit.
     FLASH_CR |= FLASH_CR_PG_Msk;
 
     for (; data_len > 0; data_len -= CONFIG_FLASH_WRITE_BYTES) {
-        // Write the data to flash.
-        *flash_addr++ = *data++;
-        *flash_addr++ = *data++;
-
-        #if CONFIG_FLASH_WRITE_BYTES == 16
-            *flash_addr++ = *data++;
-            *flash_addr++ = *data++;
-        #endif
+        write_unit(flash_addr, data);
+        flash_addr += FLASH_WRITE_WORDS;
+        data += FLASH_WRITE_WORDS;
 
         // Wait until busy is cleared.
         while (FLASH_SR & FLASH_SR_BSY_Msk) {}
@@ -379,7 +635,7 @@ int32_t flash_panic_write(uint32_t* flash_addr, uint32_t* data,
         // Since EOP interrupts are not enabled, we don't check/clear it.
     }
 
-    flash_panic_op_complete();
+    flash_op_complete();
 
     if (last_op_error_mask != 0)
         return MOD_ERR_PERIPH;
@@ -387,6 +643,196 @@ int32_t flash_panic_write(uint32_t* flash_addr, uint32_t* data,
     return 0;
 }
 
+/*
+ * @brief Queue an asynchronous erase of a single page of memory.
+ *
+ * @param[in] start_addr Starting address in flash (must be on page boundary).
+ * @param[in] cb Function called from flash_run() on completion (can be NULL).
+ * @param[in] user_data Passed to cb.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function does not block. The result of the erase is passed to cb.
+ */
+int32_t flash_erase_async(uint32_t* start_addr, flash_done_cb cb,
+                          void* user_data)
+{
+    int32_t rc = addr_to_page_num(start_addr);
+    if (rc < 0)
+        return rc;
+#if CONFIG_FLASH_TYPE == 4
+    rc = addr_to_bank_num(start_addr);
+    if (rc < 0)
+        return rc;
+#endif
+    return async_put(start_addr, NULL, 0, cb, user_data);
+}
+
+/*
+ * @brief Queue an asynchronous data write.
+ *
+ * @param[in] flash_addr Starting address in flash (must be on N-byte boundary).
+ * @param[in] data Pointer to data to write (any alignment).
+ * @param[in] data_len Number of bytes of data (> 0). If not a multiple of N,
+ *                     the last unit is padded with 0xff.
+ * @param[in] cb Function called from flash_run() on completion (can be NULL).
+ * @param[in] user_data Passed to cb.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note The data is not copied, so it must stay valid until completion.
+ *
+ * This function does not block. The result of the write is passed to cb.
+ */
+int32_t flash_write_async(uint32_t* flash_addr, const void* data,
+                          uint32_t data_len, flash_done_cb cb, void* user_data)
+{
+    if ((((uint32_t)flash_addr) & FLASH_WRITE_BYTES_MASK) || data == NULL ||
+        data_len == 0)
+        return MOD_ERR_ARG;
+    return async_put(flash_addr, data, data_len, cb, user_data);
+}
+
+/*
+ * @brief Check if there are no asynchronous operations pending.
+ *
+ * @return true if all asynchronous operations are complete, and their
+ *         callbacks have been called.
+ */
+bool flash_async_idle(void)
+{
+    return async.cb_ctr == async.put_ctr;
+}
+
+/*
+ * @brief Flash interrupt handler.
+ *
+ * Called on end of operation or error, while an asynchronous operation is
+ * active.
+ */
+void FLASH_IRQHandler(void)
+{
+    async_service();
+}
+
+#if FLASH_KV_PRESENT
+
+/*
+ * @brief Get the value of a key from the key/value store.
+ *
+ * @param[in] key The key (0 to FLASH_KV_KEY_MAX).
+ * @param[out] buf Buffer for the value.
+ * @param[in] buf_len Size of buf. If the value is longer, it is truncated.
+ *
+ * @return Length of the value (>= 0) for success, else a "MOD_ERR" value. See
+ *         code for details. MOD_ERR_UNAVAIL means the key is not present.
+ *
+ * This uses the RAM index, and then reads the value directly from flash.
+ */
+int32_t flash_kv_get(uint16_t key, void* buf, uint32_t buf_len)
+{
+    int32_t idx;
+    struct kv_index_entry* entry;
+
+    if (!kv.ready)
+        return MOD_ERR_STATE;
+    if (buf == NULL && buf_len > 0)
+        return MOD_ERR_ARG;
+
+    idx = kv_index_find(key);
+    if (idx < 0)
+        return MOD_ERR_UNAVAIL;
+    entry = &kv.index[idx];
+    memcpy(buf, (uint8_t*)(entry->addr + KV_UNIT),
+           entry->len < buf_len ? entry->len : buf_len);
+    return entry->len;
+}
+
+/*
+ * @brief Set the value of a key in the key/value store.
+ *
+ * @param[in] key The key (0 to FLASH_KV_KEY_MAX).
+ * @param[in] data The value.
+ * @param[in] len Length of the value (up to CONFIG_FLASH_KV_MAX_VALUE_LEN).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The new value is appended to the active page, and there is no erase. If the
+ * value is unchanged, nothing is written. When the active page gets full
+ * enough, compaction is started (see flash_run()).
+ */
+int32_t flash_kv_set(uint16_t key, const void* data, uint32_t len)
+{
+    int32_t idx;
+    int32_t rc;
+    uint32_t addr;
+
+    if (!kv.ready)
+        return MOD_ERR_STATE;
+    if (key > FLASH_KV_KEY_MAX || len > CONFIG_FLASH_KV_MAX_VALUE_LEN ||
+        (data == NULL && len > 0))
+        return MOD_ERR_ARG;
+
+    idx = kv_index_find(key);
+    if (idx >= 0) {
+        struct kv_index_entry* entry = &kv.index[idx];
+        if (entry->len == len &&
+            memcmp((uint8_t*)(entry->addr + KV_UNIT), data, len) == 0)
+            return 0;
+        if (kv.live_bytes - KV_REC_SIZE(entry->len) + KV_REC_SIZE(len) >
+            KV_PAGE_CAPACITY)
+            return MOD_ERR_RESOURCE;
+    } else {
+        if (kv.num_keys >= CONFIG_FLASH_KV_MAX_KEYS ||
+            kv.live_bytes + KV_REC_SIZE(len) > KV_PAGE_CAPACITY)
+            return MOD_ERR_RESOURCE;
+    }
+
+    rc = kv_append(key, KV_FLAGS_VALID, data, len, &addr);
+    if (rc != 0)
+        return rc;
+    if (idx >= 0) {
+        kv.live_bytes += KV_REC_SIZE(len) - KV_REC_SIZE(kv.index[idx].len);
+        kv.index[idx].addr = addr;
+        kv.index[idx].len = len;
+    } else {
+        kv.live_bytes += KV_REC_SIZE(len);
+        kv_index_insert(key, addr, len);
+    }
+    return 0;
+}
+
+/*
+ * @brief Delete a key from the key/value store.
+ *
+ * @param[in] key The key.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * A deletion record is appended, so the key stays deleted after a restart.
+ */
+int32_t flash_kv_delete(uint16_t key)
+{
+    int32_t idx;
+    int32_t rc;
+    uint32_t addr;
+
+    if (!kv.ready)
+        return MOD_ERR_STATE;
+
+    idx = kv_index_find(key);
+    if (idx < 0)
+        return 0;
+    rc = kv_append(key, KV_FLAGS_DELETED, NULL, 0, &addr);
+    if (rc != 0)
+        return rc;
+    kv.live_bytes -= KV_REC_SIZE(kv.index[idx].len);
+    kv_index_remove(idx);
+    return 0;
+}
+
+#endif // FLASH_KV_PRESENT
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -403,11 +849,11 @@ static void flash_unlock(void)
 }
 
 /*
- * @brief Panic operations start.
+ * @brief Operations start.
  *
  * Prepares flash for erase/write operations.
  */
-static void flash_panic_op_start(void)
+static void flash_op_start(void)
 {
     flash_unlock();
 
@@ -449,12 +895,12 @@ static void flash_panic_op_start(void)
 }
 
 /*
- * @brief Panic operations complete.
+ * @brief Operations complete.
  *
  * Restores flash after erase/write operations (should only be called after
- * calling flash_panic_op_start()).
+ * calling flash_op_start()).
  */
-static void flash_panic_op_complete(void)
+static void flash_op_complete(void)
 {
     // Save the error flags, and then clear them.
     last_op_error_mask = FLASH_SR & FLASH_ERR_MASK;
@@ -491,6 +937,249 @@ static void flash_panic_op_complete(void)
 #endif
 }
 
+/*
+ * @brief Set up the flash control register for a page erase.
+ *
+ * @param[in] start_addr Starting address in flash (must be on page boundary).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This selects the page, but does not start the erase. It should be called
+ * after flash_op_start().
+ */
+static int32_t erase_setup(uint32_t* start_addr)
+{
+    int32_t page_num = addr_to_page_num(start_addr);
+    if (page_num < 0)
+        return page_num;
+
+#if CONFIG_FLASH_TYPE == 1 // Example: STM32L452xx 
+
+    // Select the page in FLASH->CR;
+    FLASH_CR = (FLASH_CR & (~FLASH_CR_PNB_Msk)) |
+        (page_num << FLASH_CR_PNB_Pos);
+
+    // Set the PER bit in FLASH->CR.
+    FLASH_CR |= FLASH_CR_PER_Msk;
+
+#elif CONFIG_FLASH_TYPE == 2 // Example: STM32F401xE
+
+    // Select the SER bit and sector in FLASH->CR;
+    FLASH_CR = (FLASH_CR & (~FLASH_CR_SNB_Msk)) |
+        ((page_num << FLASH_CR_SNB_Pos) | FLASH_CR_SER_Msk);
+
+#elif CONFIG_FLASH_TYPE == 3 // Example: STM32F103xB
+
+    #error TODO STM32F103xB
+
+#elif CONFIG_FLASH_TYPE == 4 // Example: STM32U575xx
+
+    {
+        int32_t bank_num = addr_to_bank_num(start_addr);
+        if (bank_num < 0)
+            return bank_num;
+
+        // Select the page and bank in FLASH->CR;
+        FLASH_CR = (FLASH_CR & (~(FLASH_CR_PNB_Msk | FLASH_CR_BKER_Msk))) |
+            (FLASH_CR_PER_Msk |
+             (page_num << FLASH_CR_PNB_Pos) |
+             (bank_num << FLASH_CR_BKER_Pos));
+    }
+
+#else
+    #error Unknown procesor
+#endif
+
+    return 0;
+}
+
+/*
+ * @brief Write one unit (CONFIG_FLASH_WRITE_BYTES) to flash.
+ *
+ * @param[in] flash_addr Address in flash (must be on N-byte boundary).
+ * @param[in] data The data.
+ *
+ * The program bit must already be set.
+ */
+static void write_unit(uint32_t* flash_addr, const uint32_t* data)
+{
+    *flash_addr++ = *data++;
+    *flash_addr++ = *data++;
+
+    #if CONFIG_FLASH_WRITE_BYTES == 16
+        *flash_addr++ = *data++;
+        *flash_addr++ = *data++;
+    #endif
+}
+
+/*
+ * @brief Add an operation to the asynchronous queue, and start it if the
+ *        queue was empty.
+ *
+ * @param[in] addr Address in flash.
+ * @param[in] data Data to write, or NULL for an erase.
+ * @param[in] len Length of data.
+ * @param[in] cb Completion callback.
+ * @param[in] user_data Passed to cb.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t async_put(uint32_t* addr, const void* data, uint32_t len,
+                         flash_done_cb cb, void* user_data)
+{
+    struct async_op* op;
+    CRIT_STATE_VAR;
+
+    CRIT_BEGIN_NEST();
+    if (async.put_ctr - async.cb_ctr >= CONFIG_FLASH_ASYNC_QUEUE_SIZE) {
+        CRIT_END_NEST();
+        INC_SAT_U16(cnts_u16[CNT_ASYNC_QUEUE_FULL]);
+        return MOD_ERR_RESOURCE;
+    }
+    op = &async.ops[async.put_ctr % CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+    op->addr = addr;
+    op->data = data;
+    op->len = len;
+    op->offset = 0;
+    op->cb = cb;
+    op->user_data = user_data;
+    op->rc = 0;
+    async.put_ctr++;
+    async_kick();
+    CRIT_END_NEST();
+    INC_SAT_U16(cnts_u16[CNT_ASYNC_OP]);
+    return 0;
+}
+
+/*
+ * @brief Start the next asynchronous operation, if there is one and none is
+ *        active.
+ *
+ * @note Must be called in a critical region.
+ */
+static void async_kick(void)
+{
+    struct async_op* op;
+    int32_t rc;
+
+    while (!async.active && async.active_ctr != async.put_ctr) {
+        // Something else (e.g. a debugger) is using flash; try again later
+        // from flash_run().
+        if (FLASH_SR & FLASH_SR_BSY_Msk)
+            return;
+
+        op = &async.ops[async.active_ctr % CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+        flash_op_start();
+        if (op->data == NULL) {
+            rc = erase_setup(op->addr);
+            if (rc != 0) {
+                flash_op_complete();
+                op->rc = rc;
+                async.active_ctr++;
+                continue;
+            }
+            FLASH_CR |= FLASH_CR_EOPIE_Msk | FLASH_CR_ERRIE_Msk;
+            FLASH_CR |= FLASH_CR_STRT_Msk;
+        } else {
+            FLASH_CR |= (FLASH_CR_PG_Msk | FLASH_CR_EOPIE_Msk |
+                         FLASH_CR_ERRIE_Msk);
+            async_write_next_unit(op);
+        }
+        async.active = true;
+    }
+}
+
+/*
+ * @brief Advance the active asynchronous operation, if it is no longer busy.
+ *
+ * Called from the flash interrupt handler, and polled from flash_run().
+ */
+static void async_service(void)
+{
+    struct async_op* op;
+    uint32_t err;
+    CRIT_STATE_VAR;
+
+    CRIT_BEGIN_NEST();
+    if (!async.active || (FLASH_SR & FLASH_SR_BSY_Msk)) {
+        if (!async.active)
+            async_kick();
+        CRIT_END_NEST();
+        return;
+    }
+
+    op = &async.ops[async.active_ctr % CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+    err = FLASH_SR & FLASH_ERR_MASK;
+    // Clear EOP (write 1 to clear).
+    FLASH_SR = FLASH_SR_EOP_Msk;
+
+#if CONFIG_FLASH_TYPE == 4
+    // A write is unexpectedly waiting for more data.
+    if (FLASH_SR & FLASH_SR_WDW_Msk)
+        err |= FLASH_SR_WDW_Msk;
+#endif
+
+    if (err == 0 && op->data != NULL && op->offset < op->len) {
+        async_write_next_unit(op);
+        CRIT_END_NEST();
+        return;
+    }
+
+    flash_op_complete();
+    if (err != 0) {
+        last_op_error_mask |= err;
+        op->rc = MOD_ERR_PERIPH;
+        INC_SAT_U16(cnts_u16[CNT_ASYNC_ERR]);
+    }
+    async.active = false;
+    async.active_ctr++;
+    async_kick();
+    CRIT_END_NEST();
+}
+
+/*
+ * @brief Abort the active asynchronous operation, if any, so a panic operation
+ *        can use flash. Waiting operations are left in the queue.
+ */
+static void async_abort(void)
+{
+    struct async_op* op;
+    CRIT_STATE_VAR;
+
+    CRIT_BEGIN_NEST();
+    if (async.active) {
+        while (FLASH_SR & FLASH_SR_BSY_Msk) {}
+        flash_op_complete();
+        op = &async.ops[async.active_ctr % CONFIG_FLASH_ASYNC_QUEUE_SIZE];
+        op->rc = MOD_ERR_STATE;
+        async.active = false;
+        async.active_ctr++;
+        INC_SAT_U16(cnts_u16[CNT_ASYNC_ABORT]);
+    }
+    CRIT_END_NEST();
+}
+
+/*
+ * @brief Write the next unit of an asynchronous write operation.
+ *
+ * @param[in] op The operation.
+ *
+ * The data has any alignment, and the last unit might be partial, so the unit
+ * is copied and padded.
+ */
+static void async_write_next_unit(struct async_op* op)
+{
+    uint32_t unit[FLASH_WRITE_WORDS];
+    uint32_t len = op->len - op->offset;
+
+    if (len > CONFIG_FLASH_WRITE_BYTES)
+        len = CONFIG_FLASH_WRITE_BYTES;
+    memset(unit, 0xff, sizeof(unit));
+    memcpy(unit, op->data + op->offset, len);
+    write_unit(op->addr + op->offset / 4, unit);
+    op->offset += CONFIG_FLASH_WRITE_BYTES;
+}
+
 /*
  * @brief Convert flash addrss to page number. The term "sector" might be used
  *        instead of "page".
@@ -531,7 +1220,7 @@ static int32_t addr_to_page_num(uint32_t* addr)
         0x08040000,
         0x08060000,
     };
-    for (page_num = 0; page_num <= ARRAY_SIZE(sector_addr); page_num++) {
+    for (page_num = 0; page_num < ARRAY_SIZE(sector_addr); page_num++) {
         if ((uint32_t)addr == sector_addr[page_num])
             return page_num;
     }
@@ -621,3 +1310,601 @@ static int32_t cmd_flash_write(int32_t argc, const char** argv)
     printc("rc=%ld\n", rc);
     return rc;
 }
+
+/*
+ * @brief Console command function for "flash ea".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash ea addr
+ */
+static int32_t cmd_flash_erase_async(int32_t argc, const char** argv)
+{
+    int32_t rc;
+    struct cmd_arg_val arg_vals[1];
+
+    rc = cmd_parse_args(argc-2, argv+2, "p", arg_vals);
+    if (rc != 1)
+        return rc;
+
+    rc = flash_erase_async(arg_vals[0].val.p, cmd_async_done, "erase");
+    printc("rc=%ld\n", rc);
+    return rc;
+}
+
+/*
+ * @brief Console command function for "flash wa".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash wa addr value(32) ...
+ *
+ * From 1 to 7 words can be written (the last unit is padded).
+ */
+static int32_t cmd_flash_write_async(int32_t argc, const char** argv)
+{
+    int32_t num_args;
+    struct cmd_arg_val arg_vals[ARRAY_SIZE(cmd_async_data) + 1];
+    int idx;
+    int32_t rc;
+
+    // The data buffer is shared, so only one write at a time.
+    if (!flash_async_idle()) {
+        printc("Asynchronous operation in progress\n");
+        return MOD_ERR_BUSY;
+    }
+    num_args = cmd_parse_args(argc-2, argv+2, "pu[u[u[u[u[u[u]]]]]]",
+                              arg_vals);
+    if (num_args < 2)
+        return num_args;
+    num_args--;
+    for (idx = 0; idx < num_args; idx++)
+        cmd_async_data[idx] = arg_vals[idx+1].val.u;
+    rc = flash_write_async(arg_vals[0].val.p, cmd_async_data,
+                           num_args * sizeof(uint32_t), cmd_async_done,
+                           "write");
+    printc("rc=%ld\n", rc);
+    return rc;
+}
+
+/*
+ * @brief Completion callback for the "flash ea" and "flash wa" commands.
+ *
+ * @param[in] rc The operation result.
+ * @param[in] user_data The operation name.
+ */
+static void cmd_async_done(int32_t rc, void* user_data)
+{
+    printc("flash async %s done rc=%ld\n", (const char*)user_data, rc);
+}
+
+#if FLASH_KV_PRESENT
+
+/*
+ * @brief Initialize the key/value store, building the RAM index.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The active page is the valid page with the highest sequence number. Its
+ * records are scanned in order, so later records for a key replace earlier
+ * ones. If no page is valid (e.g. first use), page 0 is erased and set up.
+ *
+ * The store is not used if the firmware image (which ends with the initial
+ * values of .data) extends into it, so a too large image is never erased.
+ */
+static int32_t kv_init(void)
+{
+    uint32_t page;
+    uint32_t addr;
+    uint32_t end_addr;
+    uint32_t image_end;
+    bool found = false;
+    int32_t rc;
+
+    memset(&kv, 0, sizeof(kv));
+    image_end = (uint32_t)&_sidata +
+        ((uint32_t)&_edata - (uint32_t)&_sdata);
+    if (image_end > CONFIG_FLASH_KV_BASE_ADDR) {
+        log_error("kv_init: image end 0x%08lx overlaps kv store\n",
+                  image_end);
+        return MOD_ERR_RESOURCE;
+    }
+
+    for (page = 0; page < CONFIG_FLASH_KV_NUM_PAGES; page++) {
+        struct kv_page_hdr* hdr = (struct kv_page_hdr*)KV_PAGE_ADDR(page);
+        if (hdr->magic != KV_PAGE_MAGIC || hdr->seq == KV_ERASED_32)
+            continue;
+        if (!found || (int32_t)(hdr->seq - kv.seq) > 0) {
+            kv.active_page = page;
+            kv.seq = hdr->seq;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        log_info("kv_init: no valid page, formatting\n");
+        rc = kv_format_page(0, 1);
+        if (rc != 0)
+            return rc;
+        kv.active_page = 0;
+        kv.seq = 1;
+    }
+
+    addr = KV_PAGE_ADDR(kv.active_page) + KV_UNIT;
+    end_addr = KV_PAGE_ADDR(kv.active_page) + CONFIG_FLASH_KV_PAGE_SIZE;
+    while (addr + KV_UNIT <= end_addr) {
+        struct kv_rec_hdr* rec = (struct kv_rec_hdr*)addr;
+        int32_t idx;
+
+        if (rec->key == KV_ERASED_16)
+            break;
+        if (rec->key > FLASH_KV_KEY_MAX || rec->len > CONFIG_FLASH_KV_MAX_VALUE_LEN ||
+            addr + KV_REC_SIZE(rec->len) > end_addr ||
+            (rec->flags != KV_FLAGS_VALID && rec->flags != KV_FLAGS_DELETED) ||
+            rec->crc != kv_rec_crc(rec->key, rec->flags,
+                                   (uint8_t*)(addr + KV_UNIT), rec->len)) {
+            // Most likely an interrupted write. The rest of the page can't
+            // be trusted, so we stop here and compact.
+            log_error("kv_init: bad record at 0x%08lx\n", addr);
+            INC_SAT_U16(cnts_u16[CNT_KV_BAD_REC]);
+            kv.compact_pending = true;
+            addr = end_addr;
+            break;
+        }
+
+        idx = kv_index_find(rec->key);
+        if (idx >= 0) {
+            kv.live_bytes -= KV_REC_SIZE(kv.index[idx].len);
+            kv_index_remove(idx);
+        }
+        if (rec->flags == KV_FLAGS_VALID) {
+            if (kv.num_keys >= CONFIG_FLASH_KV_MAX_KEYS) {
+                log_error("kv_init: index full\n");
+                return MOD_ERR_RESOURCE;
+            }
+            kv_index_insert(rec->key, addr, rec->len);
+            kv.live_bytes += KV_REC_SIZE(rec->len);
+        }
+        addr += KV_REC_SIZE(rec->len);
+    }
+
+    // Anything after the last record should be erased. If not (e.g. a record
+    // header write was interrupted), we can't append there.
+    if (!kv_is_erased(addr, end_addr)) {
+        kv.compact_pending = true;
+        addr = end_addr;
+    }
+    kv.write_addr = addr;
+    if (addr - KV_PAGE_ADDR(kv.active_page) > KV_COMPACT_THRESHOLD)
+        kv.compact_pending = true;
+    kv.ready = true;
+    return 0;
+}
+
+/*
+ * @brief Perform one step of compaction.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Compaction copies the live records to the next page, one record per call
+ * (after the first call, which starts an asynchronous erase of the page). Records written to the active
+ * page while compaction is in progress are picked up as well. Finally the page
+ * header is written with the next sequence number, which makes the new page
+ * the active one. Until then, a restart simply continues with the old page.
+ */
+static int32_t kv_compact_step(void)
+{
+    uint32_t active_base = KV_PAGE_ADDR(kv.active_page);
+    uint32_t idx;
+    int32_t rc;
+
+    // Wait for the target page erase, or other users' asynchronous operations
+    // (which the blocking record writes would abort).
+    if (kv.erasing || !flash_async_idle())
+        return 0;
+
+    if (!kv.compacting) {
+        kv.target_page = (kv.active_page + 1) % CONFIG_FLASH_KV_NUM_PAGES;
+        rc = flash_erase_async((uint32_t*)KV_PAGE_ADDR(kv.target_page),
+                               kv_erase_done, NULL);
+        if (rc != 0) {
+            log_error("kv_compact_step: erase error %ld\n", rc);
+            return rc;
+        }
+        kv.erasing = true;
+        return 0;
+    }
+
+    for (idx = 0; idx < kv.num_keys; idx++) {
+        struct kv_index_entry* entry = &kv.index[idx];
+        struct kv_rec_hdr* rec;
+
+        if (entry->addr < active_base ||
+            entry->addr >= active_base + CONFIG_FLASH_KV_PAGE_SIZE)
+            continue;
+        rec = (struct kv_rec_hdr*)entry->addr;
+        rc = kv_write_rec(kv.target_write_addr, rec->key, rec->flags,
+                          (uint8_t*)(entry->addr + KV_UNIT), rec->len);
+        if (rc != 0) {
+            kv_compact_abort();
+            return rc;
+        }
+        entry->addr = kv.target_write_addr;
+        kv.target_write_addr += KV_REC_SIZE(rec->len);
+        return 0;
+    }
+
+    rc = kv_format_page(kv.target_page, kv.seq + 1);
+    if (rc != 0) {
+        kv_compact_abort();
+        return rc;
+    }
+    kv.compacting = false;
+    kv.active_page = kv.target_page;
+    kv.seq++;
+    kv.write_addr = kv.target_write_addr;
+    kv.compact_pending = false;
+    INC_SAT_U16(cnts_u16[CNT_KV_COMPACT]);
+    return 0;
+}
+
+/*
+ * @brief Abandon compaction after a failed write.
+ *
+ * The index entries of the records already copied point into the target page,
+ * which the next compaction erases again. They are pointed back to the latest
+ * record for the key in the active page, which is the one that was copied (an
+ * update since would have moved the entry to the active page).
+ */
+static void kv_compact_abort(void)
+{
+    uint32_t target_base = KV_PAGE_ADDR(kv.target_page);
+    uint32_t active_base = KV_PAGE_ADDR(kv.active_page);
+    uint32_t end_addr = active_base + CONFIG_FLASH_KV_PAGE_SIZE;
+    uint32_t addr;
+    uint32_t idx;
+
+    for (idx = 0; idx < kv.num_keys; idx++) {
+        struct kv_index_entry* entry = &kv.index[idx];
+
+        if (entry->addr < target_base ||
+            entry->addr >= target_base + CONFIG_FLASH_KV_PAGE_SIZE)
+            continue;
+
+        // Stop at the first record that isn't intact, as kv_init() does.
+        addr = active_base + KV_UNIT;
+        while (addr + KV_UNIT <= end_addr) {
+            struct kv_rec_hdr* rec = (struct kv_rec_hdr*)addr;
+
+            if (rec->key == KV_ERASED_16 ||
+                rec->len > CONFIG_FLASH_KV_MAX_VALUE_LEN ||
+                addr + KV_REC_SIZE(rec->len) > end_addr ||
+                rec->crc != kv_rec_crc(rec->key, rec->flags,
+                                       (uint8_t*)(addr + KV_UNIT), rec->len))
+                break;
+            if (rec->key == entry->key && rec->flags == KV_FLAGS_VALID)
+                entry->addr = addr;
+            addr += KV_REC_SIZE(rec->len);
+        }
+    }
+    kv.compacting = false;
+}
+
+/*
+ * @brief Write the header of a page, erasing the page first if needed.
+ *
+ * @param[in] page The page index.
+ * @param[in] seq The page sequence number.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * During compaction, the page was erased at the start, and has records
+ * written, so it is not erased here.
+ */
+static int32_t kv_format_page(uint32_t page, uint32_t seq)
+{
+    uint32_t unit[KV_UNIT / 4];
+    struct kv_page_hdr* hdr = (struct kv_page_hdr*)unit;
+    int32_t rc;
+
+    if (!kv.compacting) {
+        rc = flash_panic_erase_page((uint32_t*)KV_PAGE_ADDR(page));
+        if (rc != 0)
+            return rc;
+    }
+    memset(unit, 0xff, sizeof(unit));
+    hdr->magic = KV_PAGE_MAGIC;
+    hdr->seq = seq;
+    return flash_panic_write((uint32_t*)KV_PAGE_ADDR(page), unit, KV_UNIT);
+}
+
+/*
+ * @brief Append a record to the active page.
+ *
+ * @param[in] key The key.
+ * @param[in] flags KV_FLAGS_VALID or KV_FLAGS_DELETED.
+ * @param[in] data The value.
+ * @param[in] len Length of the value.
+ * @param[out] addr Address of the record.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * During compaction, a deletion is also appended to the new page, in case the
+ * key was already copied. While an asynchronous flash operation is pending,
+ * MOD_ERR_BUSY is returned, and the caller can retry.
+ */
+static int32_t kv_append(uint16_t key, uint8_t flags, const void* data,
+                         uint32_t len, uint32_t* addr)
+{
+    uint32_t rec_size = KV_REC_SIZE(len);
+    uint32_t active_base = KV_PAGE_ADDR(kv.active_page);
+    int32_t rc;
+
+    // The blocking writes would abort an asynchronous operation (e.g. the
+    // compaction erase).
+    if (!flash_async_idle())
+        return MOD_ERR_BUSY;
+
+    if (kv.write_addr + rec_size > active_base + CONFIG_FLASH_KV_PAGE_SIZE) {
+        // Page is full of stale records; the caller can retry once
+        // compaction is done.
+        kv.compact_pending = true;
+        return MOD_ERR_BUSY;
+    }
+    if (kv.compacting && flags == KV_FLAGS_DELETED) {
+        if (kv.target_write_addr + rec_size >
+            KV_PAGE_ADDR(kv.target_page) + CONFIG_FLASH_KV_PAGE_SIZE)
+            return MOD_ERR_BUSY;
+        rc = kv_write_rec(kv.target_write_addr, key, flags, data, len);
+        if (rc != 0)
+            return rc;
+        kv.target_write_addr += rec_size;
+    }
+
+    rc = kv_write_rec(kv.write_addr, key, flags, data, len);
+    if (rc != 0) {
+        // Don't reuse a location that might be partly written.
+        kv.write_addr = active_base + CONFIG_FLASH_KV_PAGE_SIZE;
+        kv.compact_pending = true;
+        return rc;
+    }
+    *addr = kv.write_addr;
+    kv.write_addr += rec_size;
+    if (kv.write_addr - active_base > KV_COMPACT_THRESHOLD)
+        kv.compact_pending = true;
+    INC_SAT_U16(cnts_u16[CNT_KV_WRITE]);
+    return 0;
+}
+
+/*
+ * @brief Write a record to flash.
+ *
+ * @param[in] addr Address of the record (must be erased).
+ * @param[in] key The key.
+ * @param[in] flags The record flags.
+ * @param[in] data The value (can be in flash).
+ * @param[in] len Length of the value.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The value is written first, and the header last, so a record only becomes
+ * visible once it is complete.
+ */
+static int32_t kv_write_rec(uint32_t addr, uint16_t key, uint8_t flags,
+                            const void* data, uint32_t len)
+{
+    uint32_t unit[KV_UNIT / 4];
+    struct kv_rec_hdr* hdr = (struct kv_rec_hdr*)unit;
+    uint32_t offset;
+    uint32_t chunk_len;
+    int32_t rc;
+
+    for (offset = 0; offset < len; offset += KV_UNIT) {
+        chunk_len = len - offset < KV_UNIT ? len - offset : KV_UNIT;
+        memset(unit, 0xff, sizeof(unit));
+        memcpy(unit, (const uint8_t*)data + offset, chunk_len);
+        rc = flash_panic_write((uint32_t*)(addr + KV_UNIT + offset), unit,
+                               KV_UNIT);
+        if (rc != 0)
+            return rc;
+    }
+
+    memset(unit, 0xff, sizeof(unit));
+    hdr->key = key;
+    hdr->len = len;
+    hdr->flags = flags;
+    hdr->crc = kv_rec_crc(key, flags, data, len);
+    return flash_panic_write((uint32_t*)addr, unit, KV_UNIT);
+}
+
+/*
+ * @brief Compute the check value for a record.
+ *
+ * @param[in] key The key.
+ * @param[in] flags The record flags.
+ * @param[in] data The value.
+ * @param[in] len Length of the value.
+ *
+ * @return CRC-32 of the key, length, flags, and value.
+ */
+static uint32_t kv_rec_crc(uint16_t key, uint8_t flags, const void* data,
+                           uint32_t len)
+{
+    uint8_t hdr_bytes[4] = { key & 0xff, key >> 8, len, flags };
+    uint32_t crc;
+
+    crc = crc32_update(CRC32_INIT, hdr_bytes, sizeof(hdr_bytes));
+    crc = crc32_update(crc, data, len);
+    return ~crc;
+}
+
+/*
+ * @brief Completion callback for the compaction target page erase.
+ *
+ * @param[in] rc The erase result.
+ * @param[in] user_data Not used.
+ */
+static void kv_erase_done(int32_t rc, void* user_data)
+{
+    kv.erasing = false;
+    if (rc != 0) {
+        // Compaction is still pending, so the erase is retried.
+        log_error("kv_erase_done: erase error %ld\n", rc);
+        INC_SAT_U16(cnts_u16[CNT_KV_COMPACT_ERR]);
+        return;
+    }
+    kv.target_write_addr = KV_PAGE_ADDR(kv.target_page) + KV_UNIT;
+    kv.compacting = true;
+}
+
+/*
+ * @brief Check whether a flash range is erased.
+ *
+ * @param[in] start_addr Start address (word aligned).
+ * @param[in] end_addr End address (exclusive, word aligned).
+ *
+ * @return True if all bytes are erased.
+ */
+static bool kv_is_erased(uint32_t start_addr, uint32_t end_addr)
+{
+    uint32_t* p;
+
+    for (p = (uint32_t*)start_addr; p < (uint32_t*)end_addr; p++) {
+        if (*p != KV_ERASED_32)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * @brief Find a key in the index.
+ *
+ * @param[in] key The key.
+ *
+ * @return Index entry number (>= 0) if found, else -1.
+ *
+ * The index is sorted by key, so a binary search is used.
+ */
+static int32_t kv_index_find(uint16_t key)
+{
+    int32_t lo = 0;
+    int32_t hi = (int32_t)kv.num_keys - 1;
+
+    while (lo <= hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (kv.index[mid].key == key)
+            return mid;
+        if (kv.index[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+/*
+ * @brief Insert a key in the index (which must not contain it already).
+ *
+ * @param[in] key The key.
+ * @param[in] addr Address of the record.
+ * @param[in] len Length of the value.
+ */
+static void kv_index_insert(uint16_t key, uint32_t addr, uint32_t len)
+{
+    uint32_t idx = kv.num_keys;
+
+    while (idx > 0 && kv.index[idx - 1].key > key) {
+        kv.index[idx] = kv.index[idx - 1];
+        idx--;
+    }
+    kv.index[idx].key = key;
+    kv.index[idx].len = len;
+    kv.index[idx].addr = addr;
+    kv.num_keys++;
+}
+
+/*
+ * @brief Remove an entry from the index.
+ *
+ * @param[in] idx The index entry number.
+ */
+static void kv_index_remove(int32_t idx)
+{
+    kv.num_keys--;
+    memmove(&kv.index[idx], &kv.index[idx + 1],
+            (kv.num_keys - idx) * sizeof(kv.index[0]));
+}
+
+/*
+ * @brief Console command function for "flash kv".
+ *
+ * @param[in] argc Number of arguments, including "flash"
+ * @param[in] argv Argument values, including "flash"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: flash kv [<op> [<arg>]]
+ */
+static int32_t cmd_flash_kv(int32_t argc, const char** argv)
+{
+    struct cmd_arg_val arg_vals[2];
+    uint8_t value[CONFIG_FLASH_KV_MAX_VALUE_LEN];
+    int32_t rc;
+    uint32_t idx;
+    uint32_t idx2;
+
+    if (argc < 3) {
+        printc("Operations and param(s) are as follows:\n"
+               "  List keys, usage: flash kv list\n"
+               "  Get value, usage: flash kv get <key>\n"
+               "  Set value (string), usage: flash kv set <key> <value>\n");
+        printc("  Delete key, usage: flash kv del <key>\n"
+               "  Start compaction, usage: flash kv compact\n");
+        return 0;
+    }
+
+    if (strcasecmp(argv[2], "list") == 0) {
+        printc("Page %lu seq %lu used %lu live %lu%s\n", kv.active_page,
+               kv.seq, kv.write_addr - KV_PAGE_ADDR(kv.active_page),
+               kv.live_bytes, kv.compacting ? " (compacting)" : "");
+        printc(" Key Len Address\n"
+               "---- --- ----------\n");
+        for (idx = 0; idx < kv.num_keys; idx++)
+            printc("%4u %3u 0x%08lx\n", kv.index[idx].key, kv.index[idx].len,
+                   kv.index[idx].addr);
+        return 0;
+    } else if (strcasecmp(argv[2], "get") == 0) {
+        if (cmd_parse_args(argc-3, argv+3, "u", arg_vals) != 1)
+            return MOD_ERR_BAD_CMD;
+        rc = flash_kv_get(arg_vals[0].val.u, value, sizeof(value));
+        for (idx2 = 0; rc > 0 && idx2 < (uint32_t)rc; idx2++)
+            printc("%02x ", value[idx2]);
+        if (rc > 0)
+            printc("\n");
+    } else if (strcasecmp(argv[2], "set") == 0) {
+        if (cmd_parse_args(argc-3, argv+3, "us", arg_vals) != 2)
+            return MOD_ERR_BAD_CMD;
+        rc = flash_kv_set(arg_vals[0].val.u, arg_vals[1].val.s,
+                          strlen(arg_vals[1].val.s));
+    } else if (strcasecmp(argv[2], "del") == 0) {
+        if (cmd_parse_args(argc-3, argv+3, "u", arg_vals) != 1)
+            return MOD_ERR_BAD_CMD;
+        rc = flash_kv_delete(arg_vals[0].val.u);
+    } else if (strcasecmp(argv[2], "compact") == 0) {
+        kv.compact_pending = true;
+        rc = 0;
+    } else {
+        printc("Invalid operation '%s'\n", argv[2]);
+        return MOD_ERR_BAD_CMD;
+    }
+    printc("rc=%ld\n", rc);
+    return 0;
+}
+
+#endif // FLASH_KV_PRESENT
@@ -3,6 +3,9 @@
  *
  * This module is simply used to study floating point operation.
  *
+ * If the bench module is present, floating point micro-benchmarks are
+ * registered with it (see bench.h).
+ *
  * The following console commands are provided:
  * > float status
  * See code for details.
@@ -34,6 +37,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "bench.h"
 #include "cmd.h"
 #include "console.h"
 #include "log.h"
@@ -64,8 +68,13 @@
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
+static int float_test(float arg_f, double arg_d);
 static int32_t cmd_float_status(int32_t argc, const char** argv);
 static int32_t cmd_float_test(int32_t argc, const char** argv);
+#if CONFIG_BENCH_PRESENT
+static int32_t bench_calc(uint32_t num_ops);
+static int32_t bench_sqrtf(uint32_t num_ops);
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -95,6 +104,31 @@ static struct cmd_client_info cmd_info = {
     .log_level_ptr = &log_level,
 };
 
+#if CONFIG_BENCH_PRESENT
+// Data structure passed to bench module.
+static const struct bench_info benches[] = {
+    {
+        .name = "calc",
+        .func = bench_calc,
+        .dflt_num_ops = 10000,
+    },
+    {
+        .name = "sqrtf",
+        .func = bench_sqrtf,
+        .dflt_num_ops = 100000,
+    },
+};
+
+static const struct bench_client_info bench_info = {
+    .name = "float",
+    .num_benches = ARRAY_SIZE(benches),
+    .benches = benches,
+};
+
+// Benchmark results are stored here so they aren't optimized away.
+static volatile float bench_sink;
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -149,6 +183,13 @@ int32_t float_start(void)
         log_error("float_start: cmd error %d\n", rc);
         return rc;
     }
+#if CONFIG_BENCH_PRESENT
+    rc = bench_register(&bench_info);
+    if (rc < 0) {
+        log_error("float_start: bench error %d\n", rc);
+        return rc;
+    }
+#endif
     return 0;
 }
 
@@ -181,6 +222,52 @@ static int float_test(float arg_f, double arg_d)
     return a_f + b_f + c_f + d_f;
 }
 
+#if CONFIG_BENCH_PRESENT
+
+/*
+ * @brief Benchmark for the mixed float/double calculation in float_test().
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 (always).
+ */
+static int32_t bench_calc(uint32_t num_ops)
+{
+    float arg = 0.1F;
+    int sum = 0;
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++) {
+        sum += float_test(arg, arg);
+        arg += 0.001F;
+    }
+    bench_sink = sum;
+    return 0;
+}
+
+/*
+ * @brief Benchmark for sqrtf().
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 (always).
+ */
+static int32_t bench_sqrtf(uint32_t num_ops)
+{
+    float arg = 1.0F;
+    float sum = 0.0F;
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++) {
+        sum += sqrtf(arg);
+        arg += 0.5F;
+    }
+    bench_sink = sum;
+    return 0;
+}
+
+#endif
+
 /*
  * @brief Console command function for "float status".
  *
@@ -0,0 +1,686 @@
+/*
+ * @brief Implementation of fmt utility.
+ *
+ * This utility is a compact printf-style formatter, used for console output
+ * instead of vsnprintf(). Compared to newlib's vsnprintf() it is smaller and
+ * faster, and the output is passed to an output function in chunks (literal
+ * text straight from the format string, each conversion from a small stack
+ * buffer), so no buffer for the whole output is needed. There is no static
+ * state, so it can be used from interrupt handlers.
+ *
+ * The supported conversion specifications are:
+ * - Flags: '-', '0', '+', ' ', and '#' (for o, x, X).
+ * - Width and precision, including '*'.
+ * - Length modifiers: hh, h, l, ll, z, j, t ('l' is 32 bits, also on the host
+ *   build).
+ * - Conversions: d, i, u, o, x, X, c, s, p, %, and f/F (fixed point).
+ *
+ * Integers are converted with 32-bit arithmetic when the value fits, which
+ * avoids the slow 64-bit division on 32-bit MCUs.
+ *
+ * For f/F the precision is limited to 9 digits, values are rounded half away
+ * from zero, and values outside the range of a uint64_t are printed as "inf". Other conversions (e.g. e, g, a,
+ * n) are not supported, and are output as-is.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fmt.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+// Flags.
+#define FLAG_LEFT   0x01
+#define FLAG_ZERO   0x02
+#define FLAG_PLUS   0x04
+#define FLAG_SPACE  0x08
+#define FLAG_ALT    0x10
+
+#define MAX_FLOAT_PREC 9
+
+// Type read for the 'l' length modifier. Modules pass 32-bit values with "%lu"
+// etc., which matches the target's 32-bit long, so the 64-bit host build
+// reads them as int.
+#if defined HOST_LINUX
+#define LONG_ARG int
+#else
+#define LONG_ARG long
+#endif
+
+// Enough for a 64-bit octal value, or a float with MAX_FLOAT_PREC digits.
+#define CONV_BUF_SIZE 24
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+enum length_mod {
+    LEN_NONE,
+    LEN_HH,
+    LEN_H,
+    LEN_L,
+    LEN_LL,
+    LEN_Z,
+    LEN_J,
+    LEN_T,
+};
+
+// A parsed conversion specification.
+struct conv_spec {
+    uint32_t flags;
+    int width;
+    int prec;       // -1 if not specified.
+};
+
+// Output state, passed to all the "emit" functions.
+struct out_state {
+    fmt_out_func out;
+    void* out_arg;
+    int count;
+};
+
+// Output argument for fmt_vsnprintf().
+struct str_out {
+    char* buf;
+    uint32_t size;
+    uint32_t len;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void emit(struct out_state* os, const char* s, uint32_t len);
+static void emit_pad(struct out_state* os, char c, int num);
+static void emit_field(struct out_state* os, const struct conv_spec* spec,
+                       const char* prefix, uint32_t prefix_len,
+                       int zeros, const char* s, uint32_t len);
+static void emit_int(struct out_state* os, const struct conv_spec* spec,
+                     uint64_t val, bool neg, uint32_t base, bool upper);
+static void emit_float(struct out_state* os, const struct conv_spec* spec,
+                       double val);
+static char* u32_to_str(char* end, uint32_t val, uint32_t base,
+                        const char* digits);
+static char* u64_to_str(char* end, uint64_t val, uint32_t base,
+                        const char* digits);
+static void str_out_func(void* out_arg, const char* s, uint32_t len);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static const char lower_digits[] = "0123456789abcdef";
+static const char upper_digits[] = "0123456789ABCDEF";
+
+static const char pad_spaces[] = "                ";
+static const char pad_zeros[] = "0000000000000000";
+
+static const uint32_t pow10[MAX_FLOAT_PREC + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Format output, passing it to an output function.
+ *
+ * @param[in] out Output function.
+ * @param[in] out_arg Argument passed to the output function.
+ * @param[in] fmt Format string as in printf.
+ * @param[in] args Format arguments as in vprintf.
+ *
+ * @return Number of characters output.
+ */
+int fmt_vformat(fmt_out_func out, void* out_arg, const char* fmt,
+                va_list args)
+{
+    struct out_state os = { .out = out, .out_arg = out_arg, .count = 0 };
+    struct conv_spec spec;
+    enum length_mod len_mod;
+    const char* lit;
+    const char* spec_start;
+    const char* s;
+    uint64_t uval;
+    int64_t ival;
+    uint32_t len;
+    char c;
+
+    while (*fmt != '\0') {
+        for (lit = fmt; *fmt != '\0' && *fmt != '%'; fmt++)
+            ;
+        if (fmt > lit)
+            emit(&os, lit, fmt - lit);
+        if (*fmt == '\0')
+            break;
+        spec_start = fmt++;
+
+        // Flags.
+        spec.flags = 0;
+        for (;; fmt++) {
+            if (*fmt == '-')
+                spec.flags |= FLAG_LEFT;
+            else if (*fmt == '0')
+                spec.flags |= FLAG_ZERO;
+            else if (*fmt == '+')
+                spec.flags |= FLAG_PLUS;
+            else if (*fmt == ' ')
+                spec.flags |= FLAG_SPACE;
+            else if (*fmt == '#')
+                spec.flags |= FLAG_ALT;
+            else
+                break;
+        }
+
+        // Width.
+        spec.width = 0;
+        if (*fmt == '*') {
+            spec.width = va_arg(args, int);
+            if (spec.width < 0) {
+                spec.flags |= FLAG_LEFT;
+                spec.width = -spec.width;
+            }
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9')
+                spec.width = spec.width * 10 + (*fmt++ - '0');
+        }
+
+        // Precision.
+        spec.prec = -1;
+        if (*fmt == '.') {
+            fmt++;
+            spec.prec = 0;
+            if (*fmt == '*') {
+                spec.prec = va_arg(args, int);
+                if (spec.prec < 0)
+                    spec.prec = -1;
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9')
+                    spec.prec = spec.prec * 10 + (*fmt++ - '0');
+            }
+        }
+
+        // Length modifier.
+        len_mod = LEN_NONE;
+        switch (*fmt) {
+            case 'h':
+                len_mod = LEN_H;
+                if (*++fmt == 'h') {
+                    len_mod = LEN_HH;
+                    fmt++;
+                }
+                break;
+            case 'l':
+                len_mod = LEN_L;
+                if (*++fmt == 'l') {
+                    len_mod = LEN_LL;
+                    fmt++;
+                }
+                break;
+            case 'z': len_mod = LEN_Z; fmt++; break;
+            case 'j': len_mod = LEN_J; fmt++; break;
+            case 't': len_mod = LEN_T; fmt++; break;
+            default: break;
+        }
+
+        c = *fmt;
+        if (c == '\0') {
+            emit(&os, spec_start, fmt - spec_start);
+            break;
+        }
+        fmt++;
+        switch (c) {
+            case 'd':
+            case 'i':
+                switch (len_mod) {
+                    case LEN_HH: ival = (signed char)va_arg(args, int); break;
+                    case LEN_H: ival = (short)va_arg(args, int); break;
+                    case LEN_L: ival = va_arg(args, LONG_ARG); break;
+                    case LEN_LL: ival = va_arg(args, long long); break;
+                    case LEN_Z: ival = va_arg(args, ptrdiff_t); break;
+                    case LEN_J: ival = va_arg(args, intmax_t); break;
+                    case LEN_T: ival = va_arg(args, ptrdiff_t); break;
+                    default: ival = va_arg(args, int); break;
+                }
+                emit_int(&os, &spec, ival < 0 ? -(uint64_t)ival : (uint64_t)ival,
+                         ival < 0, 10, false);
+                break;
+
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                switch (len_mod) {
+                    case LEN_HH:
+                        uval = (unsigned char)va_arg(args, unsigned int);
+                        break;
+                    case LEN_H:
+                        uval = (unsigned short)va_arg(args, unsigned int);
+                        break;
+                    case LEN_L: uval = va_arg(args, unsigned LONG_ARG); break;
+                    case LEN_LL: uval = va_arg(args, unsigned long long); break;
+                    case LEN_Z: uval = va_arg(args, size_t); break;
+                    case LEN_J: uval = va_arg(args, uintmax_t); break;
+                    case LEN_T: uval = va_arg(args, size_t); break;
+                    default: uval = va_arg(args, unsigned int); break;
+                }
+                spec.flags &= ~(FLAG_PLUS | FLAG_SPACE);
+                emit_int(&os, &spec, uval, false,
+                         c == 'u' ? 10 : (c == 'o' ? 8 : 16), c == 'X');
+                break;
+
+            case 'p':
+                uval = (uintptr_t)va_arg(args, void*);
+                spec.flags = (spec.flags & FLAG_LEFT) | FLAG_ALT;
+                emit_int(&os, &spec, uval, false, 16, false);
+                break;
+
+            case 'c':
+                c = (char)va_arg(args, int);
+                spec.flags &= ~FLAG_ZERO;
+                emit_field(&os, &spec, NULL, 0, 0, &c, 1);
+                break;
+
+            case 's':
+                s = va_arg(args, const char*);
+                if (s == NULL)
+                    s = "(null)";
+                if (spec.prec >= 0) {
+                    const char* nul = memchr(s, '\0', spec.prec);
+                    len = nul == NULL ? (uint32_t)spec.prec : nul - s;
+                } else {
+                    len = strlen(s);
+                }
+                spec.flags &= ~FLAG_ZERO;
+                emit_field(&os, &spec, NULL, 0, 0, s, len);
+                break;
+
+            case 'f':
+            case 'F':
+                emit_float(&os, &spec, va_arg(args, double));
+                break;
+
+            case '%':
+                emit(&os, "%", 1);
+                break;
+
+            default:
+                // Not supported, so output as-is.
+                emit(&os, spec_start, fmt - spec_start);
+                break;
+        }
+    }
+    return os.count;
+}
+
+/*
+ * @brief Format output, passing it to an output function.
+ *
+ * @param[in] out Output function.
+ * @param[in] out_arg Argument passed to the output function.
+ * @param[in] fmt Format string as in printf.
+ *
+ * @return Number of characters output.
+ */
+int fmt_format(fmt_out_func out, void* out_arg, const char* fmt, ...)
+{
+    va_list args;
+    int rc;
+
+    va_start(args, fmt);
+    rc = fmt_vformat(out, out_arg, fmt, args);
+    va_end(args);
+    return rc;
+}
+
+/*
+ * @brief Format output into a buffer, as vsnprintf().
+ *
+ * @param[out] buf The buffer.
+ * @param[in] size Size of the buffer.
+ * @param[in] fmt Format string as in printf.
+ * @param[in] args Format arguments as in vprintf.
+ *
+ * @return Number of characters in the full output (excluding the
+ *         terminator), as in vsnprintf()..
+ *
+ * If size is not 0, the output is always terminated, and truncated if
+ * necessary.
+ */
+int fmt_vsnprintf(char* buf, uint32_t size, const char* fmt, va_list args)
+{
+    struct str_out so = { .buf = buf, .size = size, .len = 0 };
+    int rc;
+
+    rc = fmt_vformat(str_out_func, &so, fmt, args);
+    if (size > 0)
+        buf[so.len] = '\0';
+    return rc;
+}
+
+/*
+ * @brief Format output into a buffer, as snprintf().
+ *
+ * @param[out] buf The buffer.
+ * @param[in] size Size of the buffer.
+ * @param[in] fmt Format string as in printf.
+ *
+ * @return Number of characters in the full output (excluding the
+ *         terminator), as in snprintf().
+ */
+int fmt_snprintf(char* buf, uint32_t size, const char* fmt, ...)
+{
+    va_list args;
+    int rc;
+
+    va_start(args, fmt);
+    rc = fmt_vsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return rc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Output a chunk of characters.
+ *
+ * @param[in] os Output state.
+ * @param[in] s The characters.
+ * @param[in] len Number of characters.
+ */
+static void emit(struct out_state* os, const char* s, uint32_t len)
+{
+    os->out(os->out_arg, s, len);
+    os->count += len;
+}
+
+/*
+ * @brief Output padding.
+ *
+ * @param[in] os Output state.
+ * @param[in] c Pad character, ' ' or '0'.
+ * @param[in] num Number of pad characters (<= 0 for none).
+ */
+static void emit_pad(struct out_state* os, char c, int num)
+{
+    const char* pad = c == '0' ? pad_zeros : pad_spaces;
+    int chunk;
+
+    while (num > 0) {
+        chunk = num;
+        if (chunk > (int)sizeof(pad_spaces) - 1)
+            chunk = sizeof(pad_spaces) - 1;
+        emit(os, pad, chunk);
+        num -= chunk;
+    }
+}
+
+/*
+ * @brief Output a field, padded to the width.
+ *
+ * @param[in] os Output state.
+ * @param[in] spec Conversion specification (for flags and width).
+ * @param[in] prefix Sign or base prefix (or NULL).
+ * @param[in] prefix_len Length of prefix.
+ * @param[in] zeros Number of zeros to put between the prefix and the value
+ *                  (e.g. for precision).
+ * @param[in] s The value.
+ * @param[in] len Length of the value.
+ *
+ * If the '0' flag is set, the padding is zeros after the prefix.
+ */
+static void emit_field(struct out_state* os, const struct conv_spec* spec,
+                       const char* prefix, uint32_t prefix_len,
+                       int zeros, const char* s, uint32_t len)
+{
+    int pad = spec->width - (int)(prefix_len + zeros + len);
+
+    if (spec->flags & FLAG_LEFT) {
+        if (prefix_len > 0)
+            emit(os, prefix, prefix_len);
+        emit_pad(os, '0', zeros);
+        emit(os, s, len);
+        emit_pad(os, ' ', pad);
+    } else if (spec->flags & FLAG_ZERO) {
+        if (prefix_len > 0)
+            emit(os, prefix, prefix_len);
+        emit_pad(os, '0', zeros + pad);
+        emit(os, s, len);
+    } else {
+        emit_pad(os, ' ', pad);
+        if (prefix_len > 0)
+            emit(os, prefix, prefix_len);
+        emit_pad(os, '0', zeros);
+        emit(os, s, len);
+    }
+}
+
+/*
+ * @brief Output an integer.
+ *
+ * @param[in] os Output state.
+ * @param[in] spec Conversion specification.
+ * @param[in] val Absolute value.
+ * @param[in] neg True if the value is negative.
+ * @param[in] base 8, 10, or 16.
+ * @param[in] upper True for upper case hex digits.
+ */
+static void emit_int(struct out_state* os, const struct conv_spec* spec,
+                     uint64_t val, bool neg, uint32_t base, bool upper)
+{
+    char buf[CONV_BUF_SIZE];
+    char* end = &buf[CONV_BUF_SIZE];
+    char* start = end;
+    const char* prefix = NULL;
+    uint32_t prefix_len = 0;
+    struct conv_spec spec2 = *spec;
+    int zeros = 0;
+
+    // Precision 0 with value 0 gives no digits.
+    if (val != 0 || spec->prec != 0) {
+        if (val <= UINT32_MAX)
+            start = u32_to_str(end, val, base,
+                               upper ? upper_digits : lower_digits);
+        else
+            start = u64_to_str(end, val, base,
+                               upper ? upper_digits : lower_digits);
+    }
+
+    if (neg) {
+        prefix = "-";
+        prefix_len = 1;
+    } else if (spec->flags & FLAG_PLUS) {
+        prefix = "+";
+        prefix_len = 1;
+    } else if (spec->flags & FLAG_SPACE) {
+        prefix = " ";
+        prefix_len = 1;
+    } else if ((spec->flags & FLAG_ALT) && base == 16 && val != 0) {
+        prefix = upper ? "0X" : "0x";
+        prefix_len = 2;
+    } else if ((spec->flags & FLAG_ALT) && base == 8 && *start != '0') {
+        *--start = '0';
+    }
+
+    if (spec->prec >= 0) {
+        zeros = spec->prec - (end - start);
+        spec2.flags &= ~FLAG_ZERO;
+    }
+    emit_field(os, &spec2, prefix, prefix_len, zeros, start, end - start);
+}
+
+/*
+ * @brief Output a floating point value, in fixed point format.
+ *
+ * @param[in] os Output state.
+ * @param[in] spec Conversion specification.
+ * @param[in] val The value.
+ */
+static void emit_float(struct out_state* os, const struct conv_spec* spec,
+                       double val)
+{
+    char buf[CONV_BUF_SIZE];
+    char* end = &buf[CONV_BUF_SIZE];
+    char* start;
+    const char* prefix = NULL;
+    uint32_t prefix_len = 0;
+    struct conv_spec spec2 = *spec;
+    int prec = spec->prec < 0 ? 6 : spec->prec;
+    uint64_t int_part;
+    uint32_t frac_part = 0;
+    double frac;
+    int idx;
+
+    if (prec > MAX_FLOAT_PREC)
+        prec = MAX_FLOAT_PREC;
+
+    if (val < 0) {
+        prefix = "-";
+        prefix_len = 1;
+        val = -val;
+    } else if (spec->flags & FLAG_PLUS) {
+        prefix = "+";
+        prefix_len = 1;
+    } else if (spec->flags & FLAG_SPACE) {
+        prefix = " ";
+        prefix_len = 1;
+    }
+
+    if (val != val) {
+        spec2.flags &= ~FLAG_ZERO;
+        emit_field(os, &spec2, NULL, 0, 0, "nan", 3);
+        return;
+    }
+    if (val >= 18446744073709551615.0) {
+        spec2.flags &= ~FLAG_ZERO;
+        emit_field(os, &spec2, prefix, prefix_len, 0, "inf", 3);
+        return;
+    }
+
+    int_part = (uint64_t)val;
+    frac = (val - (double)int_part) * pow10[prec] + 0.5;
+    frac_part = (uint32_t)frac;
+    if (frac_part >= pow10[prec]) {
+        frac_part -= pow10[prec];
+        int_part++;
+    }
+
+    start = end;
+    if (prec > 0) {
+        for (idx = 0; idx < prec; idx++) {
+            *--start = '0' + frac_part % 10;
+            frac_part /= 10;
+        }
+        *--start = '.';
+    } else if (spec->flags & FLAG_ALT) {
+        *--start = '.';
+    }
+    if (int_part <= UINT32_MAX)
+        start = u32_to_str(start, int_part, 10, lower_digits);
+    else
+        start = u64_to_str(start, int_part, 10, lower_digits);
+    emit_field(os, &spec2, prefix, prefix_len, 0, start, end - start);
+}
+
+/*
+ * @brief Convert a 32-bit value to digits.
+ *
+ * @param[in] end End of the buffer for the digits.
+ * @param[in] val The value.
+ * @param[in] base The base.
+ * @param[in] digits Digit characters.
+ *
+ * @return Pointer to the first digit (they are put at the end of the buffer).
+ */
+static char* u32_to_str(char* end, uint32_t val, uint32_t base,
+                        const char* digits)
+{
+    if (base == 16) {
+        do {
+            *--end = digits[val & 0xf];
+            val >>= 4;
+        } while (val != 0);
+    } else {
+        do {
+            *--end = digits[val % base];
+            val /= base;
+        } while (val != 0);
+    }
+    return end;
+}
+
+/*
+ * @brief Convert a 64-bit value to digits.
+ *
+ * @param[in] end End of the buffer for the digits.
+ * @param[in] val The value.
+ * @param[in] base The base.
+ * @param[in] digits Digit characters.
+ *
+ * @return Pointer to the first digit (they are put at the end of the buffer).
+ */
+static char* u64_to_str(char* end, uint64_t val, uint32_t base,
+                        const char* digits)
+{
+    do {
+        *--end = digits[val % base];
+        val /= base;
+    } while (val != 0);
+    return end;
+}
+
+/*
+ * @brief Output function for fmt_vsnprintf().
+ *
+ * @param[in] out_arg The struct str_out.
+ * @param[in] s The characters.
+ * @param[in] len Number of characters.
+ */
+static void str_out_func(void* out_arg, const char* s, uint32_t len)
+{
+    struct str_out* so = out_arg;
+
+    if (so->size == 0 || so->len >= so->size - 1)
+        return;
+    if (len > so->size - 1 - so->len)
+        len = so->size - 1 - so->len;
+    memcpy(&so->buf[so->len], s, len);
+    so->len += len;
+}
@@ -6,13 +6,27 @@
  * serial interface, and a pulse-per-second (PPS) discrete output.
  *
  * This module provides:
- * - Parsing of the GGPS GTU7 output messages that contain satellite positions.
+ * - Incremental parsing of the GGPS GTU7 NMEA output. Characters are processed
+ *   one at a time as they are received, with the checksum accumulated on the
+ *   fly, so no line buffer is needed. GGA, RMC and GSV sentences are decoded
+ *   directly into binary structures, and the results are only accepted if
+ *   the "*hh" checksum at the end of the sentence matches.
+ * - Optional UBX binary mode. The receiver is configured to send NAV-PVT and
+ *   NAV-DOP (for HDOP) frames at a higher rate, and NAV-SAT/NAV-SVINFO frames
+ *   for satellite data, instead of NMEA text. UBX frames are parsed in the
+ *   same incremental way (with the Fletcher checksum), and feed the same data
+ *   structures.
  * - Map satellite positions to a 2-D grid, and plot it to the console, using
  *   ANSI escape sequences so the satellite map stays at a fixed position.
+ *   The map is drawn in full when turned on, and after that only the cells
+ *   that changed are written, so an update is typically a few bytes. The
+ *   projection uses an integer cosine table, so there is no floating point.
  *
  * The following console commands are provided:
  * > gps status
  * > gps map
+ * > gps ubx
+ * > gps pm
  * See code for details.
  *
  * MIT License
@@ -37,8 +51,6 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
-#include <ctype.h>
-#include <math.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
@@ -54,10 +66,45 @@
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
-#define GPS_IN_BFR_SIZE 80
 #define MAX_SATS 32
 #define CLEANUP_TMR_MS 5000
 
+#define NMEA_ADDR_LEN 5     // Talker ID (2 chars) + sentence ID (3 chars).
+#define NMEA_GSV_MAX_SATS 4 // Satellites per GSV sentence.
+
+#define UBX_SYNC_1 0xb5
+#define UBX_SYNC_2 0x62
+#define UBX_MAX_LEN 1024            // Longer frames are treated as errors.
+#define UBX_BFR_SIZE 92             // Size of NAV-PVT (protocol 15+).
+#define UBX_NAV_PVT_MIN_LEN 84      // Size of NAV-PVT (protocol 14).
+#define UBX_NAV_DOP_LEN 18          // Size of NAV-DOP.
+#define UBX_SAT_HDR_LEN 8           // NAV-SAT/NAV-SVINFO header size.
+#define UBX_SAT_BLOCK_LEN 12        // NAV-SAT/NAV-SVINFO per-satellite size.
+
+#define UBX_CLASS_NAV 0x01
+#define UBX_CLASS_ACK 0x05
+#define UBX_CLASS_CFG 0x06
+#define UBX_ID_NAV_DOP 0x04
+#define UBX_ID_NAV_PVT 0x07
+#define UBX_ID_NAV_SVINFO 0x30
+#define UBX_ID_NAV_SAT 0x35
+#define UBX_ID_ACK_NAK 0x00
+#define UBX_ID_ACK_ACK 0x01
+#define UBX_ID_CFG_PRT 0x00
+#define UBX_ID_CFG_MSG 0x01
+#define UBX_ID_CFG_RATE 0x08
+
+#define UBX_PROTO_UBX 0x0001
+#define UBX_PROTO_NMEA 0x0002
+
+// Satellite map display.
+#define DISP_MAX_RAD 10
+#define DISP_ROWS (1 + 2*DISP_MAX_RAD)
+#define DISP_COLS (1 + 2*DISP_MAX_RAD)
+#define DISP_X_OFFSET DISP_MAX_RAD
+#define DISP_Y_OFFSET DISP_MAX_RAD
+#define COS_TBL_SCALE 10000
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -70,10 +117,99 @@ struct sat_data {
     uint8_t snr;        // 0-99 dB
 };
 
+enum nmea_state {
+    NMEA_STATE_IDLE,        // Waiting for '$'.
+    NMEA_STATE_ADDR,        // Receiving talker/sentence ID.
+    NMEA_STATE_FIELD,       // Receiving comma separated data fields.
+    NMEA_STATE_CSUM_1,      // Waiting for first checksum hex digit.
+    NMEA_STATE_CSUM_2,      // Waiting for second checksum hex digit.
+};
+
+enum nmea_msg {
+    NMEA_MSG_GGA,
+    NMEA_MSG_RMC,
+    NMEA_MSG_GSV,
+};
+
+// A data field as it is received. Digits are accumulated into an integer,
+// ignoring the decimal point, and the number of digits after the decimal
+// point is recorded (e.g "4807.038" gives val=4807038 frac_digits=3).
+struct nmea_field {
+    uint32_t val;
+    uint8_t frac_digits;
+    bool dot;
+    bool neg;
+    char ch;                // Last non-numeric char (e.g. N/S/E/W/A/V).
+};
+
+// Satellite data reported by a GSV sentence or UBX frame.
+struct sat_report {
+    uint16_t azimuth;
+    uint8_t prn;
+    uint8_t elevation;
+    uint8_t snr;
+};
+
+struct nmea_parser {
+    enum nmea_state state;
+    enum nmea_msg msg;
+    uint8_t csum;           // XOR of chars between '$' and '*'.
+    uint8_t rx_csum;        // Checksum received after '*'.
+    uint8_t addr_len;
+    char addr[NMEA_ADDR_LEN];
+    uint8_t field_num;      // 1 for field following the address.
+    struct nmea_field field;
+    struct gps_fix fix;     // GGA/RMC decode in progress.
+    struct sat_report sats[NMEA_GSV_MAX_SATS]; // GSV decode in progress.
+    uint8_t num_sats;
+};
+
+enum ubx_state {
+    UBX_STATE_IDLE,         // Waiting for first sync char.
+    UBX_STATE_SYNC_2,
+    UBX_STATE_CLASS,
+    UBX_STATE_ID,
+    UBX_STATE_LEN_1,
+    UBX_STATE_LEN_2,
+    UBX_STATE_PAYLOAD,
+    UBX_STATE_CK_A,
+    UBX_STATE_CK_B,
+};
+
+enum ubx_msg {
+    UBX_MSG_NAV_PVT,
+    UBX_MSG_NAV_DOP,
+    UBX_MSG_NAV_SAT,
+    UBX_MSG_NAV_SVINFO,
+    UBX_MSG_ACK_ACK,
+    UBX_MSG_ACK_NAK,
+    UBX_MSG_OTHER,
+};
+
+struct ubx_parser {
+    enum ubx_state state;
+    enum ubx_msg msg;
+    uint8_t msg_class;
+    uint8_t msg_id;
+    uint8_t ck_a;
+    uint8_t ck_b;
+    uint16_t len;
+    uint16_t payload_idx;
+    uint16_t bfr_len;
+    // NAV-PVT, NAV-DOP and ACK payloads are buffered. NAV-SAT/NAV-SVINFO are decoded
+    // one satellite block at a time, so only a block is buffered.
+    uint8_t bfr[UBX_BFR_SIZE];
+    struct sat_report sats[MAX_SATS]; // NAV-SAT/NAV-SVINFO decode in progress.
+    uint8_t num_sats;
+};
+
 struct gps_state {
     enum ttys_instance_id ttys_instance_id;
-    char in_bfr[GPS_IN_BFR_SIZE];
-    uint16_t in_bfr_chars;
+    struct nmea_parser parser;
+    struct ubx_parser ubx;
+    bool ubx_mode;
+    uint16_t ubx_meas_rate_ms;
+    struct gps_fix fix;
     struct sat_data sat_data[MAX_SATS];
     bool disp_map_on;
     bool disp_map_clear_screen;
@@ -82,17 +218,54 @@ struct gps_state {
     int32_t cleanup_tmr_id;
 };
 
+enum gps_u16_pms {
+    CNT_NMEA_OK,
+    CNT_NMEA_CSUM_ERR,
+    CNT_NMEA_FORMAT_ERR,
+    CNT_NMEA_IGNORED,
+    CNT_UBX_OK,
+    CNT_UBX_CSUM_ERR,
+    CNT_UBX_FORMAT_ERR,
+    CNT_UBX_ACK,
+    CNT_UBX_NAK,
+
+    NUM_U16_PMS
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
 static int32_t cmd_gps_status(int32_t argc, const char** argv);
 static int32_t cmd_gps_map(int32_t argc, const char** argv);
+static int32_t cmd_gps_ubx(int32_t argc, const char** argv);
 
-static void process_msg(char* msg);
+static void nmea_parse_char(char c);
+static void nmea_field_end(void);
+static void nmea_gga_field(struct gps_fix* fix, uint8_t field_num,
+                           struct nmea_field* f);
+static void nmea_rmc_field(struct gps_fix* fix, uint8_t field_num,
+                           struct nmea_field* f);
+static void nmea_gsv_field(uint8_t field_num, struct nmea_field* f);
+static void nmea_accept(void);
+static void ubx_parse_char(uint8_t c);
+static void ubx_payload_char(uint8_t c);
+static void ubx_sat_block(void);
+static void ubx_accept(void);
+static void ubx_nav_pvt(const uint8_t* p);
+static int32_t ubx_send(uint8_t msg_class, uint8_t msg_id,
+                        const uint8_t* payload, uint16_t len);
+static int32_t ubx_configure(bool ubx_mode);
+static uint32_t get_le(const uint8_t* p, uint32_t num_bytes);
+static void sat_reports_accept(const struct sat_report* sats,
+                               uint32_t num_sats);
+static uint32_t field_to_fixed(struct nmea_field* f, uint8_t frac_digits);
+static int32_t field_to_deg_e7(struct nmea_field* f);
+static uint32_t field_to_time_ms(struct nmea_field* f);
+static int32_t hex_to_val(char c);
 static char sat_idx_to_char(int32_t sat_idx);
-static char* csv_get_token(char* start, char** next_start);
 static void display_map(void);
+static int32_t cos_deg(int32_t deg);
 static enum tmr_cb_action cleanup_tmr_cb(int32_t tmr_id, uint32_t user_data);
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -101,6 +274,20 @@ static enum tmr_cb_action cleanup_tmr_cb(int32_t tmr_id, uint32_t user_data);
 
 static struct gps_state gps_state;
 
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "nmea ok",
+    "nmea csum err",
+    "nmea format err",
+    "nmea ignored",
+    "ubx ok",
+    "ubx csum err",
+    "ubx format err",
+    "ubx ack",
+    "ubx nak",
+};
+
 static struct cmd_cmd_info cmds[] = {
     {
         .name = "status",
@@ -111,7 +298,12 @@ static struct cmd_cmd_info cmds[] = {
         .name = "map",
         .func = cmd_gps_map,
         .help = "Map display on/off/clear, usage: gps map {on|off|clear}",
-    }
+    },
+    {
+        .name = "ubx",
+        .func = cmd_gps_ubx,
+        .help = "Configure receiver output, usage: gps ubx {on|off}",
+    },
 };
 
 static int32_t log_level = LOG_DEFAULT;
@@ -121,6 +313,9 @@ static struct cmd_client_info cmd_info = {
     .num_cmds = ARRAY_SIZE(cmds),
     .cmds = cmds,
     .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -145,6 +340,8 @@ int32_t gps_get_def_cfg(struct gps_cfg* cfg)
 
     memset(cfg, 0, sizeof(*cfg));
     cfg->ttys_instance_id = CONFIG_GPS_DFLT_TTYS_INSTANCE;
+    cfg->ubx_mode = CONFIG_GPS_DFLT_UBX_MODE;
+    cfg->ubx_meas_rate_ms = CONFIG_GPS_DFLT_UBX_MEAS_RATE_MS;
     return 0;
 }
 
@@ -165,6 +362,8 @@ int32_t gps_init(struct gps_cfg* cfg)
     }
     memset(&gps_state, 0, sizeof(gps_state));
     gps_state.ttys_instance_id = cfg->ttys_instance_id;
+    gps_state.ubx_mode = cfg->ubx_mode;
+    gps_state.ubx_meas_rate_ms = cfg->ubx_meas_rate_ms;
     gps_state.disp_map_clear_history = true;
     return 0;
 }
@@ -194,6 +393,16 @@ int32_t gps_start(void)
         return gps_state.cleanup_tmr_id;
     }
 
+    // The receiver powers up in NMEA mode, so only needs to be configured
+    // for UBX mode.
+    if (gps_state.ubx_mode) {
+        result = ubx_configure(true);
+        if (result < 0) {
+            log_error("gps_start: ubx error %d\n", result);
+            return result;
+        }
+    }
+
     return 0;
 }
 
@@ -208,24 +417,13 @@ int32_t gps_run(void)
 {
     char c;
     while (ttys_getc(gps_state.ttys_instance_id, &c)) {
-        if (c == '\n' || c == '\r') {
-            if (gps_state.in_bfr_chars > 0) {
-                gps_state.in_bfr[gps_state.in_bfr_chars] = '\0';
-                process_msg(gps_state.in_bfr);
-                gps_state.in_bfr_chars = 0;
-            }
-            continue;
-        }
-        if (isprint(c)) {
-            if (gps_state.in_bfr_chars < (GPS_IN_BFR_SIZE-1)) {
-                gps_state.in_bfr[gps_state.in_bfr_chars++] = c;
-            } else {
-                gps_state.in_bfr[GPS_IN_BFR_SIZE-1] = '\0';
-                log_debug("Truncated: %s\n", gps_state.in_bfr);
-                gps_state.in_bfr_chars = 0;
-            }
-            continue;
-        }
+        // UBX frames can contain any byte value, so while one is being
+        // received it gets all the characters. NMEA text never contains the
+        // UBX sync characters.
+        if (gps_state.ubx.state != UBX_STATE_IDLE || (uint8_t)c == UBX_SYNC_1)
+            ubx_parse_char((uint8_t)c);
+        else
+            nmea_parse_char(c);
     }
     if (gps_state.disp_map_on && gps_state.disp_map_update) {
         display_map();
@@ -234,6 +432,25 @@ int32_t gps_run(void)
     return 0;
 }
 
+/*
+ * @brief Get the latest position/velocity data.
+ *
+ * @param[out] fix The latest data decoded from GGA/RMC sentences.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * MOD_ERR_UNAVAIL is returned if no GGA/RMC sentence has been accepted yet.
+ * Note that a successful return does not mean there is a valid fix; check the
+ * quality and valid members for that.
+ */
+int32_t gps_get_fix(struct gps_fix* fix)
+{
+    if (fix == NULL)
+        return MOD_ERR_ARG;
+    *fix = gps_state.fix;
+    return fix->update_ms == 0 ? MOD_ERR_UNAVAIL : 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -250,8 +467,33 @@ int32_t gps_run(void)
  */
 static int32_t cmd_gps_status(int32_t argc, const char** argv)
 {
+    struct gps_fix* fix = &gps_state.fix;
     int32_t idx;
 
+    if (fix->update_ms == 0) {
+        printc("No position data\n");
+    } else {
+        printc("Position: quality=%u sats=%u hdop=%lu.%02lu status=%c "
+               "data-age=%lu ms\n",
+               fix->quality, fix->num_sats,
+               fix->hdop_x100 / 100, fix->hdop_x100 % 100,
+               fix->valid ? 'A' : 'V',
+               tmr_get_ms() - fix->update_ms);
+        printc("  time=%02lu:%02lu:%02lu.%03lu date(ddmmyy)=%06lu\n",
+               fix->time_ms / 3600000, (fix->time_ms / 60000) % 60,
+               (fix->time_ms / 1000) % 60, fix->time_ms % 1000, fix->date);
+        printc("  lat=%c%lu.%07lu lon=%c%lu.%07lu alt=%ld dm\n",
+               fix->lat_e7 < 0 ? '-' : '+',
+               (uint32_t)abs(fix->lat_e7) / 10000000,
+               (uint32_t)abs(fix->lat_e7) % 10000000,
+               fix->lon_e7 < 0 ? '-' : '+',
+               (uint32_t)abs(fix->lon_e7) / 10000000,
+               (uint32_t)abs(fix->lon_e7) % 10000000,
+               fix->alt_dm);
+        printc("  speed=%lu.%02lu knots course=%u.%02u deg\n",
+               fix->speed_knots_x100 / 100, fix->speed_knots_x100 % 100,
+               fix->course_deg_x100 / 100, fix->course_deg_x100 % 100);
+    }
     printc("Reported satellites:\n");
     for (idx = 0; idx < MAX_SATS; idx++) {
         struct sat_data* sat_data = &gps_state.sat_data[idx];
@@ -266,6 +508,7 @@ static int32_t cmd_gps_status(int32_t argc, const char** argv)
         }
     }
     printc("gps map: %s\n", gps_state.disp_map_on ? "on" : "off");
+    printc("gps ubx: %s\n", gps_state.ubx_mode ? "on" : "off");
     return 0;
 }
 
@@ -290,10 +533,12 @@ static int32_t cmd_gps_map(int32_t argc, const char** argv)
     if (strcasecmp(op, "on") == 0) {
         gps_state.disp_map_on = true;
         gps_state.disp_map_clear_screen = true;
+        gps_state.disp_map_update = true;
     } else if (strcasecmp(op, "off") == 0) {
         gps_state.disp_map_on = false;
     } else if (strcasecmp(op, "clear") == 0) {
-        gps_state.disp_map_clear_history = false;
+        gps_state.disp_map_clear_history = true;
+        gps_state.disp_map_update = true;
     } else {
         printc("Invalid operation '%s'\n", op);
         return MOD_ERR_ARG;
@@ -302,143 +547,841 @@ static int32_t cmd_gps_map(int32_t argc, const char** argv)
 }
 
 /*
- * @brief Process a message received from the GPS hardware module.
+ * @brief Console command function for "gps ubx".
+ *
+ * @param[in] argc Number of arguments, including "gps"
+ * @param[in] argv Argument values, including "gps"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: gps ubx {on|off}
  *
- * @param[in] msg GPS hardware module message.
+ * This (re)sends the receiver configuration, so can also be used if the
+ * receiver was powered up after gps_start().
  */
-static void process_msg(char* msg)
+static int32_t cmd_gps_ubx(int32_t argc, const char** argv)
 {
-    enum parse_state {
-        PARSE_STATE_START,
-        PARSE_STATE_GPGSV,
-        PARSE_STATE_IGNORE,
-    };
+    struct cmd_arg_val arg_vals[1];
+    const char* op;
+    int32_t rc;
 
-    char* next = msg;
-    enum parse_state parse_state = PARSE_STATE_START;
-    int32_t field_num = 0;
-    int32_t satellite_num = -1;
-    uint16_t msg_azimuth;
-    uint8_t msg_elevation;
-    uint8_t msg_snr;
-    struct sat_data* sat_data;
+    if (cmd_parse_args(argc-2, argv+2, "s", arg_vals) != 1)
+        return MOD_ERR_BAD_CMD;
+    op = arg_vals[0].val.s;
+    if (strcasecmp(op, "on") == 0) {
+        gps_state.ubx_mode = true;
+    } else if (strcasecmp(op, "off") == 0) {
+        gps_state.ubx_mode = false;
+    } else {
+        printc("Invalid operation '%s'\n", op);
+        return MOD_ERR_ARG;
+    }
+    rc = ubx_configure(gps_state.ubx_mode);
+    if (rc < 0)
+        printc("Configuration failed (%ld)\n", rc);
+    return rc;
+}
 
-    log_verbose("Msg: %s\n", msg);
-    while (1) {
-        if (next == NULL)
+/*
+ * @brief Process one character received from the GPS hardware module.
+ *
+ * @param[in] c The received character.
+ *
+ * This is a state machine for NMEA sentences of the form
+ * "$ttsss,f1,f2,...,fn*hh". Each data field is decoded as it ends (at ',' or
+ * '*'), into a structure that is only made visible once the checksum has been
+ * verified. Sentences other than GGA/RMC/GSV are dropped as soon as their
+ * address is known.
+ */
+static void nmea_parse_char(char c)
+{
+    struct nmea_parser* p = &gps_state.parser;
+    struct nmea_field* f = &p->field;
+    int32_t val;
+
+    if (c == '$') {
+        if (p->state != NMEA_STATE_IDLE) {
+            log_debug("Truncated sentence\n");
+            INC_SAT_U16(cnts_u16[CNT_NMEA_FORMAT_ERR]);
+        }
+        p->state = NMEA_STATE_ADDR;
+        p->csum = 0;
+        p->addr_len = 0;
+        return;
+    }
+
+    switch (p->state) {
+        case NMEA_STATE_IDLE:
+            break;
+
+        case NMEA_STATE_ADDR:
+            if (c != ',') {
+                if (p->addr_len < NMEA_ADDR_LEN && c >= 'A' && c <= 'Z') {
+                    p->addr[p->addr_len++] = c;
+                    p->csum ^= c;
+                } else {
+                    INC_SAT_U16(cnts_u16[CNT_NMEA_FORMAT_ERR]);
+                    p->state = NMEA_STATE_IDLE;
+                }
+                break;
+            }
+            // Any talker ID (GP, GN, GL, ...) is accepted.
+            if (p->addr_len != NMEA_ADDR_LEN) {
+                INC_SAT_U16(cnts_u16[CNT_NMEA_IGNORED]);
+                p->state = NMEA_STATE_IDLE;
+                break;
+            }
+            if (memcmp(&p->addr[2], "GGA", 3) == 0) {
+                p->msg = NMEA_MSG_GGA;
+            } else if (memcmp(&p->addr[2], "RMC", 3) == 0) {
+                p->msg = NMEA_MSG_RMC;
+            } else if (memcmp(&p->addr[2], "GSV", 3) == 0) {
+                p->msg = NMEA_MSG_GSV;
+            } else {
+                INC_SAT_U16(cnts_u16[CNT_NMEA_IGNORED]);
+                p->state = NMEA_STATE_IDLE;
+                break;
+            }
+            p->csum ^= c;
+            p->field_num = 1;
+            memset(f, 0, sizeof(*f));
+            if (p->msg == NMEA_MSG_GSV)
+                p->num_sats = 0;
+            else
+                p->fix = gps_state.fix;
+            p->state = NMEA_STATE_FIELD;
             break;
-        char* token = csv_get_token(next, &next);
-        field_num++;
-        switch (parse_state) {
-            case PARSE_STATE_START:
-                parse_state = strcasecmp(token, "$GPGSV") == 0 ?
-                    PARSE_STATE_GPGSV : PARSE_STATE_IGNORE;
+
+        case NMEA_STATE_FIELD:
+            if (c == '*') {
+                nmea_field_end();
+                p->state = NMEA_STATE_CSUM_1;
+                break;
+            }
+            if (c < ' ' || c > '~') {
+                // Includes CR/LF, i.e. a sentence without a checksum.
+                INC_SAT_U16(cnts_u16[CNT_NMEA_FORMAT_ERR]);
+                p->state = NMEA_STATE_IDLE;
                 break;
-            case PARSE_STATE_GPGSV:
-                switch ((field_num - 5) % 4) {
-                    case 0:
-                        // Satellite PRN number
-                        satellite_num = atoi(token);
-                        if (satellite_num < 1 || satellite_num > 32) {
-                            log_debug("Unused satellite, number=%s\n", token);
-                            parse_state = PARSE_STATE_IGNORE;
-                        } else {
-                            // Make satellite number zero-based.
-                            satellite_num--;
-                        }
-                        break;
-                    case 1:
-                        // Elevation degress (0-90)
-                        msg_elevation = atoi(token);
-                        break;
-                    case 2:
-                        // Azimuth degress (000-359)
-                        msg_azimuth = atoi(token);
-                        break;
-                    case 3:
-                        // SNR (00-99)
-                        msg_snr = atoi(token);
-                        sat_data = &gps_state.sat_data[satellite_num];
-                        if ((!sat_data->present) ||
-                            (msg_elevation != sat_data->elevation) ||
-                            (msg_azimuth != sat_data->azimuth)) {
-                            log_debug("Update sat %d ele=%d az=%d snr=%d\n",
-                                      satellite_num+1, msg_elevation,
-                                      msg_azimuth, msg_snr);
-                            sat_data->present = true;
-                            sat_data->elevation = msg_elevation;
-                            sat_data->azimuth = msg_azimuth;
-                            gps_state.disp_map_update = true;
-                        }
-                        sat_data->snr = msg_snr;
-                        sat_data->last_update_ms = tmr_get_ms();
-                        break;
+            }
+            p->csum ^= c;
+            if (c == ',') {
+                nmea_field_end();
+                if (p->field_num < UINT8_MAX)
+                    p->field_num++;
+                memset(f, 0, sizeof(*f));
+            } else if (c >= '0' && c <= '9') {
+                // Excess digits are dropped, without affecting the scale.
+                if (f->val <= (UINT32_MAX - 9) / 10) {
+                    f->val = f->val * 10 + (c - '0');
+                    if (f->dot)
+                        f->frac_digits++;
                 }
+            } else if (c == '.') {
+                f->dot = true;
+            } else if (c == '-') {
+                f->neg = true;
+            } else {
+                f->ch = c;
+            }
+            break;
+
+        case NMEA_STATE_CSUM_1:
+        case NMEA_STATE_CSUM_2:
+            val = hex_to_val(c);
+            if (val < 0) {
+                INC_SAT_U16(cnts_u16[CNT_NMEA_FORMAT_ERR]);
+                p->state = NMEA_STATE_IDLE;
                 break;
-            case PARSE_STATE_IGNORE:
-                continue;
-        }
-        if (next == NULL)
+            }
+            if (p->state == NMEA_STATE_CSUM_1) {
+                p->rx_csum = val << 4;
+                p->state = NMEA_STATE_CSUM_2;
+                break;
+            }
+            p->rx_csum |= val;
+            p->state = NMEA_STATE_IDLE;
+            if (p->rx_csum == p->csum) {
+                INC_SAT_U16(cnts_u16[CNT_NMEA_OK]);
+                nmea_accept();
+            } else {
+                log_debug("Checksum error %.5s rx=%02x calc=%02x\n", p->addr,
+                          p->rx_csum, p->csum);
+                INC_SAT_U16(cnts_u16[CNT_NMEA_CSUM_ERR]);
+            }
             break;
     }
 }
 
 /*
- * @brief Convert statellite index of the display char.
+ * @brief Decode the data field that has just ended.
+ */
+static void nmea_field_end(void)
+{
+    struct nmea_parser* p = &gps_state.parser;
+
+    switch (p->msg) {
+        case NMEA_MSG_GGA:
+            nmea_gga_field(&p->fix, p->field_num, &p->field);
+            break;
+        case NMEA_MSG_RMC:
+            nmea_rmc_field(&p->fix, p->field_num, &p->field);
+            break;
+        case NMEA_MSG_GSV:
+            nmea_gsv_field(p->field_num, &p->field);
+            break;
+    }
+}
+
+/*
+ * @brief Decode a GGA (fix data) field.
  *
- * @param[in] sat_idx Satellite index (zero-based).
+ * @param[in,out] fix Fix data being decoded.
+ * @param[in] field_num Field number (1-based).
+ * @param[in] f The field.
  *
- * @return The satellite dislay char.
+ * Format: $--GGA,hhmmss.ss,ddmm.mm,N,dddmm.mm,E,q,ns,hdop,alt,M,...
  */
-static char sat_idx_to_char(int32_t sat_idx)
+static void nmea_gga_field(struct gps_fix* fix, uint8_t field_num,
+                           struct nmea_field* f)
 {
-    if (sat_idx < 9)
-        return '1' + sat_idx;
-    return 'A' + (sat_idx - 9);
+    switch (field_num) {
+        case 1:
+            fix->time_ms = field_to_time_ms(f);
+            break;
+        case 2:
+            fix->lat_e7 = field_to_deg_e7(f);
+            break;
+        case 3:
+            if (f->ch == 'S')
+                fix->lat_e7 = -fix->lat_e7;
+            break;
+        case 4:
+            fix->lon_e7 = field_to_deg_e7(f);
+            break;
+        case 5:
+            if (f->ch == 'W')
+                fix->lon_e7 = -fix->lon_e7;
+            break;
+        case 6:
+            fix->quality = f->val;
+            break;
+        case 7:
+            fix->num_sats = f->val;
+            break;
+        case 8:
+            fix->hdop_x100 = field_to_fixed(f, 2);
+            break;
+        case 9:
+            fix->alt_dm = field_to_fixed(f, 1);
+            if (f->neg)
+                fix->alt_dm = -fix->alt_dm;
+            break;
+    }
 }
 
 /*
- * @brief Tokenize a CSV string in-place, incrementally.
+ * @brief Decode an RMC (recommended minimum data) field.
+ *
+ * @param[in,out] fix Fix data being decoded.
+ * @param[in] field_num Field number (1-based).
+ * @param[in] f The field.
  *
- * @param[in] start The current point in the string, typically pointing to the
- *            next token.
- * @param[out] next_start The start of the next token. This should be passed in
- *             as "start" in the next call. If there are no more tokens, it will
- *             be set to NULL.
+ * Format: $--RMC,hhmmss.ss,A,ddmm.mm,N,dddmm.mm,E,knots,course,ddmmyy,...
+ */
+static void nmea_rmc_field(struct gps_fix* fix, uint8_t field_num,
+                           struct nmea_field* f)
+{
+    switch (field_num) {
+        case 1:
+            fix->time_ms = field_to_time_ms(f);
+            break;
+        case 2:
+            fix->valid = f->ch == 'A';
+            break;
+        case 3:
+            fix->lat_e7 = field_to_deg_e7(f);
+            break;
+        case 4:
+            if (f->ch == 'S')
+                fix->lat_e7 = -fix->lat_e7;
+            break;
+        case 5:
+            fix->lon_e7 = field_to_deg_e7(f);
+            break;
+        case 6:
+            if (f->ch == 'W')
+                fix->lon_e7 = -fix->lon_e7;
+            break;
+        case 7:
+            fix->speed_knots_x100 = field_to_fixed(f, 2);
+            break;
+        case 8:
+            fix->course_deg_x100 = field_to_fixed(f, 2);
+            break;
+        case 9:
+            fix->date = f->val;
+            break;
+    }
+}
+
+/*
+ * @brief Decode a GSV (satellites in view) field.
  *
- * @return The next token to process. The token might have zero length (e.g.
- *         in the case of consecutive commas).
+ * @param[in] field_num Field number (1-based).
+ * @param[in] f The field.
  *
- * @note The char '*' is also treated as a separator (i.e. like a ',').
+ * Format: $--GSV,num_msgs,msg_num,num_sats{,prn,elevation,azimuth,snr}...
+ * with up to 4 satellites per sentence.
  */
-static char* csv_get_token(char* start, char** next_start)
+static void nmea_gsv_field(uint8_t field_num, struct nmea_field* f)
 {
-    char* p = start;
-    while (*p && *p != ',' && *p != '*') p++;
-    if (*p == ',' || *p == '*') {
-        *p++ = '\0';
-        *next_start = p;
+    struct nmea_parser* p = &gps_state.parser;
+    struct sat_report* sat;
+    uint32_t sat_idx;
+
+    if (field_num < 4)
+        return;
+    sat_idx = (field_num - 4) / 4;
+    if (sat_idx >= NMEA_GSV_MAX_SATS)
+        return;
+    sat = &p->sats[sat_idx];
+    switch ((field_num - 4) % 4) {
+        case 0:
+            // Satellite PRN number
+            memset(sat, 0, sizeof(*sat));
+            sat->prn = f->val;
+            p->num_sats = sat_idx + 1;
+            break;
+        case 1:
+            // Elevation degress (0-90)
+            sat->elevation = f->val;
+            break;
+        case 2:
+            // Azimuth degress (000-359)
+            sat->azimuth = f->val;
+            break;
+        case 3:
+            // SNR (00-99)
+            sat->snr = f->val;
+            break;
+    }
+}
+
+/*
+ * @brief Accept a sentence that has passed the checksum test.
+ */
+static void nmea_accept(void)
+{
+    struct nmea_parser* p = &gps_state.parser;
+
+    if (p->msg != NMEA_MSG_GSV) {
+        gps_state.fix = p->fix;
+        gps_state.fix.update_ms = tmr_get_ms();
     } else {
-        *next_start = NULL;
+        sat_reports_accept(p->sats, p->num_sats);
     }
-    return start;
+}
+
+/*
+ * @brief Update the satellite table from decoded satellite reports.
+ *
+ * @param[in] sats The satellite reports.
+ * @param[in] num_sats Number of satellite reports.
+ *
+ * Only GPS satellites (PRN 1-32) are tracked.
+ */
+static void sat_reports_accept(const struct sat_report* sats,
+                               uint32_t num_sats)
+{
+    struct sat_data* sat_data;
+    const struct sat_report* sat;
+    uint32_t idx;
+
+    for (idx = 0; idx < num_sats; idx++) {
+        sat = &sats[idx];
+        if (sat->prn < 1 || sat->prn > MAX_SATS) {
+            log_debug("Unused satellite, number=%u\n", sat->prn);
+            continue;
+        }
+        // Make satellite number zero-based.
+        sat_data = &gps_state.sat_data[sat->prn - 1];
+        if ((!sat_data->present) ||
+            (sat->elevation != sat_data->elevation) ||
+            (sat->azimuth != sat_data->azimuth)) {
+            log_debug("Update sat %d ele=%d az=%d snr=%d\n",
+                      sat->prn, sat->elevation, sat->azimuth, sat->snr);
+            sat_data->present = true;
+            sat_data->elevation = sat->elevation;
+            sat_data->azimuth = sat->azimuth;
+            gps_state.disp_map_update = true;
+        }
+        sat_data->snr = sat->snr;
+        sat_data->last_update_ms = tmr_get_ms();
+    }
+}
+
+/*
+ * @brief Process one byte of a UBX frame received from the GPS hardware module.
+ *
+ * @param[in] c The received byte.
+ *
+ * Frame format: 0xb5 0x62 class id len(2) payload(len) ck_a ck_b, with
+ * little-endian multi-byte values. The checksum is an 8-bit Fletcher checksum
+ * over class through payload.
+ */
+static void ubx_parse_char(uint8_t c)
+{
+    struct ubx_parser* u = &gps_state.ubx;
+
+    if (u->state >= UBX_STATE_CLASS && u->state <= UBX_STATE_PAYLOAD) {
+        u->ck_a += c;
+        u->ck_b += u->ck_a;
+    }
+
+    switch (u->state) {
+        case UBX_STATE_IDLE:
+            if (c == UBX_SYNC_1)
+                u->state = UBX_STATE_SYNC_2;
+            break;
+
+        case UBX_STATE_SYNC_2:
+            if (c == UBX_SYNC_2) {
+                u->ck_a = 0;
+                u->ck_b = 0;
+                u->state = UBX_STATE_CLASS;
+            } else if (c != UBX_SYNC_1) {
+                u->state = UBX_STATE_IDLE;
+            }
+            break;
+
+        case UBX_STATE_CLASS:
+            u->msg_class = c;
+            u->state = UBX_STATE_ID;
+            break;
+
+        case UBX_STATE_ID:
+            u->msg_id = c;
+            u->state = UBX_STATE_LEN_1;
+            break;
+
+        case UBX_STATE_LEN_1:
+            u->len = c;
+            u->state = UBX_STATE_LEN_2;
+            break;
+
+        case UBX_STATE_LEN_2:
+            u->len |= (uint16_t)c << 8;
+            if (u->len > UBX_MAX_LEN) {
+                INC_SAT_U16(cnts_u16[CNT_UBX_FORMAT_ERR]);
+                u->state = UBX_STATE_IDLE;
+                break;
+            }
+            u->msg = UBX_MSG_OTHER;
+            if (u->msg_class == UBX_CLASS_NAV) {
+                if (u->msg_id == UBX_ID_NAV_PVT)
+                    u->msg = UBX_MSG_NAV_PVT;
+                else if (u->msg_id == UBX_ID_NAV_DOP)
+                    u->msg = UBX_MSG_NAV_DOP;
+                else if (u->msg_id == UBX_ID_NAV_SAT)
+                    u->msg = UBX_MSG_NAV_SAT;
+                else if (u->msg_id == UBX_ID_NAV_SVINFO)
+                    u->msg = UBX_MSG_NAV_SVINFO;
+            } else if (u->msg_class == UBX_CLASS_ACK) {
+                if (u->msg_id == UBX_ID_ACK_ACK)
+                    u->msg = UBX_MSG_ACK_ACK;
+                else if (u->msg_id == UBX_ID_ACK_NAK)
+                    u->msg = UBX_MSG_ACK_NAK;
+            }
+            u->payload_idx = 0;
+            u->bfr_len = 0;
+            u->num_sats = 0;
+            u->state = u->len == 0 ? UBX_STATE_CK_A : UBX_STATE_PAYLOAD;
+            break;
+
+        case UBX_STATE_PAYLOAD:
+            ubx_payload_char(c);
+            if (++u->payload_idx == u->len)
+                u->state = UBX_STATE_CK_A;
+            break;
+
+        case UBX_STATE_CK_A:
+        case UBX_STATE_CK_B:
+            if (c != (u->state == UBX_STATE_CK_A ? u->ck_a : u->ck_b)) {
+                log_debug("UBX checksum error class=%02x id=%02x\n",
+                          u->msg_class, u->msg_id);
+                INC_SAT_U16(cnts_u16[CNT_UBX_CSUM_ERR]);
+                u->state = UBX_STATE_IDLE;
+            } else if (u->state == UBX_STATE_CK_A) {
+                u->state = UBX_STATE_CK_B;
+            } else {
+                INC_SAT_U16(cnts_u16[CNT_UBX_OK]);
+                ubx_accept();
+                u->state = UBX_STATE_IDLE;
+            }
+            break;
+    }
+}
+
+/*
+ * @brief Process one byte of a UBX frame payload.
+ *
+ * @param[in] c The payload byte.
+ */
+static void ubx_payload_char(uint8_t c)
+{
+    struct ubx_parser* u = &gps_state.ubx;
+
+    switch (u->msg) {
+        case UBX_MSG_NAV_PVT:
+        case UBX_MSG_NAV_DOP:
+        case UBX_MSG_ACK_ACK:
+        case UBX_MSG_ACK_NAK:
+            if (u->bfr_len < UBX_BFR_SIZE)
+                u->bfr[u->bfr_len++] = c;
+            break;
+        case UBX_MSG_NAV_SAT:
+        case UBX_MSG_NAV_SVINFO:
+            u->bfr[u->bfr_len++] = c;
+            if (u->payload_idx < UBX_SAT_HDR_LEN) {
+                // The header is not needed.
+                if (u->bfr_len == UBX_SAT_HDR_LEN)
+                    u->bfr_len = 0;
+            } else if (u->bfr_len == UBX_SAT_BLOCK_LEN) {
+                ubx_sat_block();
+                u->bfr_len = 0;
+            }
+            break;
+        case UBX_MSG_OTHER:
+            break;
+    }
+}
+
+/*
+ * @brief Decode one satellite block of a NAV-SAT or NAV-SVINFO frame.
+ *
+ * NAV-SAT block: gnssId(1) svId(1) cno(1) elev(1) azim(2) prRes(2) flags(4)
+ * NAV-SVINFO block: chn(1) svid(1) flags(1) quality(1) cno(1) elev(1)
+ *                   azim(2) prRes(4)
+ */
+static void ubx_sat_block(void)
+{
+    struct ubx_parser* u = &gps_state.ubx;
+    const uint8_t* b = u->bfr;
+    struct sat_report* sat;
+    int8_t elevation;
+
+    if (u->num_sats >= MAX_SATS)
+        return;
+    sat = &u->sats[u->num_sats];
+    if (u->msg == UBX_MSG_NAV_SAT) {
+        if (b[0] != 0)
+            return; // Not GPS
+        sat->prn = b[1];
+        sat->snr = b[2];
+        elevation = (int8_t)b[3];
+        sat->azimuth = (uint16_t)get_le(&b[4], 2);
+    } else {
+        sat->prn = b[1];
+        sat->snr = b[4];
+        elevation = (int8_t)b[5];
+        sat->azimuth = (uint16_t)get_le(&b[6], 2);
+    }
+    // Satellites below the horizon, or with unknown positions, are skipped.
+    if (elevation < 0 || sat->azimuth > 359)
+        return;
+    sat->elevation = elevation;
+    u->num_sats++;
+}
+
+/*
+ * @brief Accept a UBX frame that has passed the checksum test.
+ */
+static void ubx_accept(void)
+{
+    struct ubx_parser* u = &gps_state.ubx;
+
+    switch (u->msg) {
+        case UBX_MSG_NAV_PVT:
+            if (u->len < UBX_NAV_PVT_MIN_LEN) {
+                INC_SAT_U16(cnts_u16[CNT_UBX_FORMAT_ERR]);
+                break;
+            }
+            ubx_nav_pvt(u->bfr);
+            break;
+        case UBX_MSG_NAV_DOP:
+            if (u->len < UBX_NAV_DOP_LEN) {
+                INC_SAT_U16(cnts_u16[CNT_UBX_FORMAT_ERR]);
+                break;
+            }
+            // NAV-PVT only has PDOP, so HDOP comes from here.
+            gps_state.fix.hdop_x100 = (uint16_t)get_le(&u->bfr[12], 2);
+            break;
+        case UBX_MSG_NAV_SAT:
+        case UBX_MSG_NAV_SVINFO:
+            sat_reports_accept(u->sats, u->num_sats);
+            break;
+        case UBX_MSG_ACK_ACK:
+        case UBX_MSG_ACK_NAK:
+            log_debug("UBX %s class=%02x id=%02x\n",
+                      u->msg == UBX_MSG_ACK_ACK ? "ack" : "nak",
+                      u->bfr[0], u->bfr[1]);
+            if (u->msg == UBX_MSG_ACK_ACK)
+                INC_SAT_U16(cnts_u16[CNT_UBX_ACK]);
+            else
+                INC_SAT_U16(cnts_u16[CNT_UBX_NAK]);
+            break;
+        case UBX_MSG_OTHER:
+            break;
+    }
+}
+
+/*
+ * @brief Decode a NAV-PVT payload into the fix data.
+ *
+ * @param[in] p The payload.
+ */
+static void ubx_nav_pvt(const uint8_t* p)
+{
+    struct gps_fix* fix = &gps_state.fix;
+    int32_t nano = (int32_t)get_le(&p[16], 4);
+    uint8_t flags = p[21];
+    int32_t speed_mm_s = (int32_t)get_le(&p[60], 4);
+    int32_t head_e5 = (int32_t)get_le(&p[64], 4);
+
+    fix->time_ms = ((p[8] * 60 + p[9]) * 60 + p[10]) * 1000 +
+        (nano > 0 ? nano / 1000000 : 0);
+    fix->date = p[7] * 10000 + p[6] * 100 + get_le(&p[4], 2) % 100;
+    fix->lon_e7 = (int32_t)get_le(&p[24], 4);
+    fix->lat_e7 = (int32_t)get_le(&p[28], 4);
+    fix->alt_dm = (int32_t)get_le(&p[36], 4) / 100;
+    // 1 knot = 514.444 mm/s.
+    fix->speed_knots_x100 = speed_mm_s > 0 ? speed_mm_s * 1944 / 10000 : 0;
+    fix->course_deg_x100 = head_e5 > 0 ? head_e5 / 1000 : 0;
+    fix->num_sats = p[23];
+    // Map gnssFixOK/diffSoln flags to GGA quality values.
+    fix->valid = (flags & 0x01) != 0;
+    fix->quality = fix->valid ? ((flags & 0x02) ? 2 : 1) : 0;
+    fix->update_ms = tmr_get_ms();
+}
+
+/*
+ * @brief Send a UBX frame to the GPS hardware module.
+ *
+ * @param[in] msg_class Message class.
+ * @param[in] msg_id Message ID.
+ * @param[in] payload Message payload.
+ * @param[in] len Payload length (max 20).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t ubx_send(uint8_t msg_class, uint8_t msg_id,
+                        const uint8_t* payload, uint16_t len)
+{
+    uint8_t frame[8 + 20];
+    uint8_t ck_a = 0;
+    uint8_t ck_b = 0;
+    uint16_t idx;
+
+    if (len > sizeof(frame) - 8)
+        return MOD_ERR_ARG;
+    frame[0] = UBX_SYNC_1;
+    frame[1] = UBX_SYNC_2;
+    frame[2] = msg_class;
+    frame[3] = msg_id;
+    frame[4] = len & 0xff;
+    frame[5] = len >> 8;
+    memcpy(&frame[6], payload, len);
+    for (idx = 2; idx < 6 + len; idx++) {
+        ck_a += frame[idx];
+        ck_b += ck_a;
+    }
+    frame[6 + len] = ck_a;
+    frame[7 + len] = ck_b;
+    if (ttys_write(gps_state.ttys_instance_id, (const char*)frame, len + 8) !=
+        len + 8)
+        return MOD_ERR_RESOURCE;
+    return 0;
+}
+
+/*
+ * @brief Configure the output protocol of the GPS hardware module.
+ *
+ * @param[in] ubx_mode True for UBX output, false for NMEA output.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * In UBX mode, NAV-PVT and NAV-DOP are output at every navigation solution.
+ * Satellite data
+ * is output about once a second, using both NAV-SAT and NAV-SVINFO as older
+ * receivers (e.g. u-blox 7) only support the latter; the receiver NAKs the
+ * one it does not support. The serial port baud rate is not changed.
+ */
+static int32_t ubx_configure(bool ubx_mode)
+{
+    uint16_t meas_rate_ms = ubx_mode ? gps_state.ubx_meas_rate_ms : 1000;
+    uint16_t out_proto = ubx_mode ? UBX_PROTO_UBX : UBX_PROTO_NMEA;
+    uint8_t sat_rate;
+    int32_t rc;
+
+    if (meas_rate_ms < 50)
+        meas_rate_ms = 50;
+    sat_rate = ubx_mode ? CLAMP(1000 / meas_rate_ms, 1, UINT8_MAX) : 0;
+
+    // CFG-PRT for UART1: 8N1 at 9600 baud, UBX+NMEA in.
+    const uint8_t prt[20] = {
+        1, 0, 0, 0,
+        0xd0, 0x08, 0, 0,
+        0x80, 0x25, 0, 0,
+        UBX_PROTO_UBX | UBX_PROTO_NMEA, 0,
+        out_proto & 0xff, out_proto >> 8,
+        0, 0, 0, 0
+    };
+    // CFG-RATE: measurement rate, 1 solution/measurement, GPS time.
+    const uint8_t rate[6] = {
+        meas_rate_ms & 0xff, meas_rate_ms >> 8, 1, 0, 1, 0
+    };
+    const uint8_t msg_pvt[3] = { UBX_CLASS_NAV, UBX_ID_NAV_PVT, ubx_mode };
+    const uint8_t msg_dop[3] = { UBX_CLASS_NAV, UBX_ID_NAV_DOP, ubx_mode };
+    const uint8_t msg_sat[3] = { UBX_CLASS_NAV, UBX_ID_NAV_SAT, sat_rate };
+    const uint8_t msg_svinfo[3] = { UBX_CLASS_NAV, UBX_ID_NAV_SVINFO,
+                                    sat_rate };
+
+    rc = ubx_send(UBX_CLASS_CFG, UBX_ID_CFG_PRT, prt, sizeof(prt));
+    if (rc == 0)
+        rc = ubx_send(UBX_CLASS_CFG, UBX_ID_CFG_RATE, rate, sizeof(rate));
+    if (rc == 0)
+        rc = ubx_send(UBX_CLASS_CFG, UBX_ID_CFG_MSG, msg_pvt, sizeof(msg_pvt));
+    if (rc == 0)
+        rc = ubx_send(UBX_CLASS_CFG, UBX_ID_CFG_MSG, msg_dop, sizeof(msg_dop));
+    if (rc == 0)
+        rc = ubx_send(UBX_CLASS_CFG, UBX_ID_CFG_MSG, msg_sat, sizeof(msg_sat));
+    if (rc == 0)
+        rc = ubx_send(UBX_CLASS_CFG, UBX_ID_CFG_MSG, msg_svinfo,
+                      sizeof(msg_svinfo));
+    return rc;
+}
+
+/*
+ * @brief Get a little-endian unsigned value.
+ *
+ * @param[in] p Pointer to the value.
+ * @param[in] num_bytes Size of the value (1-4).
+ *
+ * @return The value.
+ */
+static uint32_t get_le(const uint8_t* p, uint32_t num_bytes)
+{
+    uint32_t val = 0;
+
+    while (num_bytes-- > 0)
+        val = (val << 8) | p[num_bytes];
+    return val;
+}
+
+/*
+ * @brief Get a field value as a fixed point number.
+ *
+ * @param[in] f The field.
+ * @param[in] frac_digits Number of decimal digits in the result.
+ *
+ * @return The field value times 10^frac_digits (truncated).
+ */
+static uint32_t field_to_fixed(struct nmea_field* f, uint8_t frac_digits)
+{
+    uint32_t val = f->val;
+    uint8_t digits = f->frac_digits;
+
+    for (; digits < frac_digits; digits++)
+        val *= 10;
+    for (; digits > frac_digits; digits--)
+        val /= 10;
+    return val;
+}
+
+/*
+ * @brief Convert a [d]ddmm.mmmmm field to degrees * 1e7.
+ *
+ * @param[in] f The field.
+ *
+ * @return The angle in degrees * 1e7.
+ */
+static int32_t field_to_deg_e7(struct nmea_field* f)
+{
+    // Minutes * 1e5 to degrees * 1e7 is a factor of 100/60 = 5/3.
+    uint32_t val = field_to_fixed(f, 5);
+    uint32_t deg = val / 10000000;
+    uint32_t min_e5 = val % 10000000;
+
+    return (int32_t)(deg * 10000000 + (min_e5 * 5) / 3);
+}
+
+/*
+ * @brief Convert an hhmmss.sss field to ms since midnight.
+ *
+ * @param[in] f The field.
+ *
+ * @return The time of day in ms.
+ */
+static uint32_t field_to_time_ms(struct nmea_field* f)
+{
+    uint32_t val = field_to_fixed(f, 3);
+    uint32_t hours = val / 10000000;
+    uint32_t mins = (val / 100000) % 100;
+
+    return (hours * 3600 + mins * 60) * 1000 + val % 100000;
+}
+
+/*
+ * @brief Convert a hex digit to its value.
+ *
+ * @param[in] c The hex digit char.
+ *
+ * @return The value 0-15, or -1 if not a hex digit.
+ */
+static int32_t hex_to_val(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * @brief Convert statellite index of the display char.
+ *
+ * @param[in] sat_idx Satellite index (zero-based).
+ *
+ * @return The satellite dislay char.
+ */
+static char sat_idx_to_char(int32_t sat_idx)
+{
+    if (sat_idx < 9)
+        return '1' + sat_idx;
+    return 'A' + (sat_idx - 9);
 }
 
 /*
  * @brief Display the satellite positions as a map.
+ *
+ * The map keeps the history of satellite positions (until "gps map clear").
+ * The frame on the screen is remembered, and only cells that differ from it
+ * are written, each with a cursor position sequence (or just the separating
+ * space when it follows the previous cell on the row). The console cursor is
+ * saved and restored around the updates, so other console output is not
+ * disturbed.
  */
 static void display_map(void)
 {
-    #define DISP_MAX_RAD 10
-    #define DISP_ROWS (1 + 2*DISP_MAX_RAD)
-    #define DISP_COLS (1 + 2*DISP_MAX_RAD)
-    #define DISP_X_OFFSET DISP_MAX_RAD
-    #define DISP_Y_OFFSET DISP_MAX_RAD
-    #define DEG_TO_RAD(d) ((double)(d) * M_PI / 180.0)
-
     static char map[DISP_COLS][DISP_ROWS];
+    static char shown[DISP_COLS][DISP_ROWS];
     int32_t idx;
     int32_t idy;
+    int32_t last_idx;
+    int32_t last_idy;
 
     if (gps_state.disp_map_clear_history) {
         memset(map, '.', sizeof(map));
@@ -447,36 +1390,85 @@ static void display_map(void)
     for (idx = 0; idx < MAX_SATS; idx++) {
         struct sat_data* sat_data = &gps_state.sat_data[idx];
         if (sat_data->present && sat_data->elevation <= 90) {
-            double r = cos(DEG_TO_RAD(sat_data->elevation)) * (double)(DISP_MAX_RAD);
-            double theta = DEG_TO_RAD(90 - sat_data->azimuth);
-            int32_t x = (int32_t)round(cos(theta) * r) + DISP_X_OFFSET;
-            int32_t y = (int32_t)round(sin(theta) * r) + DISP_Y_OFFSET;
-            x = CLAMP(x, 0, DISP_COLS-1);
-            y = CLAMP(y, 0, DISP_ROWS-1);
+            // Radius is cos(elevation) with the horizon at DISP_MAX_RAD. With
+            // north up, x = r * sin(azimuth) and y = r * cos(azimuth).
+            int32_t r = cos_deg(sat_data->elevation) * DISP_MAX_RAD;
+            int32_t x = cos_deg(sat_data->azimuth - 90) * r;
+            int32_t y = cos_deg(sat_data->azimuth) * r;
+            const int32_t half = COS_TBL_SCALE * COS_TBL_SCALE / 2;
+            x = (x + (x < 0 ? -half : half)) / (COS_TBL_SCALE * COS_TBL_SCALE);
+            y = (y + (y < 0 ? -half : half)) / (COS_TBL_SCALE * COS_TBL_SCALE);
+            x = CLAMP(x + DISP_X_OFFSET, 0, DISP_COLS-1);
+            y = CLAMP(y + DISP_Y_OFFSET, 0, DISP_ROWS-1);
             map[x][y] = sat_idx_to_char(idx);
-            log_debug("%c %c az=%3d el=%3d r*1000=%5d x=%3d y=%3d\n",
+            log_debug("%c az=%3d el=%3d r*1000=%5d x=%3d y=%3d\n",
                       sat_idx_to_char(idx),
-                      map[x][y],
                       sat_data->azimuth,
                       sat_data->elevation,
-                      (int32_t)round(r*1000.0),
+                      r / (COS_TBL_SCALE / 1000),
                       x,
                       y);
         }
     }
 
-    printc("\x1B[?25l");
     if (gps_state.disp_map_clear_screen) {
         gps_state.disp_map_clear_screen = false;
-        printc("\x1B[2J");
+        memset(shown, 0, sizeof(shown));
+        printc("\x1B[2J\x1B[%d;1H", DISP_ROWS + 1);
     }
-    printc("\x1B[1;1H");
+
+    printc("\x1B""7\x1B[?25l");
+    last_idx = -1;
+    last_idy = -1;
     for (idy = DISP_ROWS-1; idy >= 0; idy--) {
-        for (idx = 0; idx < DISP_COLS; idx++)
-            printc("%c ", map[idx][idy]);
-        printc("\n");
+        for (idx = 0; idx < DISP_COLS; idx++) {
+            if (map[idx][idy] == shown[idx][idy])
+                continue;
+            shown[idx][idy] = map[idx][idy];
+            if (idy == last_idy && idx == last_idx + 1)
+                printc(" %c", map[idx][idy]);
+            else
+                printc("\x1B[%d;%dH%c", DISP_ROWS - idy, 2 * idx + 1,
+                       map[idx][idy]);
+            last_idx = idx;
+            last_idy = idy;
+        }
     }
-    printc("\x1B[?25h");
+    printc("\x1B[?25h\x1B""8");
+}
+
+/*
+ * @brief Get the cosine of an angle from a table.
+ *
+ * @param[in] deg The angle in degrees (any value).
+ *
+ * @return The cosine, scaled by COS_TBL_SCALE.
+ */
+static int32_t cos_deg(int32_t deg)
+{
+    static const int16_t cos_tbl[91] = {
+        10000,  9998,  9994,  9986,  9976,  9962,  9945,  9925,  9903,  9877,
+         9848,  9816,  9781,  9744,  9703,  9659,  9613,  9563,  9511,  9455,
+         9397,  9336,  9272,  9205,  9135,  9063,  8988,  8910,  8829,  8746,
+         8660,  8572,  8480,  8387,  8290,  8192,  8090,  7986,  7880,  7771,
+         7660,  7547,  7431,  7314,  7193,  7071,  6947,  6820,  6691,  6561,
+         6428,  6293,  6157,  6018,  5878,  5736,  5592,  5446,  5299,  5150,
+         5000,  4848,  4695,  4540,  4384,  4226,  4067,  3907,  3746,  3584,
+         3420,  3256,  3090,  2924,  2756,  2588,  2419,  2250,  2079,  1908,
+         1736,  1564,  1392,  1219,  1045,   872,   698,   523,   349,   175,
+            0,
+    };
+
+    deg %= 360;
+    if (deg < 0)
+        deg += 360;
+    if (deg <= 90)
+        return cos_tbl[deg];
+    if (deg <= 180)
+        return -cos_tbl[180 - deg];
+    if (deg <= 270)
+        return -cos_tbl[deg - 180];
+    return cos_tbl[360 - deg];
 }
 
 /*
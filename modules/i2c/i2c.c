@@ -19,6 +19,24 @@
  *    i2co_get_error() to get an I2C-specific error code.
  * 5. You release the reservation using i2c_release().
  *
+ * Alternatively, clients can queue transactions using i2c_submit(), with no
+ * reservation. Each transaction is a write, a read, or a write followed by a
+ * read (using a repeated start, e.g. to write a register address and then
+ * read the register). When a transaction completes, a client callback
+ * is called and the next queued transaction is started, both from the
+ * interrupt handler, so the bus is kept busy without the base level being
+ * involved. Queued transactions wait while the bus is reserved, and
+ * i2c_reserve() fails while transactions are queued, so the two methods can
+ * share a bus.
+ *
+ * Optionally (see use_dma in struct i2c_cfg), transfers of 2 or more bytes
+ * use DMA rather than an interrupt per byte. For reads, the I2C LAST bit makes
+ * the hardware NACK the final byte, so the N-2/N-1 byte ACK/STOP sequencing of
+ * the interrupt driven reads is not needed, and there is one interrupt (DMA
+ * transfer complete) per transfer. For writes, the BTF event after the DMA
+ * transfer completes the operation. DMA is off by default (see
+ * CONFIG_I2C_DFLT_USE_DMA), and only supported for DMA type 1.
+ *
  * The following console commands are provided:
  * > i2c status
  * > i2c test
@@ -72,8 +90,14 @@
 #include CONFIG_STM32_LL_GPIO_HDR
 #include CONFIG_STM32_LL_I2C_HDR
 
+#if CONFIG_DMA_TYPE == 1
+#include CONFIG_STM32_LL_BUS_HDR
+#include CONFIG_STM32_LL_DMA_HDR
+#endif
+
 #include "cmd.h"
 #include "console.h"
+#include "istat.h"
 #include "log.h"
 #include "module.h"
 #include "tmr.h"
@@ -102,6 +126,32 @@
                             I2C_SR1_OVR | I2C_SR1_PECERR | I2C_SR1_TIMEOUT | \
                             I2C_SR1_SMBALERT)
 
+// Limit on polling for the stop condition to be sent, before starting a
+// chained transaction. The stop takes about one SCL clock period.
+#define STOP_WAIT_MAX_LOOPS 1000
+
+#if CONFIG_DMA_TYPE == 1
+    // Reads of 1 byte can't use DMA (see reference manual), so for simplicity
+    // neither do writes.
+    #define DMA_MIN_LEN 2
+
+    // Interrupt flags for a DMA stream, before being shifted into position for
+    // the stream (see dma_flag_shift).
+    #define DMA_ALL_FLAGS_MASK 0x3d
+    #define DMA_TCIF_MASK 0x20
+    #define DMA_TEIF_MASK 0x08
+
+    #define ENABLE_OP_INTERRUPTS(st) do {                       \
+            if (st->dma_op)                                     \
+                st->i2c_reg_base->CR2 |= LL_I2C_CR2_ITEVTEN |   \
+                    LL_I2C_CR2_ITERREN;                         \
+            else                                                \
+                ENABLE_ALL_INTERRUPTS(st);                      \
+        } while (0)
+#else
+    #define ENABLE_OP_INTERRUPTS(st) ENABLE_ALL_INTERRUPTS(st)
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -114,6 +164,8 @@ enum states {
     STATE_MSTR_RD_GEN_START,
     STATE_MSTR_RD_SENDING_ADDR,
     STATE_MSTR_RD_READING_DATA,
+    STATE_MSTR_WR_DMA,
+    STATE_MSTR_RD_DMA,
 };
 
 enum interrupt_type {
@@ -137,6 +189,20 @@ struct i2c_state {
     enum states state;
     enum i2c_errors last_op_error;
     enum states last_op_error_state;
+
+    // Transaction queue. The head transaction is the active one, if
+    // xact_active is true.
+    struct i2c_xact* xact_head;
+    struct i2c_xact* xact_tail;
+    bool xact_active;
+    bool xact_wr_phase; // Write phase of I2C_XACT_WRITE_READ.
+
+#if CONFIG_DMA_TYPE == 1
+    DMA_TypeDef* dma_reg_base;
+    uint32_t dma_tx_stream;
+    uint32_t dma_rx_stream;
+    bool dma_op; // Current operation uses DMA.
+#endif
 };
 
 // Performance measurements for i2c. Currently these are common to all
@@ -151,6 +217,8 @@ enum i2c_u16_pms {
     CNT_ACK_FAIL,
     CNT_BUS_ERR,
     CNT_INTR_UNEXPECT,
+    CNT_XACT,
+    CNT_DMA_ERR,
 
     NUM_U16_PMS
 };
@@ -162,6 +230,21 @@ enum i2c_u16_pms {
 static int32_t start_op(enum i2c_instance_id instance_id, uint32_t dest_addr,
                         uint8_t* msg_bfr, uint32_t msg_len,
                         enum states init_state);
+static void begin_op(struct i2c_state* st, uint32_t dest_addr,
+                     uint8_t* msg_bfr, uint32_t msg_len,
+                     enum states init_state);
+static void xact_start(struct i2c_state* st, bool chained);
+static void xact_done(struct i2c_state* st);
+#if CONFIG_DMA_TYPE == 1
+static int32_t dma_start(enum i2c_instance_id instance_id);
+static void dma_op_begin(struct i2c_state* st, bool is_read);
+static void dma_op_end(struct i2c_state* st);
+static void dma_rx_interrupt(enum i2c_instance_id instance_id);
+static int32_t get_dma_info(enum i2c_instance_id instance_id,
+                            DMA_TypeDef** p_dma_reg_base,
+                            uint32_t* p_tx_stream, uint32_t* p_rx_stream,
+                            uint32_t* p_channel, IRQn_Type* p_rx_irq_type);
+#endif
 static void i2c_interrupt(enum i2c_instance_id instance_id,
                           enum interrupt_type inter_type,
                           IRQn_Type irq_type);
@@ -182,6 +265,12 @@ static int32_t cmd_i2c_test(int32_t argc, const char** argv);
 
 static struct i2c_state i2c_states[I2C_NUM_INSTANCES];
 
+#if CONFIG_DMA_TYPE == 1
+// Bit position of the interrupt flags of each DMA stream in the LISR/LIFCR
+// (streams 0-3) and HISR/HIFCR (streams 4-7) registers.
+static const uint8_t dma_flag_shift[4] = {0, 6, 16, 22};
+#endif
+
 static int32_t log_level = LOG_DEBUG;
 
 // Storage for performance measurements.
@@ -197,6 +286,8 @@ static const char* cnts_u16_names[NUM_U16_PMS] = {
     "i2c ack fail",
     "i2c bus error",
     "i2c unexpect intr",
+    "i2c xact",
+    "i2c dma err",
 };
 
 // Data structure with console command info.
@@ -242,6 +333,7 @@ static struct cmd_client_info cmd_info = {
 int32_t i2c_get_def_cfg(enum i2c_instance_id instance_id, struct i2c_cfg* cfg)
 {
     cfg->transaction_guard_time_ms = CONFIG_I2C_DFLT_TRANS_GUARD_TIME_MS;
+    cfg->use_dma = CONFIG_I2C_DFLT_USE_DMA;
     return 0;
 }
 
@@ -267,6 +359,11 @@ int32_t i2c_init(enum i2c_instance_id instance_id, struct i2c_cfg* cfg)
     if (cfg == NULL)
         return MOD_ERR_ARG;
 
+#if CONFIG_DMA_TYPE != 1
+    if (cfg->use_dma)
+        return MOD_ERR_IMPL;
+#endif
+
     st = &i2c_states[instance_id];
     memset(st, 0, sizeof(*st));
     st->cfg = *cfg;
@@ -365,6 +462,14 @@ int32_t i2c_start(enum i2c_instance_id instance_id)
                      NVIC_EncodePriority(NVIC_GetPriorityGrouping(),0, 0));
     NVIC_EnableIRQ(err_irq_type);
 
+#if CONFIG_DMA_TYPE == 1
+    if (st->cfg.use_dma) {
+        result = dma_start(instance_id);
+        if (result != 0)
+            return result;
+    }
+#endif
+
     return 0;
 }
 
@@ -393,16 +498,24 @@ int32_t i2c_run(enum i2c_instance_id instance_id)
  */
 int32_t i2c_reserve(enum i2c_instance_id instance_id)
 {
+    struct i2c_state* st;
+    int32_t rc = 0;
+    CRIT_STATE_VAR;
+
     if (instance_id >= I2C_NUM_INSTANCES ||
         i2c_states[instance_id].i2c_reg_base == NULL)
         return MOD_ERR_BAD_INSTANCE;
-    if (i2c_states[instance_id].reserved) {
+    st = &i2c_states[instance_id];
+
+    CRIT_BEGIN_NEST();
+    if (st->reserved || st->xact_head != NULL) {
         INC_SAT_U16(cnts_u16[CNT_RESERVE_FAIL]);
-        return MOD_ERR_RESOURCE;
+        rc = MOD_ERR_RESOURCE;
     } else {
-        i2c_states[instance_id].reserved = true;
+        st->reserved = true;
     }
-    return 0;
+    CRIT_END_NEST();
+    return rc;
 }
 
 /*
@@ -414,10 +527,65 @@ int32_t i2c_reserve(enum i2c_instance_id instance_id)
  */
 int32_t i2c_release(enum i2c_instance_id instance_id)
 {
+    struct i2c_state* st;
+    CRIT_STATE_VAR;
+
     if (instance_id >= I2C_NUM_INSTANCES ||
         i2c_states[instance_id].i2c_reg_base == NULL)
         return MOD_ERR_BAD_INSTANCE;
-    i2c_states[instance_id].reserved = false;
+    st = &i2c_states[instance_id];
+
+    // Start any transactions that were queued while the bus was reserved.
+    CRIT_BEGIN_NEST();
+    st->reserved = false;
+    if (st->xact_head != NULL && !st->xact_active && st->state == STATE_IDLE)
+        xact_start(st, false);
+    CRIT_END_NEST();
+    return 0;
+}
+
+/*
+ * @brief Queue an I2C transaction.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ * @param[in] xact The transaction descriptor. See struct i2c_xact.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The transaction is started immediately if the bus is free, otherwise it is
+ * started when the previous transactions have completed (or the bus is
+ * released). Completion is reported via xact->cb.
+ */
+int32_t i2c_submit(enum i2c_instance_id instance_id, struct i2c_xact* xact)
+{
+    struct i2c_state* st;
+    CRIT_STATE_VAR;
+
+    if (instance_id >= I2C_NUM_INSTANCES ||
+        i2c_states[instance_id].i2c_reg_base == NULL)
+        return MOD_ERR_BAD_INSTANCE;
+    if (xact == NULL || xact->op > I2C_XACT_WRITE_READ ||
+        (xact->op != I2C_XACT_READ && xact->wr_len > 0 &&
+         xact->wr_bfr == NULL) ||
+        (xact->op != I2C_XACT_WRITE && xact->rd_len > 0 &&
+         xact->rd_bfr == NULL))
+        return MOD_ERR_ARG;
+    st = &i2c_states[instance_id];
+
+    xact->rc = MOD_ERR_OP_IN_PROG;
+    xact->error = I2C_ERR_NONE;
+    xact->next = NULL;
+
+    CRIT_BEGIN_NEST();
+    if (st->xact_head == NULL) {
+        st->xact_head = xact;
+        if (!st->reserved && st->state == STATE_IDLE)
+            xact_start(st, false);
+    } else {
+        st->xact_tail->next = xact;
+    }
+    st->xact_tail = xact;
+    CRIT_END_NEST();
     return 0;
 }
 
@@ -525,7 +693,9 @@ int32_t i2c_bus_busy(enum i2c_instance_id instance_id)
 
 void I2C1_EV_IRQHandler(void)
 {
+    ISTAT_EXEC_BEGIN(ISTAT_ID_I2C1_EV);
     i2c_interrupt(I2C_INSTANCE_1, INTER_TYPE_EVT, I2C1_EV_IRQn);
+    ISTAT_EXEC_END(ISTAT_ID_I2C1_EV);
 }
 
 void I2C1_ER_IRQHandler(void)
@@ -539,7 +709,9 @@ void I2C1_ER_IRQHandler(void)
 
 void I2C2_EV_IRQHandler(void)
 {
+    ISTAT_EXEC_BEGIN(ISTAT_ID_I2C2_EV);
     i2c_interrupt(I2C_INSTANCE_2, INTER_TYPE_EVT, I2C2_EV_IRQn);
+    ISTAT_EXEC_END(ISTAT_ID_I2C2_EV);
 }
 
 void I2C2_ER_IRQHandler(void)
@@ -553,7 +725,9 @@ void I2C2_ER_IRQHandler(void)
 
 void I2C3_EV_IRQHandler(void)
 {
+    ISTAT_EXEC_BEGIN(ISTAT_ID_I2C3_EV);
     i2c_interrupt(I2C_INSTANCE_3, INTER_TYPE_EVT, I2C3_EV_IRQn);
+    ISTAT_EXEC_END(ISTAT_ID_I2C3_EV);
 }
 
 void I2C3_ER_IRQHandler(void)
@@ -563,6 +737,31 @@ void I2C3_ER_IRQHandler(void)
 
 #endif
 
+#if CONFIG_DMA_TYPE == 1
+
+#if CONFIG_I2C_1_PRESENT
+void DMA1_Stream0_IRQHandler(void)
+{
+    dma_rx_interrupt(I2C_INSTANCE_1);
+}
+#endif
+
+#if CONFIG_I2C_2_PRESENT
+void DMA1_Stream3_IRQHandler(void)
+{
+    dma_rx_interrupt(I2C_INSTANCE_2);
+}
+#endif
+
+#if CONFIG_I2C_3_PRESENT
+void DMA1_Stream2_IRQHandler(void)
+{
+    dma_rx_interrupt(I2C_INSTANCE_3);
+}
+#endif
+
+#endif // CONFIG_DMA_TYPE == 1
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -605,6 +804,23 @@ static int32_t start_op(enum i2c_instance_id instance_id, uint32_t dest_addr,
         return MOD_ERR_PERIPH;
     }
 
+    begin_op(st, dest_addr, msg_bfr, msg_len, init_state);
+    return 0;
+}
+
+/*
+ * @brief Begin an operation on the bus.
+ *
+ * @param[in] st Pointer to struct st_state.
+ * @param[in] dest_Addr I2C destination address (not shifted).
+ * @param[in] msg_bfr Buffer containing data bytes to send.
+ * @param[in] msg_len Number of bytes in messages.
+ * @param[in] init_state Initial state (read or write start).
+ */
+static void begin_op(struct i2c_state* st, uint32_t dest_addr,
+                     uint8_t* msg_bfr, uint32_t msg_len,
+                     enum states init_state)
+{
     tmr_inst_start(st->guard_tmr_id, 100);
 
     st->dest_addr = dest_addr;
@@ -619,11 +835,82 @@ static int32_t start_op(enum i2c_instance_id instance_id, uint32_t dest_addr,
 
     LL_I2C_Enable(st->i2c_reg_base);
     LL_I2C_DisableBitPOS(st->i2c_reg_base);
+#if CONFIG_DMA_TYPE == 1
+    dma_op_begin(st, init_state == STATE_MSTR_RD_GEN_START);
+#endif
     LL_I2C_GenerateStartCondition(st->i2c_reg_base);
 
-    ENABLE_ALL_INTERRUPTS(st);
+    ENABLE_OP_INTERRUPTS(st);
+}
 
-    return 0;
+/*
+ * @brief Start the transaction at the head of the queue.
+ *
+ * @param[in] st Pointer to struct st_state.
+ * @param[in] chained True if a transaction has just completed, in which case
+ *                    the bus can still be busy with the stop condition.
+ *
+ * @note Must be called in a critical section or from the interrupt handler.
+ */
+static void xact_start(struct i2c_state* st, bool chained)
+{
+    struct i2c_xact* xact = st->xact_head;
+    uint32_t loops;
+
+    // CR1 must not be written while the stop request is pending (see the
+    // reference manual CR1 description).
+    if (chained) {
+        for (loops = 0; loops < STOP_WAIT_MAX_LOOPS; loops++) {
+            if ((st->i2c_reg_base->CR1 & I2C_CR1_STOP) == 0)
+                break;
+        }
+    }
+
+    st->xact_active = true;
+    st->xact_wr_phase = false;
+    if (!chained && LL_I2C_IsActiveFlag_BUSY(st->i2c_reg_base)) {
+        INC_SAT_U16(cnts_u16[CNT_BUS_BUSY]);
+        st->last_op_error = I2C_ERR_BUS_BUSY;
+        st->last_op_error_state = STATE_IDLE;
+        xact_done(st);
+        return;
+    }
+
+    if (xact->op == I2C_XACT_READ) {
+        begin_op(st, xact->dest_addr, xact->rd_bfr, xact->rd_len,
+                 STATE_MSTR_RD_GEN_START);
+    } else {
+        st->xact_wr_phase = xact->op == I2C_XACT_WRITE_READ;
+        begin_op(st, xact->dest_addr, xact->wr_bfr, xact->wr_len,
+                 STATE_MSTR_WR_GEN_START);
+    }
+}
+
+/*
+ * @brief Complete the active transaction and start the next one.
+ *
+ * @param[in] st Pointer to struct st_state.
+ *
+ * @note Must be called in a critical section or from the interrupt handler.
+ */
+static void xact_done(struct i2c_state* st)
+{
+    struct i2c_xact* xact = st->xact_head;
+
+    st->xact_active = false;
+    st->xact_wr_phase = false;
+    st->xact_head = xact->next;
+    if (st->xact_head == NULL)
+        st->xact_tail = NULL;
+
+    xact->error = st->last_op_error;
+    xact->rc = xact->error == I2C_ERR_NONE ? 0 : MOD_ERR_PERIPH;
+    INC_SAT_U16(cnts_u16[CNT_XACT]);
+    if (xact->cb != NULL)
+        xact->cb(xact);
+
+    if (st->xact_head != NULL && !st->reserved)
+        xact_start(st, true);
 }
 
 /*
@@ -691,6 +978,11 @@ static void i2c_interrupt(enum i2c_instance_id instance_id,
                     if (st->msg_len == 0) {
                         st->state = STATE_IDLE;
                         op_stop_success(st, true);
+#if CONFIG_DMA_TYPE == 1
+                    } else if (st->dma_op) {
+                        // The DMA writes the data bytes on TXE.
+                        st->state = STATE_MSTR_WR_DMA;
+#endif
                     } else {
                         st->state = STATE_MSTR_WR_SENDING_DATA;
                         if (sr1 & (LL_I2C_SR1_TXE | LL_I2C_SR1_BTF)) {
@@ -733,7 +1025,11 @@ static void i2c_interrupt(enum i2c_instance_id instance_id,
                     st->i2c_reg_base->DR = (st->dest_addr << 1) + 1;
                     st->state = STATE_MSTR_RD_SENDING_ADDR;
                 }
-                sr1_handled_mask = LL_I2C_SR1_SB;
+
+                // After a repeated start, TXE/BTF from the write phase can
+                // still be set until the start is sent.
+                sr1_handled_mask = LL_I2C_SR1_SB | LL_I2C_SR1_TXE |
+                    LL_I2C_SR1_BTF;
                 break;
 
             case STATE_MSTR_RD_SENDING_ADDR:
@@ -753,6 +1049,25 @@ static void i2c_interrupt(enum i2c_instance_id instance_id,
                 sr1_handled_mask = LL_I2C_SR1_RXNE | LL_I2C_SR1_BTF;
                 break;
 
+#if CONFIG_DMA_TYPE == 1
+            case STATE_MSTR_WR_DMA:
+                // As for interrupt driven writes, we wait for BTF after the
+                // last byte.
+                if ((sr1 & LL_I2C_SR1_BTF) &&
+                    LL_DMA_GetDataLength(st->dma_reg_base,
+                                         st->dma_tx_stream) == 0) {
+                    st->msg_bytes_xferred = st->msg_len;
+                    op_stop_success(st, true);
+                }
+                sr1_handled_mask = LL_I2C_SR1_TXE | LL_I2C_SR1_BTF;
+                break;
+
+            case STATE_MSTR_RD_DMA:
+                // Completion is handled in the DMA interrupt.
+                sr1_handled_mask = LL_I2C_SR1_RXNE | LL_I2C_SR1_BTF;
+                break;
+#endif
+
             default:
                 break;
         }
@@ -802,14 +1117,19 @@ static enum tmr_cb_action tmr_callback(int32_t tmr_id, uint32_t user_data)
 {
     struct i2c_state* st;
     enum i2c_instance_id instance_id = (enum i2c_instance_id)user_data;
+    CRIT_STATE_VAR;
 
     log_verbose("i2c tmr_callback\n");
     if (instance_id >= I2C_NUM_INSTANCES ||
         i2c_states[instance_id].i2c_reg_base == NULL)
         return TMR_CB_NONE;
 
+    // The interrupt handler also completes transactions, so keep it out while
+    // failing the operation (see xact_done()).
     st = &i2c_states[instance_id];
+    CRIT_BEGIN_NEST();
     op_stop_fail(st, I2C_ERR_GUARD_TMR, CNT_GUARD_TMR);
+    CRIT_END_NEST();
 
     return TMR_CB_NONE;
 }
@@ -821,6 +1141,18 @@ static enum tmr_cb_action tmr_callback(int32_t tmr_id, uint32_t user_data)
  */
 static void handle_receive_addr(struct i2c_state* st)
 {
+#if CONFIG_DMA_TYPE == 1
+    if (st->dma_op) {
+        // The NACK of the last byte is done by hardware (LAST bit).
+        LL_I2C_AcknowledgeNextData(st->i2c_reg_base, LL_I2C_ACK);
+
+        // Clear ADDR flag (SR1 already read).
+        (void)st->i2c_reg_base->SR2;
+        st->state = STATE_MSTR_RD_DMA;
+        return;
+    }
+#endif
+
     switch (st->msg_len) {
         case 0:
             // A zero byte receive is really just a "ping" of the address,
@@ -931,12 +1263,43 @@ static void handle_receive_btf(struct i2c_state* st)
 static void op_stop_success(struct i2c_state* st, bool set_stop)
 {
     log_verbose("op_stop_success state=%d\n", st->state);
+#if CONFIG_DMA_TYPE == 1
+    dma_op_end(st);
+#endif
+
+    // For a write-then-read transaction, continue with the read using a
+    // repeated start rather than a stop. This also clears BTF.
+    if (st->xact_wr_phase) {
+        struct i2c_xact* xact = st->xact_head;
+
+        st->xact_wr_phase = false;
+        st->msg_bfr = xact->rd_bfr;
+        st->msg_len = xact->rd_len;
+        st->msg_bytes_xferred = 0;
+        st->state = STATE_MSTR_RD_GEN_START;
+#if CONFIG_DMA_TYPE == 1
+        dma_op_begin(st, true);
+#endif
+        // ENABLE_OP_INTERRUPTS() only sets bits, so clear ITBUFEN left over
+        // from the write phase (which a DMA read must not have).
+        DISABLE_ALL_INTERRUPTS(st);
+        LL_I2C_GenerateStartCondition(st->i2c_reg_base);
+        ENABLE_OP_INTERRUPTS(st);
+        return;
+    }
+
     DISABLE_ALL_INTERRUPTS(st);
     if (set_stop)
         LL_I2C_GenerateStopCondition(st->i2c_reg_base);
     tmr_inst_start(st->guard_tmr_id, 0);
-    LL_I2C_Disable(st->i2c_reg_base);
     st->state = STATE_IDLE;
+    if (st->xact_active) {
+        // If another transaction is started, the peripheral stays enabled.
+        xact_done(st);
+        if (st->xact_active)
+            return;
+    }
+    LL_I2C_Disable(st->i2c_reg_base);
 }
 
 /*
@@ -952,6 +1315,9 @@ static void op_stop_fail(struct i2c_state* st, enum i2c_errors error,
     // clearing CR1 PE. We just do it.
     log_verbose("op_stop_fail state=%d error=%d pm=%d\n", st->state, error, pm);
     DISABLE_ALL_INTERRUPTS(st);
+#if CONFIG_DMA_TYPE == 1
+    dma_op_end(st);
+#endif
     LL_I2C_GenerateStopCondition(st->i2c_reg_base);
     tmr_inst_start(st->guard_tmr_id, 0);
     LL_I2C_Disable(st->i2c_reg_base);
@@ -964,8 +1330,242 @@ static void op_stop_fail(struct i2c_state* st, enum i2c_errors error,
     if (pm < NUM_U16_PMS)
         INC_SAT_U16(cnts_u16[pm]);
     st->state = STATE_IDLE;
+    if (st->xact_active)
+        xact_done(st);
+}
+
+#if CONFIG_DMA_TYPE == 1
+
+/*
+ * @brief Clear all interrupt flags for a DMA stream.
+ *
+ * @param[in] dma DMA controller.
+ * @param[in] stream DMA stream (LL_DMA_STREAM_x).
+ */
+static void dma_clear_flags(DMA_TypeDef* dma, uint32_t stream)
+{
+    uint32_t mask = DMA_ALL_FLAGS_MASK << dma_flag_shift[stream & 3];
+    if (stream < LL_DMA_STREAM_4)
+        dma->LIFCR = mask;
+    else
+        dma->HIFCR = mask;
+}
+
+/*
+ * @brief Get the interrupt flags for a DMA stream.
+ *
+ * @param[in] dma DMA controller.
+ * @param[in] stream DMA stream (LL_DMA_STREAM_x).
+ *
+ * @return The flags, shifted down so DMA_xxx_MASK values can be used.
+ */
+static uint32_t dma_get_flags(DMA_TypeDef* dma, uint32_t stream)
+{
+    uint32_t isr = stream < LL_DMA_STREAM_4 ? dma->LISR : dma->HISR;
+    return (isr >> dma_flag_shift[stream & 3]) & DMA_ALL_FLAGS_MASK;
+}
+
+/*
+ * @brief Set up DMA for an instance.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The streams are configured once, and then only the memory address and
+ * length are set for each operation.
+ */
+static int32_t dma_start(enum i2c_instance_id instance_id)
+{
+    struct i2c_state* st = &i2c_states[instance_id];
+    DMA_TypeDef* dma;
+    uint32_t tx_stream;
+    uint32_t rx_stream;
+    uint32_t channel;
+    IRQn_Type rx_irq_type;
+    int32_t rc;
+
+    rc = get_dma_info(instance_id, &dma, &tx_stream, &rx_stream, &channel,
+                      &rx_irq_type);
+    if (rc != 0)
+        return rc;
+
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+
+    LL_DMA_DisableStream(dma, rx_stream);
+    while (LL_DMA_IsEnabledStream(dma, rx_stream));
+    dma_clear_flags(dma, rx_stream);
+    LL_DMA_SetChannelSelection(dma, rx_stream, channel);
+    LL_DMA_ConfigTransfer(dma, rx_stream,
+                          LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
+                          LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_NORMAL |
+                          LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                          LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_SetPeriphAddress(dma, rx_stream, (uint32_t)&st->i2c_reg_base->DR);
+    LL_DMA_EnableIT_TC(dma, rx_stream);
+    LL_DMA_EnableIT_TE(dma, rx_stream);
+
+    LL_DMA_DisableStream(dma, tx_stream);
+    while (LL_DMA_IsEnabledStream(dma, tx_stream));
+    dma_clear_flags(dma, tx_stream);
+    LL_DMA_SetChannelSelection(dma, tx_stream, channel);
+    LL_DMA_ConfigTransfer(dma, tx_stream,
+                          LL_DMA_DIRECTION_MEMORY_TO_PERIPH |
+                          LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_NORMAL |
+                          LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                          LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_SetPeriphAddress(dma, tx_stream, (uint32_t)&st->i2c_reg_base->DR);
+
+    NVIC_SetPriority(rx_irq_type,
+                     NVIC_EncodePriority(NVIC_GetPriorityGrouping(),0, 0));
+    NVIC_EnableIRQ(rx_irq_type);
+
+    st->dma_tx_stream = tx_stream;
+    st->dma_rx_stream = rx_stream;
+    st->dma_reg_base = dma;
+    return 0;
+}
+
+/*
+ * @brief Start DMA for the current operation, if it qualifies.
+ *
+ * @param[in] st Pointer to struct st_state.
+ * @param[in] is_read True for a read operation.
+ *
+ * Sets st->dma_op according to whether DMA is used. Must be called before the
+ * start condition is generated.
+ */
+static void dma_op_begin(struct i2c_state* st, bool is_read)
+{
+    uint32_t stream = is_read ? st->dma_rx_stream : st->dma_tx_stream;
+
+    st->dma_op = st->dma_reg_base != NULL && st->msg_len >= DMA_MIN_LEN;
+    if (!st->dma_op)
+        return;
+
+    dma_clear_flags(st->dma_reg_base, stream);
+    LL_DMA_SetMemoryAddress(st->dma_reg_base, stream, (uint32_t)st->msg_bfr);
+    LL_DMA_SetDataLength(st->dma_reg_base, stream, st->msg_len);
+    LL_DMA_EnableStream(st->dma_reg_base, stream);
+    if (is_read)
+        LL_I2C_EnableLastDMA(st->i2c_reg_base);
+    else
+        LL_I2C_DisableLastDMA(st->i2c_reg_base);
+    LL_I2C_EnableDMAReq_RX(st->i2c_reg_base);
+}
+
+/*
+ * @brief Stop DMA for the current operation, if it is using DMA.
+ *
+ * @param[in] st Pointer to struct st_state.
+ */
+static void dma_op_end(struct i2c_state* st)
+{
+    if (!st->dma_op)
+        return;
+    st->dma_op = false;
+    LL_I2C_DisableDMAReq_RX(st->i2c_reg_base);
+    LL_I2C_DisableLastDMA(st->i2c_reg_base);
+    LL_DMA_DisableStream(st->dma_reg_base, st->dma_tx_stream);
+    LL_DMA_DisableStream(st->dma_reg_base, st->dma_rx_stream);
+}
+
+/*
+ * @brief DMA RX stream interrupt handler.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ *
+ * @note The "unused" attribute allows this file to be compiled without warnings
+ *       even if no I2C instances are configured.
+ */
+__attribute__((unused))
+static void dma_rx_interrupt(enum i2c_instance_id instance_id)
+{
+    struct i2c_state* st;
+    uint32_t flags;
+
+    if (instance_id >= I2C_NUM_INSTANCES)
+        return;
+    st = &i2c_states[instance_id];
+    if (st->dma_reg_base == NULL)
+        return;
+
+    flags = dma_get_flags(st->dma_reg_base, st->dma_rx_stream);
+    dma_clear_flags(st->dma_reg_base, st->dma_rx_stream);
+    if (st->state != STATE_MSTR_RD_DMA)
+        return;
+
+    if (flags & DMA_TEIF_MASK) {
+        op_stop_fail(st, I2C_ERR_DMA, CNT_DMA_ERR);
+    } else if (flags & DMA_TCIF_MASK) {
+        // The last byte has been NACKed, so we can now send the stop.
+        LL_I2C_GenerateStopCondition(st->i2c_reg_base);
+        st->msg_bytes_xferred = st->msg_len;
+        op_stop_success(st, false);
+    }
 }
 
+/*
+ * @brief Get DMA resources for an instance.
+ *
+ * @param[in] instance_id Identifies the i2c instance.
+ * @param[out] p_dma_reg_base DMA controller.
+ * @param[out] p_tx_stream TX DMA stream.
+ * @param[out] p_rx_stream RX DMA stream.
+ * @param[out] p_channel DMA channel (request) selection for both streams.
+ * @param[out] p_rx_irq_type RX DMA stream IRQ.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The stream/channel assignments are from the MCU reference manual DMA request
+ * mapping tables, avoiding the streams used by ttys. Note that I2C1 and I2C2
+ * share TX stream 7, so they can't both use DMA.
+ */
+static int32_t get_dma_info(enum i2c_instance_id instance_id,
+                            DMA_TypeDef** p_dma_reg_base,
+                            uint32_t* p_tx_stream, uint32_t* p_rx_stream,
+                            uint32_t* p_channel, IRQn_Type* p_rx_irq_type)
+{
+    switch (instance_id) {
+
+#if CONFIG_I2C_1_PRESENT
+        case I2C_INSTANCE_1:
+            *p_dma_reg_base = DMA1;
+            *p_tx_stream = LL_DMA_STREAM_7;
+            *p_rx_stream = LL_DMA_STREAM_0;
+            *p_channel = LL_DMA_CHANNEL_1;
+            *p_rx_irq_type = DMA1_Stream0_IRQn;
+            break;
+#endif
+
+#if CONFIG_I2C_2_PRESENT
+        case I2C_INSTANCE_2:
+            *p_dma_reg_base = DMA1;
+            *p_tx_stream = LL_DMA_STREAM_7;
+            *p_rx_stream = LL_DMA_STREAM_3;
+            *p_channel = LL_DMA_CHANNEL_7;
+            *p_rx_irq_type = DMA1_Stream3_IRQn;
+            break;
+#endif
+
+#if CONFIG_I2C_3_PRESENT
+        case I2C_INSTANCE_3:
+            *p_dma_reg_base = DMA1;
+            *p_tx_stream = LL_DMA_STREAM_4;
+            *p_rx_stream = LL_DMA_STREAM_2;
+            *p_channel = LL_DMA_CHANNEL_3;
+            *p_rx_irq_type = DMA1_Stream2_IRQn;
+            break;
+#endif
+
+        default:
+            return MOD_ERR_BAD_INSTANCE;
+    }
+    return 0;
+}
+
+#endif // CONFIG_DMA_TYPE == 1
+
 /*
  * @brief Console command function for "i2c status".
  *
@@ -1012,6 +1612,8 @@ static int32_t cmd_i2c_test(int32_t argc, const char** argv)
     static uint32_t msg_len;
     enum i2c_instance_id instance_id = 0;
     static uint8_t msg_bfr[MAX_MSG_LEN];
+    static uint8_t wr_bfr[MAX_MSG_LEN];
+    static struct i2c_xact xact;
 
     // Handle help case.
     if (argc == 2) {
@@ -1023,6 +1625,8 @@ static int32_t cmd_i2c_test(int32_t argc, const char** argv)
                "  Get op status/error, usage: i2c test status <instance-id>\n");
         printc("  Bus busy, usage: i2c test busy <instance-id>\n"
                "  Print msg buffer, usage: i2c test msg <instance-id>\n");
+        printc("  Queue write/read, usage: i2c test xact <instance-id> <addr> "
+               "<num-rd-bytes> [<bytes> ...]\n");
         return 0;
     }
 
@@ -1065,9 +1669,39 @@ static int32_t cmd_i2c_test(int32_t argc, const char** argv)
         }
         msg_len = arg_vals[1].val.u;
         rc = i2c_read(instance_id, arg_vals[0].val.u, msg_bfr, msg_len);
+    } else if (strcasecmp(argv[2], "xact") == 0) {
+        rc = cmd_parse_args(argc-4, argv+4, "uu[u[u[u]]]", arg_vals);
+        if (rc < 2) {
+            printc("Invalid command rc=%ld\n", rc);
+            return MOD_ERR_BAD_CMD;
+        }
+        if (arg_vals[1].val.u > MAX_MSG_LEN) {
+            printc("Message length limited to %d\n", MAX_MSG_LEN);
+            return MOD_ERR_ARG;
+        }
+        if (xact.rc == MOD_ERR_OP_IN_PROG) {
+            printc("Transaction in progress\n");
+            return MOD_ERR_BUSY;
+        }
+        for (idx = 2; idx < rc; idx++)
+            wr_bfr[idx-2] = arg_vals[idx].val.u;
+        msg_len = arg_vals[1].val.u;
+        xact.dest_addr = arg_vals[0].val.u;
+        xact.wr_bfr = wr_bfr;
+        xact.wr_len = rc - 2;
+        xact.rd_bfr = msg_bfr;
+        xact.rd_len = msg_len;
+        if (msg_len == 0)
+            xact.op = I2C_XACT_WRITE;
+        else if (xact.wr_len == 0)
+            xact.op = I2C_XACT_READ;
+        else
+            xact.op = I2C_XACT_WRITE_READ;
+        rc = i2c_submit(instance_id, &xact);
     } else if (strcasecmp(argv[2], "status") == 0) {
-        printc("op_status=%ld error=%d\n", i2c_get_op_status(instance_id),
-               i2c_get_error(instance_id));
+        printc("op_status=%ld error=%d xact rc=%ld error=%d\n",
+               i2c_get_op_status(instance_id), i2c_get_error(instance_id),
+               xact.rc, xact.error);
         goto done;
     } else if (strcasecmp(argv[2], "busy") == 0) {
         rc = i2c_bus_busy(instance_id);
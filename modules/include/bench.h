@@ -0,0 +1,74 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/*
+ * @brief Interface declaration of bench module.
+ *
+ * See implementation file for information about this module.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Function signature for a benchmark. It performs the operation being
+// measured num_ops times, and returns 0 for success, else a "MOD_ERR" value.
+typedef int32_t (*bench_func)(uint32_t num_ops);
+
+// Information about a single benchmark, provided by the client.
+struct bench_info {
+    const char* const name;      // Name of benchmark
+    const bench_func func;       // Benchmark function
+    const uint32_t dflt_num_ops; // Number of operations if not specified
+};
+
+// Information provided by the client.
+struct bench_client_info {
+    const char* const name;               // Client name (e.g. module name)
+    const int32_t num_benches;            // Number of benchmarks
+    const struct bench_info* const benches; // Pointer to array of benchmarks
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+// Core module interface functions.
+int32_t bench_start(void);
+
+// Other APIs.
+int32_t bench_register(const struct bench_client_info* client_info);
+
+#endif // _BENCH_H_
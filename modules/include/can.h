@@ -29,6 +29,7 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "module.h"
@@ -40,6 +41,12 @@
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+#define CAN_MAX_DATA_LEN 8
+
+// Largest standard (11-bit) and extended (29-bit) identifiers.
+#define CAN_STD_ID_MAX 0x7ff
+#define CAN_EXT_ID_MAX 0x1fffffff
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -57,14 +64,41 @@ enum can_instance_id {
      CAN_NUM_INSTANCES
 };
 
+// A CAN frame, as received or to be transmitted.
+struct can_msg {
+    uint32_t id;
+    uint8_t len;
+    bool ext;          // Extended (29-bit) ID.
+    bool rtr;          // Remote transmission request.
+    uint8_t filter_idx; // On RX, the index of the filter that matched.
+    uint8_t data[CAN_MAX_DATA_LEN];
+};
+
+// An acceptance filter. A received frame is accepted if its ID matches id in
+// all bit positions that are set in mask, and its ext value matches. A mask of
+// zero accepts all IDs of the given type.
+struct can_filter {
+    uint32_t id;
+    uint32_t mask;
+    bool ext;
+};
+
+// Callback for subscribers to received frames. The frame pointer is only valid
+// until the callback returns.
+typedef void (*can_rx_cb)(enum can_instance_id instance_id,
+                          const struct can_msg* msg, void* user_data);
+
 struct can_cfg
 {
     dio_port* can_tx_pin_port;
     uint32_t can_tx_pin;
     dio_port* can_rx_pin_port;
     uint32_t can_rx_pin;
-
-    // FUTURE.
+    uint32_t pin_function;
+    uint32_t bit_rate;
+    bool loopback;
+    uint32_t num_filters;
+    struct can_filter filters[CONFIG_CAN_MAX_FILTERS];
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -82,5 +116,13 @@ int32_t can_start(enum can_instance_id instance_id);
 int32_t can_run(enum can_instance_id instance_id);
 
 // Other APIs.
+int32_t can_tx(enum can_instance_id instance_id, const struct can_msg* msg);
+int32_t can_rx(enum can_instance_id instance_id, struct can_msg* msg);
+int32_t can_set_filters(enum can_instance_id instance_id, uint32_t num_filters,
+                        const struct can_filter* filters);
+int32_t can_subscribe(enum can_instance_id instance_id,
+                      const struct can_filter* filter, can_rx_cb cb,
+                      void* user_data);
+int32_t can_unsubscribe(enum can_instance_id instance_id, int32_t handle);
 
 #endif // _CAN_H_
@@ -35,6 +35,11 @@
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+// First character of a binary (pre-parsed) argument, as passed in argv by the
+// console binary command mode. It is followed by the cmd_arg_val type code
+// and the 4 value bytes (little endian).
+#define CMD_BIN_ARG_MARK '\x01'
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -97,7 +102,9 @@ int32_t cmd_init(struct cmd_cfg* cfg);
 // Other APIs.
 // Note: cmd_register() keeps a copy of the client_info pointer.
 int32_t cmd_register(const struct cmd_client_info* client_info);
+const struct cmd_client_info* cmd_get_client(uint32_t idx);
 int32_t cmd_execute(char* bfr);
+int32_t cmd_execute_argv(int32_t argc, const char** argv);
 int32_t cmd_parse_args(int32_t argc, const char** argv, const char* fmt,
                        struct cmd_arg_val* arg_vals);
 
@@ -74,12 +74,16 @@
 
     #define CONFIG_STM32_LL_BUS_HDR "stm32f1xx_ll_bus.h"
     #define CONFIG_STM32_LL_CORTEX_HDR "stm32f1xx_ll_cortex.h"
+    #define CONFIG_STM32_LL_DMA_HDR "stm32f1xx_ll_dma.h"
     #define CONFIG_STM32_LL_GPIO_HDR "stm32f1xx_ll_gpio.h"
     #define CONFIG_STM32_LL_I2C_HDR "stm32f1xx_ll_i2c.h"
     #define CONFIG_STM32_LL_RCC_HDR "stm32f1xx_ll_rcc.h"
     #define CONFIG_STM32_LL_USART_HDR "stm32f1xx_ll_usart.h"
 
+    #define CONFIG_CAN_TYPE 1
+    #define CONFIG_CRC_TYPE 1
     #define CONFIG_DIO_TYPE 3
+    #define CONFIG_DMA_TYPE 2
     #define CONFIG_I2C_TYPE 1
     #define CONFIG_USART_TYPE 1
     #define CONFIG_MPU_TYPE -1
@@ -95,18 +99,29 @@
     #define CONFIG_FLASH_SIZE (64*1024)
     #define CONFIG_FLASH_WRITE_BYTES 8
 
+    #define CONFIG_FAULT_FLASH_PANIC_ADDR \
+        (CONFIG_FLASH_BASE_ADDR + CONFIG_FLASH_PAGE_SIZE)
+    #define CONFIG_FAULT_FLASH_PAGE_SIZE CONFIG_FLASH_PAGE_SIZE
+    #define CONFIG_FAULT_FLASH_NUM_PAGES 1
+
 #elif defined STM32F401xE
 
     #define CONFIG_STM32_LL_BUS_HDR "stm32f4xx_ll_bus.h"
     #define CONFIG_STM32_LL_CORTEX_HDR "stm32f4xx_ll_cortex.h"
+    #define CONFIG_STM32_LL_DMA_HDR "stm32f4xx_ll_dma.h"
     #define CONFIG_STM32_LL_GPIO_HDR "stm32f4xx_ll_gpio.h"
     #define CONFIG_STM32_LL_I2C_HDR "stm32f4xx_ll_i2c.h"
     #define CONFIG_STM32_LL_RCC_HDR "stm32f4xx_ll_rcc.h"
     #define CONFIG_STM32_LL_USART_HDR "stm32f4xx_ll_usart.h"
     #define CONFIG_STM32_LL_IWDG_HDR "stm32f4xx_ll_iwdg.h"
+    #define CONFIG_STM32_LL_TIM_HDR "stm32f4xx_ll_tim.h"
 
+    #define CONFIG_CAN_TYPE -1
+    #define CONFIG_CRC_TYPE 1
     #define CONFIG_DIO_TYPE 1
+    #define CONFIG_DMA_TYPE 1
     #define CONFIG_I2C_TYPE 1
+    #define CONFIG_TIM_TYPE 1
     #define CONFIG_USART_TYPE 1
     #define CONFIG_MPU_TYPE 1
 
@@ -114,23 +129,37 @@
     #define CONFIG_OS_CFG_IRQN_TYPE_MAX SPI4_IRQn
     #define CONFIG_OS_IRQN_TYPE_EXC_NUM_OFFSET (4 - MemoryManagement_IRQn)
 
+    // Flash layout (sectors 0-3 are 16K, 4 is 64K, 5-7 are 128K):
+    //   Sector 1     Fault records.
+    //   Sectors 6-7  Key/value store.
+    //   Others       Firmware image (must end below 0x08040000).
     #define CONFIG_FLASH_TYPE 2
     #define CONFIG_FLASH_BASE_ADDR 0x08000000
+    #define CONFIG_FLASH_SIZE (512*1024)
     #define CONFIG_FLASH_WRITE_BYTES 8
+    #define CONFIG_FLASH_KV_BASE_ADDR 0x08040000 // Sectors 6 and 7.
+    #define CONFIG_FLASH_KV_PAGE_SIZE (128*1024)
+    #define CONFIG_FLASH_KV_NUM_PAGES 2
 
-    #define CONFIG_FAULT_FLASH_PANIC_ADDR 0x08004000
+    #define CONFIG_FAULT_FLASH_PANIC_ADDR 0x08004000 // Sector 1.
+    #define CONFIG_FAULT_FLASH_PAGE_SIZE (16*1024)
+    #define CONFIG_FAULT_FLASH_NUM_PAGES 1
 
 #elif defined STM32L452xx
 
     #define CONFIG_STM32_LL_BUS_HDR "stm32l4xx_ll_bus.h"
     #define CONFIG_STM32_LL_CORTEX_HDR "stm32l4xx_ll_cortex.h"
+    #define CONFIG_STM32_LL_DMA_HDR "stm32l4xx_ll_dma.h"
     #define CONFIG_STM32_LL_GPIO_HDR "stm32l4xx_ll_gpio.h"
     #define CONFIG_STM32_LL_I2C_HDR "stm32l4xx_ll_i2c.h"
     #define CONFIG_STM32_LL_RCC_HDR "stm32l4xx_ll_rcc.h"
     #define CONFIG_STM32_LL_USART_HDR "stm32l4xx_ll_usart.h"
     #define CONFIG_STM32_LL_IWDG_HDR "stm32l4xx_ll_iwdg.h"
 
+    #define CONFIG_CAN_TYPE 1
+    #define CONFIG_CRC_TYPE 2
     #define CONFIG_DIO_TYPE 2
+    #define CONFIG_DMA_TYPE 2
     #define CONFIG_I2C_TYPE 0
     #define CONFIG_USART_TYPE 2
 
@@ -138,24 +167,39 @@
     #define CONFIG_OS_CFG_IRQN_TYPE_MAX I2C4_ER_IRQn
     #define CONFIG_OS_IRQN_TYPE_EXC_NUM_OFFSET (4 - MemoryManagement_IRQn)
 
+    // Flash layout (2K pages):
+    //   Pages 0-249    Firmware image (must end below 0x0807d000).
+    //   Pages 250-253  Fault records.
+    //   Pages 254-255  Key/value store.
     #define CONFIG_FLASH_TYPE 1
     #define CONFIG_FLASH_BASE_ADDR 0x08000000
     #define CONFIG_FLASH_SIZE (512*1024)
-    #define CONFIG_FLASH_PAGE_SIZE 2048
+    #define CONFIG_FLASH_PAGE_SIZE 4096
     #define CONFIG_FLASH_NUM_PAGE 256
     #define CONFIG_FLASH_WRITE_BYTES 8
+    #define CONFIG_FLASH_KV_BASE_ADDR 0x0807f000 // Last 2 pages.
+    #define CONFIG_FLASH_KV_PAGE_SIZE CONFIG_FLASH_PAGE_SIZE
+    #define CONFIG_FLASH_KV_NUM_PAGES 2
+
+    #define CONFIG_FAULT_FLASH_PANIC_ADDR 0x0807d000 // 4 pages before kv.
+    #define CONFIG_FAULT_FLASH_PAGE_SIZE CONFIG_FLASH_PAGE_SIZE
+    #define CONFIG_FAULT_FLASH_NUM_PAGES 4
 
 #elif defined STM32U575xx
 
     #define CONFIG_STM32_LL_BUS_HDR "stm32u5xx_ll_bus.h"
     #define CONFIG_STM32_LL_CORTEX_HDR "stm32u5xx_ll_cortex.h"
+    #define CONFIG_STM32_LL_DMA_HDR "stm32u5xx_ll_dma.h"
     #define CONFIG_STM32_LL_GPIO_HDR "stm32u5xx_ll_gpio.h"
     #define CONFIG_STM32_LL_I2C_HDR "stm32u5xx_ll_i2c.h"
     #define CONFIG_STM32_LL_RCC_HDR "stm32u5xx_ll_rcc.h"
     #define CONFIG_STM32_LL_USART_HDR "stm32u5xx_ll_usart.h"
     #define CONFIG_STM32_LL_IWDG_HDR "stm32u5xx_ll_iwdg.h"
 
+    #define CONFIG_CAN_TYPE -1
+    #define CONFIG_CRC_TYPE 2
     #define CONFIG_DIO_TYPE 4
+    #define CONFIG_DMA_TYPE 3
     #define CONFIG_I2C_TYPE 0
     #define CONFIG_USART_TYPE 3
     #define CONFIG_MPU_TYPE 2
@@ -164,6 +208,10 @@
     #define CONFIG_OS_CFG_IRQN_TYPE_MAX FMAC_IRQn
     #define CONFIG_OS_IRQN_TYPE_EXC_NUM_OFFSET (4 - MemoryManagement_IRQn)
 
+    // Flash layout (two banks of 128 8K pages):
+    //   Bank 1, bank 2 pages 0-123  Firmware image (must end below 0x081f8000).
+    //   Bank 2 pages 124-125        Fault records.
+    //   Bank 2 pages 126-127        Key/value store.
     #define CONFIG_FLASH_TYPE 4
     #define CONFIG_FLASH_BASE_ADDR 0x08000000
     #define CONFIG_FLASH_SIZE (256*8192)
@@ -172,6 +220,47 @@
     #define CONFIG_FLASH_NUM_PAGE 256
     #define CONFIG_FLASH_WRITE_BYTES 16
     #define CONFIG_FAULT_FLASH_BANK_NUM 1
+    #define CONFIG_FLASH_KV_BASE_ADDR 0x081fc000 // Last 2 pages of bank 2.
+    #define CONFIG_FLASH_KV_PAGE_SIZE CONFIG_FLASH_PAGE_SIZE
+    #define CONFIG_FLASH_KV_NUM_PAGES 2
+
+    #define CONFIG_FAULT_FLASH_PANIC_ADDR 0x081f8000 // 2 pages before kv.
+    #define CONFIG_FAULT_FLASH_PAGE_SIZE CONFIG_FLASH_PAGE_SIZE
+    #define CONFIG_FAULT_FLASH_NUM_PAGES 2
+
+#elif defined HOST_LINUX // Host (x86/Linux) simulation build, see host/.
+
+    #define CONFIG_STM32_LL_BUS_HDR "host_hal.h"
+    #define CONFIG_STM32_LL_CORTEX_HDR "host_hal.h"
+    #define CONFIG_STM32_LL_DMA_HDR "host_hal.h"
+    #define CONFIG_STM32_LL_GPIO_HDR "host_hal.h"
+    #define CONFIG_STM32_LL_I2C_HDR "host_hal.h"
+    #define CONFIG_STM32_LL_RCC_HDR "host_hal.h"
+    #define CONFIG_STM32_LL_USART_HDR "host_hal.h"
+    #define CONFIG_STM32_LL_IWDG_HDR "host_hal.h"
+    #define CONFIG_STM32_LL_TIM_HDR "host_hal.h"
+
+    // The peripherals are simulated behind the module APIs, so none of the
+    // hardware type specific code is used.
+    #define CONFIG_CAN_TYPE -1
+    #define CONFIG_CRC_TYPE -1
+    #define CONFIG_DIO_TYPE -1
+    #define CONFIG_DMA_TYPE -1
+    #define CONFIG_I2C_TYPE -1
+    #define CONFIG_TIM_TYPE -1
+    #define CONFIG_USART_TYPE -1
+    #define CONFIG_MPU_TYPE -1
+    #define CONFIG_FLASH_TYPE -1
+
+    // Flash is a RAM image, see host/host_flash.c.
+    #define CONFIG_FLASH_PRESENT 1
+    #define CONFIG_FLASH_BASE_ADDR 0x08000000
+    #define CONFIG_FLASH_SIZE (32*4096)
+    #define CONFIG_FLASH_PAGE_SIZE 4096
+    #define CONFIG_FLASH_WRITE_BYTES 8
+    #define CONFIG_FLASH_KV_BASE_ADDR 0x0801e000 // Last 2 pages.
+    #define CONFIG_FLASH_KV_PAGE_SIZE CONFIG_FLASH_PAGE_SIZE
+    #define CONFIG_FLASH_KV_NUM_PAGES 2
 
 #else
     #error Unknown processor
@@ -181,12 +270,29 @@
 // Common settings.
 ////////////////////////////////////////////////////////////////////////////////
 
+// Module bench.
+#define CONFIG_BENCH_MAX_CLIENTS 12
+#define CONFIG_BENCH_REPEATS 3
+
+// Module can.
+#define CONFIG_CAN_MAX_FILTERS 8
+#define CONFIG_CAN_RX_RING_SIZE 32
+#define CONFIG_CAN_TX_QUEUE_SIZE 16
+#define CONFIG_CAN_DFLT_BIT_RATE 125000
+
 // Module cmd.
 #define CONFIG_CMD_MAX_TOKENS 10
-#define CONFIG_CMD_MAX_CLIENTS 12
+#define CONFIG_CMD_MAX_CLIENTS 20
+#define CONFIG_CMD_HASH_SIZE 256
 
 // Modules conole and ttys.
-#define CONFIG_CONSOLE_PRINT_BUF_SIZE 240
+#define CONFIG_CONSOLE_FMT_BENCH 1
+#define CONFIG_CONSOLE_BIN_MAX_PAYLOAD 128
+#define CONFIG_CONSOLE_BIN_TMO_MS 100
+#define CONFIG_TTYS_DFLT_TX_BUF_SIZE 1024 // Must be a power of 2.
+#define CONFIG_TTYS_DFLT_RX_BUF_SIZE 128 // Must be a power of 2.
+#define CONFIG_TTYS_STREAM_BUF_SIZE 64
+#define CONFIG_TTYS_MAX_STREAMS 4 // FILE objects allocated at init.
 #if defined STM32U575xx
     #define CONFIG_TTYS_1_PRESENT 1
     #define CONFIG_CONSOLE_DFLT_TTYS_INSTANCE TTYS_INSTANCE_1
@@ -195,9 +301,21 @@
     #define CONFIG_CONSOLE_DFLT_TTYS_INSTANCE TTYS_INSTANCE_2
 #endif
 
+// Module dio.
+#define CONFIG_DIO_EDGE_RING_SIZE 16 // Must be a power of 2.
+
 // Module draw.
 #define CONFIG_DRAW_DFLT_LINK_1_LEN_MM 149
 #define CONFIG_DRAW_DFLT_LINK_2_LEN_MM 119
+#define CONFIG_DRAW_MOVE_QUEUE_SIZE 16
+#define CONFIG_DRAW_VIA_BUF_SIZE 32
+#define CONFIG_DRAW_STREAM_LINE_SIZE 80
+#define CONFIG_DRAW_FAST_KIN 1
+
+// Module flash.
+#define CONFIG_FLASH_ASYNC_QUEUE_SIZE 8
+#define CONFIG_FLASH_KV_MAX_KEYS 32
+#define CONFIG_FLASH_KV_MAX_VALUE_LEN 128
 
 // Module float.
 #define CONFIG_FLOAT_TYPE_FLOAT 1
@@ -206,13 +324,57 @@
 
 // Module i2c.
 #define CONFIG_I2C_DFLT_TRANS_GUARD_TIME_MS 100
+#define CONFIG_I2C_DFLT_USE_DMA false // DMA type 1 only.
+
+// Module log.
+#define CONFIG_LOG_DEFERRED_BUF_SIZE 2048 // Must be a power of 2.
+#define CONFIG_LOG_DFLT_DEFERRED false
+
+// Main application (app_main.c).
+#define CONFIG_MAIN_FAST_START 0 // 1 to defer slow module starts to super loop.
+
+// Module mem.
+#define CONFIG_MEM_CRC_BYTES_PER_RUN 2048
+#define CONFIG_MEM_WATCH_MAX_ADDRS 8
+#define CONFIG_MEM_WATCH_BUF_SIZE 1024
+
+// Module sched.
+#define CONFIG_SCHED_MAX_TASKS 32
+
+// Module step.
+#define CONFIG_STEP_CMD_QUEUE_SIZE 32
+#define CONFIG_STEP_DFLT_ACCEL_STEPS_PER_S2 1000
+#define CONFIG_STEP_DFLT_USE_HW_TMR false // TIM type 1 only.
 
 // Module tmphm.
 #define CONFIG_TMPHM_1_DFLT_I2C_ADDR 0x44
 #define CONFIG_TMPHM_DFLT_SAMPLE_TIME_MS 1000
 #define CONFIG_TMPHM_DFLT_MEAS_TIME_MS 17
+#define CONFIG_TMPHM_DFLT_MODE TMPHM_MODE_SINGLE_SHOT
+#define CONFIG_TMPHM_HIST_SIZE 64
+#define CONFIG_TMPHM_NUM_STAT_WINDOWS 2
+#define CONFIG_TMPHM_DFLT_STAT_WINDOW_1 10
+#define CONFIG_TMPHM_DFLT_STAT_WINDOW_2 60
+#define CONFIG_TMPHM_2_DFLT_I2C_ADDR 0x45
 #define CONFIG_TMPHM_WDG_MS 5000
 
+// Module telem.
+#define CONFIG_TELEM_BUF_SIZE 512
+#define CONFIG_TELEM_MAX_DURS 8
+#define CONFIG_TELEM_MAX_PMS 256
+#define CONFIG_TELEM_CAN_ID 0x7f0
+
+// Module tmr.
+#define CONFIG_TMR_NUM_INST 16
+#if defined HOST_LINUX
+    // The host simulation delivers every tick (see host/host_hal.c).
+    #define CONFIG_TMR_TICKLESS 0
+#else
+    #define CONFIG_TMR_TICKLESS 1
+#endif
+#define CONFIG_TMR_DFLT_TICKLESS_ENABLE false
+#define CONFIG_TMR_IDLE_MAX_MS 100
+
 // Module wdg.
 #define CONFIG_WDG_RUN_CHECK_MS 10
 #define CONFIG_WDG_HARD_TIMEOUT_MS 4000
@@ -223,13 +385,28 @@
 
 // GPS feature.
 #if defined CONFIG_FEAT_GPS
+    // The GPS sends bursts of several hundred characters each fix, and
+    // only short commands are sent to it.
     #if defined STM32F103xB
         #define CONFIG_GPS_DFLT_TTYS_INSTANCE TTYS_INSTANCE_3
+        #define CONFIG_TTYS_3_TX_BUF_SIZE 128
+        #define CONFIG_TTYS_3_RX_BUF_SIZE 512
     #elif defined STM32F401xE
         #define CONFIG_GPS_DFLT_TTYS_INSTANCE TTYS_INSTANCE_6
+        #define CONFIG_TTYS_6_TX_BUF_SIZE 128
+        #define CONFIG_TTYS_6_RX_BUF_SIZE 512
     #elif defined STM32L452xx
         #define CONFIG_GPS_DFLT_TTYS_INSTANCE TTYS_INSTANCE_3
+        #define CONFIG_TTYS_3_TX_BUF_SIZE 128
+        #define CONFIG_TTYS_3_RX_BUF_SIZE 512
+    #elif defined HOST_LINUX
+        #define CONFIG_GPS_DFLT_TTYS_INSTANCE TTYS_INSTANCE_6
+        #define CONFIG_TTYS_6_TX_BUF_SIZE 128
+        #define CONFIG_TTYS_6_RX_BUF_SIZE 512
     #endif
+    // Set to 1 to switch the receiver to UBX binary output in gps_start().
+    #define CONFIG_GPS_DFLT_UBX_MODE 0
+    #define CONFIG_GPS_DFLT_UBX_MEAS_RATE_MS 200
 #else
     #define CONFIG_GPS_DFLT_TTYS_INSTANCE CONFIG_DUMMY_0
 #endif
@@ -254,6 +431,28 @@
         #define CONFIG_STEP_1_DFLT_IDLE_TIMER_MS 2000
         #define CONFIG_STEP_1_DFLT_REV_DIRECTION false
         #define CONFIG_STEP_1_DFLT_DRIVE_MODE STEP_DRIVE_MODE_FULL
+        #define CONFIG_STEP_1_DFLT_COORD false
+
+        #define CONFIG_STEP_2_DFLT_GPIO_PORT DIO_PORT_C
+        #define CONFIG_STEP_2_DFLT_DIO_PIN_A DIO_PIN_1
+        #define CONFIG_STEP_2_DFLT_DIO_PIN_NOT_A DIO_PIN_3
+        #define CONFIG_STEP_2_DFLT_DIO_PIN_B DIO_PIN_2
+        #define CONFIG_STEP_2_DFLT_DIO_PIN_NOT_B DIO_PIN_0
+        #define CONFIG_STEP_2_DFLT_IDLE_TIMER_MS 2000
+        #define CONFIG_STEP_2_DFLT_REV_DIRECTION false
+        #define CONFIG_STEP_2_DFLT_DRIVE_MODE STEP_DRIVE_MODE_FULL
+        #define CONFIG_STEP_2_DFLT_COORD false
+    #elif defined HOST_LINUX
+        // Motor outputs simulated by host/host_dio.c.
+        #define CONFIG_STEP_1_DFLT_GPIO_PORT DIO_PORT_A
+        #define CONFIG_STEP_1_DFLT_DIO_PIN_A DIO_PIN_10
+        #define CONFIG_STEP_1_DFLT_DIO_PIN_NOT_A DIO_PIN_12
+        #define CONFIG_STEP_1_DFLT_DIO_PIN_B DIO_PIN_11
+        #define CONFIG_STEP_1_DFLT_DIO_PIN_NOT_B DIO_PIN_9
+        #define CONFIG_STEP_1_DFLT_IDLE_TIMER_MS 2000
+        #define CONFIG_STEP_1_DFLT_REV_DIRECTION false
+        #define CONFIG_STEP_1_DFLT_DRIVE_MODE STEP_DRIVE_MODE_FULL
+        #define CONFIG_STEP_1_DFLT_COORD false
 
         #define CONFIG_STEP_2_DFLT_GPIO_PORT DIO_PORT_C
         #define CONFIG_STEP_2_DFLT_DIO_PIN_A DIO_PIN_1
@@ -263,6 +462,7 @@
         #define CONFIG_STEP_2_DFLT_IDLE_TIMER_MS 2000
         #define CONFIG_STEP_2_DFLT_REV_DIRECTION false
         #define CONFIG_STEP_2_DFLT_DRIVE_MODE STEP_DRIVE_MODE_FULL
+        #define CONFIG_STEP_2_DFLT_COORD false
     #else
         #error DRAW not supported
     #endif
@@ -277,8 +477,17 @@
         #define CONFIG_I2C_3_PRESENT 1
         #define CONFIG_TMPHM_1_DFLT_I2C_INSTANCE I2C_INSTANCE_3
         #define CONFIG_TMPHM_1_PRESENT 1
+        // To add a second sensor (at the alternate address) on the same bus:
+        // #define CONFIG_TMPHM_2_PRESENT 1
+        #define CONFIG_TMPHM_2_DFLT_I2C_INSTANCE I2C_INSTANCE_3
         #define CONFIG_TTYS_3_PRESENT 1
         #define CONFIG_I2C_1_PRESENT 1
+    #elif defined HOST_LINUX
+        // Sensor(s) simulated by host/host_i2c.c.
+        #define CONFIG_I2C_3_PRESENT 1
+        #define CONFIG_TMPHM_1_DFLT_I2C_INSTANCE I2C_INSTANCE_3
+        #define CONFIG_TMPHM_1_PRESENT 1
+        #define CONFIG_TMPHM_2_DFLT_I2C_INSTANCE I2C_INSTANCE_3
     #else
         #error TMPHM not supported
     #endif
@@ -294,11 +503,35 @@
 // OS feature.
 #if defined CONFIG_FEAT_OS
     #define CONFIG_OS_PRESENT 1
+    #define CONFIG_OS_TASK_STACK_WORDS 256
+    // Run the module tasks under FreeRTOS, which must be part of the IDE
+    // project (with configUSE_TICK_HOOK 1 and configTICK_RATE_HZ 1000).
+    #if defined CONFIG_FEAT_OS_FREERTOS
+        #define CONFIG_OS_FREERTOS 1
+        // The kernel owns the SysTick, so the tmr module cannot skip ticks.
+        #undef CONFIG_TMR_TICKLESS
+        #define CONFIG_TMR_TICKLESS 0
+    #endif
 #endif
 
 // CAN feature.
 #if defined CONFIG_FEAT_CAN
     #define CONFIG_CAN_1_PRESENT 1
+    #if defined STM32F103xB
+        #define CONFIG_CAN_1_DFLT_TX_PORT DIO_PORT_A
+        #define CONFIG_CAN_1_DFLT_TX_PIN DIO_PIN_12
+        #define CONFIG_CAN_1_DFLT_RX_PORT DIO_PORT_A
+        #define CONFIG_CAN_1_DFLT_RX_PIN DIO_PIN_11
+        #define CONFIG_CAN_1_DFLT_PIN_FUNCTION DIO_GPIO_FUNC_NONE
+    #elif defined STM32L452xx
+        #define CONFIG_CAN_1_DFLT_TX_PORT DIO_PORT_B
+        #define CONFIG_CAN_1_DFLT_TX_PIN DIO_PIN_13
+        #define CONFIG_CAN_1_DFLT_RX_PORT DIO_PORT_B
+        #define CONFIG_CAN_1_DFLT_RX_PIN DIO_PIN_12
+        #define CONFIG_CAN_1_DFLT_PIN_FUNCTION DIO_GPIO_FUNC_10
+    #else
+        #error CAN not supported
+    #endif
 #endif
 
 // FAULT feature.
@@ -313,9 +546,29 @@
 
     #define CONFIG_FAULT_PANIC_TO_CONSOLE 1
     #define CONFIG_FAULT_PANIC_TO_FLASH 1
+    #define CONFIG_FAULT_STACK_DUMP_BYTES 256
+    #define CONFIG_FAULT_STACK_SCAN_MS 10
+    #define CONFIG_FAULT_STACK_SCAN_WORDS 16
+    #define CONFIG_FAULT_STACK_SAMPLE_MS 5
 
     #define CONFIG_TMPHM_WDG_ID 0
     #define CONFIG_WDG_NUM_WDGS 1
 #endif
 
+// BENCH feature.
+#if defined CONFIG_FEAT_BENCH
+    #define CONFIG_BENCH_PRESENT 1
+#endif
+
+// TELEM feature (binary snapshots of performance measurements).
+#if defined CONFIG_FEAT_TELEM
+    #define CONFIG_TELEM_PRESENT 1
+#endif
+
+// ISTAT feature (interrupt timing instrumentation).
+#if defined CONFIG_FEAT_ISTAT
+    #define CONFIG_ISTAT_PRESENT 1
+    #define CONFIG_ISTAT_CRIT 1
+#endif
+
 #endif // _CONFIG_H_
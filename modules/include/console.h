@@ -30,6 +30,7 @@
  */
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "config.h"
@@ -40,6 +41,18 @@
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+// Start of frame character for binary commands (see console.c).
+#define CONSOLE_BIN_SOF '\x02'
+
+// Modules print uint32_t/int32_t with "%lu"/"%ld", as long is 32 bits on the
+// target. On the 64-bit host build fmt also reads "l" as 32 bits, but the
+// compiler's printf format check would not agree, so it is target only.
+#if defined HOST_LINUX
+#define PRINTC_FORMAT_ATTR
+#else
+#define PRINTC_FORMAT_ATTR __attribute__((__format__ (__printf__, 1, 2)))
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -60,21 +73,24 @@ struct console_cfg
 // Core module interface functions.
 int32_t console_get_def_cfg(struct console_cfg* cfg);
 int32_t console_init(struct console_cfg* cfg);;
+int32_t console_start(void);
 int32_t console_run(void);
 
 // Other APIs.
 int32_t console_data_print(uint8_t* data_ptr, uint32_t num_bytes);
+bool console_bin_active(void);
 void console_emit_prompt(void);
-int	printc(const char* fmt, ...)
-    __attribute__((__format__ (__printf__, 1, 2)));
+int	printc(const char* fmt, ...) PRINTC_FORMAT_ATTR;
 int	vprintc(const char* fmt, va_list args);
 void printc_float(const char* prefix, float f, uint32_t max_frac_width,
                   const char* suffix);
 int32_t console_tx_idle(void);
+int32_t console_tx_space(void);
 
 #if CONFIG_FAULT_PRESENT
-int printc_panic(const char* fmt, ...)
-    __attribute__((__format__ (__printf__, 1, 2)));
+int printc_panic(const char* fmt, ...) PRINTC_FORMAT_ATTR;
+void console_data_print_panic(uint32_t offset, const uint8_t* data,
+                              uint32_t num_bytes);
 #endif
 
 #endif // _CONSOLE_H_
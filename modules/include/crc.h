@@ -0,0 +1,50 @@
+#ifndef _CRC_H_
+#define _CRC_H_
+
+/*
+ * @brief Interface declaration of crc utility.
+ *
+ * See implementation file for information about this utility.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+// Initial values. Each *_update() function takes the running CRC value,
+// starting with the initial value, so data can be processed in pieces.
+
+#define CRC8_INIT 0xff        // CRC-8, Sensirion (poly 0x31, no final XOR).
+#define CRC16_INIT 0xffff     // CRC-16/CCITT-FALSE (poly 0x1021, no final XOR).
+#define CRC32_INIT 0xffffffff // CRC-32/IEEE 802.3 (reflected, final XOR).
+
+uint8_t crc8_update(uint8_t crc, const void* data, uint32_t len);
+uint16_t crc16_update(uint16_t crc, const void* data, uint32_t len);
+uint32_t crc32_update(uint32_t crc, const void* data, uint32_t len);
+
+// One-shot versions, including the final XOR for CRC-32.
+uint8_t crc8(const void* data, uint32_t len);
+uint16_t crc16(const void* data, uint32_t len);
+uint32_t crc32(const void* data, uint32_t len);
+
+#endif // _CRC_H_
@@ -29,6 +29,7 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "config.h"
@@ -55,6 +56,16 @@
  *     + DIO_PULL_DOWN
  *   - invert : True to invert the signal value.
  *
+ * Fields for inputs only:
+ *   - edge : One of (default DIO_EDGE_NONE):
+ *     + DIO_EDGE_NONE
+ *     + DIO_EDGE_RISING
+ *     + DIO_EDGE_FALLING
+ *     + DIO_EDGE_BOTH
+ *     Edges are captured using EXTI interrupts, and read with
+ *     dio_edge_get(). Only one input per pin number can capture edges. The
+ *     edge is that of the pin, before any inversion.
+ *
  * Additional fields common for inputs and outputs only used for direct
  * configuration:
  *   - mode: One of:
@@ -145,6 +156,14 @@
 #define DIO_OUTPUT_PUSHPULL (LL_GPIO_OUTPUT_PUSHPULL)
 #define DIO_OUTPUT_OPENDRAIN (LL_GPIO_OUTPUT_OPENDRAIN)
 
+#define DIO_EDGE_NONE 0
+#define DIO_EDGE_RISING 1
+#define DIO_EDGE_FALLING 2
+#define DIO_EDGE_BOTH (DIO_EDGE_RISING | DIO_EDGE_FALLING)
+
+#define DIO_GROUP_MAX_PINS 32
+#define DIO_GROUP_MAX_PORTS 4
+
 // Support for alternative functions as defined in the reference manual.
 //
 // The value DIO_GPIO_FUNC_NONE means "no alternative function" which
@@ -186,6 +205,7 @@ struct dio_in_info {
     const uint32_t pin;
     const uint32_t pull;
     const uint8_t invert;
+    const uint8_t edge;
 };
 
 // Structure for init-time configuration of digital outputs.
@@ -209,6 +229,28 @@ struct dio_cfg
     const struct dio_out_info* const outputs;
 };
 
+// A set of inputs, or outputs, accessed with one call. It is set up by
+// dio_group_init(), which resolves the pins into per-port masks, so I/O takes
+// one register access per port. Bit N of the values used with it is the pin
+// at index N of the list passed to dio_group_init().
+struct dio_group {
+    bool outputs;
+    uint8_t num_pins;
+    uint8_t num_ports;
+    dio_port* ports[DIO_GROUP_MAX_PORTS];
+    uint16_t invert_masks[DIO_GROUP_MAX_PORTS];
+    uint8_t pin_port_idx[DIO_GROUP_MAX_PINS];
+    uint8_t pin_num[DIO_GROUP_MAX_PINS];
+};
+
+// A captured input edge.
+struct dio_edge_event {
+    uint32_t ms;            // tmr_get_ms() at the interrupt.
+    uint32_t systick_ctr;   // tmr_get_systick_ctr() at the interrupt.
+    uint8_t din_idx;        // Discrete input index per module configuration.
+    uint8_t value;          // Input value (0/1) after the edge.
+};
+
 // Structure for direct configuration of GPIO.
 struct dio_direct_cfg {
     dio_port* port;
@@ -240,6 +282,12 @@ int32_t dio_get_out(uint32_t dout_idx);
 int32_t dio_set(uint32_t dout_idx, uint32_t value);
 int32_t dio_get_num_in(void);
 int32_t dio_get_num_out(void);
+int32_t dio_group_init(struct dio_group* grp, bool outputs,
+                       const uint32_t* idxs, uint32_t num_pins);
+int32_t dio_group_get(const struct dio_group* grp, uint32_t* values);
+int32_t dio_group_set(const struct dio_group* grp, uint32_t values,
+                      uint32_t mask);
+int32_t dio_edge_get(struct dio_edge_event* event);
 
 // Other APIs, for DIO configured at run time.
 int32_t dio_direct_cfg(struct dio_direct_cfg* cfg);
@@ -32,6 +32,7 @@
 #include <stdint.h>
 
 #include "step.h"
+#include "ttys.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
@@ -70,6 +71,11 @@ int32_t draw_start(void);
 int32_t draw_run(void);
 
 // Other APIs.
+int32_t draw_queue_move(float x_mm, float y_mm, enum draw_move_type move_type);
+int32_t draw_queue_polyline(const float* xy_mm, uint32_t num_points);
+int32_t draw_get_free_move_slots(void);
+int32_t draw_stream_start(enum ttys_instance_id instance_id);
+int32_t draw_stream_stop(void);
 int32_t draw_move_to(float x_mm, float y_mm, enum draw_move_type move_type);
 int32_t draw_jog_joint(uint32_t joint_idx, float jog_degrees);
 int32_t draw_joint_calib(float theta_1_deg, float theta_2_deg);
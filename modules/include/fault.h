@@ -65,5 +65,6 @@ int32_t fault_start(void);
 void fault_detected(enum fault_type type, uint32_t fault_param);
 void fault_exception_handler(uint32_t sp);
 uint32_t fault_get_rcc_csr(void);
+void fault_stack_sample(void);
 
 #endif // _FAULT_H_
@@ -29,16 +29,24 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+// Largest key for the key/value store.
+#define FLASH_KV_KEY_MAX 0xfffe
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+// Asynchronous operation completion callback, with a "MOD_ERR" value (0 for
+// success).
+typedef void (*flash_done_cb)(int32_t rc, void* user_data);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -49,10 +57,21 @@
 
 // Core module interface functions.
 int32_t flash_start(void);
+int32_t flash_run(void);
 
 // Other APIs.
 int32_t flash_panic_erase_page(uint32_t* start_addr);
 int32_t flash_panic_write(uint32_t* flash_addr, uint32_t* data,
                           uint32_t data_len);
+int32_t flash_erase_async(uint32_t* start_addr, flash_done_cb cb,
+                          void* user_data);
+int32_t flash_write_async(uint32_t* flash_addr, const void* data,
+                          uint32_t data_len, flash_done_cb cb, void* user_data);
+bool flash_async_idle(void);
+
+// Key/value store APIs.
+int32_t flash_kv_get(uint16_t key, void* buf, uint32_t buf_len);
+int32_t flash_kv_set(uint16_t key, const void* data, uint32_t len);
+int32_t flash_kv_delete(uint16_t key);
 
 #endif // _FLASH_H_
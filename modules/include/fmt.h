@@ -0,0 +1,45 @@
+#ifndef _FMT_H_
+#define _FMT_H_
+
+/*
+ * @brief Interface declaration of fmt utility.
+ *
+ * See implementation file for information about this utility.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+
+// Output function, called with each chunk of formatted output (not
+// terminated).
+typedef void (*fmt_out_func)(void* out_arg, const char* s, uint32_t len);
+
+int fmt_vformat(fmt_out_func out, void* out_arg, const char* fmt,
+                va_list args);
+int fmt_format(fmt_out_func out, void* out_arg, const char* fmt, ...);
+int fmt_vsnprintf(char* buf, uint32_t size, const char* fmt, va_list args);
+int fmt_snprintf(char* buf, uint32_t size, const char* fmt, ...);
+
+#endif // _FMT_H_
@@ -29,6 +29,7 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "ttys.h"
@@ -36,6 +37,27 @@
 struct gps_cfg
 {
     enum ttys_instance_id ttys_instance_id;
+    bool ubx_mode;              // Configure receiver for UBX output at start.
+    uint16_t ubx_meas_rate_ms;  // Navigation rate to use in UBX mode.
+};
+
+// Position/velocity data decoded from GGA and RMC sentences. All values are
+// scaled integers so no floating point is needed to use them. In UBX mode the
+// same structure is filled in from NAV-PVT frames.
+struct gps_fix
+{
+    uint32_t update_ms;         // tmr_get_ms() when last GGA/RMC was accepted.
+    uint32_t time_ms;           // UTC time of day, in ms.
+    uint32_t date;              // UTC date as ddmmyy (from RMC).
+    int32_t lat_e7;             // Latitude in degrees * 1e7, north positive.
+    int32_t lon_e7;             // Longitude in degrees * 1e7, east positive.
+    int32_t alt_dm;             // Altitude above mean sea level, in dm.
+    uint32_t speed_knots_x100;  // Speed over ground, in knots * 100.
+    uint16_t course_deg_x100;   // Course over ground, in degrees * 100.
+    uint16_t hdop_x100;         // HDOP * 100 (from NAV-DOP in UBX mode).
+    uint8_t quality;            // GGA fix quality (0 = no fix).
+    uint8_t num_sats;           // Number of satellites used in fix.
+    bool valid;                 // RMC status is 'A' (active).
 };
 
 // Core module interface functions.
@@ -45,5 +67,6 @@ int32_t gps_start(void);
 int32_t gps_run(void);
 
 // Other APIs.
+int32_t gps_get_fix(struct gps_fix* fix);
 
 #endif // _GPS_GTU7_H_
@@ -29,6 +29,7 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "config.h"
@@ -43,6 +44,7 @@ enum i2c_errors {
     I2C_ERR_ACK_FAIL,
     I2C_ERR_BUS_ERR,
     I2C_ERR_INTR_UNEXPECT,
+    I2C_ERR_DMA,
 };
 
 // I2C numbering is based on the MCU hardware definition.
@@ -66,6 +68,42 @@ enum i2c_instance_id {
 
 struct i2c_cfg {
     uint32_t transaction_guard_time_ms;
+    bool use_dma; // Use DMA for transfers of 2 or more bytes (DMA type 1 only).
+};
+
+// Transaction types for i2c_submit().
+enum i2c_xact_op {
+    I2C_XACT_WRITE,
+    I2C_XACT_READ,
+    I2C_XACT_WRITE_READ, // Write, then read after a repeated start.
+};
+
+struct i2c_xact;
+
+// Transaction completion callback. It is called from interrupt context (or in
+// the case of a guard timer expiry, from the base level).
+typedef void (*i2c_xact_cb)(struct i2c_xact* xact);
+
+// Transaction descriptor for i2c_submit(). The descriptor is owned by the
+// i2c module from submission until the completion callback is called, so it
+// must not be on the stack of a function that returns before then.
+struct i2c_xact {
+    // Set by client.
+    enum i2c_xact_op op;
+    uint16_t dest_addr;      // I2C destination address (not shifted).
+    uint16_t wr_len;
+    uint16_t rd_len;
+    uint8_t* wr_bfr;
+    uint8_t* rd_bfr;
+    i2c_xact_cb cb;          // Completion callback (or NULL).
+    uint32_t user_data;
+
+    // Set by i2c module before completion callback.
+    int32_t rc;              // 0 for success, else a "MOD_ERR" value.
+    enum i2c_errors error;
+
+    // Private to the i2c module.
+    struct i2c_xact* next;
 };
 
 // Core module interface functions.
@@ -82,6 +120,8 @@ int32_t i2c_write(enum i2c_instance_id instance_id, uint32_t dest_addr,
 int32_t i2c_read(enum i2c_instance_id instance_id, uint32_t dest_addr,
                  uint8_t* msg_bfr, uint32_t msg_len);
 
+int32_t i2c_submit(enum i2c_instance_id instance_id, struct i2c_xact* xact);
+
 int32_t i2c_get_op_status(enum i2c_instance_id instance_id);
 enum i2c_errors i2c_get_error(enum i2c_instance_id instance_id);
 int32_t i2c_bus_busy(enum i2c_instance_id instance_id);
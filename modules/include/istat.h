@@ -0,0 +1,81 @@
+#ifndef _ISTAT_H_
+#define _ISTAT_H_
+
+/*
+ * @brief Interface declaration of istat module.
+ *
+ * See implementation file for information about this module.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+// Instrumented interrupt sources.
+enum istat_id {
+    ISTAT_ID_SYSTICK,
+    ISTAT_ID_USART1,
+    ISTAT_ID_USART2,
+    ISTAT_ID_USART6,
+    ISTAT_ID_I2C1_EV,
+    ISTAT_ID_I2C2_EV,
+    ISTAT_ID_I2C3_EV,
+    ISTAT_ID_STEP_1,
+    ISTAT_ID_STEP_2,
+
+    ISTAT_NUM_IDS
+};
+
+// Instrumentation macros. ISTAT_EXEC_BEGIN() declares a variable, so it must
+// be paired with ISTAT_EXEC_END() in the same block. ISTAT_LATENCY() records
+// the time from the interrupt event to handler entry, for sources that can
+// measure it (e.g. from a hardware timer counter).
+#if CONFIG_ISTAT_PRESENT
+    #define ISTAT_EXEC_BEGIN(id) const uint32_t _istat_begin_cyc = DWT->CYCCNT
+    #define ISTAT_EXEC_END(id) \
+        istat_exec_record((id), DWT->CYCCNT - _istat_begin_cyc)
+    #define ISTAT_LATENCY(id, cycles) istat_latency_record((id), (cycles))
+#else
+    #define ISTAT_EXEC_BEGIN(id) do { } while (0)
+    #define ISTAT_EXEC_END(id) do { } while (0)
+    #define ISTAT_LATENCY(id, cycles) do { } while (0)
+#endif
+
+struct istat_cfg
+{
+    // FUTURE
+};
+
+// Core module interface functions.
+int32_t istat_init(struct istat_cfg* cfg);
+int32_t istat_start(void);
+
+// Other APIs.
+void istat_exec_record(enum istat_id id, uint32_t cycles);
+void istat_latency_record(enum istat_id id, uint32_t cycles);
+void istat_crit_record(uint32_t cycles);
+
+#endif // _ISTAT_H_
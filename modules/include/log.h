@@ -30,6 +30,7 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // The log toggle char at the console is ctrl-L which is form feed, or 0x0c.
 #define LOG_TOGGLE_CHAR '\x0c'
@@ -48,11 +49,15 @@ enum log_level {
 #define LOG_LEVEL_NAMES_CSV "off", "error", "warning", "info", "debug", "verbose"
 
 // Core module interface functions.
+int32_t log_start(void);
+int32_t log_run(void);
 
 // Other APIs.
 void log_toggle_active(void);
 bool log_is_active(void);
 void log_printf(const char* fmt, ...);
+void log_set_deferred(bool deferred);
+void log_flush(void);
 
 #define log_error(fmt, ...) do { if (_log_active && log_level >= LOG_ERROR) \
             log_printf("ERR  " fmt, ##__VA_ARGS__); } while (0)
@@ -32,22 +32,94 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+#include "tmr.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+// There are several LWL circular buffers ("rings"), so that high rate logs do
+// not overwrite the history of rarer ones. A source file selects a ring for
+// its logs by defining LWL_RING (after including this file, along with
+// LWL_BASE_ID and LWL_NUM), for example:
+//     #define LWL_RING LWL_RING_HI_RATE
+// Otherwise, logs go to LWL_RING_MAIN.
+
+#define LWL_RING_MAIN 0
+#define LWL_RING_HI_RATE 1
+#define LWL_NUM_RINGS 2
+
+// The buffer sizes must be powers of 2, so buffer indices can be wrapped with a
+// mask.
+#ifdef CONFIG_LWL_BUF_SIZE
+    #define LWL_BUF_SIZE (CONFIG_LWL_BUF_SIZE)
+#else
+    #define LWL_BUF_SIZE 1024
+#endif
+
+#ifdef CONFIG_LWL_HI_RATE_BUF_SIZE
+    #define LWL_HI_RATE_BUF_SIZE (CONFIG_LWL_HI_RATE_BUF_SIZE)
+#else
+    #define LWL_HI_RATE_BUF_SIZE 256
+#endif
+
+_Static_assert((LWL_BUF_SIZE & (LWL_BUF_SIZE - 1)) == 0 &&
+               LWL_BUF_SIZE < 0x10000,
+               "LWL_BUF_SIZE not a power of 2 < 64K");
+_Static_assert((LWL_HI_RATE_BUF_SIZE & (LWL_HI_RATE_BUF_SIZE - 1)) == 0 &&
+               LWL_HI_RATE_BUF_SIZE < 0x10000,
+               "LWL_HI_RATE_BUF_SIZE not a power of 2 < 64K");
+
+// Each log starts with the ID, followed by the time (ms) since the previous log
+// in the same ring, and then the argument bytes. The time delta is one byte,
+// or if it is LWL_TS_EXT, it is followed by a 2 byte delta (big endian). Only
+// the low 16 bits of the time of the last log are kept, so the 2 byte delta is
+// modulo 64K ms, i.e. a gap of 65.536 seconds or more between logs wraps
+// rather than saturates.
+#define LWL_TS_EXT 0xff
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+// Header for a ring. Each ring is output as a separate data section (with
+// magic MOD_MAGIC_LWL_TS), in ring number order.
+struct lwl_ring_hdr
+{
+    uint32_t magic;
+    uint32_t num_section_bytes;
+    uint32_t buf_size;
+    // Bits 0-15 put index, 16-31 time of last log. The put index is a free
+    // running count modulo 64K (masked with buf_size - 1 to index the buffer),
+    // so a reader can tell when the ring has lapped it.
+    volatile uint32_t put_idx;
+};
+
+// For writing to flash, this structure needs to be a multiple of 8 bytes.
+struct lwl_data
+{
+    struct lwl_ring_hdr main_hdr;
+    uint8_t main_buf[LWL_BUF_SIZE];
+    struct lwl_ring_hdr hi_rate_hdr;
+    uint8_t hi_rate_buf[LWL_HI_RATE_BUF_SIZE];
+};
+
+// Default ring for a source file. See LWL_RING above.
+enum { LWL_RING = LWL_RING_MAIN };
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) externs
 ////////////////////////////////////////////////////////////////////////////////
 
-// Following variable is global to allow efficient access by macros,
-// but it is considered private.
+// Following variables are global to allow efficient access by macros and
+// inline functions, but they are considered private.
 
 extern bool _lwl_active;
+extern uint32_t lwl_off_cnt;
+extern struct lwl_data _lwl_data;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) function declarations
@@ -55,30 +127,121 @@ extern bool _lwl_active;
 
 // Core module interface functions.
 int32_t lwl_start(void);
+int32_t lwl_run(void);
 
 // Other APIs.
-void lwl_rec(uint8_t id, int32_t num_arg_bytes, ...);
 void lwl_enable(bool on);
 void lwl_dump(void);
 uint8_t* lwl_get_buffer(uint32_t* len);
 
+// Private.
+void _lwl_off_cnt_dec(void);
+
 // The special __COUNTER__ macro (not official C but supported by many
 // compilers) is used to generate LWL IDs.
+//
+// The argument bytes are put in a compound literal array (with a leading dummy
+// byte so it is never empty), which also allows the number of argument bytes
+// to be checked at compile time.
 
 #define LWL(fmt, num_arg_bytes, ...) LWL_CNT(__COUNTER__, fmt, num_arg_bytes, ##__VA_ARGS__)
 
 #define LWL_CNT(counter, fmt, num_arg_bytes, ...) do {                  \
         _Static_assert((counter) < LWL_NUM);                            \
+        _Static_assert(sizeof((uint8_t[]){0, ##__VA_ARGS__}) ==         \
+                       (num_arg_bytes) + 1, "LWL num_arg_bytes mismatch"); \
         if (_lwl_active)                                                \
-            lwl_rec(LWL_BASE_ID+(counter), num_arg_bytes, ##__VA_ARGS__); \
+            _lwl_rec(LWL_RING, LWL_BASE_ID+(counter), num_arg_bytes,    \
+                     (const uint8_t[]){0, ##__VA_ARGS__} + 1);          \
     } while (0)
 
 // The argument macros convert arguments to bytes, which makes copying them to the
 // circular buffer efficient.
 
-#define LWL_1(a) (uint32_t)(a)
-#define LWL_2(a) (uint32_t)(a) >> 8,  (uint32_t)(a)
-#define LWL_3(a) (uint32_t)(a) >> 16, (uint32_t)(a) >> 8,  (uint32_t)(a)
-#define LWL_4(a) (uint32_t)(a) >> 24, (uint32_t)(a) >> 16, (uint32_t)(a) >> 8, (uint32_t)(a)
+#define _LWL_B(a, shift) (uint8_t)((uint32_t)(a) >> (shift))
+
+#define LWL_1(a) _LWL_B(a, 0)
+#define LWL_2(a) _LWL_B(a, 8),  _LWL_B(a, 0)
+#define LWL_3(a) _LWL_B(a, 16), _LWL_B(a, 8),  _LWL_B(a, 0)
+#define LWL_4(a) _LWL_B(a, 24), _LWL_B(a, 16), _LWL_B(a, 8), _LWL_B(a, 0)
+
+////////////////////////////////////////////////////////////////////////////////
+// Inline functions (private, used by the LWL macro)
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Record a lightweight log.
+ *
+ * @param[in] ring The ring (LWL_RING_xxx).
+ * @param[in] id The log ID.
+ * @param[in] num_arg_bytes The number of argument bytes (0 if no arguments).
+ * @param[in] args The argument bytes.
+ *
+ * Space in the ring is reserved with a single exclusive load/store
+ * (LDREX/STREX) of the put index, which also holds the time of the last log
+ * (for computing the time delta). Interrupts are not disabled. If an
+ * interrupt handler records a log in between, the store fails and the
+ * reservation is retried, so each log gets its own space and the time deltas
+ * stay consistent with the buffer order.
+ *
+ * Since ring and num_arg_bytes are constants at each call site, the ring
+ * selection folds away and the copy loop is normally unrolled by the compiler.
+ *
+ * @note If a fault occurs while the bytes are being written, the last log in
+ *       the ring can be incomplete. The decoder detects this as unused data at
+ *       the end of the buffer.
+ */
+static inline void _lwl_rec(uint32_t ring, uint8_t id, uint32_t num_arg_bytes,
+                            const uint8_t* args)
+{
+    struct lwl_ring_hdr* hdr;
+    uint8_t* buf;
+    uint32_t mask;
+    uint32_t old;
+    uint32_t now_ms;
+    uint32_t delta_ms;
+    uint32_t num_ts_bytes;
+    uint32_t put_idx;
+
+    if (ring == LWL_RING_HI_RATE) {
+        hdr = &_lwl_data.hi_rate_hdr;
+        buf = _lwl_data.hi_rate_buf;
+        mask = LWL_HI_RATE_BUF_SIZE - 1;
+    } else {
+        hdr = &_lwl_data.main_hdr;
+        buf = _lwl_data.main_buf;
+        mask = LWL_BUF_SIZE - 1;
+    }
+
+    if (lwl_off_cnt != 0)
+        _lwl_off_cnt_dec();
+
+    do {
+        old = __LDREXW(&hdr->put_idx);
+        now_ms = tmr_get_ms() & 0xffff;
+        delta_ms = (now_ms - (old >> 16)) & 0xffff;
+        num_ts_bytes = delta_ms < LWL_TS_EXT ? 1 : 3;
+        put_idx = old & 0xffff;
+    } while (__STREXW((now_ms << 16) |
+                      ((put_idx + 1 + num_ts_bytes + num_arg_bytes) & 0xffff),
+                      &hdr->put_idx) != 0);
+
+    put_idx &= mask;
+    buf[put_idx] = id;
+    put_idx = (put_idx + 1) & mask;
+    if (num_ts_bytes == 1) {
+        buf[put_idx] = delta_ms;
+    } else {
+        buf[put_idx] = LWL_TS_EXT;
+        put_idx = (put_idx + 1) & mask;
+        buf[put_idx] = delta_ms >> 8;
+        put_idx = (put_idx + 1) & mask;
+        buf[put_idx] = delta_ms;
+    }
+    while (num_arg_bytes-- > 0) {
+        put_idx = (put_idx + 1) & mask;
+        buf[put_idx] = *args++;
+    }
+}
 
 #endif // _LWL_H_
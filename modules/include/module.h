@@ -51,7 +51,10 @@
 // Data block magic numbers
 #define MOD_MAGIC_FAULT 0xdead0001
 #define MOD_MAGIC_LWL 0xf00d0001
+#define MOD_MAGIC_LWL_TS 0xf00d0002
 #define MOD_MAGIC_END 0xc0da0001
+#define MOD_MAGIC_STACK 0x57ac0001
+#define MOD_MAGIC_LZ 0x1200c001
 
 // Get size of an array.
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
@@ -77,6 +80,29 @@
 
 // Critical region start/end macros, which work regardless of where you are
 // runing in a handler, or at the base level.
+//
+// If CONFIG_ISTAT_CRIT is set, the time interrupts are masked by each
+// outermost critical region is recorded by the istat module.
+#if CONFIG_ISTAT_CRIT
+
+void istat_crit_record(uint32_t cycles);
+
+#define CRIT_STATE_VAR uint32_t _primask_save, _crit_begin_cyc
+#define CRIT_BEGIN_NEST()                       \
+    do {                                        \
+        _primask_save = __get_PRIMASK();        \
+        __set_PRIMASK(1);                       \
+        _crit_begin_cyc = DWT->CYCCNT;          \
+    } while (0)
+#define CRIT_END_NEST()                                             \
+    do {                                                            \
+        if (_primask_save == 0)                                     \
+            istat_crit_record(DWT->CYCCNT - _crit_begin_cyc);       \
+        __set_PRIMASK(_primask_save);                               \
+    } while (0)
+
+#else
+
 #define CRIT_STATE_VAR uint32_t _primask_save
 #define CRIT_BEGIN_NEST()                       \
     do {                                        \
@@ -88,4 +114,20 @@
         __set_PRIMASK(_primask_save);           \
     } while (0)
 
+#endif
+
+// Critical region macros for waiting for an interrupt (WFI) with interrupts
+// masked, as in sched_idle(). These are never recorded with CONFIG_ISTAT_CRIT,
+// as the time is spent sleeping rather than delaying interrupt handlers.
+#define CRIT_IDLE_STATE_VAR uint32_t _primask_save
+#define CRIT_IDLE_BEGIN_NEST()                  \
+    do {                                        \
+        _primask_save = __get_PRIMASK();        \
+        __set_PRIMASK(1);                       \
+    } while (0)
+#define CRIT_IDLE_END_NEST()                    \
+    do {                                        \
+        __set_PRIMASK(_primask_save);           \
+    } while (0)
+
 #endif // _MODDEFS_H_
@@ -29,12 +29,29 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "config.h"
+#include "sched.h"
+
+#if CONFIG_OS_FREERTOS
+#include "FreeRTOS.h"
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+// NVIC preemption priority for interrupt handlers that call sched_post(). With
+// FreeRTOS this is the highest (numerically lowest) priority allowed to call
+// the kernel "FromISR" APIs.
+#if CONFIG_OS_FREERTOS
+#define OS_POST_IRQ_PRIO configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+#else
+#define OS_POST_IRQ_PRIO 0
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -59,5 +76,14 @@ int32_t os_start(void);
 int32_t os_run(void);
 
 // Other APIs.
+void os_dump(const char* tag);
+
+#if CONFIG_OS_FREERTOS
+int32_t os_task_create(const char* name, sched_task_func func, int32_t arg,
+                       uint8_t prio, bool poll);
+int32_t os_task_set_poll(int32_t os_task_id, bool poll);
+void os_task_notify(int32_t os_task_id);
+int32_t os_sched_start(void);
+#endif
 
 #endif // _OS_H_
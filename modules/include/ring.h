@@ -0,0 +1,271 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+/*
+ * @brief Single-producer/single-consumer ring buffer (header only).
+ *
+ * A struct ring holds only the indices of a ring. The storage is an array of
+ * any element type owned by the client, with a power of 2 number of elements
+ * (max 0x8000), so the indices wrap by masking. One element is always left
+ * empty to distinguish full from empty, so a ring of size N holds up to N-1
+ * elements.
+ *
+ * Only the producer writes put_idx and only the consumer writes get_idx, so
+ * no locking is needed when there is one of each (e.g. an interrupt handler
+ * and the super loop). If there can be more than one producer (or consumer),
+ * the client must serialize them, e.g. with a critical section. A memory
+ * barrier orders the element accesses with respect to the index updates, so
+ * the other side, or a DMA controller, never sees an index before the data.
+ *
+ * There are two ways to access the elements:
+ * - Zero-copy, with ring_put_peek()/ring_put_commit() and
+ *   ring_get_peek()/ring_get_commit(). The peek functions give the index of
+ *   the next element, and the number of contiguous elements from there, so the
+ *   client can work on the elements in place (e.g. for a DMA transfer) and then
+ *   commit them.
+ * - Bulk copies, with ring_put() and ring_get(), which copy as many elements as
+ *   possible in at most two memcpy() calls. The element size is normally a
+ *   constant, so the compiler can optimize the copies.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+// Check that a ring size is valid (a power of 2, at least 2, max 0x8000).
+#define RING_SIZE_OK(n) ((n) >= 2 && (n) <= 0x8000 && ((n) & ((n) - 1)) == 0)
+
+// Static initializer for an empty ring of a given size.
+#define RING_INIT(size) { .put_idx = 0, .get_idx = 0, .mask = (size) - 1 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+struct ring {
+    volatile uint16_t put_idx;
+    volatile uint16_t get_idx;
+    uint16_t mask;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Inline functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Initialize a ring to empty.
+ *
+ * @param[out] r The ring.
+ * @param[in] size Number of elements in the storage (see RING_SIZE_OK).
+ */
+static inline void ring_init(struct ring* r, uint32_t size)
+{
+    r->put_idx = 0;
+    r->get_idx = 0;
+    r->mask = size - 1;
+}
+
+/*
+ * @brief Get the size of the ring storage.
+ *
+ * @param[in] r The ring.
+ *
+ * @return Number of elements in the storage (one more than the capacity).
+ */
+static inline uint32_t ring_size(const struct ring* r)
+{
+    return r->mask + 1;
+}
+
+/*
+ * @brief Get the number of elements in a ring.
+ *
+ * @param[in] r The ring.
+ *
+ * @return Number of elements that can be got.
+ */
+static inline uint32_t ring_count(const struct ring* r)
+{
+    return (r->put_idx - r->get_idx) & r->mask;
+}
+
+/*
+ * @brief Get the free space in a ring.
+ *
+ * @param[in] r The ring.
+ *
+ * @return Number of elements that can be put.
+ */
+static inline uint32_t ring_space(const struct ring* r)
+{
+    return (r->get_idx - r->put_idx - 1) & r->mask;
+}
+
+/*
+ * @brief Check if a ring is empty.
+ *
+ * @param[in] r The ring.
+ *
+ * @return true if empty.
+ */
+static inline bool ring_empty(const struct ring* r)
+{
+    return r->get_idx == r->put_idx;
+}
+
+/*
+ * @brief Get the next free element(s) of a ring (producer).
+ *
+ * @param[in] r The ring.
+ * @param[out] idx Index of the first free element.
+ *
+ * @return Number of contiguous free elements starting at *idx (0 if full).
+ *
+ * The elements can be filled in place, then added with ring_put_commit().
+ */
+static inline uint32_t ring_put_peek(const struct ring* r, uint32_t* idx)
+{
+    uint32_t put_idx = r->put_idx;
+    uint32_t space = (r->get_idx - put_idx - 1) & r->mask;
+    uint32_t contig = r->mask + 1 - put_idx;
+
+    *idx = put_idx;
+    return space < contig ? space : contig;
+}
+
+/*
+ * @brief Add element(s) filled in place to a ring (producer).
+ *
+ * @param[in] r The ring.
+ * @param[in] num Number of elements, at most the free space.
+ */
+static inline void ring_put_commit(struct ring* r, uint32_t num)
+{
+    __DMB();
+    r->put_idx = (r->put_idx + num) & r->mask;
+}
+
+/*
+ * @brief Get the next element(s) of a ring, without removing them (consumer).
+ *
+ * @param[in] r The ring.
+ * @param[out] idx Index of the first element.
+ *
+ * @return Number of contiguous elements starting at *idx (0 if empty).
+ *
+ * The elements can be used in place, then removed with ring_get_commit().
+ */
+static inline uint32_t ring_get_peek(const struct ring* r, uint32_t* idx)
+{
+    uint32_t get_idx = r->get_idx;
+    uint32_t count = (r->put_idx - get_idx) & r->mask;
+    uint32_t contig = r->mask + 1 - get_idx;
+
+    __DMB();
+    *idx = get_idx;
+    return count < contig ? count : contig;
+}
+
+/*
+ * @brief Remove element(s) from a ring (consumer).
+ *
+ * @param[in] r The ring.
+ * @param[in] num Number of elements, at most the count.
+ */
+static inline void ring_get_commit(struct ring* r, uint32_t num)
+{
+    __DMB();
+    r->get_idx = (r->get_idx + num) & r->mask;
+}
+
+/*
+ * @brief Copy elements into a ring (producer).
+ *
+ * @param[in] r The ring.
+ * @param[in] buf The ring storage.
+ * @param[in] elem_size Size of each element.
+ * @param[in] data The elements to put.
+ * @param[in] num Number of elements to put.
+ *
+ * @return Number of elements put, which is less than num if the ring fills.
+ */
+static inline uint32_t ring_put(struct ring* r, void* buf, uint32_t elem_size,
+                                const void* data, uint32_t num)
+{
+    const uint8_t* src = data;
+    uint32_t put_idx = r->put_idx;
+    uint32_t space = (r->get_idx - put_idx - 1) & r->mask;
+    uint32_t chunk;
+
+    if (num > space)
+        num = space;
+    chunk = r->mask + 1 - put_idx;
+    if (chunk > num)
+        chunk = num;
+    memcpy((uint8_t*)buf + put_idx * elem_size, src, chunk * elem_size);
+    memcpy(buf, src + chunk * elem_size, (num - chunk) * elem_size);
+    ring_put_commit(r, num);
+    return num;
+}
+
+/*
+ * @brief Copy elements out of a ring (consumer).
+ *
+ * @param[in] r The ring.
+ * @param[in] buf The ring storage.
+ * @param[in] elem_size Size of each element.
+ * @param[out] data Where to put the elements.
+ * @param[in] num Maximum number of elements to get.
+ *
+ * @return Number of elements got, which is less than num if the ring empties.
+ */
+static inline uint32_t ring_get(struct ring* r, const void* buf,
+                                uint32_t elem_size, void* data, uint32_t num)
+{
+    uint8_t* dst = data;
+    uint32_t get_idx = r->get_idx;
+    uint32_t count = (r->put_idx - get_idx) & r->mask;
+    uint32_t chunk;
+
+    __DMB();
+    if (num > count)
+        num = count;
+    chunk = r->mask + 1 - get_idx;
+    if (chunk > num)
+        chunk = num;
+    memcpy(dst, (const uint8_t*)buf + get_idx * elem_size, chunk * elem_size);
+    memcpy(dst + chunk * elem_size, buf, (num - chunk) * elem_size);
+    ring_get_commit(r, num);
+    return num;
+}
+
+#endif // _RING_H_
@@ -0,0 +1,55 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+/*
+ * @brief Interface declaration of sched module.
+ *
+ * See implementation file for information about this module.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#define SCHED_MAX_TASKS CONFIG_SCHED_MAX_TASKS
+
+#define SCHED_NO_TASK -1
+
+// Task function signature. The arg is the value given to sched_task_add().
+typedef int32_t (*sched_task_func)(int32_t arg);
+
+// Core module interface functions.
+int32_t sched_start(void);
+int32_t sched_run(void);
+
+// Other APIs.
+int32_t sched_task_add(const char* name, sched_task_func func, int32_t arg,
+                       uint8_t prio, bool poll);
+int32_t sched_task_set_poll(int32_t task_id, bool poll);
+void sched_post(int32_t task_id);
+int32_t sched_idle(void);
+
+#endif // _SCHED_H_
@@ -47,4 +47,30 @@ void stat_dur_restart(struct stat_dur* stat);
 void stat_dur_end(struct stat_dur* stat);
 uint32_t stat_dur_avg_us(struct stat_dur* stat);
 
+// Number of log2 histogram buckets for cycle-based durations. Bucket i counts
+// durations of [2^i, 2^(i+1)) cycles (bucket 0 also counts 0 cycles).
+#define STAT_HIST_NUM_BUCKETS 32
+
+struct stat_cyc_dur {
+    uint64_t accum_cyc;
+    uint32_t start_cyc;
+    uint32_t min;
+    uint32_t max;
+    uint32_t samples;
+    bool started;
+    uint16_t hist[STAT_HIST_NUM_BUCKETS];
+};
+
+void stat_cyc_dur_init(struct stat_cyc_dur* stat);
+void stat_cyc_dur_start(struct stat_cyc_dur* stat);
+void stat_cyc_dur_restart(struct stat_cyc_dur* stat);
+void stat_cyc_dur_end(struct stat_cyc_dur* stat);
+void stat_cyc_dur_add(struct stat_cyc_dur* stat, uint32_t cycles);
+uint32_t stat_cyc_dur_avg_ns(struct stat_cyc_dur* stat);
+uint32_t stat_cyc_dur_pctl_ns(struct stat_cyc_dur* stat, uint32_t pctl_x100);
+
+uint32_t stat_cyc_get(void);
+uint32_t stat_cyc_to_ns(uint32_t cycles);
+uint32_t stat_cyc_to_us64(uint64_t cycles);
+
 #endif // _STAT_H_
@@ -75,12 +75,16 @@ struct step_cfg
     uint32_t idle_timer_ms;
     bool rev_direction;
     enum step_drive_mode drive_mode;
+    uint32_t accel_steps_per_s2;
+    bool use_hw_tmr;
+    bool coord;
 };
 
 enum step_cmd_type {
     STEP_CMD_N_EACH_M,   // Move N steps, at M ms per step.
     STEP_CMD_N_IN_M,     // Move N steps, evenly over an M ms interval.
     STEP_CMD_TO_P_IN_M,  // Move to position P, evenly over an M ms interval.
+    STEP_CMD_N_AT_R,     // Move N steps, ramping up to R steps/sec and down.
 
     STEP_NUM_CMD,
 };
@@ -89,6 +93,7 @@ struct step_motor_info
 {
     uint32_t min_ms_per_step;
     uint32_t steps_per_rev;
+    bool coord;
 };
     
 ////////////////////////////////////////////////////////////////////////////////
@@ -108,6 +113,8 @@ int32_t step_start(enum step_instance_id instance_id);
 int32_t step_queue_cmd(enum step_instance_id instance_id,
                        enum step_cmd_type cmd_type,
                        int32_t param1, int32_t param2);
+int32_t step_queue_coord_cmd(uint32_t instance_mask, const int32_t* positions,
+                             uint32_t ms);
 int32_t step_get_free_queue_slots(enum step_instance_id instance_id);
 int32_t step_set_position(enum step_instance_id instance_id,
                           int32_t step_position);
@@ -116,6 +123,8 @@ int32_t step_get_info(enum step_instance_id instance_id,
                       struct step_motor_info* info);
 int32_t step_set_drive_mode(enum step_instance_id instance_id,
                             enum step_drive_mode drive_mode);
+int32_t step_set_accel(enum step_instance_id instance_id,
+                       uint32_t accel_steps_per_s2);
 
 
 #endif // _STEP_H_
@@ -0,0 +1,76 @@
+#ifndef _TELEM_H_
+#define _TELEM_H_
+
+/*
+ * @brief Interface declaration of telem module.
+ *
+ * See implementation file for information about this module.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stat.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+// Snapshot format version.
+#define TELEM_VERSION 1
+
+// Snapshot header flags.
+#define TELEM_FLAG_DELTA 0x01
+
+// Units of duration statistic values.
+#define TELEM_UNIT_US 0
+#define TELEM_UNIT_NS 1
+
+// Start of frame character for snapshots pushed on a ttys.
+#define TELEM_SOF 0xa5
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+// Core module interface functions.
+int32_t telem_init(void);
+int32_t telem_start(void);
+int32_t telem_run(void);
+
+// Other APIs.
+int32_t telem_register_dur(const char* name, struct stat_dur* stat);
+int32_t telem_register_cyc_dur(const char* name, struct stat_cyc_dur* stat);
+int32_t telem_snapshot(uint8_t* buf, uint32_t buf_size, bool delta);
+
+#endif // _TELEM_H_
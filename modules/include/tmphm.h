@@ -35,18 +35,35 @@
 #include "i2c.h"
 #include "module.h"
 
+// Size of the per-instance sample history. Must be a power of 2.
+#define TMPHM_HIST_SIZE CONFIG_TMPHM_HIST_SIZE
+#define TMPHM_NUM_STAT_WINDOWS CONFIG_TMPHM_NUM_STAT_WINDOWS
+
 enum tmphm_instance_id {
     TMPHM_INSTANCE_1,
+#if CONFIG_TMPHM_2_PRESENT
+    TMPHM_INSTANCE_2,
+#endif
 
     TMPHM_NUM_INSTANCES
 };
 
+enum tmphm_mode {
+    TMPHM_MODE_SINGLE_SHOT, // Measurement command for each sample.
+    TMPHM_MODE_PERIODIC,    // Periodic acquisition, rate from sample_time_ms.
+    TMPHM_MODE_ART,         // Accelerated response time (4 Hz) acquisition.
+};
+
 struct tmphm_cfg
 {
     enum i2c_instance_id i2c_instance_id;
     uint32_t i2c_addr;
     uint32_t sample_time_ms;
-    uint32_t meas_time_ms;
+    uint32_t meas_time_ms; // Single shot mode only.
+    enum tmphm_mode mode;
+
+    // Number of samples in each statistics window (1..TMPHM_HIST_SIZE).
+    uint16_t stat_window_samples[TMPHM_NUM_STAT_WINDOWS];
 };
 
 struct tmphm_meas
@@ -55,6 +72,22 @@ struct tmphm_meas
     uint16_t rh_percent_x10;
 };
 
+// A measurement from the history.
+struct tmphm_sample
+{
+    uint32_t ms;   // Time of measurement (tmr_get_ms()).
+    struct tmphm_meas meas;
+};
+
+// Statistics over a window of the most recent samples.
+struct tmphm_stats
+{
+    struct tmphm_meas min;
+    struct tmphm_meas max;
+    struct tmphm_meas mean;
+    uint32_t num_samples; // Less than the window size until it fills.
+};
+
 // Core module interface functions.
 int32_t tmphm_get_def_cfg(enum tmphm_instance_id instance_id, struct tmphm_cfg* cfg);
 int32_t tmphm_init(enum tmphm_instance_id instance_id, struct tmphm_cfg* cfg);
@@ -64,4 +97,8 @@ int32_t tmphm_run(enum tmphm_instance_id instance_id);
 // Other APIs.
 int32_t tmphm_get_last_meas(enum tmphm_instance_id instance_id,
                             struct tmphm_meas* meas, uint32_t* meas_age_ms);
+int32_t tmphm_get_stats(enum tmphm_instance_id instance_id,
+                        uint32_t window_idx, struct tmphm_stats* stats);
+int32_t tmphm_get_hist(enum tmphm_instance_id instance_id, uint32_t decim,
+                       struct tmphm_sample* samples, uint32_t max_samples);
 #endif // _TMPHM_H_
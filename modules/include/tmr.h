@@ -33,7 +33,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define TMR_NUM_INST 10
+#include "config.h"
+
+#define TMR_NUM_INST CONFIG_TMR_NUM_INST
 
 // Return values from a timer handler indicating whether or not to restart the
 // timer.
@@ -63,6 +65,7 @@ int32_t tmr_run(void);
 // Other module-level APIs:
 uint32_t tmr_get_ms(void);
 uint32_t tmr_get_systick_ctr(void);
+int32_t tmr_idle(void);
 
 // Timer instance-level APIs.
 int32_t tmr_inst_get(uint32_t ms);
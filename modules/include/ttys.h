@@ -64,12 +64,50 @@ enum ttys_instance_id {
     TTYS_NUM_INSTANCES
 };
 
-#define TTYS_RX_BUF_SIZE 80
-#define TTYS_TX_BUF_SIZE 1024
+// Buffer sizes for the default storage of each instance. These can be set per
+// instance in config.h, and must be powers of 2.
+
+#ifndef CONFIG_TTYS_1_TX_BUF_SIZE
+    #define CONFIG_TTYS_1_TX_BUF_SIZE CONFIG_TTYS_DFLT_TX_BUF_SIZE
+#endif
+#ifndef CONFIG_TTYS_1_RX_BUF_SIZE
+    #define CONFIG_TTYS_1_RX_BUF_SIZE CONFIG_TTYS_DFLT_RX_BUF_SIZE
+#endif
+#ifndef CONFIG_TTYS_2_TX_BUF_SIZE
+    #define CONFIG_TTYS_2_TX_BUF_SIZE CONFIG_TTYS_DFLT_TX_BUF_SIZE
+#endif
+#ifndef CONFIG_TTYS_2_RX_BUF_SIZE
+    #define CONFIG_TTYS_2_RX_BUF_SIZE CONFIG_TTYS_DFLT_RX_BUF_SIZE
+#endif
+#ifndef CONFIG_TTYS_3_TX_BUF_SIZE
+    #define CONFIG_TTYS_3_TX_BUF_SIZE CONFIG_TTYS_DFLT_TX_BUF_SIZE
+#endif
+#ifndef CONFIG_TTYS_3_RX_BUF_SIZE
+    #define CONFIG_TTYS_3_RX_BUF_SIZE CONFIG_TTYS_DFLT_RX_BUF_SIZE
+#endif
+#ifndef CONFIG_TTYS_6_TX_BUF_SIZE
+    #define CONFIG_TTYS_6_TX_BUF_SIZE CONFIG_TTYS_DFLT_TX_BUF_SIZE
+#endif
+#ifndef CONFIG_TTYS_6_RX_BUF_SIZE
+    #define CONFIG_TTYS_6_RX_BUF_SIZE CONFIG_TTYS_DFLT_RX_BUF_SIZE
+#endif
 
 struct ttys_cfg {
-    bool create_stream;
+    bool create_stream; // Create a line buffered FILE stream (see ttys.c).
     bool send_cr_after_nl;
+    bool use_dma; // Use DMA for TX and RX (only supported for DMA type 1).
+
+    // Post the RX task when the line goes idle after a burst of characters
+    // (and when the RX buffer reaches half full), rather than for each
+    // character.
+    bool rx_wake_on_idle;
+
+    // Buffer storage. The defaults are static buffers for the instance, sized
+    // by CONFIG_TTYS_<n>_TX_BUF_SIZE etc. Sizes must be powers of 2.
+    char* tx_buf;
+    char* rx_buf;
+    uint16_t tx_buf_size;
+    uint16_t rx_buf_size;
 };
 
 // Core module interface functions.
@@ -79,13 +117,19 @@ int32_t ttys_start(enum ttys_instance_id instance_id);
 
 // Other APIs.
 int32_t ttys_putc(enum ttys_instance_id instance_id, char c);
+int32_t ttys_write(enum ttys_instance_id instance_id, const char* buf,
+                   uint32_t len);
 int32_t ttys_getc(enum ttys_instance_id instance_id, char* c);
 int ttys_get_fd(enum ttys_instance_id instance_id);
 FILE* ttys_get_stream(enum ttys_instance_id instance_id);
 int32_t ttys_tx_idle(enum ttys_instance_id instance_id);
+int32_t ttys_tx_space(enum ttys_instance_id instance_id);
+int32_t ttys_set_rx_task(enum ttys_instance_id instance_id, int32_t task_id);
 
 #if CONFIG_FAULT_PRESENT
 int32_t ttys_putc_panic(enum ttys_instance_id instance_id, char c);
+int32_t ttys_write_panic(enum ttys_instance_id instance_id, const char* buf,
+                         uint32_t len);
 #endif
 
 #endif // _TTYS_H_
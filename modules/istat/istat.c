@@ -0,0 +1,312 @@
+/*
+ * @brief Implementation of istat module.
+ *
+ * This module collects interrupt timing statistics using the DWT cycle
+ * counter, to help find the sources of jitter (e.g. in motion control). For
+ * each instrumented interrupt source it records:
+ * - Execution time, from handler entry to exit. Nested higher priority
+ *   interrupts are included.
+ * - Entry latency, from the interrupt event to handler entry. This is only
+ *   available for sources whose hardware can tell how long ago the event
+ *   occurred, such as SysTick and the step hardware timers.
+ *
+ * If CONFIG_ISTAT_CRIT is set, the CRIT_BEGIN_NEST()/CRIT_END_NEST() macros
+ * also record how long interrupts stay masked by each outermost critical
+ * section, along with the code address where the longest one ended. Waiting
+ * for an interrupt in the idle path (CRIT_IDLE_BEGIN_NEST()) is not recorded.
+ *
+ * Instrumentation is added to a handler using the ISTAT_EXEC_BEGIN(),
+ * ISTAT_EXEC_END() and ISTAT_LATENCY() macros (see istat.h), which compile to
+ * nothing if this module is not present. Each statistic is only updated by
+ * one interrupt source (or, for critical sections, with interrupts masked),
+ * so no locking is needed when recording.
+ *
+ * The following console commands are provided:
+ * > istat status [clear]
+ * See code for details.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+#include "cmd.h"
+#include "console.h"
+#include "log.h"
+#include "module.h"
+#include "stat.h"
+
+#include "istat.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+struct istat_src {
+    struct stat_cyc_dur exec;
+    struct stat_cyc_dur latency;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void print_stat(const char* name, const char* type,
+                       struct stat_cyc_dur* stat);
+static int32_t cmd_istat_status(int32_t argc, const char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static struct istat_src srcs[ISTAT_NUM_IDS];
+
+static const char* src_names[ISTAT_NUM_IDS] = {
+    [ISTAT_ID_SYSTICK] = "systick",
+    [ISTAT_ID_USART1] = "usart1",
+    [ISTAT_ID_USART2] = "usart2",
+    [ISTAT_ID_USART6] = "usart6",
+    [ISTAT_ID_I2C1_EV] = "i2c1_ev",
+    [ISTAT_ID_I2C2_EV] = "i2c2_ev",
+    [ISTAT_ID_I2C3_EV] = "i2c3_ev",
+    [ISTAT_ID_STEP_1] = "step1",
+    [ISTAT_ID_STEP_2] = "step2",
+};
+
+#if CONFIG_ISTAT_CRIT
+static struct stat_cyc_dur crit;
+static uint32_t crit_max_pc;
+#endif
+
+// Recording is disabled while the statistics are being cleared. Since a
+// handler can't be preempted by this module's base level code, it either sees
+// this false and skips recording, or completes its update before clearing
+// continues.
+static volatile bool initialized;
+
+static int32_t log_level = LOG_DEFAULT;
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "status",
+        .func = cmd_istat_status,
+        .help = "Get module status, usage: istat status [clear]",
+    },
+};
+
+static struct cmd_client_info cmd_info = {
+    .name = "istat",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Initialize istat module instance.
+ *
+ * @param[in] cfg The istat configuration. (FUTURE)
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This also enables the DWT cycle counter. Samples are not recorded until
+ * this function has been called. It is also used to clear the statistics.
+ */
+int32_t istat_init(struct istat_cfg* cfg)
+{
+    uint32_t idx;
+
+    initialized = false;
+    for (idx = 0; idx < ISTAT_NUM_IDS; idx++) {
+        stat_cyc_dur_init(&srcs[idx].exec);
+        stat_cyc_dur_init(&srcs[idx].latency);
+    }
+#if CONFIG_ISTAT_CRIT
+    stat_cyc_dur_init(&crit);
+    crit_max_pc = 0;
+#endif
+    initialized = true;
+    return 0;
+}
+
+/*
+ * @brief Start istat module instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function starts the istat singleton module, to enter normal operation.
+ */
+int32_t istat_start(void)
+{
+    int32_t result;
+
+    result = cmd_register(&cmd_info);
+    if (result < 0) {
+        log_error("istat_start: cmd error %d\n", result);
+        return result;
+    }
+    return 0;
+}
+
+/*
+ * @brief Record an interrupt handler execution time.
+ *
+ * @param[in] id The interrupt source.
+ * @param[in] cycles Execution time in cycles.
+ *
+ * Normally called using the ISTAT_EXEC_END() macro.
+ */
+void istat_exec_record(enum istat_id id, uint32_t cycles)
+{
+    if (initialized && id < ISTAT_NUM_IDS)
+        stat_cyc_dur_add(&srcs[id].exec, cycles);
+}
+
+/*
+ * @brief Record an interrupt entry latency.
+ *
+ * @param[in] id The interrupt source.
+ * @param[in] cycles Time from the interrupt event to handler entry in cycles.
+ *
+ * Normally called using the ISTAT_LATENCY() macro.
+ */
+void istat_latency_record(enum istat_id id, uint32_t cycles)
+{
+    if (initialized && id < ISTAT_NUM_IDS)
+        stat_cyc_dur_add(&srcs[id].latency, cycles);
+}
+
+/*
+ * @brief Record a critical section hold time.
+ *
+ * @param[in] cycles Time interrupts were masked in cycles.
+ *
+ * Called by CRIT_END_NEST() (with interrupts still masked) at the end of an
+ * outermost critical section, if CONFIG_ISTAT_CRIT is set. The return address
+ * identifies the function containing the critical section.
+ */
+void istat_crit_record(uint32_t cycles)
+{
+#if CONFIG_ISTAT_CRIT
+    if (!initialized)
+        return;
+    if (cycles > crit.max || crit.samples == 0)
+        crit_max_pc = (uint32_t)__builtin_return_address(0);
+    stat_cyc_dur_add(&crit, cycles);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Print one statistic for "istat status".
+ *
+ * @param[in] name Source name.
+ * @param[in] type Statistic type.
+ * @param[in] stat The statistic to print (a copy taken by the caller).
+ */
+static void print_stat(const char* name, const char* type,
+                       struct stat_cyc_dur* stat)
+{
+    if (stat->samples == 0)
+        return;
+    printc("%-8s %-4s %10lu %9lu %9lu %9lu %9lu\n", name, type, stat->samples,
+           stat_cyc_to_ns(stat->min), stat_cyc_dur_avg_ns(stat),
+           stat_cyc_dur_pctl_ns(stat, 9900), stat_cyc_to_ns(stat->max));
+}
+
+/*
+ * @brief Console command function for "istat status".
+ *
+ * @param[in] argc Number of arguments, including "istat"
+ * @param[in] argv Argument values, including "istat"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: istat status [clear]
+ */
+static int32_t cmd_istat_status(int32_t argc, const char** argv)
+{
+    static struct stat_cyc_dur copy;
+    uint32_t idx;
+    CRIT_STATE_VAR;
+
+    if (argc > 3 || (argc == 3 && strcasecmp(argv[2], "clear") != 0)) {
+        printc("Invalid arguments\n");
+        return MOD_ERR_ARG;
+    }
+
+    // Each statistic is copied with interrupts masked, so that it is
+    // consistent, and then printed.
+    printc("Times in ns, exec=execution lat=entry latency\n\n"
+           "Source   Type    Samples       Min       Avg       P99       Max\n"
+           "-------- ---- ---------- --------- --------- --------- ---------\n");
+    for (idx = 0; idx < ISTAT_NUM_IDS; idx++) {
+        CRIT_BEGIN_NEST();
+        copy = srcs[idx].exec;
+        CRIT_END_NEST();
+        print_stat(src_names[idx], "exec", &copy);
+        CRIT_BEGIN_NEST();
+        copy = srcs[idx].latency;
+        CRIT_END_NEST();
+        print_stat(src_names[idx], "lat", &copy);
+    }
+
+#if CONFIG_ISTAT_CRIT
+    {
+        uint32_t max_pc;
+
+        CRIT_BEGIN_NEST();
+        copy = crit;
+        max_pc = crit_max_pc;
+        CRIT_END_NEST();
+        print_stat("crit", "hold", &copy);
+        if (copy.samples != 0)
+            printc("\nLongest critical section ended at 0x%08lx\n", max_pc);
+    }
+#endif
+
+    if (argc == 3) {
+        printc("Clearing statistics\n");
+        istat_init(NULL);
+    }
+    return 0;
+}
@@ -14,6 +14,29 @@
  * log output. The console module toggles this variable on/off based on a
  * input key (ctrl-L).
  *
+ * Logging can be direct or deferred:
+ * - In direct mode (the original behavior), log_printf() formats and writes
+ *   the output at the call site.
+ * - In deferred mode, log_printf() only scans the format string to find the
+ *   arguments, and puts a record in a ring. The record holds the format string
+ *   pointer, the timestamp, and the raw argument values. String arguments are
+ *   copied (possibly truncated), since they might not outlive the call. The
+ *   records are formatted later by log_run(), at base level, as console
+ *   buffer space allows. If the ring is full, records are dropped (and
+ *   counted).
+ *
+ * Deferred mode is much cheaper at the call site, which matters for logging
+ * from interrupt level (e.g. timer callbacks). Note that the format string
+ * must be a literal (as it is when using the API macros), since only its
+ * pointer is saved. As the records contain the format string address, the
+ * ring could also be dumped (e.g. "mem dump") and decoded on a host using the
+ * image's symbol information.
+ *
+ * The following console commands are provided:
+ * > log status
+ * > log deferred
+ * See code for details.
+ *
  * MIT License
  * 
  * Copyright (c) 2021 Eugene R Schroeder
@@ -38,8 +61,14 @@
  */
 
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "config.h"
+#include CONFIG_STM32_LL_BUS_HDR
+
+#include "cmd.h"
 #include "console.h"
 #include "module.h"
 #include "tmr.h"
@@ -49,18 +78,135 @@
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+#define RING_MASK (CONFIG_LOG_DEFERRED_BUF_SIZE - 1)
+
+#if (CONFIG_LOG_DEFERRED_BUF_SIZE & RING_MASK) != 0
+    #error CONFIG_LOG_DEFERRED_BUF_SIZE must be a power of 2
+#endif
+
+// A record is a length byte, then the format string pointer, the timestamp,
+// and the arguments.
+#define REC_MAX_SIZE 96
+#define REC_HDR_SIZE (1 + sizeof(const char*) + sizeof(uint32_t))
+
+// Longest string argument copied into a record (excluding the terminator).
+#define REC_MAX_STR_LEN 31
+
+// Longest conversion specification handled (e.g. "%-08.3lx").
+#define CONV_SPEC_MAX_LEN 15
+
+// Format records only while the console has this much buffer space.
+#define RUN_MIN_TX_SPACE 128
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+// Argument types, based on conversion specifier and length modifier.
+enum arg_type {
+    ARG_NONE,      // "%%"
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_PTR,
+    ARG_STR,
+    ARG_BAD,       // Unsupported (e.g. "%n"), or too long.
+};
+
+// A parsed conversion specification.
+struct conv_spec {
+    const char* start;   // Points to the '%'.
+    uint32_t len;        // Including the '%' and the conversion specifier.
+    uint32_t num_stars;  // Number of '*' width/precision arguments.
+    enum arg_type type;
+};
+
+union arg_val {
+    int i;
+    long l;
+    long long ll;
+    size_t sz;
+    intmax_t im;
+    ptrdiff_t pd;
+    double d;
+    void* p;
+};
+
+enum log_u16_pms {
+    CNT_DEFERRED,
+    CNT_DROPPED,
+    CNT_TRUNCATED,
+
+    NUM_U16_PMS
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
+static void deferred_put(const char* fmt, uint32_t ms, va_list args);
+static bool deferred_get(uint8_t* rec);
+static void deferred_print(const uint8_t* rec);
+static const char* next_conv(const char* fmt, struct conv_spec* spec);
+static void print_conv(const struct conv_spec* spec, const int* stars,
+                       enum arg_type type, const union arg_val* val);
+static uint32_t arg_size(enum arg_type type);
+
+static int32_t cmd_log_status(int32_t argc, const char** argv);
+static int32_t cmd_log_deferred(int32_t argc, const char** argv);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
 
+static bool deferred = CONFIG_LOG_DFLT_DEFERRED;
+
+// Deferred record ring. Producers (any context) reserve and fill space with
+// interrupts disabled; the consumer (log_run, at base level) is the only
+// writer of ring_get_ctr. The counters are free running byte counts.
+static uint8_t ring[CONFIG_LOG_DEFERRED_BUF_SIZE];
+static volatile uint32_t ring_put_ctr;
+static volatile uint32_t ring_get_ctr;
+
+static uint16_t dropped_unreported;
+
+static int32_t log_level = LOG_DEFAULT;
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "deferred",
+    "dropped",
+    "truncated",
+};
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "status",
+        .func = cmd_log_status,
+        .help = "Get module status, usage: log status",
+    },
+    {
+        .name = "deferred",
+        .func = cmd_log_deferred,
+        .help = "Set deferred mode, usage: log deferred {on|off}",
+    },
+};
+
+static struct cmd_client_info cmd_info = {
+    .name = "log",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,6 +217,60 @@ bool _log_active = true;
 // Public (global) functions
 ////////////////////////////////////////////////////////////////////////////////
 
+/*
+ * @brief Start log module instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function starts the log singleton module, to enter normal operation.
+ * Deferred records can be created before this is called, and are formatted
+ * once log_run() is called.
+ */
+int32_t log_start(void)
+{
+    int32_t result;
+
+    result = cmd_register(&cmd_info);
+    if (result < 0) {
+        log_error("log_start: cmd error %d\n", result);
+        return result;
+    }
+    return 0;
+}
+
+/*
+ * @brief Run log module instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note This function should not block.
+ *
+ * This function is called in the super loop, and formats deferred records
+ * while there is console buffer space for them.
+ */
+int32_t log_run(void)
+{
+    uint8_t rec[REC_MAX_SIZE];
+    uint16_t dropped;
+    CRIT_STATE_VAR;
+
+    while (console_tx_space() >= RUN_MIN_TX_SPACE) {
+        if (deferred_get(rec)) {
+            deferred_print(rec);
+        } else if (dropped_unreported != 0) {
+            // Report drops once the records before them are out.
+            CRIT_BEGIN_NEST();
+            dropped = dropped_unreported;
+            dropped_unreported = 0;
+            CRIT_END_NEST();
+            printc("log: %u deferred records dropped\n", dropped);
+        } else {
+            break;
+        }
+    }
+    return 0;
+}
+
 /*
  * @brief Toggle state of "log active".
  */
@@ -103,12 +303,400 @@ void log_printf(const char* fmt, ...)
     va_list args;
     uint32_t ms = tmr_get_ms();
 
-    printc("%lu.%03lu ", ms / 1000U, ms % 1000U);
     va_start(args, fmt);
-    vprintc(fmt, args);
+    if (deferred) {
+        deferred_put(fmt, ms, args);
+    } else {
+        printc("%lu.%03lu ", ms / 1000U, ms % 1000U);
+        vprintc(fmt, args);
+    }
     va_end(args);
 }
 
+/*
+ * @brief Set deferred logging mode.
+ *
+ * @param[in] deferred_mode True for deferred mode, false for direct mode.
+ *
+ * When switching to direct mode, pending deferred records are flushed first,
+ * to keep the output in order.
+ */
+void log_set_deferred(bool deferred_mode)
+{
+    if (!deferred_mode)
+        log_flush();
+    deferred = deferred_mode;
+}
+
+/*
+ * @brief Format all pending deferred records.
+ *
+ * @note This function blocks until all records are written to the console,
+ *       so should only be used from base level (e.g. before a reset).
+ */
+void log_flush(void)
+{
+    uint8_t rec[REC_MAX_SIZE];
+
+    while (deferred_get(rec))
+        deferred_print(rec);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Encode a log call as a deferred record, and put it in the ring.
+ *
+ * @param[in] fmt Format string
+ * @param[in] ms Timestamp.
+ * @param[in] args The format arguments.
+ *
+ * The record is built on the stack, and then copied to the ring with
+ * interrupts disabled, so this can be called from any context.
+ */
+static void deferred_put(const char* fmt, uint32_t ms, va_list args)
+{
+    uint8_t rec[REC_MAX_SIZE];
+    uint32_t len = REC_HDR_SIZE;
+    struct conv_spec spec;
+    union arg_val val;
+    const char* p = fmt;
+    const char* s;
+    uint32_t idx;
+    uint32_t size;
+    uint32_t put;
+    CRIT_STATE_VAR;
+
+    memcpy(&rec[1], &fmt, sizeof(fmt));
+    memcpy(&rec[1 + sizeof(fmt)], &ms, sizeof(ms));
+
+    while ((p = next_conv(p, &spec)) != NULL) {
+        if (spec.type == ARG_BAD)
+            break;
+        if (len + spec.num_stars * sizeof(int) > REC_MAX_SIZE)
+            goto truncated;
+        for (idx = 0; idx < spec.num_stars; idx++) {
+            val.i = va_arg(args, int);
+            memcpy(&rec[len], &val.i, sizeof(int));
+            len += sizeof(int);
+        }
+        switch (spec.type) {
+            case ARG_INT: val.i = va_arg(args, int); break;
+            case ARG_LONG: val.l = va_arg(args, long); break;
+            case ARG_LLONG: val.ll = va_arg(args, long long); break;
+            case ARG_SIZE: val.sz = va_arg(args, size_t); break;
+            case ARG_INTMAX: val.im = va_arg(args, intmax_t); break;
+            case ARG_PTRDIFF: val.pd = va_arg(args, ptrdiff_t); break;
+            case ARG_DOUBLE: val.d = va_arg(args, double); break;
+            case ARG_PTR: val.p = va_arg(args, void*); break;
+            case ARG_STR:
+                s = va_arg(args, const char*);
+                if (s == NULL)
+                    s = "(null)";
+                size = strnlen(s, REC_MAX_STR_LEN);
+                if (len + size + 1 > REC_MAX_SIZE)
+                    goto truncated;
+                memcpy(&rec[len], s, size);
+                rec[len + size] = '\0';
+                len += size + 1;
+                continue;
+            default:
+                continue;
+        }
+        size = arg_size(spec.type);
+        if (len + size > REC_MAX_SIZE)
+            goto truncated;
+        memcpy(&rec[len], &val, size);
+        len += size;
+    }
+    goto put_rec;
+
+truncated:
+    // The remaining conversions are printed without values.
+    INC_SAT_U16(cnts_u16[CNT_TRUNCATED]);
+
+put_rec:
+    rec[0] = len;
+    CRIT_BEGIN_NEST();
+    put = ring_put_ctr;
+    if (CONFIG_LOG_DEFERRED_BUF_SIZE - (put - ring_get_ctr) < len) {
+        INC_SAT_U16(dropped_unreported);
+        INC_SAT_U16(cnts_u16[CNT_DROPPED]);
+    } else {
+        for (idx = 0; idx < len; idx++)
+            ring[(put + idx) & RING_MASK] = rec[idx];
+        ring_put_ctr = put + len;
+        INC_SAT_U16(cnts_u16[CNT_DEFERRED]);
+    }
+    CRIT_END_NEST();
+}
+
+/*
+ * @brief Get the oldest deferred record from the ring.
+ *
+ * @param[out] rec Buffer for the record (REC_MAX_SIZE bytes).
+ *
+ * @return true if a record was returned, false if the ring is empty.
+ */
+static bool deferred_get(uint8_t* rec)
+{
+    uint32_t get = ring_get_ctr;
+    uint32_t len;
+    uint32_t idx;
+
+    if (get == ring_put_ctr)
+        return false;
+    len = ring[get & RING_MASK];
+    for (idx = 0; idx < len; idx++)
+        rec[idx] = ring[(get + idx) & RING_MASK];
+    ring_get_ctr = get + len;
+    return true;
+}
+
+/*
+ * @brief Format and print a deferred record.
+ *
+ * @param[in] rec The record.
+ *
+ * The format string is processed one conversion specification at a time,
+ * each printed with its own argument(s) from the record. Conversions beyond
+ * the arguments in the record (if it was truncated) are printed as-is.
+ */
+static void deferred_print(const uint8_t* rec)
+{
+    uint32_t len = rec[0];
+    uint32_t offset = REC_HDR_SIZE;
+    const char* fmt;
+    const char* p;
+    const char* lit;
+    uint32_t ms;
+    struct conv_spec spec;
+    union arg_val val;
+    int stars[2];
+    uint32_t idx;
+    uint32_t size;
+
+    memcpy(&fmt, &rec[1], sizeof(fmt));
+    memcpy(&ms, &rec[1 + sizeof(fmt)], sizeof(ms));
+    printc("%lu.%03lu ", ms / 1000U, ms % 1000U);
+
+    for (lit = p = fmt; ; lit = p) {
+        p = next_conv(p, &spec);
+        if (p == NULL || spec.type == ARG_BAD) {
+            printc("%s", lit);
+            break;
+        }
+        if (spec.start > lit)
+            printc("%.*s", (int)(spec.start - lit), lit);
+        if (spec.type == ARG_NONE) {
+            printc("%%");
+            continue;
+        }
+        size = spec.type == ARG_STR ? 1 : arg_size(spec.type);
+        if (offset + spec.num_stars * sizeof(int) + size > len) {
+            printc("%s", spec.start);
+            break;
+        }
+        for (idx = 0; idx < spec.num_stars; idx++) {
+            memcpy(&stars[idx], &rec[offset], sizeof(int));
+            offset += sizeof(int);
+        }
+        if (spec.type == ARG_STR) {
+            val.p = (void*)&rec[offset];
+            offset += strnlen((const char*)&rec[offset], len - offset) + 1;
+        } else {
+            memcpy(&val, &rec[offset], size);
+            offset += size;
+        }
+        print_conv(&spec, stars, spec.type, &val);
+    }
+}
+
+/*
+ * @brief Find and parse the next conversion specification in a format string.
+ *
+ * @param[in] fmt The (remaining) format string.
+ * @param[out] spec The conversion specification.
+ *
+ * @return Pointer to the character after the conversion specification, or
+ *         NULL if there are no more.
+ */
+static const char* next_conv(const char* fmt, struct conv_spec* spec)
+{
+    const char* p = strchr(fmt, '%');
+    uint32_t longs = 0;
+    char mod = '\0';
+
+    if (p == NULL)
+        return NULL;
+    spec->start = p++;
+    spec->num_stars = 0;
+
+    // Flags, width and precision.
+    while (*p != '\0' && strchr("-+ #0123456789.*", *p) != NULL) {
+        if (*p == '*')
+            spec->num_stars++;
+        p++;
+    }
+
+    // Length modifier.
+    while (*p != '\0' && strchr("hlzjtL", *p) != NULL) {
+        if (*p == 'l')
+            longs++;
+        else
+            mod = *p;
+        p++;
+    }
+
+    switch (*p) {
+        case '%':
+            spec->type = ARG_NONE;
+            break;
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+            if (longs >= 2)
+                spec->type = ARG_LLONG;
+            else if (longs == 1)
+                spec->type = ARG_LONG;
+            else if (mod == 'z')
+                spec->type = ARG_SIZE;
+            else if (mod == 'j')
+                spec->type = ARG_INTMAX;
+            else if (mod == 't')
+                spec->type = ARG_PTRDIFF;
+            else
+                spec->type = ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a':
+        case 'A':
+            spec->type = mod == 'L' ? ARG_BAD : ARG_DOUBLE;
+            break;
+        case 'p':
+            spec->type = ARG_PTR;
+            break;
+        case 's':
+            spec->type = ARG_STR;
+            break;
+        default:
+            spec->type = ARG_BAD;
+            return p;
+    }
+    p++;
+    spec->len = p - spec->start;
+    if (spec->len > CONV_SPEC_MAX_LEN || spec->num_stars > 2)
+        spec->type = ARG_BAD;
+    return p;
+}
+
+/*
+ * @brief Print a single conversion, with its argument(s).
+ *
+ * @param[in] spec The conversion specification.
+ * @param[in] stars The '*' width/precision arguments.
+ * @param[in] type The argument type.
+ * @param[in] val The argument value.
+ */
+static void print_conv(const struct conv_spec* spec, const int* stars,
+                       enum arg_type type, const union arg_val* val)
+{
+    char spec_str[CONV_SPEC_MAX_LEN + 1];
+
+    memcpy(spec_str, spec->start, spec->len);
+    spec_str[spec->len] = '\0';
+
+#define PRINT_CONV(v)                                                   \
+    do {                                                                \
+        if (spec->num_stars == 0)                                       \
+            printc(spec_str, v);                                        \
+        else if (spec->num_stars == 1)                                  \
+            printc(spec_str, stars[0], v);                              \
+        else                                                            \
+            printc(spec_str, stars[0], stars[1], v);                    \
+    } while (0)
+
+    switch (type) {
+        case ARG_INT: PRINT_CONV(val->i); break;
+        case ARG_LONG: PRINT_CONV(val->l); break;
+        case ARG_LLONG: PRINT_CONV(val->ll); break;
+        case ARG_SIZE: PRINT_CONV(val->sz); break;
+        case ARG_INTMAX: PRINT_CONV(val->im); break;
+        case ARG_PTRDIFF: PRINT_CONV(val->pd); break;
+        case ARG_DOUBLE: PRINT_CONV(val->d); break;
+        case ARG_PTR: case ARG_STR: PRINT_CONV(val->p); break;
+        default: break;
+    }
+
+#undef PRINT_CONV
+}
+
+/*
+ * @brief Get the size of a (non-string) argument in a record.
+ *
+ * @param[in] type The argument type.
+ *
+ * @return The size in bytes.
+ */
+static uint32_t arg_size(enum arg_type type)
+{
+    switch (type) {
+        case ARG_INT: return sizeof(int);
+        case ARG_LONG: return sizeof(long);
+        case ARG_LLONG: return sizeof(long long);
+        case ARG_SIZE: return sizeof(size_t);
+        case ARG_INTMAX: return sizeof(intmax_t);
+        case ARG_PTRDIFF: return sizeof(ptrdiff_t);
+        case ARG_DOUBLE: return sizeof(double);
+        case ARG_PTR: return sizeof(void*);
+        default: return 0;
+    }
+}
+
+/*
+ * @brief Console command function for "log status".
+ *
+ * @param[in] argc Number of arguments, including "log".
+ * @param[in] argv Argument values, including "log".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: log status
+ */
+static int32_t cmd_log_status(int32_t argc, const char** argv)
+{
+    uint32_t used = ring_put_ctr - ring_get_ctr;
+
+    printc("Active: %s Mode: %s Ring used: %lu/%d bytes\n",
+           _log_active ? "yes" : "no", deferred ? "deferred" : "direct",
+           used, CONFIG_LOG_DEFERRED_BUF_SIZE);
+    return 0;
+}
+
+/*
+ * @brief Console command function for "log deferred".
+ *
+ * @param[in] argc Number of arguments, including "log".
+ * @param[in] argv Argument values, including "log".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: log deferred {on|off}
+ */
+static int32_t cmd_log_deferred(int32_t argc, const char** argv)
+{
+    int32_t num_args;
+    struct cmd_arg_val arg_vals[1];
+
+    num_args = cmd_parse_args(argc-2, argv+2, "s", arg_vals);
+    if (num_args != 1)
+        return MOD_ERR_BAD_CMD;
+    if (strcasecmp(arg_vals[0].val.s, "on") == 0) {
+        log_set_deferred(true);
+    } else if (strcasecmp(arg_vals[0].val.s, "off") == 0) {
+        log_set_deferred(false);
+    } else {
+        printc("Invalid mode '%s'\n", arg_vals[0].val.s);
+        return MOD_ERR_ARG;
+    }
+    return 0;
+}
@@ -5,11 +5,45 @@
  * and are stored in a circular buffer. A python program prints "user friendly"
  * log output.
  *
+ * Logs are recorded by inline code generated by the LWL macro (see lwl.h).
+ * Space in the buffer is reserved by atomically updating the put index, so
+ * interrupts are not disabled while recording. The buffer size is a power of
+ * 2 so indices wrap with a mask.
+ *
+ * There are several buffers ("rings"), selected per source file, so that high
+ * rate logs do not overwrite the history of rarer ones. Each log has a compact
+ * timestamp (delta from the previous log in the ring), so the logs of all rings
+ * can be merged in time order by the python program.
+ *
+ * Streaming: The new bytes of each ring can be continuously sent, in frames,
+ * to a ttys instance while running (see "lwl stream"). Frames are only sent
+ * when the ttys transmit buffer is empty, so streaming never overruns it. The
+ * frame format is:
+ *   Offset Size Contents
+ *   ------ ---- --------
+ *     0      2  Sync bytes LWL_STREAM_SYNC_1, LWL_STREAM_SYNC_2
+ *     2      1  Sequence number (incremented for each frame)
+ *     3      1  Type: ring number, or LWL_STREAM_TYPE_TIME + ring number
+ *     4      1  Payload length (N)
+ *     5      N  Payload
+ *   5+N      1  Checksum (8-bit sum of bytes 2 to 4+N)
+ * A data frame payload is the next bytes of the ring (logs can span frames). A
+ * time frame is sent for each ring when streaming starts; its payload is the
+ * current ms time (4 bytes) and the time of the ring's last log (2 bytes), both
+ * big endian, which gives the base for the time deltas that follow.
+ *
+ * If more than a ring's worth of logs are recorded between runs of this
+ * module, the oldest are overwritten before being sent. This is detected from
+ * the free running put index, the unsent bytes are skipped, and a resync frame
+ * (type LWL_STREAM_TYPE_RESYNC + ring number, with the same payload as a time
+ * frame) is sent so the host discards partial data and restarts its time base.
+ *
  * The following console commands are provided:
  * > lwl status
  * > lwl test
  * > lwl on
  * > lwl dump
+ * > lwl stream
  * See code for details.
  *
  * MIT License
@@ -35,62 +69,85 @@
  * SOFTWARE.
  */
 
-#include <stdarg.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "bench.h"
 #include "cmd.h"
 #include "console.h"
 #include "log.h"
 #include "lwl.h"
 #include "module.h"
+#include "ttys.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
 #define LWL_BASE_ID 1
-#define LWL_NUM 4
+#define LWL_NUM 5
 
-#ifdef CONFIG_LWL_BUF_SIZE
-    #define LWL_BUF_SIZE (CONFIG_LWL_BUF_SIZE)
-#else
-    #define LWL_BUF_SIZE 1008
-#endif
+#define LWL_STREAM_SYNC_1 0xa5
+#define LWL_STREAM_SYNC_2 0x5a
+#define LWL_STREAM_TYPE_TIME 0x80
+#define LWL_STREAM_TYPE_RESYNC 0x40
+#define LWL_STREAM_HDR_BYTES 5
+#define LWL_STREAM_MAX_PAYLOAD 128
+#define LWL_STREAM_MAX_FRAME (LWL_STREAM_HDR_BYTES + LWL_STREAM_MAX_PAYLOAD + 1)
 
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
-// For writing to flash, this structure needs to be a multiple of 8 bytes.
-struct lwl_data
-{
-    uint32_t magic;
-    uint32_t num_section_bytes;
-    uint32_t buf_size;
-    uint32_t put_idx;
-    uint8_t buf[LWL_BUF_SIZE];
-};
-
 _Static_assert((sizeof(struct lwl_data) % CONFIG_FLASH_WRITE_BYTES) == 0,
                "struct lwl_data not a multiple of flash write size");
+// Streaming state.
+struct lwl_stream_info {
+    bool on;
+    enum ttys_instance_id ttys_inst;
+    uint8_t seq;
+    uint32_t get_idx[LWL_NUM_RINGS];
+    bool send_time[LWL_NUM_RINGS];
+    uint32_t start_ms;
+    uint16_t start_last_ms[LWL_NUM_RINGS];
+    uint32_t frame_ctr;
+    uint32_t byte_ctr;
+    uint32_t write_fail_ctr;
+    uint32_t overrun_ctr;
+};
+
+// Map of UART number to ttys instance.
+struct lwl_ttys_map {
+    uint8_t uart_num;
+    enum ttys_instance_id ttys_inst;
+};
+
+_Static_assert(sizeof(struct lwl_data) ==
+               2 * sizeof(struct lwl_ring_hdr) + LWL_BUF_SIZE +
+               LWL_HI_RATE_BUF_SIZE, "struct lwl_data has padding");
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
 static void prepare_data_for_output(void);
+#if CONFIG_BENCH_PRESENT
+static int32_t bench_lwl_rec(uint32_t num_ops);
+#endif
 static int32_t cmd_lwl_status(int32_t argc, const char** argv);
 static int32_t cmd_lwl_test(int32_t argc, const char** argv);
 static int32_t cmd_lwl_enable(int32_t argc, const char** argv);
 static int32_t cmd_lwl_dump(int32_t argc, const char** argv);
+static int32_t cmd_lwl_stream(int32_t argc, const char** argv);
+static void get_ring(uint32_t ring, struct lwl_ring_hdr** hdr, uint8_t** buf,
+                     uint32_t* buf_size);
+static bool stream_frame(uint8_t type, const uint8_t* buf, uint32_t buf_size,
+                         uint32_t start_idx, uint32_t len);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
 
-static struct lwl_data lwl_data;
-
 static int32_t log_level = LOG_DEFAULT;
 
 // Data structure with console command info.
@@ -115,6 +172,25 @@ static struct cmd_cmd_info cmds[] = {
         .func = cmd_lwl_dump,
         .help = "Dump buffer",
     },
+    {
+        .name = "stream",
+        .func = cmd_lwl_stream,
+        .help = "Stream to UART, usage: lwl stream [off|<uart-num>]",
+    },
+};
+
+static struct lwl_stream_info stream;
+
+static const struct lwl_ttys_map ttys_map[] = {
+#if CONFIG_TTYS_1_PRESENT
+    { 1, TTYS_INSTANCE_1 },
+#endif
+#if CONFIG_TTYS_2_PRESENT
+    { 2, TTYS_INSTANCE_2 },
+#endif
+#if CONFIG_TTYS_6_PRESENT
+    { 6, TTYS_INSTANCE_6 },
+#endif
 };
 
 // Data structure passed to cmd module for console interaction.
@@ -125,6 +201,23 @@ static struct cmd_client_info cmd_info = {
     .log_level_ptr = &log_level,
 };
 
+#if CONFIG_BENCH_PRESENT
+// Data structure passed to bench module.
+static const struct bench_info benches[] = {
+    {
+        .name = "lwl_rec",
+        .func = bench_lwl_rec,
+        .dflt_num_ops = 10000,
+    },
+};
+
+static const struct bench_client_info bench_info = {
+    .name = "lwl",
+    .num_benches = ARRAY_SIZE(benches),
+    .benches = benches,
+};
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -132,6 +225,8 @@ static struct cmd_client_info cmd_info = {
 bool _lwl_active = false;
 uint32_t lwl_off_cnt = 0;
 
+struct lwl_data _lwl_data;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -150,41 +245,104 @@ int32_t lwl_start(void)
         log_error("lwl_start: cmd error %d\n", rc);
         return rc;
     }
+#if CONFIG_BENCH_PRESENT
+    rc = bench_register(&bench_info);
+    if (rc < 0) {
+        log_error("lwl_start: bench error %d\n", rc);
+        return rc;
+    }
+#endif
     return 0;
 }
 
 /*
- * @brief Record a lightweight log.
+ * @brief Run lwl instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note This function should not block.
  *
- * @param[in] id The log ID.
- * @param[in] num_arg_bytes The number of argument bytes (0 if no arguments).
+ * This function runs the lwl singleton module, during normal operation. If
+ * streaming is on, and the ttys transmit buffer is empty, it sends frames with
+ * the new bytes of each ring, up to the transmit buffer size.
  */
-void lwl_rec(uint8_t id, int32_t num_arg_bytes, ...)
+int32_t lwl_run(void)
 {
-    CRIT_STATE_VAR;
-    va_list ap;
-    uint32_t put_idx;
+    uint32_t budget;
+    uint32_t ring;
+
+    if (!stream.on || ttys_tx_idle(stream.ttys_inst) != 1)
+        return 0;
+    budget = ttys_tx_space(stream.ttys_inst);
+
+    for (ring = 0; ring < LWL_NUM_RINGS; ring++) {
+        struct lwl_ring_hdr* hdr;
+        uint8_t* buf;
+        uint32_t buf_size;
+        uint32_t put_word;
+        uint32_t put_idx;
+        uint32_t len;
+        uint8_t type;
+
+        get_ring(ring, &hdr, &buf, &buf_size);
+        put_word = hdr->put_idx;
+        put_idx = put_word & 0xffff;
+
+        // If the producer has lapped us, the unsent bytes have been (partly)
+        // overwritten. Skip to the put index and resync the host.
+        if (!stream.send_time[ring] &&
+            ((put_idx - stream.get_idx[ring]) & 0xffff) > buf_size) {
+            stream.overrun_ctr++;
+            stream.get_idx[ring] = put_idx;
+            stream.start_ms = tmr_get_ms();
+            stream.start_last_ms[ring] = put_word >> 16;
+            stream.send_time[ring] = true;
+            type = LWL_STREAM_TYPE_RESYNC + ring;
+        } else {
+            type = LWL_STREAM_TYPE_TIME + ring;
+        }
+
+        if (stream.send_time[ring]) {
+            uint8_t time_buf[6] = {
+                LWL_4(stream.start_ms),
+                LWL_2(stream.start_last_ms[ring]),
+            };
+            if (!stream_frame(type, time_buf, sizeof(time_buf), 0,
+                              sizeof(time_buf)))
+                return 0;
+            stream.send_time[ring] = false;
+            budget -= LWL_STREAM_HDR_BYTES + sizeof(time_buf) + 1;
+        }
+
+        while (put_idx != stream.get_idx[ring] &&
+               budget > LWL_STREAM_HDR_BYTES + 1) {
+            len = (put_idx - stream.get_idx[ring]) & 0xffff;
+            if (len > LWL_STREAM_MAX_PAYLOAD)
+                len = LWL_STREAM_MAX_PAYLOAD;
+            if (len > budget - LWL_STREAM_HDR_BYTES - 1)
+                len = budget - LWL_STREAM_HDR_BYTES - 1;
+            if (!stream_frame(ring, buf, buf_size, stream.get_idx[ring], len))
+                return 0;
+            stream.get_idx[ring] = (stream.get_idx[ring] + len) & 0xffff;
+            budget -= LWL_STREAM_HDR_BYTES + len + 1;
+        }
+    }
+    return 0;
+}
 
-    va_start(ap, num_arg_bytes);
+/*
+ * @brief Count down the number of logs until recording is turned off.
+ *
+ * This is called by the LWL recording code only if lwl_off_cnt is non-zero
+ * (e.g. it was set using a debugger), so it is not on the normal path.
+ */
+void _lwl_off_cnt_dec(void)
+{
+    CRIT_STATE_VAR;
 
     CRIT_BEGIN_NEST();
     if (lwl_off_cnt != 0 && --lwl_off_cnt == 0)
         _lwl_active = false;
-    put_idx = lwl_data.put_idx % LWL_BUF_SIZE;
-    lwl_data.put_idx = (put_idx + 1 + num_arg_bytes) % LWL_BUF_SIZE;
-
-    // We could end the critical section here, since the put index has been
-    // updated. But there is a chance that a fault occurs before all of the
-    // argument bytes have been written, such that the buffer would contain
-    // invalid data.
-    //
-    // For now we play it safe.
-
-    lwl_data.buf[put_idx] = id;
-    while (num_arg_bytes-- > 0) {
-        put_idx = (put_idx + 1) % LWL_BUF_SIZE;
-        lwl_data.buf[put_idx] = (uint8_t)va_arg(ap, unsigned);
-    }
     CRIT_END_NEST();
 }
 
@@ -208,24 +366,118 @@ void lwl_enable(bool on)
 uint8_t* lwl_get_buffer(uint32_t* len)
 {
     prepare_data_for_output();
-    *len = sizeof(lwl_data);
-    return (uint8_t*)&lwl_data;
+    *len = sizeof(_lwl_data);
+    return (uint8_t*)&_lwl_data;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
 
+/*
+ * @brief Get the header and buffer of a ring.
+ *
+ * @param[in] ring Ring number.
+ * @param[out] hdr Ring header.
+ * @param[out] buf Ring buffer.
+ * @param[out] buf_size Ring buffer size.
+ */
+static void get_ring(uint32_t ring, struct lwl_ring_hdr** hdr, uint8_t** buf,
+                     uint32_t* buf_size)
+{
+    if (ring == LWL_RING_HI_RATE) {
+        *hdr = &_lwl_data.hi_rate_hdr;
+        *buf = _lwl_data.hi_rate_buf;
+        *buf_size = LWL_HI_RATE_BUF_SIZE;
+    } else {
+        *hdr = &_lwl_data.main_hdr;
+        *buf = _lwl_data.main_buf;
+        *buf_size = LWL_BUF_SIZE;
+    }
+}
+
+/*
+ * @brief Build a stream frame and write it to the ttys.
+ *
+ * @param[in] type Frame type.
+ * @param[in] buf Circular buffer containing payload.
+ * @param[in] buf_size Size of buf (a power of 2).
+ * @param[in] start_idx Index of first payload byte in buf.
+ * @param[in] len Number of payload bytes.
+ *
+ * @return true if the frame was written, false otherwise.
+ */
+static bool stream_frame(uint8_t type, const uint8_t* buf, uint32_t buf_size,
+                         uint32_t start_idx, uint32_t len)
+{
+    uint8_t frame[LWL_STREAM_MAX_FRAME];
+    uint8_t sum = 0;
+    uint32_t idx;
+
+    frame[0] = LWL_STREAM_SYNC_1;
+    frame[1] = LWL_STREAM_SYNC_2;
+    frame[2] = stream.seq;
+    frame[3] = type;
+    frame[4] = len;
+    for (idx = 0; idx < len; idx++)
+        frame[LWL_STREAM_HDR_BYTES + idx] =
+            buf[(start_idx + idx) & (buf_size - 1)];
+    for (idx = 2; idx < LWL_STREAM_HDR_BYTES + len; idx++)
+        sum += frame[idx];
+    frame[LWL_STREAM_HDR_BYTES + len] = sum;
+
+    len += LWL_STREAM_HDR_BYTES + 1;
+    if (ttys_write(stream.ttys_inst, (const char*)frame, len) != (int32_t)len) {
+        stream.write_fail_ctr++;
+        return false;
+    }
+    stream.seq++;
+    stream.frame_ctr++;
+    stream.byte_ctr += len;
+    return true;
+}
+
 /*
  * @brief Prepare data to be output.
  */
 static void prepare_data_for_output(void)
 {
-    lwl_data.magic = MOD_MAGIC_LWL;
-    lwl_data.num_section_bytes = sizeof(lwl_data);
-    lwl_data.buf_size = LWL_BUF_SIZE;
+    _lwl_data.main_hdr.magic = MOD_MAGIC_LWL_TS;
+    _lwl_data.main_hdr.num_section_bytes =
+        sizeof(_lwl_data.main_hdr) + sizeof(_lwl_data.main_buf);
+    _lwl_data.main_hdr.buf_size = LWL_BUF_SIZE;
+
+    _lwl_data.hi_rate_hdr.magic = MOD_MAGIC_LWL_TS;
+    _lwl_data.hi_rate_hdr.num_section_bytes =
+        sizeof(_lwl_data.hi_rate_hdr) + sizeof(_lwl_data.hi_rate_buf);
+    _lwl_data.hi_rate_hdr.buf_size = LWL_HI_RATE_BUF_SIZE;
 }
 
+#if CONFIG_BENCH_PRESENT
+
+/*
+ * @brief Benchmark for recording a lightweight log with a 4 byte argument.
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note The logs overwrite older ones in the ring.
+ */
+static int32_t bench_lwl_rec(uint32_t num_ops)
+{
+    uint32_t idx;
+
+    if (!_lwl_active)
+        return MOD_ERR_STATE;
+
+    for (idx = 0; idx < num_ops; idx++)
+        LWL("bench %d", 4, LWL_4(idx));
+    return 0;
+}
+
+#endif
+
 /*
  * @brief Console command function for "lwl status".
  *
@@ -238,7 +490,16 @@ static void prepare_data_for_output(void)
  */
 static int32_t cmd_lwl_status(int32_t argc, const char** argv)
 {
-    printc("on=%d put_idx=%lu\n", _lwl_active, lwl_data.put_idx);
+    printc("on=%d\n", _lwl_active);
+    printc("main: put_idx=%lu last_ms=%lu\n",
+           _lwl_data.main_hdr.put_idx & (LWL_BUF_SIZE - 1),
+           _lwl_data.main_hdr.put_idx >> 16);
+    printc("hi_rate: put_idx=%lu last_ms=%lu\n",
+           _lwl_data.hi_rate_hdr.put_idx & (LWL_HI_RATE_BUF_SIZE - 1),
+           _lwl_data.hi_rate_hdr.put_idx >> 16);
+    printc("stream: on=%d frames=%lu bytes=%lu write_fail=%lu overrun=%lu\n",
+           stream.on, stream.frame_ctr, stream.byte_ctr, stream.write_fail_ctr,
+           stream.overrun_ctr);
     return 0;
 }
 
@@ -304,6 +565,71 @@ static int32_t cmd_lwl_enable(int32_t argc, const char** argv)
 static int32_t cmd_lwl_dump(int32_t argc, const char** argv)
 {
     prepare_data_for_output();
-    console_data_print((uint8_t*)&lwl_data, sizeof(lwl_data));
+    console_data_print((uint8_t*)&_lwl_data, sizeof(_lwl_data));
+    return 0;
+}
+
+/*
+ * @brief Console command function for "lwl stream".
+ *
+ * @param[in] argc Number of arguments, including "lwl"
+ * @param[in] argv Argument values, including "lwl"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: lwl stream [off|<uart-num>]
+ *
+ * Streaming starts with the next log recorded. If the UART is the one used by
+ * the console, the frames are mixed with console output.
+ */
+static int32_t cmd_lwl_stream(int32_t argc, const char** argv)
+{
+    struct cmd_arg_val arg_vals[1];
+    uint32_t idx;
+    uint32_t ring;
+    CRIT_STATE_VAR;
+
+    if (argc == 2) {
+        printc("Streaming is %s\n", stream.on ? "on" : "off");
+        return 0;
+    }
+    if (argc != 3) {
+        printc("Invalid arguments\n");
+        return MOD_ERR_ARG;
+    }
+    if (strcasecmp(argv[2], "off") == 0) {
+        stream.on = false;
+        return 0;
+    }
+
+    if (cmd_parse_args(argc-2, argv+2, "u", arg_vals) != 1)
+        return MOD_ERR_BAD_CMD;
+    for (idx = 0; idx < ARRAY_SIZE(ttys_map); idx++) {
+        if (ttys_map[idx].uart_num == arg_vals[0].val.u)
+            break;
+    }
+    if (idx >= ARRAY_SIZE(ttys_map)) {
+        printc("UART %lu not available\n", arg_vals[0].val.u);
+        return MOD_ERR_ARG;
+    }
+
+    stream.on = false;
+    stream.ttys_inst = ttys_map[idx].ttys_inst;
+    CRIT_BEGIN_NEST();
+    stream.start_ms = tmr_get_ms();
+    for (ring = 0; ring < LWL_NUM_RINGS; ring++) {
+        struct lwl_ring_hdr* hdr;
+        uint8_t* buf;
+        uint32_t buf_size;
+        uint32_t put_word;
+
+        get_ring(ring, &hdr, &buf, &buf_size);
+        put_word = hdr->put_idx;
+        stream.get_idx[ring] = put_word & 0xffff;
+        stream.start_last_ms[ring] = put_word >> 16;
+        stream.send_time[ring] = true;
+    }
+    CRIT_END_NEST();
+    stream.on = true;
     return 0;
 }
@@ -4,9 +4,38 @@
  * This module simply provides console commands to read and write memory, for
  * debugging.
  *
+ * Large reads and CRC calculations are done over time in mem_run(), so they
+ * do not block the super loop. Read output is formatted with a lookup table,
+ * and as many lines are written on each pass as fit in the console transmit
+ * buffer. For binary console commands (see console module), reads are sent as
+ * raw data frames instead of hex text.
+ *
+ * Watch: A set of addresses (each with a data unit size of 1, 2 or 4) can be
+ * sampled at a fixed rate by a timer callback at interrupt level, as a
+ * lightweight data recorder. Each sample is a record, stored in a circular
+ * buffer, containing a 16-bit sample number followed by the values in the order
+ * the addresses were added. Records are streamed to a ttys instance in frames,
+ * as space in its transmit buffer allows. The frame format is the same as for
+ * lwl streaming:
+ *   Offset Size Contents
+ *   ------ ---- --------
+ *     0      2  Sync bytes MEM_WATCH_SYNC_1, MEM_WATCH_SYNC_2
+ *     2      1  Sequence number (incremented for each frame)
+ *     3      1  Type: MEM_WATCH_TYPE_DATA or MEM_WATCH_TYPE_LAYOUT
+ *     4      1  Payload length (N)
+ *     5      N  Payload
+ *   5+N      1  Checksum (8-bit sum of bytes 2 to 4+N)
+ * A layout frame is sent when a watch starts. Its payload is the sample period
+ * in ms (2 bytes), then the address (4 bytes) and data unit size (1 byte) of
+ * each watched address. A data frame payload is a whole number of records. All
+ * multi-byte values are big endian. If the buffer fills, records are dropped,
+ * which the host sees as a gap in sample numbers.
+ *
  * The following console commands are provided:
  * > mem r
  * > mem w
+ * > mem crc
+ * > mem watch
  * See code for details.
  *
  * MIT License
@@ -39,23 +68,86 @@
 
 #include "cmd.h"
 #include "console.h"
+#include "crc.h"
 #include "log.h"
 #include "module.h"
+#include "tmr.h"
+#include "ttys.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+// Read line: "aaaaaaaa:" + 16 x " hh" (or 8 x " hhhh", 4 x " hhhhhhhh") + "\n"
+#define READ_LINE_SIZE (9 + 16 * 3 + 1)
+
+#define MEM_WATCH_SYNC_1 0xa5
+#define MEM_WATCH_SYNC_2 0x6b
+#define MEM_WATCH_TYPE_DATA 0x00
+#define MEM_WATCH_TYPE_LAYOUT 0x80
+#define MEM_WATCH_HDR_BYTES 5
+#define MEM_WATCH_MAX_PAYLOAD 128
+#define MEM_WATCH_MAX_FRAME (MEM_WATCH_HDR_BYTES + MEM_WATCH_MAX_PAYLOAD + 1)
+#define MEM_WATCH_MAX_REC_SIZE (2 + 4 * CONFIG_MEM_WATCH_MAX_ADDRS)
+
+#if 2 + 5 * CONFIG_MEM_WATCH_MAX_ADDRS > MEM_WATCH_MAX_PAYLOAD
+    #error CONFIG_MEM_WATCH_MAX_ADDRS too large
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+struct mem_watch_addr {
+    uint8_t* addr;
+    uint8_t unit_size;
+};
+
+// Watch state. The timer callback is the only writer of put_ctr and
+// overrun_ctr, and mem_run() the only writer of get_ctr, so no critical
+// sections are needed. The counters are free running, in records.
+struct mem_watch_info {
+    struct mem_watch_addr addrs[CONFIG_MEM_WATCH_MAX_ADDRS];
+    uint32_t num_addrs;
+    uint32_t rec_size;
+    uint32_t num_recs;          // Record capacity of buf.
+    volatile uint32_t put_ctr;
+    volatile uint32_t get_ctr;
+    volatile uint32_t overrun_ctr;
+    uint16_t sample_num;
+    uint16_t period_ms;
+    bool on;
+    bool send_layout;
+    int32_t tmr_id;
+    enum ttys_instance_id ttys_inst;
+    uint8_t seq;
+    uint32_t frame_ctr;
+    uint32_t write_fail_ctr;
+    uint8_t buf[CONFIG_MEM_WATCH_BUF_SIZE];
+};
+
+// Map of UART number to ttys instance.
+struct mem_ttys_map {
+    uint8_t uart_num;
+    enum ttys_instance_id ttys_inst;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
 static int32_t cmd_mem_read(int32_t argc, const char** argv);
 static int32_t cmd_mem_write(int32_t argc, const char** argv);
+static int32_t cmd_mem_crc(int32_t argc, const char** argv);
+static int32_t cmd_mem_watch(int32_t argc, const char** argv);
+
+static void read_run(void);
+static void crc_run(uint32_t max_bytes);
+static uint32_t hex_format(char* buf, uint32_t val, uint32_t num_digits);
+static enum tmr_cb_action watch_tmr_cb(int32_t tmr_id, uint32_t user_data);
+static void watch_run(void);
+static bool watch_frame(uint8_t type, const uint8_t* payload, uint32_t len);
+static void watch_stop(void);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -72,6 +164,16 @@ static struct cmd_cmd_info cmds[] = {
         .func = cmd_mem_write,
         .help = "Write memory, usage: mem w addr <data-unit-size> value ...",
     },
+    {
+        .name = "crc",
+        .func = cmd_mem_crc,
+        .help = "Calculate CRC-32 of memory, usage: mem crc addr num-bytes",
+    },
+    {
+        .name = "watch",
+        .func = cmd_mem_watch,
+        .help = "Sample memory, usage: mem watch [<op> [<arg> ...]] (enter no op for help)",
+    },
 };
 
 static int32_t log_level = LOG_DEFAULT;
@@ -85,10 +187,34 @@ static struct cmd_client_info cmd_info = {
 
 // Storage to allow reads to be output over time.
 static uint16_t read_cmd_unit_size;
-static uint16_t read_cmd_count;
+static uint32_t read_cmd_count;
 static uint16_t read_cmd_items_per_line;
 static uint8_t* read_cmd_data_ptr;
 
+// Storage to allow CRCs to be calculated over time.
+static uint32_t crc_cmd_bytes_left;
+static uint32_t crc_cmd_num_bytes;
+static uint32_t crc_cmd_val;
+static uint32_t crc_cmd_start_ms;
+static uint8_t* crc_cmd_start_ptr;
+static uint8_t* crc_cmd_data_ptr;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static struct mem_watch_info watch;
+
+static const struct mem_ttys_map ttys_map[] = {
+#if CONFIG_TTYS_1_PRESENT
+    { 1, TTYS_INSTANCE_1 },
+#endif
+#if CONFIG_TTYS_2_PRESENT
+    { 2, TTYS_INSTANCE_2 },
+#endif
+#if CONFIG_TTYS_6_PRESENT
+    { 6, TTYS_INSTANCE_6 },
+#endif
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -117,35 +243,21 @@ int32_t mem_start(void)
     return 0;
 }
 
+/*
+ * @brief Run mem instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note This function should not block.
+ */
 int32_t mem_run(void)
 {
-    if (read_cmd_count > 0 && console_tx_idle() == 1) {
-        int32_t line_item_ctr = 0;
-
-        // We always print exactly one line.
-        printc("%08x:", (unsigned)read_cmd_data_ptr);
-
-        while (read_cmd_count > 0) {
-            read_cmd_count--;
-            switch (read_cmd_unit_size) {
-                case 1:
-                    printc(" %02x", *((uint8_t*)read_cmd_data_ptr));
-                    break;
-                case 2:
-                    printc(" %04x", *((uint16_t*)read_cmd_data_ptr));
-                    break;
-                case 4:
-                    printc(" %08lx", *((uint32_t*)read_cmd_data_ptr));
-                    break;
-            }
-            read_cmd_data_ptr += read_cmd_unit_size;
-            if (++line_item_ctr == read_cmd_items_per_line)
-                break;
-        }
-        printc("\n");
-        if (read_cmd_count == 0)
-            console_emit_prompt();
-    }
+    if (read_cmd_count > 0)
+        read_run();
+    if (crc_cmd_bytes_left > 0)
+        crc_run(CONFIG_MEM_CRC_BYTES_PER_RUN);
+    if (watch.on)
+        watch_run();
     return 0;
 }
 
@@ -168,7 +280,7 @@ static int32_t cmd_mem_read(int32_t argc, const char** argv)
     int32_t num_args;
     struct cmd_arg_val arg_vals[3];
 
-    if (read_cmd_count != 0)
+    if (read_cmd_count != 0 || crc_cmd_bytes_left != 0)
         return MOD_ERR_BUSY;
 
     read_cmd_count = 1;
@@ -201,11 +313,18 @@ static int32_t cmd_mem_read(int32_t argc, const char** argv)
             read_cmd_count = 0;
             return MOD_ERR_ARG;
     }
+
+    // For a binary command, the console sends the raw memory contents.
+    if (console_bin_active()) {
+        uint32_t num_bytes = read_cmd_count * read_cmd_unit_size;
+
+        read_cmd_count = 0;
+        return console_data_print(arg_vals[0].val.p8, num_bytes);
+    }
     read_cmd_data_ptr = arg_vals[0].val.p8;
     return 0;
 }
 
-
 /*
  * @brief Console command function for "mem w".
  *
@@ -248,3 +367,378 @@ static int32_t cmd_mem_write(int32_t argc, const char** argv)
     }
     return 0;
 }
+
+/*
+ * @brief Console command function for "mem crc".
+ *
+ * @param[in] argc Number of arguments, including "mem"
+ * @param[in] argv Argument values, including "mem"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: mem crc addr num-bytes
+ *
+ * The CRC is CRC-32 (IEEE 802.3), as used by zlib, so a host can compare it
+ * with e.g. the crc32 of an image file, instead of reading the memory.
+ */
+static int32_t cmd_mem_crc(int32_t argc, const char** argv)
+{
+    int32_t num_args;
+    struct cmd_arg_val arg_vals[2];
+
+    if (read_cmd_count != 0 || crc_cmd_bytes_left != 0)
+        return MOD_ERR_BUSY;
+
+    num_args = cmd_parse_args(argc-2, argv+2, "pu", arg_vals);
+    if (num_args != 2)
+        return num_args < 0 ? num_args : MOD_ERR_BAD_CMD;
+
+    crc_cmd_start_ptr = arg_vals[0].val.p8;
+    crc_cmd_data_ptr = crc_cmd_start_ptr;
+    crc_cmd_num_bytes = arg_vals[1].val.u;
+    crc_cmd_bytes_left = crc_cmd_num_bytes;
+    crc_cmd_val = CRC32_INIT;
+    crc_cmd_start_ms = tmr_get_ms();
+
+    // A binary command reply cannot be deferred, so the CRC is calculated
+    // right away. Otherwise it is done over time, in mem_run().
+    if (console_bin_active() || crc_cmd_num_bytes == 0)
+        crc_run(crc_cmd_num_bytes);
+    return 0;
+}
+
+/*
+ * @brief Console command function for "mem watch".
+ *
+ * @param[in] argc Number of arguments, including "mem"
+ * @param[in] argv Argument values, including "mem"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: mem watch [<op> [<arg> ...]]
+ */
+static int32_t cmd_mem_watch(int32_t argc, const char** argv)
+{
+    struct cmd_arg_val arg_vals[2];
+    const char* op;
+    uint32_t idx;
+
+    if (argc < 3) {
+        printc("Ops:\n"
+               "  status\n"
+               "  add addr data-unit-size\n"
+               "  clear\n"
+               "  start period-ms uart-num\n"
+               "  stop\n");
+        return 0;
+    }
+    op = argv[2];
+
+    if (strcasecmp(op, "status") == 0) {
+        printc("Watch is %s period=%u ms records=%lu/%lu overruns=%lu "
+               "frames=%lu write-fails=%lu\n",
+               watch.on ? "on" : "off", watch.period_ms,
+               watch.put_ctr - watch.get_ctr, watch.num_recs,
+               watch.overrun_ctr, watch.frame_ctr, watch.write_fail_ctr);
+        for (idx = 0; idx < watch.num_addrs; idx++)
+            printc("  %lu: addr=0x%08lx size=%u\n", idx,
+                   (uint32_t)watch.addrs[idx].addr, watch.addrs[idx].unit_size);
+    } else if (strcasecmp(op, "add") == 0) {
+        if (watch.on)
+            return MOD_ERR_BUSY;
+        if (cmd_parse_args(argc-3, argv+3, "pu", arg_vals) != 2)
+            return MOD_ERR_BAD_CMD;
+        if (arg_vals[1].val.u != 1 && arg_vals[1].val.u != 2 &&
+            arg_vals[1].val.u != 4) {
+            printc("Invalid data unit size %lu\n", arg_vals[1].val.u);
+            return MOD_ERR_ARG;
+        }
+        if (watch.num_addrs >= CONFIG_MEM_WATCH_MAX_ADDRS) {
+            printc("Too many addresses\n");
+            return MOD_ERR_RESOURCE;
+        }
+        watch.addrs[watch.num_addrs].addr = arg_vals[0].val.p8;
+        watch.addrs[watch.num_addrs].unit_size = arg_vals[1].val.u;
+        watch.num_addrs++;
+    } else if (strcasecmp(op, "clear") == 0) {
+        if (watch.on)
+            return MOD_ERR_BUSY;
+        watch.num_addrs = 0;
+    } else if (strcasecmp(op, "start") == 0) {
+        if (watch.on)
+            return MOD_ERR_BUSY;
+        if (watch.num_addrs == 0) {
+            printc("No addresses\n");
+            return MOD_ERR_STATE;
+        }
+        if (cmd_parse_args(argc-3, argv+3, "uu", arg_vals) != 2)
+            return MOD_ERR_BAD_CMD;
+        if (arg_vals[0].val.u == 0 || arg_vals[0].val.u > UINT16_MAX)
+            return MOD_ERR_ARG;
+        for (idx = 0; idx < ARRAY_SIZE(ttys_map); idx++) {
+            if (ttys_map[idx].uart_num == arg_vals[1].val.u)
+                break;
+        }
+        if (idx >= ARRAY_SIZE(ttys_map)) {
+            printc("UART %lu not available\n", arg_vals[1].val.u);
+            return MOD_ERR_ARG;
+        }
+        watch.ttys_inst = ttys_map[idx].ttys_inst;
+        watch.period_ms = arg_vals[0].val.u;
+        watch.rec_size = 2;
+        for (idx = 0; idx < watch.num_addrs; idx++)
+            watch.rec_size += watch.addrs[idx].unit_size;
+        watch.num_recs = CONFIG_MEM_WATCH_BUF_SIZE / watch.rec_size;
+        watch.put_ctr = 0;
+        watch.get_ctr = 0;
+        watch.overrun_ctr = 0;
+        watch.sample_num = 0;
+        watch.frame_ctr = 0;
+        watch.write_fail_ctr = 0;
+        watch.send_layout = true;
+        watch.tmr_id = tmr_inst_get_cb(watch.period_ms, watch_tmr_cb, 0,
+                                       TMR_CNTX_INTERRUPT);
+        if (watch.tmr_id < 0) {
+            printc("Can't get timer (%ld)\n", watch.tmr_id);
+            return watch.tmr_id;
+        }
+        watch.on = true;
+    } else if (strcasecmp(op, "stop") == 0) {
+        watch_stop();
+    } else {
+        printc("Invalid op '%s'\n", op);
+        return MOD_ERR_BAD_CMD;
+    }
+    return 0;
+}
+
+/*
+ * @brief Timer callback to take a watch sample.
+ *
+ * @param[in] tmr_id The timer ID (not used).
+ * @param[in] user_data User data for the timer (not used).
+ *
+ * @return TMR_CB_RESTART
+ *
+ * This runs at interrupt level, so sampling is not delayed by the super loop.
+ */
+static enum tmr_cb_action watch_tmr_cb(int32_t tmr_id, uint32_t user_data)
+{
+    uint8_t* rec;
+    uint32_t val;
+    uint32_t idx;
+    uint32_t byte_idx;
+
+    if (watch.put_ctr - watch.get_ctr >= watch.num_recs) {
+        watch.overrun_ctr++;
+        watch.sample_num++;
+        return TMR_CB_RESTART;
+    }
+    rec = &watch.buf[(watch.put_ctr % watch.num_recs) * watch.rec_size];
+    *rec++ = watch.sample_num >> 8;
+    *rec++ = watch.sample_num;
+    for (idx = 0; idx < watch.num_addrs; idx++) {
+        switch (watch.addrs[idx].unit_size) {
+            case 1:
+                val = *((volatile uint8_t*)watch.addrs[idx].addr);
+                break;
+            case 2:
+                val = *((volatile uint16_t*)watch.addrs[idx].addr);
+                break;
+            default:
+                val = *((volatile uint32_t*)watch.addrs[idx].addr);
+                break;
+        }
+        for (byte_idx = watch.addrs[idx].unit_size; byte_idx > 0; byte_idx--)
+            *rec++ = val >> (8 * (byte_idx - 1));
+    }
+    watch.sample_num++;
+    watch.put_ctr++;
+    return TMR_CB_RESTART;
+}
+
+/*
+ * @brief Stream watch frames, as long as there is space in the ttys buffer.
+ */
+static void watch_run(void)
+{
+    uint8_t payload[MEM_WATCH_MAX_PAYLOAD];
+    uint32_t recs_per_frame = MEM_WATCH_MAX_PAYLOAD / watch.rec_size;
+    uint32_t num_recs;
+    uint32_t len;
+    uint32_t idx;
+    int32_t space = ttys_tx_space(watch.ttys_inst);
+
+    if (watch.send_layout) {
+        len = 0;
+        payload[len++] = watch.period_ms >> 8;
+        payload[len++] = watch.period_ms;
+        for (idx = 0; idx < watch.num_addrs; idx++) {
+            uint32_t addr = (uint32_t)watch.addrs[idx].addr;
+            payload[len++] = addr >> 24;
+            payload[len++] = addr >> 16;
+            payload[len++] = addr >> 8;
+            payload[len++] = addr;
+            payload[len++] = watch.addrs[idx].unit_size;
+        }
+        if (space < MEM_WATCH_HDR_BYTES + (int32_t)len + 1 ||
+            !watch_frame(MEM_WATCH_TYPE_LAYOUT, payload, len))
+            return;
+        watch.send_layout = false;
+        space -= MEM_WATCH_HDR_BYTES + len + 1;
+    }
+
+    while (watch.put_ctr != watch.get_ctr && space >= MEM_WATCH_MAX_FRAME) {
+        num_recs = watch.put_ctr - watch.get_ctr;
+        if (num_recs > recs_per_frame)
+            num_recs = recs_per_frame;
+        len = 0;
+        for (idx = 0; idx < num_recs; idx++) {
+            memcpy(&payload[len],
+                   &watch.buf[((watch.get_ctr + idx) % watch.num_recs) *
+                              watch.rec_size],
+                   watch.rec_size);
+            len += watch.rec_size;
+        }
+        if (!watch_frame(MEM_WATCH_TYPE_DATA, payload, len))
+            return;
+        watch.get_ctr += num_recs;
+        space -= MEM_WATCH_HDR_BYTES + len + 1;
+    }
+}
+
+/*
+ * @brief Build a watch stream frame and write it to the ttys.
+ *
+ * @param[in] type Frame type.
+ * @param[in] payload Frame payload.
+ * @param[in] len Number of payload bytes (max MEM_WATCH_MAX_PAYLOAD).
+ *
+ * @return true if the frame was written, false otherwise.
+ */
+static bool watch_frame(uint8_t type, const uint8_t* payload, uint32_t len)
+{
+    uint8_t frame[MEM_WATCH_MAX_FRAME];
+    uint8_t sum = 0;
+    uint32_t idx;
+
+    frame[0] = MEM_WATCH_SYNC_1;
+    frame[1] = MEM_WATCH_SYNC_2;
+    frame[2] = watch.seq;
+    frame[3] = type;
+    frame[4] = len;
+    memcpy(&frame[MEM_WATCH_HDR_BYTES], payload, len);
+    for (idx = 2; idx < MEM_WATCH_HDR_BYTES + len; idx++)
+        sum += frame[idx];
+    frame[MEM_WATCH_HDR_BYTES + len] = sum;
+
+    len += MEM_WATCH_HDR_BYTES + 1;
+    if (ttys_write(watch.ttys_inst, (const char*)frame, len) != (int32_t)len) {
+        watch.write_fail_ctr++;
+        return false;
+    }
+    watch.seq++;
+    watch.frame_ctr++;
+    return true;
+}
+
+/*
+ * @brief Stop watch sampling.
+ *
+ * Records not yet sent are discarded.
+ */
+static void watch_stop(void)
+{
+    if (!watch.on)
+        return;
+    tmr_inst_release(watch.tmr_id);
+    watch.on = false;
+}
+
+/*
+ * @brief Output as much of the current read as fits in the console buffer.
+ *
+ * Each data unit is read with its own size, so registers that need a
+ * particular access size can be read.
+ */
+static void read_run(void)
+{
+    char line[READ_LINE_SIZE + 1]; // Plus terminator.
+    uint32_t len;
+    uint32_t val;
+    uint16_t line_item_ctr;
+
+    // Each line also gets a CR added by the console.
+    while (read_cmd_count > 0 && console_tx_space() >= READ_LINE_SIZE + 1) {
+        len = hex_format(line, (uint32_t)read_cmd_data_ptr, 8);
+        line[len++] = ':';
+        for (line_item_ctr = 0;
+             line_item_ctr < read_cmd_items_per_line && read_cmd_count > 0;
+             line_item_ctr++, read_cmd_count--) {
+            switch (read_cmd_unit_size) {
+                case 1:
+                    val = *((uint8_t*)read_cmd_data_ptr);
+                    break;
+                case 2:
+                    val = *((uint16_t*)read_cmd_data_ptr);
+                    break;
+                default:
+                    val = *((uint32_t*)read_cmd_data_ptr);
+                    break;
+            }
+            line[len++] = ' ';
+            len += hex_format(&line[len], val, read_cmd_unit_size * 2);
+            read_cmd_data_ptr += read_cmd_unit_size;
+        }
+        line[len++] = '\n';
+        line[len] = '\0';
+        printc("%s", line);
+    }
+    if (read_cmd_count == 0)
+        console_emit_prompt();
+}
+
+/*
+ * @brief Continue the current CRC calculation.
+ *
+ * @param[in] max_bytes Maximum number of bytes to process in this call.
+ *
+ * When the calculation completes, the result is printed.
+ */
+static void crc_run(uint32_t max_bytes)
+{
+    uint32_t num_bytes = crc_cmd_bytes_left;
+
+    if (num_bytes > max_bytes)
+        num_bytes = max_bytes;
+    crc_cmd_val = crc32_update(crc_cmd_val, crc_cmd_data_ptr, num_bytes);
+    crc_cmd_data_ptr += num_bytes;
+    crc_cmd_bytes_left -= num_bytes;
+    if (crc_cmd_bytes_left == 0) {
+        printc("addr=0x%08lx num-bytes=%lu crc32=0x%08lx time=%lu ms\n",
+               (uint32_t)crc_cmd_start_ptr, crc_cmd_num_bytes, ~crc_cmd_val,
+               tmr_get_ms() - crc_cmd_start_ms);
+        if (!console_bin_active())
+            console_emit_prompt();
+    }
+}
+
+/*
+ * @brief Format a value as fixed width hex.
+ *
+ * @param[out] buf Where to put the hex digits (not terminated).
+ * @param[in] val The value.
+ * @param[in] num_digits The number of digits (max 8).
+ *
+ * @return The number of chars written (num_digits).
+ */
+static uint32_t hex_format(char* buf, uint32_t val, uint32_t num_digits)
+{
+    uint32_t idx;
+
+    for (idx = num_digits; idx > 0; idx--) {
+        buf[idx - 1] = hex_digits[val & 0xf];
+        val >>= 4;
+    }
+    return num_digits;
+}
@@ -1,10 +1,38 @@
 /*
  * @brief Implementation of os module.
  *
- * This module ...
+ * This module provides OS related utilities, and optionally (see
+ * CONFIG_OS_FREERTOS) runs the module tasks under the FreeRTOS preemptive
+ * kernel rather than the super loop.
+ *
+ * When using FreeRTOS:
+ * - Each sched task (see sched module) becomes a kernel task. Kernel task
+ *   priorities follow the sched task priorities, above the idle task, so
+ *   when several tasks are ready the highest priority one runs first.
+ * - Module code was written for the super loop, and shares state without
+ *   locking: console output (printc() and the binary command reply buffer),
+ *   the cmd handlers, base level tmr callbacks, and the many cross-module
+ *   calls. So the sched task functions are serialized by a module mutex,
+ *   which each kernel task holds while running its function. Task functions
+ *   do not block, so a ready higher priority task waits at most for the
+ *   current function to return (the mutex has priority inheritance). Code
+ *   that runs outside the sched tasks (interrupt handlers, and the kernel
+ *   tick hook) has the same constraints as with the super loop.
+ * - An event driven task blocks on its task notification, which
+ *   sched_post() gives. A polled task also wakes on every kernel tick.
+ * - The kernel owns the SysTick, and the tmr module is driven from the kernel
+ *   tick hook, so interrupt level tmr callbacks (e.g. motion control) still
+ *   run in interrupt context, at every tick.
+ * - Each task's stack high-water mark is shown by "os status", to help tune
+ *   CONFIG_OS_TASK_STACK_WORDS.
+ *
+ * Interrupt handlers that call sched_post() must have a priority allowed to
+ * call FreeRTOS "FromISR" APIs (see configMAX_SYSCALL_INTERRUPT_PRIORITY), so
+ * they set their NVIC priority to OS_POST_IRQ_PRIO (see os.h).
  *
  * The following console commands are provided:
  * > os status
+ * > os test
  * See code for details.
  *
  * MIT License
@@ -36,6 +64,12 @@
 #include "config.h"
 #include CONFIG_STM32_LL_CORTEX_HDR 
 
+#if CONFIG_OS_FREERTOS
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#endif
+
 #include "cmd.h"
 #include "console.h"
 #include "log.h"
@@ -52,6 +86,20 @@
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+#if CONFIG_OS_FREERTOS
+
+struct os_task {
+    const char* name;
+    sched_task_func func;
+    int32_t arg;
+    TaskHandle_t handle;
+    uint8_t prio;
+    volatile bool poll;
+    uint32_t runs;
+};
+
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
@@ -59,6 +107,9 @@
 static enum tmr_cb_action timer_callback(int32_t tmr_id, uint32_t user_data);
 static int32_t cmd_os_status(int32_t argc, const char** argv);
 static int32_t cmd_os_test(int32_t argc, const char** argv);
+#if CONFIG_OS_FREERTOS
+static void task_entry(void* param);
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -90,6 +141,14 @@ static struct cmd_client_info cmd_info = {
 
 static bool get_systick_basepri = false;
 
+#if CONFIG_OS_FREERTOS
+static struct os_task os_tasks[SCHED_MAX_TASKS];
+static uint32_t num_os_tasks;
+
+// Held while a sched task function runs (see module description).
+static SemaphoreHandle_t module_mutex;
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -168,6 +227,11 @@ int32_t os_run(void)
     return 0;
 }
 
+/*
+ * @brief Print OS related register values.
+ *
+ * @param[in] tag Printed before the values (or NULL).
+ */
 void os_dump(const char* tag)
 {
     if (tag != NULL)
@@ -179,6 +243,113 @@ void os_dump(const char* tag)
            __get_IPSR());
 }
 
+#if CONFIG_OS_FREERTOS
+
+/*
+ * @brief Create a kernel task for a sched task.
+ *
+ * @param[in] name Task name (must be a static string).
+ * @param[in] func Task function.
+ * @param[in] arg Argument passed to the task function.
+ * @param[in] prio Sched task priority, higher values run first.
+ * @param[in] poll True if the task is polled, false if event driven.
+ *
+ * @return OS task ID (>= 0) for success, else a "MOD_ERR" value (< 0). See
+ *         code for details.
+ *
+ * This is called by sched_task_add(). The task does not run until
+ * os_sched_start() is called.
+ */
+int32_t os_task_create(const char* name, sched_task_func func, int32_t arg,
+                       uint8_t prio, bool poll)
+{
+    struct os_task* ot;
+    UBaseType_t os_prio = tskIDLE_PRIORITY + 1 + prio;
+
+    if (num_os_tasks >= SCHED_MAX_TASKS)
+        return MOD_ERR_RESOURCE;
+    if (os_prio > configMAX_PRIORITIES - 1)
+        os_prio = configMAX_PRIORITIES - 1;
+    if (module_mutex == NULL) {
+        module_mutex = xSemaphoreCreateMutex();
+        if (module_mutex == NULL) {
+            log_error("os_task_create: no memory for mutex\n");
+            return MOD_ERR_RESOURCE;
+        }
+    }
+
+    ot = &os_tasks[num_os_tasks];
+    ot->name = name;
+    ot->func = func;
+    ot->arg = arg;
+    ot->prio = os_prio;
+    ot->poll = poll;
+    ot->runs = 0;
+    if (xTaskCreate(task_entry, name, CONFIG_OS_TASK_STACK_WORDS, ot, os_prio,
+                    &ot->handle) != pdPASS) {
+        log_error("os_task_create: no memory for %s\n", name);
+        return MOD_ERR_RESOURCE;
+    }
+    return num_os_tasks++;
+}
+
+/*
+ * @brief Set whether a kernel task is polled or event driven.
+ *
+ * @param[in] os_task_id OS task ID from os_task_create().
+ * @param[in] poll True if the task is polled, false if event driven.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t os_task_set_poll(int32_t os_task_id, bool poll)
+{
+    if (os_task_id < 0 || (uint32_t)os_task_id >= num_os_tasks)
+        return MOD_ERR_ARG;
+    os_tasks[os_task_id].poll = poll;
+    os_task_notify(os_task_id);
+    return 0;
+}
+
+/*
+ * @brief Make a kernel task ready to run.
+ *
+ * @param[in] os_task_id OS task ID from os_task_create().
+ *
+ * This can be called from any context, including interrupt handlers (see
+ * note in the module description about interrupt priorities).
+ */
+void os_task_notify(int32_t os_task_id)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (os_task_id < 0 || (uint32_t)os_task_id >= num_os_tasks ||
+        xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
+        return;
+    if (__get_IPSR() != 0) {
+        vTaskNotifyGiveFromISR(os_tasks[os_task_id].handle, &woken);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        xTaskNotifyGive(os_tasks[os_task_id].handle);
+    }
+}
+
+/*
+ * @brief Start the kernel.
+ *
+ * @return Only returns if the kernel could not start, with a "MOD_ERR"
+ *         value.
+ *
+ * This is called by app_main() instead of entering the super loop.
+ */
+int32_t os_sched_start(void)
+{
+    vTaskStartScheduler();
+    log_error("os_sched_start: kernel did not start\n");
+    return MOD_ERR_RESOURCE;
+}
+
+#endif // CONFIG_OS_FREERTOS
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -215,7 +386,25 @@ static enum tmr_cb_action timer_callback(int32_t tmr_id, uint32_t user_data)
  */
 static int32_t cmd_os_status(int32_t argc, const char** argv)
 {
+#if CONFIG_OS_FREERTOS
+    uint32_t idx;
+    struct os_task* ot;
+#endif
+
     os_dump("cmd");
+
+#if CONFIG_OS_FREERTOS
+    printc("\nKernel free heap: %u bytes (min %u)\n\n",
+           xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize());
+    printc("Task     Prio Mode  Runs       Stack free (min)\n"
+           "-------- ---- ----- ---------- ----------------\n");
+    for (idx = 0; idx < num_os_tasks; idx++) {
+        ot = &os_tasks[idx];
+        printc("%-8s %4u %-5s %10lu %10lu bytes\n", ot->name, ot->prio,
+               ot->poll ? "poll" : "event", ot->runs,
+               uxTaskGetStackHighWaterMark(ot->handle) * sizeof(StackType_t));
+    }
+#endif
     return 0;
 }
 
@@ -281,3 +470,29 @@ static int32_t cmd_os_test(int32_t argc, const char** argv)
     printc("Result code =%ld\n", rc);
     return 0;
 }
+
+#if CONFIG_OS_FREERTOS
+
+/*
+ * @brief Kernel task function, which runs a sched task function.
+ *
+ * @param[in] param The os_task.
+ *
+ * The task waits for a notification (see os_task_notify()), or for polled
+ * tasks at most one tick, and then runs the sched task function while holding
+ * the module mutex.
+ */
+static void task_entry(void* param)
+{
+    struct os_task* ot = param;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, ot->poll ? 1 : portMAX_DELAY);
+        xSemaphoreTake(module_mutex, portMAX_DELAY);
+        ot->runs++;
+        ot->func(ot->arg);
+        xSemaphoreGive(module_mutex);
+    }
+}
+
+#endif // CONFIG_OS_FREERTOS
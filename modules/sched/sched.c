@@ -0,0 +1,409 @@
+/*
+ * @brief Implementation of sched module.
+ *
+ * This module is a cooperative scheduler for the super loop. Rather than
+ * calling every module's run function on each pass, the super loop calls
+ * sched_run(), which only runs tasks that are ready, and then sched_idle(),
+ * which sleeps until an interrupt if no task is ready.
+ *
+ * Each task has one of two modes:
+ * - Event driven. The task runs only after sched_post() is called for it,
+ *   typically by an interrupt handler or a timer callback (e.g. ttys posts a
+ *   task when a character is received, see ttys_set_rx_task()). Several posts
+ *   before the task runs result in one run. A task can post itself to run
+ *   again (e.g. to spread work over several runs).
+ * - Polled. The task runs once on each pass of the super loop, i.e. once per
+ *   wakeup. This is the mode for run functions that poll for work, and the
+ *   default, so existing modules keep working without change.
+ *
+ * Tasks have a priority, higher values first. After each task runs, the
+ * highest priority ready task is chosen again, so a task posted by an
+ * interrupt does not wait for lower priority tasks that were already ready.
+ * Since the scheduling is cooperative, a task is never preempted by another,
+ * and the worst case latency for a task is the longest run time of any task
+ * (plus interrupt handling).
+ *
+ * If CONFIG_OS_FREERTOS is set, each task is instead run as a kernel task by
+ * the os module, and sched_run()/sched_idle() are not used. The task API
+ * (including sched_post()) is the same, so modules do not need to know which
+ * is used.
+ *
+ * The following console commands are provided:
+ * > sched status
+ * See code for details.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
+#include "cmd.h"
+#include "console.h"
+#include "log.h"
+#include "module.h"
+#include "os.h"
+#include "tmr.h"
+
+#include "sched.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#if SCHED_MAX_TASKS > 32
+    #error SCHED_MAX_TASKS must be at most 32
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+struct sched_task {
+    const char* name;
+    sched_task_func func;
+    int32_t arg;
+    uint8_t prio;
+    bool poll;
+    uint32_t posts;
+    uint32_t runs;
+#if CONFIG_OS_FREERTOS
+    int32_t os_task_id;
+#endif
+};
+
+enum sched_u16_pms {
+    CNT_TASK_ERR,
+
+    NUM_U16_PMS
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t cmd_sched_status(int32_t argc, const char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static struct sched_task tasks[SCHED_MAX_TASKS];
+static uint32_t num_tasks;
+
+// Task IDs in order of decreasing priority (in order added for equal
+// priority).
+static uint8_t order[SCHED_MAX_TASKS];
+
+// Bit N is set when task N is ready to run.
+static volatile uint32_t ready_mask;
+
+// Bit N is set when task N is polled.
+static uint32_t poll_mask;
+
+static uint32_t passes;
+static uint32_t idles;
+
+static int32_t log_level = LOG_DEFAULT;
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "task err",
+};
+
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "status",
+        .func = cmd_sched_status,
+        .help = "Get module status, usage: sched status [clear]",
+    },
+};
+
+static struct cmd_client_info cmd_info = {
+    .name = "sched",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Start sched module instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function starts the sched singleton module, to enter normal operation.
+ */
+int32_t sched_start(void)
+{
+    int32_t result;
+
+    result = cmd_register(&cmd_info);
+    if (result < 0) {
+        log_error("sched_start: cmd error %d\n", result);
+        return result;
+    }
+    return 0;
+}
+
+/*
+ * @brief Run ready tasks.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function is called in the super loop. Polled tasks are made ready, and
+ * then ready tasks are run, highest priority first, until none are ready.
+ */
+int32_t sched_run(void)
+{
+    struct sched_task* task;
+    uint32_t ready;
+    uint32_t idx;
+    uint32_t task_id;
+    CRIT_STATE_VAR;
+
+    passes++;
+    CRIT_BEGIN_NEST();
+    ready_mask |= poll_mask;
+    CRIT_END_NEST();
+
+    while (1) {
+        CRIT_BEGIN_NEST();
+        ready = ready_mask;
+        for (idx = 0; idx < num_tasks; idx++) {
+            if (ready & (1UL << order[idx]))
+                break;
+        }
+        if (idx == num_tasks) {
+            CRIT_END_NEST();
+            break;
+        }
+        task_id = order[idx];
+        ready_mask &= ~(1UL << task_id);
+        CRIT_END_NEST();
+
+        task = &tasks[task_id];
+        task->runs++;
+        if (task->func(task->arg) < 0)
+            INC_SAT_U16(cnts_u16[CNT_TASK_ERR]);
+    }
+    return 0;
+}
+
+/*
+ * @brief Add a task.
+ *
+ * @param[in] name Task name (must be a static string).
+ * @param[in] func Task function.
+ * @param[in] arg Argument passed to the task function.
+ * @param[in] prio Priority, higher values run first.
+ * @param[in] poll True if the task is polled, false if event driven.
+ *
+ * @return Task ID (>= 0) for success, else a "MOD_ERR" value (< 0). See code
+ *         for details.
+ *
+ * This is normally called during initialization, before the super loop
+ * starts.
+ */
+int32_t sched_task_add(const char* name, sched_task_func func, int32_t arg,
+                       uint8_t prio, bool poll)
+{
+    struct sched_task* task;
+    uint32_t task_id;
+    uint32_t idx;
+    CRIT_STATE_VAR;
+
+    if (func == NULL)
+        return MOD_ERR_ARG;
+    if (num_tasks >= SCHED_MAX_TASKS)
+        return MOD_ERR_RESOURCE;
+
+    task_id = num_tasks;
+    task = &tasks[task_id];
+    memset(task, 0, sizeof(*task));
+    task->name = name;
+    task->func = func;
+    task->arg = arg;
+    task->prio = prio;
+#if CONFIG_OS_FREERTOS
+    task->os_task_id = os_task_create(name, func, arg, prio, poll);
+    if (task->os_task_id < 0)
+        return task->os_task_id;
+#endif
+
+    CRIT_BEGIN_NEST();
+    for (idx = num_tasks; idx > 0 && tasks[order[idx - 1]].prio < prio; idx--)
+        order[idx] = order[idx - 1];
+    order[idx] = task_id;
+    num_tasks++;
+    CRIT_END_NEST();
+
+    sched_task_set_poll(task_id, poll);
+    return task_id;
+}
+
+/*
+ * @brief Set whether a task is polled or event driven.
+ *
+ * @param[in] task_id Task ID from sched_task_add().
+ * @param[in] poll True if the task is polled, false if event driven.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t sched_task_set_poll(int32_t task_id, bool poll)
+{
+    CRIT_STATE_VAR;
+
+    if (task_id < 0 || (uint32_t)task_id >= num_tasks)
+        return MOD_ERR_ARG;
+    tasks[task_id].poll = poll;
+    CRIT_BEGIN_NEST();
+    if (poll)
+        poll_mask |= 1UL << task_id;
+    else
+        poll_mask &= ~(1UL << task_id);
+    // Run the task at least once after a change of mode, in case there is
+    // work pending from before.
+    ready_mask |= 1UL << task_id;
+    CRIT_END_NEST();
+#if CONFIG_OS_FREERTOS
+    os_task_set_poll(tasks[task_id].os_task_id, poll);
+#endif
+    return 0;
+}
+
+/*
+ * @brief Make a task ready to run.
+ *
+ * @param[in] task_id Task ID from sched_task_add() (SCHED_NO_TASK is
+ *                    ignored).
+ *
+ * This can be called from any context, including interrupt handlers.
+ */
+void sched_post(int32_t task_id)
+{
+    CRIT_STATE_VAR;
+
+    if (task_id < 0 || (uint32_t)task_id >= num_tasks)
+        return;
+    CRIT_BEGIN_NEST();
+    ready_mask |= 1UL << task_id;
+    tasks[task_id].posts++;
+    CRIT_END_NEST();
+#if CONFIG_OS_FREERTOS
+    os_task_notify(tasks[task_id].os_task_id);
+#endif
+}
+
+/*
+ * @brief Sleep until an interrupt if no task is ready.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function is called by the super loop after sched_run(). If no task is
+ * ready there is nothing to do until an interrupt, so the MCU sleeps, using
+ * tmr_idle() to skip ticks when possible.
+ *
+ * The ready check and the sleep are done with interrupts disabled, so a post
+ * from an interrupt handler after the check still wakes the MCU (a pending
+ * interrupt ends WFI even when masked).
+ */
+int32_t sched_idle(void)
+{
+    CRIT_IDLE_STATE_VAR;
+
+    CRIT_IDLE_BEGIN_NEST();
+    if (ready_mask == 0) {
+        idles++;
+        if (tmr_idle() <= 0) {
+            __DSB();
+            __WFI();
+            __ISB();
+        }
+    }
+    CRIT_IDLE_END_NEST();
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Console command function for "sched status".
+ *
+ * @param[in] argc Number of arguments, including "sched".
+ * @param[in] argv Argument values, including "sched".
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: sched status [clear]
+ *
+ * Tasks are listed in priority order.
+ */
+static int32_t cmd_sched_status(int32_t argc, const char** argv)
+{
+    struct sched_task* task;
+    uint32_t idx;
+
+    if (argc > 3 || (argc == 3 && strcasecmp(argv[2], "clear") != 0)) {
+        printc("Invalid arguments\n");
+        return MOD_ERR_ARG;
+    }
+
+    printc("Passes: %lu Idles: %lu\n\n", passes, idles);
+    printc("ID Name     Prio Mode  Posts      Runs\n"
+           "-- -------- ---- ----- ---------- ----------\n");
+    for (idx = 0; idx < num_tasks; idx++) {
+        task = &tasks[order[idx]];
+        printc("%2u %-8s %4u %-5s %10lu %10lu\n", order[idx], task->name,
+               task->prio, task->poll ? "poll" : "event", task->posts,
+               task->runs);
+    }
+
+    if (argc == 3) {
+        printc("Clearing counts\n");
+        passes = 0;
+        idles = 0;
+        for (idx = 0; idx < num_tasks; idx++) {
+            tasks[idx].posts = 0;
+            tasks[idx].runs = 0;
+        }
+    }
+    return 0;
+}
@@ -4,6 +4,16 @@
  * This utility collects data and performs statistical calculations. Currently it
  * supports time duration measurements.
  *
+ * There are two types of duration statistic:
+ * - struct stat_dur, which uses the ms system tick. Durations shorter than a few
+ *   ms are mostly quantization noise.
+ * - struct stat_cyc_dur, which uses the DWT cycle counter (CYCCNT), so has the
+ *   resolution of the CPU clock. It also keeps a log2 histogram of durations,
+ *   from which percentiles (e.g. p50, p99, p999) can be estimated for looking
+ *   at tail latency. The 32-bit cycle counter limits a single duration to a
+ *   few tens of seconds. Note that the cycle counter does not run while the CPU
+ *   is sleeping (e.g. tickless idle).
+ *
  * MIT License
  * 
  * Copyright (c) 2021 Eugene R Schroeder
@@ -31,6 +41,9 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "config.h"
+#include CONFIG_STM32_LL_CORTEX_HDR
+
 #include "tmr.h"
 #include "stat.h"
 
@@ -46,6 +59,8 @@
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
+static void cyc_dur_record(struct stat_cyc_dur* stat, uint32_t dur);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
@@ -152,6 +167,221 @@ uint32_t stat_dur_avg_us(struct stat_dur* stat)
     return (stat->accum_ms * 1000) / stat->samples;
 }
 
+/*
+ * @brief Initializize cycle-based time duration statistic.
+ *
+ * @param[in] stat Time duration statistic.
+ *
+ * This also enables the DWT cycle counter, if not already enabled.
+ */
+void stat_cyc_dur_init(struct stat_cyc_dur* stat)
+{
+    memset(stat, 0, sizeof(*stat));
+    stat->min = UINT32_MAX;
+    stat->max = 0;
+
+    if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+}
+
+/*
+ * @brief Indicate start of cycle-based duration interval.
+ *
+ * @param[in] stat Time duration statistic.
+ */
+void stat_cyc_dur_start(struct stat_cyc_dur* stat)
+{
+    stat->start_cyc = DWT->CYCCNT;
+    stat->started = true;
+}
+
+/*
+ * @brief Indicate end of cycle-based duration interval.
+ *
+ * @param[in] stat Time duration statistic.
+ */
+void stat_cyc_dur_end(struct stat_cyc_dur* stat)
+{
+    uint32_t now_cyc = DWT->CYCCNT;
+
+    if (stat->samples == UINT32_MAX || !stat->started)
+        return;
+
+    stat->started = false;
+    cyc_dur_record(stat, now_cyc - stat->start_cyc);
+}
+
+/*
+ * @brief Restart measurement of a cycle-based duration interval.
+ *
+ * @param[in] stat Time duration statistic.
+ *
+ * See stat_dur_restart().
+ */
+void stat_cyc_dur_restart(struct stat_cyc_dur* stat)
+{
+    uint32_t now_cyc = DWT->CYCCNT;
+
+    if (stat->samples == UINT32_MAX)
+        return;
+
+    if (stat->started)
+        cyc_dur_record(stat, now_cyc - stat->start_cyc);
+
+    stat->started = true;
+    stat->start_cyc = now_cyc;
+}
+
+/*
+ * @brief Add a cycle-based duration sample measured by the caller.
+ *
+ * @param[in] stat Time duration statistic.
+ * @param[in] cycles Duration in cycles.
+ *
+ * This is for durations that are not measured with stat_cyc_dur_start() and
+ * stat_cyc_dur_end(), e.g. by code that can be reentered.
+ */
+void stat_cyc_dur_add(struct stat_cyc_dur* stat, uint32_t cycles)
+{
+    if (stat->samples == UINT32_MAX)
+        return;
+    cyc_dur_record(stat, cycles);
+}
+
+/*
+ * @brief Get average cycle-based duration in ns.
+ *
+ * @param[in] stat Time duration statistic.
+ *
+ * @return Average duration in ns (0 if there are no samples).
+ */
+uint32_t stat_cyc_dur_avg_ns(struct stat_cyc_dur* stat)
+{
+    if (stat->samples == 0)
+        return 0;
+    return stat_cyc_to_ns(stat->accum_cyc / stat->samples);
+}
+
+/*
+ * @brief Estimate a percentile of cycle-based duration in ns.
+ *
+ * @param[in] stat Time duration statistic.
+ * @param[in] pctl_x100 Percentile times 100, e.g. 9900 for p99, 9990 for p999.
+ *
+ * @return Estimated percentile in ns (0 if there are no samples).
+ *
+ * The bucket containing the percentile is found from the histogram, and the
+ * value is interpolated linearly within the bucket (limited by the min and max
+ * durations seen).
+ */
+uint32_t stat_cyc_dur_pctl_ns(struct stat_cyc_dur* stat, uint32_t pctl_x100)
+{
+    uint32_t idx;
+    uint32_t total = 0;
+    uint32_t cum = 0;
+    uint32_t rank;
+    uint32_t lo;
+    uint32_t hi;
+
+    for (idx = 0; idx < STAT_HIST_NUM_BUCKETS; idx++)
+        total += stat->hist[idx];
+    if (total == 0)
+        return 0;
+
+    if (pctl_x100 > 10000)
+        pctl_x100 = 10000;
+    rank = ((uint64_t)total * pctl_x100 + 9999) / 10000;
+    if (rank == 0)
+        rank = 1;
+
+    for (idx = 0; idx < STAT_HIST_NUM_BUCKETS - 1; idx++) {
+        if (cum + stat->hist[idx] >= rank)
+            break;
+        cum += stat->hist[idx];
+    }
+
+    lo = idx == 0 ? 0 : 1UL << idx;
+    hi = idx == STAT_HIST_NUM_BUCKETS - 1 ? UINT32_MAX : (2UL << idx) - 1;
+    if (lo < stat->min)
+        lo = stat->min;
+    if (hi > stat->max)
+        hi = stat->max;
+    if (hi < lo || stat->hist[idx] == 0)
+        return stat_cyc_to_ns(lo);
+    return stat_cyc_to_ns(lo + ((uint64_t)(hi - lo) * (rank - cum)) /
+                          stat->hist[idx]);
+}
+
+/*
+ * @brief Get the cycle counter value.
+ *
+ * @return Cycle counter value (only valid after stat_cyc_dur_init()).
+ */
+uint32_t stat_cyc_get(void)
+{
+    return DWT->CYCCNT;
+}
+
+/*
+ * @brief Convert a number of CPU cycles to ns.
+ *
+ * @param[in] cycles Number of cycles.
+ *
+ * @return Number of ns (saturated to UINT32_MAX).
+ */
+uint32_t stat_cyc_to_ns(uint32_t cycles)
+{
+    uint64_t ns = ((uint64_t)cycles * 1000000000ULL) / SystemCoreClock;
+
+    return ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+/*
+ * @brief Convert a (possibly large) number of CPU cycles to us.
+ *
+ * @param[in] cycles Number of cycles.
+ *
+ * @return Number of us (saturated to UINT32_MAX).
+ */
+uint32_t stat_cyc_to_us64(uint64_t cycles)
+{
+    uint64_t us = cycles / (SystemCoreClock / 1000000);
+
+    return us > UINT32_MAX ? UINT32_MAX : us;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Record a cycle-based duration sample.
+ *
+ * @param[in] stat Time duration statistic.
+ * @param[in] dur Duration in cycles.
+ *
+ * If a histogram bucket would overflow, all buckets are halved, which keeps the
+ * shape of the distribution.
+ */
+static void cyc_dur_record(struct stat_cyc_dur* stat, uint32_t dur)
+{
+    uint32_t idx;
+
+    stat->accum_cyc += dur;
+    stat->samples++;
+    if (dur > stat->max)
+        stat->max = dur;
+    if (dur < stat->min)
+        stat->min = dur;
+
+    idx = dur == 0 ? 0 : 31 - __builtin_clz(dur);
+    if (stat->hist[idx] == UINT16_MAX) {
+        uint32_t bkt;
+        for (bkt = 0; bkt < STAT_HIST_NUM_BUCKETS; bkt++)
+            stat->hist[bkt] >>= 1;
+    }
+    stat->hist[idx]++;
+}
@@ -4,14 +4,49 @@
  * This module drives stepper motors. Multiple instances are supported,
  * and each instance drives a single stepper motor.
  *
- * The usage model is to add motion commands. There is a motion command queue,
- * so it is possible to add motion commands "in advance" to get continuous
- * operation.
+ * The usage model is to add motion commands. There is a motion command queue
+ * (of CONFIG_STEP_CMD_QUEUE_SIZE entries), so it is possible to add motion
+ * commands "in advance" to get continuous operation.
+ *
+ * Steps are scheduled with microsecond resolution. If the MCU has a supported
+ * hardware timer (CONFIG_TIM_TYPE) and the instance is configured to use it,
+ * each instance has a dedicated 32-bit timer running at 1 MHz, and the step
+ * logic runs from its update interrupt. Otherwise, the tmr module is used, and
+ * step times are rounded to its 1 ms resolution (with the rounding error
+ * carried forward so that it does not accumulate). The tmr module is the
+ * default (see CONFIG_STEP_DFLT_USE_HW_TMR).
+ *
+ * Instances can be configured as "coordinated" (cfg.coord, off by default). The
+ * coordinated instances share a single motion command queue and a single timer
+ * (that of the first coordinated instance). Each command moves all of them over
+ * the same time interval. The axis with the most steps steps evenly over the
+ * interval, and the other axes step on a subset of its ticks, chosen with a
+ * Bresenham-style error accumulator. On each tick, the coil outputs of all axes
+ * that step are written together with one dio_set_reset_outputs() call per GPIO
+ * port (a single call if all motors share a port). This keeps the axes in lock
+ * step, and avoids the timer overhead of one timer per motor. Commands can be
+ * queued for all coordinated instances at once with step_queue_coord_cmd(), or
+ * for a single one with step_queue_cmd() (the other coordinated instances hold
+ * position). Ramped (STEP_CMD_N_AT_R) moves are not supported for coordinated
+ * instances.
+ *
+ * The STEP_CMD_N_AT_R command type moves with a trapezoidal speed profile,
+ * accelerating at cfg.accel_steps_per_s2 up to the requested rate and
+ * decelerating to a stop at the end of the move. The step period is
+ * updated incrementally on each step using the approximation described in
+ * "Generate stepper-motor speed profiles in real time" (D. Austin), so no
+ * divides by square roots are needed in the interrupt handler.
  *
  * Threading considerations:
  * - Only software running at the base level can invoke the public APIs.  For
  *   example, a motion command cannot be added from an interrupt handler.  This
  *   reduces the size and number of critical regions.
+ * - The step logic runs from an interrupt handler (the hardware timer
+ *   interrupt or the tmr module's callback).
+ * - Thus each motion command queue is a ring (see ring.h) with the base level
+ *   as the producer and the interrupt handler as the consumer. The active
+ *   command is used in place at the head of the queue, and only removed when
+ *   it is done, so its slot cannot be reused while it is running.
  *
  * The following console commands are provided:
  * > step status
@@ -48,21 +83,51 @@
 #include "cmd.h"
 #include "config.h"
 #include "console.h"
+#include "istat.h"
 #include "log.h"
 #include "module.h"
+#include "ring.h"
 #include "step.h"
 #include "tmr.h"
 
+#if CONFIG_TIM_TYPE == 1
+#include CONFIG_STM32_LL_BUS_HDR
+#include CONFIG_STM32_LL_RCC_HDR
+#include CONFIG_STM32_LL_TIM_HDR
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
 #define MAX_NUM_DRIVE_PATTERNS 8
-#define CMD_QUEUE_SIZE 3
-#define ZERO_STEP_MOVE ULONG_MAX
+#define CMD_QUEUE_SIZE CONFIG_STEP_CMD_QUEUE_SIZE
+#define ZERO_STEP_MOVE UINT32_MAX
 #define MIN_STEP_MS 3
 #define STEPS_PER_REV 2048
 
+#define US_PER_MS 1000
+#define US_PER_SEC 1000000
+
+// Delay from queuing a command on an idle motor to the command starting.
+#define START_DELAY_US 100
+
+// Maximum acceleration, so that sqrt(accel << 8) fits in 32 bits.
+#define MAX_ACCEL_STEPS_PER_S2 0xffffff
+
+// Step periods in the ramp calculations are in units of 1/256 us (Q8).
+#define PERIOD_Q8_SHIFT 8
+
+// Initial ramp period (us, Q8) is 0.676 * sqrt(2/a) * 1e6. The 0.676 factor
+// corrects the error of the incremental approximation at the first step. To
+// keep precision, it is computed as C0_NUM / sqrt(a << 8), hence the extra
+// factor of 16.
+#define C0_NUM (956008ULL * 256 * 16)
+
+#if !RING_SIZE_OK(CMD_QUEUE_SIZE)
+    #error CONFIG_STEP_CMD_QUEUE_SIZE must be a power of 2 (max 0x8000)
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -73,22 +138,48 @@ struct motion_cmd {
     uint32_t ms;
 };
 
+struct coord_cmd {
+    int32_t steps[STEP_NUM_INSTANCES];
+    uint32_t ms;
+    uint32_t abs_mask; // Instances for which steps is a position.
+};
+
+struct coord_state {
+    struct coord_cmd coord_cmds[CMD_QUEUE_SIZE];
+    uint32_t axis_steps[STEP_NUM_INSTANCES];
+    int32_t axis_err[STEP_NUM_INSTANCES];
+    uint32_t num_ticks;
+    uint32_t ticks_remaining;
+    uint32_t last_tick_us;
+    uint32_t instance_mask;
+    enum step_instance_id owner;
+    struct ring cmd_ring;
+    bool cmd_active;
+    bool idle_timer_running;
+};
+
 struct step_state {
     struct step_cfg cfg;
     struct motion_cmd motion_cmds[CMD_QUEUE_SIZE];
     int32_t position;
     uint32_t cmd_steps_remaining;
     uint32_t cmd_num_steps;
-    uint32_t last_step_ms;
+    uint32_t last_step_us;
+    uint32_t period_q8;
+    uint32_t min_period_q8;
+    uint32_t ramp_steps;
+    int32_t tmr_residual_us;
     int32_t tmr_id;
+#if CONFIG_TIM_TYPE == 1
+    TIM_TypeDef* tim;
+#endif
     uint16_t drive_pattern[MAX_NUM_DRIVE_PATTERNS];
     uint16_t num_drive_patterns;
     uint16_t last_drive_pattern;
     int8_t drive_pattern_idx;
     int8_t step_delta;
-    uint8_t get_cmd_idx;
-    uint8_t put_cmd_idx;
-    uint8_t active_cmd_idx;
+    struct ring cmd_ring;
+    bool cmd_active;
     bool idle_timer_running;
 };
 
@@ -96,7 +187,21 @@ struct step_state {
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
+static uint32_t step_tick(enum step_instance_id instance_id);
+static uint32_t coord_tick(void);
+static uint32_t coord_cmd_begin(struct coord_cmd* cmd);
+static int32_t coord_queue(const struct coord_cmd* cmd);
+static uint16_t advance_pattern(struct step_state* st);
+static bool is_moving(enum step_instance_id instance_id);
+static uint32_t ramp_start(struct step_state* st, uint32_t rate);
+static uint32_t ramp_next(struct step_state* st);
+static uint32_t isqrt(uint32_t val);
+static void sched_start(struct step_state* st, uint32_t us);
 static enum tmr_cb_action timer_callback(int32_t tmr_id, uint32_t user_data);
+#if CONFIG_TIM_TYPE == 1
+static int32_t hw_tmr_start(enum step_instance_id instance_id);
+static void hw_tmr_interrupt(enum step_instance_id instance_id);
+#endif
 static int32_t cmd_step_status(int32_t argc, const char** argv);
 static int32_t cmd_step_test(int32_t argc, const char** argv);
 
@@ -106,6 +211,11 @@ static int32_t cmd_step_test(int32_t argc, const char** argv);
 
 static struct step_state step_states[STEP_NUM_INSTANCES];
 
+static struct coord_state coord = {
+    .owner = STEP_NUM_INSTANCES,
+    .cmd_ring = RING_INIT(CMD_QUEUE_SIZE),
+};
+
 static int32_t log_level = LOG_DEFAULT;
 
 // Data structure with console command info.
@@ -158,6 +268,9 @@ int32_t step_get_def_cfg(enum step_instance_id instance_id, struct step_cfg* cfg
             cfg->idle_timer_ms = CONFIG_STEP_1_DFLT_IDLE_TIMER_MS;
             cfg->rev_direction = CONFIG_STEP_1_DFLT_REV_DIRECTION;
             cfg->drive_mode = CONFIG_STEP_1_DFLT_DRIVE_MODE;
+            cfg->accel_steps_per_s2 = CONFIG_STEP_DFLT_ACCEL_STEPS_PER_S2;
+            cfg->use_hw_tmr = CONFIG_STEP_DFLT_USE_HW_TMR;
+            cfg->coord = CONFIG_STEP_1_DFLT_COORD;
             break;
 #endif
 
@@ -171,6 +284,9 @@ int32_t step_get_def_cfg(enum step_instance_id instance_id, struct step_cfg* cfg
             cfg->idle_timer_ms = CONFIG_STEP_2_DFLT_IDLE_TIMER_MS;
             cfg->rev_direction = CONFIG_STEP_2_DFLT_REV_DIRECTION;
             cfg->drive_mode = CONFIG_STEP_2_DFLT_DRIVE_MODE;
+            cfg->accel_steps_per_s2 = CONFIG_STEP_DFLT_ACCEL_STEPS_PER_S2;
+            cfg->use_hw_tmr = CONFIG_STEP_DFLT_USE_HW_TMR;
+            cfg->coord = CONFIG_STEP_2_DFLT_COORD;
             break;
 #endif
 
@@ -200,15 +316,27 @@ int32_t step_init(enum step_instance_id instance_id, struct step_cfg* cfg)
     if (instance_id >= STEP_NUM_INSTANCES)
         return MOD_ERR_BAD_INSTANCE;
 
-    if (cfg == NULL)
+    if (cfg == NULL || cfg->accel_steps_per_s2 > MAX_ACCEL_STEPS_PER_S2)
         return MOD_ERR_ARG;
 
+#if CONFIG_TIM_TYPE != 1
+    if (cfg->use_hw_tmr)
+        return MOD_ERR_ARG;
+#endif
+
     st = &step_states[instance_id];
     memset(st, 0, sizeof(*st));
     st->cfg = *cfg;
 
     rc = step_set_drive_mode(instance_id, cfg->drive_mode);
-    st->active_cmd_idx = CMD_QUEUE_SIZE;
+    ring_init(&st->cmd_ring, CMD_QUEUE_SIZE);
+
+    // The first coordinated instance owns the timer used for all of them.
+    if (cfg->coord) {
+        coord.instance_mask |= 1UL << instance_id;
+        if (coord.owner >= STEP_NUM_INSTANCES)
+            coord.owner = instance_id;
+    }
     return rc;
 }
 
@@ -231,11 +359,25 @@ int32_t step_start(enum step_instance_id instance_id)
 
     st = &step_states[instance_id];
 
-    st->tmr_id = tmr_inst_get_cb(0, timer_callback, instance_id,
-                                 TMR_CNTX_INTERRUPT);
-    if (st->tmr_id < 0) {
-        log_error("step_start: tmr error %d\n", st->tmr_id);
-        return st->tmr_id;
+    // Coordinated instances, other than the owner, use the owner's timer.
+    if (!st->cfg.coord || coord.owner == instance_id) {
+#if CONFIG_TIM_TYPE == 1
+        if (st->cfg.use_hw_tmr) {
+            result = hw_tmr_start(instance_id);
+            if (result != 0) {
+                log_error("step_start: hw_tmr_start error %d\n", result);
+                return result;
+            }
+        } else
+#endif
+        {
+            st->tmr_id = tmr_inst_get_cb(0, timer_callback, instance_id,
+                                         TMR_CNTX_INTERRUPT);
+            if (st->tmr_id < 0) {
+                log_error("step_start: tmr error %d\n", st->tmr_id);
+                return st->tmr_id;
+            }
+        }
     }
 
     result = cmd_register(&cmd_info);
@@ -280,9 +422,13 @@ int32_t step_start(enum step_instance_id instance_id)
  * STEP_CMD_N_EACH_M   N: Steps to move     M: Ms per step
  * STEP_CMD_N_IN_M     N: Steps to move     M: Total ms
  * STEP_CMD_TO_P_IN_M  P: Step destination  M: Total ms
+ * STEP_CMD_N_AT_R     N: Steps to move     R: Max steps/sec
  *
  * Note that this function just puts the command info in the queue.  Commands
  * are always started from the timer callback handler.
+ *
+ * For a coordinated instance, the command is put in the coordinated queue,
+ * with the other coordinated instances holding position.
  */
 int32_t step_queue_cmd(enum step_instance_id instance_id,
                        enum step_cmd_type cmd_type,
@@ -290,7 +436,8 @@ int32_t step_queue_cmd(enum step_instance_id instance_id,
 {
     struct step_state* st;
     struct motion_cmd* cmd;
-    uint8_t next_put_cmd_idx;
+    uint32_t put_idx;
+    CRIT_STATE_VAR;
 
     if (instance_id >= STEP_NUM_INSTANCES)
         return MOD_ERR_BAD_INSTANCE;
@@ -299,32 +446,86 @@ int32_t step_queue_cmd(enum step_instance_id instance_id,
         return MOD_ERR_ARG;
 
     st = &step_states[instance_id];
-    next_put_cmd_idx = st->put_cmd_idx + 1;
-    if (next_put_cmd_idx >= CMD_QUEUE_SIZE)
-        next_put_cmd_idx = 0;
-    if (next_put_cmd_idx == st->get_cmd_idx)
+    if (st->cfg.coord) {
+        struct coord_cmd ccmd;
+
+        memset(&ccmd, 0, sizeof(ccmd));
+        ccmd.steps[instance_id] = steps;
+        ccmd.ms = ms;
+        switch (cmd_type) {
+            case STEP_CMD_N_EACH_M:
+                if (steps != 0)
+                    ccmd.ms *= steps > 0 ? steps : -steps;
+                break;
+            case STEP_CMD_N_IN_M:
+                break;
+            case STEP_CMD_TO_P_IN_M:
+                ccmd.abs_mask = 1UL << instance_id;
+                break;
+            default:
+                return MOD_ERR_ARG;
+        }
+        return coord_queue(&ccmd);
+    }
+
+    if (ring_put_peek(&st->cmd_ring, &put_idx) == 0)
         return MOD_ERR_RESOURCE;
-    cmd = &st->motion_cmds[st->put_cmd_idx];
+    cmd = &st->motion_cmds[put_idx];
     cmd->steps = steps;
     cmd->ms = ms;
     cmd->cmd_type = cmd_type;
     log_debug("step_queue_cmd type=%d steps=%ld ms=%ld\n",
               cmd_type, steps, ms);
-    st->put_cmd_idx = next_put_cmd_idx;
+    ring_put_commit(&st->cmd_ring, 1);
 
     // If there is no command running, cancel any idle timer, and start a timer
     // that will start the command. We block interrupts since the timer handler,
     // which can modify the timer, runs from an interrupt.
 
-    CRIT_START();
-    if (st->active_cmd_idx >= CMD_QUEUE_SIZE) {
+    CRIT_BEGIN_NEST();
+    if (!st->cmd_active) {
         st->idle_timer_running = false;
-        tmr_inst_start(st->tmr_id, 1);
+        sched_start(st, START_DELAY_US);
     }
-    CRIT_END();
+    CRIT_END_NEST();
     return 0;
 }
 
+/*
+ * @brief Queue a coordinated move of the coordinated instances.
+ *
+ * @param[in] instance_mask Mask of instances to move (bit N for instance N).
+ *                          They must all be coordinated instances.
+ * @param[in] positions Step destinations, indexed by instance ID. Only entries
+ *                      in instance_mask are used.
+ * @param[in] ms Time for the move, in ms.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * All instances in instance_mask arrive at their destinations at the same
+ * time. Coordinated instances not in instance_mask hold position.
+ */
+int32_t step_queue_coord_cmd(uint32_t instance_mask, const int32_t* positions,
+                             uint32_t ms)
+{
+    struct coord_cmd ccmd;
+    uint32_t idx;
+
+    if (instance_mask == 0 || (instance_mask & ~coord.instance_mask) != 0)
+        return MOD_ERR_BAD_INSTANCE;
+    if (positions == NULL || ms == 0)
+        return MOD_ERR_ARG;
+
+    memset(&ccmd, 0, sizeof(ccmd));
+    for (idx = 0; idx < STEP_NUM_INSTANCES; idx++) {
+        if (instance_mask & (1UL << idx))
+            ccmd.steps[idx] = positions[idx];
+    }
+    ccmd.ms = ms;
+    ccmd.abs_mask = instance_mask;
+    return coord_queue(&ccmd);
+}
+
 /*
  * @brief Get number of free motion command queue slots.
  *
@@ -336,25 +537,13 @@ int32_t step_queue_cmd(enum step_instance_id instance_id,
 int32_t step_get_free_queue_slots(enum step_instance_id instance_id)
 {
     struct step_state* st;
-    uint32_t ctr = 0;
-    uint8_t put_idx;
-    uint8_t get_idx;
 
     if (instance_id >= STEP_NUM_INSTANCES)
         return MOD_ERR_BAD_INSTANCE;
     st = &step_states[instance_id];
-    put_idx = st->put_cmd_idx;
-    get_idx = st->get_cmd_idx;
-    // While loop does sanity check.
-    while (ctr <= STEP_NUM_CMD) {
-        put_idx += 1;
-        if (put_idx >= STEP_NUM_CMD)
-            put_idx = 0;
-        if (put_idx == get_idx)
-            break;
-        ctr += 1;
-    }
-    return ctr <= STEP_NUM_CMD ? ctr : MOD_ERR_INTERNAL;
+    if (st->cfg.coord)
+        return ring_space(&coord.cmd_ring);
+    return ring_space(&st->cmd_ring);
 }
 
 /*
@@ -396,7 +585,7 @@ int32_t step_energize(enum step_instance_id instance_id, bool energize)
         return MOD_ERR_BAD_INSTANCE;
 
     st = &step_states[instance_id];
-    if (st->active_cmd_idx != CMD_QUEUE_SIZE)
+    if (is_moving(instance_id))
         return MOD_ERR_STATE;
 
     // Normally, drive_pattern_idx is the last pattern that was used (it is
@@ -435,6 +624,7 @@ int32_t step_get_info(enum step_instance_id instance_id,
     info->steps_per_rev =
         step_states[instance_id].cfg.drive_mode == STEP_DRIVE_MODE_HALF ?
         STEPS_PER_REV * 2 : STEPS_PER_REV;
+    info->coord = step_states[instance_id].cfg.coord;
     return 0;
 }
 
@@ -492,86 +682,99 @@ int32_t step_set_drive_mode(enum step_instance_id instance_id,
     return 0;
 }
 
+/*
+ * @brief Set the acceleration used for STEP_CMD_N_AT_R commands.
+ *
+ * @param[in] instance_id Identifies the step instance.
+ * @param[in] accel_steps_per_s2 Acceleration, in steps/sec^2. A value of 0
+ *            means moves start and stop at the requested rate.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The new value is used for commands started after this call.
+ */
+int32_t step_set_accel(enum step_instance_id instance_id,
+                       uint32_t accel_steps_per_s2)
+{
+    if (instance_id >= STEP_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (accel_steps_per_s2 > MAX_ACCEL_STEPS_PER_S2)
+        return MOD_ERR_ARG;
+
+    step_states[instance_id].cfg.accel_steps_per_s2 = accel_steps_per_s2;
+    return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
 
 /*
- * @brief Step timer callback.
+ * @brief Process a step timer expiry.
  *
- * @param[in] tmr_id Timer ID.
- * @param[in] user_data User callback data (is instance ID)
+ * @param[in] instance_id Identifies the step instance.
  *
- * @return TMR_CB_NONE/TMR_CB_RESTART
+ * @return Time until the next expiry in us, or 0 to stop the timer.
  *
  * This function handles any current motion in progress, and also handles
- * starting new commands in the qeuue.
+ * starting new commands in the qeuue. It is called from interrupt context
+ * (the hardware timer interrupt, or the tmr module callback).
  */
-static enum tmr_cb_action timer_callback(int32_t tmr_id, uint32_t user_data)
+static uint32_t step_tick(enum step_instance_id instance_id)
 {
     struct step_state* st;
     struct motion_cmd* cmd;
-    uint32_t next_step_ms;
+    uint32_t next_step_us;
+    uint32_t period_us;
     int32_t tmp_steps;
-    uint8_t next_get_cmd_idx;
+    uint32_t cmd_idx;
     bool check_for_next_cmd = false;
 
-    if (user_data >= STEP_NUM_INSTANCES)
-        // Shouldn't happen.
-        return TMR_CB_NONE;
-
-    st = &step_states[user_data];
-    if (st->active_cmd_idx >= CMD_QUEUE_SIZE) {
+    st = &step_states[instance_id];
+    if (!st->cmd_active) {
         if (st->idle_timer_running) {
             st->idle_timer_running = false;
-            step_energize(user_data, false);
-            return TMR_CB_NONE;
+            step_energize(instance_id, false);
+            return 0;
         } else {
             check_for_next_cmd = true;
         }
     } else {
-        cmd = &st->motion_cmds[st->active_cmd_idx];
-        log_verbose("timer_callback cmd_steps_remaining=%lu\n",
+        ring_get_peek(&st->cmd_ring, &cmd_idx);
+        cmd = &st->motion_cmds[cmd_idx];
+        log_verbose("step_tick cmd_steps_remaining=%lu\n",
                     st->cmd_steps_remaining);
         if (st->cmd_steps_remaining == ZERO_STEP_MOVE) {
             st->cmd_steps_remaining = 0;
             check_for_next_cmd = true;
         } else if (st->cmd_steps_remaining > 0) {
             // Take the step.
-            uint16_t drive_pattern;
-            int8_t drive_pattern_idx = st->drive_pattern_idx + st->step_delta;
-            if (drive_pattern_idx < 0)
-                drive_pattern_idx = st->num_drive_patterns - 1;
-            else if (drive_pattern_idx >= st->num_drive_patterns)
-                drive_pattern_idx = 0;
-            st->drive_pattern_idx = drive_pattern_idx;
-            log_verbose("step phase %u\n", drive_pattern_idx);
-            drive_pattern = st->drive_pattern[st->drive_pattern_idx];
+            uint16_t last_drive_pattern = st->last_drive_pattern;
+            uint16_t drive_pattern = advance_pattern(st);
             dio_set_reset_outputs(st->cfg.dio_port, drive_pattern,
-                                  st->last_drive_pattern & (~drive_pattern));
-            st->last_drive_pattern = drive_pattern;
-            st->position += st->step_delta;
+                                  last_drive_pattern & (~drive_pattern));
 
             // Check if the command is done.
             if (--st->cmd_steps_remaining > 0) {
                 // Compute time until next step.
                 if (cmd->cmd_type == STEP_CMD_N_EACH_M) {
-                    tmr_inst_set_period(st->tmr_id, cmd->ms);
+                    return cmd->ms * US_PER_MS;
+                } else if (cmd->cmd_type == STEP_CMD_N_AT_R) {
+                    return ramp_next(st);
                 } else {
                     // In the "N steps in M milliseconds" cases, the cumulative
                     // time for each step can be calculated as
                     // ((M * N_s + N/2) / N) with integer divides, where N_s is
                     // the step number 1, 2, 3, ..., N.
-                    next_step_ms =
-                        (cmd->ms *
+                    next_step_us =
+                        ((uint64_t)cmd->ms * US_PER_MS *
                          (st->cmd_num_steps + 1 - st->cmd_steps_remaining) +
                          st->cmd_num_steps / 2) /
                         st->cmd_num_steps;
-                    tmr_inst_set_period(st->tmr_id,
-                                        next_step_ms - st->last_step_ms);
-                    st->last_step_ms = next_step_ms;
+                    period_us = next_step_us - st->last_step_us;
+                    st->last_step_us = next_step_us;
+                    return period_us > 0 ? period_us : 1;
                 }
-                return TMR_CB_RESTART;
             } else {
                 check_for_next_cmd = true;
             }
@@ -579,28 +782,26 @@ static enum tmr_cb_action timer_callback(int32_t tmr_id, uint32_t user_data)
     }
 
     if (check_for_next_cmd) {
-        if (st->get_cmd_idx == st->put_cmd_idx) {
+        // Remove the finished command (if any) from the queue.
+        if (st->cmd_active)
+            ring_get_commit(&st->cmd_ring, 1);
+        if (ring_get_peek(&st->cmd_ring, &cmd_idx) == 0) {
             // Command queue is empty.
-            st->active_cmd_idx = CMD_QUEUE_SIZE;
+            st->cmd_active = false;
             if (st->cfg.idle_timer_ms > 0) {
                 st->idle_timer_running = true;
-                tmr_inst_set_period(st->tmr_id, st->cfg.idle_timer_ms);
-                return TMR_CB_RESTART;
+                return st->cfg.idle_timer_ms * US_PER_MS;
             } else {
-                return TMR_CB_NONE;
+                return 0;
             }
         }
 
-        // Get next command from queue.
-        next_get_cmd_idx = st->get_cmd_idx + 1;
-        if (next_get_cmd_idx >= CMD_QUEUE_SIZE)
-            next_get_cmd_idx = 0;
-        st->active_cmd_idx = st->get_cmd_idx;
-        st->get_cmd_idx = next_get_cmd_idx;
+        // The next command stays in the queue while it is active.
+        st->cmd_active = true;
     }
 
     // Start next command.
-    cmd = &st->motion_cmds[st->active_cmd_idx];
+    cmd = &st->motion_cmds[cmd_idx];
     if (cmd->cmd_type == STEP_CMD_TO_P_IN_M)
         tmp_steps =  cmd->steps - st->position;
     else
@@ -622,17 +823,510 @@ static enum tmr_cb_action timer_callback(int32_t tmr_id, uint32_t user_data)
 
     st->cmd_num_steps = st->cmd_steps_remaining;
 
-    if (cmd->cmd_type == STEP_CMD_N_EACH_M ||
-        st->cmd_num_steps == ZERO_STEP_MOVE)
-        next_step_ms = cmd->ms;
+    if (cmd->cmd_type == STEP_CMD_N_AT_R) {
+        if (st->cmd_num_steps == ZERO_STEP_MOVE)
+            next_step_us = START_DELAY_US;
+        else
+            next_step_us = ramp_start(st, cmd->ms);
+    } else if (cmd->cmd_type == STEP_CMD_N_EACH_M ||
+               st->cmd_num_steps == ZERO_STEP_MOVE) {
+        next_step_us = cmd->ms * US_PER_MS;
+    } else {
+        next_step_us = ((uint64_t)cmd->ms * US_PER_MS +
+                        st->cmd_num_steps / 2) / st->cmd_num_steps;
+    }
+    st->last_step_us = next_step_us;
+    log_verbose("step period=%lu us\n", next_step_us);
+    return next_step_us > 0 ? next_step_us : 1;
+}
+
+/*
+ * @brief Process a coordinated timer expiry.
+ *
+ * @return Time until the next expiry in us, or 0 to stop the timer.
+ *
+ * This is the coordinated instance counterpart of step_tick(), and is called
+ * from the timer interrupt of the owner instance.
+ */
+static uint32_t coord_tick(void)
+{
+    struct coord_cmd* cmd;
+    struct step_state* st;
+    uint32_t idx;
+    uint32_t next_tick_us;
+    uint32_t period_us;
+    uint32_t cmd_idx;
+
+    if (!coord.cmd_active) {
+        if (coord.idle_timer_running) {
+            coord.idle_timer_running = false;
+            for (idx = 0; idx < STEP_NUM_INSTANCES; idx++) {
+                if (coord.instance_mask & (1UL << idx))
+                    step_energize(idx, false);
+            }
+            return 0;
+        }
+    } else if (coord.ticks_remaining > 0) {
+        // Take the steps of all axes due on this tick, gathering the coil
+        // outputs per GPIO port so each port is written once.
+        dio_port* ports[STEP_NUM_INSTANCES];
+        uint32_t set_masks[STEP_NUM_INSTANCES];
+        uint32_t reset_masks[STEP_NUM_INSTANCES];
+        uint32_t num_ports = 0;
+        uint32_t port_idx;
+        uint16_t last_drive_pattern;
+        uint16_t drive_pattern;
+
+        for (idx = 0, st = step_states; idx < STEP_NUM_INSTANCES; idx++, st++) {
+            if ((coord.instance_mask & (1UL << idx)) == 0 ||
+                coord.axis_steps[idx] == 0)
+                continue;
+            coord.axis_err[idx] += coord.axis_steps[idx];
+            if (2 * coord.axis_err[idx] < (int32_t)coord.num_ticks)
+                continue;
+            coord.axis_err[idx] -= coord.num_ticks;
+
+            last_drive_pattern = st->last_drive_pattern;
+            drive_pattern = advance_pattern(st);
+            for (port_idx = 0; port_idx < num_ports; port_idx++) {
+                if (ports[port_idx] == st->cfg.dio_port)
+                    break;
+            }
+            if (port_idx == num_ports) {
+                ports[port_idx] = st->cfg.dio_port;
+                set_masks[port_idx] = 0;
+                reset_masks[port_idx] = 0;
+                num_ports++;
+            }
+            set_masks[port_idx] |= drive_pattern;
+            reset_masks[port_idx] |= last_drive_pattern & (~drive_pattern);
+        }
+        for (port_idx = 0; port_idx < num_ports; port_idx++)
+            dio_set_reset_outputs(ports[port_idx], set_masks[port_idx],
+                                  reset_masks[port_idx]);
+
+        if (--coord.ticks_remaining > 0) {
+            // Ticks are spread evenly over the command time, as for the
+            // "N steps in M milliseconds" commands in step_tick().
+            ring_get_peek(&coord.cmd_ring, &cmd_idx);
+            cmd = &coord.coord_cmds[cmd_idx];
+            next_tick_us =
+                ((uint64_t)cmd->ms * US_PER_MS *
+                 (coord.num_ticks + 1 - coord.ticks_remaining) +
+                 coord.num_ticks / 2) /
+                coord.num_ticks;
+            period_us = next_tick_us - coord.last_tick_us;
+            coord.last_tick_us = next_tick_us;
+            return period_us > 0 ? period_us : 1;
+        }
+    }
+
+    // The active command (if any) is done, so start the next one.
+    if (coord.cmd_active)
+        ring_get_commit(&coord.cmd_ring, 1);
+    if (ring_get_peek(&coord.cmd_ring, &cmd_idx) == 0) {
+        // Command queue is empty.
+        coord.cmd_active = false;
+        st = &step_states[coord.owner];
+        if (st->cfg.idle_timer_ms > 0) {
+            coord.idle_timer_running = true;
+            return st->cfg.idle_timer_ms * US_PER_MS;
+        } else {
+            return 0;
+        }
+    }
+    coord.cmd_active = true;
+    return coord_cmd_begin(&coord.coord_cmds[cmd_idx]);
+}
+
+/*
+ * @brief Start a coordinated command.
+ *
+ * @param[in] cmd The command.
+ *
+ * @return Time until the first tick in us.
+ *
+ * The number of ticks is the largest step count of the axes. The error
+ * accumulators start at zero, so each minor axis takes its steps centered
+ * in the runs of ticks between them.
+ */
+static uint32_t coord_cmd_begin(struct coord_cmd* cmd)
+{
+    struct step_state* st;
+    uint32_t idx;
+    int32_t steps;
+    uint32_t next_tick_us;
+
+    coord.num_ticks = 0;
+    for (idx = 0, st = step_states; idx < STEP_NUM_INSTANCES; idx++, st++) {
+        coord.axis_steps[idx] = 0;
+        coord.axis_err[idx] = 0;
+        if ((coord.instance_mask & (1UL << idx)) == 0)
+            continue;
+        steps = cmd->steps[idx];
+        if (cmd->abs_mask & (1UL << idx))
+            steps -= st->position;
+        st->step_delta = 1;
+        if (steps < 0) {
+            steps = -steps;
+            st->step_delta = -1;
+        }
+        if (st->cfg.rev_direction)
+            st->step_delta *= -1;
+        coord.axis_steps[idx] = steps;
+        if (steps > coord.num_ticks)
+            coord.num_ticks = steps;
+    }
+    coord.ticks_remaining = coord.num_ticks;
+
+    if (coord.num_ticks == 0)
+        // Zero step move.
+        next_tick_us = cmd->ms * US_PER_MS;
     else
-        next_step_ms = cmd->ms / st->cmd_num_steps;
-    st->last_step_ms = next_step_ms;
-    log_verbose("tmr period=%lu\n", next_step_ms);
-    tmr_inst_set_period(st->tmr_id, next_step_ms);
+        next_tick_us = ((uint64_t)cmd->ms * US_PER_MS + coord.num_ticks / 2) /
+            coord.num_ticks;
+    coord.last_tick_us = next_tick_us;
+    log_verbose("coord ticks=%lu period=%lu us\n", coord.num_ticks,
+                next_tick_us);
+    return next_tick_us > 0 ? next_tick_us : 1;
+}
+
+/*
+ * @brief Put a command in the coordinated command queue.
+ *
+ * @param[in] cmd The command.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t coord_queue(const struct coord_cmd* cmd)
+{
+    CRIT_STATE_VAR;
+
+    if (coord.owner >= STEP_NUM_INSTANCES)
+        return MOD_ERR_STATE;
+
+    if (ring_put(&coord.cmd_ring, coord.coord_cmds, sizeof(*cmd), cmd, 1) == 0)
+        return MOD_ERR_RESOURCE;
+    log_debug("coord_queue ms=%lu abs_mask=0x%lx\n", cmd->ms, cmd->abs_mask);
+
+    CRIT_BEGIN_NEST();
+    if (!coord.cmd_active) {
+        coord.idle_timer_running = false;
+        sched_start(&step_states[coord.owner], START_DELAY_US);
+    }
+    CRIT_END_NEST();
+    return 0;
+}
+
+/*
+ * @brief Advance the drive pattern of an instance by one step.
+ *
+ * @param[in] st The instance state.
+ *
+ * @return The new drive pattern.
+ *
+ * The position and last_drive_pattern are updated, but the outputs are not
+ * written; that is left to the caller.
+ */
+static uint16_t advance_pattern(struct step_state* st)
+{
+    int8_t drive_pattern_idx = st->drive_pattern_idx + st->step_delta;
+
+    if (drive_pattern_idx < 0)
+        drive_pattern_idx = st->num_drive_patterns - 1;
+    else if (drive_pattern_idx >= st->num_drive_patterns)
+        drive_pattern_idx = 0;
+    st->drive_pattern_idx = drive_pattern_idx;
+    log_verbose("step phase %u\n", drive_pattern_idx);
+    st->last_drive_pattern = st->drive_pattern[drive_pattern_idx];
+    st->position += st->step_delta;
+    return st->last_drive_pattern;
+}
+
+/*
+ * @brief Determine if an instance is executing a motion command.
+ *
+ * @param[in] instance_id Identifies the step instance.
+ *
+ * @return true if a command is active.
+ */
+static bool is_moving(enum step_instance_id instance_id)
+{
+    if (step_states[instance_id].cfg.coord)
+        return coord.cmd_active;
+    return step_states[instance_id].cmd_active;
+}
+
+/*
+ * @brief Set up the speed profile for a STEP_CMD_N_AT_R command.
+ *
+ * @param[in] st The instance state, with cmd_num_steps set.
+ * @param[in] rate The cruise rate, in steps/sec (non-zero).
+ *
+ * @return Time until the first step in us.
+ *
+ * The move accelerates for ramp_steps steps, cruises, then decelerates for
+ * ramp_steps steps. If the move is too short to reach the cruise rate, the
+ * profile is triangular.
+ */
+static uint32_t ramp_start(struct step_state* st, uint32_t rate)
+{
+    uint32_t accel = st->cfg.accel_steps_per_s2;
+    uint64_t ramp_steps;
+
+    st->min_period_q8 = ((uint64_t)US_PER_SEC << PERIOD_Q8_SHIFT) / rate;
+    if (st->min_period_q8 == 0)
+        st->min_period_q8 = 1;
+    if (accel == 0) {
+        st->ramp_steps = 0;
+        st->period_q8 = st->min_period_q8;
+    } else {
+        st->period_q8 = C0_NUM / isqrt(accel << 8);
+        ramp_steps = (uint64_t)rate * rate / (2 * accel);
+        if (ramp_steps > st->cmd_num_steps / 2)
+            ramp_steps = st->cmd_num_steps / 2;
+        st->ramp_steps = ramp_steps;
+        if (st->period_q8 < st->min_period_q8)
+            st->period_q8 = st->min_period_q8;
+    }
+    return (st->period_q8 >> PERIOD_Q8_SHIFT) ?: 1;
+}
+
+/*
+ * @brief Compute the next step period of a STEP_CMD_N_AT_R command.
+ *
+ * @param[in] st The instance state, with cmd_steps_remaining updated for the
+ *               step just taken.
+ *
+ * @return Time until the next step in us.
+ *
+ * The period is updated with c' = c - 2c/(4n+1) while accelerating (n is the
+ * number of steps taken), and with c' = c + 2c/(4r-1) while decelerating (r
+ * is the number of steps remaining).
+ */
+static uint32_t ramp_next(struct step_state* st)
+{
+    uint32_t remaining = st->cmd_steps_remaining;
+    uint32_t taken = st->cmd_num_steps - remaining;
+    uint32_t c = st->period_q8;
+
+    if (remaining <= st->ramp_steps) {
+        c += 2 * c / (4 * remaining - 1);
+    } else if (taken < st->ramp_steps) {
+        c -= 2 * c / (4 * taken + 1);
+        if (c < st->min_period_q8)
+            c = st->min_period_q8;
+    }
+    st->period_q8 = c;
+    return (c >> PERIOD_Q8_SHIFT) ?: 1;
+}
+
+/*
+ * @brief Integer square root.
+ *
+ * @param[in] val The value.
+ *
+ * @return floor(sqrt(val)), but at least 1.
+ */
+static uint32_t isqrt(uint32_t val)
+{
+    uint32_t res = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > val)
+        bit >>= 2;
+    while (bit != 0) {
+        if (val >= res + bit) {
+            val -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res > 0 ? res : 1;
+}
+
+/*
+ * @brief Start the step timer of an idle instance.
+ *
+ * @param[in] st The instance state.
+ * @param[in] us Time until the timer expires.
+ *
+ * Must be called with interrupts disabled.
+ */
+static void sched_start(struct step_state* st, uint32_t us)
+{
+#if CONFIG_TIM_TYPE == 1
+    if (st->cfg.use_hw_tmr) {
+        LL_TIM_DisableCounter(st->tim);
+        LL_TIM_SetCounter(st->tim, 0);
+        LL_TIM_SetAutoReload(st->tim, us - 1);
+        LL_TIM_EnableCounter(st->tim);
+        return;
+    }
+#endif
+    st->tmr_residual_us = 0;
+    tmr_inst_start(st->tmr_id, (us + US_PER_MS - 1) / US_PER_MS);
+}
+
+/*
+ * @brief Step timer callback (tmr module).
+ *
+ * @param[in] tmr_id Timer ID.
+ * @param[in] user_data User callback data (is instance ID)
+ *
+ * @return TMR_CB_NONE/TMR_CB_RESTART
+ *
+ * The tmr module has 1 ms resolution, so each period is rounded, and the
+ * rounding error is carried into the next period.
+ */
+static enum tmr_cb_action timer_callback(int32_t tmr_id, uint32_t user_data)
+{
+    struct step_state* st;
+    int32_t us;
+    int32_t ms;
+
+    if (user_data >= STEP_NUM_INSTANCES)
+        // Shouldn't happen.
+        return TMR_CB_NONE;
+
+    st = &step_states[user_data];
+    {
+        ISTAT_EXEC_BEGIN(ISTAT_ID_STEP_1 + user_data);
+        us = st->cfg.coord ? coord_tick() : step_tick(user_data);
+        ISTAT_EXEC_END(ISTAT_ID_STEP_1 + user_data);
+    }
+    if (us == 0)
+        return TMR_CB_NONE;
+
+    us += st->tmr_residual_us;
+    ms = (us + US_PER_MS / 2) / US_PER_MS;
+    if (ms < 1)
+        ms = 1;
+    st->tmr_residual_us = us - ms * US_PER_MS;
+    tmr_inst_set_period(tmr_id, ms);
     return TMR_CB_RESTART;
 }
 
+#if CONFIG_TIM_TYPE == 1
+
+/*
+ * @brief Set up the hardware step timer of an instance.
+ *
+ * @param[in] instance_id Identifies the step instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Instance 1 uses TIM2 and instance 2 uses TIM5 (both 32-bit timers on APB1).
+ * The timer counts at 1 MHz, and the auto-reload value is set to the time to
+ * the next step. Auto-reload preload is disabled, so a new value written in
+ * the update interrupt applies to the period that has just started.
+ */
+static int32_t hw_tmr_start(enum step_instance_id instance_id)
+{
+    struct step_state* st = &step_states[instance_id];
+    LL_RCC_ClocksTypeDef clocks;
+    uint32_t tim_clk_hz;
+    IRQn_Type irq_type;
+
+    switch (instance_id) {
+#if CONFIG_STEP_1_PRESENT
+        case STEP_INSTANCE_1:
+            st->tim = TIM2;
+            irq_type = TIM2_IRQn;
+            LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_TIM2);
+            break;
+#endif
+#if CONFIG_STEP_2_PRESENT
+        case STEP_INSTANCE_2:
+            st->tim = TIM5;
+            irq_type = TIM5_IRQn;
+            LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_TIM5);
+            break;
+#endif
+        default:
+            return MOD_ERR_BAD_INSTANCE;
+    }
+
+    // APB timer clocks run at twice PCLK if the APB prescaler is not 1.
+    LL_RCC_GetSystemClocksFreq(&clocks);
+    tim_clk_hz = clocks.PCLK1_Frequency;
+    if (LL_RCC_GetAPB1Prescaler() != LL_RCC_APB1_DIV_1)
+        tim_clk_hz *= 2;
+
+    LL_TIM_DisableCounter(st->tim);
+    LL_TIM_SetCounterMode(st->tim, LL_TIM_COUNTERMODE_UP);
+    LL_TIM_SetPrescaler(st->tim, __LL_TIM_CALC_PSC(tim_clk_hz, US_PER_SEC));
+    LL_TIM_DisableARRPreload(st->tim);
+    LL_TIM_SetAutoReload(st->tim, 0xffffffff);
+
+    // Load the prescaler.
+    LL_TIM_GenerateEvent_UPDATE(st->tim);
+    LL_TIM_ClearFlag_UPDATE(st->tim);
+    LL_TIM_EnableIT_UPDATE(st->tim);
+
+    NVIC_SetPriority(irq_type,
+                     NVIC_EncodePriority(NVIC_GetPriorityGrouping(),0, 0));
+    NVIC_EnableIRQ(irq_type);
+    return 0;
+}
+
+/*
+ * @brief Hardware step timer interrupt handler.
+ *
+ * @param[in] instance_id Identifies the step instance.
+ */
+static void hw_tmr_interrupt(enum step_instance_id instance_id)
+{
+    struct step_state* st = &step_states[instance_id];
+    uint32_t us;
+
+    if (!LL_TIM_IsActiveFlag_UPDATE(st->tim))
+        return;
+    LL_TIM_ClearFlag_UPDATE(st->tim);
+
+    us = st->cfg.coord ? coord_tick() : step_tick(instance_id);
+    if (us == 0) {
+        LL_TIM_DisableCounter(st->tim);
+        return;
+    }
+    LL_TIM_SetAutoReload(st->tim, us - 1);
+
+    // If the counter already passed the new period (very short period and/or
+    // interrupt latency), force an update rather than letting the counter wrap.
+    if (LL_TIM_GetCounter(st->tim) >= us - 1)
+        LL_TIM_GenerateEvent_UPDATE(st->tim);
+}
+
+// The following interrupt handler functions override the default handlers,
+// which are "weak" symobols. The timers count at 1 MHz from the update event,
+// so the counter value on entry is the interrupt latency in us.
+
+#if CONFIG_STEP_1_PRESENT
+void TIM2_IRQHandler(void)
+{
+    ISTAT_EXEC_BEGIN(ISTAT_ID_STEP_1);
+    ISTAT_LATENCY(ISTAT_ID_STEP_1,
+                  LL_TIM_GetCounter(TIM2) * (SystemCoreClock / 1000000));
+    hw_tmr_interrupt(STEP_INSTANCE_1);
+    ISTAT_EXEC_END(ISTAT_ID_STEP_1);
+}
+#endif
+
+#if CONFIG_STEP_2_PRESENT
+void TIM5_IRQHandler(void)
+{
+    ISTAT_EXEC_BEGIN(ISTAT_ID_STEP_2);
+    ISTAT_LATENCY(ISTAT_ID_STEP_2,
+                  LL_TIM_GetCounter(TIM5) * (SystemCoreClock / 1000000));
+    hw_tmr_interrupt(STEP_INSTANCE_2);
+    ISTAT_EXEC_END(ISTAT_ID_STEP_2);
+}
+#endif
+
+#endif // CONFIG_TIM_TYPE == 1
+
 /*
  * @brief Console command function for "step status".
  *
@@ -648,24 +1342,24 @@ static int32_t cmd_step_status(int32_t argc, const char** argv)
     uint32_t idx;
     struct step_state* st;
     struct motion_cmd* mc;
-    uint8_t get_idx;
-    uint8_t put_idx;
+    uint16_t get_idx;
+    uint16_t put_idx;
 
-    printc("              Num   Steps Last  Pat Step Cmd\n"
-           "ID  Position  Steps Rmain Ms    Idx Dlta Idx\n"
-           "-- ---------- ----- ----- ----- --- ---- ---\n");
+    printc("              Num   Steps Last     Pat Step Cmd\n"
+           "ID  Position  Steps Rmain Us       Idx Dlta Act\n"
+           "-- ---------- ----- ----- -------- --- ---- ---\n");
     for (idx = 0, st = step_states; idx < STEP_NUM_INSTANCES; idx++, st++) {
-        printc("%2lu %10ld %5lu %5lu %5lu %3d %4d %3u\n",
+        printc("%2lu %10ld %5lu %5lu %8lu %3d %4d %3d\n",
                idx,
                st->position,
                st->cmd_num_steps,
                st->cmd_steps_remaining,
-               st->last_step_ms,
+               st->last_step_us,
                st->drive_pattern_idx,
                st->step_delta,
-               st->active_cmd_idx);
-        get_idx = st->get_cmd_idx;
-        put_idx = st->put_cmd_idx;
+               st->cmd_active);
+        get_idx = st->cmd_ring.get_idx;
+        put_idx = st->cmd_ring.put_idx;
         while (get_idx != put_idx) {
             mc = &st->motion_cmds[get_idx];
             printc("   Q%u: %d %ld %lu\n",
@@ -673,9 +1367,24 @@ static int32_t cmd_step_status(int32_t argc, const char** argv)
                    mc->cmd_type,
                    mc->steps,
                    mc->ms);
-            get_idx += 1;
-            if (get_idx >= CMD_QUEUE_SIZE)
-                get_idx = 0;
+            get_idx = (get_idx + 1) & st->cmd_ring.mask;
+        }
+    }
+
+    if (coord.instance_mask != 0) {
+        printc("\nCoord: mask=0x%lx owner=%d ticks=%lu rmain=%lu cmd act=%d\n",
+               coord.instance_mask, coord.owner, coord.num_ticks,
+               coord.ticks_remaining, coord.cmd_active);
+        get_idx = coord.cmd_ring.get_idx;
+        put_idx = coord.cmd_ring.put_idx;
+        while (get_idx != put_idx) {
+            printc("   Q%u: ms=%lu abs_mask=0x%lx steps:", get_idx,
+                   coord.coord_cmds[get_idx].ms,
+                   coord.coord_cmds[get_idx].abs_mask);
+            for (idx = 0; idx < STEP_NUM_INSTANCES; idx++)
+                printc(" %ld", coord.coord_cmds[get_idx].steps[idx]);
+            printc("\n");
+            get_idx = (get_idx + 1) & coord.cmd_ring.mask;
         }
     }
     return 0;
@@ -704,13 +1413,42 @@ static int32_t cmd_step_test(int32_t argc, const char** argv)
                "  Free slots, usage: step test free <instance-id>\n"
                "  Energize, usage: step test energize <instance-id> <0/1>\n");
         printc("  Set mode, usage: step test mode <instance-id> <mode-idx>\n");
+        printc("  Set accel, usage: step test accel <instance-id> <steps/s^2>\n");
+        printc("  Coord move, usage: step test coord <mask> <ms> <pos> ... (one per instance in mask)\n");
         printc("Cmd types:\n"
                "  %d: N steps, M ms/step\n"
                "  %d: N steps over M ms\n"
-               "  %d: To position N over M ms\n",
+               "  %d: To position N over M ms\n"
+               "  %d: N steps, ramp up/down to M steps/sec\n",
                STEP_CMD_N_EACH_M,
                STEP_CMD_N_IN_M,
-               STEP_CMD_TO_P_IN_M);
+               STEP_CMD_TO_P_IN_M,
+               STEP_CMD_N_AT_R);
+        return 0;
+    }
+
+    if (argc >= 3 && strcasecmp(argv[2], "coord") == 0) {
+        int32_t positions[STEP_NUM_INSTANCES];
+        uint32_t mask;
+        uint32_t idx;
+        int32_t arg_idx = 5;
+
+        rc = cmd_parse_args(argc-3, argv+3, "uu+", arg_vals);
+        if (rc != 2)
+            return MOD_ERR_BAD_CMD;
+        mask = arg_vals[0].val.u;
+        for (idx = 0; idx < STEP_NUM_INSTANCES; idx++) {
+            positions[idx] = 0;
+            if ((mask & (1UL << idx)) == 0)
+                continue;
+            if (arg_idx >= argc ||
+                cmd_parse_args(1, argv+arg_idx, "i", &arg_vals[2]) != 1)
+                return MOD_ERR_BAD_CMD;
+            positions[idx] = arg_vals[2].val.i;
+            arg_idx++;
+        }
+        rc = step_queue_coord_cmd(mask, positions, arg_vals[1].val.u);
+        printc("Return code %ld\n", rc);
         return 0;
     }
 
@@ -748,6 +1486,12 @@ static int32_t cmd_step_test(int32_t argc, const char** argv)
             return MOD_ERR_BAD_CMD;
         }
         rc = step_set_drive_mode(instance_id, arg_vals[0].val.u);
+    } else if (strcasecmp(argv[2], "accel") == 0) {
+        rc = cmd_parse_args(argc-4, argv+4, "u", arg_vals);
+        if (rc != 1) {
+            return MOD_ERR_BAD_CMD;
+        }
+        rc = step_set_accel(instance_id, arg_vals[0].val.u);
     } else {
         printc("Invalid operation '%s'\n", argv[2]);
         return MOD_ERR_BAD_CMD;
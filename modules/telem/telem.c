@@ -0,0 +1,865 @@
+/*
+ * @brief Implementation of telem module.
+ *
+ * This module packs the performance measurements (PMs) of all cmd clients,
+ * plus registered duration statistics (see telem_register_dur() and
+ * telem_register_cyc_dur()), into one binary snapshot, so a host collector can
+ * sample a board with one request rather than a "<client> pm" command per
+ * module. A snapshot can be read on demand with "telem snap" (which gives raw
+ * data frames in console binary command mode, or a hex dump otherwise), or
+ * pushed periodically on a ttys or CAN instance (see "telem push").
+ *
+ * All values are little endian. A snapshot starts with this header:
+ *
+ *   version:1 flags:1 seq:2 base_seq:2 time_ms:4 num_pm_blocks:1 num_durs:1
+ *
+ * A full snapshot (no TELEM_FLAG_DELTA) then has a block for each cmd client
+ * that has PMs, in registration order, and then a block for each duration
+ * statistic:
+ *
+ *   name_len:1 name num_pms:1 value:2 (num_pms times)
+ *   name_len:1 name unit:1 samples:4 min:4 max:4 avg:4
+ *
+ * The PM values are in the same order as in the "<client> pm" output. The
+ * duration values are in us or ns (see TELEM_UNIT_xxx).
+ *
+ * A delta snapshot (TELEM_FLAG_DELTA) only has the values that changed since
+ * the snapshot with seq equal to base_seq. It has a bitmap of the PM blocks
+ * that changed, then for each of those a bitmap of the changed values followed
+ * by the values, and then the same for the duration statistics:
+ *
+ *   pm_block_bitmap num_pms:1 pm_bitmap value:2 ... (for each changed block)
+ *   dur_bitmap samples:4 min:4 max:4 avg:4 ...     (for each changed stat)
+ *
+ * Bitmaps have one bit per item, LSB of the first byte first, rounded up to
+ * whole bytes. The names are not repeated, so the host must keep the last full
+ * snapshot. Snapshots read on demand (telem_snapshot() and "telem snap") and
+ * pushed snapshots each have their own baseline and seq, so the two can be
+ * used at the same time. A host must check that base_seq is the seq of the
+ * last snapshot it got from the same source. A full snapshot is given when a
+ * delta is requested but the baseline is not valid, e.g. the first time, when
+ * a push is (re)started, or when a client has registered since.
+ *
+ * Pushed snapshots are framed. On a ttys the frame is:
+ *
+ *   TELEM_SOF len:2 snapshot (len bytes) crc16:2
+ *
+ * The CRC is CRC-16/CCITT-FALSE over len and the snapshot. On CAN, the frame
+ * without the SOF is split over as many CAN frames as needed, all with ID
+ * CONFIG_TELEM_CAN_ID. The first data byte of each is its index in the frame
+ * (0-based), with bit 7 set for the last one, followed by up to 7 bytes.
+ * The frame is sent from telem_run(), as transmit buffer space allows.
+ *
+ * The following console commands are provided:
+ * > telem status
+ * > telem snap
+ * > telem push
+ * See code for details.
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2021 Eugene R Schroeder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "console.h"
+#include "crc.h"
+#include "log.h"
+#include "module.h"
+#include "stat.h"
+#include "tmr.h"
+#include "ttys.h"
+
+#if CONFIG_CAN_1_PRESENT
+#include "can.h"
+#endif
+
+#include "telem.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define BUF_SIZE CONFIG_TELEM_BUF_SIZE
+#define MAX_DURS CONFIG_TELEM_MAX_DURS
+#define MAX_PMS CONFIG_TELEM_MAX_PMS
+
+// Push frame overhead: SOF, len, crc16
+#define FRAME_HDR_SIZE 3
+#define FRAME_OVERHEAD (FRAME_HDR_SIZE + 2)
+
+// CAN frame data bytes used for the frame, and index flag for the last frame.
+#define CAN_CHUNK_SIZE 7
+#define CAN_IDX_LAST 0x80
+
+// Max number of CAN frames queued in a call to telem_run.
+#define MAX_CAN_FRAMES_PER_RUN 8
+
+#define BITMAP_SIZE(n) (((n) + 7) / 8)
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+enum push_dest {
+    PUSH_DEST_NONE,
+    PUSH_DEST_TTYS,
+    PUSH_DEST_CAN,
+};
+
+// A registered duration statistic.
+struct dur_info {
+    const char* name;
+    struct stat_dur* stat;          // One of these is set.
+    struct stat_cyc_dur* cyc_stat;
+};
+
+// Baseline for delta snapshots, i.e. the values in the last snapshot given to
+// one consumer (on demand, or push).
+struct baseline {
+    bool valid;
+    uint16_t seq; // Seq of the next snapshot.
+    uint16_t base_seq;
+    uint32_t num_pm_blocks;
+    uint32_t num_durs;
+    uint16_t pms[MAX_PMS];
+    uint32_t dur_samples[MAX_DURS];
+};
+
+// Writer for building a snapshot, which notes if the buffer overflows.
+struct writer {
+    uint8_t* p;
+    uint8_t* end;
+    bool overflow;
+};
+
+struct state {
+    struct dur_info durs[MAX_DURS];
+    uint32_t num_durs;
+
+    // Delta snapshot baselines, for on-demand and pushed snapshots.
+    struct baseline snap_base;
+    struct baseline push_base;
+
+    // Periodic push.
+    enum push_dest push_dest;
+    int32_t push_instance;
+    uint32_t push_period_ms;
+    bool push_delta;
+    int32_t push_tmr_id;
+    bool push_due;
+    uint32_t push_frame_len;
+    uint32_t push_tx_offset;
+    uint8_t push_can_idx;
+
+    uint8_t snap_buf[BUF_SIZE];
+    uint8_t push_buf[BUF_SIZE];
+};
+
+enum telem_u16_pms {
+    CNT_SNAP_OVERFLOW,
+    CNT_PUSH,
+    CNT_PUSH_SKIPPED,
+    CNT_PUSH_ERR,
+
+    NUM_U16_PMS
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static int32_t register_dur(const char* name, struct stat_dur* stat,
+                            struct stat_cyc_dur* cyc_stat);
+static uint32_t num_pm_blocks(void);
+static int32_t build_snapshot(struct baseline* base, uint8_t* buf,
+                              uint32_t buf_size, bool delta);
+static void put_u8(struct writer* w, uint8_t val);
+static void put_u16(struct writer* w, uint16_t val);
+static void put_u32(struct writer* w, uint32_t val);
+static void put_name(struct writer* w, const char* name);
+static uint8_t* put_bitmap(struct writer* w, uint32_t num_bits);
+static void put_dur_vals(struct writer* w, const struct dur_info* dur,
+                         uint32_t samples);
+static void push_build(void);
+static void push_send(void);
+static enum tmr_cb_action push_tmr_cb(int32_t tmr_id, uint32_t user_data);
+static int32_t cmd_telem_status(int32_t argc, const char** argv);
+static int32_t cmd_telem_snap(int32_t argc, const char** argv);
+static int32_t cmd_telem_push(int32_t argc, const char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static struct state state;
+
+static int32_t log_level = LOG_DEFAULT;
+
+static uint16_t cnts_u16[NUM_U16_PMS];
+
+static const char* cnts_u16_names[NUM_U16_PMS] = {
+    "snap overflow",
+    "push",
+    "push skipped",
+    "push err",
+};
+
+// Data structure with console command info.
+static struct cmd_cmd_info cmds[] = {
+    {
+        .name = "status",
+        .func = cmd_telem_status,
+        .help = "Get module status, usage: telem status",
+    },
+    {
+        .name = "snap",
+        .func = cmd_telem_snap,
+        .help = "Get snapshot, usage: telem snap [delta]",
+    },
+    {
+        .name = "push",
+        .func = cmd_telem_push,
+        .help = "Push snapshots, usage: telem push {off|{ttys|can} <instance> "
+                "<period-ms> [delta]}",
+    },
+};
+
+// Data structure passed to cmd module for console interaction.
+static struct cmd_client_info cmd_info = {
+    .name = "telem",
+    .num_cmds = ARRAY_SIZE(cmds),
+    .cmds = cmds,
+    .log_level_ptr = &log_level,
+    .num_u16_pms = NUM_U16_PMS,
+    .u16_pms = cnts_u16,
+    .u16_pm_names = cnts_u16_names,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Initialize telem instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function initializes the telem singleton module. Generally, it should
+ * not access other modules as they might not have been initialized yet. An
+ * exception is the log module.
+ */
+int32_t telem_init(void)
+{
+    memset(&state, 0, sizeof(state));
+    state.push_tmr_id = -1;
+    return 0;
+}
+
+/*
+ * @brief Start telem instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This function starts the telem singleton module, to enter normal operation.
+ */
+int32_t telem_start(void)
+{
+    int32_t rc;
+
+    rc = cmd_register(&cmd_info);
+    if (rc < 0) {
+        log_error("telem_start: cmd error %d\n", rc);
+        return rc;
+    }
+
+    state.push_tmr_id = tmr_inst_get_cb(0, push_tmr_cb, 0,
+                                        TMR_CNTX_BASE_LEVEL);
+    if (state.push_tmr_id < 0) {
+        log_error("telem_start: tmr error %d\n", state.push_tmr_id);
+        return state.push_tmr_id;
+    }
+    return 0;
+}
+
+/*
+ * @brief Run telem instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note This function should not block.
+ *
+ * This function runs the telem singleton module, during normal operation. It
+ * builds a snapshot when a push is due, and sends it.
+ */
+int32_t telem_run(void)
+{
+    if (state.push_due) {
+        state.push_due = false;
+        if (state.push_tx_offset < state.push_frame_len)
+            INC_SAT_U16(cnts_u16[CNT_PUSH_SKIPPED]);
+        else
+            push_build();
+    }
+    if (state.push_tx_offset < state.push_frame_len)
+        push_send();
+    return 0;
+}
+
+/*
+ * @brief Register a (ms based) duration statistic.
+ *
+ * @param[in] name Name of the statistic.
+ * @param[in] stat The statistic.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note This function keeps a copy of the name and stat pointers.
+ */
+int32_t telem_register_dur(const char* name, struct stat_dur* stat)
+{
+    return register_dur(name, stat, NULL);
+}
+
+/*
+ * @brief Register a cycle based duration statistic.
+ *
+ * @param[in] name Name of the statistic.
+ * @param[in] stat The statistic.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note This function keeps a copy of the name and stat pointers.
+ */
+int32_t telem_register_cyc_dur(const char* name, struct stat_cyc_dur* stat)
+{
+    return register_dur(name, NULL, stat);
+}
+
+/*
+ * @brief Build a snapshot.
+ *
+ * @param[out] buf Where to put the snapshot.
+ * @param[in] buf_size Size of buf.
+ * @param[in] delta Build a delta snapshot, if the baseline is valid.
+ *
+ * @return Length of the snapshot (> 0), else a "MOD_ERR" value (< 0). See code
+ *         for details.
+ *
+ * The snapshot becomes the baseline for the next delta snapshot read on
+ * demand. Pushed snapshots have a separate baseline.
+ */
+int32_t telem_snapshot(uint8_t* buf, uint32_t buf_size, bool delta)
+{
+    return build_snapshot(&state.snap_base, buf, buf_size, delta);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Build a snapshot against a baseline.
+ *
+ * @param[in,out] base The consumer's baseline.
+ * @param[out] buf Where to put the snapshot.
+ * @param[in] buf_size Size of buf.
+ * @param[in] delta Build a delta snapshot, if the baseline is valid.
+ *
+ * @return Length of the snapshot (> 0), else a "MOD_ERR" value (< 0). See code
+ *         for details.
+ *
+ * The snapshot becomes the new baseline.
+ */
+static int32_t build_snapshot(struct baseline* base, uint8_t* buf,
+                              uint32_t buf_size, bool delta)
+{
+    struct writer w = { .p = buf, .end = buf + buf_size, .overflow = false };
+    const struct cmd_client_info* ci;
+    const struct dur_info* dur;
+    uint32_t num_blocks = num_pm_blocks();
+    uint32_t client_idx;
+    uint32_t block_idx = 0;
+    uint32_t pm_idx = 0;
+    uint32_t idx;
+    uint32_t num_pms;
+    uint32_t samples;
+    uint8_t* block_bitmap;
+    uint8_t* pm_bitmap;
+    uint8_t* block_start;
+    uint16_t val;
+    bool changed;
+
+    if (buf == NULL)
+        return MOD_ERR_ARG;
+
+    if (!base->valid || num_blocks != base->num_pm_blocks ||
+        state.num_durs != base->num_durs)
+        delta = false;
+
+    put_u8(&w, TELEM_VERSION);
+    put_u8(&w, delta ? TELEM_FLAG_DELTA : 0);
+    put_u16(&w, base->seq);
+    put_u16(&w, base->base_seq);
+    put_u32(&w, tmr_get_ms());
+    put_u8(&w, num_blocks);
+    put_u8(&w, state.num_durs);
+
+    // PM blocks.
+    block_bitmap = delta ? put_bitmap(&w, num_blocks) : NULL;
+    for (client_idx = 0; (ci = cmd_get_client(client_idx)) != NULL;
+         client_idx++) {
+        if (ci->num_u16_pms <= 0 || ci->u16_pms == NULL)
+            continue;
+        num_pms = ci->num_u16_pms > UINT8_MAX ? UINT8_MAX : ci->num_u16_pms;
+        if (!delta) {
+            put_name(&w, ci->name);
+            put_u8(&w, num_pms);
+            for (idx = 0; idx < num_pms; idx++, pm_idx++) {
+                val = ci->u16_pms[idx];
+                put_u16(&w, val);
+                if (pm_idx < MAX_PMS)
+                    base->pms[pm_idx] = val;
+            }
+        } else {
+            block_start = w.p;
+            put_u8(&w, num_pms);
+            pm_bitmap = put_bitmap(&w, num_pms);
+            changed = false;
+            for (idx = 0; idx < num_pms; idx++, pm_idx++) {
+                val = ci->u16_pms[idx];
+                if (pm_idx < MAX_PMS && val == base->pms[pm_idx])
+                    continue;
+                if (pm_idx < MAX_PMS)
+                    base->pms[pm_idx] = val;
+                put_u16(&w, val);
+                if (pm_bitmap != NULL)
+                    pm_bitmap[idx / 8] |= 1 << (idx % 8);
+                changed = true;
+            }
+            if (changed) {
+                if (block_bitmap != NULL)
+                    block_bitmap[block_idx / 8] |= 1 << (block_idx % 8);
+            } else if (!w.overflow) {
+                // Nothing changed, so drop the block.
+                w.p = block_start;
+            }
+        }
+        block_idx++;
+    }
+
+    // Duration statistic blocks.
+    block_bitmap = delta ? put_bitmap(&w, state.num_durs) : NULL;
+    for (idx = 0, dur = state.durs; idx < state.num_durs; idx++, dur++) {
+        samples = dur->stat != NULL ? dur->stat->samples :
+            dur->cyc_stat->samples;
+        if (!delta) {
+            put_name(&w, dur->name);
+            put_u8(&w, dur->stat != NULL ? TELEM_UNIT_US : TELEM_UNIT_NS);
+            put_dur_vals(&w, dur, samples);
+        } else if (samples != base->dur_samples[idx]) {
+            put_dur_vals(&w, dur, samples);
+            if (block_bitmap != NULL)
+                block_bitmap[idx / 8] |= 1 << (idx % 8);
+        }
+        base->dur_samples[idx] = samples;
+    }
+
+    base->base_seq = base->seq++;
+    base->num_pm_blocks = num_blocks;
+    base->num_durs = state.num_durs;
+    if (w.overflow) {
+        // The baseline might have been partially updated.
+        base->valid = false;
+        INC_SAT_U16(cnts_u16[CNT_SNAP_OVERFLOW]);
+        return MOD_ERR_RESOURCE;
+    }
+    base->valid = true;
+    return w.p - buf;
+}
+
+
+/*
+ * @brief Register a duration statistic.
+ *
+ * @param[in] name Name of the statistic.
+ * @param[in] stat The statistic, if ms based, else NULL.
+ * @param[in] cyc_stat The statistic, if cycle based, else NULL.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+static int32_t register_dur(const char* name, struct stat_dur* stat,
+                            struct stat_cyc_dur* cyc_stat)
+{
+    struct dur_info* dur;
+
+    if (name == NULL || (stat == NULL && cyc_stat == NULL))
+        return MOD_ERR_ARG;
+    if (state.num_durs >= MAX_DURS)
+        return MOD_ERR_RESOURCE;
+
+    dur = &state.durs[state.num_durs++];
+    dur->name = name;
+    dur->stat = stat;
+    dur->cyc_stat = cyc_stat;
+    return 0;
+}
+
+/*
+ * @brief Get the number of PM blocks in a snapshot.
+ *
+ * @return Number of cmd clients that have PMs.
+ */
+static uint32_t num_pm_blocks(void)
+{
+    const struct cmd_client_info* ci;
+    uint32_t client_idx;
+    uint32_t num_blocks = 0;
+
+    for (client_idx = 0; (ci = cmd_get_client(client_idx)) != NULL;
+         client_idx++) {
+        if (ci->num_u16_pms > 0 && ci->u16_pms != NULL)
+            num_blocks++;
+    }
+    return num_blocks > UINT8_MAX ? UINT8_MAX : num_blocks;
+}
+
+/*
+ * @brief Put values in a snapshot (little endian).
+ *
+ * @param[in] w The snapshot writer.
+ * @param[in] val The value.
+ */
+static void put_u8(struct writer* w, uint8_t val)
+{
+    if (w->p >= w->end) {
+        w->overflow = true;
+        return;
+    }
+    *w->p++ = val;
+}
+
+static void put_u16(struct writer* w, uint16_t val)
+{
+    put_u8(w, val);
+    put_u8(w, val >> 8);
+}
+
+static void put_u32(struct writer* w, uint32_t val)
+{
+    put_u16(w, val);
+    put_u16(w, val >> 16);
+}
+
+/*
+ * @brief Put a name in a snapshot, with its length first.
+ *
+ * @param[in] w The snapshot writer.
+ * @param[in] name The name.
+ */
+static void put_name(struct writer* w, const char* name)
+{
+    uint32_t len = strlen(name);
+
+    if (len > UINT8_MAX)
+        len = UINT8_MAX;
+    put_u8(w, len);
+    while (len-- > 0)
+        put_u8(w, *name++);
+}
+
+/*
+ * @brief Put an empty bitmap in a snapshot.
+ *
+ * @param[in] w The snapshot writer.
+ * @param[in] num_bits Number of bits in the bitmap.
+ *
+ * @return Pointer to the bitmap, so bits can be set later, or NULL if the
+ *         buffer overflowed.
+ */
+static uint8_t* put_bitmap(struct writer* w, uint32_t num_bits)
+{
+    uint8_t* bitmap = w->p;
+    uint32_t idx;
+
+    for (idx = 0; idx < BITMAP_SIZE(num_bits); idx++)
+        put_u8(w, 0);
+    return w->overflow ? NULL : bitmap;
+}
+
+/*
+ * @brief Put the values of a duration statistic in a snapshot.
+ *
+ * @param[in] w The snapshot writer.
+ * @param[in] dur The statistic.
+ * @param[in] samples The number of samples (read by the caller).
+ */
+static void put_dur_vals(struct writer* w, const struct dur_info* dur,
+                         uint32_t samples)
+{
+    put_u32(w, samples);
+    if (samples == 0) {
+        put_u32(w, 0);
+        put_u32(w, 0);
+        put_u32(w, 0);
+    } else if (dur->stat != NULL) {
+        put_u32(w, dur->stat->min * 1000);
+        put_u32(w, dur->stat->max * 1000);
+        put_u32(w, stat_dur_avg_us(dur->stat));
+    } else {
+        put_u32(w, stat_cyc_to_ns(dur->cyc_stat->min));
+        put_u32(w, stat_cyc_to_ns(dur->cyc_stat->max));
+        put_u32(w, stat_cyc_dur_avg_ns(dur->cyc_stat));
+    }
+}
+
+/*
+ * @brief Build a snapshot frame to push.
+ */
+static void push_build(void)
+{
+    uint8_t* frame = state.push_buf;
+    int32_t len;
+    uint16_t crc;
+
+    len = build_snapshot(&state.push_base, &frame[FRAME_HDR_SIZE],
+                         BUF_SIZE - FRAME_OVERHEAD, state.push_delta);
+    if (len < 0) {
+        INC_SAT_U16(cnts_u16[CNT_PUSH_ERR]);
+        return;
+    }
+    frame[0] = TELEM_SOF;
+    frame[1] = len;
+    frame[2] = len >> 8;
+    crc = crc16_update(CRC16_INIT, &frame[1], len + 2);
+    frame[FRAME_HDR_SIZE + len] = crc;
+    frame[FRAME_HDR_SIZE + len + 1] = crc >> 8;
+
+    state.push_frame_len = len + FRAME_OVERHEAD;
+    if (state.push_dest == PUSH_DEST_CAN) {
+        // The SOF is not needed, as CAN has its own framing.
+        state.push_tx_offset = 1;
+        state.push_can_idx = 0;
+    } else {
+        state.push_tx_offset = 0;
+    }
+    INC_SAT_U16(cnts_u16[CNT_PUSH]);
+}
+
+/*
+ * @brief Send as much of the snapshot frame as possible.
+ */
+static void push_send(void)
+{
+    uint32_t len = state.push_frame_len - state.push_tx_offset;
+    int32_t rc = 0;
+
+    if (state.push_dest == PUSH_DEST_TTYS) {
+        rc = ttys_tx_space(state.push_instance);
+        if (rc > 0) {
+            if (len > rc)
+                len = rc;
+            rc = ttys_write(state.push_instance,
+                            (const char*)&state.push_buf[state.push_tx_offset],
+                            len);
+            if (rc > 0)
+                state.push_tx_offset += rc;
+        }
+    }
+#if CONFIG_CAN_1_PRESENT
+    else if (state.push_dest == PUSH_DEST_CAN) {
+        struct can_msg msg = { .id = CONFIG_TELEM_CAN_ID };
+        uint32_t num_frames;
+
+        for (num_frames = 0; num_frames < MAX_CAN_FRAMES_PER_RUN &&
+                 state.push_tx_offset < state.push_frame_len; num_frames++) {
+            len = state.push_frame_len - state.push_tx_offset;
+            if (len > CAN_CHUNK_SIZE)
+                len = CAN_CHUNK_SIZE;
+            msg.len = len + 1;
+            msg.data[0] = state.push_can_idx & ~CAN_IDX_LAST;
+            if (state.push_tx_offset + len >= state.push_frame_len)
+                msg.data[0] |= CAN_IDX_LAST;
+            memcpy(&msg.data[1], &state.push_buf[state.push_tx_offset], len);
+            rc = can_tx(state.push_instance, &msg);
+            if (rc != 0)
+                break;
+            state.push_tx_offset += len;
+            state.push_can_idx++;
+        }
+        if (rc == MOD_ERR_BUF_OVERRUN)
+            rc = 0;
+    }
+#endif
+    else {
+        rc = MOD_ERR_STATE;
+    }
+
+    if (rc < 0) {
+        // Drop the rest of the frame.
+        INC_SAT_U16(cnts_u16[CNT_PUSH_ERR]);
+        state.push_tx_offset = state.push_frame_len;
+    }
+}
+
+/*
+ * @brief Timer callback for periodic push.
+ *
+ * @param[in] tmr_id Timer ID.
+ * @param[in] user_data Not used.
+ *
+ * @return TMR_CB_RESTART, so the timer runs periodically.
+ */
+static enum tmr_cb_action push_tmr_cb(int32_t tmr_id, uint32_t user_data)
+{
+    state.push_due = true;
+    return TMR_CB_RESTART;
+}
+
+/*
+ * @brief Console command function for "telem status".
+ *
+ * @param[in] argc Number of arguments, including "telem"
+ * @param[in] argv Argument values, including "telem"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: telem status
+ */
+static int32_t cmd_telem_status(int32_t argc, const char** argv)
+{
+    uint32_t idx;
+
+    printc("pm_blocks=%lu durs=%lu\n", num_pm_blocks(), state.num_durs);
+    printc("snap baseline: seq=%u base_seq=%u valid=%d\n", state.snap_base.seq,
+           state.snap_base.base_seq, state.snap_base.valid);
+    printc("push baseline: seq=%u base_seq=%u valid=%d\n", state.push_base.seq,
+           state.push_base.base_seq, state.push_base.valid);
+    for (idx = 0; idx < state.num_durs; idx++)
+        printc("  dur %lu: %s\n", idx, state.durs[idx].name);
+    printc("push: dest=%d instance=%ld period_ms=%lu delta=%d frame_len=%lu "
+           "tx_offset=%lu\n", state.push_dest, state.push_instance,
+           state.push_period_ms, state.push_delta, state.push_frame_len,
+           state.push_tx_offset);
+    return 0;
+}
+
+/*
+ * @brief Console command function for "telem snap".
+ *
+ * @param[in] argc Number of arguments, including "telem"
+ * @param[in] argv Argument values, including "telem"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: telem snap [delta]
+ *
+ * The snapshot is output with console_data_print(), so is sent as raw data in
+ * console binary command mode.
+ */
+static int32_t cmd_telem_snap(int32_t argc, const char** argv)
+{
+    bool delta = false;
+    int32_t len;
+
+    if (argc == 3 && strcasecmp(argv[2], "delta") == 0)
+        delta = true;
+    else if (argc != 2)
+        return MOD_ERR_BAD_CMD;
+
+    len = telem_snapshot(state.snap_buf, BUF_SIZE, delta);
+    if (len < 0) {
+        printc("Snapshot error %ld\n", len);
+        return len;
+    }
+    return console_data_print(state.snap_buf, len);
+}
+
+/*
+ * @brief Console command function for "telem push".
+ *
+ * @param[in] argc Number of arguments, including "telem"
+ * @param[in] argv Argument values, including "telem"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: telem push {off|{ttys|can} <instance> <period-ms> [delta]}
+ */
+static int32_t cmd_telem_push(int32_t argc, const char** argv)
+{
+    struct cmd_arg_val arg_vals[3];
+    enum push_dest dest;
+    int32_t num_args;
+
+    if (argc < 3)
+        return MOD_ERR_BAD_CMD;
+
+    // Stop any push in progress.
+    tmr_inst_start(state.push_tmr_id, 0);
+    state.push_dest = PUSH_DEST_NONE;
+    state.push_due = false;
+    state.push_tx_offset = state.push_frame_len;
+
+    if (strcasecmp(argv[2], "off") == 0)
+        return argc == 3 ? 0 : MOD_ERR_BAD_CMD;
+
+    if (strcasecmp(argv[2], "ttys") == 0) {
+        dest = PUSH_DEST_TTYS;
+#if CONFIG_CAN_1_PRESENT
+    } else if (strcasecmp(argv[2], "can") == 0) {
+        dest = PUSH_DEST_CAN;
+#endif
+    } else {
+        printc("Invalid destination '%s'\n", argv[2]);
+        return MOD_ERR_BAD_CMD;
+    }
+
+    num_args = cmd_parse_args(argc-3, argv+3, "uu[s]", arg_vals);
+    if (num_args < 2 || arg_vals[1].val.u == 0)
+        return MOD_ERR_BAD_CMD;
+    if ((dest == PUSH_DEST_TTYS && arg_vals[0].val.u >= TTYS_NUM_INSTANCES)
+#if CONFIG_CAN_1_PRESENT
+        || (dest == PUSH_DEST_CAN && arg_vals[0].val.u >= CAN_NUM_INSTANCES)
+#endif
+        ) {
+        printc("Invalid instance\n");
+        return MOD_ERR_BAD_INSTANCE;
+    }
+    if (num_args == 3 && strcasecmp(arg_vals[2].val.s, "delta") != 0)
+        return MOD_ERR_BAD_CMD;
+
+    state.push_instance = arg_vals[0].val.u;
+    state.push_period_ms = arg_vals[1].val.u;
+    state.push_delta = num_args == 3;
+    state.push_dest = dest;
+
+    // The receiver might be new, so start with a full snapshot.
+    state.push_base.valid = false;
+    return tmr_inst_start(state.push_tmr_id, state.push_period_ms);
+}
@@ -8,6 +8,25 @@
  * ms). The module can can be queried at any time for the last measurement,
  * including the "age" (in ms) of that measurement.
  *
+ * There are two ways of operating the sensor (see mode in struct tmphm_cfg):
+ * - Single shot mode (the default, see CONFIG_TMPHM_DFLT_MODE). For each
+ *   sample, a measurement command is sent, and after the measurement time the
+ *   result is read.
+ * - Periodic (or ART) mode. The sensor is put in periodic acquisition mode
+ *   once, and then for each sample only a fetch (write fetch command, repeated
+ *   start, read result) is needed. The fetches of all periodic mode instances
+ *   are submitted together from one module timer, so the i2c module sends
+ *   them as one back-to-back burst per bus. The results are processed in
+ *   tmphm_run().
+ *
+ * Each instance keeps a history of the last TMPHM_HIST_SIZE samples, with
+ * timestamps. For each of TMPHM_NUM_STAT_WINDOWS windows (a number of most
+ * recent samples, see struct tmphm_cfg), the min, max, and mean are updated
+ * incrementally as samples are added, so tmphm_get_stats() is O(1). The mean
+ * uses running sums, and the min/max use monotonic queues of sample numbers.
+ * tmphm_get_hist() provides the history, optionally decimated (averaging
+ * groups of samples).
+ *
  * The following console commands are provided:
  * > tmphm status
  * > tmphm pm
@@ -44,8 +63,10 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "bench.h"
 #include "cmd.h"
 #include "console.h"
+#include "crc.h"
 #include "i2c.h"
 #include "log.h"
 #include "lwl.h"
@@ -62,6 +83,16 @@
 #define LWL_BASE_ID 20
 #define LWL_NUM 10
 
+// After this many consecutive failed fetches in periodic mode, the periodic
+// mode command is sent again (e.g. in case the sensor was reset).
+#define MAX_CONSEC_FETCH_FAILS 3
+
+#define HIST_MASK (TMPHM_HIST_SIZE - 1)
+
+#if (TMPHM_HIST_SIZE & HIST_MASK) != 0 || TMPHM_HIST_SIZE > 0x8000
+    #error CONFIG_TMPHM_HIST_SIZE must be a power of 2 (max 0x8000)
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -76,6 +107,30 @@ enum states {
 
 #define I2C_MSG_BFR_LEN 6
 
+// Sample values tracked by the statistics.
+enum stat_vals {
+    STAT_VAL_TEMP,
+    STAT_VAL_HUM,
+
+    NUM_STAT_VALS
+};
+
+// Monotonic queue of sample numbers (low 16 bits), for the min or max of one
+// value over one window. The values of the samples in the queue are in
+// increasing (min) or decreasing (max) order, so the front is the min/max.
+struct mono_q {
+    uint16_t seqs[TMPHM_HIST_SIZE];
+    uint16_t head;
+    uint16_t len;
+};
+
+// Running statistics for one window.
+struct stat_window {
+    int32_t sums[NUM_STAT_VALS];
+    struct mono_q min_q[NUM_STAT_VALS];
+    struct mono_q max_q[NUM_STAT_VALS];
+};
+
 // Per-instance tmphm state information.
 struct tmphm_state {
     struct tmphm_cfg cfg;
@@ -86,6 +141,22 @@ struct tmphm_state {
     uint8_t msg_bfr[I2C_MSG_BFR_LEN];
     bool got_meas;
     enum states state;
+
+    // Periodic/ART mode.
+    struct i2c_xact xact;
+    const uint8_t* periodic_cmd;
+    uint32_t last_fetch_ms;
+    volatile bool xact_pending; // Submitted, completion not yet reported.
+    volatile bool xact_done;    // Completed, to be processed by tmphm_run().
+    bool started;
+    bool periodic_on;
+    uint8_t consec_fetch_fails;
+
+    // Sample history and statistics. num_samples counts all samples ever
+    // added, so the newest is at index (num_samples - 1) & HIST_MASK.
+    struct tmphm_sample hist[TMPHM_HIST_SIZE];
+    uint32_t num_samples;
+    struct stat_window windows[TMPHM_NUM_STAT_WINDOWS];
 };
 
 // Performance measurements for i2c. Currently these are common to all
@@ -99,6 +170,9 @@ enum tmphm_u16_pms {
     CNT_READ_OP_FAIL,
     CNT_TASK_OVERRUN,
     CNT_CRC_FAIL,
+    CNT_PERIODIC_START_FAIL,
+    CNT_FETCH_FAIL,
+    CNT_FETCH_OVERRUN,
 
     NUM_U16_PMS
 };
@@ -108,9 +182,22 @@ enum tmphm_u16_pms {
 ////////////////////////////////////////////////////////////////////////////////
 
 static enum tmr_cb_action tmr_callback(int32_t tmr_id, uint32_t user_data);
+static enum tmr_cb_action batch_tmr_callback(int32_t tmr_id,
+                                             uint32_t user_data);
+static void xact_callback(struct i2c_xact* xact);
+static void periodic_run(struct tmphm_state* st);
+static const uint8_t* get_periodic_cmd(const struct tmphm_cfg* cfg);
+static void process_meas(struct tmphm_state* st, const uint8_t* msg);
+static void hist_add(struct tmphm_state* st);
+static int32_t sample_val(struct tmphm_state* st, uint32_t seq,
+                          enum stat_vals val);
+static void mono_q_add(struct mono_q* q, struct tmphm_state* st, uint32_t seq,
+                       uint32_t window, enum stat_vals val, bool is_max);
 static int32_t cmd_tmphm_status(int32_t argc, const char** argv);
 static int32_t cmd_tmphm_test(int32_t argc, const char** argv);
-static uint8_t crc8(const uint8_t *data, int len);
+#if CONFIG_BENCH_PRESENT
+static int32_t bench_crc8(uint32_t num_ops);
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -118,6 +205,11 @@ static uint8_t crc8(const uint8_t *data, int len);
 
 static struct tmphm_state tmphm_states[TMPHM_NUM_INSTANCES];
 
+// Timer for the batched fetches of periodic mode instances. It runs at the
+// smallest sample time of these instances.
+static int32_t batch_tmr_id = -1;
+static uint32_t batch_period_ms;
+
 static int32_t log_level = LOG_INFO;
 
 // Storage for performance measurements.
@@ -132,6 +224,9 @@ static const char* cnts_u16_names[NUM_U16_PMS] = {
     "read op fail",
     "task overrun",
     "crc error",
+    "periodic start fail",
+    "fetch fail",
+    "fetch overrun",
 };
 
 // Data structure with console command info.
@@ -159,8 +254,46 @@ static struct cmd_client_info cmd_info = {
     .u16_pm_names = cnts_u16_names,
 };
 
+#if CONFIG_BENCH_PRESENT
+// Data structure passed to bench module.
+static const struct bench_info benches[] = {
+    {
+        .name = "crc8",
+        .func = bench_crc8,
+        .dflt_num_ops = 100000,
+    },
+};
+
+static const struct bench_client_info bench_info = {
+    .name = "tmphm",
+    .num_benches = ARRAY_SIZE(benches),
+    .benches = benches,
+};
+
+// Benchmark results are stored here so they aren't optimized away.
+static volatile uint8_t bench_sink;
+#endif
+
 const char sensor_i2c_cmd[2] = {0x2c, 0x06 };
 
+// Sensor commands for periodic/ART mode, high repeatability (see datasheet
+// section 4.5 to 4.7).
+static const uint8_t sensor_fetch_cmd[2] = {0xe0, 0x00};
+static const uint8_t sensor_art_cmd[2] = {0x2b, 0x32};
+
+// Periodic mode commands, by measurement period. The slowest rate that gives
+// a new measurement for each sample is used.
+static const struct {
+    uint32_t period_ms;
+    uint8_t cmd[2];
+} sensor_periodic_cmds[] = {
+    { 2000, {0x20, 0x32} }, // 0.5 mps
+    { 1000, {0x21, 0x30} }, // 1 mps
+    {  500, {0x22, 0x36} }, // 2 mps
+    {  250, {0x23, 0x34} }, // 4 mps
+    {  100, {0x27, 0x37} }, // 10 mps
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -181,11 +314,21 @@ int32_t tmphm_get_def_cfg(enum tmphm_instance_id instance_id, struct tmphm_cfg*
     if (instance_id == TMPHM_INSTANCE_1) {
         cfg->i2c_instance_id = CONFIG_TMPHM_1_DFLT_I2C_INSTANCE;
         cfg->i2c_addr = CONFIG_TMPHM_1_DFLT_I2C_ADDR;
+#if CONFIG_TMPHM_2_PRESENT
+    } else if (instance_id == TMPHM_INSTANCE_2) {
+        cfg->i2c_instance_id = CONFIG_TMPHM_2_DFLT_I2C_INSTANCE;
+        cfg->i2c_addr = CONFIG_TMPHM_2_DFLT_I2C_ADDR;
+#endif
     } else {
         return MOD_ERR_ARG;
     }
     cfg->sample_time_ms = CONFIG_TMPHM_DFLT_SAMPLE_TIME_MS;
     cfg->meas_time_ms = CONFIG_TMPHM_DFLT_MEAS_TIME_MS;
+    cfg->mode = CONFIG_TMPHM_DFLT_MODE;
+    cfg->stat_window_samples[0] = CONFIG_TMPHM_DFLT_STAT_WINDOW_1;
+#if TMPHM_NUM_STAT_WINDOWS > 1
+    cfg->stat_window_samples[1] = CONFIG_TMPHM_DFLT_STAT_WINDOW_2;
+#endif
     return 0;
 }
 /*
@@ -202,9 +345,17 @@ int32_t tmphm_get_def_cfg(enum tmphm_instance_id instance_id, struct tmphm_cfg*
  */
 int32_t tmphm_init(enum tmphm_instance_id instance_id, struct tmphm_cfg* cfg)
 {
+    uint32_t idx;
+
     if (instance_id >= TMPHM_NUM_INSTANCES)
         return MOD_ERR_BAD_INSTANCE;
 
+    for (idx = 0; idx < TMPHM_NUM_STAT_WINDOWS; idx++) {
+        if (cfg->stat_window_samples[idx] == 0 ||
+            cfg->stat_window_samples[idx] > TMPHM_HIST_SIZE)
+            return MOD_ERR_ARG;
+    }
+
     tmphm_states[instance_id].cfg = *cfg;
     return 0;
 }
@@ -232,12 +383,43 @@ int32_t tmphm_start(enum tmphm_instance_id instance_id)
         return rc;
     }
 
+#if CONFIG_BENCH_PRESENT
+    rc = bench_register(&bench_info);
+    if (rc < 0) {
+        log_error("tmphm_start: bench error %d\n", rc);
+        return rc;
+    }
+#endif
+
     st = &tmphm_states[instance_id];
 
-    st->tmr_id = tmr_inst_get_cb(st->cfg.sample_time_ms, tmr_callback,
-                                 (uint32_t)instance_id, TMR_CNTX_BASE_LEVEL);
-    if (st->tmr_id < 0)
-        return st->tmr_id;
+    if (st->cfg.mode == TMPHM_MODE_SINGLE_SHOT) {
+        st->tmr_id = tmr_inst_get_cb(st->cfg.sample_time_ms, tmr_callback,
+                                     (uint32_t)instance_id,
+                                     TMR_CNTX_BASE_LEVEL);
+        if (st->tmr_id < 0)
+            return st->tmr_id;
+    } else {
+        st->periodic_cmd = get_periodic_cmd(&st->cfg);
+        st->xact.dest_addr = st->cfg.i2c_addr;
+        st->xact.rd_bfr = st->msg_bfr;
+        st->xact.cb = xact_callback;
+        st->xact.user_data = (uint32_t)instance_id;
+        st->tmr_id = -1;
+
+        if (batch_tmr_id < 0) {
+            batch_tmr_id = tmr_inst_get_cb(st->cfg.sample_time_ms,
+                                           batch_tmr_callback, 0,
+                                           TMR_CNTX_BASE_LEVEL);
+            if (batch_tmr_id < 0)
+                return batch_tmr_id;
+            batch_period_ms = st->cfg.sample_time_ms;
+        } else if (st->cfg.sample_time_ms < batch_period_ms) {
+            batch_period_ms = st->cfg.sample_time_ms;
+            tmr_inst_start(batch_tmr_id, batch_period_ms);
+        }
+        st->started = true;
+    }
 
     #if CONFIG_TMPHM_WDG_MS > 0 && defined CONFIG_TMPHM_WDG_ID
 
@@ -273,6 +455,11 @@ int32_t tmphm_run(enum tmphm_instance_id instance_id)
 
     st = &tmphm_states[instance_id];
 
+    if (st->cfg.mode != TMPHM_MODE_SINGLE_SHOT) {
+        periodic_run(st);
+        return 0;
+    }
+
     switch (st->state) {
         case STATE_IDLE:
             break;
@@ -329,28 +516,7 @@ int32_t tmphm_run(enum tmphm_instance_id instance_id)
             rc = i2c_get_op_status(st->cfg.i2c_instance_id);
             if (rc != MOD_ERR_OP_IN_PROG) {
                 if (rc == 0) {
-                    const uint32_t divisor = 65535;
-                    uint8_t* msg = st->msg_bfr;
-
-                    if (crc8(&msg[0], 2) != msg[2] ||
-                        crc8(&msg[3], 2) != msg[5]) {
-                        INC_SAT_U16(cnts_u16[CNT_CRC_FAIL]);
-                    } else {
-                        LWL("Got good tmphm measurement", 0);
-                        wdg_feed(CONFIG_TMPHM_WDG_ID);
-                        int32_t temp = (msg[0] << 8) + msg[1];
-                        uint32_t hum = (msg[3] << 8) + msg[4];
-                        temp = -450 +
-                            (1750 * temp + divisor/2) / divisor;
-                        hum = (1000 * hum + divisor/2) / divisor;
-                        st->last_meas.temp_deg_c_x10 = temp;
-                        st->last_meas.rh_percent_x10 = hum;
-                        st->last_meas_ms = tmr_get_ms();
-                        st->got_meas = true;
-                        log_info("temp=%ld degC*10 hum=%d %%*10\n",
-                                 temp, hum);
-                    }
-                    
+                    process_meas(st, st->msg_bfr);
                 } else {
                     LWL("i2c_get_op_status() for tmphm fails rc=%d", 4, LWL_4(rc));
                     INC_SAT_U16(cnts_u16[CNT_READ_OP_FAIL]);
@@ -393,10 +559,355 @@ int32_t tmphm_get_last_meas(enum tmphm_instance_id instance_id,
     return 0;
 }
 
+/*
+ * @brief Get statistics over a window of recent samples.
+ *
+ * @param[in]  instance_id Identifies the tmphm instance.
+ * @param[in]  window_idx Identifies the window (see struct tmphm_cfg).
+ * @param[out] stats The statistics.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ */
+int32_t tmphm_get_stats(enum tmphm_instance_id instance_id,
+                        uint32_t window_idx, struct tmphm_stats* stats)
+{
+    struct tmphm_state* st;
+    struct stat_window* w;
+    uint32_t num;
+
+    if (instance_id >= TMPHM_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (window_idx >= TMPHM_NUM_STAT_WINDOWS || stats == NULL)
+        return MOD_ERR_ARG;
+
+    st = &tmphm_states[instance_id];
+    if (st->num_samples == 0)
+        return MOD_ERR_UNAVAIL;
+
+    w = &st->windows[window_idx];
+    num = st->cfg.stat_window_samples[window_idx];
+    if (num > st->num_samples)
+        num = st->num_samples;
+
+    stats->num_samples = num;
+    stats->min.temp_deg_c_x10 = sample_val(
+        st, w->min_q[STAT_VAL_TEMP].seqs[w->min_q[STAT_VAL_TEMP].head],
+        STAT_VAL_TEMP);
+    stats->min.rh_percent_x10 = sample_val(
+        st, w->min_q[STAT_VAL_HUM].seqs[w->min_q[STAT_VAL_HUM].head],
+        STAT_VAL_HUM);
+    stats->max.temp_deg_c_x10 = sample_val(
+        st, w->max_q[STAT_VAL_TEMP].seqs[w->max_q[STAT_VAL_TEMP].head],
+        STAT_VAL_TEMP);
+    stats->max.rh_percent_x10 = sample_val(
+        st, w->max_q[STAT_VAL_HUM].seqs[w->max_q[STAT_VAL_HUM].head],
+        STAT_VAL_HUM);
+    stats->mean.temp_deg_c_x10 = w->sums[STAT_VAL_TEMP] / (int32_t)num;
+    stats->mean.rh_percent_x10 = w->sums[STAT_VAL_HUM] / (int32_t)num;
+    return 0;
+}
+
+/*
+ * @brief Get sample history, optionally decimated.
+ *
+ * @param[in]  instance_id Identifies the tmphm instance.
+ * @param[in]  decim Decimation factor. Each returned sample is the mean of
+ *                   this many consecutive samples, with the time of the last
+ *                   of them. Use 1 for no decimation.
+ * @param[out] samples The samples, oldest first.
+ * @param[in]  max_samples Maximum number of samples to return.
+ *
+ * @return Number of samples returned (>= 0), else a "MOD_ERR" value (< 0).
+ *         See code for details.
+ *
+ * The most recent samples are returned, in whole groups of decim samples.
+ */
+int32_t tmphm_get_hist(enum tmphm_instance_id instance_id, uint32_t decim,
+                       struct tmphm_sample* samples, uint32_t max_samples)
+{
+    struct tmphm_state* st;
+    uint32_t avail;
+    uint32_t num_out;
+    uint32_t seq;
+    uint32_t out_idx;
+    uint32_t idx;
+
+    if (instance_id >= TMPHM_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (decim == 0 || samples == NULL)
+        return MOD_ERR_ARG;
+
+    st = &tmphm_states[instance_id];
+    avail = st->num_samples < TMPHM_HIST_SIZE ? st->num_samples :
+        TMPHM_HIST_SIZE;
+    num_out = avail / decim;
+    if (num_out > max_samples)
+        num_out = max_samples;
+
+    seq = st->num_samples - num_out * decim;
+    for (out_idx = 0; out_idx < num_out; out_idx++) {
+        int32_t temp_sum = 0;
+        int32_t hum_sum = 0;
+        struct tmphm_sample* s = NULL;
+
+        for (idx = 0; idx < decim; idx++, seq++) {
+            s = &st->hist[seq & HIST_MASK];
+            temp_sum += s->meas.temp_deg_c_x10;
+            hum_sum += s->meas.rh_percent_x10;
+        }
+        samples[out_idx].ms = s->ms;
+        samples[out_idx].meas.temp_deg_c_x10 = temp_sum / (int32_t)decim;
+        samples[out_idx].meas.rh_percent_x10 = hum_sum / (int32_t)decim;
+    }
+    return num_out;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
 
+/*
+ * @brief Process a transaction completion in periodic/ART mode.
+ *
+ * @param[in] st Instance state.
+ */
+static void periodic_run(struct tmphm_state* st)
+{
+    if (!st->xact_done)
+        return;
+    st->xact_done = false;
+
+    if (!st->periodic_on) {
+        // Completion of the periodic mode command.
+        if (st->xact.rc == 0) {
+            st->periodic_on = true;
+            st->consec_fetch_fails = 0;
+        } else {
+            LWL("tmphm periodic start fails err=%d", 1,
+                LWL_1(st->xact.error));
+            INC_SAT_U16(cnts_u16[CNT_PERIODIC_START_FAIL]);
+        }
+        return;
+    }
+
+    if (st->xact.rc == 0) {
+        st->consec_fetch_fails = 0;
+        process_meas(st, st->msg_bfr);
+    } else {
+        // The sensor NACKs the read if there is no new measurement.
+        LWL("tmphm fetch fails err=%d", 1, LWL_1(st->xact.error));
+        INC_SAT_U16(cnts_u16[CNT_FETCH_FAIL]);
+        if (++st->consec_fetch_fails >= MAX_CONSEC_FETCH_FAILS)
+            st->periodic_on = false;
+    }
+}
+
+/*
+ * @brief Timer callback for periodic/ART mode fetches.
+ *
+ * @param[in] tmr_id The timer ID (not used).
+ * @param[in] user_data User data for the timer (not used).
+ *
+ * @return Timer disposition (always TMR_CB_RESTART).
+ *
+ * The transactions for all due instances are queued together, so that each
+ * i2c bus processes them back-to-back.
+ */
+static enum tmr_cb_action batch_tmr_callback(int32_t tmr_id,
+                                             uint32_t user_data)
+{
+    uint32_t idx;
+    uint32_t now_ms = tmr_get_ms();
+    struct tmphm_state* st;
+
+    for (idx = 0, st = tmphm_states; idx < TMPHM_NUM_INSTANCES; idx++, st++) {
+        if (!st->started)
+            continue;
+        if (st->xact_pending || st->xact_done) {
+            INC_SAT_U16(cnts_u16[CNT_FETCH_OVERRUN]);
+            continue;
+        }
+        if (!st->periodic_on) {
+            st->xact.op = I2C_XACT_WRITE;
+            st->xact.wr_bfr = (uint8_t*)st->periodic_cmd;
+            st->xact.wr_len = 2;
+            st->xact.rd_len = 0;
+        } else if (now_ms - st->last_fetch_ms + batch_period_ms / 2 >=
+                   st->cfg.sample_time_ms) {
+            st->xact.op = I2C_XACT_WRITE_READ;
+            st->xact.wr_bfr = (uint8_t*)sensor_fetch_cmd;
+            st->xact.wr_len = sizeof(sensor_fetch_cmd);
+            st->xact.rd_len = I2C_MSG_BFR_LEN;
+            st->last_fetch_ms = now_ms;
+        } else {
+            continue;
+        }
+        st->xact_pending = true;
+        if (i2c_submit(st->cfg.i2c_instance_id, &st->xact) != 0) {
+            st->xact_pending = false;
+            INC_SAT_U16(cnts_u16[CNT_FETCH_FAIL]);
+        }
+    }
+    return TMR_CB_RESTART;
+}
+
+/*
+ * @brief I2C transaction completion callback (interrupt context).
+ *
+ * @param[in] xact The completed transaction.
+ */
+static void xact_callback(struct i2c_xact* xact)
+{
+    struct tmphm_state* st = &tmphm_states[xact->user_data];
+
+    st->xact_done = true;
+    st->xact_pending = false;
+}
+
+/*
+ * @brief Get the sensor command to start periodic/ART mode.
+ *
+ * @param[in] cfg Instance configuration.
+ *
+ * @return The 2-byte sensor command.
+ */
+static const uint8_t* get_periodic_cmd(const struct tmphm_cfg* cfg)
+{
+    uint32_t idx;
+
+    if (cfg->mode == TMPHM_MODE_ART)
+        return sensor_art_cmd;
+
+    for (idx = 0; idx < ARRAY_SIZE(sensor_periodic_cmds) - 1; idx++) {
+        if (sensor_periodic_cmds[idx].period_ms <= cfg->sample_time_ms)
+            break;
+    }
+    return sensor_periodic_cmds[idx].cmd;
+}
+
+/*
+ * @brief Check and convert a measurement read from the sensor.
+ *
+ * @param[in] st Instance state.
+ * @param[in] msg The 6 bytes read from the sensor.
+ */
+static void process_meas(struct tmphm_state* st, const uint8_t* msg)
+{
+    const uint32_t divisor = 65535;
+    int32_t temp;
+    uint32_t hum;
+
+    if (crc8(&msg[0], 2) != msg[2] || crc8(&msg[3], 2) != msg[5]) {
+        INC_SAT_U16(cnts_u16[CNT_CRC_FAIL]);
+        return;
+    }
+
+    LWL("Got good tmphm measurement", 0);
+#if CONFIG_TMPHM_WDG_MS > 0 && defined CONFIG_TMPHM_WDG_ID
+    wdg_feed(CONFIG_TMPHM_WDG_ID);
+#endif
+    temp = (msg[0] << 8) + msg[1];
+    hum = (msg[3] << 8) + msg[4];
+    temp = -450 + (1750 * temp + divisor/2) / divisor;
+    hum = (1000 * hum + divisor/2) / divisor;
+    st->last_meas.temp_deg_c_x10 = temp;
+    st->last_meas.rh_percent_x10 = hum;
+    st->last_meas_ms = tmr_get_ms();
+    st->got_meas = true;
+    hist_add(st);
+    log_info("temp=%ld degC*10 hum=%d %%*10\n", temp, hum);
+}
+
+/*
+ * @brief Add the last measurement to the history, and update statistics.
+ *
+ * @param[in] st Instance state.
+ */
+static void hist_add(struct tmphm_state* st)
+{
+    uint32_t seq = st->num_samples;
+    uint32_t widx;
+    uint32_t val;
+
+    // Remove the sample leaving each window from the sums, before it might be
+    // overwritten.
+    for (widx = 0; widx < TMPHM_NUM_STAT_WINDOWS; widx++) {
+        uint32_t window = st->cfg.stat_window_samples[widx];
+        if (seq >= window) {
+            for (val = 0; val < NUM_STAT_VALS; val++)
+                st->windows[widx].sums[val] -= sample_val(st, seq - window,
+                                                          val);
+        }
+    }
+
+    st->hist[seq & HIST_MASK].ms = st->last_meas_ms;
+    st->hist[seq & HIST_MASK].meas = st->last_meas;
+    st->num_samples++;
+
+    for (widx = 0; widx < TMPHM_NUM_STAT_WINDOWS; widx++) {
+        struct stat_window* w = &st->windows[widx];
+        uint32_t window = st->cfg.stat_window_samples[widx];
+
+        for (val = 0; val < NUM_STAT_VALS; val++) {
+            w->sums[val] += sample_val(st, seq, val);
+            mono_q_add(&w->min_q[val], st, seq, window, val, false);
+            mono_q_add(&w->max_q[val], st, seq, window, val, true);
+        }
+    }
+}
+
+/*
+ * @brief Get a value of a sample in the history.
+ *
+ * @param[in] st Instance state.
+ * @param[in] seq Sample number (only the low bits are used).
+ * @param[in] val Which value.
+ *
+ * @return The value.
+ */
+static int32_t sample_val(struct tmphm_state* st, uint32_t seq,
+                          enum stat_vals val)
+{
+    struct tmphm_meas* meas = &st->hist[seq & HIST_MASK].meas;
+
+    return val == STAT_VAL_TEMP ? meas->temp_deg_c_x10 : meas->rh_percent_x10;
+}
+
+/*
+ * @brief Add a new sample to a min or max monotonic queue.
+ *
+ * @param[in] q The queue.
+ * @param[in] st Instance state.
+ * @param[in] seq Sample number of the new sample.
+ * @param[in] window Window size in samples.
+ * @param[in] val Which value the queue is for.
+ * @param[in] is_max True for a max queue, false for a min queue.
+ *
+ * Samples that have left the window are dropped from the front, and samples
+ * that can no longer be the min/max (because the new sample is newer and
+ * smaller/larger) are dropped from the back. The amortized cost is O(1).
+ */
+static void mono_q_add(struct mono_q* q, struct tmphm_state* st, uint32_t seq,
+                       uint32_t window, enum stat_vals val, bool is_max)
+{
+    int32_t new_val = sample_val(st, seq, val);
+
+    while (q->len > 0 && (uint16_t)(seq - q->seqs[q->head]) >= window) {
+        q->head = (q->head + 1) & HIST_MASK;
+        q->len--;
+    }
+    while (q->len > 0) {
+        int32_t back_val = sample_val(st,
+                                      q->seqs[(q->head + q->len - 1) &
+                                              HIST_MASK], val);
+        if (is_max ? back_val > new_val : back_val < new_val)
+            break;
+        q->len--;
+    }
+    q->seqs[(q->head + q->len) & HIST_MASK] = (uint16_t)seq;
+    q->len++;
+}
+
 static enum tmr_cb_action tmr_callback(int32_t tmr_id, uint32_t user_data)
 {
     enum tmphm_instance_id instance_id = (enum tmphm_instance_id)user_data;
@@ -429,25 +940,20 @@ static enum tmr_cb_action tmr_callback(int32_t tmr_id, uint32_t user_data)
  */
 static int32_t cmd_tmphm_status(int32_t argc, const char** argv)
 {
-    uint32_t instance_id;
+    uint32_t idx;
+    struct tmphm_state* st;
 
-    for (instance_id = 0; instance_id < TMPHM_NUM_INSTANCES; instance_id++)
-    {
-        uint32_t idx;
-        struct tmphm_state* st;
-        st = &tmphm_states[instance_id];
-
-        printc("         Got  Last Last Meas Meas\n"
-               "ID State Meas Temp Hum  Age  Time\n"
-               "-- ----- ---- ---- ---- ---- ----\n");
-        for (idx = 0, st = tmphm_states;
-             idx < TMPHM_NUM_INSTANCES;
-             idx++, st++) {
-            printc("%2lu %5d %4d %4u %4u %4lu %4lu\n", idx, st->state,
-                   st->got_meas, st->last_meas.temp_deg_c_x10,
-                   st->last_meas.rh_percent_x10,
-                   tmr_get_ms() - st->last_meas_ms, st->cfg.meas_time_ms);
-        }
+    printc("         Got  Last Last Meas Meas\n"
+           "ID State Meas Temp Hum  Age  Time Mode\n"
+           "-- ----- ---- ---- ---- ---- ---- ----\n");
+    for (idx = 0, st = tmphm_states;
+         idx < TMPHM_NUM_INSTANCES;
+         idx++, st++) {
+        printc("%2lu %5d %4d %4u %4u %4lu %4lu %4d\n", idx, st->state,
+               st->got_meas, st->last_meas.temp_deg_c_x10,
+               st->last_meas.rh_percent_x10,
+               tmr_get_ms() - st->last_meas_ms, st->cfg.meas_time_ms,
+               st->cfg.mode);
     }
     return 0;
 }
@@ -475,6 +981,8 @@ static int32_t cmd_tmphm_test(int32_t argc, const char** argv)
                "  Get last meas, usage: tmphm test lastmeas <instance-id>\n"
                "  Set meas time, usage: tmphm test meastime <instance-id> <time-ms>\n"
                "  Test crc8, usage: tmphm test crc8 byte1 ... (up to 4 bytes)\n"
+               "  Get stats, usage: tmphm test stats <instance-id>\n"
+               "  Get history, usage: tmphm test hist <instance-id> [<decim>]\n"
             );
         return 0;
     }
@@ -500,14 +1008,48 @@ static int32_t cmd_tmphm_test(int32_t argc, const char** argv)
         uint32_t meas_age_ms;
         rc = tmphm_get_last_meas(instance_id, &meas, &meas_age_ms);
         if (rc == 0)
-            printf("Temp=%d.%d C Hum=%u.%u %% age=%lu ms\n",
+            printc("Temp=%d.%d C Hum=%u.%u %% age=%lu ms\n",
                    meas.temp_deg_c_x10 / 10,
                    meas.temp_deg_c_x10 % 10,
                    meas.rh_percent_x10 / 10,
                    meas.rh_percent_x10 % 10,
                    meas_age_ms);
         else
-            printf("tmphm_get_last_meas fails rc=%ld\n", rc);
+            printc("tmphm_get_last_meas fails rc=%ld\n", rc);
+    } else if (strcasecmp(argv[2], "stats") == 0) {
+        struct tmphm_stats stats;
+
+        for (idx = 0; idx < TMPHM_NUM_STAT_WINDOWS; idx++) {
+            rc = tmphm_get_stats(instance_id, idx, &stats);
+            if (rc != 0) {
+                printc("tmphm_get_stats fails rc=%ld\n", rc);
+                break;
+            }
+            printc("Window %lu (%lu samples): temp min/max/mean=%d/%d/%d "
+                   "hum min/max/mean=%u/%u/%u (x10)\n", idx,
+                   stats.num_samples, stats.min.temp_deg_c_x10,
+                   stats.max.temp_deg_c_x10, stats.mean.temp_deg_c_x10,
+                   stats.min.rh_percent_x10, stats.max.rh_percent_x10,
+                   stats.mean.rh_percent_x10);
+        }
+    } else if (strcasecmp(argv[2], "hist") == 0) {
+        struct tmphm_sample samples[8];
+        uint32_t decim = 1;
+
+        rc = cmd_parse_args(argc-4, argv+4, "[u]", arg_vals);
+        if (rc < 0)
+            return MOD_ERR_BAD_CMD;
+        if (rc == 1)
+            decim = arg_vals[0].val.u;
+        rc = tmphm_get_hist(instance_id, decim, samples, ARRAY_SIZE(samples));
+        if (rc < 0) {
+            printc("tmphm_get_hist fails rc=%ld\n", rc);
+            return rc;
+        }
+        for (idx = 0; idx < rc; idx++)
+            printc("%10lu ms temp=%d hum=%u (x10)\n", samples[idx].ms,
+                   samples[idx].meas.temp_deg_c_x10,
+                   samples[idx].meas.rh_percent_x10);
     } else if (strcasecmp(argv[2], "meastime") == 0) {
         rc = cmd_parse_args(argc-4, argv+4, "u", arg_vals);
         if (rc != 1) {
@@ -533,45 +1075,30 @@ static int32_t cmd_tmphm_test(int32_t argc, const char** argv)
     return 0;
 }
 
+#if CONFIG_BENCH_PRESENT
 
 /*
- * @brief CRC8 calculation.
- *
- * @param[in] data Pointer to data to be checked.
- * @param[in] len Number of data bytes.
+ * @brief Benchmark for crc8().
  *
- * @return The CRC.
+ * @param[in] num_ops Number of operations.
  *
- * Because the data to be validated is small (2 bytes) we don't use a faster
- * table-based algoritm.
- *
- * I can't find the origin of this code - there are very many copies of this
- * code, or something very similar to it, on the web.
+ * @return 0 (always).
  *
+ * Each operation is the CRC of one 2 byte measurement, as for each value
+ * read from the sensor.
  */
-
-static uint8_t crc8(const uint8_t *data, int len)
+static int32_t bench_crc8(uint32_t num_ops)
 {
-    //
-    // Parameters comes from page 14 of the STH31-D datasheet (see @ref).
-    // - Polynomial: x^8 + x^5 + x^4 + x^0 which is 100110001 binary, or 0x31 in
-    //   "normal" representation
-    // - Initialization: 0xff.
-    // - Final XOR: 0x00 (i.e. none).
-    // - Example: 0xbeef => 0x92.
-    //
-    const uint8_t polynomial = 0x31;
-    uint8_t crc = 0xff;
-    uint32_t idx1;
-    uint32_t idx2;
-
-    for (idx1 = len; idx1 > 0; idx1--)
-    {
-        crc ^= *data++;
-        for (idx2 = 8; idx2 > 0; idx2--)
-        {
-            crc = (crc & 0x80) ? (crc << 1) ^ polynomial : (crc << 1);
-        }
+    uint8_t data[2] = { 0xbe, 0xef };
+    uint8_t crc = 0;
+    uint32_t idx;
+
+    for (idx = 0; idx < num_ops; idx++) {
+        data[1] = idx;
+        crc ^= crc8(data, sizeof(data));
     }
-    return crc;
+    bench_sink = crc;
+    return 0;
 }
+
+#endif
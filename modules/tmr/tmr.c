@@ -12,7 +12,24 @@
  *   periodically rolls over. With the current 32 bit variable, it rolls over
  *   every 49.7 days.
  *
- * The number of software timers is fixed at compile time (see TMR_NUM_INST).
+ * The number of software timers is fixed at compile time (see
+ * CONFIG_TMR_NUM_INST). Unused timers are kept on a free list, so getting a
+ * timer does not require a search.
+ *
+ * Running timers are kept in a "timer wheel" (one for each callback context),
+ * which is an array of lists indexed by expiration time modulo the wheel size.
+ * On each tick only the list for that tick is checked, so the cost of starting,
+ * stopping, and expiring timers does not depend on the number of timers.
+ *
+ * Tickless idle (see CONFIG_TMR_TICKLESS): When the super loop has nothing to
+ * do it calls tmr_idle(), which reprograms the SysTick to fire at the earliest
+ * running timer deadline (rather than every ms) and then waits for an
+ * interrupt. If some other interrupt wakes the MCU first, the elapsed time is
+ * computed from the SysTick counter so tmr_get_ms() stays correct, and the
+ * normal 1 ms tick resumes. Tickless idle is off by default (see
+ * CONFIG_TMR_DFLT_TICKLESS_ENABLE), and can be turned on with the "tmr tickless"
+ * command.
+ *
  * Each software timer has one of the following states:
  *   TMR_UNUSED:  Not in use.
  *   TMR_STOPPED: Initialized (gotten) but not running.
@@ -57,6 +74,7 @@
 
 #include "cmd.h"
 #include "console.h"
+#include "istat.h"
 #include "log.h"
 #include "lwl.h"
 #include "module.h"
@@ -68,6 +86,20 @@
 
 #define LWL_BASE_ID 10
 #define LWL_NUM 5
+#define LWL_RING LWL_RING_HI_RATE
+
+// Number of slots in each timer wheel. Must be a power of 2.
+#define TMR_WHEEL_SIZE 64
+#define TMR_WHEEL_MASK (TMR_WHEEL_SIZE - 1)
+
+_Static_assert((TMR_WHEEL_SIZE & TMR_WHEEL_MASK) == 0,
+               "TMR_WHEEL_SIZE not a power of 2");
+_Static_assert(TMR_NUM_INST <= INT16_MAX, "TMR_NUM_INST too large");
+
+// Null timer instance index, for list links.
+#define TMR_NIL -1
+
+#define TMR_NUM_CNTX 2
 
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
@@ -84,7 +116,9 @@ enum tmr_state {
     TMR_EXPIRED,
 };
 
-// State information for a timer instance.
+// State information for a timer instance. A running timer is linked into a
+// timer wheel slot list. An unused timer is linked into the free list (using
+// "next").
 struct tmr_inst_info {
     uint32_t period_ms;
     uint32_t start_time;
@@ -92,6 +126,15 @@ struct tmr_inst_info {
     uint32_t cb_user_data;
     enum tmr_state state;
     enum tmr_cb_cntx cb_cntx;
+    int16_t next;
+    int16_t prev;
+    uint16_t slot;
+};
+
+// A timer wheel.
+struct tmr_wheel {
+    uint32_t next_tick;             // Next tick (ms) to be processed.
+    int16_t slots[TMR_WHEEL_SIZE];  // Head of timer list for each slot.
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -101,6 +144,16 @@ struct tmr_inst_info {
 static int32_t cmd_tmr_status(int32_t argc, const char** argv);
 static int32_t cmd_tmr_test(int32_t argc, const char** argv);
 static enum tmr_cb_action test_cb_func(int32_t tmr_id, uint32_t user_data);
+static int32_t inst_get(uint32_t ms, tmr_cb_func cb_func, uint32_t cb_user_data,
+                        enum tmr_cb_cntx cb_cntx);
+static void wheel_link(int32_t tmr_id);
+static void wheel_unlink(int32_t tmr_id);
+static void wheel_process(enum tmr_cb_cntx cntx, uint32_t now_ms);
+static void tick_advance(uint32_t ms);
+#if CONFIG_TMR_TICKLESS
+static int32_t cmd_tmr_tickless(int32_t argc, const char** argv);
+static uint32_t ms_to_next_deadline(uint32_t now_ms, uint32_t max_ms);
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -114,6 +167,32 @@ static struct tmr_mod_info tmr_info;
 
 static struct tmr_inst_info tmrs[TMR_NUM_INST];
 
+static struct tmr_wheel wheels[TMR_NUM_CNTX];
+
+static int16_t free_head;
+static uint16_t num_free;
+
+// Set once the wheels are initialized, since the tick interrupt can run
+// before tmr_init() is called.
+static volatile bool wheels_ready;
+
+// Number of ms represented by the next SysTick interrupt, and whether the
+// SysTick must be set back to a 1 ms period in the next interrupt. These are
+// only changed from the 1/false defaults by tickless idle.
+static volatile uint32_t tick_step = 1;
+static volatile bool tick_reload_restore;
+
+#if CONFIG_TMR_TICKLESS
+static bool tickless_enabled = CONFIG_TMR_DFLT_TICKLESS_ENABLE;
+static uint32_t tick_cycles_per_ms;
+static uint32_t max_idle_ms;
+
+// Tickless idle statistics.
+static uint32_t idle_ctr;
+static uint32_t idle_early_wake_ctr;
+static uint32_t idle_total_ms;
+#endif
+
 static struct cmd_cmd_info cmds[] = {
     {
         .name = "status",
@@ -125,6 +204,13 @@ static struct cmd_cmd_info cmds[] = {
         .func = cmd_tmr_test,
         .help = "Run test, usage: tmr test [<op> [<arg1> [<arg2>]]] (enter no op for help)",
     },
+#if CONFIG_TMR_TICKLESS
+    {
+        .name = "tickless",
+        .func = cmd_tmr_tickless,
+        .help = "Set tickless idle mode, usage: tmr tickless [on|off]",
+    },
+#endif
 };
 
 static int32_t log_level = LOG_DEFAULT;
@@ -157,10 +243,33 @@ static struct cmd_client_info cmd_info = {
  */
 int32_t tmr_init(struct tmr_cfg* cfg)
 {
+    int32_t idx;
+    int32_t cntx;
+
     log_debug("In tmr_init()\n");
     memset(&tmr_info, 0, sizeof(tmr_info));
     memset(&tmrs, 0, sizeof(tmrs));
 
+    for (idx = 0; idx < TMR_NUM_INST; idx++)
+        tmrs[idx].next = idx + 1 < TMR_NUM_INST ? idx + 1 : TMR_NIL;
+    free_head = 0;
+    num_free = TMR_NUM_INST;
+
+    for (cntx = 0; cntx < TMR_NUM_CNTX; cntx++) {
+        wheels[cntx].next_tick = tick_ms_ctr + 1;
+        for (idx = 0; idx < TMR_WHEEL_SIZE; idx++)
+            wheels[cntx].slots[idx] = TMR_NIL;
+    }
+    wheels_ready = true;
+
+#if CONFIG_TMR_TICKLESS
+    // The SysTick has already been set up for a 1 ms period.
+    tick_cycles_per_ms = SysTick->LOAD + 1;
+    max_idle_ms = (SysTick_LOAD_RELOAD_Msk + 1) / tick_cycles_per_ms;
+    if (max_idle_ms > CONFIG_TMR_IDLE_MAX_MS)
+        max_idle_ms = CONFIG_TMR_IDLE_MAX_MS;
+#endif
+
     // TODO:
     // Get information needed to efficiently convert a systick timer/counter
     // value to nano secounds. Here is what we know:
@@ -207,35 +316,98 @@ int32_t tmr_start(void)
  */
 int32_t tmr_run(void)
 {
-    static uint32_t last_ms = 0;
-    int32_t idx;
-    uint32_t now_ms = tmr_get_ms();
+    wheel_process(TMR_CNTX_BASE_LEVEL, tmr_get_ms());
+    return 0;
+}
 
-    // Fast exit if time has not changed.
-    if (now_ms == last_ms)
+/*
+ * @brief Wait for an interrupt, skipping ticks until the next timer deadline.
+ *
+ * @return 1 if the MCU waited for an interrupt, 0 if it did not, else a
+ *         "MOD_ERR" value (<0).
+ *
+ * This function is called when there is nothing to do (see sched_idle()).
+ * If tickless idle is enabled, and the earliest running timer deadline is at
+ * least 2 ms away, the SysTick is set to interrupt at that deadline (limited
+ * by CONFIG_TMR_IDLE_MAX_MS and the SysTick reload range) and the MCU waits for
+ * an interrupt. Otherwise, it returns immediately.
+ *
+ * Interrupts are disabled while waiting so that no interrupt handler runs (and
+ * sees a stale tmr_get_ms() value) until the tick counter has been updated.
+ *
+ * @note Base level work made ready by an interrupt that occurs after the
+ *       module's run function and before this function is not handled until
+ *       the next wakeup, unless it is signalled with sched_post() (which
+ *       sched_idle() checks with interrupts disabled). CONFIG_TMR_IDLE_MAX_MS
+ *       bounds that delay.
+ */
+int32_t tmr_idle(void)
+{
+#if CONFIG_TMR_TICKLESS
+    uint32_t idle_ms;
+    uint32_t load;
+    uint32_t val;
+    uint32_t used_cycles;
+    CRIT_IDLE_STATE_VAR;
+
+    if (!tickless_enabled || !wheels_ready)
         return 0;
 
-    last_ms = now_ms;
-    for (idx = 0; idx < TMR_NUM_INST; idx++) {
-        struct tmr_inst_info* ti = &tmrs[idx];
-        if (ti->cb_cntx == TMR_CNTX_BASE_LEVEL && ti->state == TMR_RUNNING) {
-            if (now_ms - ti->start_time >= ti->period_ms) {
-                // Save period in case user changes it in handler.
-                uint32_t save_period_ms = ti->period_ms;
-                ti->state = TMR_EXPIRED;
-                if (ti->cb_func != NULL) {
-                    enum tmr_cb_action result =
-                        ti->cb_func(idx, ti->cb_user_data);
-                    now_ms = tmr_get_ms();
-                    if (result == TMR_CB_RESTART) {
-                        ti->state = TMR_RUNNING;
-                        ti->start_time += save_period_ms;
-                    }
-                }
-            }
-        }
+    CRIT_IDLE_BEGIN_NEST();
+    idle_ms = ms_to_next_deadline(tick_ms_ctr, max_idle_ms);
+    if (idle_ms < 2 || tick_reload_restore) {
+        CRIT_IDLE_END_NEST();
+        return 0;
+    }
+
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        // A tick is already pending.
+        SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+        CRIT_IDLE_END_NEST();
+        return 0;
     }
+
+    // The first interrupt is at the end of the current ms, plus the whole ms
+    // ticks after that.
+    val = SysTick->VAL;
+    if (val == 0)
+        val = tick_cycles_per_ms;
+    load = val + (idle_ms - 1) * tick_cycles_per_ms;
+    SysTick->LOAD = load - 1;
+    SysTick->VAL = 0;
+    tick_step = idle_ms;
+    tick_reload_restore = true;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    idle_ctr++;
+
+    __DSB();
+    __WFI();
+    __ISB();
+
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        // Woke at the deadline. The interrupt handler will account for the
+        // skipped ticks and restore the 1 ms period.
+        idle_total_ms += idle_ms;
+    } else {
+        // Woke early. Account for the whole ms ticks that have elapsed, and
+        // set the SysTick to interrupt at the end of the current ms.
+        used_cycles = (tick_cycles_per_ms - val) + (load - SysTick->VAL);
+        tick_step = 1;
+        tick_advance(used_cycles / tick_cycles_per_ms);
+        idle_total_ms += used_cycles / tick_cycles_per_ms;
+        load = tick_cycles_per_ms - (used_cycles % tick_cycles_per_ms);
+        SysTick->LOAD = load > 1 ? load - 1 : 1;
+        SysTick->VAL = 0;
+        idle_early_wake_ctr++;
+    }
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    CRIT_IDLE_END_NEST();
+    return 1;
+#else
     return 0;
+#endif
 }
 
 /*
@@ -279,26 +451,7 @@ uint32_t tmr_get_systick_ctr(void)
  */
 int32_t tmr_inst_get(uint32_t ms)
 {
-    uint32_t idx;
-
-    for (idx = 0; idx < TMR_NUM_INST; idx++) {
-        struct tmr_inst_info* ti = &tmrs[idx];
-        if (ti->state == TMR_UNUSED) {
-            ti->period_ms = ms;
-            if (ms == 0) {
-                ti->state = TMR_STOPPED;
-            } else {
-                ti->start_time = tmr_get_ms();
-                ti->state = TMR_RUNNING;
-            }
-            ti->cb_func = NULL;
-            ti->cb_user_data = 0;
-            return idx;
-        }
-    }
-    // Out of timers.
-    log_error("Out of timers\n");
-    return MOD_ERR_RESOURCE;
+    return inst_get(ms, NULL, 0, TMR_CNTX_BASE_LEVEL);
 }
 
 /*
@@ -319,16 +472,9 @@ int32_t tmr_inst_get(uint32_t ms)
 int32_t tmr_inst_get_cb(uint32_t ms, tmr_cb_func cb_func, uint32_t cb_user_data,
                         enum tmr_cb_cntx cb_cntx)
 {
-    int32_t tmr_id;
-
-    tmr_id = tmr_inst_get(ms);
-    if (tmr_id >= 0) {
-        struct tmr_inst_info* ti = &tmrs[tmr_id];
-        ti->cb_cntx = cb_cntx;
-        ti->cb_func = cb_func;
-        ti->cb_user_data = cb_user_data;
-    }
-    return tmr_id;
+    if (cb_cntx != TMR_CNTX_BASE_LEVEL && cb_cntx != TMR_CNTX_INTERRUPT)
+        return MOD_ERR_ARG;
+    return inst_get(ms, cb_func, cb_user_data, cb_cntx);
 }
 
 /*
@@ -345,21 +491,27 @@ int32_t tmr_inst_get_cb(uint32_t ms, tmr_cb_func cb_func, uint32_t cb_user_data,
 int32_t tmr_inst_start(int32_t tmr_id, uint32_t ms)
 {
     int32_t rc;
+    CRIT_STATE_VAR;
 
     if (tmr_id >= 0 && tmr_id < TMR_NUM_INST) {
         struct tmr_inst_info* ti = &tmrs[tmr_id];
+        CRIT_BEGIN_NEST();
         if (ti->state != TMR_UNUSED) {
+            if (ti->state == TMR_RUNNING)
+                wheel_unlink(tmr_id);
             ti->period_ms = ms;
             if (ms == 0) {
                 ti->state = TMR_STOPPED;
             } else {
                 ti->start_time = tmr_get_ms();
                 ti->state = TMR_RUNNING;
+                wheel_link(tmr_id);
             }
             rc = 0;
         } else {
             rc = MOD_ERR_STATE;
         }
+        CRIT_END_NEST();
     } else {
         rc = MOD_ERR_ARG;
     }
@@ -378,14 +530,24 @@ int32_t tmr_inst_start(int32_t tmr_id, uint32_t ms)
  */
 int32_t tmr_inst_set_period(int32_t tmr_id, uint32_t ms)
 {
-    int32_t rc;
+    int32_t rc = 0;
+    CRIT_STATE_VAR;
 
-    if (ms == 0)
+    if (ms == 0) {
         rc = MOD_ERR_ARG;
-    else if (tmr_id >= 0 && tmr_id < TMR_NUM_INST)
-        tmrs[tmr_id].period_ms = ms;
-    else
+    } else if (tmr_id >= 0 && tmr_id < TMR_NUM_INST) {
+        struct tmr_inst_info* ti = &tmrs[tmr_id];
+        CRIT_BEGIN_NEST();
+        ti->period_ms = ms;
+        if (ti->state == TMR_RUNNING) {
+            // The expiration time has changed, so move to the new slot.
+            wheel_unlink(tmr_id);
+            wheel_link(tmr_id);
+        }
+        CRIT_END_NEST();
+    } else {
         rc = MOD_ERR_ARG;
+    }
     return rc;
 }
 
@@ -398,8 +560,20 @@ int32_t tmr_inst_set_period(int32_t tmr_id, uint32_t ms)
  */
 int32_t tmr_inst_release(int32_t tmr_id)
 {
+    CRIT_STATE_VAR;
+
     if (tmr_id >= 0 && tmr_id < TMR_NUM_INST) {
-        tmrs[tmr_id].state = TMR_UNUSED;
+        struct tmr_inst_info* ti = &tmrs[tmr_id];
+        CRIT_BEGIN_NEST();
+        if (ti->state != TMR_UNUSED) {
+            if (ti->state == TMR_RUNNING)
+                wheel_unlink(tmr_id);
+            ti->state = TMR_UNUSED;
+            ti->next = free_head;
+            free_head = tmr_id;
+            num_free++;
+        }
+        CRIT_END_NEST();
         return 0;
     }
     return MOD_ERR_ARG;
@@ -458,44 +632,262 @@ int32_t tmr_inst_dump(int32_t tmr_id)
  *
  * This function is called from the SysTick_Handler(). It must be a public
  * function so it can be called externally, but is not really a part of the API.
+ *
+ * When running under FreeRTOS (see os module), the kernel owns the SysTick,
+ * and this function is the kernel tick hook instead.
  */
+#if CONFIG_OS_FREERTOS
+void vApplicationTickHook(void)
+#else
 void SysTick_Handler(void)
+#endif
 {
-    uint32_t idx;
+    uint32_t step = tick_step;
+    ISTAT_EXEC_BEGIN(ISTAT_ID_SYSTICK);
 
-    tick_ms_ctr++;
-    if (++uptime_ctr_ms == 1000) {
-        uptime_ctr_ms = 0;
-        uptime_ctr_sec++;
-        LWL("Uptime seconds %u", 4, LWL_4(uptime_ctr_sec));
+    // The counter counts down from the reload value, which it was set to
+    // when the interrupt was triggered.
+    ISTAT_LATENCY(ISTAT_ID_SYSTICK, SysTick->LOAD - SysTick->VAL);
+
+    if (tick_reload_restore) {
+        // Returning from tickless idle, go back to a 1 ms period.
+        tick_reload_restore = false;
+        tick_step = 1;
+#if CONFIG_TMR_TICKLESS
+        SysTick->LOAD = tick_cycles_per_ms - 1;
+        SysTick->VAL = 0;
+#endif
     }
+    tick_advance(step);
 
-    if ((tick_ms_ctr % 100) == 0)
+    if ((tick_ms_ctr % 100) < step)
         LWL("Tick 100 ms", 0);
 
-    for (idx = 0; idx < TMR_NUM_INST; idx++) {
-        struct tmr_inst_info* ti = &tmrs[idx];
-        if (ti->cb_cntx == TMR_CNTX_INTERRUPT && ti->state == TMR_RUNNING) {
-            if (tick_ms_ctr - ti->start_time >= ti->period_ms) {
-                // Save period in case user changes it in handler.
-                uint32_t save_period_ms = ti->period_ms;
-                ti->state = TMR_EXPIRED;
-                if (ti->cb_func != NULL) {
-                    enum tmr_cb_action result =
-                        ti->cb_func(idx, ti->cb_user_data);
-                    if (result == TMR_CB_RESTART) {
-                        ti->state = TMR_RUNNING;
-                        ti->start_time += save_period_ms;
-                    }
+    wheel_process(TMR_CNTX_INTERRUPT, tick_ms_ctr);
+    ISTAT_EXEC_END(ISTAT_ID_SYSTICK);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * @brief Get a timer instance from the free list.
+ *
+ * @param[in] ms Timeout value in ms (or 0 to get a stopped timer).
+ * @param[in] cb_func Function to call when timer expires (or NULL).
+ * @param[in] cb_user_data Data to pass to callback function.
+ * @param[in] cb_cntx In what context to process callback.
+ *
+ * @return Timer instance ID (>= 0), else a "MOD_ERR" value (< 0). See code
+ *         for details.
+ */
+static int32_t inst_get(uint32_t ms, tmr_cb_func cb_func, uint32_t cb_user_data,
+                        enum tmr_cb_cntx cb_cntx)
+{
+    int32_t tmr_id;
+    struct tmr_inst_info* ti;
+    CRIT_STATE_VAR;
+
+    CRIT_BEGIN_NEST();
+    tmr_id = free_head;
+    if (tmr_id == TMR_NIL) {
+        CRIT_END_NEST();
+        // Out of timers.
+        log_error("Out of timers\n");
+        return MOD_ERR_RESOURCE;
+    }
+    ti = &tmrs[tmr_id];
+    free_head = ti->next;
+    num_free--;
+
+    ti->period_ms = ms;
+    ti->cb_func = cb_func;
+    ti->cb_user_data = cb_user_data;
+    ti->cb_cntx = cb_cntx;
+    if (ms == 0) {
+        ti->state = TMR_STOPPED;
+    } else {
+        ti->start_time = tmr_get_ms();
+        ti->state = TMR_RUNNING;
+        wheel_link(tmr_id);
+    }
+    CRIT_END_NEST();
+    return tmr_id;
+}
+
+/*
+ * @brief Link a running timer into the wheel slot for its expiration time.
+ *
+ * @param[in] tmr_id Timer ID.
+ *
+ * If the timer is already overdue, it is put in the slot for the next tick to
+ * be processed, so it is not missed until the wheel comes around again.
+ *
+ * @note Must be called with interrupts disabled.
+ */
+static void wheel_link(int32_t tmr_id)
+{
+    struct tmr_inst_info* ti = &tmrs[tmr_id];
+    struct tmr_wheel* w = &wheels[ti->cb_cntx];
+    uint32_t expire_ms = ti->start_time + ti->period_ms;
+
+    if ((int32_t)(expire_ms - w->next_tick) < 0)
+        expire_ms = w->next_tick;
+    ti->slot = expire_ms & TMR_WHEEL_MASK;
+    ti->prev = TMR_NIL;
+    ti->next = w->slots[ti->slot];
+    if (ti->next != TMR_NIL)
+        tmrs[ti->next].prev = tmr_id;
+    w->slots[ti->slot] = tmr_id;
+}
+
+/*
+ * @brief Unlink a running timer from its wheel slot.
+ *
+ * @param[in] tmr_id Timer ID.
+ *
+ * @note Must be called with interrupts disabled.
+ */
+static void wheel_unlink(int32_t tmr_id)
+{
+    struct tmr_inst_info* ti = &tmrs[tmr_id];
+
+    if (ti->prev != TMR_NIL)
+        tmrs[ti->prev].next = ti->next;
+    else
+        wheels[ti->cb_cntx].slots[ti->slot] = ti->next;
+    if (ti->next != TMR_NIL)
+        tmrs[ti->next].prev = ti->prev;
+    ti->next = TMR_NIL;
+    ti->prev = TMR_NIL;
+}
+
+/*
+ * @brief Process timer wheel slots up to the current time.
+ *
+ * @param[in] cntx Callback context (selects the wheel).
+ * @param[in] now_ms Current time.
+ *
+ * Each tick since the last call is processed in turn (normally just one). If
+ * more ticks than the wheel size have elapsed, each slot is processed once.
+ * Within a slot, timers that are for a later trip around the wheel are left
+ * alone.
+ *
+ * The callback functions are run with interrupts enabled, and can call any of
+ * the timer APIs. Since a callback can change the slot list, the search for an
+ * expired timer restarts from the head of the list after each callback.
+ */
+static void wheel_process(enum tmr_cb_cntx cntx, uint32_t now_ms)
+{
+    struct tmr_wheel* w = &wheels[cntx];
+    int32_t tmr_id;
+    uint16_t slot;
+    CRIT_STATE_VAR;
+
+    // Fast exit if time has not changed.
+    if (!wheels_ready || (int32_t)(now_ms - w->next_tick) < 0)
+        return;
+
+    if (now_ms - w->next_tick >= TMR_WHEEL_SIZE)
+        w->next_tick = now_ms - TMR_WHEEL_MASK;
+
+    while ((int32_t)(now_ms - w->next_tick) >= 0) {
+        slot = w->next_tick & TMR_WHEEL_MASK;
+        w->next_tick++;
+        while (1) {
+            struct tmr_inst_info* ti;
+            uint32_t save_period_ms;
+            enum tmr_cb_action result;
+
+            CRIT_BEGIN_NEST();
+            for (tmr_id = w->slots[slot]; tmr_id != TMR_NIL;
+                 tmr_id = tmrs[tmr_id].next) {
+                ti = &tmrs[tmr_id];
+                if ((int32_t)(now_ms - (ti->start_time + ti->period_ms)) >= 0)
+                    break;
+            }
+            if (tmr_id == TMR_NIL) {
+                CRIT_END_NEST();
+                break;
+            }
+            wheel_unlink(tmr_id);
+            ti->state = TMR_EXPIRED;
+            CRIT_END_NEST();
+
+            if (ti->cb_func == NULL)
+                continue;
+
+            // Save period in case user changes it in handler.
+            save_period_ms = ti->period_ms;
+            result = ti->cb_func(tmr_id, ti->cb_user_data);
+            if (result == TMR_CB_RESTART) {
+                CRIT_BEGIN_NEST();
+                if (ti->state != TMR_UNUSED) {
+                    if (ti->state == TMR_RUNNING)
+                        wheel_unlink(tmr_id);
+                    ti->state = TMR_RUNNING;
+                    ti->start_time += save_period_ms;
+                    wheel_link(tmr_id);
                 }
+                CRIT_END_NEST();
             }
         }
     }
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Private (static) functions
-////////////////////////////////////////////////////////////////////////////////
+/*
+ * @brief Advance the tick and uptime counters.
+ *
+ * @param[in] ms Number of ms to advance.
+ *
+ * @note Must be called with interrupts disabled, or from the SysTick handler.
+ */
+static void tick_advance(uint32_t ms)
+{
+    tick_ms_ctr += ms;
+    uptime_ctr_ms += ms;
+    while (uptime_ctr_ms >= 1000) {
+        uptime_ctr_ms -= 1000;
+        uptime_ctr_sec++;
+        LWL("Uptime seconds %u", 4, LWL_4(uptime_ctr_sec));
+    }
+}
+
+#if CONFIG_TMR_TICKLESS
+
+/*
+ * @brief Get the time until the earliest running timer expires.
+ *
+ * @param[in] now_ms Current time.
+ * @param[in] max_ms Maximum value to return.
+ *
+ * @return Time in ms to the earliest deadline (0 if a timer is overdue), or
+ *         max_ms if that is smaller.
+ *
+ * This scans all timers, but is only called when the system is idle.
+ *
+ * @note Must be called with interrupts disabled.
+ */
+static uint32_t ms_to_next_deadline(uint32_t now_ms, uint32_t max_ms)
+{
+    uint32_t idx;
+    int32_t left_ms;
+
+    for (idx = 0; idx < TMR_NUM_INST; idx++) {
+        struct tmr_inst_info* ti = &tmrs[idx];
+        if (ti->state != TMR_RUNNING)
+            continue;
+        left_ms = (int32_t)(ti->start_time + ti->period_ms - now_ms);
+        if (left_ms <= 0)
+            return 0;
+        if ((uint32_t)left_ms < max_ms)
+            max_ms = left_ms;
+    }
+    return max_ms;
+}
+
+#endif // CONFIG_TMR_TICKLESS
 
 /*
  * @brief Convert timer instance state enum value to a string.
@@ -557,7 +949,15 @@ static int32_t cmd_tmr_status(int32_t argc, const char** argv)
     printc("SysTick: CTRL=0x%08lx LOAD=%lu VAL=%lu\n",
            SysTick->CTRL, SysTick->LOAD, SysTick->VAL);
 
-    printc("Current millisecond tmr=%lu\n\n", now_ms);
+    printc("Current millisecond tmr=%lu\n", now_ms);
+    printc("Timers: %u of %u free, wheel size %u\n", num_free, TMR_NUM_INST,
+           TMR_WHEEL_SIZE);
+#if CONFIG_TMR_TICKLESS
+    printc("Tickless idle: %s max=%lu ms idles=%lu early=%lu idle_ms=%lu\n",
+           tickless_enabled ? "on" : "off", max_idle_ms, idle_ctr,
+           idle_early_wake_ctr, idle_total_ms);
+#endif
+    printc("\n");
 
     printc("ID   Period   Start time Time left  CB User data  State\n");
     printc("-- ---------- ---------- ---------- -- ---------- ------\n");
@@ -658,3 +1058,36 @@ static enum tmr_cb_action test_cb_func(int32_t tmr_id, uint32_t user_data)
               tmr_id, user_data);
     return user_data == 0 ? TMR_CB_RESTART : TMR_CB_NONE;
 }
+
+#if CONFIG_TMR_TICKLESS
+
+/*
+ * @brief Console command function for "tmr tickless".
+ *
+ * @param[in] argc Number of arguments, including "tmr"
+ * @param[in] argv Argument values, including "tmr"
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Command usage: tmr tickless [on|off]
+ */
+static int32_t cmd_tmr_tickless(int32_t argc, const char** argv)
+{
+    if (argc == 3) {
+        if (strcasecmp(argv[2], "on") == 0) {
+            tickless_enabled = true;
+        } else if (strcasecmp(argv[2], "off") == 0) {
+            tickless_enabled = false;
+        } else {
+            printc("Invalid value '%s'\n", argv[2]);
+            return MOD_ERR_BAD_CMD;
+        }
+    } else if (argc != 2) {
+        printc("Invalid number of arguments\n");
+        return MOD_ERR_BAD_CMD;
+    }
+    printc("Tickless idle is %s\n", tickless_enabled ? "on" : "off");
+    return 0;
+}
+
+#endif // CONFIG_TMR_TICKLESS
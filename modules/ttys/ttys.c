@@ -33,6 +33,48 @@
  * the "USARTx global interrupt" should NOT be chosen or you will get a
  * duplicate symbol at link time.
  *
+ * Optionally (see use_dma in struct ttys_cfg), an instance can use DMA rather
+ * than a per-character interrupt. In this case:
+ * - For TX, each DMA transfer moves the largest contiguous chunk of the TX
+ *   buffer, and the DMA transfer complete interrupt starts the next chunk.
+ * - For RX, a circular DMA transfer fills the RX buffer, and the put index is
+ *   derived from the DMA transfer counter. Note that in this mode RX buffer
+ *   overrun is not detected; the oldest data is simply overwritten.
+ * This module overrides the (weak) DMA stream interrupt handler functions for
+ * the TX streams it uses, so they should not be chosen in the IDE device
+ * configuration tool either. DMA is currently only supported for DMA type 1
+ * (see CONFIG_DMA_TYPE).
+ *
+ * A client can have a sched task posted when characters are received (see
+ * ttys_set_rx_task()), rather than polling with ttys_getc(). By default (see
+ * rx_wake_on_idle in struct ttys_cfg), the UART IDLE-line interrupt is used so
+ * the task is posted once per burst of characters, plus when the RX buffer
+ * reaches half full during a long burst. Otherwise the task is posted for each
+ * character. For instances using DMA for RX, only the former is supported, as
+ * there is no per-character interrupt, and the half full post is not done.
+ *
+ * If create_stream is set (see struct ttys_cfg), a FILE stream is created for
+ * the instance with fopencookie(). The stream is line buffered, using a small
+ * static buffer in the instance state, and each flush is copied into the TX
+ * buffer in one block. Thus fprintf() and friends make one ttys_write() per
+ * line rather than a _write() call per character, and do not allocate stdio
+ * buffers from the heap. Output without a trailing newline needs an fflush().
+ *
+ * The FILE object itself is the one heap allocation in this module. Its layout
+ * is private to the C library, so it can't be placed statically. Newlib
+ * allocates FILE objects in blocks of four, so the number of streams is
+ * limited to CONFIG_TTYS_MAX_STREAMS (default 4), which costs one block. Each
+ * stream is created by ttys_init() and kept for the life of the program
+ * (even across re-init), so there is no heap use after startup.
+ *
+ * The TX and RX buffers of each instance are static buffers sized by config.h
+ * (see ttys.h), unless the client supplies its own storage in struct
+ * ttys_cfg. They are managed as rings (see ring.h), so buffer sizes must be
+ * powers of 2. The RX ring has a single producer (the interrupt handler, or
+ * DMA) and a single consumer, so ttys_getc() does not disable interrupts. The
+ * TX ring can have several producers (e.g. the main loop and interrupt
+ * handlers writing logs), so they are serialized with a critical section.
+ *
  * A future feature is to perform full hardware initialization in this library,
  * and allowing at least some UART parameters to be set (e.g. buad).
  *
@@ -59,20 +101,34 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE // For fopencookie().
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
 
 #include "config.h"
 #include CONFIG_STM32_LL_USART_HDR
 
+#if CONFIG_DMA_TYPE == 1
+#include CONFIG_STM32_LL_BUS_HDR
+#include CONFIG_STM32_LL_DMA_HDR
+#endif
+
+#include "bench.h"
 #include "cmd.h"
 #include "console.h"
+#include "fault.h"
+#include "istat.h"
 #include "log.h"
 #include "module.h"
+#include "os.h"
+#include "ring.h"
+#include "sched.h"
 #include "tmr.h"
 #include "ttys.h"
 
@@ -100,6 +156,7 @@
     #define NE_BIT_MASK LL_USART_SR_NE
     #define FE_BIT_MASK LL_USART_SR_FE
     #define PE_BIT_MASK LL_USART_SR_PE
+    #define IDLE_BIT_MASK LL_USART_SR_IDLE
     #define DATA_RX_REG DR
     #define DATA_TX_REG DR
     #define STATUS_REG SR
@@ -110,6 +167,7 @@
     #define NE_BIT_MASK LL_USART_ISR_NE
     #define FE_BIT_MASK LL_USART_ISR_FE
     #define PE_BIT_MASK LL_USART_ISR_PE
+    #define IDLE_BIT_MASK LL_USART_ISR_IDLE
     #define DATA_RX_REG RDR
     #define DATA_TX_REG TDR
     #define STATUS_REG ISR
@@ -120,11 +178,29 @@
     #define NE_BIT_MASK LL_USART_ISR_NE
     #define FE_BIT_MASK LL_USART_ISR_FE
     #define PE_BIT_MASK LL_USART_ISR_PE
+    #define IDLE_BIT_MASK LL_USART_ISR_IDLE
     #define DATA_RX_REG RDR
     #define DATA_TX_REG TDR
     #define STATUS_REG ISR
 #endif
 
+#if CONFIG_DMA_TYPE == 1
+    // Interrupt flags for a DMA stream, before being shifted into position for
+    // the stream (see dma_flag_shift).
+    #define DMA_ALL_FLAGS_MASK 0x3d
+    #define DMA_TCIF_MASK 0x20
+    #define DMA_TEIF_MASK 0x08
+#endif
+
+// Initializer for the buffer fields of an instance state, using the default
+// storage for the instance.
+#define DFLT_BUFS(n) {                                  \
+        .tx_buf = tx_buf_##n,                           \
+        .rx_buf = rx_buf_##n,                           \
+        .tx_ring = RING_INIT(sizeof(tx_buf_##n)),       \
+        .rx_ring = RING_INIT(sizeof(rx_buf_##n)),       \
+    }
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -135,12 +211,19 @@ struct ttys_state {
     FILE* stream;
     int fd;
     USART_TypeDef* uart_reg_base;
-    uint16_t rx_buf_get_idx;
-    uint16_t rx_buf_put_idx;
-    uint16_t tx_buf_get_idx;
-    uint16_t tx_buf_put_idx;
-    char tx_buf[TTYS_TX_BUF_SIZE];
-    char rx_buf[TTYS_RX_BUF_SIZE];
+    struct ring tx_ring;
+    struct ring rx_ring;
+    int32_t rx_task_id;
+    char* tx_buf;
+    char* rx_buf;
+    char stream_buf[CONFIG_TTYS_STREAM_BUF_SIZE];
+#if CONFIG_DMA_TYPE == 1
+    DMA_TypeDef* dma_reg_base;
+    uint32_t dma_tx_stream;
+    uint32_t dma_rx_stream;
+    uint16_t dma_tx_len;
+    bool dma_tx_busy;
+#endif
 };
 
 // Performance measurements for ttys. Currently these are common to all
@@ -153,6 +236,7 @@ enum ttys_u16_pms {
     CNT_RX_UART_PE,
     CNT_TX_BUF_OVERRUN,
     CNT_RX_BUF_OVERRUN,
+    CNT_DMA_ERR,
 
     NUM_U16_PMS
 };
@@ -166,6 +250,24 @@ static void ttys_interrupt(enum ttys_instance_id instance_id,
 static int32_t get_instance_info(enum ttys_instance_id instance_id,
                                  USART_TypeDef** p_uart_reg_base,
                                  int* p_fd, IRQn_Type* p_irq_type);
+static void tx_kick(struct ttys_state* st);
+static void rx_dma_update(struct ttys_state* st);
+static void write_crlf(enum ttys_instance_id instance_id, const char* ptr,
+                       uint32_t len);
+static ssize_t stream_read(void* cookie, char* buf, size_t size);
+static ssize_t stream_write(void* cookie, const char* buf, size_t size);
+#if CONFIG_DMA_TYPE == 1
+static int32_t dma_start(enum ttys_instance_id instance_id);
+static void dma_tx_next(struct ttys_state* st);
+static void dma_tx_interrupt(enum ttys_instance_id instance_id);
+static int32_t get_dma_info(enum ttys_instance_id instance_id,
+                            DMA_TypeDef** p_dma_reg_base,
+                            uint32_t* p_tx_stream, uint32_t* p_rx_stream,
+                            uint32_t* p_channel, IRQn_Type* p_tx_irq_type);
+#endif
+#if CONFIG_BENCH_PRESENT
+static int32_t bench_ring(uint32_t num_ops);
+#endif
 static int32_t cmd_ttys_status(int32_t argc, const char** argv);
 static int32_t cmd_ttys_test(int32_t argc, const char** argv);
 
@@ -173,7 +275,45 @@ static int32_t cmd_ttys_test(int32_t argc, const char** argv);
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
 
-static struct ttys_state ttys_states[TTYS_NUM_INSTANCES];
+// Default buffer storage for each instance.
+
+#if CONFIG_TTYS_1_PRESENT
+static char tx_buf_1[CONFIG_TTYS_1_TX_BUF_SIZE];
+static char rx_buf_1[CONFIG_TTYS_1_RX_BUF_SIZE];
+#endif
+
+#if CONFIG_TTYS_2_PRESENT
+static char tx_buf_2[CONFIG_TTYS_2_TX_BUF_SIZE];
+static char rx_buf_2[CONFIG_TTYS_2_RX_BUF_SIZE];
+#endif
+
+#if CONFIG_TTYS_6_PRESENT
+static char tx_buf_6[CONFIG_TTYS_6_TX_BUF_SIZE];
+static char rx_buf_6[CONFIG_TTYS_6_RX_BUF_SIZE];
+#endif
+
+// Number of FILE streams created, limited to CONFIG_TTYS_MAX_STREAMS.
+static uint8_t num_streams;
+
+// The default buffers are set up statically, so output written before
+// ttys_init() is buffered.
+static struct ttys_state ttys_states[TTYS_NUM_INSTANCES] = {
+#if CONFIG_TTYS_1_PRESENT
+    [TTYS_INSTANCE_1] = DFLT_BUFS(1),
+#endif
+#if CONFIG_TTYS_2_PRESENT
+    [TTYS_INSTANCE_2] = DFLT_BUFS(2),
+#endif
+#if CONFIG_TTYS_6_PRESENT
+    [TTYS_INSTANCE_6] = DFLT_BUFS(6),
+#endif
+};
+
+#if CONFIG_DMA_TYPE == 1
+// Bit position of the interrupt flags of each DMA stream in the LISR/LIFCR
+// (streams 0-3) and HISR/HIFCR (streams 4-7) registers.
+static const uint8_t dma_flag_shift[4] = {0, 6, 16, 22};
+#endif
 
 static int32_t log_level = LOG_DEFAULT;
 
@@ -188,6 +328,7 @@ static const char* cnts_u16_names[NUM_U16_PMS] = {
     "uart rx parity err",
     "tx buf overrun err",
     "rx buf overrun err",
+    "dma err",
 };
 
 // Data structure with console command info.
@@ -215,6 +356,23 @@ static struct cmd_client_info cmd_info = {
     .u16_pm_names = cnts_u16_names,
 };
 
+#if CONFIG_BENCH_PRESENT
+// Data structure passed to bench module.
+static const struct bench_info benches[] = {
+    {
+        .name = "ring",
+        .func = bench_ring,
+        .dflt_num_ops = 100000,
+    },
+};
+
+static const struct bench_client_info bench_info = {
+    .name = "ttys",
+    .num_benches = ARRAY_SIZE(benches),
+    .benches = benches,
+};
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -238,6 +396,37 @@ int32_t ttys_get_def_cfg(enum ttys_instance_id instance_id, struct ttys_cfg* cfg
     memset(cfg, 0, sizeof(*cfg));
     cfg->create_stream = true;
     cfg->send_cr_after_nl = true;
+    cfg->use_dma = false;
+    cfg->rx_wake_on_idle = true;
+
+    switch (instance_id) {
+#if CONFIG_TTYS_1_PRESENT
+        case TTYS_INSTANCE_1:
+            cfg->tx_buf = tx_buf_1;
+            cfg->rx_buf = rx_buf_1;
+            cfg->tx_buf_size = sizeof(tx_buf_1);
+            cfg->rx_buf_size = sizeof(rx_buf_1);
+            break;
+#endif
+#if CONFIG_TTYS_2_PRESENT
+        case TTYS_INSTANCE_2:
+            cfg->tx_buf = tx_buf_2;
+            cfg->rx_buf = rx_buf_2;
+            cfg->tx_buf_size = sizeof(tx_buf_2);
+            cfg->rx_buf_size = sizeof(rx_buf_2);
+            break;
+#endif
+#if CONFIG_TTYS_6_PRESENT
+        case TTYS_INSTANCE_6:
+            cfg->tx_buf = tx_buf_6;
+            cfg->rx_buf = rx_buf_6;
+            cfg->tx_buf_size = sizeof(tx_buf_6);
+            cfg->rx_buf_size = sizeof(rx_buf_6);
+            break;
+#endif
+        default:
+            return MOD_ERR_BAD_INSTANCE;
+    }
     return 0;
 }
 
@@ -251,6 +440,9 @@ int32_t ttys_get_def_cfg(enum ttys_instance_id instance_id, struct ttys_cfg* cfg
  *
  * This function initializes a ttys module instance. Generally, it should not
  * access other modules as they might not have been initialized yet.
+ *
+ * If the configuration replaces the default TX buffer, any output written
+ * before this call is discarded.
  */
 int32_t ttys_init(enum ttys_instance_id instance_id, struct ttys_cfg* cfg)
 {
@@ -263,31 +455,58 @@ int32_t ttys_init(enum ttys_instance_id instance_id, struct ttys_cfg* cfg)
     if (cfg == NULL)
         return MOD_ERR_ARG;
 
+#if CONFIG_DMA_TYPE != 1
+    if (cfg->use_dma)
+        return MOD_ERR_IMPL;
+#endif
+
+    if (cfg->tx_buf == NULL || cfg->rx_buf == NULL ||
+        !RING_SIZE_OK(cfg->tx_buf_size) || !RING_SIZE_OK(cfg->rx_buf_size))
+        return MOD_ERR_ARG;
+
     // We selectively initialize the state structure, as we want to preserve the
     // transmit queue in case there is output in it.  However, if the transmit
-    // queue appears corrupted, we initialize the whole thing.
+    // buffer is being replaced, or the transmit queue appears corrupted, we
+    // initialize the whole thing, except for the FILE stream, which can't be
+    // closed and so must be kept to avoid leaking it.
 
     st = &ttys_states[instance_id];
-    if (st->tx_buf_get_idx >= TTYS_TX_BUF_SIZE ||
-        st->tx_buf_put_idx >= TTYS_TX_BUF_SIZE) {
+    if (st->tx_buf != cfg->tx_buf ||
+        ring_size(&st->tx_ring) != cfg->tx_buf_size ||
+        st->tx_ring.get_idx > st->tx_ring.mask ||
+        st->tx_ring.put_idx > st->tx_ring.mask) {
+        FILE* stream = st->stream;
         memset(st, 0, sizeof(*st));
-    } else {
-        st->rx_buf_get_idx = 0;
-        st->rx_buf_put_idx = 0;
+        st->stream = stream;
+        ring_init(&st->tx_ring, cfg->tx_buf_size);
     }
+    ring_init(&st->rx_ring, cfg->rx_buf_size);
     st->cfg = *cfg;
+    st->tx_buf = cfg->tx_buf;
+    st->rx_buf = cfg->rx_buf;
+    st->rx_task_id = SCHED_NO_TASK;
 
     rc = get_instance_info(instance_id, &st->uart_reg_base,
                            &st->fd, NULL);
     if (rc != 0)
         return rc;
 
-    if (st->cfg.create_stream) {
-        st->stream = fdopen(st->fd, "r+");
-        if (st->stream != NULL)
-            setvbuf(st->stream, NULL, _IONBF, 0);    
-    } else {
-        st->stream = NULL;
+    // The stream is only created once, as there is no API to close it. If a
+    // later configuration doesn't want a stream, it is kept but not handed
+    // out (see ttys_get_stream()).
+    if (st->cfg.create_stream && st->stream == NULL) {
+        static const cookie_io_functions_t stream_funcs = {
+            .read = stream_read,
+            .write = stream_write,
+        };
+        if (num_streams >= CONFIG_TTYS_MAX_STREAMS)
+            return MOD_ERR_RESOURCE;
+        st->stream = fopencookie((void*)(intptr_t)instance_id, "r+",
+                                 stream_funcs);
+        if (st->stream == NULL)
+            return MOD_ERR_RESOURCE;
+        num_streams++;
+        setvbuf(st->stream, st->stream_buf, _IOLBF, sizeof(st->stream_buf));
     }
     return 0;
 }
@@ -318,16 +537,37 @@ int32_t ttys_start(enum ttys_instance_id instance_id)
         return rc;
     }
 
+#if CONFIG_BENCH_PRESENT
+    rc = bench_register(&bench_info);
+    if (rc < 0) {
+        log_error("ttys_start: bench error %d\n", rc);
+        return rc;
+    }
+#endif
+
     st = &ttys_states[instance_id];
-    LL_USART_EnableIT_RXNE(st->uart_reg_base);
-    LL_USART_EnableIT_TXE(st->uart_reg_base);
+#if CONFIG_DMA_TYPE == 1
+    if (st->cfg.use_dma) {
+        rc = dma_start(instance_id);
+        if (rc != 0)
+            return rc;
+    } else
+#endif
+    {
+        LL_USART_EnableIT_RXNE(st->uart_reg_base);
+        LL_USART_EnableIT_TXE(st->uart_reg_base);
+    }
+    if (st->cfg.rx_wake_on_idle)
+        LL_USART_EnableIT_IDLE(st->uart_reg_base);
 
     rc = get_instance_info(instance_id, NULL, NULL, &irq_type);
     if (rc != 0)
         return rc;
 
+    // The handler calls sched_post().
     NVIC_SetPriority(irq_type,
-                     NVIC_EncodePriority(NVIC_GetPriorityGrouping(),0, 0));
+                     NVIC_EncodePriority(NVIC_GetPriorityGrouping(),
+                                         OS_POST_IRQ_PRIO, 0));
     NVIC_EnableIRQ(irq_type);
 
     return 0;
@@ -348,38 +588,72 @@ int32_t ttys_start(enum ttys_instance_id instance_id)
 int32_t ttys_putc(enum ttys_instance_id instance_id, char c)
 {
     struct ttys_state* st;
-    uint16_t next_put_idx;
+    uint32_t put_idx;
     CRIT_STATE_VAR;
 
-    if (instance_id >= TTYS_NUM_INSTANCES)
+    if (instance_id >= TTYS_NUM_INSTANCES ||
+        ttys_states[instance_id].tx_buf == NULL)
         return MOD_ERR_BAD_INSTANCE;
     st = &ttys_states[instance_id];
 
-    // Calculate the new TX buffer put index
-    CRIT_BEGIN_NEST();
-    next_put_idx = st->tx_buf_put_idx + 1;
-    if (next_put_idx >= TTYS_TX_BUF_SIZE)
-        next_put_idx = 0;
-
     // If buffer is full, then return error.
-    while (next_put_idx == st->tx_buf_get_idx) {
+    CRIT_BEGIN_NEST();
+    if (ring_put_peek(&st->tx_ring, &put_idx) == 0) {
         INC_SAT_U16(cnts_u16[CNT_TX_BUF_OVERRUN]);
         CRIT_END_NEST();
         return MOD_ERR_BUF_OVERRUN;
     }
 
     // Put the char in the TX buffer.
-    st->tx_buf[st->tx_buf_put_idx] = c;
-    st->tx_buf_put_idx = next_put_idx;
+    st->tx_buf[put_idx] = c;
+    ring_put_commit(&st->tx_ring, 1);
 
-    // Ensure the TX interrupt is enabled.
-    if (ttys_states[instance_id].uart_reg_base != NULL) {
-        LL_USART_EnableIT_TXE(st->uart_reg_base);
-    }
+    tx_kick(st);
     CRIT_END_NEST();
     return 0;
 }
 
+/*
+ * @brief Put a block of characters for transmission.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[in] buf Characters to transmit.
+ * @param[in] len Number of characters to transmit.
+ *
+ * @return Number of characters put in the TX buffer (>= 0), else a "MOD_ERR"
+ *         value (< 0). See code for details.
+ *
+ * The characters are copied to the TX buffer in one operation, which is much
+ * cheaper than a ttys_putc() per character. If there is not enough space in
+ * the TX buffer, as many characters as will fit are copied, and a TX buffer
+ * overrun is recorded.
+ *
+ * @note As with ttys_putc(), this can be called before the module is started.
+ */
+int32_t ttys_write(enum ttys_instance_id instance_id, const char* buf,
+                   uint32_t len)
+{
+    struct ttys_state* st;
+    uint32_t num_written;
+    CRIT_STATE_VAR;
+
+    if (instance_id >= TTYS_NUM_INSTANCES ||
+        ttys_states[instance_id].tx_buf == NULL)
+        return MOD_ERR_BAD_INSTANCE;
+    if (buf == NULL)
+        return MOD_ERR_ARG;
+    st = &ttys_states[instance_id];
+
+    CRIT_BEGIN_NEST();
+    num_written = ring_put(&st->tx_ring, st->tx_buf, 1, buf, len);
+    if (num_written < len)
+        INC_SAT_U16(cnts_u16[CNT_TX_BUF_OVERRUN]);
+    if (num_written > 0)
+        tx_kick(st);
+    CRIT_END_NEST();
+    return num_written;
+}
+
 /*
  * @brief Get a received character.
  *
@@ -387,32 +661,28 @@ int32_t ttys_putc(enum ttys_instance_id instance_id, char c)
  * @param[out] c Received character.
  *
  * @return Number of characters returned (0 or 1)
+ *
+ * @note There must be only one reader of an instance (e.g. the console).
  */
 int32_t ttys_getc(enum ttys_instance_id instance_id, char* c)
 {
     struct ttys_state* st;
-    int32_t next_get_idx;
-    CRIT_STATE_VAR;
+    uint32_t get_idx;
 
-    if (instance_id >= TTYS_NUM_INSTANCES)
+    if (instance_id >= TTYS_NUM_INSTANCES ||
+        ttys_states[instance_id].rx_buf == NULL)
         return MOD_ERR_BAD_INSTANCE;
 
     st = &ttys_states[instance_id];
+    rx_dma_update(st);
 
     // Check if buffer is empty.
-    CRIT_BEGIN_NEST();
-    if (st->rx_buf_get_idx == st->rx_buf_put_idx) {
-        CRIT_END_NEST();
+    if (ring_get_peek(&st->rx_ring, &get_idx) == 0)
         return 0;
-    }
 
     // Get a character and advance get index.
-    next_get_idx = st->rx_buf_get_idx + 1;
-    if (next_get_idx >= TTYS_RX_BUF_SIZE)
-        next_get_idx = 0;
-    *c = st->rx_buf[st->rx_buf_get_idx];
-    st->rx_buf_get_idx = next_get_idx;
-    CRIT_END_NEST();
+    *c = st->rx_buf[get_idx];
+    ring_get_commit(&st->rx_ring, 1);
     return 1;
 }
 
@@ -438,11 +708,12 @@ int ttys_get_fd(enum ttys_instance_id instance_id)
  *
  * @param[in] instance_id Identifies the ttys instance.
  *
- * @return FILE stream pointer, or NULL if error.
+ * @return FILE stream pointer, or NULL if error or no stream configured.
  */
 FILE* ttys_get_stream(enum ttys_instance_id instance_id)
 {
-    if (instance_id >= TTYS_NUM_INSTANCES)
+    if (instance_id >= TTYS_NUM_INSTANCES ||
+        !ttys_states[instance_id].cfg.create_stream)
         return NULL;
 
     return ttys_states[instance_id].stream;
@@ -460,9 +731,49 @@ int32_t ttys_tx_idle(enum ttys_instance_id instance_id)
 {
     if (instance_id >= TTYS_NUM_INSTANCES)
         return MOD_ERR_ARG;
-    return (ttys_states[instance_id].tx_buf_get_idx ==
-            ttys_states[instance_id].tx_buf_put_idx ?
-            1 : 0);
+    return ring_empty(&ttys_states[instance_id].tx_ring) ? 1 : 0;
+}
+
+/*
+ * @brief Get the free space in the xmit buffer.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ *
+ * @return Number of chars that can be written without overrun, else a
+ *         "MOD_ERR" value (<0).
+ *
+ * This lets clients with a lot of output pace themselves, writing as much as
+ * fits rather than waiting for the buffer to drain completely.
+ */
+int32_t ttys_tx_space(enum ttys_instance_id instance_id)
+{
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_ARG;
+    return ring_space(&ttys_states[instance_id].tx_ring);
+}
+
+/*
+ * @brief Set a task to be posted when characters are received.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[in] task_id The sched task ID (or SCHED_NO_TASK for none).
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The task is posted from the interrupt handler when the line goes idle after
+ * received characters, or for each received character (see rx_wake_on_idle in
+ * struct ttys_cfg), so it should read all available characters each time it
+ * runs.
+ */
+int32_t ttys_set_rx_task(enum ttys_instance_id instance_id, int32_t task_id)
+{
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_BAD_INSTANCE;
+    if (ttys_states[instance_id].cfg.use_dma &&
+        !ttys_states[instance_id].cfg.rx_wake_on_idle)
+        return MOD_ERR_IMPL;
+    ttys_states[instance_id].rx_task_id = task_id;
+    return 0;
 }
 
 // The following interrupt handler functions override the default handlers,
@@ -471,24 +782,55 @@ int32_t ttys_tx_idle(enum ttys_instance_id instance_id)
 #if CONFIG_TTYS_1_PRESENT
 void USART1_IRQHandler(void)
 {
+    ISTAT_EXEC_BEGIN(ISTAT_ID_USART1);
     ttys_interrupt(TTYS_INSTANCE_1, USART1_IRQn);
+    ISTAT_EXEC_END(ISTAT_ID_USART1);
 }
 #endif
 
 #if CONFIG_TTYS_2_PRESENT
 void USART2_IRQHandler(void)
 {
+    ISTAT_EXEC_BEGIN(ISTAT_ID_USART2);
     ttys_interrupt(TTYS_INSTANCE_2, USART2_IRQn);
+    ISTAT_EXEC_END(ISTAT_ID_USART2);
 }
 #endif
 
 #if CONFIG_TTYS_6_PRESENT
 void USART6_IRQHandler(void)
 {
+    ISTAT_EXEC_BEGIN(ISTAT_ID_USART6);
     ttys_interrupt(TTYS_INSTANCE_6, USART6_IRQn);
+    ISTAT_EXEC_END(ISTAT_ID_USART6);
+}
+#endif
+
+#if CONFIG_DMA_TYPE == 1
+
+#if CONFIG_TTYS_1_PRESENT
+void DMA2_Stream7_IRQHandler(void)
+{
+    dma_tx_interrupt(TTYS_INSTANCE_1);
 }
 #endif
 
+#if CONFIG_TTYS_2_PRESENT
+void DMA1_Stream6_IRQHandler(void)
+{
+    dma_tx_interrupt(TTYS_INSTANCE_2);
+}
+#endif
+
+#if CONFIG_TTYS_6_PRESENT
+void DMA2_Stream6_IRQHandler(void)
+{
+    dma_tx_interrupt(TTYS_INSTANCE_6);
+}
+#endif
+
+#endif // CONFIG_DMA_TYPE == 1
+
 #if CONFIG_FAULT_PRESENT
 
 /*
@@ -502,6 +844,26 @@ void USART6_IRQHandler(void)
  * @note It is assumed interrupts are disabled.
  */
 int32_t ttys_putc_panic(enum ttys_instance_id instance_id, char c)
+{
+    return ttys_write_panic(instance_id, &c, 1);
+}
+
+/*
+ * @brief Write characters for transmission in panic mode.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[in] buf Characters to transmit.
+ * @param[in] len Number of characters.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * @note It is assumed interrupts are disabled.
+ *
+ * The UART is polled, and each character is written as soon as the data
+ * register is empty, so a whole line goes out back to back.
+ */
+int32_t ttys_write_panic(enum ttys_instance_id instance_id, const char* buf,
+                         uint32_t len)
 {
     int rc;
     USART_TypeDef* uart_reg_base;
@@ -522,8 +884,14 @@ int32_t ttys_putc_panic(enum ttys_instance_id instance_id, char c)
     if (uart_reg_base == NULL)
         // This should not happen.
         return MOD_ERR_INTERNAL;
-    while (!(uart_reg_base->STATUS_REG & TXE_BIT_MASK));
-    uart_reg_base->DATA_TX_REG = c;
+#if CONFIG_DMA_TYPE == 1
+    // Stop any DMA transfer from competing for the data register.
+    LL_USART_DisableDMAReq_TX(uart_reg_base);
+#endif
+    for (; len > 0; len--) {
+        while (!(uart_reg_base->STATUS_REG & TXE_BIT_MASK));
+        uart_reg_base->DATA_TX_REG = *buf++;
+    }
     while (!(uart_reg_base->STATUS_REG & TXE_BIT_MASK));
     return 0;
 }
@@ -548,11 +916,16 @@ static void ttys_interrupt(enum ttys_instance_id instance_id,
 {
     struct ttys_state* st;
     uint8_t sr;
+    uint32_t idx;
     CRIT_STATE_VAR;
 
     if (instance_id >= TTYS_NUM_INSTANCES)
         return;
 
+#if CONFIG_FAULT_PRESENT
+    fault_stack_sample();
+#endif
+
     st = &ttys_states[instance_id];
 
     // If instance is not open, we should not get an interrupt, but for safety
@@ -565,38 +938,53 @@ static void ttys_interrupt(enum ttys_instance_id instance_id,
     sr = st->uart_reg_base->STATUS_REG;
 
     CRIT_BEGIN_NEST();
-    if (sr & RXNE_BIT_MASK) {
+    if ((sr & RXNE_BIT_MASK) && !st->cfg.use_dma) {
         // Got an incoming character.
-        uint16_t next_rx_put_idx = st->rx_buf_put_idx + 1;
-        if (next_rx_put_idx >= TTYS_RX_BUF_SIZE)
-            next_rx_put_idx = 0;
-        if (next_rx_put_idx == st->rx_buf_get_idx) {
+        if (ring_put_peek(&st->rx_ring, &idx) == 0) {
             // Need to read DR.
             INC_SAT_U16(cnts_u16[CNT_RX_BUF_OVERRUN]);
         } else {
-            st->rx_buf[st->rx_buf_put_idx] = st->uart_reg_base->DATA_RX_REG;
-            st->rx_buf_put_idx = next_rx_put_idx;
+            st->rx_buf[idx] = st->uart_reg_base->DATA_RX_REG;
+            ring_put_commit(&st->rx_ring, 1);
+
+            // When waking on idle, also wake the client if a long burst has
+            // filled half the buffer, so it is not overrun.
+            if (!st->cfg.rx_wake_on_idle ||
+                ring_count(&st->rx_ring) == ring_size(&st->rx_ring) / 2)
+                sched_post(st->rx_task_id);
         }
     }
-    if (sr & TXE_BIT_MASK) {
+    if ((sr & TXE_BIT_MASK) && !st->cfg.use_dma) {
         // Can send a character.
-        if (st->tx_buf_get_idx == st->tx_buf_put_idx) {
+        if (ring_get_peek(&st->tx_ring, &idx) == 0) {
             // No characters to send, disable the interrrupt.
             LL_USART_DisableIT_TXE(st->uart_reg_base);
         } else {
-            st->uart_reg_base->DATA_TX_REG = st->tx_buf[st->tx_buf_get_idx];
-            if (st->tx_buf_get_idx < TTYS_TX_BUF_SIZE-1)
-                st->tx_buf_get_idx++;
-            else
-                st->tx_buf_get_idx = 0;
+            st->uart_reg_base->DATA_TX_REG = st->tx_buf[idx];
+            ring_get_commit(&st->tx_ring, 1);
         }
     }
+    if ((sr & IDLE_BIT_MASK) && st->cfg.rx_wake_on_idle) {
+        // The line went idle after a burst of characters.
+
+#if CONFIG_USART_TYPE == 1
+        // The flag is cleared by reading the status register (done above)
+        // then the data register. The last character was already read above,
+        // or by DMA, so this does not lose data.
+        (void)st->uart_reg_base->DR;
+#elif (CONFIG_USART_TYPE == 2 || CONFIG_USART_TYPE == 3)
+        st->uart_reg_base->ICR = LL_USART_ICR_IDLECF;
+#endif
+        sched_post(st->rx_task_id);
+    }
 
     if (sr & (ORE_BIT_MASK | NE_BIT_MASK | FE_BIT_MASK | PE_BIT_MASK)) {
         // Error bits(s) detected. First clear them out.
 
 #if CONFIG_USART_TYPE == 1
-        // Just reading the data register clears the error bits.
+        // Just reading the data register clears the error bits. In DMA mode
+        // this can cost a received character, which is acceptable as there
+        // was an error anyway.
         (void)st->uart_reg_base->DR;
 #elif (CONFIG_USART_TYPE == 2 || CONFIG_USART_TYPE == 3)
         // Writing the error bits to the ICR clears them.
@@ -668,6 +1056,327 @@ static int32_t get_instance_info(enum ttys_instance_id instance_id,
     return 0;
 }
 
+/*
+ * @brief Ensure transmission of TX buffer data is in progress.
+ *
+ * @param[in] st Instance state.
+ *
+ * @note Must be called with interrupts disabled.
+ */
+static void tx_kick(struct ttys_state* st)
+{
+    if (st->uart_reg_base == NULL)
+        return;
+
+#if CONFIG_DMA_TYPE == 1
+    if (st->cfg.use_dma) {
+        if (!st->dma_tx_busy && st->dma_reg_base != NULL)
+            dma_tx_next(st);
+        return;
+    }
+#endif
+    LL_USART_EnableIT_TXE(st->uart_reg_base);
+}
+
+/*
+ * @brief Update the RX ring put index in DMA mode.
+ *
+ * @param[in] st Instance state.
+ *
+ * In DMA mode, the DMA controller is the producer of the RX ring, and the put
+ * index is derived from the DMA transfer counter. This is done by the consumer
+ * before it looks at the ring. Otherwise, this function does nothing.
+ */
+static void rx_dma_update(struct ttys_state* st)
+{
+#if CONFIG_DMA_TYPE == 1
+    if (st->cfg.use_dma && st->dma_reg_base != NULL) {
+        uint32_t put_idx = ring_size(&st->rx_ring) -
+            LL_DMA_GetDataLength(st->dma_reg_base, st->dma_rx_stream);
+        ring_put_commit(&st->rx_ring, put_idx - st->rx_ring.put_idx);
+    }
+#endif
+}
+
+#if CONFIG_BENCH_PRESENT
+
+/*
+ * @brief Benchmark for the TX/RX buffer put/get.
+ *
+ * @param[in] num_ops Number of operations.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * Each operation is a ttys_putc() and a ttys_getc(). An instance that has not
+ * been initialized is used, so there is no UART to start transmission. The TX
+ * buffer is emptied and the RX buffer is filled directly, as the interrupt
+ * handler would do.
+ */
+static int32_t bench_ring(uint32_t num_ops)
+{
+    struct ttys_state* st;
+    enum ttys_instance_id instance_id;
+    uint32_t idx;
+    uint32_t put_idx;
+    char c;
+
+    for (instance_id = 0; instance_id < TTYS_NUM_INSTANCES; instance_id++) {
+        if (ttys_states[instance_id].uart_reg_base == NULL &&
+            ttys_states[instance_id].tx_buf != NULL)
+            break;
+    }
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return MOD_ERR_UNAVAIL;
+    st = &ttys_states[instance_id];
+
+    for (idx = 0; idx < num_ops; idx++) {
+        ttys_putc(instance_id, 'x');
+        ring_get_commit(&st->tx_ring, ring_count(&st->tx_ring));
+
+        ring_put_peek(&st->rx_ring, &put_idx);
+        st->rx_buf[put_idx] = 'x';
+        ring_put_commit(&st->rx_ring, 1);
+        ttys_getc(instance_id, &c);
+    }
+    return 0;
+}
+
+#endif
+
+#if CONFIG_DMA_TYPE == 1
+
+/*
+ * @brief Clear all interrupt flags for a DMA stream.
+ *
+ * @param[in] dma DMA controller.
+ * @param[in] stream DMA stream (LL_DMA_STREAM_x).
+ */
+static void dma_clear_flags(DMA_TypeDef* dma, uint32_t stream)
+{
+    uint32_t mask = DMA_ALL_FLAGS_MASK << dma_flag_shift[stream & 3];
+    if (stream < LL_DMA_STREAM_4)
+        dma->LIFCR = mask;
+    else
+        dma->HIFCR = mask;
+}
+
+/*
+ * @brief Get the interrupt flags for a DMA stream.
+ *
+ * @param[in] dma DMA controller.
+ * @param[in] stream DMA stream (LL_DMA_STREAM_x).
+ *
+ * @return The flags, shifted down so DMA_xxx_MASK values can be used.
+ */
+static uint32_t dma_get_flags(DMA_TypeDef* dma, uint32_t stream)
+{
+    uint32_t isr = stream < LL_DMA_STREAM_4 ? dma->LISR : dma->HISR;
+    return (isr >> dma_flag_shift[stream & 3]) & DMA_ALL_FLAGS_MASK;
+}
+
+/*
+ * @brief Set up and start DMA for an instance.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The RX stream is started in circular mode over the whole RX buffer. The TX
+ * stream is configured, and started if there is already data in the TX buffer
+ * (e.g. from output before the module was started).
+ */
+static int32_t dma_start(enum ttys_instance_id instance_id)
+{
+    struct ttys_state* st = &ttys_states[instance_id];
+    DMA_TypeDef* dma;
+    uint32_t tx_stream;
+    uint32_t rx_stream;
+    uint32_t channel;
+    IRQn_Type tx_irq_type;
+    int32_t rc;
+    CRIT_STATE_VAR;
+
+    rc = get_dma_info(instance_id, &dma, &tx_stream, &rx_stream, &channel,
+                      &tx_irq_type);
+    if (rc != 0)
+        return rc;
+
+    if (dma == DMA1)
+        LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+    else
+        LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA2);
+
+    // RX: circular transfer into the RX buffer.
+    LL_DMA_DisableStream(dma, rx_stream);
+    while (LL_DMA_IsEnabledStream(dma, rx_stream));
+    dma_clear_flags(dma, rx_stream);
+    LL_DMA_SetChannelSelection(dma, rx_stream, channel);
+    LL_DMA_ConfigTransfer(dma, rx_stream,
+                          LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
+                          LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_CIRCULAR |
+                          LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                          LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_SetPeriphAddress(dma, rx_stream,
+                            (uint32_t)&st->uart_reg_base->DATA_RX_REG);
+    LL_DMA_SetMemoryAddress(dma, rx_stream, (uint32_t)st->rx_buf);
+    LL_DMA_SetDataLength(dma, rx_stream, ring_size(&st->rx_ring));
+    ring_init(&st->rx_ring, ring_size(&st->rx_ring));
+    LL_DMA_EnableStream(dma, rx_stream);
+    LL_USART_EnableDMAReq_RX(st->uart_reg_base);
+
+    // TX: a normal transfer for each contiguous chunk of the TX buffer.
+    LL_DMA_DisableStream(dma, tx_stream);
+    while (LL_DMA_IsEnabledStream(dma, tx_stream));
+    dma_clear_flags(dma, tx_stream);
+    LL_DMA_SetChannelSelection(dma, tx_stream, channel);
+    LL_DMA_ConfigTransfer(dma, tx_stream,
+                          LL_DMA_DIRECTION_MEMORY_TO_PERIPH |
+                          LL_DMA_PRIORITY_LOW | LL_DMA_MODE_NORMAL |
+                          LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                          LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_SetPeriphAddress(dma, tx_stream,
+                            (uint32_t)&st->uart_reg_base->DATA_TX_REG);
+    LL_DMA_EnableIT_TC(dma, tx_stream);
+    LL_DMA_EnableIT_TE(dma, tx_stream);
+    LL_USART_EnableDMAReq_TX(st->uart_reg_base);
+
+    // The UART interrupt is still used for error reporting.
+    LL_USART_EnableIT_ERROR(st->uart_reg_base);
+
+    // Same priority as the UART interrupt, which shares the instance state.
+    NVIC_SetPriority(tx_irq_type,
+                     NVIC_EncodePriority(NVIC_GetPriorityGrouping(),
+                                         OS_POST_IRQ_PRIO, 0));
+    NVIC_EnableIRQ(tx_irq_type);
+
+    CRIT_BEGIN_NEST();
+    st->dma_tx_stream = tx_stream;
+    st->dma_rx_stream = rx_stream;
+    st->dma_tx_busy = false;
+    st->dma_reg_base = dma;
+    dma_tx_next(st);
+    CRIT_END_NEST();
+    return 0;
+}
+
+/*
+ * @brief Start a DMA transfer for the next contiguous chunk of TX data.
+ *
+ * @param[in] st Instance state.
+ *
+ * @note Must be called with interrupts disabled, and with no TX DMA transfer
+ *       in progress.
+ */
+static void dma_tx_next(struct ttys_state* st)
+{
+    uint32_t get_idx;
+
+    // Transfer up to the put index, or the end of the buffer if the data
+    // wraps. In the latter case, the rest is sent by the next transfer.
+    st->dma_tx_len = ring_get_peek(&st->tx_ring, &get_idx);
+    if (st->dma_tx_len == 0) {
+        st->dma_tx_busy = false;
+        return;
+    }
+    dma_clear_flags(st->dma_reg_base, st->dma_tx_stream);
+    LL_DMA_SetMemoryAddress(st->dma_reg_base, st->dma_tx_stream,
+                            (uint32_t)&st->tx_buf[get_idx]);
+    LL_DMA_SetDataLength(st->dma_reg_base, st->dma_tx_stream, st->dma_tx_len);
+    st->dma_tx_busy = true;
+    LL_DMA_EnableStream(st->dma_reg_base, st->dma_tx_stream);
+}
+
+/*
+ * @brief DMA TX stream interrupt handler.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ */
+static void dma_tx_interrupt(enum ttys_instance_id instance_id)
+{
+    struct ttys_state* st;
+    uint32_t flags;
+    CRIT_STATE_VAR;
+
+    if (instance_id >= TTYS_NUM_INSTANCES)
+        return;
+    st = &ttys_states[instance_id];
+    if (st->dma_reg_base == NULL)
+        return;
+
+    CRIT_BEGIN_NEST();
+    flags = dma_get_flags(st->dma_reg_base, st->dma_tx_stream);
+    dma_clear_flags(st->dma_reg_base, st->dma_tx_stream);
+    if (flags & DMA_TEIF_MASK)
+        INC_SAT_U16(cnts_u16[CNT_DMA_ERR]);
+    if (st->dma_tx_busy && (flags & (DMA_TCIF_MASK | DMA_TEIF_MASK))) {
+        // Consider the chunk sent, even on error, so we don't get stuck.
+        ring_get_commit(&st->tx_ring, st->dma_tx_len);
+        st->dma_tx_busy = false;
+        dma_tx_next(st);
+    }
+    CRIT_END_NEST();
+}
+
+/*
+ * @brief Get DMA resources for an instance.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[out] p_dma_reg_base DMA controller.
+ * @param[out] p_tx_stream TX DMA stream.
+ * @param[out] p_rx_stream RX DMA stream.
+ * @param[out] p_channel DMA channel (request) selection for both streams.
+ * @param[out] p_tx_irq_type TX DMA stream IRQ.
+ *
+ * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * The stream/channel assignments are from the MCU reference manual DMA request
+ * mapping tables.
+ */
+static int32_t get_dma_info(enum ttys_instance_id instance_id,
+                            DMA_TypeDef** p_dma_reg_base,
+                            uint32_t* p_tx_stream, uint32_t* p_rx_stream,
+                            uint32_t* p_channel, IRQn_Type* p_tx_irq_type)
+{
+    switch (instance_id) {
+
+#if CONFIG_TTYS_1_PRESENT
+        case TTYS_INSTANCE_1:
+            *p_dma_reg_base = DMA2;
+            *p_tx_stream = LL_DMA_STREAM_7;
+            *p_rx_stream = LL_DMA_STREAM_2;
+            *p_channel = LL_DMA_CHANNEL_4;
+            *p_tx_irq_type = DMA2_Stream7_IRQn;
+            break;
+#endif
+
+#if CONFIG_TTYS_2_PRESENT
+        case TTYS_INSTANCE_2:
+            *p_dma_reg_base = DMA1;
+            *p_tx_stream = LL_DMA_STREAM_6;
+            *p_rx_stream = LL_DMA_STREAM_5;
+            *p_channel = LL_DMA_CHANNEL_4;
+            *p_tx_irq_type = DMA1_Stream6_IRQn;
+            break;
+#endif
+
+#if CONFIG_TTYS_6_PRESENT
+        case TTYS_INSTANCE_6:
+            *p_dma_reg_base = DMA2;
+            *p_tx_stream = LL_DMA_STREAM_6;
+            *p_rx_stream = LL_DMA_STREAM_1;
+            *p_channel = LL_DMA_CHANNEL_5;
+            *p_tx_irq_type = DMA2_Stream6_IRQn;
+            break;
+#endif
+
+        default:
+            return MOD_ERR_BAD_INSTANCE;
+    }
+    return 0;
+}
+
+#endif // CONFIG_DMA_TYPE == 1
+
 /*
  * @brief Console command function for "ttys status".
  *
@@ -688,12 +1397,19 @@ static int32_t cmd_ttys_status(int32_t argc, const char** argv)
         if (st->uart_reg_base == NULL) {
             printc("  NULL\n");
         } else {
-            printc("  TX buffer: get_idx=%u put_idx=%u\n",
-                   st->tx_buf_get_idx, st->tx_buf_put_idx);
-            printc("  RX buffer: get_idx=%u put_idx=%d\n",
-                   st->rx_buf_get_idx, st->rx_buf_put_idx);
+            printc("  Mode: %s%s\n", st->cfg.use_dma ? "dma" : "interrupt",
+                   st->cfg.rx_wake_on_idle ? ", rx wake on idle" : "");
+            printc("  TX buffer: size=%lu get_idx=%u put_idx=%u\n",
+                   ring_size(&st->tx_ring), st->tx_ring.get_idx,
+                   st->tx_ring.put_idx);
+            printc("  RX buffer: size=%lu get_idx=%u put_idx=%u\n",
+                   ring_size(&st->rx_ring), st->rx_ring.get_idx,
+                   st->rx_ring.put_idx);
+            printc("  Stream: %s\n", st->stream == NULL ? "none" :
+                   st->cfg.create_stream ? "active" : "unused");
         }
     }
+    printc("Streams: %u of %u\n", num_streams, CONFIG_TTYS_MAX_STREAMS);
     return 0;
 }
 
@@ -849,7 +1565,6 @@ static enum ttys_instance_id fd_to_instance(int fd)
  */
 int _write(int file, char* ptr, int len)
 {
-    int idx;
     enum ttys_instance_id instance_id = fd_to_instance(file);
 
     if (instance_id >= TTYS_NUM_INSTANCES) {
@@ -857,13 +1572,7 @@ int _write(int file, char* ptr, int len)
         return -1;
     }
 
-    for (idx = 0; idx < len; idx++) {
-        char c = *ptr++;
-        ttys_putc(instance_id, c);
-        if (c == '\n' && ttys_states[instance_id].cfg.send_cr_after_nl) {
-            ttys_putc(instance_id, '\r');
-        }
-    }
+    write_crlf(instance_id, ptr, len);
     return len;
 }
 
@@ -880,24 +1589,101 @@ int _write(int file, char* ptr, int len)
  */
 int _read(int file, char* ptr, int len)
 {
-    int rc = 0;
-    char c;
+    int rc;
+    struct ttys_state* st;
     enum ttys_instance_id instance_id = fd_to_instance(file);
 
-    if (instance_id >= TTYS_NUM_INSTANCES) {
+    if (instance_id >= TTYS_NUM_INSTANCES ||
+        ttys_states[instance_id].rx_buf == NULL) {
         errno = EBADF;
         return -1;
     }
 
-    if (ttys_states[instance_id].rx_buf_get_idx ==
-        ttys_states[instance_id].rx_buf_put_idx) {
+    st = &ttys_states[instance_id];
+    rx_dma_update(st);
+    rc = ring_get(&st->rx_ring, st->rx_buf, 1, ptr, len);
+    if (rc == 0) {
         errno = EAGAIN;
         rc = -1;
-    } else {
-        while (rc < len && ttys_getc(instance_id, &c)) {
-            *ptr++ = c;
-            rc++;
+    }
+    return rc;
+}
+
+/*
+ * @brief Write characters to the TX buffer, adding a CR after each NL if
+ *        configured.
+ *
+ * @param[in] instance_id Identifies the ttys instance.
+ * @param[in] ptr Data to be written.
+ * @param[in] len Length of data.
+ */
+static void write_crlf(enum ttys_instance_id instance_id, const char* ptr,
+                       uint32_t len)
+{
+    uint32_t idx;
+    uint32_t seg_len;
+
+    if (!ttys_states[instance_id].cfg.send_cr_after_nl) {
+        ttys_write(instance_id, ptr, len);
+        return;
+    }
+
+    // Write the data in blocks, each ending with a newline, adding a CR after
+    // each newline.
+    seg_len = 0;
+    for (idx = 0; idx < len; idx++) {
+        seg_len++;
+        if (ptr[idx] == '\n') {
+            ttys_write(instance_id, &ptr[idx + 1 - seg_len], seg_len);
+            ttys_write(instance_id, "\r", 1);
+            seg_len = 0;
         }
     }
+    if (seg_len > 0)
+        ttys_write(instance_id, &ptr[len - seg_len], seg_len);
+}
+
+/*
+ * @brief Read function for the ttys FILE streams (see fopencookie()).
+ *
+ * @param[in] cookie The instance ID.
+ * @param[out] buf Location of buffer to place characters.
+ * @param[in] size Length of buffer.
+ *
+ * @return Number of characters read, or -1 for error.
+ *
+ * @note Non-blocking, as for _read().
+ */
+static ssize_t stream_read(void* cookie, char* buf, size_t size)
+{
+    struct ttys_state* st =
+        &ttys_states[(enum ttys_instance_id)(intptr_t)cookie];
+    ssize_t rc;
+
+    rx_dma_update(st);
+    rc = ring_get(&st->rx_ring, st->rx_buf, 1, buf, size);
+    if (rc == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
     return rc;
 }
+
+/*
+ * @brief Write function for the ttys FILE streams (see fopencookie()).
+ *
+ * @param[in] cookie The instance ID.
+ * @param[in] buf Data to be written.
+ * @param[in] size Length of data.
+ *
+ * @return Number of characters written.
+ *
+ * This is called when stdio flushes the stream buffer, normally once per
+ * line. As for _write(), characters dropped due to TX buffer overrun are not
+ * reflected in the return value.
+ */
+static ssize_t stream_write(void* cookie, const char* buf, size_t size)
+{
+    write_crlf((enum ttys_instance_id)(intptr_t)cookie, buf, size);
+    return size;
+}
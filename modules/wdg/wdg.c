@@ -5,8 +5,16 @@
  * of software-based watchdogs. A hardware-based watchdog is used to verify the
  * software-based watchdogs are operating correctly.
  *
+ * The registered software-based watchdogs are kept in deadline order, so the
+ * periodic check only needs to look at the nearest deadline. A feed moves the
+ * watchdog to its new place in the order.
+ *
+ * For tuning the periods, each watchdog records the minimum slack (time left
+ * before the deadline when fed), and a histogram of feed intervals as a
+ * fraction of the period. These are shown by "wdg status".
+ *
  * The following console commands are provided:
- * > wdg status
+ * > wdg status [clear]
  * > wdg test
  * See code for details.
  *
@@ -51,6 +59,14 @@
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+// Number of feed interval histogram buckets. Bucket N counts intervals of
+// N/WDG_HIST_BUCKETS to (N+1)/WDG_HIST_BUCKETS of the period, except the last
+// bucket also counts longer intervals.
+#define WDG_HIST_BUCKETS 8
+
+// Compare times, allowing for wrap.
+#define TIME_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -59,12 +75,21 @@ struct soft_wdg
 {
     uint32_t period_ms;
     uint32_t last_feed_time_ms;
+    uint32_t deadline_ms;
+
+    // Statistics.
+    int32_t min_slack_ms;
+    uint16_t hist[WDG_HIST_BUCKETS];
 };
 
 struct wdg_state
 {
     struct soft_wdg soft_wdgs[CONFIG_WDG_NUM_WDGS];
     wdg_triggered_cb triggered_cb;
+
+    // IDs of registered watchdogs, in deadline order.
+    uint8_t order[CONFIG_WDG_NUM_WDGS];
+    uint32_t num_registered;
 };
 
 struct wdg_no_init_vars {
@@ -80,6 +105,9 @@ struct wdg_no_init_vars {
 ////////////////////////////////////////////////////////////////////////////////
 
 static enum tmr_cb_action wdg_tmr_cb(int32_t tmr_id, uint32_t user_data);
+static void order_remove(uint32_t wdg_id);
+static void order_insert(uint32_t wdg_id);
+static void clear_stats(struct soft_wdg* soft_wdg);
 static void validate_no_init_vars(void);
 static void update_no_init_vars(void);
 static int32_t cmd_wdg_status(int32_t argc, const char** argv);
@@ -98,7 +126,7 @@ static struct cmd_cmd_info cmds[] = {
     {
         .name = "status",
         .func = cmd_wdg_status,
-        .help = "Get module status, usage: wdg status",
+        .help = "Get module status, usage: wdg status [clear]",
     },
     {
         .name = "test",
@@ -141,7 +169,11 @@ struct wdg_no_init_vars no_init_vars __attribute__((section (".no.init.vars")));
  */
 int32_t wdg_init(struct wdg_cfg* cfg)
 {
+    uint32_t idx;
+
     memset(&state, 0, sizeof(state));
+    for (idx = 0; idx < CONFIG_WDG_NUM_WDGS; idx++)
+        clear_stats(&state.soft_wdgs[idx]);
     return 0;
 }
 
@@ -177,20 +209,28 @@ exit:
  * @brief Client registration.
  *
  * @param[in] wdg_id The sofware-based watchdog ID.
- * @param[in] period_ms The watchdog timeout period.
+ * @param[in] period_ms The watchdog timeout period (0 to unregister).
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
  */
 int32_t wdg_register(uint32_t wdg_id, uint32_t period_ms)
 {
     struct soft_wdg* soft_wdg;
+    CRIT_STATE_VAR;
 
     if (wdg_id >= CONFIG_WDG_NUM_WDGS)
         return MOD_ERR_ARG;
 
     soft_wdg = &state.soft_wdgs[wdg_id];
+    CRIT_BEGIN_NEST();
+    order_remove(wdg_id);
     soft_wdg->last_feed_time_ms = tmr_get_ms();
     soft_wdg->period_ms = period_ms;
+    soft_wdg->deadline_ms = soft_wdg->last_feed_time_ms + period_ms;
+    clear_stats(soft_wdg);
+    if (period_ms != 0)
+        order_insert(wdg_id);
+    CRIT_END_NEST();
 
     return 0;
 }
@@ -201,12 +241,42 @@ int32_t wdg_register(uint32_t wdg_id, uint32_t period_ms)
  * @param[in] wdg_id The sofware-based watchdog ID.
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
+ *
+ * This can be called from an interrupt handler.
  */
 int32_t wdg_feed(uint32_t wdg_id)
 {
+    struct soft_wdg* soft_wdg;
+    uint32_t now_ms;
+    uint32_t interval_ms;
+    uint32_t bucket;
+    int32_t slack_ms;
+    CRIT_STATE_VAR;
+
     if (wdg_id >= CONFIG_WDG_NUM_WDGS)
         return MOD_ERR_ARG;
-    state.soft_wdgs[wdg_id].last_feed_time_ms = tmr_get_ms();
+
+    soft_wdg = &state.soft_wdgs[wdg_id];
+    CRIT_BEGIN_NEST();
+    now_ms = tmr_get_ms();
+    if (soft_wdg->period_ms != 0) {
+        interval_ms = now_ms - soft_wdg->last_feed_time_ms;
+        slack_ms = (int32_t)(soft_wdg->deadline_ms - now_ms);
+        if (slack_ms < soft_wdg->min_slack_ms)
+            soft_wdg->min_slack_ms = slack_ms;
+        if (interval_ms >= soft_wdg->period_ms)
+            bucket = WDG_HIST_BUCKETS - 1;
+        else
+            bucket = interval_ms * WDG_HIST_BUCKETS / soft_wdg->period_ms;
+        INC_SAT_U16(soft_wdg->hist[bucket]);
+
+        // The new deadline is likely the latest, so search from the end.
+        order_remove(wdg_id);
+        soft_wdg->deadline_ms = now_ms + soft_wdg->period_ms;
+        order_insert(wdg_id);
+    }
+    soft_wdg->last_feed_time_ms = now_ms;
+    CRIT_END_NEST();
     return 0;
 }
 
@@ -358,32 +428,36 @@ void wdg_feed_hdw(void)
 static enum tmr_cb_action wdg_tmr_cb(int32_t tmr_id,
                                      uint32_t user_data)
 {
-    int32_t idx;
-    struct soft_wdg* soft_wdg;
+    uint32_t pos;
+    uint32_t wdg_id;
+    uint32_t now_ms;
+    bool expired;
     bool wdg_triggered = false;
+    CRIT_STATE_VAR;
 
     if (test_cmd_disable_wdg) {
         wdg_feed_hdw();
         goto exit;
     }
 
-    for (idx = 0, soft_wdg = &state.soft_wdgs[0];
-         idx < CONFIG_WDG_NUM_WDGS;
-         idx++, soft_wdg++)
-    {
-        if (soft_wdg->period_ms != 0) {
-
-            // We have to careful with race conditions, especially for
-            // watchdogs fed from interrupt handlers.
-
-            uint32_t last_feed_time_ms = soft_wdg->last_feed_time_ms;
-            if (tmr_get_ms() - last_feed_time_ms > soft_wdg->period_ms) {
-                wdg_triggered = true;
-                if (state.triggered_cb != NULL) {
-                    // This function will normally not return.
-                    state.triggered_cb(idx);
-                }
-            }
+    // Only the watchdogs at the start of the deadline order can have expired.
+    // We have to careful with race conditions, especially for watchdogs fed
+    // from interrupt handlers, so the order is read in a critical region.
+    now_ms = tmr_get_ms();
+    for (pos = 0; ; pos++) {
+        CRIT_BEGIN_NEST();
+        expired = false;
+        if (pos < state.num_registered) {
+            wdg_id = state.order[pos];
+            expired = TIME_BEFORE(state.soft_wdgs[wdg_id].deadline_ms, now_ms);
+        }
+        CRIT_END_NEST();
+        if (!expired)
+            break;
+        wdg_triggered = true;
+        if (state.triggered_cb != NULL) {
+            // This function will normally not return.
+            state.triggered_cb(wdg_id);
         }
     }
 
@@ -396,6 +470,63 @@ exit:
     return TMR_CB_RESTART;
 }
 
+/*
+ * @brief Remove a watchdog from the deadline order, if present.
+ *
+ * @param[in] wdg_id The sofware-based watchdog ID.
+ *
+ * @note Must be called in a critical region.
+ */
+static void order_remove(uint32_t wdg_id)
+{
+    uint32_t pos;
+
+    for (pos = 0; pos < state.num_registered; pos++) {
+        if (state.order[pos] == wdg_id) {
+            state.num_registered--;
+            memmove(&state.order[pos], &state.order[pos + 1],
+                    state.num_registered - pos);
+            return;
+        }
+    }
+}
+
+/*
+ * @brief Insert a watchdog in the deadline order.
+ *
+ * @param[in] wdg_id The sofware-based watchdog ID (not already present).
+ *
+ * @note Must be called in a critical region.
+ *
+ * The search is from the end, as a newly fed watchdog usually has the latest
+ * deadline.
+ */
+static void order_insert(uint32_t wdg_id)
+{
+    uint32_t deadline_ms = state.soft_wdgs[wdg_id].deadline_ms;
+    uint32_t pos = state.num_registered;
+
+    while (pos > 0 &&
+           TIME_BEFORE(deadline_ms,
+                       state.soft_wdgs[state.order[pos - 1]].deadline_ms)) {
+        state.order[pos] = state.order[pos - 1];
+        pos--;
+    }
+    state.order[pos] = wdg_id;
+    state.num_registered++;
+}
+
+/*
+ * @brief Clear the statistics of a watchdog.
+ *
+ * @param[in] soft_wdg The watchdog.
+ */
+static void clear_stats(struct soft_wdg* soft_wdg)
+{
+    soft_wdg->min_slack_ms = INT32_MAX;
+    memset(soft_wdg->hist, 0, sizeof(soft_wdg->hist));
+}
+
 /*
  * @brief Validate the "no-init-vars" block and initialize if needed.
  */
@@ -446,25 +577,64 @@ static void update_no_init_vars(void)
  *
  * @return 0 for success, else a "MOD_ERR" value. See code for details.
  *
- * Command usage: wdg test [<op> [<arg>]]
+ * Command usage: wdg status [clear]
+ *
+ * MIN_SLACK is the minimum time left before the deadline when fed (blank if
+ * not fed since registration). The histogram columns count feed intervals,
+ * by fraction of the period (e.g. "<25%" is 12.5% to 25%).
  */
 static int32_t cmd_wdg_status(int32_t argc, const char** argv)
 {
     uint32_t id;
+    uint32_t bucket;
+    CRIT_STATE_VAR;
+
+    if (argc == 3 && strcasecmp(argv[2], "clear") == 0) {
+        for (id = 0; id < ARRAY_SIZE(state.soft_wdgs); id++) {
+            CRIT_BEGIN_NEST();
+            clear_stats(&state.soft_wdgs[id]);
+            CRIT_END_NEST();
+        }
+        return 0;
+    } else if (argc != 2) {
+        printc("Invalid command arguments\n");
+        return MOD_ERR_BAD_CMD;
+    }
 
     printc("Current time: %10lu\nWatchdog %s.\n",
            tmr_get_ms(),
            test_cmd_disable_wdg ? "disabled" : "enabled");
     printc("consec_failed_init_ctr=%lu\n", no_init_vars.consec_failed_init_ctr);
 
-    printc("\nID  PERIOD LAST_FEED  ELAPSED\n"
-             "--- ------ ---------- -------\n");
+    printc("\nID  PERIOD LAST_FEED  ELAPSED MIN_SLACK\n"
+             "--- ------ ---------- ------- ---------\n");
     for (id = 0; id < ARRAY_SIZE(state.soft_wdgs); id++) {
         struct soft_wdg* c = &state.soft_wdgs[id];
-        printc("%3lu %6lu %10lu %7ld\n", id, c->period_ms, c->last_feed_time_ms,
+        printc("%3lu %6lu %10lu %7ld", id, c->period_ms, c->last_feed_time_ms,
                tmr_get_ms() - c->last_feed_time_ms);
+        if (c->min_slack_ms != INT32_MAX)
+            printc(" %9ld", c->min_slack_ms);
+        printc("\n");
+    }
+
+    printc("\nFeed interval histogram (%% of period):\nID ");
+    for (bucket = 0; bucket < WDG_HIST_BUCKETS - 1; bucket++)
+        printc("  <%3lu%%", (bucket + 1) * 1000 / WDG_HIST_BUCKETS / 10);
+    printc(" >=%3lu%%\n---", (WDG_HIST_BUCKETS - 1) * 1000 /
+           WDG_HIST_BUCKETS / 10);
+    for (bucket = 0; bucket < WDG_HIST_BUCKETS; bucket++)
+        printc(" ------");
+    printc("\n");
+    for (id = 0; id < ARRAY_SIZE(state.soft_wdgs); id++) {
+        struct soft_wdg* c = &state.soft_wdgs[id];
+        if (c->period_ms == 0)
+            continue;
+        printc("%3lu", id);
+        for (bucket = 0; bucket < WDG_HIST_BUCKETS; bucket++)
+            printc(" %6u", c->hist[bucket]);
+        printc("\n");
     }
-     return 0;
+    return 0;
 }
 
 /*